@@ -201,10 +201,12 @@ void ApacheServerContext::InitProxyFetchFactory() {
 
 ApacheRequestContext* ApacheServerContext::NewApacheRequestContext(
     request_rec* request) {
-  return new ApacheRequestContext(
+  ApacheRequestContext* request_context = new ApacheRequestContext(
       thread_system()->NewMutex(),
       timer(),
       request);
+  MaybeStartRequestTimeline(request->unparsed_uri, request_context);
+  return request_context;
 }
 
 void ApacheServerContext::ReportNotFoundHelper(MessageType message_type,
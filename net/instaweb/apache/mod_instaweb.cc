@@ -160,9 +160,17 @@ const char kModPagespeedNumExpensiveRewriteThreads[] =
     "ModPagespeedNumExpensiveRewriteThreads";
 const char kModPagespeedNumRewriteThreads[] = "ModPagespeedNumRewriteThreads";
 const char kModPagespeedNumShards[] = "ModPagespeedNumShards";
+const char kModPagespeedPersistSharedMemoryMetadataCaches[] =
+    "ModPagespeedPersistSharedMemoryMetadataCaches";
 const char kModPagespeedRetainComment[] = "ModPagespeedRetainComment";
+const char kModPagespeedRewriteThreadWorkStealing[] =
+    "ModPagespeedRewriteThreadWorkStealing";
 const char kModPagespeedRunExperiment[] = "ModPagespeedRunExperiment";
 const char kModPagespeedShardDomain[] = "ModPagespeedShardDomain";
+const char kModPagespeedSharedMemoryCacheAssociativity[] =
+    "ModPagespeedSharedMemoryCacheAssociativity";
+const char kModPagespeedSharedMemoryCacheEvictionPolicy[] =
+    "ModPagespeedSharedMemoryCacheEvictionPolicy";
 const char kModPagespeedSpeedTracking[] = "ModPagespeedIncreaseSpeedTracking";
 const char kModPagespeedStaticAssetPrefix[] = "ModPagespeedStaticAssetPrefix";
 const char kModPagespeedStatisticsLoggingFile[] =
@@ -1700,6 +1708,18 @@ static const command_rec mod_pagespeed_filter_cmds[] = {
         "Number of threads to use for computation-intensive portions of "
         "resource-rewriting. <= 0 to auto-detect"),
   APACHE_CONFIG_OPTION(kModPagespeedNumShards, "No longer used."),
+  APACHE_CONFIG_OPTION(kModPagespeedPersistSharedMemoryMetadataCaches,
+        "Keep shared memory metadata caches in their file cache directories, "
+        "so they survive restarts"),
+  APACHE_CONFIG_OPTION(kModPagespeedRewriteThreadWorkStealing,
+        "Let idle rewrite threads take queued work from busy ones instead "
+        "of sharing one queue per pool"),
+  APACHE_CONFIG_OPTION(kModPagespeedSharedMemoryCacheAssociativity,
+        "Number of entries (1-16) each key may use in shared memory "
+        "metadata caches"),
+  APACHE_CONFIG_OPTION(kModPagespeedSharedMemoryCacheEvictionPolicy,
+        "LRU or LFU: which entry shared memory metadata caches overwrite; "
+        "LFU also keeps out keys looked up less often than that entry"),
   APACHE_CONFIG_OPTION(kModPagespeedStaticAssetPrefix,
          "Where to serve static support files for pagespeed filters from."),
   APACHE_CONFIG_OPTION(kModPagespeedTrackOriginalContentLength,
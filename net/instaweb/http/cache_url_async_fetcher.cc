@@ -66,10 +66,14 @@ class CachePutFetch : public SharedAsyncFetch {
         cacheable_(false),
         cache_value_writer_(&cache_value_, cache_),
         saved_headers_(http_options_),
-        req_properties_(base_fetch->request_headers()->GetProperties()) {
+        req_properties_(base_fetch->request_headers()->GetProperties()),
+        timeline_start_us_(0) {
     if (backend_first_byte_latency_ != NULL) {
       start_time_ms_ = cache_->timer()->NowMs();
     }
+    if (request_context()->timeline() != NULL) {
+      timeline_start_us_ = cache_->timer()->NowUs();
+    }
   }
 
   virtual ~CachePutFetch() {}
@@ -145,6 +149,13 @@ class CachePutFetch : public SharedAsyncFetch {
       log_record()->SetIsOriginalResourceCacheable(false);
     }
 
+    RequestTimeline* timeline = request_context()->timeline();
+    if (timeline != NULL) {
+      timeline->AddSpan("fetch", "origin fetch",
+                        success ? url_ : StrCat(url_, " (failed)"),
+                        timeline_start_us_, cache_->timer()->NowUs());
+    }
+
     // Finish fetch.
     SharedAsyncFetch::HandleDone(success);
     // Note: SharedAsyncFetch::base_fetch_ and other things that refer to that,
@@ -175,6 +186,7 @@ class CachePutFetch : public SharedAsyncFetch {
   int64 start_time_ms_;  // only used if backend_first_byte_latency_ != NULL
   ResponseHeaders saved_headers_;
   RequestHeaders::Properties req_properties_;
+  int64 timeline_start_us_;  // only used if the request has a timeline
 
   DISALLOW_COPY_AND_ASSIGN(CachePutFetch);
 };
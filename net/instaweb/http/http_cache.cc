@@ -23,6 +23,7 @@
 #include "base/logging.h"
 #include "net/instaweb/http/public/http_value.h"
 #include "net/instaweb/http/public/meta_data.h"
+#include "net/instaweb/http/public/request_context.h"
 #include "net/instaweb/http/public/response_headers.h"
 #include "net/instaweb/util/public/basictypes.h"
 #include "net/instaweb/util/public/cache_interface.h"
@@ -250,6 +251,7 @@ class HTTPCacheCallback : public CacheInterface::Callback {
     int64 elapsed_us = std::max(static_cast<int64>(0), now_us - start_us_);
     http_cache_->cache_time_us()->Add(elapsed_us);
     callback_->ReportLatencyMs(elapsed_us/1000);
+    callback_->ReportTimelineSpan(start_us_, now_us, result);
     if (callback_->update_stats_on_failure() ||
         (result == HTTPCache::kFound)) {
       http_cache_->UpdateStats(key_, fragment_, backend_state, result,
@@ -518,11 +520,12 @@ void HTTPCache::DeleteInternal(const GoogleString& key_fragment) {
 }
 
 void HTTPCache::InitStats(Statistics* statistics) {
-  statistics->AddVariable(kCacheTimeUs);
-  statistics->AddVariable(kCacheHits);
-  statistics->AddVariable(kCacheMisses);
-  statistics->AddVariable(kCacheBackendHits);
-  statistics->AddVariable(kCacheBackendMisses);
+  // These are bumped on every lookup.
+  statistics->AddStripedVariable(kCacheTimeUs);
+  statistics->AddStripedVariable(kCacheHits);
+  statistics->AddStripedVariable(kCacheMisses);
+  statistics->AddStripedVariable(kCacheBackendHits);
+  statistics->AddStripedVariable(kCacheBackendMisses);
   statistics->AddVariable(kCacheFallbacks);
   statistics->AddVariable(kCacheExpirations);
   statistics->AddVariable(kCacheInserts);
@@ -556,4 +559,28 @@ void HTTPCache::Callback::ReportLatencyMsImpl(int64 latency_ms) {
   request_context()->mutable_timing_info()->SetHTTPCacheLatencyMs(latency_ms);
 }
 
+void HTTPCache::Callback::ReportTimelineSpan(int64 start_us, int64 end_us,
+                                             FindResult find_result) {
+  RequestTimeline* timeline = (request_context().get() == NULL) ?
+      NULL : request_context()->timeline();
+  if (timeline == NULL) {
+    return;
+  }
+  const char* outcome = "miss";
+  switch (find_result) {
+    case kFound:
+      outcome = "hit";
+      break;
+    case kNotFound:
+      break;
+    case kRecentFetchFailed:
+      outcome = "recent fetch failed";
+      break;
+    case kRecentFetchNotCacheable:
+      outcome = "recent fetch not cacheable";
+      break;
+  }
+  timeline->AddSpan("cache", TimelineName(), outcome, start_us, end_us);
+}
+
 }  // namespace net_instaweb
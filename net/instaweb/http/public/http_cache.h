@@ -150,6 +150,11 @@ class HTTPCache {
     // latency.
     void ReportLatencyMs(int64 latency_ms);
 
+    // Called with the outcome of a lookup that ran from start_us to end_us,
+    // to record it as a span in the request's timeline, if it has one.
+    void ReportTimelineSpan(int64 start_us, int64 end_us,
+                            FindResult find_result);
+
     // Determines whether this Get request was made in the context where
     // arbitrary Vary headers should be respected.
     //
@@ -202,6 +207,10 @@ class HTTPCache {
     // implementation calls RequestContext::TimingInfo::SetHTTPCacheLatencyMs.
     virtual void ReportLatencyMsImpl(int64 latency_ms);
 
+    // The name lookups are recorded under in the request's timeline.
+    // WriteThroughHTTPCache's callbacks override this to tell L1 from L2.
+    virtual const char* TimelineName() const { return "http_cache"; }
+
    private:
     HTTPValue http_value_;
     // Stale value that can be used in case a fetch fails. Note that Find()
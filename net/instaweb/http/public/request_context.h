@@ -24,6 +24,7 @@
 #include "base/logging.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/ref_counted_ptr.h"
+#include "pagespeed/kernel/base/request_timeline.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
@@ -117,6 +118,15 @@ class RequestContext : public RefCounted<RequestContext> {
   // Subclasses should customize this based on their underlying tracing system.
   virtual void ReleaseDependentTraceContext(RequestTrace* t);
 
+  // The timeline of spans recorded for this request, or NULL if the request
+  // was not sampled for tracing; see RequestTimelineStore.  The timeline is
+  // marked finished when this context is destroyed, so it covers any
+  // rewrites that outlive the response.
+  RequestTimeline* timeline() const { return timeline_.get(); }
+  void set_timeline(const RequestTimelinePtr& timeline) {
+    timeline_ = timeline;
+  }
+
   // The log record for the this request, created when the request context is.
   virtual AbstractLogRecord* log_record();
 
@@ -398,6 +408,8 @@ class RequestContext : public RefCounted<RequestContext> {
   // Log for recording background rewritings.
   scoped_ptr<AbstractLogRecord> background_rewrite_log_record_;
 
+  RequestTimelinePtr timeline_;
+
   StringSet session_authorized_fetch_origins_;
 
   bool using_spdy_;
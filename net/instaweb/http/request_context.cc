@@ -89,6 +89,9 @@ RequestContext::~RequestContext() {
   // RequestContexts are reference counted, and doing work in the dtor will
   // result in actions being taken at unpredictable times, leading to difficult
   // to diagnose performance and correctness bugs.
+  if (timeline_.get() != NULL) {
+    timeline_->Finish();
+  }
 }
 
 RequestContextPtr RequestContext::NewTestRequestContextWithTimer(
@@ -103,6 +103,8 @@ class FallbackCacheCallback: public HTTPCache::Callback {
         latency_ms);
   }
 
+  virtual const char* TimelineName() const { return "http_cache_l2"; }
+
  private:
   GoogleString key_;
   GoogleString fragment_;
@@ -165,6 +167,8 @@ class Cache1Callback: public HTTPCache::Callback {
     return client_callback_->IsFresh(headers);
   }
 
+  virtual const char* TimelineName() const { return "http_cache_l1"; }
+
  private:
   GoogleString key_;
   GoogleString fragment_;
@@ -1338,6 +1338,7 @@
         'rewriter/google_font_service_input_resource.cc',
         'rewriter/handle_noscript_redirect_filter.cc',
         'rewriter/image_rewrite_filter.cc',
+        'rewriter/image_rewrite_queue.cc',
         'rewriter/in_place_rewrite_context.cc',
         'rewriter/inline_rewrite_context.cc',
         'rewriter/insert_dns_prefetch_filter.cc',
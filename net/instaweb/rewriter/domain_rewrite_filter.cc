@@ -197,6 +197,10 @@ DomainRewriteFilter::RewriteResult DomainRewriteFilter::Rewrite(
   }
 }
 
+bool DomainRewriteFilter::IsStreamingSafe() const {
+  return !driver()->options()->client_domain_rewrite();
+}
+
 void DomainRewriteFilter::EndDocument() {
   if (!driver()->options()->client_domain_rewrite()) {
     return;
@@ -41,6 +41,7 @@
 #include "pagespeed/kernel/image/image_resizer.h"
 #include "pagespeed/kernel/image/image_util.h"
 #include "pagespeed/kernel/image/jpeg_optimizer.h"
+#include "pagespeed/kernel/image/jpeg_reader.h"
 #include "pagespeed/kernel/image/jpeg_utils.h"
 #include "pagespeed/kernel/image/png_optimizer.h"
 #include "pagespeed/kernel/image/read_image.h"
@@ -72,6 +73,7 @@ using pagespeed::image_compression::ImageConverter;
 using pagespeed::image_compression::ImageFormat;
 using pagespeed::image_compression::ImageFormatToString;
 using pagespeed::image_compression::JpegCompressionOptions;
+using pagespeed::image_compression::JpegScanlineReader;
 using pagespeed::image_compression::JpegScanlineWriter;
 using pagespeed::image_compression::JpegUtils;
 using pagespeed::image_compression::OptimizeJpegWithOptions;
@@ -775,11 +777,30 @@ bool ImageImpl::ResizeTo(const ImageDim& new_dim) {
     return false;
   }
 
-  scoped_ptr<ScanlineReaderInterface> image_reader(
-      CreateScanlineReader(original_format,
-                           original_contents_.data(),
-                           original_contents_.length(),
-                           handler_.get()));
+  scoped_ptr<ScanlineReaderInterface> image_reader;
+  if (original_format == pagespeed::image_compression::IMAGE_JPEG) {
+    // Let libjpeg do as much of the shrinking as it can while decoding, so
+    // the resizer only has to make up the difference.
+    JpegScanlineReader* jpeg_reader = new JpegScanlineReader(handler_.get());
+    image_reader.reset(jpeg_reader);
+    if (!jpeg_reader->Initialize(original_contents_.data(),
+                                 original_contents_.length())) {
+      image_reader.reset(NULL);
+    } else if (!jpeg_reader->ScaleDownTo(new_dim.width(), new_dim.height()) &&
+               !jpeg_reader->HasMoreScanLines()) {
+      // libjpeg failed while scaling and the reader was reset, so start over
+      // and let the resizer do all the shrinking.
+      if (!jpeg_reader->Initialize(original_contents_.data(),
+                                   original_contents_.length())) {
+        image_reader.reset(NULL);
+      }
+    }
+  } else {
+    image_reader.reset(CreateScanlineReader(original_format,
+                                            original_contents_.data(),
+                                            original_contents_.length(),
+                                            handler_.get()));
+  }
   if (image_reader == NULL) {
     resize_debug_message_ = "Cannot resize: Cannot open the image to resize";
     PS_LOG_INFO(handler_, "Cannot open the image to resize.");
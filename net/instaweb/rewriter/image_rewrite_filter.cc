@@ -42,6 +42,7 @@
 #include "net/instaweb/rewriter/public/css_url_encoder.h"
 #include "net/instaweb/rewriter/public/css_util.h"
 #include "net/instaweb/rewriter/public/image.h"
+#include "net/instaweb/rewriter/public/image_rewrite_queue.h"
 #include "net/instaweb/rewriter/public/local_storage_cache_filter.h"
 #include "net/instaweb/rewriter/public/output_resource.h"
 #include "net/instaweb/rewriter/public/output_resource_kind.h"
@@ -52,12 +53,15 @@
 #include "net/instaweb/rewriter/public/resource_tag_scanner.h"
 #include "net/instaweb/rewriter/public/rewrite_context.h"
 #include "net/instaweb/rewriter/public/rewrite_driver.h"
+#include "net/instaweb/rewriter/public/rewrite_driver_factory.h"
 #include "net/instaweb/rewriter/public/rewrite_options.h"
 #include "net/instaweb/rewriter/public/single_rewrite_context.h"
 #include "net/instaweb/util/enums.pb.h"
 #include "net/instaweb/util/public/basictypes.h"
 #include "net/instaweb/util/public/data_url.h"
+#include "net/instaweb/util/public/function.h"
 #include "net/instaweb/util/public/google_url.h"
+#include "net/instaweb/util/public/hasher.h"
 #include "net/instaweb/util/public/message_handler.h"
 #include "net/instaweb/util/public/property_cache.h"
 #include "net/instaweb/util/public/scoped_ptr.h"
@@ -153,6 +157,12 @@ bool ShouldInlinePreview(const int64 low_res_size, const int64 full_res_size,
   return (low_res_is_small && low_res_smaller_than_full_res);
 }
 
+// Image memory is bounded in kilobytes, since UpDownCounter adds ints.
+int BytesToKbytes(int64 bytes) {
+  int64 kbytes = (std::max(static_cast<int64>(0), bytes) + 1023) / 1024;
+  return static_cast<int>(std::min(static_cast<int64>(kint32max), kbytes));
+}
+
 const char* const kRelatedOptions[] = {
   RewriteOptions::kImageJpegNumProgressiveScans,
   RewriteOptions::kImageJpegNumProgressiveScansForSmallScreens,
@@ -160,6 +170,7 @@ const char* const kRelatedOptions[] = {
   RewriteOptions::kImageJpegRecompressionQualityForSmallScreens,
   RewriteOptions::kImageLimitOptimizedPercent,
   RewriteOptions::kImageLimitResizeAreaPercent,
+  RewriteOptions::kImageMaxRewriteBytesAtOnce,
   RewriteOptions::kImageMaxRewritesAtOnce,
   RewriteOptions::kImagePreserveURLs,
   RewriteOptions::kImageRecompressionQuality,
@@ -211,6 +222,10 @@ const char ImageRewriteFilter::kImageRewritesDroppedNoSavingNoResize[] =
     "image_rewrites_dropped_nosaving_noresize";
 const char ImageRewriteFilter::kImageRewritesDroppedDueToLoad[] =
     "image_rewrites_dropped_due_to_load";
+const char ImageRewriteFilter::kImageRewritesDeferredOverMemoryBudget[] =
+    "image_rewrites_deferred_over_memory_budget";
+const char ImageRewriteFilter::kImageRewritesDroppedOverMemoryBudget[] =
+    "image_rewrites_dropped_over_memory_budget";
 const char ImageRewriteFilter::kImageRewritesSquashingForMobileScreen[] =
     "image_rewrites_squashing_for_mobile_screen";
 const char kImageRewriteTotalBytesSaved[] = "image_rewrite_total_bytes_saved";
@@ -220,6 +235,8 @@ const char kImageRewriteUses[] = "image_rewrite_uses";
 const char kImageInline[] = "image_inline";
 const char ImageRewriteFilter::kImageOngoingRewrites[] =
     "image_ongoing_rewrites";
+const char ImageRewriteFilter::kImageOngoingRewriteKbytes[] =
+    "image_ongoing_rewrite_kbytes";
 const char ImageRewriteFilter::kImageResizedUsingRenderedDimensions[] =
     "image_resized_using_rendered_dimensions";
 const char ImageRewriteFilter::kImageWebpRewrites[] = "image_webp_rewrites";
@@ -355,7 +372,8 @@ class ImageRewriteFilter::Context : public SingleRewriteContext {
         html_index_(html_index),
         in_noscript_element_(in_noscript_element),
         is_resized_using_rendered_dimensions_(
-            is_resized_using_rendered_dimensions) {}
+            is_resized_using_rendered_dimensions),
+        deferred_(false) {}
   virtual ~Context() {}
 
   virtual void Render();
@@ -376,12 +394,29 @@ class ImageRewriteFilter::Context : public SingleRewriteContext {
  private:
   friend class ImageRewriteFilter;
 
+  // Called by the ImageRewriteQueue, in any thread, when a slot may have
+  // freed up for a deferred rewrite.
+  void RunDeferred();
+
+  // Retries a deferred rewrite, in the low-priority rewrite thread.
+  void RewriteDeferred();
+
+  // Gives up on a deferred rewrite, leaving the image unoptimized.
+  void GiveUpDeferred();
+
   int64 css_image_inline_max_bytes_;
   ImageRewriteFilter* filter_;
   bool is_css_;
   const int html_index_;
   bool in_noscript_element_;
   bool is_resized_using_rendered_dimensions_;
+
+  // Set once the rewrite has been found too busy to start and queued to run
+  // later.  A deferred rewrite that is still too busy is dropped.
+  bool deferred_;
+  GoogleString deferral_key_;
+  ResourcePtr deferred_input_;
+  OutputResourcePtr deferred_output_;
   DISALLOW_COPY_AND_ASSIGN(Context);
 };
 
@@ -427,9 +462,33 @@ void ImageRewriteFilter::Context::RewriteSingle(
     const OutputResourcePtr& output_resource) {
   bool is_ipro = IsNestedIn(RewriteOptions::kInPlaceRewriteId);
   AttachDependentRequestTrace(is_ipro ? "IproProcessImage" : "ProcessImage");
-  RewriteDone(
-      filter_->RewriteLoadedResourceImpl(this, input_resource, output_resource),
-      0);
+  RewriteResult result =
+      filter_->RewriteLoadedResourceImpl(this, input_resource, output_resource);
+  if (deferred_) {
+    deferred_input_ = input_resource;
+    deferred_output_ = output_resource;
+    // This must come last: once queued, we may be finished off in another
+    // thread.
+    filter_->DeferRewrite(this);
+    return;
+  }
+  RewriteDone(result, 0);
+}
+
+void ImageRewriteFilter::Context::RunDeferred() {
+  Driver()->AddLowPriorityRewriteTask(
+      MakeFunction(this, &Context::RewriteDeferred, &Context::GiveUpDeferred));
+}
+
+void ImageRewriteFilter::Context::RewriteDeferred() {
+  RewriteDone(filter_->RewriteLoadedResourceImpl(this, deferred_input_,
+                                                 deferred_output_),
+              0);
+}
+
+void ImageRewriteFilter::Context::GiveUpDeferred() {
+  filter_->image_rewrites_dropped_due_to_load_->IncBy(1);
+  RewriteDone(kTooBusy, 0);
 }
 
 void ImageRewriteFilter::Context::Render() {
@@ -514,6 +573,10 @@ ImageRewriteFilter::ImageRewriteFilter(RewriteDriver* driver)
       stats->GetVariable(kImageRewritesDroppedNoSavingNoResize);
   image_rewrites_dropped_due_to_load_ =
       stats->GetTimedVariable(kImageRewritesDroppedDueToLoad);
+  image_rewrites_deferred_over_memory_budget_ =
+      stats->GetVariable(kImageRewritesDeferredOverMemoryBudget);
+  image_rewrites_dropped_over_memory_budget_ =
+      stats->GetVariable(kImageRewritesDroppedOverMemoryBudget);
   image_rewrites_squashing_for_mobile_screen_ =
       stats->GetTimedVariable(kImageRewritesSquashingForMobileScreen);
   image_rewrite_total_bytes_saved_ =
@@ -585,6 +648,16 @@ ImageRewriteFilter::ImageRewriteFilter(RewriteDriver* driver)
   work_bound_.reset(
       new StatisticsWorkBound(image_ongoing_rewrites,
                               driver->options()->image_max_rewrites_at_once()));
+  // The memory budget protects this process's heap, so unlike the bound on
+  // the number of rewrites it isn't shared with other processes.
+  UpDownCounter* image_ongoing_rewrite_kbytes =
+      driver->server_context()->factory()->process_local_statistics()->
+      GetUpDownCounter(kImageOngoingRewriteKbytes);
+  memory_bound_.reset(
+      new StatisticsWorkBound(
+          image_ongoing_rewrite_kbytes,
+          BytesToKbytes(
+              driver->options()->image_max_rewrite_bytes_at_once())));
 }
 
 ImageRewriteFilter::~ImageRewriteFilter() {}
@@ -619,8 +692,11 @@ void ImageRewriteFilter::InitStats(Statistics* statistics) {
   // We want image_ongoing_rewrites to be global even if we do per-vhost
   // stats, as it's used for a StatisticsWorkBound.
   statistics->AddGlobalUpDownCounter(kImageOngoingRewrites);
+  statistics->AddVariable(kImageRewritesDeferredOverMemoryBudget);
+  statistics->AddVariable(kImageRewritesDroppedOverMemoryBudget);
   statistics->AddHistogram(kImageRewriteLatencyOkMs);
   statistics->AddHistogram(kImageRewriteLatencyFailedMs);
+  ImageRewriteQueue::InitStats(statistics);
 
   statistics->AddVariable(kImageWebpFromGifTimeouts);
   statistics->AddVariable(kImageWebpFromPngTimeouts);
@@ -643,6 +719,10 @@ void ImageRewriteFilter::InitStats(Statistics* statistics) {
   statistics->AddHistogram(kImageWebpOpaqueFailureMs);
 }
 
+void ImageRewriteFilter::InitProcessLocalStats(Statistics* statistics) {
+  statistics->AddUpDownCounter(kImageOngoingRewriteKbytes);
+}
+
 void ImageRewriteFilter::Initialize() {
   CHECK(related_options_ == NULL);
   related_options_ = new StringPieceVector;
@@ -915,12 +995,21 @@ RewriteResult ImageRewriteFilter::RewriteLoadedResourceImpl(
   ImageDim image_dim;
   image->Dimensions(&image_dim);
   int64 image_width = image_dim.width(), image_height = image_dim.height();
-  if ((image_width*image_height*4) > options->image_resolution_limit_bytes()) {
+  int64 decoded_bytes = image_width * image_height * 4;
+  if (decoded_bytes > options->image_resolution_limit_bytes()) {
     image_rewrites_dropped_intentionally_->Add(1);
     image_norewrites_high_resolution_->Add(1);
     return kRewriteFailed;
   }
-  if (work_bound_->TryToWork()) {
+  int decoded_kbytes = BytesToKbytes(decoded_bytes);
+  bool may_rewrite = work_bound_->TryToWork();
+  bool over_memory_budget = false;
+  if (may_rewrite && !memory_bound_->TryToWorkUnits(decoded_kbytes)) {
+    work_bound_->WorkComplete();
+    may_rewrite = false;
+    over_memory_budget = true;
+  }
+  if (may_rewrite) {
     rewrite_result = kRewriteFailed;
     Timer* timer = server_context()->timer();
     int64 rewrite_time_start_ms = GetCurrentCpuTimeMs(timer);
@@ -1093,7 +1182,12 @@ RewriteResult ImageRewriteFilter::RewriteLoadedResourceImpl(
             static_cast<int>(low_image->image_type()));
       }
     }
+    memory_bound_->WorkCompleteUnits(decoded_kbytes);
     work_bound_->WorkComplete();
+    ImageRewriteQueue* queue = server_context()->image_rewrite_queue();
+    if (queue != NULL) {
+      queue->RunNext();
+    }
     int64 latency_ms = GetCurrentCpuTimeMs(timer) - rewrite_time_start_ms;
     if (rewrite_result == kRewriteOk) {
       image_rewrite_latency_ok_ms_->Add(latency_ms);
@@ -1105,8 +1199,24 @@ RewriteResult ImageRewriteFilter::RewriteLoadedResourceImpl(
     // variable so it can be easily scraped with wget.  The ok/failed
     // versions above are histograms and thus harder to scrape.
     image_rewrite_latency_total_ms_->Add(latency_ms);
+  } else if (CanDeferRewrite(rewrite_context)) {
+    // Context::RewriteSingle queues us to try again when a slot frees up.
+    rewrite_context->deferred_ = true;
+    if (over_memory_budget) {
+      image_rewrites_deferred_over_memory_budget_->Add(1);
+    }
+    rewrite_context->deferral_key_ = StrCat(
+        result->name(), " ", input_resource->url(), " ",
+        ImageUrlEncoder::CacheKeyFromResourceContext(resource_context), " ",
+        server_context()->hasher()->Hash(options->signature()));
+    rewrite_context->TracePrintf("%s: Deferring image rewrite until not busy.",
+                                 input_resource->url().c_str());
+    return kTooBusy;
   } else {
     image_rewrites_dropped_due_to_load_->IncBy(1);
+    if (over_memory_budget) {
+      image_rewrites_dropped_over_memory_budget_->Add(1);
+    }
     GoogleString msg(StringPrintf("%s: Too busy to rewrite image.",
                                   input_resource->url().c_str()));
     rewrite_context->TracePrintf("%s", msg.c_str());
@@ -1136,6 +1246,33 @@ RewriteResult ImageRewriteFilter::RewriteLoadedResourceImpl(
   return rewrite_result;
 }
 
+bool ImageRewriteFilter::CanDeferRewrite(Context* context) const {
+  if (context->deferred_ ||
+      (driver()->options()->image_max_deferred_rewrites() <= 0) ||
+      (server_context()->image_rewrite_queue() == NULL)) {
+    return false;
+  }
+  // Fetches of .pagespeed. URLs have someone waiting on them, so aren't
+  // deferred.  That includes images nested in a fetched CSS file, whose
+  // fetch is recorded on the outermost context.
+  for (const RewriteContext* c = context; c != NULL; c = c->parent()) {
+    if (c->IsFetchRewrite()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void ImageRewriteFilter::DeferRewrite(Context* context) {
+  const RewriteOptions* options = driver()->options();
+  // Copy the key, as context may be done with before Add returns.
+  GoogleString key(context->deferral_key_);
+  server_context()->image_rewrite_queue()->Add(
+      server_context(), key, options->image_max_deferred_rewrites(),
+      options->image_max_deferred_rewrite_wait_ms(),
+      MakeFunction(context, &Context::RunDeferred, &Context::GiveUpDeferred));
+}
+
 // Generate resized low quality image if the image width is not smaller than
 // kDelayImageWidthForMobile. If image width is smaller than
 // kDelayImageWidthForMobile, "delay_images" optimization is not very useful
@@ -43,6 +43,7 @@
 #include "net/instaweb/rewriter/image_testing_peer.h"
 #include "net/instaweb/rewriter/public/dom_stats_filter.h"
 #include "net/instaweb/rewriter/public/image.h"
+#include "net/instaweb/rewriter/public/image_rewrite_queue.h"
 #include "net/instaweb/rewriter/public/mock_critical_images_finder.h"
 #include "net/instaweb/rewriter/public/request_properties.h"
 #include "net/instaweb/rewriter/public/resource.h"
@@ -3315,6 +3316,186 @@ TEST_F(ImageRewriteTest, TooBusyReturnsOriginalResource) {
                     true, false);
 }
 
+// With ImageMaxDeferredRewrites set, a rewrite that finds every slot taken
+// waits on the ImageRewriteQueue, and finishes once another image rewrite
+// frees a slot.
+TEST_F(ImageRewriteTest, DeferredRewriteRunsWhenSlotFrees) {
+  options()->EnableFilter(RewriteOptions::kRecompressPng);
+  options()->set_image_max_rewrites_at_once(1);
+  options()->set_image_max_deferred_rewrites(4);
+  rewrite_driver()->AddFilters();
+  ImageRewriteQueue* queue = server_context()->image_rewrite_queue();
+  ASSERT_TRUE(queue != NULL);
+  // The queue is the process's, so every ServerContext gets the same one.
+  EXPECT_EQ(factory()->image_rewrite_queue(), queue);
+  AddFileToMockFetcher(StrCat(kTestDomain, "a.png"), kBikePngFile,
+                       kContentTypePng, 100);
+  UpDownCounter* ongoing_rewrites =
+      statistics()->GetUpDownCounter(ImageRewriteFilter::kImageOngoingRewrites);
+  Variable* rewrites =
+      statistics()->GetVariable(ImageRewriteFilter::kImageRewrites);
+
+  // The only slot is taken, so the rewrite is queued and the HTML goes out
+  // unoptimized.
+  ongoing_rewrites->Set(1);
+  ValidateNoChanges("deferred", "<img src=a.png>");
+  EXPECT_EQ(1, queue->size());
+  EXPECT_EQ(1, statistics()->GetVariable(
+      ImageRewriteQueue::kImageDeferredRewrites)->Get());
+  EXPECT_EQ(0, rewrites->Get());
+
+  // Another image rewrite finishing frees the slot and runs the queue.
+  ongoing_rewrites->Set(0);
+  queue->RunNext();
+  rewrite_driver()->WaitForCompletion();
+  EXPECT_EQ(0, queue->size());
+  EXPECT_EQ(1, rewrites->Get());
+  EXPECT_EQ(0, ongoing_rewrites->Get());
+  EXPECT_EQ(0, statistics()->GetVariable(
+      ImageRewriteQueue::kImageDeferredRewritesTimedOut)->Get());
+  EXPECT_EQ(0, statistics()->GetTimedVariable(
+      ImageRewriteFilter::kImageRewritesDroppedDueToLoad)->Get(
+          TimedVariable::START));
+
+  // The result was cached, so it is used even with the slot taken again.
+  ongoing_rewrites->Set(1);
+  ValidateExpected(
+      "deferred_done", "<img src=a.png>",
+      StrCat("<img src=", Encode("", "ic", "0", "a.png", "png"), ">"));
+  EXPECT_EQ(0, queue->size());
+  EXPECT_EQ(1, rewrites->Get());
+}
+
+// A deferred rewrite that is still waiting when its time is up gets one last
+// try, and is dropped if the slot is still taken.
+TEST_F(ImageRewriteTest, DeferredRewriteDroppedIfStillBusyAfterMaxWait) {
+  const int64 kMaxWaitMs = 1000;
+  options()->EnableFilter(RewriteOptions::kRecompressPng);
+  options()->set_image_max_rewrites_at_once(1);
+  options()->set_image_max_deferred_rewrites(4);
+  options()->set_image_max_deferred_rewrite_wait_ms(kMaxWaitMs);
+  rewrite_driver()->AddFilters();
+  ImageRewriteQueue* queue = server_context()->image_rewrite_queue();
+  ASSERT_TRUE(queue != NULL);
+  AddFileToMockFetcher(StrCat(kTestDomain, "a.png"), kBikePngFile,
+                       kContentTypePng, 100);
+  UpDownCounter* ongoing_rewrites =
+      statistics()->GetUpDownCounter(ImageRewriteFilter::kImageOngoingRewrites);
+  TimedVariable* drops = statistics()->GetTimedVariable(
+      ImageRewriteFilter::kImageRewritesDroppedDueToLoad);
+
+  ongoing_rewrites->Set(1);
+  ValidateNoChanges("deferred", "<img src=a.png>");
+  EXPECT_EQ(1, queue->size());
+  EXPECT_EQ(0, drops->Get(TimedVariable::START));
+
+  AdvanceTimeMs(kMaxWaitMs);
+  rewrite_driver()->WaitForCompletion();
+  EXPECT_EQ(0, queue->size());
+  EXPECT_EQ(1, statistics()->GetVariable(
+      ImageRewriteQueue::kImageDeferredRewritesTimedOut)->Get());
+  EXPECT_EQ(1, drops->Get(TimedVariable::START));
+  EXPECT_EQ(0, statistics()->GetVariable(
+      ImageRewriteFilter::kImageRewrites)->Get());
+
+  // It isn't queued a second time; the next request tries again instead.
+  EXPECT_EQ(1, statistics()->GetVariable(
+      ImageRewriteQueue::kImageDeferredRewrites)->Get());
+}
+
+// Shutting down cancels whatever is queued instead of waiting it out.
+TEST_F(ImageRewriteTest, ShutDownCancelsDeferredRewrites) {
+  options()->EnableFilter(RewriteOptions::kRecompressPng);
+  options()->set_image_max_rewrites_at_once(1);
+  options()->set_image_max_deferred_rewrites(4);
+  rewrite_driver()->AddFilters();
+  ImageRewriteQueue* queue = server_context()->image_rewrite_queue();
+  ASSERT_TRUE(queue != NULL);
+  AddFileToMockFetcher(StrCat(kTestDomain, "a.png"), kBikePngFile,
+                       kContentTypePng, 100);
+  UpDownCounter* ongoing_rewrites =
+      statistics()->GetUpDownCounter(ImageRewriteFilter::kImageOngoingRewrites);
+
+  ongoing_rewrites->Set(1);
+  ValidateNoChanges("deferred", "<img src=a.png>");
+  EXPECT_EQ(1, queue->size());
+
+  server_context()->ShutDownDrivers();
+  EXPECT_EQ(0, queue->size());
+  rewrite_driver()->WaitForCompletion();
+  EXPECT_EQ(1, statistics()->GetTimedVariable(
+      ImageRewriteFilter::kImageRewritesDroppedDueToLoad)->Get(
+          TimedVariable::START));
+  EXPECT_EQ(0, statistics()->GetVariable(
+      ImageRewriteQueue::kImageDeferredRewritesTimedOut)->Get());
+  EXPECT_EQ(0, statistics()->GetVariable(
+      ImageRewriteFilter::kImageRewrites)->Get());
+}
+
+// An image nested in a fetched .pagespeed. CSS file has someone waiting on
+// it, so it isn't deferred even though only the CSS context is the fetch.
+TEST_F(ImageRewriteTest, NestedFetchRewriteIsNotDeferred) {
+  options()->EnableFilter(RewriteOptions::kRecompressPng);
+  options()->EnableFilter(RewriteOptions::kRewriteCss);
+  options()->set_image_max_rewrites_at_once(1);
+  options()->set_image_max_deferred_rewrites(4);
+  options()->set_always_rewrite_css(true);
+  rewrite_driver()->AddFilters();
+  ImageRewriteQueue* queue = server_context()->image_rewrite_queue();
+  ASSERT_TRUE(queue != NULL);
+
+  const char kPngFile[] = "a.png";
+  const char kCssFile[] = "a.css";
+  AddFileToMockFetcher(StrCat(kTestDomain, kPngFile), kBikePngFile,
+                       kContentTypePng, 100);
+  GoogleString in_css = StringPrintf("div{background-image:url(%s)}",
+                                     kPngFile);
+  SetResponseWithDefaultHeaders(kCssFile, kContentTypeCss, in_css, 100);
+  statistics()->GetUpDownCounter(
+      ImageRewriteFilter::kImageOngoingRewrites)->Set(1);
+
+  GoogleString out_css;
+  EXPECT_TRUE(FetchResourceUrl(
+      StrCat(kTestDomain, Encode("", "cf", "0", kCssFile, "css")), &out_css));
+  EXPECT_EQ(in_css, out_css);
+  EXPECT_EQ(0, queue->size());
+  EXPECT_EQ(0, statistics()->GetVariable(
+      ImageRewriteQueue::kImageDeferredRewrites)->Get());
+  EXPECT_EQ(1, statistics()->GetTimedVariable(
+      ImageRewriteFilter::kImageRewritesDroppedDueToLoad)->Get(
+          TimedVariable::START));
+}
+
+TEST_F(ImageRewriteTest, OverMemoryBudgetReturnsOriginalResource) {
+  options()->EnableFilter(RewriteOptions::kRecompressPng);
+  options()->set_image_max_rewrite_bytes_at_once(1024);
+  rewrite_driver()->AddFilters();
+
+  // The budget is per process, so isn't counted in the statistics, which
+  // may be shared by several.
+  EXPECT_TRUE(statistics()->FindUpDownCounter(
+      ImageRewriteFilter::kImageOngoingRewriteKbytes) == NULL);
+
+  // Pretend a kilobyte of image is already being rewritten, so there is no
+  // room for the bike.
+  UpDownCounter* ongoing_kbytes =
+      factory()->process_local_statistics()->GetUpDownCounter(
+          ImageRewriteFilter::kImageOngoingRewriteKbytes);
+  ongoing_kbytes->Set(1);
+
+  TestSingleRewrite(kBikePngFile, kContentTypePng, kContentTypePng, "", "",
+                    false, false);
+  EXPECT_EQ(1, statistics()->GetVariable(
+      ImageRewriteFilter::kImageRewritesDroppedOverMemoryBudget)->Get());
+
+  // On its own, the bike is rewritten even though it is bigger than the
+  // budget.
+  ongoing_kbytes->Set(0);
+  TestSingleRewrite(kBikePngFile, kContentTypePng, kContentTypePng, "", "",
+                    true, false);
+  EXPECT_EQ(0, ongoing_kbytes->Get());
+}
+
 TEST_F(ImageRewriteTest, ResizeUsingRenderedDimensions) {
   MockCriticalImagesFinder* finder = new MockCriticalImagesFinder(statistics());
   server_context()->set_critical_images_finder(finder);
@@ -0,0 +1,240 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "net/instaweb/rewriter/public/image_rewrite_queue.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "base/logging.h"
+#include "net/instaweb/util/public/abstract_mutex.h"
+#include "net/instaweb/util/public/function.h"
+#include "net/instaweb/util/public/statistics.h"
+#include "net/instaweb/util/public/thread_system.h"
+#include "net/instaweb/util/public/timer.h"
+
+namespace net_instaweb {
+
+const char ImageRewriteQueue::kImageDeferredRewrites[] =
+    "image_deferred_rewrites";
+const char ImageRewriteQueue::kImageDeferredRewritesMerged[] =
+    "image_deferred_rewrites_merged";
+const char ImageRewriteQueue::kImageDeferredRewritesEvicted[] =
+    "image_deferred_rewrites_evicted";
+const char ImageRewriteQueue::kImageDeferredRewritesTimedOut[] =
+    "image_deferred_rewrites_timed_out";
+
+const int ImageRewriteQueue::kMaxQueuedRewrites = 64;
+
+ImageRewriteQueue::ImageRewriteQueue(ThreadSystem* thread_system,
+                                     Scheduler* scheduler, Statistics* stats)
+    : scheduler_(scheduler),
+      mutex_(thread_system->NewMutex()),
+      next_id_(0),
+      alarm_(NULL),
+      deferred_rewrites_(stats->GetVariable(kImageDeferredRewrites)),
+      deferred_rewrites_merged_(
+          stats->GetVariable(kImageDeferredRewritesMerged)),
+      deferred_rewrites_evicted_(
+          stats->GetVariable(kImageDeferredRewritesEvicted)),
+      deferred_rewrites_timed_out_(
+          stats->GetVariable(kImageDeferredRewritesTimedOut)) {
+}
+
+ImageRewriteQueue::~ImageRewriteQueue() {
+  {
+    ScopedMutex lock(scheduler_->mutex());
+    if (alarm_ != NULL) {
+      scheduler_->CancelAlarm(alarm_);
+      alarm_ = NULL;
+    }
+  }
+  CancelAll();
+}
+
+void ImageRewriteQueue::InitStats(Statistics* stats) {
+  stats->AddVariable(kImageDeferredRewrites);
+  stats->AddVariable(kImageDeferredRewritesMerged);
+  stats->AddVariable(kImageDeferredRewritesEvicted);
+  stats->AddVariable(kImageDeferredRewritesTimedOut);
+}
+
+void ImageRewriteQueue::Add(const ServerContext* owner, StringPiece key,
+                            int max_size, int64 max_wait_ms,
+                            Function* callback) {
+  Function* canceled = callback;
+  max_size = std::min(max_size, kMaxQueuedRewrites);
+  EntryKey entry_key(owner, key.as_string());
+  {
+    ScopedMutex lock(mutex_.get());
+    EntryMap::iterator p = entries_.find(entry_key);
+    if (p != entries_.end()) {
+      ++p->second.requests;
+      deferred_rewrites_merged_->Add(1);
+    } else {
+      if (static_cast<int>(entries_.size()) >= max_size) {
+        // Make room by dropping the least requested entry, unless they have
+        // all been requested more than this new one.
+        EntryMap::iterator victim = LeastRequested();
+        if ((victim == entries_.end()) || (victim->second.requests > 1)) {
+          deferred_rewrites_evicted_->Add(1);
+          callback = NULL;
+        } else {
+          canceled = victim->second.callback;
+          entries_.erase(victim);
+          deferred_rewrites_evicted_->Add(1);
+        }
+      } else {
+        canceled = NULL;
+      }
+      if (callback != NULL) {
+        Entry& entry = entries_[entry_key];
+        entry.id = next_id_++;
+        entry.deadline_us =
+            scheduler_->timer()->NowUs() + max_wait_ms * Timer::kMsUs;
+        entry.requests = 1;
+        entry.callback = callback;
+        deferred_rewrites_->Add(1);
+      }
+    }
+  }
+  if (canceled != NULL) {
+    canceled->CallCancel();
+  }
+  MaybeScheduleAlarm();
+}
+
+void ImageRewriteQueue::RunNext() {
+  Function* callback = NULL;
+  {
+    ScopedMutex lock(mutex_.get());
+    EntryMap::iterator p = MostRequested();
+    if (p == entries_.end()) {
+      return;
+    }
+    callback = p->second.callback;
+    entries_.erase(p);
+  }
+  callback->CallRun();
+}
+
+void ImageRewriteQueue::CancelOwnedBy(const ServerContext* owner) {
+  DCHECK(owner != NULL);
+  CancelEntries(owner);
+}
+
+void ImageRewriteQueue::CancelAll() {
+  CancelEntries(NULL);
+}
+
+void ImageRewriteQueue::CancelEntries(const ServerContext* owner) {
+  std::vector<Function*> canceled;
+  {
+    ScopedMutex lock(mutex_.get());
+    for (EntryMap::iterator p = entries_.begin(); p != entries_.end(); ) {
+      if ((owner == NULL) || (p->first.first == owner)) {
+        canceled.push_back(p->second.callback);
+        entries_.erase(p++);
+      } else {
+        ++p;
+      }
+    }
+  }
+  for (int i = 0, n = canceled.size(); i < n; ++i) {
+    canceled[i]->CallCancel();
+  }
+}
+
+int ImageRewriteQueue::size() const {
+  ScopedMutex lock(mutex_.get());
+  return entries_.size();
+}
+
+ImageRewriteQueue::EntryMap::iterator ImageRewriteQueue::MostRequested() {
+  EntryMap::iterator best = entries_.end();
+  for (EntryMap::iterator p = entries_.begin(), e = entries_.end(); p != e;
+       ++p) {
+    if ((best == entries_.end()) ||
+        (p->second.requests > best->second.requests) ||
+        ((p->second.requests == best->second.requests) &&
+         (p->second.id < best->second.id))) {
+      best = p;
+    }
+  }
+  return best;
+}
+
+ImageRewriteQueue::EntryMap::iterator ImageRewriteQueue::LeastRequested() {
+  EntryMap::iterator worst = entries_.end();
+  for (EntryMap::iterator p = entries_.begin(), e = entries_.end(); p != e;
+       ++p) {
+    if ((worst == entries_.end()) ||
+        (p->second.requests < worst->second.requests) ||
+        ((p->second.requests == worst->second.requests) &&
+         (p->second.id < worst->second.id))) {
+      worst = p;
+    }
+  }
+  return worst;
+}
+
+void ImageRewriteQueue::MaybeScheduleAlarm() {
+  int64 wakeup_time_us = 0;
+  {
+    ScopedMutex lock(mutex_.get());
+    if (entries_.empty()) {
+      return;
+    }
+    EntryMap::const_iterator p = entries_.begin();
+    wakeup_time_us = p->second.deadline_us;
+    for (++p; p != entries_.end(); ++p) {
+      wakeup_time_us = std::min(wakeup_time_us, p->second.deadline_us);
+    }
+  }
+  // An entry queued with an earlier deadline than the outstanding alarm's
+  // waits for that alarm; max_wait_ms normally comes from a process-wide
+  // option, so that doesn't happen.
+  ScopedMutex lock(scheduler_->mutex());
+  if (alarm_ == NULL) {
+    alarm_ = scheduler_->AddAlarmAtUsMutexHeld(
+        wakeup_time_us, MakeFunction(this, &ImageRewriteQueue::AlarmFired));
+  }
+}
+
+void ImageRewriteQueue::AlarmFired() {
+  {
+    ScopedMutex lock(scheduler_->mutex());
+    alarm_ = NULL;
+  }
+  std::vector<Function*> expired;
+  {
+    ScopedMutex lock(mutex_.get());
+    int64 now_us = scheduler_->timer()->NowUs();
+    for (EntryMap::iterator p = entries_.begin(); p != entries_.end(); ) {
+      if (p->second.deadline_us <= now_us) {
+        expired.push_back(p->second.callback);
+        entries_.erase(p++);
+      } else {
+        ++p;
+      }
+    }
+  }
+  deferred_rewrites_timed_out_->Add(expired.size());
+  for (int i = 0, n = expired.size(); i < n; ++i) {
+    expired[i]->CallRun();
+  }
+  MaybeScheduleAlarm();
+}
+
+}  // namespace net_instaweb
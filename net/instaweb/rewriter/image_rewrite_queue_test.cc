@@ -0,0 +1,198 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "net/instaweb/rewriter/public/image_rewrite_queue.h"
+
+#include "net/instaweb/util/public/function.h"
+#include "net/instaweb/util/public/gtest.h"
+#include "net/instaweb/util/public/mock_scheduler.h"
+#include "net/instaweb/util/public/mock_timer.h"
+#include "net/instaweb/util/public/platform.h"
+#include "net/instaweb/util/public/scoped_ptr.h"
+#include "net/instaweb/util/public/simple_stats.h"
+#include "net/instaweb/util/public/string.h"
+#include "net/instaweb/util/public/string_util.h"
+#include "net/instaweb/util/public/thread_system.h"
+
+namespace net_instaweb {
+
+class ServerContext;
+
+namespace {
+
+const int kMaxSize = 3;
+const int64 kMaxWaitMs = 1000;
+
+class ImageRewriteQueueTest : public testing::Test {
+ protected:
+  ImageRewriteQueueTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        timer_(thread_system_->NewMutex(), MockTimer::kApr_5_2010_ms),
+        scheduler_(thread_system_.get(), &timer_),
+        stats_(thread_system_.get()) {
+    ImageRewriteQueue::InitStats(&stats_);
+    queue_.reset(
+        new ImageRewriteQueue(thread_system_.get(), &scheduler_, &stats_));
+  }
+
+  // Records "+name" in log_ when run and "-name" when canceled.
+  class LogFunction : public Function {
+   public:
+    LogFunction(StringPiece name, GoogleString* log)
+        : name_(name.data(), name.size()), log_(log) {}
+
+   protected:
+    virtual void Run() { StrAppend(log_, "+", name_, " "); }
+    virtual void Cancel() { StrAppend(log_, "-", name_, " "); }
+
+   private:
+    GoogleString name_;
+    GoogleString* log_;
+  };
+
+  void Add(StringPiece key, StringPiece name) {
+    AddFor(vhost(0), key, name);
+  }
+
+  void AddFor(const ServerContext* owner, StringPiece key, StringPiece name) {
+    queue_->Add(owner, key, kMaxSize, kMaxWaitMs,
+                new LogFunction(name, &log_));
+  }
+
+  // The queue only compares owners, so stand-ins do for ServerContexts.
+  const ServerContext* vhost(int index) {
+    return reinterpret_cast<const ServerContext*>(&vhosts_[index]);
+  }
+
+  int64 Stat(const char* name) {
+    return stats_.GetVariable(name)->Get();
+  }
+
+  scoped_ptr<ThreadSystem> thread_system_;
+  MockTimer timer_;
+  MockScheduler scheduler_;
+  SimpleStats stats_;
+  GoogleString log_;
+  scoped_ptr<ImageRewriteQueue> queue_;
+  char vhosts_[2];
+};
+
+TEST_F(ImageRewriteQueueTest, RunsMostRequestedFirst) {
+  queue_->RunNext();  // Nothing to do.
+  Add("a", "a1");
+  Add("b", "b1");
+  Add("b", "b2");
+  Add("c", "c1");
+  EXPECT_EQ("-b2 ", log_);  // Merged with b1.
+  EXPECT_EQ(3, queue_->size());
+
+  log_.clear();
+  queue_->RunNext();
+  queue_->RunNext();
+  EXPECT_EQ("+b1 +a1 ", log_);  // a1 and c1 tie, so the older goes first.
+  EXPECT_EQ(1, queue_->size());
+  EXPECT_EQ(3, Stat(ImageRewriteQueue::kImageDeferredRewrites));
+  EXPECT_EQ(1, Stat(ImageRewriteQueue::kImageDeferredRewritesMerged));
+
+  // Once run, a key can be queued again.
+  Add("b", "b3");
+  EXPECT_EQ(2, queue_->size());
+
+  log_.clear();
+  queue_->CancelAll();
+  EXPECT_EQ("-b3 -c1 ", log_);
+  EXPECT_EQ(0, queue_->size());
+}
+
+TEST_F(ImageRewriteQueueTest, EvictsLeastRequestedWhenFull) {
+  Add("a", "a1");
+  Add("a", "a2");
+  Add("b", "b1");
+  Add("c", "c1");
+  log_.clear();
+
+  // b1 is the oldest of the least requested, so it makes room.
+  Add("d", "d1");
+  EXPECT_EQ("-b1 ", log_);
+  EXPECT_EQ(3, queue_->size());
+
+  // With everything requested more often than a newcomer, it's the one
+  // that doesn't get in.
+  Add("c", "c2");
+  Add("d", "d2");
+  log_.clear();
+  Add("e", "e1");
+  EXPECT_EQ("-e1 ", log_);
+  EXPECT_EQ(3, queue_->size());
+  EXPECT_EQ(2, Stat(ImageRewriteQueue::kImageDeferredRewritesEvicted));
+}
+
+TEST_F(ImageRewriteQueueTest, RunsAnywayAfterMaxWait) {
+  Add("a", "a1");
+  scheduler_.AdvanceTimeMs(kMaxWaitMs / 2);
+  Add("b", "b1");
+  scheduler_.AdvanceTimeMs(kMaxWaitMs / 2 - 1);
+  EXPECT_EQ("", log_);
+  scheduler_.AdvanceTimeMs(1);
+  EXPECT_EQ("+a1 ", log_);
+  EXPECT_EQ(1, queue_->size());
+  scheduler_.AdvanceTimeMs(kMaxWaitMs / 2);
+  EXPECT_EQ("+a1 +b1 ", log_);
+  EXPECT_EQ(0, queue_->size());
+  EXPECT_EQ(2, Stat(ImageRewriteQueue::kImageDeferredRewritesTimedOut));
+
+  // Nothing is left to expire.
+  scheduler_.AdvanceTimeMs(10 * kMaxWaitMs);
+  EXPECT_EQ("+a1 +b1 ", log_);
+}
+
+TEST_F(ImageRewriteQueueTest, SizeIsCappedWhateverTheCallerAsks) {
+  const int kHuge = 10 * ImageRewriteQueue::kMaxQueuedRewrites;
+  for (int i = 0; i < kHuge; ++i) {
+    queue_->Add(vhost(i % 2), IntegerToString(i), kHuge, kMaxWaitMs,
+                new LogFunction("x", &log_));
+  }
+  EXPECT_EQ(ImageRewriteQueue::kMaxQueuedRewrites, queue_->size());
+  EXPECT_EQ(kHuge - ImageRewriteQueue::kMaxQueuedRewrites,
+            Stat(ImageRewriteQueue::kImageDeferredRewritesEvicted));
+  queue_->CancelAll();
+}
+
+TEST_F(ImageRewriteQueueTest, SharedBetweenServerContexts) {
+  // The same key from two vhosts is two rewrites, as their options may
+  // differ, but they compete for the same slots.
+  AddFor(vhost(0), "a", "a0");
+  AddFor(vhost(1), "a", "a1");
+  AddFor(vhost(1), "a", "a1b");
+  AddFor(vhost(0), "b", "b0");
+  EXPECT_EQ(3, queue_->size());
+  EXPECT_EQ(1, Stat(ImageRewriteQueue::kImageDeferredRewritesMerged));
+  EXPECT_EQ("-a1b ", log_);
+
+  // A slot freed by any vhost goes to the most requested rewrite.
+  queue_->RunNext();
+  EXPECT_EQ("-a1b +a1 ", log_);
+
+  // Shutting down one vhost leaves the others' rewrites queued.
+  AddFor(vhost(1), "c", "c1");
+  queue_->CancelOwnedBy(vhost(0));
+  EXPECT_EQ("-a1b +a1 -a0 -b0 ", log_);
+  EXPECT_EQ(1, queue_->size());
+  queue_->RunNext();
+  EXPECT_EQ("-a1b +a1 -a0 -b0 +c1 ", log_);
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
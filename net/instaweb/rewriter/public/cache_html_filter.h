@@ -52,6 +52,9 @@ class CacheHtmlFilter : public HtmlWriterFilter {
   void WriteString(StringPiece str);
   virtual void Flush();
   virtual const char* Name() const { return "CacheHtmlFilter"; }
+  // Buffers the page and writes it to the driver's writer itself, so its
+  // output must not be interleaved with that of later filters.
+  virtual bool IsStreamingSafe() const { return false; }
 
  private:
   void SendCookies();
@@ -58,6 +58,9 @@ class ComputeVisibleTextFilter : public HtmlWriterFilter {
   virtual void Directive(HtmlDirectiveNode* directive);
   virtual void EndDocument();
   virtual const char* Name() const { return "ComputeVisibleTextFilter"; }
+  // Writes straight to the driver's writer at EndDocument, which must come
+  // before anything later filters write for the same flush window.
+  virtual bool IsStreamingSafe() const { return false; }
 
  private:
   RewriteDriver* rewrite_driver_;
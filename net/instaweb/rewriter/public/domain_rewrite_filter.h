@@ -48,6 +48,9 @@ class DomainRewriteFilter : public CommonFilter {
   virtual void EndElementImpl(HtmlElement* element) {}
 
   virtual const char* Name() const { return "DomainRewrite"; }
+  // Not streaming-safe with client_domain_rewrite, which inserts a script
+  // at the end of the body.
+  virtual bool IsStreamingSafe() const;
 
   enum RewriteResult {
     kRewroteDomain,
@@ -66,6 +66,10 @@ class FlushEarlyContentWriterFilter : public HtmlWriterFilter {
 
   virtual void Characters(HtmlCharactersNode* characters_node);
 
+  // Emits the flush-early content to the original writer as it goes, so
+  // must not be interleaved with later filters' output.
+  virtual bool IsStreamingSafe() const { return false; }
+
  protected:
   virtual void Clear();
 
@@ -43,6 +43,7 @@ class ResourceContext;
 class RewriteContext;
 class RewriteDriver;
 class Statistics;
+class StatisticsWorkBound;
 class TimedVariable;
 class UrlSegmentEncoder;
 class Variable;
@@ -66,13 +67,16 @@ class ImageRewriteFilter : public RewriteFilter {
  public:
   // Statistic names:
   static const char kImageNoRewritesHighResolution[];
+  static const char kImageOngoingRewriteKbytes[];
   static const char kImageOngoingRewrites[];
   static const char kImageResizedUsingRenderedDimensions[];
   static const char kImageRewriteLatencyFailedMs[];
   static const char kImageRewriteLatencyOkMs[];
   static const char kImageRewriteLatencyTotalMs[];
   static const char kImageRewritesDroppedDecodeFailure[];
+  static const char kImageRewritesDeferredOverMemoryBudget[];
   static const char kImageRewritesDroppedDueToLoad[];
+  static const char kImageRewritesDroppedOverMemoryBudget[];
   static const char kImageRewritesDroppedMIMETypeUnknown[];
   static const char kImageRewritesDroppedNoSavingNoResize[];
   static const char kImageRewritesDroppedNoSavingResize[];
@@ -107,6 +111,10 @@ class ImageRewriteFilter : public RewriteFilter {
   explicit ImageRewriteFilter(RewriteDriver* driver);
   virtual ~ImageRewriteFilter();
   static void InitStats(Statistics* statistics);
+  // Adds the statistics that are kept per process, whatever the server's
+  // statistics are shared between; see
+  // RewriteDriverFactory::process_local_statistics().
+  static void InitProcessLocalStats(Statistics* statistics);
   static void Initialize();
   static void Terminate();
   static void AddRelatedOptions(StringPieceVector* target);
@@ -210,6 +218,14 @@ class ImageRewriteFilter : public RewriteFilter {
                                           const ResourcePtr& input_resource,
                                           const OutputResourcePtr& result);
 
+  // Whether a rewrite that found the work bound full should wait in the
+  // process's ImageRewriteQueue rather than being dropped.
+  bool CanDeferRewrite(Context* context) const;
+
+  // Queues context, whose rewrite couldn't start for lack of a free slot, on
+  // the process's ImageRewriteQueue.
+  void DeferRewrite(Context* context);
+
   // Returns true if it rewrote (ie inlined) the URL.
   bool FinishRewriteCssImageUrl(
       int64 css_image_inline_max_bytes,
@@ -263,6 +279,9 @@ class ImageRewriteFilter : public RewriteFilter {
                                CachedResult* cached_result);
 
   scoped_ptr<WorkBound> work_bound_;
+  // Bounds the estimated decoded size, in kilobytes, of the images being
+  // rewritten.
+  scoped_ptr<StatisticsWorkBound> memory_bound_;
 
   // Statistics
 
@@ -292,6 +311,11 @@ class ImageRewriteFilter : public RewriteFilter {
   Variable* image_rewrites_dropped_nosaving_noresize_;
   // # of images not rewritten because of load.
   TimedVariable* image_rewrites_dropped_due_to_load_;
+  // # of images queued or not rewritten because they would have gone over
+  // image_max_rewrite_bytes_at_once; the latter are also counted as dropped
+  // due to load.
+  Variable* image_rewrites_deferred_over_memory_budget_;
+  Variable* image_rewrites_dropped_over_memory_budget_;
   // # of image squashing for mobile screen initiated. This may not be the
   // actual # of images squashed as squashing may fail or rewritten image size
   // is larger.
@@ -0,0 +1,141 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NET_INSTAWEB_REWRITER_PUBLIC_IMAGE_REWRITE_QUEUE_H_
+#define NET_INSTAWEB_REWRITER_PUBLIC_IMAGE_REWRITE_QUEUE_H_
+
+#include <map>
+#include <utility>
+
+#include "net/instaweb/util/public/basictypes.h"
+#include "net/instaweb/util/public/scoped_ptr.h"
+#include "net/instaweb/util/public/string.h"
+#include "net/instaweb/util/public/string_util.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/thread/scheduler.h"
+
+namespace net_instaweb {
+
+class AbstractMutex;
+class Function;
+class ServerContext;
+class Statistics;
+class ThreadSystem;
+class Variable;
+
+// Holds image rewrites that could not start because too many were already
+// running (see ImageRewriteFilter's use of StatisticsWorkBound), so they can
+// run as soon as a slot frees up rather than waiting for the image to be
+// requested again.  Each queued rewrite is a Function: Run means a slot has
+// probably freed up and the rewrite should try again, and Cancel means it
+// should give up.  Exactly one of them is called for every Function added.
+//
+// Rewrites are identified by a key, and a rewrite whose key is already
+// queued is canceled straight away, since the queued one will put the same
+// result in the cache; it counts as another request for the queued one.
+// Slots go to the most requested rewrite first, and the least requested is
+// canceled to make room when the queue is full.  A rewrite that is still
+// queued after its maximum wait is run anyway, for one last try.
+//
+// Every queued rewrite holds on to its RewriteContext, and so to the
+// RewriteDriver it came from, until it is run or canceled.  The queue never
+// holds more than kMaxQueuedRewrites of them, whatever max_size callers ask
+// for, so deferral can't tie up an unbounded number of drivers.
+//
+// There is one queue per process, owned by the RewriteDriverFactory, since
+// the slots it waits for are not per ServerContext.  Rewrites from all the
+// ServerContexts (vhosts) share it, and so share kMaxQueuedRewrites; each
+// rewrite remembers the ServerContext it is for, so that one being shut down
+// can cancel just its own.
+//
+// This class is thread-safe.
+class ImageRewriteQueue {
+ public:
+  static const char kImageDeferredRewrites[];
+  static const char kImageDeferredRewritesMerged[];
+  static const char kImageDeferredRewritesEvicted[];
+  static const char kImageDeferredRewritesTimedOut[];
+
+  // Upper bound on the max_size passed to Add.
+  static const int kMaxQueuedRewrites;
+
+  ImageRewriteQueue(ThreadSystem* thread_system, Scheduler* scheduler,
+                    Statistics* stats);
+  ~ImageRewriteQueue();
+
+  static void InitStats(Statistics* stats);
+
+  // Queues callback, a rewrite for owner, under key, keeping at most
+  // max_size (capped at kMaxQueuedRewrites) rewrites queued, and running it
+  // no later than max_wait_ms from now.  The same key from different owners
+  // names different rewrites, as their options may differ.
+  void Add(const ServerContext* owner, StringPiece key, int max_size,
+           int64 max_wait_ms, Function* callback);
+
+  // Runs the most requested queued rewrite, if any, whichever ServerContext
+  // it is for.  Call this whenever an image rewrite finishes.
+  void RunNext();
+
+  // Cancels everything queued for owner, so its shutdown needn't wait.
+  void CancelOwnedBy(const ServerContext* owner);
+
+  // Cancels everything queued.
+  void CancelAll();
+
+  int size() const;
+
+ private:
+  struct Entry {
+    int64 id;  // Increases with time of queueing.
+    int64 deadline_us;
+    int requests;
+    Function* callback;
+  };
+  typedef std::pair<const ServerContext*, GoogleString> EntryKey;
+  typedef std::map<EntryKey, Entry> EntryMap;
+
+  // Cancels the entries for owner, or all of them if owner is NULL.
+  void CancelEntries(const ServerContext* owner);
+
+  // Returns the entry that should get the next free slot.
+  EntryMap::iterator MostRequested() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Returns the entry to drop first when full: the least requested, and
+  // the oldest of those.
+  EntryMap::iterator LeastRequested() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Schedules alarm_ for the earliest deadline, if there is anything queued
+  // and no alarm outstanding.
+  void MaybeScheduleAlarm() LOCKS_EXCLUDED(mutex_);
+
+  // Runs the queued rewrites whose deadline has passed.
+  void AlarmFired();
+
+  Scheduler* scheduler_;
+  scoped_ptr<AbstractMutex> mutex_;
+  int64 next_id_ GUARDED_BY(mutex_);
+  EntryMap entries_ GUARDED_BY(mutex_);
+  Scheduler::Alarm* alarm_ GUARDED_BY(scheduler_->mutex());
+
+  Variable* deferred_rewrites_;
+  Variable* deferred_rewrites_merged_;
+  Variable* deferred_rewrites_evicted_;
+  Variable* deferred_rewrites_timed_out_;
+
+  DISALLOW_COPY_AND_ASSIGN(ImageRewriteQueue);
+};
+
+}  // namespace net_instaweb
+
+#endif  // NET_INSTAWEB_REWRITER_PUBLIC_IMAGE_REWRITE_QUEUE_H_
@@ -57,6 +57,8 @@ class MetaTagFilter : public CommonFilter {
   virtual void Flush();
 
   virtual const char* Name() const { return "ConvertMetaTags"; }
+  // Not IsStreamingSafe: a fused writer may already have committed the
+  // response headers when the meta tag is seen.
 
   // Utility function to extract the mime type and/or charset from a meta tag
   // and update the response_headers if they are not set already.
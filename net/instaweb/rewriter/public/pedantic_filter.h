@@ -36,6 +36,7 @@ class PedanticFilter : public EmptyHtmlFilter {
 
   virtual void StartElement(HtmlElement* element);
   virtual const char* Name() const { return "Pedantic"; }
+  virtual bool IsStreamingSafe() const { return true; }
 
  private:
   HtmlParse* html_parse_;
@@ -41,6 +41,7 @@ class AsyncFetch;
 class GoogleUrl;
 class MessageHandler;
 class NamedLock;
+class RequestTimeline;
 class RequestTrace;
 class ResponseHeaders;
 class RewriteDriver;
@@ -266,6 +267,10 @@ class RewriteContext {
   RewriteContext* parent() { return parent_; }
   const RewriteContext* parent() const { return parent_; }
 
+  // Returns true if this rewrite context was created to fetch a resource (e.g.,
+  // IPRO or .pagespeed. URLs) and false otherwise.
+  bool IsFetchRewrite() const { return fetch_.get() != NULL; }
+
   // If called with true, forces a rewrite and re-generates the output.
   void set_force_rewrite(bool x) { force_rewrite_ = x; }
 
@@ -301,6 +306,10 @@ class RewriteContext {
     return driver_;
   }
 
+  // The timeline of the request this rewrite is for, or NULL if the request
+  // is not being traced.
+  RequestTimeline* Timeline() const;
+
   // Accessors for the nested rewrites.
   int num_nested() const { return nested_.size(); }
   RewriteContext* nested(int i) const { return nested_[i]; }
@@ -647,6 +656,10 @@ class RewriteContext {
   void SetPartitionKey();
   void StartFetch();
   void StartFetchImpl();
+  // Record how long StartFetch waited for the creation lock, then call
+  // StartFetchImpl.  Only used when the request has a timeline.
+  void CreationLockAcquired(int64 wait_start_us);
+  void CreationLockTimedOut(int64 wait_start_us);
   void CancelFetch();
   void OutputCacheDone(CacheLookupResult* cache_result);
   void OutputCacheHit(bool write_partitions);
@@ -717,10 +730,6 @@ class RewriteContext {
   //    output: http://www.example.com/50x50xa.png.pagespeed.ic.0.distributed
   GoogleString DistributedFetchUrl(StringPiece url);
 
-  // Returns true if this rewrite context was created to fetch a resource (e.g.,
-  // IPRO or .pagespeed. URLs) and false otherwise.
-  bool IsFetchRewrite() const { return fetch_.get() != NULL; }
-
   // Called on the parent from a nested Rewrite when it is complete.
   // Note that we don't track rewrite success/failure here.  We only
   // care whether the nested rewrites are complete, and whether there
@@ -1254,6 +1254,11 @@ class RewriteDriver : public HtmlParse {
   // (configured via max_page_processing_delay_ms()).
   int64 ComputeCurrentFlushWindowRewriteDelayMs();
 
+  // Tags our rewrite sequences with the time by which the HTML wants their
+  // results, so the worker pools run them ahead of background work, or
+  // untags them when deadline_ms is QueuedWorkerPool::kNoDeadline.
+  void SetRewriteSequenceDeadlineMs(int64 deadline_ms);
+
   // Queues up invocation of FlushAsyncDone in our html_workers sequence.
   void QueueFlushAsyncDone(int num_rewrites, Function* callback);
 
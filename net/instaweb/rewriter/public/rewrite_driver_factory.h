@@ -43,6 +43,7 @@ class FileSystem;
 class FlushEarlyInfoFinder;
 class ExperimentMatcher;
 class Hasher;
+class ImageRewriteQueue;
 class MessageHandler;
 class NamedLockManager;
 class NonceGenerator;
@@ -56,6 +57,7 @@ class RewriteOptionsManager;
 class RewriteStats;
 class SHA1Signature;
 class Scheduler;
+class SimpleStats;
 class StaticAssetManager;
 class Statistics;
 class ThreadSystem;
@@ -164,6 +166,13 @@ class RewriteDriverFactory {
   NamedLockManager* lock_manager();
   QueuedWorkerPool* WorkerPool(WorkerPoolCategory pool);
   Scheduler* scheduler();
+  // Holds image rewrites waiting for one of the image_max_rewrites_at_once()
+  // slots to free up.  The slots are counted in a global statistic, so are
+  // shared by every ServerContext, and queued rewrites hold on to this
+  // process's drivers, so there is one queue per factory: any image rewrite
+  // finishing, whichever ServerContext it is for, gives the slot to the most
+  // requested queued rewrite.
+  ImageRewriteQueue* image_rewrite_queue();
   UsageDataReporter* usage_data_reporter();
   const pagespeed::js::JsTokenizerPatterns* js_tokenizer_patterns() const {
     return js_tokenizer_patterns_;
@@ -241,6 +250,12 @@ class RewriteDriverFactory {
   // SetStatistics, either from subclasses or externally.
   Statistics* statistics() { return statistics_; }
 
+  // Statistics kept in this process's memory only, for counts that must not
+  // be shared with the server's other processes even when statistics() is,
+  // such as those bounding this process's memory use.  A forked child gets
+  // its own copy.  These aren't shown on the statistics pages.
+  Statistics* process_local_statistics();
+
   // Initializes statistics variables.  This must be done at process
   // startup to enable shared memory segments in Apache to be set up.
   static void InitStats(Statistics* statistics);
@@ -459,6 +474,7 @@ class RewriteDriverFactory {
   scoped_ptr<StaticAssetManager> static_asset_manager_;
   scoped_ptr<Timer> timer_;
   scoped_ptr<Scheduler> scheduler_;
+  scoped_ptr<ImageRewriteQueue> image_rewrite_queue_;  // Uses scheduler_.
   scoped_ptr<UsageDataReporter> usage_data_reporter_;
   // RE2 patterns needed for JsTokenizer.
   const pagespeed::js::JsTokenizerPatterns* js_tokenizer_patterns_;
@@ -497,6 +513,7 @@ class RewriteDriverFactory {
   // by calling SetStatistics().
   NullStatistics null_statistics_;
   Statistics* statistics_;
+  scoped_ptr<SimpleStats> process_local_statistics_;
 
   StringSet created_directories_;
 
@@ -272,6 +272,9 @@ class RewriteOptions {
   static const char kImageLimitOptimizedPercent[];
   static const char kImageLimitRenderedAreaPercent[];
   static const char kImageLimitResizeAreaPercent[];
+  static const char kImageMaxDeferredRewriteWaitMs[];
+  static const char kImageMaxDeferredRewrites[];
+  static const char kImageMaxRewriteBytesAtOnce[];
   static const char kImageMaxRewritesAtOnce[];
   static const char kImagePreserveURLs[];
   static const char kImageRecompressionQuality[];
@@ -396,14 +399,23 @@ class RewriteOptions {
   static const char kFileCacheCleanInodeLimit[];
   static const char kFileCacheCleanIntervalMs[];
   static const char kFileCacheCleanSizeKb[];
+  static const char kFileCacheIndex[];
+  static const char kFileCacheIoThreads[];
+  static const char kFileCacheMaxEvictionsPerClean[];
   static const char kFileCachePath[];
   static const char kLogDir[];
   static const char kLruCacheByteLimit[];
   static const char kLruCacheKbPerProcess[];
+  static const char kMemcachedHedgeDelayUs[];
+  static const char kMemcachedReplicas[];
   static const char kMemcachedServers[];
+  static const char kMemcachedTargetLatencyUs[];
   static const char kMemcachedThreads[];
   static const char kMemcachedTimeoutUs[];
+  static const char kProfileFilters[];
   static const char kRateLimitBackgroundFetches[];
+  static const char kRequestTimelineSampleRate[];
+  static const char kRequestTimelineSlowThresholdMs[];
   static const char kServeWebpToAnyAgent[];
   static const char kSlurpDirectory[];
   static const char kSlurpFlushLimit[];
@@ -651,6 +663,9 @@ class RewriteOptions {
   static const int kDefaultMaxUrlSize;
 
   static const int kDefaultImageMaxRewritesAtOnce;
+  static const int64 kDefaultImageMaxRewriteBytesAtOnce;
+  static const int kDefaultImageMaxDeferredRewrites;
+  static const int64 kDefaultImageMaxDeferredRewriteWaitMs;
 
   // See http://code.google.com/p/modpagespeed/issues/detail?id=9
   // Apache evidently limits each URL path segment (between /) to
@@ -1468,6 +1483,40 @@ class RewriteOptions {
     set_option(x, &image_max_rewrites_at_once_);
   }
 
+  // Bound on the estimated decoded size, in bytes, of the images being
+  // rewritten at one time by each server process (0 = unbounded).  Unlike
+  // image_max_rewrites_at_once(), which is counted across the server, this
+  // bounds memory, so each process has its own budget.
+  int64 image_max_rewrite_bytes_at_once() const {
+    return image_max_rewrite_bytes_at_once_.value();
+  }
+  void set_image_max_rewrite_bytes_at_once(int64 x) {
+    set_option(x, &image_max_rewrite_bytes_at_once_);
+  }
+
+  // Image rewrites that find image_max_rewrites_at_once() already running, or
+  // that would go over image_max_rewrite_bytes_at_once(), are queued to run
+  // when one finishes, up to this many at a time; with 0 they are dropped
+  // instead.  A queued rewrite keeps its RewriteDriver alive until it runs,
+  // so this also bounds the drivers deferral can hold; it is capped at
+  // ImageRewriteQueue::kMaxQueuedRewrites, which is shared by all the vhosts
+  // in a process.
+  int image_max_deferred_rewrites() const {
+    return image_max_deferred_rewrites_.value();
+  }
+  void set_image_max_deferred_rewrites(int x) {
+    set_option(x, &image_max_deferred_rewrites_);
+  }
+
+  // How long a queued image rewrite waits for a free slot before it is tried
+  // regardless.
+  int64 image_max_deferred_rewrite_wait_ms() const {
+    return image_max_deferred_rewrite_wait_ms_.value();
+  }
+  void set_image_max_deferred_rewrite_wait_ms(int64 x) {
+    set_option(x, &image_max_deferred_rewrite_wait_ms_);
+  }
+
   // The maximum size of the entire URL.  If '0', this is left unlimited.
   int max_url_size() const { return max_url_size_.value(); }
   void set_max_url_size(int x) {
@@ -3413,6 +3462,9 @@ class RewriteOptions {
   Option<int64> image_webp_timeout_ms_;
 
   Option<int> image_max_rewrites_at_once_;
+  Option<int64> image_max_rewrite_bytes_at_once_;
+  Option<int> image_max_deferred_rewrites_;
+  Option<int64> image_max_deferred_rewrite_wait_ms_;
   Option<int> max_url_segment_size_;  // For http://a/b/c.d, use strlen("c.d").
   Option<int> max_url_size_;          // This is strlen("http://a/b/c.d").
   // The interval to wait for async rewrites to complete before flushing
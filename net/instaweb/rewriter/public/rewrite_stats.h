@@ -128,6 +128,24 @@ class RewriteStats {
   Waveform* thread_queue_depth(RewriteDriverFactory::WorkerPoolCategory pool) {
     return thread_queue_depths_[pool];
   }
+  // Number of times a worker in the pool took a sequence queued to another
+  // worker, and number of times one went idle, when work stealing is on.
+  Variable* worker_steals(RewriteDriverFactory::WorkerPoolCategory pool) {
+    return worker_steals_[pool];
+  }
+  Variable* worker_idles(RewriteDriverFactory::WorkerPoolCategory pool) {
+    return worker_idles_[pool];
+  }
+  // Number of times a sequence that an HTML flush window was waiting on ran
+  // ahead of older background work in the pool, and number of times one
+  // was shed because the window's deadline had already passed.
+  Variable* deadline_promotions(
+      RewriteDriverFactory::WorkerPoolCategory pool) {
+    return deadline_promotions_[pool];
+  }
+  Variable* stale_sheds(RewriteDriverFactory::WorkerPoolCategory pool) {
+    return stale_sheds_[pool];
+  }
 
   TimedVariable* num_rewrites_executed() { return num_rewrites_executed_; }
   TimedVariable* num_rewrites_dropped() { return num_rewrites_dropped_; }
@@ -169,6 +187,10 @@ class RewriteStats {
   TimedVariable* num_rewrites_dropped_;
 
   std::vector<Waveform*> thread_queue_depths_;
+  std::vector<Variable*> worker_steals_;
+  std::vector<Variable*> worker_idles_;
+  std::vector<Variable*> deadline_promotions_;
+  std::vector<Variable*> stale_sheds_;
 
   DISALLOW_COPY_AND_ASSIGN(RewriteStats);
 };
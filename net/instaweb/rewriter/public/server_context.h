@@ -57,14 +57,17 @@ class RequestProperties;
 class ExperimentMatcher;
 class FileSystem;
 class FlushEarlyInfoFinder;
+class FilterProfiler;
 class Function;
 class GoogleUrl;
 class Hasher;
+class ImageRewriteQueue;
 class MessageHandler;
 class NamedLock;
 class NamedLockManager;
 class PropertyStore;
 class RequestHeaders;
+class RequestTimelineStore;
 class ResponseHeaders;
 class RewriteDriver;
 class RewriteDriverFactory;
@@ -310,6 +313,26 @@ class ServerContext {
   RewriteStats* rewrite_stats() const { return rewrite_stats_; }
   MessageHandler* message_handler() const { return message_handler_; }
 
+  // If non-NULL, HTML filters and resource rewrites run for this server
+  // context record their costs here.  Not owned.
+  FilterProfiler* filter_profiler() const { return filter_profiler_; }
+  void set_filter_profiler(FilterProfiler* x) { filter_profiler_ = x; }
+
+  // If non-NULL, decides which requests record a RequestTimeline, and keeps
+  // them for the admin site.  Not owned.
+  RequestTimelineStore* request_timeline_store() const {
+    return request_timeline_store_;
+  }
+  void set_request_timeline_store(RequestTimelineStore* x) {
+    request_timeline_store_ = x;
+  }
+
+  // Gives request_context a timeline if there is a request_timeline_store()
+  // and it samples this request.  label identifies the request, typically by
+  // its URL.
+  void MaybeStartRequestTimeline(StringPiece label,
+                                 RequestContext* request_context);
+
   // Allocate an NamedLock to guard the creation of the given resource.  If the
   // object is expensive to create, this lock should be held during its creation
   // to avoid multiple rewrites happening at once.  The lock will be unlocked
@@ -538,6 +561,11 @@ class ServerContext {
     return low_priority_rewrite_workers_;
   }
 
+  // Holds image rewrites waiting for one of the image_max_rewrites_at_once()
+  // slots to free up.  Shared with the other ServerContexts in the process;
+  // NULL if there are no statistics to count them in.
+  ImageRewriteQueue* image_rewrite_queue() { return image_rewrite_queue_; }
+
   // Returns the number of rewrite drivers that we were aware of at the
   // time of the call. This includes those created via NewCustomRewriteDriver
   // and NewRewriteDriver, but not via NewUnmanagedRewriteDriver.
@@ -687,6 +715,8 @@ class ServerContext {
   // These are normally owned by the RewriteDriverFactory that made 'this'.
   ThreadSystem* thread_system_;
   RewriteStats* rewrite_stats_;
+  FilterProfiler* filter_profiler_;
+  RequestTimelineStore* request_timeline_store_;
   GoogleString file_prefix_;
   FileSystem* file_system_;
   UrlNamer* url_namer_;
@@ -779,6 +809,7 @@ class ServerContext {
   QueuedWorkerPool* html_workers_;  // Owned by the factory
   QueuedWorkerPool* rewrite_workers_;  // Owned by the factory
   QueuedWorkerPool* low_priority_rewrite_workers_;  // Owned by the factory
+  ImageRewriteQueue* image_rewrite_queue_;  // Owned by the factory
 
   AtomicBool shutting_down_;
 
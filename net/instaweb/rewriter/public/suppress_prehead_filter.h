@@ -50,6 +50,9 @@ class SuppressPreheadFilter : public HtmlWriterFilter {
 
   virtual void EndDocument();
 
+  // Unlike the base writer, this inserts a cookie script into the head.
+  virtual bool IsStreamingSafe() const { return false; }
+
  protected:
   virtual void Clear();
   RewriteDriver* driver() const { return driver_; }
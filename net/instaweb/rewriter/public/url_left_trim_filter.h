@@ -55,6 +55,7 @@ class UrlLeftTrimFilter : public CommonFilter {
   virtual void EndElementImpl(HtmlElement* element) {}
 
   virtual const char* Name() const { return "UrlLeftTrim"; }
+  virtual bool IsStreamingSafe() const { return true; }
 
   // Trim 'url_to_trim' relative to 'base_url' returning the result in
   // 'trimmed_url'. Returns true if we succeeded at trimming the URL.
@@ -79,6 +79,8 @@
 #include "net/instaweb/util/public/url_segment_encoder.h"
 #include "net/instaweb/util/public/writer.h"
 #include "pagespeed/kernel/base/callback.h"
+#include "pagespeed/kernel/base/filter_profiler.h"
+#include "pagespeed/kernel/base/request_timeline.h"
 #include "pagespeed/kernel/http/http_options.h"
 
 namespace net_instaweb {
@@ -1190,11 +1192,22 @@ class RewriteContext::InvokeRewriteFunction : public Function {
   virtual ~InvokeRewriteFunction() {}
 
   virtual void Run() {
-    context_->FindServerContext()->rewrite_stats()->num_rewrites_executed()
-        ->IncBy(1);
-    context_->Rewrite(partition_,
-                      context_->partitions_->mutable_partition(partition_),
-                      output_);
+    ServerContext* server_context = context_->FindServerContext();
+    server_context->rewrite_stats()->num_rewrites_executed()->IncBy(1);
+    CachedResult* partition =
+        context_->partitions_->mutable_partition(partition_);
+    FilterProfiler* profiler = server_context->filter_profiler();
+    int64 bytes = (profiler == NULL) ? 0 : InputBytes(*partition);
+
+    // Only the synchronous part of the rewrite is measured, which for most
+    // filters is all of it.
+    FilterProfiler::Scope profile(profiler, FilterProfiler::kRewrite,
+                                  context_->id(), bytes);
+    // Rewrite may finish the context and release the request, so keep the
+    // timeline alive until the span is recorded.
+    RequestTimelinePtr timeline(context_->Timeline());
+    RequestTimeline::Span span(timeline.get(), "rewrite", context_->id());
+    context_->Rewrite(partition_, partition, output_);
   }
 
   virtual void Cancel() {
@@ -1204,6 +1217,22 @@ class RewriteContext::InvokeRewriteFunction : public Function {
   }
 
  private:
+  // Returns the total size of the partition's inputs that were fetched.
+  int64 InputBytes(const CachedResult& partition) {
+    int64 bytes = 0;
+    for (int i = 0; i < partition.input_size(); ++i) {
+      const InputInfo& input = partition.input(i);
+      if (input.has_index()) {
+        ResourcePtr resource(context_->slot(input.index())->resource());
+        if ((resource.get() != NULL) && resource->loaded() &&
+            resource->HttpStatusOk()) {
+          bytes += resource->contents().size();
+        }
+      }
+    }
+    return bytes;
+  }
+
   RewriteContext* context_;
   int partition_;
   OutputResourcePtr output_;
@@ -1647,6 +1676,11 @@ void RewriteContext::OutputCacheMiss() {
     FetchInputs();
   } else {
     num_rewrites_abandoned_for_lock_contention_->Add(1);
+    RequestTimeline* timeline = Timeline();
+    if (timeline != NULL) {
+      timeline->AddInstant("lock", "creation lock", StrCat(
+          id(), " abandoned for contention"));
+    }
     MarkTooBusy();
     Activate();
   }
@@ -1905,6 +1939,14 @@ void RewriteContext::RepeatedFailure() {
   FinalizeRewriteForHtml();
 }
 
+RequestTimeline* RewriteContext::Timeline() const {
+  RewriteDriver* driver = Driver();
+  if ((driver == NULL) || (driver->request_context().get() == NULL)) {
+    return NULL;
+  }
+  return driver->request_context()->timeline();
+}
+
 NamedLock* RewriteContext::Lock() {
   NamedLock* result = lock_.get();
   if (result == NULL) {
@@ -2994,13 +3036,33 @@ void RewriteContext::StartFetch() {
     // Acquire the lock early, before checking the cache. This way, if another
     // context finished a rewrite while this one waited for the lock we can use
     // its cached output.
+    Function* callback;
+    if (Timeline() == NULL) {
+      callback = MakeFunction(this, &RewriteContext::StartFetchImpl,
+                              &RewriteContext::StartFetchImpl);
+    } else {
+      callback = MakeFunction(this, &RewriteContext::CreationLockAcquired,
+                              &RewriteContext::CreationLockTimedOut,
+                              FindServerContext()->timer()->NowUs());
+    }
     FindServerContext()->LockForCreation(
-        Lock(), Driver()->rewrite_worker(),
-        MakeFunction(this, &RewriteContext::StartFetchImpl,
-                     &RewriteContext::StartFetchImpl));
+        Lock(), Driver()->rewrite_worker(), callback);
   }
 }
 
+void RewriteContext::CreationLockAcquired(int64 wait_start_us) {
+  Timeline()->AddSpan("lock", "creation lock wait", id(), wait_start_us,
+                      FindServerContext()->timer()->NowUs());
+  StartFetchImpl();
+}
+
+void RewriteContext::CreationLockTimedOut(int64 wait_start_us) {
+  Timeline()->AddSpan("lock", "creation lock wait",
+                      StrCat(id(), " timed out"), wait_start_us,
+                      FindServerContext()->timer()->NowUs());
+  StartFetchImpl();
+}
+
 void RewriteContext::StartFetchImpl() {
   // If we have an on-the-fly resource, we almost always want to reconstruct it
   // --- there will be no shortcuts in the metadata cache unless the rewrite
@@ -455,6 +455,7 @@ void RewriteDriver::Clear() NO_THREAD_SAFETY_ANALYSIS {
     request_context_->WriteBackgroundRewriteLog();
     request_context_.reset(NULL);
   }
+  set_request_timeline(NULL);
   start_time_ms_ = 0;
 
   critical_css_result_.reset(NULL);
@@ -634,22 +635,20 @@ void RewriteDriver::FlushAsync(Function* callback) {
 
   DetermineEnabledFilters();
 
-  for (FilterList::iterator it = early_pre_render_filters_.begin();
-      it != early_pre_render_filters_.end(); ++it) {
-    HtmlFilter* filter = *it;
-    if (filter->is_enabled()) {
-      ApplyFilter(filter);
-    }
-  }
-  for (FilterList::iterator it = pre_render_filters_.begin();
-      it != pre_render_filters_.end(); ++it) {
-    HtmlFilter* filter = *it;
-    if (filter->is_enabled()) {
-      ApplyFilter(filter);
-    }
-  }
+  ApplyFilters(early_pre_render_filters_);
+  ApplyFilters(pre_render_filters_);
 
+  // Only a flush window that actually waits on a deadline gets one; when
+  // we wait for the rewrites to finish, or the delay is unlimited, they keep
+  // kNoDeadline so the worker doesn't demote or shed them as stale.
   int num_rewrites = rewrites_.size();
+  if (num_rewrites > 0 && !fully_rewrite_on_flush_) {
+    int64 delay_ms = ComputeCurrentFlushWindowRewriteDelayMs();
+    if (delay_ms > 0) {
+      SetRewriteSequenceDeadlineMs(server_context_->timer()->NowMs() +
+                                   delay_ms);
+    }
+  }
 
   // Copy all of the RewriteContext* into the initiated_rewrites_ set
   // *before* initiating them, as we are doing this before we lock.
@@ -721,6 +720,11 @@ int64 RewriteDriver::ComputeCurrentFlushWindowRewriteDelayMs() {
   return deadline;
 }
 
+void RewriteDriver::SetRewriteSequenceDeadlineMs(int64 deadline_ms) {
+  rewrite_worker_->set_deadline_ms(deadline_ms);
+  low_priority_rewrite_worker_->set_deadline_ms(deadline_ms);
+}
+
 void RewriteDriver::QueueFlushAsyncDone(int num_rewrites, Function* callback) {
   html_worker_->Add(MakeFunction(this, &RewriteDriver::FlushAsyncDone,
                                  num_rewrites, callback));
@@ -730,6 +734,12 @@ void RewriteDriver::FlushAsyncDone(int num_rewrites, Function* callback) {
   DCHECK(request_context_.get() != NULL);
   TracePrintf("RewriteDriver::FlushAsyncDone()");
 
+  // Anything still running for this flush window has been detached from
+  // the HTML, and competes with other background work from here on.
+  if (num_rewrites > 0) {
+    SetRewriteSequenceDeadlineMs(QueuedWorkerPool::kNoDeadline);
+  }
+
   {
     ScopedMutex lock(rewrite_mutex());
     DCHECK_EQ(0, possibly_quick_rewrites_);
@@ -2326,6 +2336,9 @@ bool RewriteDriver::StartParseId(const StringPiece& url, const StringPiece& id,
   }
   start_time_ms_ = server_context_->timer()->NowMs();
   set_log_rewrite_timing(options()->log_rewrite_timing());
+  set_filter_profiler(server_context_->filter_profiler());
+  set_request_timeline((request_context_.get() == NULL) ?
+                       NULL : request_context_->timeline());
 
   if (debug_filter_ != NULL) {
     debug_filter_->InitParse();
@@ -33,6 +33,8 @@
 #include "net/instaweb/rewriter/public/critical_selector_finder.h"
 #include "net/instaweb/rewriter/public/device_properties.h"
 #include "net/instaweb/rewriter/public/experiment_matcher.h"
+#include "net/instaweb/rewriter/public/image_rewrite_filter.h"
+#include "net/instaweb/rewriter/public/image_rewrite_queue.h"
 #include "net/instaweb/rewriter/public/process_context.h"
 #include "net/instaweb/rewriter/public/rewrite_driver.h"
 #include "net/instaweb/rewriter/public/rewrite_options.h"
@@ -62,7 +64,9 @@
 #include "net/instaweb/util/public/timer.h"
 #include "pagespeed/kernel/base/sha1_signature.h"
 #include "pagespeed/kernel/http/user_agent_normalizer.h"
+#include "pagespeed/kernel/thread/named_lock_wait_queue.h"
 #include "pagespeed/kernel/util/nonce_generator.h"
+#include "pagespeed/kernel/util/simple_stats.h"
 
 namespace net_instaweb {
 
@@ -97,6 +101,8 @@ void RewriteDriverFactory::Init() {
   slurp_read_only_ = false;
   slurp_print_urls_ = false;
   SetStatistics(&null_statistics_);
+  process_local_statistics_.reset(new SimpleStats(thread_system_.get()));
+  ImageRewriteFilter::InitProcessLocalStats(process_local_statistics_.get());
   server_context_mutex_.reset(thread_system_->NewMutex());
   worker_pools_.assign(kNumWorkerPools, NULL);
   hostname_ = GetHostname();
@@ -127,6 +133,10 @@ void RewriteDriverFactory::InitializeDefaultOptions() {
 RewriteDriverFactory::~RewriteDriverFactory() {
   ShutDown();
 
+  // Anything still queued holds on to a RewriteDriver, so must go before
+  // the server contexts do.
+  image_rewrite_queue_.reset(NULL);
+
   {
     ScopedMutex lock(server_context_mutex_.get());
     STLDeleteElements(&server_contexts_);
@@ -314,6 +324,14 @@ Scheduler* RewriteDriverFactory::scheduler() {
   return scheduler_.get();
 }
 
+ImageRewriteQueue* RewriteDriverFactory::image_rewrite_queue() {
+  if (image_rewrite_queue_.get() == NULL) {
+    image_rewrite_queue_.reset(new ImageRewriteQueue(
+        thread_system(), scheduler(), statistics()));
+  }
+  return image_rewrite_queue_.get();
+}
+
 Hasher* RewriteDriverFactory::hasher() {
   if (hasher_ == NULL) {
     hasher_.reset(NewHasher());
@@ -354,8 +372,10 @@ const std::vector<const UserAgentNormalizer*>&
 }
 
 NamedLockManager* RewriteDriverFactory::DefaultLockManager() {
-  return new FileSystemLockManager(file_system(), LockFilePrefix(),
-                                   scheduler(), message_handler());
+  FileSystemLockManager* lock_manager = new FileSystemLockManager(
+      file_system(), LockFilePrefix(), scheduler(), message_handler());
+  lock_manager->SetStatistics(statistics());
+  return lock_manager;
 }
 
 UrlNamer* RewriteDriverFactory::DefaultUrlNamer() {
@@ -458,6 +478,15 @@ QueuedWorkerPool* RewriteDriverFactory::WorkerPool(WorkerPoolCategory pool) {
     worker_pools_[pool] = CreateWorkerPool(pool, name);
     worker_pools_[pool]->set_queue_size_stat(
         rewrite_stats()->thread_queue_depth(pool));
+    worker_pools_[pool]->set_steal_count_stat(
+        rewrite_stats()->worker_steals(pool));
+    worker_pools_[pool]->set_idle_count_stat(
+        rewrite_stats()->worker_idles(pool));
+    worker_pools_[pool]->set_timer(timer());
+    worker_pools_[pool]->set_deadline_promotion_stat(
+        rewrite_stats()->deadline_promotions(pool));
+    worker_pools_[pool]->set_stale_shed_stat(
+        rewrite_stats()->stale_sheds(pool));
     if (pool == kLowPriorityRewriteWorkers) {
       worker_pools_[pool]->SetLoadSheddingThreshold(
           LowPriorityLoadSheddingThreshold());
@@ -752,6 +781,7 @@ void RewriteDriverFactory::InitStats(Statistics* statistics) {
   RewriteDriver::InitStats(statistics);
   RewriteStats::InitStats(statistics);
   CacheBatcher::InitStats(statistics);
+  NamedLockWaitQueue::InitStats(statistics);
   CriticalImagesFinder::InitStats(statistics);
   CriticalCssFinder::InitStats(statistics);
   CriticalSelectorFinder::InitStats(statistics);
@@ -769,6 +799,11 @@ void RewriteDriverFactory::Terminate() {
 void RewriteDriverFactory::SetStatistics(Statistics* statistics) {
   statistics_ = statistics;
   rewrite_stats_.reset(NULL);
+  image_rewrite_queue_.reset(NULL);  // Counts in the old statistics.
+}
+
+Statistics* RewriteDriverFactory::process_local_statistics() {
+  return process_local_statistics_.get();
 }
 
 RewriteStats* RewriteDriverFactory::rewrite_stats() {
@@ -814,6 +814,33 @@ TEST_F(RewriteDriverTest, BaseTags) {
   EXPECT_EQ("http://new.example.com/subdir/", BaseUrlSpec());
 }
 
+// The post-render filters that are streaming-safe run fused with the
+// minifiers and the writer, and must produce what they do unfused.
+TEST_F(RewriteDriverTest, FusedPostRenderFiltersMatchUnfused) {
+  AddRewriteDomainMapping("http://cdn.example.com/", kTestDomain);
+  options()->EnableFilter(RewriteOptions::kRewriteDomains);
+  options()->EnableFilter(RewriteOptions::kLeftTrimUrls);
+  options()->EnableFilter(RewriteOptions::kPedantic);
+  options()->EnableFilter(RewriteOptions::kRemoveQuotes);
+  options()->EnableFilter(RewriteOptions::kCollapseWhitespace);
+  rewrite_driver()->AddFilters();
+
+  const char kInput[] =
+      "<head>\n  <script src=\"a.js\"></script>\n"
+      "  <style>  p { color: red }  </style>\n</head>\n"
+      "<body>\n  <img src=\"http://test.com/b.png\">  \n"
+      "  <a href=\"http://test.com/c.html\">  c  </a>\n</body>\n";
+
+  rewrite_driver()->set_fuse_streaming_filters(false);
+  Parse("unfused", kInput);
+  GoogleString unfused = output_buffer_;
+  rewrite_driver()->set_fuse_streaming_filters(true);
+  Parse("fused", kInput);
+  EXPECT_EQ(unfused, output_buffer_);
+  EXPECT_NE(GoogleString::npos, output_buffer_.find("cdn.example.com/b.png"));
+  EXPECT_NE(GoogleString::npos, output_buffer_.find("text/javascript"));
+}
+
 TEST_F(RewriteDriverTest, RelativeBaseTag) {
   // Starting the parse, the base-tag will be derived from the html url.
   ASSERT_TRUE(rewrite_driver()->StartParse("http://example.com/index.html"));
@@ -153,6 +153,12 @@ const char RewriteOptions::kImageLimitRenderedAreaPercent[] =
     "ImageLimitRenderedAreaPercent";
 const char RewriteOptions::kImageLimitResizeAreaPercent[] =
     "ImageLimitResizeAreaPercent";
+const char RewriteOptions::kImageMaxDeferredRewriteWaitMs[] =
+    "ImageMaxDeferredRewriteWaitMs";
+const char RewriteOptions::kImageMaxDeferredRewrites[] =
+    "ImageMaxDeferredRewrites";
+const char RewriteOptions::kImageMaxRewriteBytesAtOnce[] =
+    "ImageMaxRewriteBytesAtOnce";
 const char RewriteOptions::kImageMaxRewritesAtOnce[] = "ImageMaxRewritesAtOnce";
 const char RewriteOptions::kImagePreserveURLs[] = "ImagePreserveURLs";
 const char RewriteOptions::kImageRecompressionQuality[] =
@@ -317,16 +323,29 @@ const char RewriteOptions::kFileCacheCleanInodeLimit[] =
 const char RewriteOptions::kFileCacheCleanIntervalMs[] =
     "FileCacheCleanIntervalMs";
 const char RewriteOptions::kFileCacheCleanSizeKb[] = "FileCacheSizeKb";
+const char RewriteOptions::kFileCacheIndex[] = "FileCacheIndex";
+const char RewriteOptions::kFileCacheIoThreads[] = "FileCacheIoThreads";
+const char RewriteOptions::kFileCacheMaxEvictionsPerClean[] =
+    "FileCacheMaxEvictionsPerClean";
 const char RewriteOptions::kFileCachePath[] = "FileCachePath";
 const char RewriteOptions::kLogDir[] = "LogDir";
 const char RewriteOptions::kLruCacheByteLimit[] = "LRUCacheByteLimit";
 const char RewriteOptions::kLruCacheKbPerProcess[] = "LRUCacheKbPerProcess";
+const char RewriteOptions::kMemcachedHedgeDelayUs[] = "MemcachedHedgeDelayUs";
+const char RewriteOptions::kMemcachedReplicas[] = "MemcachedReplicas";
 const char RewriteOptions::kMemcachedServers[] = "MemcachedServers";
+const char RewriteOptions::kMemcachedTargetLatencyUs[] =
+    "MemcachedTargetLatencyUs";
 const char RewriteOptions::kMemcachedThreads[] = "MemcachedThreads";
 const char RewriteOptions::kMemcachedTimeoutUs[] = "MemcachedTimeoutUs";
+const char RewriteOptions::kProfileFilters[] = "ProfileFilters";
 const char RewriteOptions::kRateLimitBackgroundFetches[] =
     "RateLimitBackgroundFetches";
 const char RewriteOptions::kRequestOptionOverride[] = "RequestOptionOverride";
+const char RewriteOptions::kRequestTimelineSampleRate[] =
+    "RequestTimelineSampleRate";
+const char RewriteOptions::kRequestTimelineSlowThresholdMs[] =
+    "RequestTimelineSlowThresholdMs";
 const char RewriteOptions::kServeWebpToAnyAgent[] =
     "ServeRewrittenWebpUrlsToAnyAgent";
 const char RewriteOptions::kSlurpDirectory[] = "SlurpDirectory";
@@ -431,6 +450,15 @@ const int64 RewriteOptions::kDefaultPrioritizeVisibleContentCacheTimeMs =
 // TODO(jmaessen): Determine a sane default for this value.
 const int RewriteOptions::kDefaultImageMaxRewritesAtOnce = 8;
 
+// Limit on the decoded size of concurrent ongoing image rewrites; none by
+// default.
+const int64 RewriteOptions::kDefaultImageMaxRewriteBytesAtOnce = 0;
+
+// Image rewrites over the limit above are dropped by default.
+const int RewriteOptions::kDefaultImageMaxDeferredRewrites = 0;
+const int64 RewriteOptions::kDefaultImageMaxDeferredRewriteWaitMs =
+    10 * Timer::kSecondMs;
+
 // IE limits URL size overall to about 2k characters.  See
 // http://support.microsoft.com/kb/208427/EN-US
 const int RewriteOptions::kDefaultMaxUrlSize = 2083;
@@ -1317,6 +1345,30 @@ void RewriteOptions::AddProperties() {
       kProcessScope,
       "Set bound on number of images being rewritten at one time "
       "(0 = unbounded).", true);
+  AddBaseProperty(
+      kDefaultImageMaxRewriteBytesAtOnce,
+      &RewriteOptions::image_max_rewrite_bytes_at_once_,
+      "imrb", kImageMaxRewriteBytesAtOnce,
+      kProcessScope,
+      "Set bound on the decoded size in bytes (width x height x 4) of the "
+      "images each server process rewrites at one time (0 = unbounded).",
+      true);
+  AddBaseProperty(
+      kDefaultImageMaxDeferredRewrites,
+      &RewriteOptions::image_max_deferred_rewrites_,
+      "imdr", kImageMaxDeferredRewrites,
+      kProcessScope,
+      "Number of image rewrites over ImageMaxRewritesAtOnce to queue until "
+      "one finishes, most requested first (0 = drop them, at most 64).  This "
+      "also applies to rewrites over ImageMaxRewriteBytesAtOnce.  Each "
+      "queued rewrite holds on to a rewrite driver until it runs.", true);
+  AddBaseProperty(
+      kDefaultImageMaxDeferredRewriteWaitMs,
+      &RewriteOptions::image_max_deferred_rewrite_wait_ms_,
+      "imdw", kImageMaxDeferredRewriteWaitMs,
+      kProcessScope,
+      "Longest time a queued image rewrite waits for a free slot before it "
+      "is tried anyway.", true);
   AddBaseProperty(
       kDefaultMaxUrlSegmentSize, &RewriteOptions::max_url_segment_size_,
       "uss", kMaxUrlSegmentSize,
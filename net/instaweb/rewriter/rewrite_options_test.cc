@@ -892,6 +892,9 @@ TEST_F(RewriteOptionsTest, LookupOptionByNameTest) {
     RewriteOptions::kImageLimitOptimizedPercent,
     RewriteOptions::kImageLimitRenderedAreaPercent,
     RewriteOptions::kImageLimitResizeAreaPercent,
+    RewriteOptions::kImageMaxDeferredRewriteWaitMs,
+    RewriteOptions::kImageMaxDeferredRewrites,
+    RewriteOptions::kImageMaxRewriteBytesAtOnce,
     RewriteOptions::kImageMaxRewritesAtOnce,
     RewriteOptions::kImagePreserveURLs,
     RewriteOptions::kImageRecompressionQuality,
@@ -1060,9 +1063,14 @@ TEST_F(RewriteOptionsTest, LookupNonBaseOptionByNameTest) {
   FailLookupOptionByName(RewriteOptions::kFileCachePath);
   FailLookupOptionByName(RewriteOptions::kFileCacheCleanSizeKb);
   FailLookupOptionByName(RewriteOptions::kFileCacheCleanInodeLimit);
+  FailLookupOptionByName(RewriteOptions::kFileCacheIndex);
+  FailLookupOptionByName(RewriteOptions::kFileCacheIoThreads);
+  FailLookupOptionByName(RewriteOptions::kFileCacheMaxEvictionsPerClean);
   FailLookupOptionByName(RewriteOptions::kLogDir);
   FailLookupOptionByName(RewriteOptions::kLruCacheByteLimit);
   FailLookupOptionByName(RewriteOptions::kLruCacheKbPerProcess);
+  FailLookupOptionByName(RewriteOptions::kMemcachedHedgeDelayUs);
+  FailLookupOptionByName(RewriteOptions::kMemcachedReplicas);
   FailLookupOptionByName(RewriteOptions::kMemcachedServers);
   FailLookupOptionByName(RewriteOptions::kMemcachedThreads);
   FailLookupOptionByName(RewriteOptions::kMemcachedTimeoutUs);
@@ -56,6 +56,34 @@ const char* kWaveFormCounters[RewriteDriverFactory::kNumWorkerPools] = {
   "low-priority-worked-queue-depth"
 };
 
+// Per-pool totals of the work-stealing counters that QueuedWorkerPool also
+// keeps per worker; see QueuedWorkerPool::GetWorkerStats.
+const char* kWorkerStealCounters[RewriteDriverFactory::kNumWorkerPools] = {
+  "html-worker-steals",
+  "rewrite-worker-steals",
+  "low-priority-worker-steals"
+};
+const char* kWorkerIdleCounters[RewriteDriverFactory::kNumWorkerPools] = {
+  "html-worker-idles",
+  "rewrite-worker-idles",
+  "low-priority-worker-idles"
+};
+
+// Per-pool counts of sequences run ahead of older background work because
+// an HTML flush window was waiting on them, and of sequences shed because
+// that window had already given up on them.
+const char* kDeadlinePromotionCounters[
+    RewriteDriverFactory::kNumWorkerPools] = {
+  "html-worker-deadline-promotions",
+  "rewrite-worker-deadline-promotions",
+  "low-priority-worker-deadline-promotions"
+};
+const char* kStaleShedCounters[RewriteDriverFactory::kNumWorkerPools] = {
+  "html-worker-stale-sheds",
+  "rewrite-worker-stale-sheds",
+  "low-priority-worker-stale-sheds"
+};
+
 // Variables for the beacon to increment.  These are currently handled in
 // mod_pagespeed_handler on apache.  The average load time in milliseconds is
 // total_page_load_ms / page_load_count.  Note that these are not updated
@@ -112,8 +140,8 @@ void RewriteStats::InitStats(Statistics* statistics) {
   statistics->AddVariable(kResourceUrlDomainAcceptances);
   statistics->AddVariable(kResourceUrlDomainRejections);
   statistics->AddVariable(kCachedOutputMissedDeadline);
-  statistics->AddVariable(kCachedOutputHits);
-  statistics->AddVariable(kCachedOutputMisses);
+  statistics->AddStripedVariable(kCachedOutputHits);
+  statistics->AddStripedVariable(kCachedOutputMisses);
   statistics->AddVariable(kInstawebResource404Count);
   statistics->AddVariable(kInstawebSlurp404Count);
   statistics->AddVariable(kTotalPageLoadMs);
@@ -150,6 +178,10 @@ void RewriteStats::InitStats(Statistics* statistics) {
 
   for (int i = 0; i < RewriteDriverFactory::kNumWorkerPools; ++i) {
     statistics->AddUpDownCounter(kWaveFormCounters[i]);
+    statistics->AddVariable(kWorkerStealCounters[i]);
+    statistics->AddVariable(kWorkerIdleCounters[i]);
+    statistics->AddVariable(kDeadlinePromotionCounters[i]);
+    statistics->AddVariable(kStaleShedCounters[i]);
   }
 }
 
@@ -232,6 +264,11 @@ RewriteStats::RewriteStats(Statistics* stats,
     thread_queue_depths_.push_back(
         new Waveform(thread_system, timer, kNumWaveformSamples,
                      stats->GetUpDownCounter(kWaveFormCounters[i])));
+    worker_steals_.push_back(stats->GetVariable(kWorkerStealCounters[i]));
+    worker_idles_.push_back(stats->GetVariable(kWorkerIdleCounters[i]));
+    deadline_promotions_.push_back(
+        stats->GetVariable(kDeadlinePromotionCounters[i]));
+    stale_sheds_.push_back(stats->GetVariable(kStaleShedCounters[i]));
   }
 }
 
@@ -41,6 +41,7 @@
 #include "net/instaweb/rewriter/public/critical_selector_finder.h"
 #include "net/instaweb/rewriter/public/experiment_matcher.h"
 #include "net/instaweb/rewriter/public/flush_early_info_finder.h"
+#include "net/instaweb/rewriter/public/image_rewrite_queue.h"
 #include "net/instaweb/rewriter/public/output_resource_kind.h"
 #include "net/instaweb/rewriter/public/request_properties.h"
 #include "net/instaweb/rewriter/public/resource.h"
@@ -75,6 +76,7 @@
 #include "net/instaweb/util/public/thread_system.h"
 #include "net/instaweb/util/public/timer.h"
 #include "pagespeed/kernel/base/escaping.h"
+#include "pagespeed/kernel/base/request_timeline.h"
 #include "pagespeed/kernel/base/string_writer.h"
 #include "pagespeed/kernel/html/html_keywords.h"
 
@@ -261,6 +263,8 @@ class GlobalOptionsRewriteDriverPool : public RewriteDriverPool {
 ServerContext::ServerContext(RewriteDriverFactory* factory)
     : thread_system_(factory->thread_system()),
       rewrite_stats_(NULL),
+      filter_profiler_(NULL),
+      request_timeline_store_(NULL),
       file_system_(factory->file_system()),
       url_namer_(NULL),
       user_agent_matcher_(NULL),
@@ -293,6 +297,7 @@ ServerContext::ServerContext(RewriteDriverFactory* factory)
       html_workers_(NULL),
       rewrite_workers_(NULL),
       low_priority_rewrite_workers_(NULL),
+      image_rewrite_queue_(NULL),
       static_asset_manager_(NULL),
       thread_synchronizer_(new ThreadSynchronizer(thread_system_)),
       experiment_matcher_(factory_->NewExperimentMatcher()),
@@ -353,6 +358,9 @@ void ServerContext::InitWorkers() {
       RewriteDriverFactory::kRewriteWorkers);
   low_priority_rewrite_workers_ = factory_->WorkerPool(
       RewriteDriverFactory::kLowPriorityRewriteWorkers);
+  if (statistics_ != NULL) {
+    image_rewrite_queue_ = factory_->image_rewrite_queue();
+  }
 }
 
 void ServerContext::PostInitHook() {
@@ -545,6 +553,14 @@ const int64 kBreakLockMs = 30 * Timer::kSecondMs;
 const int64 kBlockLockMs = 5 * Timer::kSecondMs;
 }  // namespace
 
+void ServerContext::MaybeStartRequestTimeline(
+    StringPiece label, RequestContext* request_context) {
+  if (request_timeline_store_ != NULL) {
+    request_context->set_timeline(
+        request_timeline_store_->MaybeStartTimeline(label));
+  }
+}
+
 bool ServerContext::TryLockForCreation(NamedLock* creation_lock) {
   return creation_lock->TryLockStealOld(kBreakLockMs);
 }
@@ -852,6 +868,12 @@ void ServerContext::ShutDownDrivers() {
   }
   shutdown_drivers_called_ = true;
 
+  // Don't make drivers wait out deferred image rewrites.  Other
+  // ServerContexts' rewrites stay queued, as they may be carrying on.
+  if (image_rewrite_queue_ != NULL) {
+    image_rewrite_queue_->CancelOwnedBy(this);
+  }
+
   if (!active_rewrite_drivers_.empty()) {
     message_handler_->Message(kInfo, "%d rewrite(s) still ongoing at exit",
                               static_cast<int>(active_rewrite_drivers_.size()));
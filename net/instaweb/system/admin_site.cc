@@ -38,6 +38,8 @@
 #include "net/instaweb/util/public/statistics_logger.h"
 #include "pagespeed/kernel/base/cache_interface.h"
 #include "pagespeed/kernel/base/callback.h"
+#include "pagespeed/kernel/base/filter_profiler.h"
+#include "pagespeed/kernel/base/request_timeline.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/string_writer.h"
@@ -89,6 +91,10 @@ const Tab kTabs[] = {
   {"Configuration", "Configuration", "config", "?config", kShortBreak},
   {"(SPDY)", "SPDY Configuration", "spdy_config", "?spdy_config", kLongBreak},
   {"Histograms", "Histograms", "histograms", "?histograms", kLongBreak},
+  {"Filter Profile", "Filter Profile", "filter_profile", "?filter_profile",
+   kLongBreak},
+  {"Slow Requests", "Slow Requests", "slow_requests", "?slow_requests",
+   kLongBreak},
   {"Caches", "Caches", "cache", "?cache", kLongBreak},
   {"Console", "Console", "console", NULL, kLongBreak},
   {"Message History", "Message History", "message_history", NULL, kLongBreak},
@@ -373,6 +379,209 @@ void AdminSite::PrintHistograms(AdminSource source, AsyncFetch* fetch,
 
 namespace {
 
+const char kFilterProfileProlog[] =
+    "<p>HTML filters are listed by name, timed over each flush window and "
+    "charged with the bytes of HTML in it.  Resource rewrites are listed by "
+    "filter id, timed over each rewrite and charged with its input bytes.  "
+    "Times are in microseconds; median and 99% are rounded up to a power of "
+    "two.  CPU times are n/a where the platform can't measure them per "
+    "thread.</p>\n"
+    "<p>This table covers only the server process that served this page.  "
+    "Resource rewrite times for the whole server are in the "
+    "filter_profile_rewrite_<i>id</i>_wall_us and _cpu_us histograms.</p>\n"
+    "<table>\n"
+    "  <thead><tr>\n"
+    "    <td>Kind</td><td>Filter</td><td>Runs</td><td>KB</td>\n"
+    "    <td>CPU total</td><td>CPU median</td><td>CPU 99%</td>"
+    "<td>CPU max</td>\n"
+    "    <td>Wall total</td><td>Wall median</td><td>Wall 99%</td>"
+    "<td>Wall max</td>\n"
+    "  </tr></thead>\n"
+    "  <tbody>\n";
+
+// Returns the total, median, 99% and max cells for a row of the table.
+GoogleString FilterProfileCells(const FilterProfiler::Measure& measure) {
+  if (measure.count == 0) {
+    return "<td>n/a</td><td>n/a</td><td>n/a</td><td>n/a</td>";
+  }
+  const int64 values[] = {
+    measure.total, measure.Percentile(50), measure.Percentile(99), measure.max
+  };
+  GoogleString cells;
+  for (int i = 0, n = arraysize(values); i < n; ++i) {
+    StrAppend(&cells, "<td>", Integer64ToString(values[i]), "</td>");
+  }
+  return cells;
+}
+
+}  // namespace
+
+void AdminSite::FilterProfileHandler(AdminSource source, AsyncFetch* fetch,
+                                     FilterProfiler* profiler) {
+  AdminHtml admin_html("filter_profile", "", source, fetch, message_handler_);
+  if (profiler == NULL) {
+    fetch->Write("<p>Filter profiling is off.  Turn on ProfileFilters to "
+                 "record the time spent in each filter.</p>\n",
+                 message_handler_);
+    return;
+  }
+  FilterProfiler::ProfileVector profiles;
+  profiler->Snapshot(&profiles);
+  fetch->Write(kFilterProfileProlog, message_handler_);
+  for (int i = 0, n = profiles.size(); i < n; ++i) {
+    const FilterProfiler::Profile& profile = profiles[i];
+    GoogleString escaped_id;
+    HtmlKeywords::Escape(profile.id, &escaped_id);
+    GoogleString row = StrCat(
+        "    <tr><td>", FilterProfiler::KindName(profile.kind),
+        "</td><td>", escaped_id,
+        "</td><td>", Integer64ToString(profile.wall_us.count),
+        "</td><td>", Integer64ToString(profile.bytes / 1024), "</td>");
+    StrAppend(&row, FilterProfileCells(profile.cpu_us),
+              FilterProfileCells(profile.wall_us), "</tr>\n");
+    fetch->Write(row, message_handler_);
+  }
+  fetch->Write("  </tbody>\n</table>\n", message_handler_);
+  const char* json_link = (source == kStatistics) ?
+      "?filter_profile_json" : "filter_profile_json";
+  fetch->Write(StrCat("<p><a href='", json_link, "'>As JSON</a></p>\n"),
+               message_handler_);
+}
+
+void AdminSite::FilterProfileJsonHandler(AsyncFetch* fetch,
+                                         FilterProfiler* profiler) {
+  if (profiler == NULL) {
+    fetch->response_headers()->SetStatusAndReason(HttpStatus::kNotFound);
+    fetch->response_headers()->Add(HttpAttributes::kContentType, "text/plain");
+    fetch->Write("ProfileFilters must be enabled to profile filters.",
+                 message_handler_);
+  } else {
+    fetch->response_headers()->SetStatusAndReason(HttpStatus::kOK);
+    fetch->response_headers()->Add(HttpAttributes::kContentType,
+                                   kContentTypeJson.mime_type());
+    profiler->DumpJson(fetch, message_handler_);
+  }
+  fetch->Done(true);
+}
+
+void AdminSite::SlowRequestsHandler(AdminSource source, AsyncFetch* fetch,
+                                    RequestTimelineStore* store) {
+  AdminHtml admin_html("slow_requests", "", source, fetch, message_handler_);
+  if (store == NULL) {
+    fetch->Write("<p>Request timelines are off.  Set "
+                 "RequestTimelineSampleRate to record a timeline for a "
+                 "sample of requests.</p>\n", message_handler_);
+    return;
+  }
+  RequestTimelineStore::TimelineVector timelines;
+  store->GetSlowTimelines(&timelines);
+  fetch->Write(StrCat(
+      "<p>Sampled requests that took at least ",
+      Integer64ToString(store->slow_threshold_us() / Timer::kMsUs),
+      "ms, slowest first.  Each trace can be loaded into "
+      "chrome://tracing.</p>\n"
+      "<table>\n"
+      "  <thead><tr>\n"
+      "    <td>Request</td><td>ms</td><td>Events</td><td>Trace</td>\n"
+      "  </tr></thead>\n"
+      "  <tbody>\n"), message_handler_);
+  const char* trace_link = (source == kStatistics) ?
+      "?request_trace&amp;id=" : "request_trace?id=";
+  for (int i = 0, n = timelines.size(); i < n; ++i) {
+    RequestTimeline* timeline = timelines[i].get();
+    GoogleString escaped_label;
+    HtmlKeywords::Escape(timeline->label(), &escaped_label);
+    GoogleString row = StrCat(
+        "    <tr><td>", escaped_label,
+        "</td><td>", Integer64ToString(timeline->DurationUs() / Timer::kMsUs),
+        "</td><td>", IntegerToString(timeline->num_events()),
+        "</td><td><a href='", trace_link);
+    StrAppend(&row, Integer64ToString(timeline->id()),
+              "'>Download</a></td></tr>\n");
+    fetch->Write(row, message_handler_);
+  }
+  fetch->Write("  </tbody>\n</table>\n", message_handler_);
+}
+
+namespace {
+
+void StartRequestTrace(int64 id, AsyncFetch* fetch) {
+  fetch->response_headers()->SetStatusAndReason(HttpStatus::kOK);
+  fetch->response_headers()->Add(HttpAttributes::kContentType,
+                                 kContentTypeJson.mime_type());
+  fetch->response_headers()->Add(
+      HttpAttributes::kContentDisposition,
+      StrCat("attachment; filename=request_trace_", Integer64ToString(id),
+             ".json"));
+}
+
+void NoSuchRequestTrace(AsyncFetch* fetch, MessageHandler* handler) {
+  fetch->response_headers()->SetStatusAndReason(HttpStatus::kNotFound);
+  fetch->response_headers()->Add(HttpAttributes::kContentType, "text/plain");
+  fetch->Write("No such request timeline; it may have been discarded.",
+               handler);
+}
+
+// Serves a trace recorded by another process from the cache it was shared
+// through; see RequestTimelineStore::set_shared_cache.
+class SharedRequestTraceCallback : public CacheInterface::Callback {
+ public:
+  SharedRequestTraceCallback(int64 id, AsyncFetch* fetch,
+                             MessageHandler* handler)
+      : id_(id), fetch_(fetch), handler_(handler) {}
+  virtual ~SharedRequestTraceCallback() {}
+
+  virtual void Done(CacheInterface::KeyState state) {
+    if (state == CacheInterface::kAvailable) {
+      StartRequestTrace(id_, fetch_);
+      fetch_->Write(value()->Value(), handler_);
+    } else {
+      NoSuchRequestTrace(fetch_, handler_);
+    }
+    fetch_->Done(true);
+    delete this;
+  }
+
+ private:
+  int64 id_;
+  AsyncFetch* fetch_;
+  MessageHandler* handler_;
+
+  DISALLOW_COPY_AND_ASSIGN(SharedRequestTraceCallback);
+};
+
+}  // namespace
+
+void AdminSite::RequestTraceHandler(const QueryParams& query_params,
+                                    AsyncFetch* fetch,
+                                    RequestTimelineStore* store) {
+  RequestTimelinePtr timeline;
+  GoogleString id_string;
+  int64 id = 0;
+  bool have_id = false;
+  if ((store != NULL) && query_params.Lookup1Unescaped("id", &id_string) &&
+      StringToInt64(id_string, &id)) {
+    have_id = true;
+    timeline = store->Find(id);
+  }
+  if (timeline.get() != NULL) {
+    StartRequestTrace(id, fetch);
+    timeline->DumpChromeTraceJson(fetch, message_handler_);
+  } else if (have_id && (store->shared_cache() != NULL)) {
+    // Recorded by another process, or finished here and since dropped from
+    // the store; either way its trace was shared if it was slow.
+    store->shared_cache()->Get(
+        RequestTimelineStore::SharedCacheKey(id),
+        new SharedRequestTraceCallback(id, fetch, message_handler_));
+    return;
+  } else {
+    NoSuchRequestTrace(fetch, message_handler_);
+  }
+  fetch->Done(true);
+}
+
+namespace {
+
 static const char kTableStart[] =
     "<table class='pagespeed-caches-structure'>\n"
     "  <thead>\n"
@@ -767,6 +976,17 @@ void AdminSite::AdminPage(
                   page_property_cache, server_context);
     } else if (leaf == "histograms") {
       PrintHistograms(kPageSpeedAdmin, fetch, stats);
+    } else if (leaf == "filter_profile") {
+      FilterProfileHandler(kPageSpeedAdmin, fetch,
+                           server_context->filter_profiler());
+    } else if (leaf == "filter_profile_json") {
+      FilterProfileJsonHandler(fetch, server_context->filter_profiler());
+    } else if (leaf == "slow_requests") {
+      SlowRequestsHandler(kPageSpeedAdmin, fetch,
+                          server_context->request_timeline_store());
+    } else if (leaf == "request_trace") {
+      RequestTraceHandler(query_params, fetch,
+                          server_context->request_timeline_store());
     } else {
       fetch->response_headers()->SetStatusAndReason(HttpStatus::kNotFound);
       fetch->response_headers()->Add(HttpAttributes::kContentType, "text/html");
@@ -807,6 +1027,16 @@ void AdminSite::StatisticsPage(
     PrintSpdyConfig(kStatistics, fetch, spdy_config);
   } else if (query_params.Has("histograms")) {
     PrintHistograms(kStatistics, fetch, stats);
+  } else if (query_params.Has("filter_profile")) {
+    FilterProfileHandler(kStatistics, fetch, server_context->filter_profiler());
+  } else if (query_params.Has("filter_profile_json")) {
+    FilterProfileJsonHandler(fetch, server_context->filter_profiler());
+  } else if (query_params.Has("slow_requests")) {
+    SlowRequestsHandler(kStatistics, fetch,
+                        server_context->request_timeline_store());
+  } else if (query_params.Has("request_trace")) {
+    RequestTraceHandler(query_params, fetch,
+                        server_context->request_timeline_store());
   } else if (query_params.Has("graphs")) {
     GraphsHandler(*options, kStatistics, query_params, fetch, statistics);
   } else if (query_params.Has("cache")) {
@@ -29,12 +29,18 @@
 #include "net/instaweb/system/public/system_server_context.h"
 #include "net/instaweb/util/public/gtest.h"
 #include "net/instaweb/util/public/platform.h"
+#include "net/instaweb/util/public/query_params.h"
 #include "net/instaweb/util/public/scoped_ptr.h"
 #include "net/instaweb/util/public/thread_system.h"
 #include "pagespeed/kernel/base/gmock.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/mock_message_handler.h"
+#include "pagespeed/kernel/base/request_timeline.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/cache/lru_cache.h"
+#include "pagespeed/kernel/http/http_names.h"
+#include "pagespeed/kernel/http/response_headers.h"
 
 namespace net_instaweb {
 
@@ -113,6 +119,38 @@ TEST_F(AdminSiteTest, ColorMessagesInHistoryPage) {
       buffer, ::testing::HasSubstr(StringPrintf(kColorTemplate, "brown")));
   EXPECT_THAT(buffer, ::testing::HasSubstr("style=\"margin:0;\""));
 }
+
+TEST_F(AdminSiteTest, ServesRequestTraceFromSharedCache) {
+  // Two stores sharing a cache stand in for two server processes.
+  LRUCache cache(100000);
+  RequestTimelineStore here(thread_system_.get(), timer(), 1, 0, 4);
+  RequestTimelineStore there(thread_system_.get(), timer(), 1, 0, 4);
+  here.set_shared_cache(&cache);
+  there.set_shared_cache(&cache);
+  RequestTimelinePtr timeline = there.MaybeStartTimeline("http://a.com/");
+  timeline->AddInstant("html", "flush", "");
+  timeline->Finish();
+
+  QueryParams query_params;
+  query_params.AddEscaped("id", Integer64ToString(timeline->id()));
+  GoogleString buffer;
+  StringAsyncFetch fetch(rewrite_driver()->request_context(), &buffer);
+  admin_site_->RequestTraceHandler(query_params, &fetch, &here);
+  ASSERT_TRUE(fetch.done());
+  EXPECT_EQ(HttpStatus::kOK, fetch.response_headers()->status_code());
+  EXPECT_THAT(buffer, ::testing::HasSubstr("\"name\": \"flush\""));
+
+  // Unknown ids are still not found.
+  query_params.Clear();
+  query_params.AddEscaped("id", "12345");
+  buffer.clear();
+  StringAsyncFetch missing_fetch(rewrite_driver()->request_context(), &buffer);
+  admin_site_->RequestTraceHandler(query_params, &missing_fetch, &here);
+  ASSERT_TRUE(missing_fetch.done());
+  EXPECT_EQ(HttpStatus::kNotFound,
+            missing_fetch.response_headers()->status_code());
+}
+
 // TODO(xqyin): Add unit tests for other methods in AdminSite.
 
 }  // namespace
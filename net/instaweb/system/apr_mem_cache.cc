@@ -18,7 +18,9 @@
 
 #include "net/instaweb/system/public/apr_mem_cache.h"
 
+#include <algorithm>
 #include <memory>
+#include <vector>
 
 #include "apr_pools.h"  // NOLINT
 
@@ -34,6 +36,7 @@
 #include "net/instaweb/util/public/string_util.h"
 #include "net/instaweb/util/public/timer.h"
 #include "net/instaweb/util/stack_buffer.h"
+#include "pagespeed/kernel/cache/consistent_hash_ring.h"
 #include "third_party/aprutil/apr_memcache2.h"
 
 namespace net_instaweb {
@@ -46,6 +49,7 @@ const int kDefaultMemcachedPort = 11211;
 const int kDefaultServerMin = 0;      // minimum # client sockets to open
 const int kDefaultServerSmax = 1;     // soft max # client connections to open
 const char kMemCacheTimeouts[] = "memcache_timeouts";
+const char kMemCacheHedgedReads[] = "memcache_hedged_reads";
 const char kLastErrorCheckpointMs[] = "memcache_last_error_checkpoint_ms";
 const char kErrorBurstSize[] = "memcache_error_burst_size";
 
@@ -62,6 +66,10 @@ const int kDefaultServerTtlUs = 600*1000*1000;
 
 const int kTimeoutUnset = -1;
 
+// Number of dead servers FindLiveServers remembers during a walk of the
+// ring, so it doesn't recheck them at every point they own.
+const int kMaxDeadServersTracked = 8;
+
 }  // namespace
 
 AprMemCache::AprMemCache(const StringPiece& servers, int thread_limit,
@@ -70,11 +78,14 @@ AprMemCache::AprMemCache(const StringPiece& servers, int thread_limit,
     : valid_server_spec_(false),
       thread_limit_(thread_limit),
       timeout_us_(kTimeoutUnset),
+      num_replicas_(1),
+      hedge_delay_us_(0),
       pool_(NULL),
       memcached_(NULL),
       hasher_(hasher),
       timer_(timer),
       timeouts_(statistics->GetVariable(kMemCacheTimeouts)),
+      hedged_reads_(statistics->GetVariable(kMemCacheHedgedReads)),
       last_error_checkpoint_ms_(statistics->GetUpDownCounter(
           kLastErrorCheckpointMs)),
       error_burst_size_(statistics->GetUpDownCounter(kErrorBurstSize)),
@@ -125,6 +136,7 @@ AprMemCache::~AprMemCache() {
 
 void AprMemCache::InitStats(Statistics* statistics) {
   statistics->AddVariable(kMemCacheTimeouts);
+  statistics->AddVariable(kMemCacheHedgedReads);
   statistics->AddUpDownCounter(kLastErrorCheckpointMs);
   statistics->AddUpDownCounter(kErrorBurstSize);
 }
@@ -133,6 +145,7 @@ bool AprMemCache::Connect() {
   apr_status_t status =
       apr_memcache2_create(pool_, hosts_.size(), 0, &memcached_);
   bool success = false;
+  StringVector server_names;
   if ((status == APR_SUCCESS) && !hosts_.empty()) {
     success = true;
     CHECK_EQ(hosts_.size(), ports_.size());
@@ -156,12 +169,79 @@ bool AprMemCache::Connect() {
           apr_memcache2_set_timeout_microseconds(memcached_, timeout_us_);
         }
         servers_.push_back(server);
+        server_names.push_back(StrCat(hosts_[i], ":",
+                                      IntegerToString(ports_[i])));
       }
     }
   }
+
+  // Pick servers from a consistent-hash ring rather than apr_memcache2's
+  // hash-modulo-N, so that adding or removing a server only moves the keys
+  // on it.  apr_memcache2's default hash only has 15 bits, so use the full
+  // 32-bit crc32 to place keys on the ring.
+  ring_.reset(new ConsistentHashRing(server_names));
+  if (memcached_ != NULL) {
+    memcached_->hash_func = apr_memcache2_hash_crc32;
+    memcached_->hash_baton = NULL;
+    memcached_->server_func = FindServerCallback;
+    memcached_->server_baton = this;
+  }
   return success;
 }
 
+void AprMemCache::set_num_replicas(int num_replicas) {
+  num_replicas_ = std::max(1, num_replicas);
+}
+
+void AprMemCache::set_hedge_delay_us(int hedge_delay_us) {
+  hedge_delay_us_ = std::max(0, hedge_delay_us);
+}
+
+apr_memcache2_server_t* AprMemCache::FindServerCallback(
+    void* baton, apr_memcache2_t* memcached, const uint32 hash) {
+  AprMemCache* cache = static_cast<AprMemCache*>(baton);
+  apr_memcache2_server_t* server;
+  return (cache->FindLiveServers(hash, 1, &server) == 1) ? server : NULL;
+}
+
+int AprMemCache::FindLiveServers(uint32 hash, int max_servers,
+                                 apr_memcache2_server_t** servers) {
+  int num_found = 0;
+  if (ring_->num_servers() == 0) {
+    return num_found;
+  }
+  max_servers = std::min(max_servers, ring_->num_servers());
+
+  // Each server owns many points, so skip the ones already taken, and the
+  // dead ones, which are only checked the first time they are met.
+  int num_dead = 0;
+  apr_memcache2_server_t* dead[kMaxDeadServersTracked];
+  for (int i = ring_->FirstPointIndex(hash), n = 0;
+       (n < ring_->num_points()) && (num_found < max_servers);
+       ++n, i = ring_->NextPointIndex(i)) {
+    apr_memcache2_server_t* server = servers_[ring_->ServerAtPoint(i)];
+    if ((std::find(servers, servers + num_found, server) !=
+         servers + num_found) ||
+        (std::find(dead, dead + num_dead, server) != dead + num_dead)) {
+      continue;
+    }
+    if (apr_memcache2_server_is_live(memcached_, server)) {
+      servers[num_found++] = server;
+    } else if (num_dead < kMaxDeadServersTracked) {
+      dead[num_dead++] = server;
+    }
+  }
+  return num_found;
+}
+
+void AprMemCache::FindServers(const GoogleString& hashed_key,
+                              ServerVector* servers) {
+  uint32 hash = apr_memcache2_hash(memcached_, hashed_key.data(),
+                                   hashed_key.size());
+  servers->resize(num_replicas_);
+  servers->resize(FindLiveServers(hash, num_replicas_, &(*servers)[0]));
+}
+
 void AprMemCache::DecodeValueMatchingKeyAndCallCallback(
     const GoogleString& key, const char* data, size_t data_len,
     const char* calling_method, Callback* callback) {
@@ -190,27 +270,63 @@ void AprMemCache::Get(const GoogleString& key, Callback* callback) {
     ValidateAndReportResult(key, CacheInterface::kNotFound, callback);
     return;
   }
+  GoogleString hashed_key = hasher_->Hash(key);
+
+  // Try each server the value is stored on in turn, so that a slow or
+  // failed server doesn't turn into a miss when there's a replica.  Rather
+  // than wait out the full timeout (set_timeout_us) on a slow first server,
+  // the read is also sent to the second after set_hedge_delay_us, and the
+  // first reply wins.  A server that times out altogether is marked dead,
+  // so later reads go straight to the replica until apr_memcache2 revives
+  // it, which it tries every 5 seconds.
+  ServerVector servers;
+  FindServers(hashed_key, &servers);
+  GetFromServers(key, hashed_key, servers, callback);
+}
+
+void AprMemCache::GetFromServers(const GoogleString& key,
+                                 const GoogleString& hashed_key,
+                                 const ServerVector& servers,
+                                 Callback* callback) {
   apr_pool_t* data_pool;
   apr_pool_create(&data_pool, pool_);
   CHECK(data_pool != NULL) << "apr_pool_t data_pool allocation failure";
-  GoogleString hashed_key = hasher_->Hash(key);
   char* data;
   apr_size_t data_len;
-  apr_status_t status = apr_memcache2_getp(
-      memcached_, data_pool, hashed_key.c_str(), &data, &data_len, NULL);
+  apr_status_t status = APR_NOTFOUND;
+  for (int i = 0, n = servers.size(); i < n; ++i) {
+    if ((i == 0) && (n > 1) && (hedge_delay_us_ > 0)) {
+      // The hedged read covers servers[1] as well.
+      int hedged = 0;
+      status = apr_memcache2_getp_hedged(
+          memcached_, servers[0], servers[1], hedge_delay_us_, data_pool,
+          hashed_key.c_str(), &data, &data_len, NULL, &hedged);
+      if (hedged) {
+        hedged_reads_->Add(1);
+      }
+      ++i;
+    } else {
+      status = apr_memcache2_getp_server(
+          memcached_, servers[i], data_pool, hashed_key.c_str(), &data,
+          &data_len, NULL);
+    }
+    if ((status == APR_SUCCESS) || (status == APR_NOTFOUND)) {
+      break;
+    }
+    char buf[kStackBufferSize];
+    apr_strerror(status, buf, sizeof(buf));
+    message_handler_->Message(
+        kError, "AprMemCache::Get error: %s (%d) on key %s",
+        buf, status, key.c_str());
+    if (status == APR_TIMEUP) {
+      timeouts_->Add(1);
+    }
+  }
   if (status == APR_SUCCESS) {
     DecodeValueMatchingKeyAndCallCallback(key, data, data_len, "Get", callback);
   } else {
     if (status != APR_NOTFOUND) {
       RecordError();
-      char buf[kStackBufferSize];
-      apr_strerror(status, buf, sizeof(buf));
-      message_handler_->Message(
-          kError, "AprMemCache::Get error: %s (%d) on key %s",
-          buf, status, key.c_str());
-      if (status == APR_TIMEUP) {
-        timeouts_->Add(1);
-      }
     }
     ValidateAndReportResult(key, CacheInterface::kNotFound, callback);
   }
@@ -222,7 +338,11 @@ void AprMemCache::MultiGet(MultiGetRequest* request) {
     ReportMultiGetNotFound(request);
     return;
   }
+  MultiGetHelper(request, num_replicas_ > 1);
+}
 
+void AprMemCache::MultiGetHelper(MultiGetRequest* request,
+                                 bool retry_on_replicas) {
   // apr_memcache2_multgetp documentation indicates it may clear the
   // temp_pool inside the function.  Thus it is risky to pass the same
   // pool for both temp_pool and data_pool, as we need to read the
@@ -236,16 +356,27 @@ void AprMemCache::MultiGet(MultiGetRequest* request) {
   apr_hash_t* hash_table = apr_hash_make(data_pool);
   StringVector hashed_keys;
 
+  // With replicas, remember the server each key is read from, so we can
+  // tell whether a failed read has anywhere else to go.
+  ServerVector primary_servers;
   for (int i = 0, n = request->size(); i < n; ++i) {
     GoogleString hashed_key = hasher_->Hash((*request)[i].key);
     hashed_keys.push_back(hashed_key);
     apr_memcache2_add_multget_key(data_pool, hashed_key.c_str(), &hash_table);
+    if (retry_on_replicas) {
+      apr_memcache2_server_t* server = NULL;
+      FindLiveServers(apr_memcache2_hash(memcached_, hashed_key.data(),
+                                         hashed_key.size()),
+                      1, &server);
+      primary_servers.push_back(server);
+    }
   }
 
   apr_status_t status = apr_memcache2_multgetp(memcached_, temp_pool, data_pool,
                                                hash_table);
   apr_pool_destroy(temp_pool);
   bool error_recorded = false;
+  MultiGetRequest* retry_request = NULL;
   if (status == APR_SUCCESS) {
     for (int i = 0, n = request->size(); i < n; ++i) {
       CacheInterface::KeyCallback* key_callback = &(*request)[i];
@@ -262,24 +393,41 @@ void AprMemCache::MultiGet(MultiGetRequest* request) {
       if (status == APR_SUCCESS) {
         DecodeValueMatchingKeyAndCallCallback(key, value->data, value->len,
                                               "MultiGet", callback);
-      } else {
-        if (status != APR_NOTFOUND) {
-          if (!error_recorded) {
-            // Only count 1 error towards threshold on MultiGet failure.
-            error_recorded = true;
-            RecordError();
-          }
-          char buf[kStackBufferSize];
-          apr_strerror(status, buf, sizeof(buf));
-          message_handler_->Message(
-              kError, "AprMemCache::MultiGet error: %s (%d) on key %s",
-              buf, status, key.c_str());
-          if (status == APR_TIMEUP) {
-            timeouts_->Add(1);
+        continue;
+      }
+      if ((status != APR_NOTFOUND) && retry_on_replicas) {
+        // The failure marked the key's server dead, so apr_memcache2 will
+        // now pick the next replica on the ring for it.  Batch up all such
+        // keys and read them again together once we're done here, which
+        // costs one more round trip in all, not one per key.
+        apr_memcache2_server_t* replica = NULL;
+        FindLiveServers(apr_memcache2_hash(memcached_, hashed_key.data(),
+                                           hashed_key.size()),
+                        1, &replica);
+        if ((replica != NULL) && (replica != primary_servers[i])) {
+          if (retry_request == NULL) {
+            retry_request = new MultiGetRequest;
           }
+          retry_request->push_back(*key_callback);
+          continue;
+        }
+      }
+      if (status != APR_NOTFOUND) {
+        if (!error_recorded) {
+          // Only count 1 error towards threshold on MultiGet failure.
+          error_recorded = true;
+          RecordError();
+        }
+        char buf[kStackBufferSize];
+        apr_strerror(status, buf, sizeof(buf));
+        message_handler_->Message(
+            kError, "AprMemCache::MultiGet error: %s (%d) on key %s",
+            buf, status, key.c_str());
+        if (status == APR_TIMEUP) {
+          timeouts_->Add(1);
         }
-        ValidateAndReportResult(key, CacheInterface::kNotFound, callback);
       }
+      ValidateAndReportResult(key, CacheInterface::kNotFound, callback);
     }
     delete request;
   } else {
@@ -292,6 +440,9 @@ void AprMemCache::MultiGet(MultiGetRequest* request) {
     ReportMultiGetNotFound(request);
   }
   apr_pool_destroy(data_pool);
+  if (retry_request != NULL) {
+    MultiGetHelper(retry_request, false);
+  }
 }
 
 void AprMemCache::PutHelper(const GoogleString& key,
@@ -299,26 +450,67 @@ void AprMemCache::PutHelper(const GoogleString& key,
   // I believe apr_memcache2_set erroneously takes a char* for the value.
   // Hence we const_cast.
   GoogleString hashed_key = hasher_->Hash(key);
-  apr_status_t status = apr_memcache2_set(
-      memcached_, hashed_key.c_str(),
-      const_cast<char*>(key_and_value->data()), key_and_value->size(),
-      0, 0);
+  ServerVector servers;
+  FindServers(hashed_key, &servers);
+  if (servers.empty()) {
+    ReportPutError(key, *key_and_value, APR_NOTFOUND);
+    return;
+  }
+  if (servers.size() == 1) {
+    apr_status_t status = apr_memcache2_set_server(
+        memcached_, servers[0], hashed_key.c_str(),
+        const_cast<char*>(key_and_value->data()), key_and_value->size(),
+        0, 0);
+    if (status != APR_SUCCESS) {
+      RecordError();
+      ReportPutError(key, *key_and_value, status);
+    }
+    return;
+  }
+
+  // Send the value to all its replicas at once, so they store it in
+  // parallel and the put costs one round trip rather than one per replica.
+  std::vector<apr_memcache2_value_t> values(servers.size());
+  for (int i = 0, n = values.size(); i < n; ++i) {
+    apr_memcache2_value_t* value = &values[i];
+    value->status = APR_SUCCESS;
+    value->key = hashed_key.c_str();
+    value->data = const_cast<char*>(key_and_value->data());
+    value->len = key_and_value->size();
+    value->flags = 0;
+  }
+  apr_pool_t* temp_pool = NULL;
+  apr_pool_create(&temp_pool, pool_);
+  CHECK(temp_pool != NULL) << "apr_pool_t temp_pool allocation failure";
+  apr_status_t status = apr_memcache2_multset(
+      memcached_, temp_pool, &values[0], &servers[0], values.size(), 0);
+  apr_pool_destroy(temp_pool);
   if (status != APR_SUCCESS) {
+    // Only count 1 error towards threshold if several replicas fail.
     RecordError();
-    char buf[kStackBufferSize];
-    apr_strerror(status, buf, sizeof(buf));
-
-    int value_size = key_value_codec::GetValueSizeFromKeyAndKeyValue(
-        key, *key_and_value);
-    message_handler_->Message(
-        kError, "AprMemCache::Put error: %s (%d) on key %s, value-size %d",
-        buf, status, key.c_str(), value_size);
-    if (status == APR_TIMEUP) {
-      timeouts_->Add(1);
+    for (int i = 0, n = values.size(); i < n; ++i) {
+      if (values[i].status != APR_SUCCESS) {
+        ReportPutError(key, *key_and_value, values[i].status);
+      }
     }
   }
 }
 
+void AprMemCache::ReportPutError(const GoogleString& key,
+                                 const SharedString& key_and_value,
+                                 int status) {
+  char buf[kStackBufferSize];
+  apr_strerror(status, buf, sizeof(buf));
+  int value_size = key_value_codec::GetValueSizeFromKeyAndKeyValue(
+      key, key_and_value);
+  message_handler_->Message(
+      kError, "AprMemCache::Put error: %s (%d) on key %s, value-size %d",
+      buf, status, key.c_str(), value_size);
+  if (status == APR_TIMEUP) {
+    timeouts_->Add(1);
+  }
+}
+
 void AprMemCache::PutWithKeyInValue(const GoogleString& key,
                                     SharedString* key_and_value) {
   if (!IsHealthy()) {
@@ -343,6 +535,124 @@ void AprMemCache::Put(const GoogleString& key, SharedString* value) {
   }
 }
 
+void AprMemCache::MultiPutHelper(MultiPutRequest* request) {
+  int num_values = request->size();
+  if (num_values == 0) {
+    delete request;
+    return;
+  }
+
+  apr_pool_t* temp_pool = NULL;
+  apr_pool_create(&temp_pool, pool_);
+  CHECK(temp_pool != NULL) << "apr_pool_t temp_pool allocation failure";
+
+  // Hash all the keys before pointing values at them, so the hashed keys
+  // don't move.
+  StringVector hashed_keys(num_values);
+  for (int i = 0; i < num_values; ++i) {
+    hashed_keys[i] = hasher_->Hash((*request)[i].key);
+  }
+
+  // With replicas, every value is sent to each of its servers, which we
+  // name explicitly.  Otherwise apr_memcache2 finds the one server for each
+  // value itself, via FindServerCallback.
+  std::vector<apr_memcache2_value_t> values;
+  std::vector<int> request_indices;
+  ServerVector value_servers;
+  values.reserve(num_values * num_replicas_);
+  for (int i = 0; i < num_values; ++i) {
+    ServerVector servers;
+    if (num_replicas_ > 1) {
+      FindServers(hashed_keys[i], &servers);
+      value_servers.insert(value_servers.end(), servers.begin(),
+                           servers.end());
+    } else {
+      servers.push_back(NULL);
+    }
+    SharedString* key_and_value = &(*request)[i].value;
+    for (int j = 0, n = servers.size(); j < n; ++j) {
+      values.push_back(apr_memcache2_value_t());
+      apr_memcache2_value_t* value = &values.back();
+      value->status = APR_SUCCESS;
+      value->key = hashed_keys[i].c_str();
+      // As in PutHelper, apr_memcache2 takes a char* for the value.
+      value->data = const_cast<char*>(key_and_value->data());
+      value->len = key_and_value->size();
+      value->flags = 0;
+      request_indices.push_back(i);
+    }
+  }
+
+  apr_status_t status = APR_SUCCESS;
+  if (!values.empty()) {
+    status = apr_memcache2_multset(
+        memcached_, temp_pool, &values[0],
+        value_servers.empty() ? NULL : &value_servers[0], values.size(), 0);
+  }
+  apr_pool_destroy(temp_pool);
+  if (status != APR_SUCCESS) {
+    bool error_recorded = false;
+    for (int i = 0, n = values.size(); i < n; ++i) {
+      status = values[i].status;
+      if (status == APR_SUCCESS) {
+        continue;
+      }
+      if (!error_recorded) {
+        // Only count 1 error towards threshold on MultiPut failure.
+        error_recorded = true;
+        RecordError();
+      }
+      char buf[kStackBufferSize];
+      apr_strerror(status, buf, sizeof(buf));
+      const KeyValue& key_value = (*request)[request_indices[i]];
+      int value_size = key_value_codec::GetValueSizeFromKeyAndKeyValue(
+          key_value.key, key_value.value);
+      message_handler_->Message(
+          kError,
+          "AprMemCache::MultiPut error: %s (%d) on key %s, value-size %d",
+          buf, status, key_value.key.c_str(), value_size);
+      if (status == APR_TIMEUP) {
+        timeouts_->Add(1);
+      }
+    }
+  }
+  delete request;
+}
+
+void AprMemCache::MultiPutWithKeyInValue(MultiPutRequest* request) {
+  if (!IsHealthy()) {
+    delete request;
+    return;
+  }
+  MultiPutHelper(request);
+}
+
+void AprMemCache::MultiPut(MultiPutRequest* request) {
+  if (!IsHealthy()) {
+    delete request;
+    return;
+  }
+
+  MultiPutRequest* encoded_request = new MultiPutRequest;
+  encoded_request->reserve(request->size());
+  for (int i = 0, n = request->size(); i < n; ++i) {
+    KeyValue* key_value = &(*request)[i];
+    SharedString key_and_value;
+    if (key_value_codec::Encode(key_value->key, &key_value->value,
+                                &key_and_value)) {
+      encoded_request->push_back(KeyValue(key_value->key, key_and_value));
+    } else {
+      message_handler_->Message(
+          kError, "AprMemCache::MultiPut error: key size %d too large, first "
+          "100 bytes of key is: %s",
+          static_cast<int>(key_value->key.size()),
+          key_value->key.substr(0, 100).c_str());
+    }
+  }
+  delete request;
+  MultiPutHelper(encoded_request);
+}
+
 void AprMemCache::Delete(const GoogleString& key) {
   if (!IsHealthy()) {
     return;
@@ -363,16 +673,25 @@ void AprMemCache::Delete(const GoogleString& key) {
   // will be tossed.
 
   GoogleString hashed_key = hasher_->Hash(key);
-  apr_status_t status = apr_memcache2_delete(memcached_, hashed_key.c_str(), 0);
-  if ((status != APR_SUCCESS) && (status != APR_NOTFOUND)) {
-    RecordError();
-    char buf[kStackBufferSize];
-    apr_strerror(status, buf, sizeof(buf));
-    message_handler_->Message(
-        kError, "AprMemCache::Delete error: %s (%d) on key %s", buf, status,
-        key.c_str());
-    if (status == APR_TIMEUP) {
-      timeouts_->Add(1);
+  ServerVector servers;
+  FindServers(hashed_key, &servers);
+  bool error_recorded = false;
+  for (int i = 0, n = servers.size(); i < n; ++i) {
+    apr_status_t status = apr_memcache2_delete_server(
+        memcached_, servers[i], hashed_key.c_str(), 0);
+    if ((status != APR_SUCCESS) && (status != APR_NOTFOUND)) {
+      if (!error_recorded) {
+        error_recorded = true;
+        RecordError();
+      }
+      char buf[kStackBufferSize];
+      apr_strerror(status, buf, sizeof(buf));
+      message_handler_->Message(
+          kError, "AprMemCache::Delete error: %s (%d) on key %s", buf, status,
+          key.c_str());
+      if (status == APR_TIMEUP) {
+        timeouts_->Add(1);
+      }
     }
   }
 }
@@ -314,6 +314,78 @@ TEST_F(AprMemCacheTest, LargeValueMultiGet) {
   WaitAndCheck(large2, kLargeValue2);
 }
 
+TEST_F(AprMemCacheTest, MultiPut) {
+  if (!InitMemcachedOrSkip(true)) {
+    return;
+  }
+  TestMultiPut(10);
+  EXPECT_EQ(0, lru_cache_->size_bytes()) << "fallback not used.";
+  EXPECT_TRUE(servers_->IsHealthy());
+}
+
+TEST_F(AprMemCacheTest, LargeValueMultiPut) {
+  if (!InitMemcachedOrSkip(true)) {
+    return;
+  }
+  const GoogleString kLargeValue(kLargeWriteSize, 'a');
+  CacheInterface::MultiPutRequest* request =
+      new CacheInterface::MultiPutRequest;
+  request->push_back(CacheInterface::KeyValue("small1",
+                                              SharedString("value1")));
+  request->push_back(CacheInterface::KeyValue("large",
+                                              SharedString(kLargeValue)));
+  request->push_back(CacheInterface::KeyValue("small2",
+                                              SharedString("value2")));
+  cache_->MultiPut(request);
+  CheckGet("small1", "value1");
+  CheckGet("large", kLargeValue);
+  CheckGet("small2", "value2");
+  EXPECT_LE(kLargeWriteSize, lru_cache_->size_bytes())
+      << "Checks that the large value was written to the fallback cache";
+}
+
+// Compares a batch of individual Puts against a single pipelined MultiPut.
+// This is not a pass/fail test; the timings are logged so they can be
+// compared against a real memcached started by
+// install/run_program_with_memcached.sh.
+TEST_F(AprMemCacheTest, MultiPutTiming) {
+  if (!InitMemcachedOrSkip(true)) {
+    return;
+  }
+  const int kNumValues = 100;
+  const int kNumIters = 20;
+  AprTimer timer;
+
+  int64 start_us = timer.NowUs();
+  for (int iter = 0; iter < kNumIters; ++iter) {
+    for (int i = 0; i < kNumValues; ++i) {
+      SharedString value(StringPrintf("serial value %d", i));
+      servers_->Put(StringPrintf("serial%d", i), &value);
+    }
+  }
+  int64 serial_us = timer.NowUs() - start_us;
+
+  start_us = timer.NowUs();
+  for (int iter = 0; iter < kNumIters; ++iter) {
+    CacheInterface::MultiPutRequest* request =
+        new CacheInterface::MultiPutRequest;
+    for (int i = 0; i < kNumValues; ++i) {
+      request->push_back(CacheInterface::KeyValue(
+          StringPrintf("pipelined%d", i),
+          SharedString(StringPrintf("pipelined value %d", i))));
+    }
+    servers_->MultiPut(request);
+  }
+  int64 pipelined_us = timer.NowUs() - start_us;
+
+  LOG(INFO) << kNumIters << " batches of " << kNumValues << " writes: "
+            << "serial Put " << serial_us << "us, "
+            << "pipelined MultiPut " << pipelined_us << "us";
+  EXPECT_TRUE(servers_->IsHealthy());
+  CheckGet(servers_.get(), StringPrintf("pipelined%d", kNumValues - 1),
+           StringPrintf("pipelined value %d", kNumValues - 1));
+}
+
 TEST_F(AprMemCacheTest, MultiServerFallback) {
   if (!InitMemcachedOrSkip(true)) {
     return;
@@ -342,6 +414,82 @@ TEST_F(AprMemCacheTest, MultiServerFallback) {
   CheckGet(cache_.get(), kKey1, kLargeValue);
 }
 
+// Names the same memcached twice, so each value is written to it under both
+// names, and checks that Put, Get, Delete and MultiPut all handle both
+// replicas.
+TEST_F(AprMemCacheTest, Replicas) {
+  if (!InitMemcachedOrSkip(true)) {
+    return;
+  }
+  AprMemCache replicated(StrCat(server_spec_, ",127.0.0.1:",
+                                getenv("MEMCACHED_PORT")),
+                         5, &md5_hasher_, &statistics_, &timer_, &handler_);
+  replicated.set_num_replicas(2);
+  ASSERT_TRUE(replicated.Connect());
+
+  for (int i = 0; i < 10; ++i) {
+    GoogleString key = StrCat("replicated", IntegerToString(i));
+    CheckPut(&replicated, key, "value");
+    CheckGet(&replicated, key, "value");
+    replicated.Delete(key);
+    CheckNotFound(&replicated, key.c_str());
+  }
+
+  CacheInterface::MultiPutRequest* request =
+      new CacheInterface::MultiPutRequest;
+  request->push_back(CacheInterface::KeyValue("a", SharedString("value_a")));
+  request->push_back(CacheInterface::KeyValue("b", SharedString("value_b")));
+  replicated.MultiPut(request);
+  CheckGet(&replicated, "a", "value_a");
+  CheckGet(&replicated, "b", "value_b");
+  EXPECT_TRUE(replicated.IsHealthy());
+}
+
+// With a one microsecond hedge delay, reads will mostly be sent to both
+// replicas.  Whichever answers first wins, and dropping the other
+// connection must not make the cache unhealthy.
+TEST_F(AprMemCacheTest, HedgedReads) {
+  if (!InitMemcachedOrSkip(true)) {
+    return;
+  }
+  AprMemCache replicated(StrCat(server_spec_, ",127.0.0.1:",
+                                getenv("MEMCACHED_PORT")),
+                         5, &md5_hasher_, &statistics_, &timer_, &handler_);
+  replicated.set_num_replicas(2);
+  replicated.set_hedge_delay_us(1);
+  ASSERT_TRUE(replicated.Connect());
+
+  for (int i = 0; i < 10; ++i) {
+    GoogleString key = StrCat("hedged", IntegerToString(i));
+    CheckPut(&replicated, key, "value");
+    CheckGet(&replicated, key, "value");
+    CheckGet(&replicated, key, "value");
+  }
+  CheckNotFound(&replicated, "hedged_missing");
+  EXPECT_TRUE(replicated.IsHealthy());
+  EXPECT_EQ(0, statistics_.GetVariable("memcache_timeouts")->Get());
+}
+
+// Adds a server that's not running to the spec.  Once it has failed it is
+// skipped, and its keys go to the next server on the ring.
+TEST_F(AprMemCacheTest, DeadServerSkipped) {
+  if (!InitMemcachedOrSkip(true)) {
+    return;
+  }
+  AprMemCache with_dead_server(StrCat(server_spec_, ",localhost:1"), 5,
+                               &md5_hasher_, &statistics_, &timer_,
+                               &handler_);
+  with_dead_server.set_num_replicas(2);
+  ASSERT_TRUE(with_dead_server.Connect());
+
+  for (int i = 0; i < 10; ++i) {
+    GoogleString key = StrCat("key", IntegerToString(i));
+    CheckPut(&with_dead_server, key, "value");
+    CheckGet(&with_dead_server, key, "value");
+  }
+  EXPECT_TRUE(with_dead_server.IsHealthy());
+}
+
 TEST_F(AprMemCacheTest, KeyOver64kDropped) {
   if (!InitMemcachedOrSkip(true)) {
     return;
@@ -25,11 +25,13 @@ namespace net_instaweb {
 
 class AsyncFetch;
 class CacheInterface;
+class FilterProfiler;
 class GoogleUrl;
 class HTTPCache;
 class MessageHandler;
 class PropertyCache;
 class QueryParams;
+class RequestTimelineStore;
 class RewriteOptions;
 class ServerContext;
 class StaticAssetManager;
@@ -157,6 +159,26 @@ class AdminSite {
   void PrintHistograms(AdminSource source, AsyncFetch* fetch,
                        Statistics* stats);
 
+  // Shows the time spent in each filter, costliest first.  profiler is NULL
+  // unless ProfileFilters is on, in which case we explain how to turn it on.
+  void FilterProfileHandler(AdminSource source, AsyncFetch* fetch,
+                            FilterProfiler* profiler);
+
+  // Responds with the same data as FilterProfileHandler, as JSON.
+  void FilterProfileJsonHandler(AsyncFetch* fetch, FilterProfiler* profiler);
+
+  // Lists the sampled requests that were slow, slowest first, each with a
+  // link to download its timeline.  store is NULL unless request timelines
+  // are being sampled.
+  void SlowRequestsHandler(AdminSource source, AsyncFetch* fetch,
+                           RequestTimelineStore* store);
+
+  // Responds with the timeline named by the "id" query parameter, in the
+  // Chrome trace-event format.  Slow timelines recorded by other processes
+  // are looked up in the store's shared cache.
+  void RequestTraceHandler(const QueryParams& query_params, AsyncFetch* fetch,
+                           RequestTimelineStore* store);
+
   void PurgeHandler(StringPiece url, SystemCachePath* cache_path,
                     AsyncFetch* fetch);
 
@@ -27,6 +27,7 @@
 #include "net/instaweb/util/public/cache_interface.h"
 #include "net/instaweb/util/public/string.h"
 #include "net/instaweb/util/public/string_util.h"
+#include "net/instaweb/util/public/scoped_ptr.h"
 #include "net/instaweb/util/public/timer.h"
 
 struct apr_memcache2_t;
@@ -35,6 +36,7 @@ struct apr_pool_t;
 
 namespace net_instaweb {
 
+class ConsistentHashRing;
 class Hasher;
 class MessageHandler;
 class SharedString;
@@ -47,6 +49,15 @@ class Variable;
 //
 // While this class derives from CacheInterface, it is a blocking
 // implementation, suitable for instantiating underneath an AsyncCache.
+//
+// Keys are spread across the servers with a consistent-hash ring, so
+// adding or removing a server only moves the keys on that server.  If
+// set_num_replicas is called with N > 1, each value is also written to
+// the next N-1 servers on the ring, all at once, and reads that fail on
+// one server are retried on the next.  A Get that the first server hasn't
+// answered within set_hedge_delay_us is also sent to the second, and the
+// first reply wins, so a slow server doesn't hold reads up for the whole
+// timeout; see Get.
 class AprMemCache : public CacheInterface {
  public:
   // Experimentally it seems large values larger than 1M bytes result in
@@ -86,6 +97,10 @@ class AprMemCache : public CacheInterface {
   virtual void Delete(const GoogleString& key);
   virtual void MultiGet(MultiGetRequest* request);
 
+  // Pipelines the values to memcached, costing a round-trip per server for
+  // each window of up to 64 values, rather than one per value as with Put.
+  virtual void MultiPut(MultiPutRequest* request);
+
   // Connects to the server, returning whether the connnection was
   // successful or not.
   bool Connect();
@@ -118,12 +133,55 @@ class AprMemCache : public CacheInterface {
   virtual bool MustEncodeKeyInValueOnPut() const { return true; }
   virtual void PutWithKeyInValue(const GoogleString& key,
                                  SharedString* key_and_value);
+  virtual void MultiPutWithKeyInValue(MultiPutRequest* request);
 
   // Sets the I/O timeout in microseconds.  This should be called at
   // setup time and not while there are operations in flight.
   void set_timeout_us(int timeout_us);
 
+  // Sets the number of servers each value is stored on, which defaults
+  // to 1.  This should be called at setup time and not while there are
+  // operations in flight.
+  void set_num_replicas(int num_replicas);
+
+  // Sets how long a Get waits for the first server a value is stored on
+  // before also asking the second, when there are replicas.  0 means the
+  // second is only asked once the first has failed.  This should be called
+  // at setup time and not while there are operations in flight.
+  void set_hedge_delay_us(int hedge_delay_us);
+
  private:
+  typedef std::vector<apr_memcache2_server_t*> ServerVector;
+
+  // apr_memcache2 server-selection callback, which picks the first live
+  // server on the ring.  baton is the AprMemCache.
+  static apr_memcache2_server_t* FindServerCallback(
+      void* baton, apr_memcache2_t* memcached, const uint32 hash);
+
+  // Fills the servers array with up to max_servers live servers, in ring
+  // order from hash, returning how many it found.  The walk stops as soon
+  // as it has max_servers, and allocates nothing, as it is called for
+  // every key.
+  int FindLiveServers(uint32 hash, int max_servers,
+                      apr_memcache2_server_t** servers);
+
+  // Fills *servers with the live servers that hashed_key is stored on.
+  void FindServers(const GoogleString& hashed_key, ServerVector* servers);
+
+  // Does the work of MultiGet once the health check is done.  If
+  // retry_on_replicas, the keys whose server fails are read again from
+  // their next replica, in one batch.  Takes ownership of the request.
+  void MultiGetHelper(MultiGetRequest* request, bool retry_on_replicas);
+
+  // Looks key up on each of servers in turn, until one answers, and
+  // reports the result to callback.  The first two are hedged; see Get.
+  void GetFromServers(const GoogleString& key, const GoogleString& hashed_key,
+                      const ServerVector& servers, Callback* callback);
+
+  // Logs a failure to put a value, where status is an apr_status_t.
+  void ReportPutError(const GoogleString& key,
+                      const SharedString& key_and_value, int status);
+
   void DecodeValueMatchingKeyAndCallCallback(
       const GoogleString& key, const char* data, size_t data_len,
       const char* calling_method, Callback* callback);
@@ -133,20 +191,28 @@ class AprMemCache : public CacheInterface {
   // PutWithKeyInValue, which will do the health check.
   void PutHelper(const GoogleString& key, SharedString* key_and_value);
 
+  // Likewise for MultiPut and MultiPutWithKeyInValue, where each value is
+  // already encoded with its key.  Takes ownership of the request.
+  void MultiPutHelper(MultiPutRequest* request);
+
   StringVector hosts_;
   std::vector<int> ports_;
   GoogleString server_spec_;
   bool valid_server_spec_;
   int thread_limit_;
   int timeout_us_;
+  int num_replicas_;
+  int hedge_delay_us_;
   apr_pool_t* pool_;
   apr_memcache2_t* memcached_;
-  std::vector<apr_memcache2_server_t*> servers_;
+  ServerVector servers_;
+  scoped_ptr<ConsistentHashRing> ring_;
   Hasher* hasher_;
   Timer* timer_;
   AtomicBool shutdown_;
 
   Variable* timeouts_;
+  Variable* hedged_reads_;
   UpDownCounter* last_error_checkpoint_ms_;
   UpDownCounter* error_burst_size_;
 
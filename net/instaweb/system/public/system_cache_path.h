@@ -37,6 +37,7 @@ class MessageHandler;
 class NamedLockManager;
 class PurgeContext;
 class PurgeSet;
+class QueuedWorkerPool;
 class RewriteDriverFactory;
 class SharedMemLockManager;
 class SlowWorker;
@@ -58,12 +59,17 @@ class SystemCachePath {
                   AbstractSharedMem* shm_runtime);
   ~SystemCachePath();
 
-  // Per-process in-memory LRU, with any stats/thread safety wrappers, or NULL.
+  // Per-process in-memory ShardedLRUCache, with any stats wrapper, or NULL.
   CacheInterface* lru_cache() { return lru_cache_; }
 
   // Per-machine file cache with any stats wrappers.
   CacheInterface* file_cache() { return file_cache_; }
 
+  // The same file cache, but when any vhost on the path sets
+  // FileCacheIoThreads it doesn't block: its file operations run on that
+  // many background threads.  file_cache() always blocks.
+  CacheInterface* async_file_cache() { return async_file_cache_; }
+
   // Access to backend for testing.  Do not use this directly in production
   // as it lacks statistics wrappers, etc.
   FileCache* file_cache_backend() { return file_cache_backend_; }
@@ -73,10 +79,12 @@ class SystemCachePath {
   void RootInit();
   void ChildInit(SlowWorker* cache_clean_worker);
   void GlobalCleanup(MessageHandler* handler);  // only called in root process
+  void StopCacheActivity();
+  void ShutDown();
 
   // When there are multiple configurations which specify the same cache
-  // path, we must merge the other settings: the cleaning interval, size, and
-  // inode count.
+  // path, we must merge the other settings: the cleaning interval, size,
+  // inode count, and the number of I/O threads.
   void MergeConfig(const SystemRewriteOptions* config);
 
   // Associates a ServerContext with this CachePath, enabling cache purges
@@ -98,6 +106,12 @@ class SystemCachePath {
   typedef std::set<SystemServerContext*> ServerContextSet;
 
   void FallBackToFileBasedLocking();
+  // Makes async_file_cache() non-blocking with io_threads I/O threads,
+  // unless it already has at least that many.
+  void SetFileCacheIoThreads(int io_threads);
+  // Gives the file cache an index, if it doesn't have one yet; see
+  // FileCache::EnableIndex.
+  void EnableFileCacheIndex();
   GoogleString LockManagerSegmentName() const;
 
   // Merge a value taken from a config file against the value already
@@ -133,10 +147,15 @@ class SystemCachePath {
   NamedLockManager* lock_manager_;
   FileCache* file_cache_backend_;  // owned by file_cache_
   CacheInterface* lru_cache_;
-  CacheInterface* file_cache_;
+  CacheInterface* file_cache_;  // Through file_cache_backend_'s blocking view.
+  CacheInterface* async_file_cache_;
+  scoped_ptr<QueuedWorkerPool> file_cache_io_pool_;
   bool clean_interval_explicitly_set_;
   bool clean_size_explicitly_set_;
   bool clean_inode_limit_explicitly_set_;
+  bool max_evictions_per_clean_explicitly_set_;
+  int file_cache_io_threads_;  // 0 without file_cache_io_pool_.
+  bool io_threads_explicitly_set_;
   const SystemRewriteOptions* options_;
 
   scoped_ptr<PurgeContext> purge_context_;
@@ -111,6 +111,27 @@ class SystemCaches {
   bool CreateShmMetadataCache(
       StringPiece name, int64 size_kb, GoogleString* error_msg);
 
+  // Settings applied to every shared memory metadata cache when RootInit()
+  // sets them up; see SharedMemCache::set_associativity() and
+  // set_eviction_policy(). Meant to be called from config parsing.
+  void set_shm_cache_associativity(int associativity) {
+    shm_cache_associativity_ = associativity;
+  }
+  int shm_cache_associativity() const { return shm_cache_associativity_; }
+  void set_shm_cache_eviction_policy(
+      SharedMemCache<64>::EvictionPolicy policy) {
+    shm_cache_eviction_policy_ = policy;
+  }
+
+  // Whether to keep shared memory metadata caches in files, so that their
+  // contents survive restarts; see SharedMemCache::InitializeFromFile. Each
+  // goes in the file cache directory it's used with, under a name the file
+  // cache leaves alone (see FileCache::kReservedFilePrefix). The default
+  // cache, which is shared by every vhost without one of its own, goes in
+  // the global config's file cache directory. Meant to be called from config
+  // parsing.
+  void set_persist_shm_caches(bool persist) { persist_shm_caches_ = persist; }
+
   // Returns, perhaps creating it, an appropriate named manager for this config
   // (potentially sharing with others as appropriate).
   NamedLockManager* GetLockManager(SystemRewriteOptions* config);
@@ -144,6 +165,7 @@ class SystemCaches {
     // Note that the fields may be NULL if e.g. initialization failed.
     CacheInterface* cache_to_use;  // may be CacheStats or such.
     GoogleString segment;
+    GoogleString file_cache_path;  // Where to keep it, if persisted.
     MetadataShmCache* cache_backend;
     bool initialized;  // This is needed since in some scenarios we may
                        // not end up as far as calling ->Initialize() before
@@ -236,6 +258,10 @@ class SystemCaches {
 
   bool default_shm_metadata_cache_creation_failed_;
 
+  int shm_cache_associativity_;
+  MetadataShmCache::EvictionPolicy shm_cache_eviction_policy_;
+  bool persist_shm_caches_;
+
   DISALLOW_COPY_AND_ASSIGN(SystemCaches);
 };
 
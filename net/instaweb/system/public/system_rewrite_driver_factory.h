@@ -226,6 +226,16 @@ class SystemRewriteDriverFactory : public RewriteDriverFactory {
   void set_num_expensive_rewrite_threads(int x) {
     num_expensive_rewrite_threads_ = x;
   }
+  // If true, the rewrite and expensive rewrite thread pools give each worker
+  // its own queue and let idle workers steal from busy ones, rather than
+  // handing every sequence off through the pool's central queue.  Off by
+  // default.  Must be set before the pools are created.
+  bool rewrite_thread_work_stealing() const {
+    return rewrite_thread_work_stealing_;
+  }
+  void set_rewrite_thread_work_stealing(bool x) {
+    rewrite_thread_work_stealing_ = x;
+  }
   bool use_per_vhost_statistics() const {
     return use_per_vhost_statistics_;
   }
@@ -385,6 +395,8 @@ class SystemRewriteDriverFactory : public RewriteDriverFactory {
   int num_rewrite_threads_;
   int num_expensive_rewrite_threads_;
 
+  bool rewrite_thread_work_stealing_;
+
   DISALLOW_COPY_AND_ASSIGN(SystemRewriteDriverFactory);
 };
 
@@ -65,6 +65,15 @@ class SystemRewriteOptions : public RewriteOptions {
   void set_file_cache_clean_inode_limit(int64 x) {
     set_option(x, &file_cache_clean_inode_limit_);
   }
+  int64 file_cache_max_evictions_per_clean() const {
+    return file_cache_max_evictions_per_clean_.value();
+  }
+  bool has_file_cache_max_evictions_per_clean() const {
+    return file_cache_max_evictions_per_clean_.was_set();
+  }
+  void set_file_cache_max_evictions_per_clean(int64 x) {
+    set_option(x, &file_cache_max_evictions_per_clean_);
+  }
   int64 lru_cache_byte_limit() const {
     return lru_cache_byte_limit_.value();
   }
@@ -101,6 +110,24 @@ class SystemRewriteOptions : public RewriteOptions {
   void set_statistics_logging_enabled(bool x) {
     set_option(x, &statistics_logging_enabled_);
   }
+  bool profile_filters() const {
+    return profile_filters_.value();
+  }
+  void set_profile_filters(bool x) {
+    set_option(x, &profile_filters_);
+  }
+  int request_timeline_sample_rate() const {
+    return request_timeline_sample_rate_.value();
+  }
+  void set_request_timeline_sample_rate(int x) {
+    set_option(x, &request_timeline_sample_rate_);
+  }
+  int64 request_timeline_slow_threshold_ms() const {
+    return request_timeline_slow_threshold_ms_.value();
+  }
+  void set_request_timeline_slow_threshold_ms(int64 x) {
+    set_option(x, &request_timeline_slow_threshold_ms_);
+  }
   int64 statistics_logging_max_file_size_kb() const {
     return statistics_logging_max_file_size_kb_.value();
   }
@@ -130,6 +157,39 @@ class SystemRewriteOptions : public RewriteOptions {
   void set_memcached_servers(const GoogleString& x) {
     set_option(x, &memcached_servers_);
   }
+  bool file_cache_index() const {
+    return file_cache_index_.value();
+  }
+  void set_file_cache_index(bool x) {
+    set_option(x, &file_cache_index_);
+  }
+  int file_cache_io_threads() const {
+    return file_cache_io_threads_.value();
+  }
+  bool has_file_cache_io_threads() const {
+    return file_cache_io_threads_.was_set();
+  }
+  void set_file_cache_io_threads(int x) {
+    set_option(x, &file_cache_io_threads_);
+  }
+  int memcached_hedge_delay_us() const {
+    return memcached_hedge_delay_us_.value();
+  }
+  void set_memcached_hedge_delay_us(int x) {
+    set_option(x, &memcached_hedge_delay_us_);
+  }
+  int memcached_replicas() const {
+    return memcached_replicas_.value();
+  }
+  void set_memcached_replicas(int x) {
+    set_option(x, &memcached_replicas_);
+  }
+  int memcached_target_latency_us() const {
+    return memcached_target_latency_us_.value();
+  }
+  void set_memcached_target_latency_us(int x) {
+    set_option(x, &memcached_target_latency_us_);
+  }
   int memcached_threads() const {
     return memcached_threads_.value();
   }
@@ -326,8 +386,10 @@ class SystemRewriteOptions : public RewriteOptions {
 
   Option<bool> statistics_enabled_;
   Option<bool> statistics_logging_enabled_;
+  Option<bool> profile_filters_;
   Option<bool> use_shared_mem_locking_;
   Option<bool> compress_metadata_cache_;
+  Option<bool> file_cache_index_;
 
   Option<bool> slurp_read_only_;
   Option<bool> test_proxy_;
@@ -342,12 +404,18 @@ class SystemRewriteOptions : public RewriteOptions {
   // cleartext.  We'll decompress as we read the content if needed.
   Option<bool> fetch_with_gzip_;
 
+  Option<int> file_cache_io_threads_;
+  Option<int> memcached_hedge_delay_us_;
+  Option<int> memcached_replicas_;
+  Option<int> memcached_target_latency_us_;
   Option<int> memcached_threads_;
   Option<int> memcached_timeout_us_;
+  Option<int> request_timeline_sample_rate_;
 
   Option<int64> file_cache_clean_inode_limit_;
   Option<int64> file_cache_clean_interval_ms_;
   Option<int64> file_cache_clean_size_kb_;
+  Option<int64> file_cache_max_evictions_per_clean_;
   Option<int64> lru_cache_byte_limit_;
   Option<int64> lru_cache_kb_per_process_;
   Option<int64> statistics_logging_interval_ms_;
@@ -356,6 +424,7 @@ class SystemRewriteOptions : public RewriteOptions {
   Option<int64> cache_flush_poll_interval_sec_;
   Option<int64> statistics_logging_max_file_size_kb_;
   Option<int64> slurp_flush_limit_;
+  Option<int64> request_timeline_slow_threshold_ms_;
   Option<int64> ipro_max_response_bytes_;
   Option<int64> ipro_max_concurrent_recordings_;
   Option<int64> default_shared_memory_cache_kb_;
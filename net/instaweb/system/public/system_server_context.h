@@ -31,10 +31,12 @@ namespace net_instaweb {
 
 class AbstractMutex;
 class AsyncFetch;
+class FilterProfiler;
 class GoogleUrl;
 class Histogram;
 class QueryParams;
 class PurgeSet;
+class RequestTimelineStore;
 class RewriteDriver;
 class RewriteDriverFactory;
 class RewriteOptions;
@@ -258,6 +260,12 @@ class SystemServerContext : public ServerContext {
   scoped_ptr<RewriteStats> local_rewrite_stats_;
   scoped_ptr<UrlAsyncFetcherStats> stats_fetcher_;
 
+  // Non-NULL if ProfileFilters is on.
+  scoped_ptr<FilterProfiler> filter_profiler_;
+
+  // Non-NULL if RequestTimelineSampleRate is positive.
+  scoped_ptr<RequestTimelineStore> request_timeline_store_;
+
   // hostname_identifier_ equals to "server_hostname:port" of the server.  It's
   // used to distinguish the name of shared memory so that each vhost has its
   // own SharedCircularBuffer.
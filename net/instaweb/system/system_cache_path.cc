@@ -25,21 +25,43 @@
 #include "net/instaweb/util/public/cache_stats.h"
 #include "net/instaweb/util/public/file_cache.h"
 #include "net/instaweb/util/public/file_system_lock_manager.h"
-#include "net/instaweb/util/public/lru_cache.h"
 #include "net/instaweb/util/public/message_handler.h"
+#include "net/instaweb/util/public/queued_worker_pool.h"
 #include "net/instaweb/util/public/shared_mem_lock_manager.h"
 #include "net/instaweb/util/public/thread_system.h"
-#include "net/instaweb/util/public/threadsafe_cache.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/callback.h"
 #include "pagespeed/kernel/cache/purge_context.h"
+#include "pagespeed/kernel/cache/sharded_lru_cache.h"
 
 namespace net_instaweb {
 
 const char SystemCachePath::kFileCache[] = "file_cache";
 const char SystemCachePath::kLruCache[] = "lru_cache";
 
+namespace {
+
+// Each shard of the per-process LRU cache gets an equal part of its size,
+// and can't hold anything bigger than that, so small caches get fewer
+// shards: enough that each can still hold this many of the largest entries
+// that LRUCacheByteLimit lets into it.
+const int kMinLargestEntriesPerShard = 4;
+
+int LruCacheShards(int64 cache_bytes, int64 entry_byte_limit) {
+  int num_shards = ShardedLRUCache::kDefaultNumShards;
+  if (entry_byte_limit > 0) {
+    while ((num_shards > 1) &&
+           (cache_bytes / num_shards <
+            kMinLargestEntriesPerShard * entry_byte_limit)) {
+      num_shards /= 2;
+    }
+  }
+  return num_shards;
+}
+
+}  // namespace
+
 // The SystemCachePath encapsulates a cache-sharing model where a user specifies
 // a file-cache path per virtual-host.  With each file-cache object we keep
 // a locking mechanism and an optional per-process LRUCache.
@@ -54,17 +76,23 @@ SystemCachePath::SystemCachePath(const StringPiece& path,
       file_cache_backend_(NULL),
       lru_cache_(NULL),
       file_cache_(NULL),
+      async_file_cache_(NULL),
       clean_interval_explicitly_set_(
           config->has_file_cache_clean_interval_ms()),
       clean_size_explicitly_set_(config->has_file_cache_clean_size_kb()),
       clean_inode_limit_explicitly_set_(
           config->has_file_cache_clean_inode_limit()),
+      max_evictions_per_clean_explicitly_set_(
+          config->has_file_cache_max_evictions_per_clean()),
+      file_cache_io_threads_(0),
+      io_threads_explicitly_set_(config->has_file_cache_io_threads()),
       options_(config),
       mutex_(factory->thread_system()->NewMutex()) {
   if (config->use_shared_mem_locking()) {
     shared_mem_lock_manager_.reset(new SharedMemLockManager(
         shm_runtime, LockManagerSegmentName(),
         factory->scheduler(), factory->hasher(), factory->message_handler()));
+    shared_mem_lock_manager_->SetStatistics(factory->statistics());
     lock_manager_ = shared_mem_lock_manager_.get();
   } else {
     FallBackToFileBasedLocking();
@@ -76,32 +104,45 @@ SystemCachePath::SystemCachePath(const StringPiece& path,
       config->file_cache_clean_interval_ms(),
       config->file_cache_clean_size_kb() * 1024,
       config->file_cache_clean_inode_limit());
+  policy->max_evictions_per_clean =
+      config->file_cache_max_evictions_per_clean();
   file_cache_backend_ = new FileCache(
       config->file_cache_path(), factory->file_system(), NULL,
       policy, factory->statistics(), factory->message_handler());
   factory->TakeOwnership(file_cache_backend_);
-  file_cache_ = new CacheStats(kFileCache, file_cache_backend_,
+
+  // The property cache needs a blocking cache, so file_cache_ goes through
+  // the backend's blocking view, which keeps doing its file operations in
+  // the calling thread once SetFileCacheIoThreads gives the backend I/O
+  // threads.  Both share the one FileCache, with its index and cleaning.
+  file_cache_ = new CacheStats(kFileCache,
+                               file_cache_backend_->blocking_cache(),
                                factory->timer(), factory->statistics());
   factory->TakeOwnership(file_cache_);
+  async_file_cache_ = new CacheStats(kFileCache, file_cache_backend_,
+                                     factory->timer(), factory->statistics());
+  factory->TakeOwnership(async_file_cache_);
+  SetFileCacheIoThreads(config->file_cache_io_threads());
+  if (config->file_cache_index()) {
+    EnableFileCacheIndex();
+  }
 
   if (config->lru_cache_kb_per_process() != 0) {
-    LRUCache* lru_cache = new LRUCache(
-        config->lru_cache_kb_per_process() * 1024);
-    factory->TakeOwnership(lru_cache);
-
-    // We only add the threadsafe-wrapper to the LRUCache.  The FileCache
-    // is naturally thread-safe because it's got no writable member variables.
-    // And surrounding that slower-running class with a mutex would likely
-    // cause contention.
-    ThreadsafeCache* ts_cache =
-        new ThreadsafeCache(lru_cache, factory->thread_system()->NewMutex());
-    factory->TakeOwnership(ts_cache);
+    // Only the LRU cache needs locking.  The FileCache is naturally
+    // thread-safe because it's got no writable member variables.  The LRU
+    // is split into shards with a lock each, so that the rewrite threads,
+    // which all share it, rarely wait on one another.
+    int64 lru_cache_bytes = config->lru_cache_kb_per_process() * 1024;
+    ShardedLRUCache* sharded_cache = new ShardedLRUCache(
+        LruCacheShards(lru_cache_bytes, config->lru_cache_byte_limit()),
+        lru_cache_bytes, factory->thread_system());
+    factory->TakeOwnership(sharded_cache);
 #if CACHE_STATISTICS
-    lru_cache_ = new CacheStats(kLruCache, ts_cache, factory->timer(),
+    lru_cache_ = new CacheStats(kLruCache, sharded_cache, factory->timer(),
                                 factory->statistics());
     factory->TakeOwnership(lru_cache_);
 #else
-    lru_cache_ = ts_cache;
+    lru_cache_ = sharded_cache;
 #endif
   }
 }
@@ -117,7 +158,7 @@ void SystemCachePath::MergeConfig(const SystemRewriteOptions* config) {
   MergeEntries(config->file_cache_clean_interval_ms(),
                config->has_file_cache_clean_interval_ms(),
                false /* take_larger */,
-               "IntervalMs",
+               RewriteOptions::kFileCacheCleanIntervalMs,
                &policy->clean_interval_ms,
                &clean_interval_explicitly_set_);
 
@@ -127,14 +168,58 @@ void SystemCachePath::MergeConfig(const SystemRewriteOptions* config) {
   // answer here, which is why MergeEntries prints a warning on a conflict.
   MergeEntries(config->file_cache_clean_size_kb() * 1024,
                config->has_file_cache_clean_size_kb(),
-               true, "SizeKb",
+               true, RewriteOptions::kFileCacheCleanSizeKb,
                &policy->target_size_bytes,
                &clean_size_explicitly_set_);
   MergeEntries(config->file_cache_clean_inode_limit(),
                config->has_file_cache_clean_inode_limit(),
-               true, "InodeLimit",
+               true, RewriteOptions::kFileCacheCleanInodeLimit,
                &policy->target_inode_count,
                &clean_inode_limit_explicitly_set_);
+  // A larger cap lets each clean catch up faster; 0 means no cap at all, but
+  // an explicit cap from one vhost still wins over another's default.
+  MergeEntries(config->file_cache_max_evictions_per_clean(),
+               config->has_file_cache_max_evictions_per_clean(),
+               true, RewriteOptions::kFileCacheMaxEvictionsPerClean,
+               &policy->max_evictions_per_clean,
+               &max_evictions_per_clean_explicitly_set_);
+
+  // One vhost asking for an index is enough, as it only changes how cleaning
+  // finds its victims.
+  if (config->file_cache_index()) {
+    EnableFileCacheIndex();
+  }
+
+  // The I/O threads belong to the path's one FileCache, and are shared by
+  // every vhost on it, so we take the larger count, to give each at least
+  // the parallelism it asked for.
+  int64 io_threads = file_cache_io_threads_;
+  MergeEntries(config->file_cache_io_threads(),
+               config->has_file_cache_io_threads(),
+               true, RewriteOptions::kFileCacheIoThreads,
+               &io_threads, &io_threads_explicitly_set_);
+  SetFileCacheIoThreads(io_threads);
+}
+
+void SystemCachePath::SetFileCacheIoThreads(int io_threads) {
+  if (io_threads <= file_cache_io_threads_) {
+    return;
+  }
+  file_cache_io_threads_ = io_threads;
+
+  // The pool's threads are only started by the first file operation, which
+  // comes after all the configurations are merged, so a larger pool can
+  // simply replace the old one.
+  QueuedWorkerPool* pool = new QueuedWorkerPool(
+      io_threads, "file_cache_io", factory_->thread_system());
+  file_cache_backend_->SetIoPool(pool, io_threads);
+  file_cache_io_pool_.reset(pool);
+}
+
+void SystemCachePath::EnableFileCacheIndex() {
+  if (!file_cache_backend_->index_enabled()) {
+    file_cache_backend_->EnableIndex(factory_->thread_system()->NewMutex());
+  }
 }
 
 void SystemCachePath::MergeEntries(int64 config_value, bool config_was_set,
@@ -155,7 +240,7 @@ void SystemCachePath::MergeEntries(int64 config_value, bool config_was_set,
       *policy_was_set = true;
       factory_->message_handler()->Message(
           kWarning,
-          "Conflicting settings %s!=%s for FileCacheClean%s for file-cache %s, "
+          "Conflicting settings %s!=%s for %s for file-cache %s, "
           "keeping the %s value",
           Integer64ToString(config_value).c_str(),
           Integer64ToString(*policy_value).c_str(),
@@ -234,12 +319,27 @@ void SystemCachePath::GlobalCleanup(MessageHandler* handler) {
   }
 }
 
+void SystemCachePath::StopCacheActivity() {
+  if (file_cache_io_pool_.get() != NULL) {
+    file_cache_backend_->ShutDown();
+  }
+}
+
+void SystemCachePath::ShutDown() {
+  // Waits for any file operation already running, so that none outlives
+  // file_cache_backend_.
+  if (file_cache_io_pool_.get() != NULL) {
+    file_cache_io_pool_->ShutDown();
+  }
+}
+
 void SystemCachePath::FallBackToFileBasedLocking() {
   if ((shared_mem_lock_manager_.get() != NULL) || (lock_manager_ == NULL)) {
     shared_mem_lock_manager_.reset(NULL);
     file_system_lock_manager_.reset(new FileSystemLockManager(
         factory_->file_system(), path_,
         factory_->scheduler(), factory_->message_handler()));
+    file_system_lock_manager_->SetStatistics(factory_->statistics());
     lock_manager_ = file_system_lock_manager_.get();
   }
 }
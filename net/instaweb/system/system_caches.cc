@@ -68,7 +68,10 @@ SystemCaches::SystemCaches(
       is_root_process_(true),
       was_shut_down_(false),
       cache_hasher_(20),
-      default_shm_metadata_cache_creation_failed_(false) {
+      default_shm_metadata_cache_creation_failed_(false),
+      shm_cache_associativity_(MetadataShmCache::kDefaultAssociativity),
+      shm_cache_eviction_policy_(MetadataShmCache::kEvictLeastRecentlyUsed),
+      persist_shm_caches_(false) {
 }
 
 SystemCaches::~SystemCaches() {
@@ -101,6 +104,12 @@ void SystemCaches::ShutDown(MessageHandler* message_handler) {
   // opposed to hanging, it will probably not appear wedged.
   memcached_pool_.reset(NULL);
 
+  // Likewise for the file cache I/O threads.
+  for (PathCacheMap::iterator p = path_cache_map_.begin(),
+           e = path_cache_map_.end(); p != e; ++p) {
+    p->second->ShutDown();
+  }
+
   if (is_root_process_) {
     // Cleanup per-path shm resources.
     for (PathCacheMap::iterator p = path_cache_map_.begin(),
@@ -163,6 +172,8 @@ SystemCaches::MemcachedInterfaces SystemCaches::GetMemcached(
   if (result.second) {
     AprMemCache* mem_cache = NewAprMemCache(server_spec);
     mem_cache->set_timeout_us(config->memcached_timeout_us());
+    mem_cache->set_num_replicas(config->memcached_replicas());
+    mem_cache->set_hedge_delay_us(config->memcached_hedge_delay_us());
     memcache_servers_.push_back(mem_cache);
 
     int num_threads = config->memcached_threads();
@@ -200,11 +211,16 @@ SystemCaches::MemcachedInterfaces SystemCaches::GetMemcached(
 
     CacheBatcher* batcher = new CacheBatcher(
         memcached.async, factory_->thread_system()->NewMutex(),
-        factory_->statistics());
+        factory_->timer(), factory_->statistics());
     factory_->TakeOwnership(batcher);
     if (num_threads != 0) {
       batcher->set_max_parallel_lookups(num_threads);
     }
+    // As with the thread count, the first VirtualHost using these servers
+    // decides this.
+    if (config->memcached_target_latency_us() > 0) {
+      batcher->EnableAdaptiveMode(config->memcached_target_latency_us());
+    }
     memcached.async = batcher;
 
     // Populate the blocking memcached interface, giving it its own
@@ -246,6 +262,8 @@ bool SystemCaches::CreateShmMetadataCache(
       cache_info = new MetadataShmCacheInfo;
       factory_->TakeOwnership(cache_info);
       cache_info->segment = StrCat(name, "/metadata_cache");
+      // A named cache is used with the file cache of the same path.
+      cache_info->file_cache_path = name.as_string();
       cache_info->cache_backend =
           new SharedMemCache<64>(
               shared_mem_runtime_,
@@ -323,6 +341,8 @@ SystemCaches::MetadataShmCacheInfo* SystemCaches::GetShmMetadataCacheOrDefault(
     default_shm_metadata_cache_creation_failed_ = true;
     return NULL;
   }
+  // Its file_cache_path is set in RootInit, from the global config rather
+  // than from whichever vhost got here first.
   return LookupShmMetadataCache(kDefaultSharedMemoryPath);
 }
 
@@ -347,13 +367,14 @@ void SystemCaches::SetupCaches(ServerContext* server_context,
   SystemCachePath* caches_for_path = GetCache(config);
   CacheInterface* lru_cache = caches_for_path->lru_cache();
   CacheInterface* file_cache = caches_for_path->file_cache();
+  CacheInterface* async_file_cache = caches_for_path->async_file_cache();
   MetadataShmCacheInfo* shm_metadata_cache_info =
       GetShmMetadataCacheOrDefault(config);
   CacheInterface* shm_metadata_cache = (shm_metadata_cache_info != NULL) ?
       shm_metadata_cache_info->cache_to_use : NULL;
   MemcachedInterfaces memcached = GetMemcached(config);
   CacheInterface* property_store_cache = NULL;
-  CacheInterface* http_l2 = file_cache;
+  CacheInterface* http_l2 = async_file_cache;
   Statistics* stats = server_context->statistics();
 
   if (memcached.async != NULL) {
@@ -366,7 +387,7 @@ void SystemCaches::SetupCaches(ServerContext* server_context,
     // FallbackCache* objects would require making a map using the
     // memcache & file-cache specs as a key, so it's simpler to make a new
     // small FallbackCache object for each VirtualHost.
-    memcached.async = new FallbackCache(memcached.async, file_cache,
+    memcached.async = new FallbackCache(memcached.async, async_file_cache,
                                         AprMemCache::kValueSizeThreshold,
                                         factory_->message_handler());
     http_l2 = memcached.async;
@@ -479,6 +500,10 @@ void SystemCaches::SetupCaches(ServerContext* server_context,
     l1_size_limit = config->lru_cache_byte_limit();
     metadata_l1 = lru_cache;  // may be NULL
     metadata_l2 = http_l2;  // memcached.async or file.
+    if (property_store_cache == NULL) {
+      // metadata_l2 may be the non-blocking file cache.
+      property_store_cache = file_cache;
+    }
   }
 
   CacheInterface* metadata_cache;
@@ -528,10 +553,31 @@ void SystemCaches::RegisterConfig(SystemRewriteOptions* config) {
 }
 
 void SystemCaches::RootInit() {
+  MetadataShmCacheInfo* default_cache_info =
+      LookupShmMetadataCache(kDefaultSharedMemoryPath);
+  const SystemRewriteOptions* global_config =
+      SystemRewriteOptions::DynamicCast(factory_->default_options());
+  if (default_cache_info != NULL) {
+    default_cache_info->file_cache_path =
+        (global_config == NULL) ? "" : global_config->file_cache_path();
+  }
+
   for (MetadataShmCacheMap::iterator p = metadata_shm_caches_.begin(),
            e = metadata_shm_caches_.end(); p != e; ++p) {
     MetadataShmCacheInfo* cache_info = p->second;
-    if (cache_info->cache_backend->Initialize()) {
+    cache_info->cache_backend->set_associativity(shm_cache_associativity_);
+    cache_info->cache_backend->set_eviction_policy(shm_cache_eviction_policy_);
+    bool ok;
+    if (persist_shm_caches_ && !cache_info->file_cache_path.empty()) {
+      GoogleString file_path = cache_info->file_cache_path;
+      EnsureEndsInSlash(&file_path);
+      StrAppend(&file_path, FileCache::kReservedFilePrefix,
+                "shm_metadata_cache");
+      ok = cache_info->cache_backend->InitializeFromFile(file_path);
+    } else {
+      ok = cache_info->cache_backend->Initialize();
+    }
+    if (ok) {
       cache_info->initialized = true;
       cache_info->cache_to_use =
           new CacheStats(kShmCache, cache_info->cache_backend,
@@ -606,6 +652,11 @@ void SystemCaches::StopCacheActivity() {
     cache->ShutDown();
   }
 
+  for (PathCacheMap::iterator p = path_cache_map_.begin(),
+           e = path_cache_map_.end(); p != e; ++p) {
+    p->second->StopCacheActivity();
+  }
+
   // TODO(morlovich): Also shutdown shm caches
 }
 
@@ -51,7 +51,6 @@
 #include "net/instaweb/util/public/file_system_lock_manager.h"
 #include "net/instaweb/util/public/gtest.h"
 #include "net/instaweb/util/public/inprocess_shared_mem.h"
-#include "net/instaweb/util/public/lru_cache.h"
 #include "net/instaweb/util/public/md5_hasher.h"
 #include "net/instaweb/util/public/named_lock_manager.h"
 #include "net/instaweb/util/public/null_shared_mem.h"
@@ -63,7 +62,6 @@
 #include "net/instaweb/util/public/shared_string.h"
 #include "net/instaweb/util/public/stl_util.h"
 #include "net/instaweb/util/public/thread_system.h"
-#include "net/instaweb/util/public/threadsafe_cache.h"
 #include "net/instaweb/util/public/timer.h"
 #include "net/instaweb/util/public/write_through_cache.h"
 #include "net/instaweb/util/worker_test_base.h"
@@ -71,6 +69,7 @@
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/mock_message_handler.h"
 #include "pagespeed/kernel/cache/compressed_cache.h"
+#include "pagespeed/kernel/cache/sharded_lru_cache.h"
 #include "pagespeed/kernel/http/request_headers.h"
 
 namespace net_instaweb {
@@ -369,8 +368,8 @@ class SystemCachesTest : public CustomRewriteTestBase<SystemRewriteOptions> {
     return CacheStats::FormatName(prefix, cache);
   }
 
-  GoogleString ThreadsafeLRU() {
-    return ThreadsafeCache::FormatName(LRUCache::FormatName());
+  GoogleString ShardedLRU() {
+    return ShardedLRUCache::FormatName(ShardedLRUCache::kDefaultNumShards);
   }
 
   GoogleString FileCacheName() { return FileCache::FormatName(); }
@@ -453,12 +452,12 @@ TEST_F(SystemCachesTest, BasicFileAndLruCache) {
 
   scoped_ptr<ServerContext> server_context(
       SetupServerContext(options_.release()));
-  EXPECT_STREQ(Compressed(WriteThrough(Stats("lru_cache", ThreadsafeLRU()),
+  EXPECT_STREQ(Compressed(WriteThrough(Stats("lru_cache", ShardedLRU()),
                                        FileCacheWithStats())),
                server_context->metadata_cache()->Name());
   EXPECT_STREQ(
       WriteThroughHTTP(
-          HttpCache(Stats("lru_cache", ThreadsafeLRU())),
+          HttpCache(Stats("lru_cache", ShardedLRU())),
           HttpCache(FileCacheWithStats())),
       server_context->http_cache()->Name());
   EXPECT_TRUE(server_context->filesystem_metadata_cache() == NULL);
@@ -480,6 +479,91 @@ TEST_F(SystemCachesTest, BasicFileOnlyCache) {
   EXPECT_TRUE(server_context->filesystem_metadata_cache() == NULL);
 }
 
+TEST_F(SystemCachesTest, FileCacheIoThreads) {
+  options_->set_file_cache_path(kCachePath);
+  options_->set_use_shared_mem_locking(false);
+  options_->set_lru_cache_kb_per_process(0);
+  options_->set_default_shared_memory_cache_kb(0);
+  options_->set_file_cache_io_threads(2);
+  PrepareWithConfig(options_.get());
+  SystemCachePath* path = system_caches_->GetCache(options_.get());
+  EXPECT_TRUE(path->file_cache()->IsBlocking());
+  EXPECT_FALSE(path->async_file_cache()->IsBlocking());
+
+  // The HTTP and metadata caches use the non-blocking file cache, while the
+  // property cache keeps the blocking one.
+  scoped_ptr<ServerContext> server_context(
+      SetupServerContext(options_.release()));
+  EXPECT_STREQ(Compressed(FileCacheWithStats()),
+               server_context->metadata_cache()->Name());
+  EXPECT_STREQ(HttpCache(FileCacheWithStats()),
+               server_context->http_cache()->Name());
+}
+
+TEST_F(SystemCachesTest, FileCacheIoThreadsMerge) {
+  options_->set_file_cache_path(kCachePath);
+  SystemCachePath* path = system_caches_->GetCache(options_.get());
+  CacheInterface* async_cache = path->async_file_cache();
+  FileCache* backend = path->file_cache_backend();
+  EXPECT_TRUE(async_cache->IsBlocking());
+
+  // Another vhost sharing the path can ask for I/O threads, which go to the
+  // path's one FileCache, so every vhost on it stops blocking, whatever
+  // order they come in.
+  SystemRewriteOptions options2(thread_system_.get());
+  options2.set_file_cache_path(kCachePath);
+  options2.set_file_cache_io_threads(2);
+  EXPECT_EQ(path, system_caches_->GetCache(&options2));
+  EXPECT_EQ(async_cache, path->async_file_cache());
+  EXPECT_EQ(backend, path->file_cache_backend());
+  EXPECT_FALSE(async_cache->IsBlocking());
+  SystemRewriteOptions options3(thread_system_.get());
+  options3.set_file_cache_path(kCachePath);
+  options3.set_file_cache_io_threads(1);
+  EXPECT_EQ(path, system_caches_->GetCache(&options3));
+  EXPECT_EQ(async_cache, path->async_file_cache());
+  EXPECT_FALSE(async_cache->IsBlocking());
+
+  // The blocking cache is a view of the same FileCache.
+  EXPECT_TRUE(path->file_cache()->IsBlocking());
+  EXPECT_EQ(backend, path->file_cache()->Backend()->Backend());
+}
+
+TEST_F(SystemCachesTest, FileCacheIndex) {
+  options_->set_file_cache_path(kCachePath);
+  SystemCachePath* path = system_caches_->GetCache(options_.get());
+  EXPECT_FALSE(path->file_cache_backend()->index_enabled());
+
+  // Another vhost sharing the path can turn the index on.
+  SystemRewriteOptions options2(thread_system_.get());
+  options2.set_file_cache_path(kCachePath);
+  options2.set_file_cache_index(true);
+  EXPECT_EQ(path, system_caches_->GetCache(&options2));
+  EXPECT_TRUE(path->file_cache_backend()->index_enabled());
+}
+
+TEST_F(SystemCachesTest, FileCacheMaxEvictionsPerClean) {
+  options_->set_file_cache_path(kCachePath);
+  options_->set_file_cache_max_evictions_per_clean(1000);
+  SystemCachePath* path = system_caches_->GetCache(options_.get());
+  EXPECT_EQ(1000, path->file_cache_backend()->cache_policy()
+                      ->max_evictions_per_clean);
+
+  // A vhost sharing the path that leaves it at the default keeps the cap,
+  // while an explicitly larger one raises it.
+  SystemRewriteOptions options2(thread_system_.get());
+  options2.set_file_cache_path(kCachePath);
+  EXPECT_EQ(path, system_caches_->GetCache(&options2));
+  EXPECT_EQ(1000, path->file_cache_backend()->cache_policy()
+                      ->max_evictions_per_clean);
+  SystemRewriteOptions options3(thread_system_.get());
+  options3.set_file_cache_path(kCachePath);
+  options3.set_file_cache_max_evictions_per_clean(5000);
+  EXPECT_EQ(path, system_caches_->GetCache(&options3));
+  EXPECT_EQ(5000, path->file_cache_backend()->cache_policy()
+                      ->max_evictions_per_clean);
+}
+
 TEST_F(SystemCachesTest, UnusableShmAndLru) {
   // Test that we properly fallback when we can't create the shm cache
   // due to too small a size given.
@@ -496,12 +580,12 @@ TEST_F(SystemCachesTest, UnusableShmAndLru) {
 
   scoped_ptr<ServerContext> server_context(
       SetupServerContext(options_.release()));
-  EXPECT_STREQ(Compressed(WriteThrough(Stats("lru_cache", ThreadsafeLRU()),
+  EXPECT_STREQ(Compressed(WriteThrough(Stats("lru_cache", ShardedLRU()),
                                        FileCacheWithStats())),
                server_context->metadata_cache()->Name());
   EXPECT_STREQ(
       WriteThroughHTTP(
-          HttpCache(Stats("lru_cache", ThreadsafeLRU())),
+          HttpCache(Stats("lru_cache", ShardedLRU())),
           HttpCache(FileCacheWithStats())),
       server_context->http_cache()->Name());
   EXPECT_TRUE(server_context->filesystem_metadata_cache() == NULL);
@@ -525,7 +609,7 @@ TEST_F(SystemCachesTest, BasicShmAndLru) {
                server_context->metadata_cache()->Name());
   // HTTP cache is unaffected.
   EXPECT_STREQ(
-      WriteThroughHTTP(HttpCache(Stats("lru_cache", ThreadsafeLRU())),
+      WriteThroughHTTP(HttpCache(Stats("lru_cache", ShardedLRU())),
                        HttpCache(FileCacheWithStats())),
       server_context->http_cache()->Name());
   EXPECT_TRUE(server_context->filesystem_metadata_cache() == NULL);
@@ -581,7 +665,7 @@ TEST_F(SystemCachesTest, DoubleShmCreate) {
   // HTTP cache is unaffected.
   EXPECT_STREQ(
       WriteThroughHTTP(
-          HttpCache(Stats("lru_cache", ThreadsafeLRU())),
+          HttpCache(Stats("lru_cache", ShardedLRU())),
           HttpCache(FileCacheWithStats())),
       server_context->http_cache()->Name());
   EXPECT_TRUE(server_context->filesystem_metadata_cache() == NULL);
@@ -602,13 +686,13 @@ TEST_F(SystemCachesTest, BasicMemCachedAndLru) {
   scoped_ptr<ServerContext> server_context(
       SetupServerContext(options_.release()));
   EXPECT_STREQ(Compressed(
-      WriteThrough(Stats("lru_cache", ThreadsafeLRU()),
+      WriteThrough(Stats("lru_cache", ShardedLRU()),
                    Fallback(Batcher(AsyncMemCacheWithStats(), 1, 1000),
                             FileCacheWithStats()))),
                server_context->metadata_cache()->Name());
   EXPECT_STREQ(
       WriteThroughHTTP(
-          HttpCache(Stats("lru_cache", ThreadsafeLRU())),
+          HttpCache(Stats("lru_cache", ShardedLRU())),
           HttpCache(Fallback(Batcher(AsyncMemCacheWithStats(), 1, 1000),
                              FileCacheWithStats()))),
       server_context->http_cache()->Name());
@@ -657,7 +741,7 @@ TEST_F(SystemCachesTest, BasicMemCachedLruShm) {
       server_context->metadata_cache()->Name());
   EXPECT_STREQ(
       WriteThroughHTTP(
-          HttpCache(Stats("lru_cache", ThreadsafeLRU())),
+          HttpCache(Stats("lru_cache", ShardedLRU())),
           HttpCache(Fallback(Batcher(AsyncMemCacheWithStats(), 1, 1000),
                              FileCacheWithStats()))),
       server_context->http_cache()->Name());
@@ -968,10 +1052,11 @@ TEST_F(SystemCachesTest, LruCacheSettings) {
   ASSERT_TRUE(write_through != NULL);
   EXPECT_EQ(500, write_through->cache1_limit());
 
-  LRUCache* lru_cache = dynamic_cast<LRUCache*>(
+  ShardedLRUCache* lru_cache = dynamic_cast<ShardedLRUCache*>(
       SkipWrappers(write_through->cache1()));
   ASSERT_TRUE(lru_cache != NULL);
   EXPECT_EQ(1024*1024, lru_cache->max_bytes_in_cache());
+  EXPECT_EQ(ShardedLRUCache::kDefaultNumShards, lru_cache->num_shards());
 
   // Also on the HTTP cache (which has a separate write through class.
   WriteThroughHTTPCache* http_write_through =
@@ -980,6 +1065,27 @@ TEST_F(SystemCachesTest, LruCacheSettings) {
   EXPECT_EQ(500, http_write_through->cache1_limit());
 }
 
+TEST_F(SystemCachesTest, SmallLruCacheHasFewerShards) {
+  // Split 16 ways, 100KB would leave no shard room for even one 12KB entry,
+  // so the LRU cache is split just two ways, with room for four in each.
+  options_->set_file_cache_path(kCachePath);
+  options_->set_lru_cache_kb_per_process(100);
+  options_->set_lru_cache_byte_limit(12 * 1024);
+  options_->set_default_shared_memory_cache_kb(0);
+  PrepareWithConfig(options_.get());
+  scoped_ptr<ServerContext> server_context(
+      SetupServerContext(options_.release()));
+
+  WriteThroughCache* write_through = dynamic_cast<WriteThroughCache*>(
+      SkipWrappers(server_context->metadata_cache()));
+  ASSERT_TRUE(write_through != NULL);
+  ShardedLRUCache* lru_cache = dynamic_cast<ShardedLRUCache*>(
+      SkipWrappers(write_through->cache1()));
+  ASSERT_TRUE(lru_cache != NULL);
+  EXPECT_EQ(2, lru_cache->num_shards());
+  EXPECT_EQ(100 * 1024, lru_cache->max_bytes_in_cache());
+}
+
 TEST_F(SystemCachesTest, StatsStringMinimal) {
   // The format is rather dependent on the implementation so we don't check it,
   // but we do care that it at least doesn't crash.
@@ -1148,13 +1254,13 @@ TEST_F(BrokenShmSystemCachesTest, FallbackShmAndLru) {
   scoped_ptr<ServerContext> server_context(
       SetupServerContext(options_.release()));
   // We don't use the LRU when shm cache is on.
-  EXPECT_STREQ(Compressed(WriteThrough(Stats("lru_cache", ThreadsafeLRU()),
+  EXPECT_STREQ(Compressed(WriteThrough(Stats("lru_cache", ShardedLRU()),
                                        FileCacheWithStats())),
                server_context->metadata_cache()->Name());
   // HTTP cache is unaffected.
   EXPECT_STREQ(
       WriteThroughHTTP(
-          HttpCache(Stats("lru_cache", ThreadsafeLRU())),
+          HttpCache(Stats("lru_cache", ShardedLRU())),
           HttpCache(FileCacheWithStats())),
       server_context->http_cache()->Name());
 }
@@ -1200,13 +1306,13 @@ TEST_F(BrokenShmSystemCachesTest, FallbackMemCachedLruShm) {
   EXPECT_STREQ(
       Compressed(
           WriteThrough(
-              Stats("lru_cache", ThreadsafeLRU()),
+              Stats("lru_cache", ShardedLRU()),
               Fallback(Batcher(AsyncMemCacheWithStats(), 1, 1000),
                        FileCacheWithStats()))),
       server_context->metadata_cache()->Name());
   EXPECT_STREQ(
       WriteThroughHTTP(
-          HttpCache(Stats("lru_cache", ThreadsafeLRU())),
+          HttpCache(Stats("lru_cache", ShardedLRU())),
           HttpCache(Fallback(Batcher(AsyncMemCacheWithStats(), 1, 1000),
                              FileCacheWithStats()))),
       server_context->http_cache()->Name());
@@ -45,6 +45,7 @@
 #include "net/instaweb/util/public/property_cache.h"
 #include "net/instaweb/util/public/pthread_shared_mem.h"
 #include "net/instaweb/util/public/shared_circular_buffer.h"
+#include "net/instaweb/util/public/shared_mem_cache.h"
 #include "net/instaweb/util/public/shared_mem_statistics.h"
 #include "net/instaweb/util/public/stdio_file_system.h"
 #include "third_party/domain_registry_provider/src/domain_registry/domain_registry.h"
@@ -73,12 +74,19 @@ const char kUsePerVHostStatistics[] = "UsePerVHostStatistics";
 const char kInstallCrashHandler[] = "InstallCrashHandler";
 const char kNumRewriteThreads[] = "NumRewriteThreads";
 const char kNumExpensiveRewriteThreads[] = "NumExpensiveRewriteThreads";
+const char kRewriteThreadWorkStealing[] = "RewriteThreadWorkStealing";
 const char kForceCaching[] = "ForceCaching";
 const char kListOutstandingUrlsOnError[] = "ListOutstandingUrlsOnError";
 const char kMessageBufferSize[] = "MessageBufferSize";
 const char kTrackOriginalContentLength[] = "TrackOriginalContentLength";
 const char kCreateSharedMemoryMetadataCache[] =
     "CreateSharedMemoryMetadataCache";
+const char kSharedMemoryCacheAssociativity[] =
+    "SharedMemoryCacheAssociativity";
+const char kSharedMemoryCacheEvictionPolicy[] =
+    "SharedMemoryCacheEvictionPolicy";
+const char kPersistSharedMemoryMetadataCaches[] =
+    "PersistSharedMemoryMetadataCaches";
 
 }  // namespace
 
@@ -100,7 +108,8 @@ SystemRewriteDriverFactory::SystemRewriteDriverFactory(
       install_crash_handler_(false),
       thread_counts_finalized_(false),
       num_rewrite_threads_(-1),
-      num_expensive_rewrite_threads_(-1) {
+      num_expensive_rewrite_threads_(-1),
+      rewrite_thread_work_stealing_(false) {
   if (shared_mem_runtime == NULL) {
 #ifdef PAGESPEED_SUPPORT_POSIX_SHARED_MEM
     shared_mem_runtime = new PthreadSharedMem();
@@ -218,19 +227,25 @@ void SystemRewriteDriverFactory::InitStaticAssetManager(
 
 QueuedWorkerPool* SystemRewriteDriverFactory::CreateWorkerPool(
     WorkerPoolCategory pool, StringPiece name) {
+  QueuedWorkerPool* worker_pool = NULL;
   switch (pool) {
     case kHtmlWorkers:
       // In Apache this will effectively be 0, as it doesn't use HTML threads.
       return new QueuedWorkerPool(1, name, thread_system());
     case kRewriteWorkers:
-      return new QueuedWorkerPool(num_rewrite_threads_, name, thread_system());
+      worker_pool =
+          new QueuedWorkerPool(num_rewrite_threads_, name, thread_system());
+      break;
     case kLowPriorityRewriteWorkers:
-      return new QueuedWorkerPool(num_expensive_rewrite_threads_,
-                                  name,
-                                  thread_system());
+      worker_pool = new QueuedWorkerPool(num_expensive_rewrite_threads_,
+                                         name,
+                                         thread_system());
+      break;
     default:
       return RewriteDriverFactory::CreateWorkerPool(pool, name);
   }
+  worker_pool->set_work_stealing(rewrite_thread_work_stealing_);
+  return worker_pool;
 }
 
 void SystemRewriteDriverFactory::ParentOrChildInit() {
@@ -307,7 +322,11 @@ SystemRewriteDriverFactory::ParseAndSetOption1(StringPiece option,
       StringCaseEqual(option, kUsePerVHostStatistics) ||
       StringCaseEqual(option, kInstallCrashHandler) ||
       StringCaseEqual(option, kNumRewriteThreads) ||
-      StringCaseEqual(option, kNumExpensiveRewriteThreads)) {
+      StringCaseEqual(option, kNumExpensiveRewriteThreads) ||
+      StringCaseEqual(option, kRewriteThreadWorkStealing) ||
+      StringCaseEqual(option, kSharedMemoryCacheAssociativity) ||
+      StringCaseEqual(option, kSharedMemoryCacheEvictionPolicy) ||
+      StringCaseEqual(option, kPersistSharedMemoryMetadataCaches)) {
     if (!process_scope) {
       *msg = StrCat("'", option, "' is global and can't be set at this scope.");
       return RewriteOptions::kOptionValueInvalid;
@@ -333,6 +352,18 @@ SystemRewriteDriverFactory::ParseAndSetOption1(StringPiece option,
   if (StringCaseEqual(option, kStaticAssetPrefix)) {
     set_static_asset_prefix(arg);
     return RewriteOptions::kOptionOk;
+  } else if (StringCaseEqual(option, kSharedMemoryCacheEvictionPolicy)) {
+    if (StringCaseEqual(arg, "LRU")) {
+      caches()->set_shm_cache_eviction_policy(
+          SharedMemCache<64>::kEvictLeastRecentlyUsed);
+    } else if (StringCaseEqual(arg, "LFU")) {
+      caches()->set_shm_cache_eviction_policy(
+          SharedMemCache<64>::kEvictLeastFrequentlyUsed);
+    } else {
+      *msg = "must be LRU or LFU";
+      return RewriteOptions::kOptionValueInvalid;
+    }
+    return RewriteOptions::kOptionOk;
   }
 
   // Most of our options take booleans, so just parse once.
@@ -349,12 +380,18 @@ SystemRewriteDriverFactory::ParseAndSetOption1(StringPiece option,
   } else if (StringCaseEqual(option, kInstallCrashHandler)) {
     set_install_crash_handler(is_on);
     return parsed_as_bool;
+  } else if (StringCaseEqual(option, kRewriteThreadWorkStealing)) {
+    set_rewrite_thread_work_stealing(is_on);
+    return parsed_as_bool;
   } else if (StringCaseEqual(option, kListOutstandingUrlsOnError)) {
     list_outstanding_urls_on_error(is_on);
     return parsed_as_bool;
   } else if (StringCaseEqual(option, kTrackOriginalContentLength)) {
     set_track_original_content_length(is_on);
     return parsed_as_bool;
+  } else if (StringCaseEqual(option, kPersistSharedMemoryMetadataCaches)) {
+    caches()->set_persist_shm_caches(is_on);
+    return parsed_as_bool;
   }
 
   // Others take a positive integer.
@@ -371,6 +408,17 @@ SystemRewriteDriverFactory::ParseAndSetOption1(StringPiece option,
   } else if (StringCaseEqual(option, kMessageBufferSize)) {
     set_message_buffer_size(int_value);
     return parsed_as_int;
+  } else if (StringCaseEqual(option, kSharedMemoryCacheAssociativity)) {
+    // SharedMemCache CHECK-fails on an out of range associativity, so a bad
+    // value must never get as far as the caches.
+    if ((parsed_as_int != RewriteOptions::kOptionOk) ||
+        (int_value > SharedMemCache<64>::kMaxAssociativity)) {
+      *msg = StrCat("must be between 1 and ", IntegerToString(
+          SharedMemCache<64>::kMaxAssociativity));
+      return RewriteOptions::kOptionValueInvalid;
+    }
+    caches()->set_shm_cache_associativity(int_value);
+    return RewriteOptions::kOptionOk;
   }
 
   LOG(FATAL) << "Unknown options should have been handled in scope checking.";
@@ -0,0 +1,140 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Unit tests for process-scope option parsing in SystemRewriteDriverFactory.
+
+#include "net/instaweb/system/public/system_rewrite_driver_factory.h"
+
+#include "net/instaweb/rewriter/public/rewrite_options.h"
+#include "net/instaweb/rewriter/public/rewrite_test_base.h"
+#include "net/instaweb/system/public/system_caches.h"
+#include "net/instaweb/system/public/system_thread_system.h"
+#include "net/instaweb/util/public/gtest.h"
+#include "net/instaweb/util/public/scoped_ptr.h"
+#include "net/instaweb/util/public/shared_mem_cache.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/null_shared_mem.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
+
+namespace net_instaweb {
+
+class MessageHandler;
+class ServerContext;
+
+namespace {
+
+const char kAssociativity[] = "SharedMemoryCacheAssociativity";
+const char kWorkStealing[] = "RewriteThreadWorkStealing";
+
+// The least a SystemRewriteDriverFactory needs to be to parse options.
+class TestSystemRewriteDriverFactory : public SystemRewriteDriverFactory {
+ public:
+  TestSystemRewriteDriverFactory()
+      : SystemRewriteDriverFactory(RewriteTestBase::process_context(),
+                                   new SystemThreadSystem,
+                                   new NullSharedMem,
+                                   "localhost", 80) {
+  }
+  virtual ~TestSystemRewriteDriverFactory() { ShutDown(); }
+
+  virtual void NonStaticInitStats(Statistics* statistics) {}
+
+  // Whether a fresh pool of the given kind would have work stealing on.
+  bool PoolStealsWork(WorkerPoolCategory pool) {
+    scoped_ptr<QueuedWorkerPool> worker_pool(CreateWorkerPool(pool, "test"));
+    return worker_pool->work_stealing();
+  }
+
+ protected:
+  virtual MessageHandler* DefaultHtmlParseMessageHandler() {
+    return new NullMessageHandler;
+  }
+  virtual MessageHandler* DefaultMessageHandler() {
+    return new NullMessageHandler;
+  }
+  virtual ServerContext* NewDecodingServerContext() { return NULL; }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(TestSystemRewriteDriverFactory);
+};
+
+class SystemRewriteDriverFactoryTest : public testing::Test {
+ protected:
+  SystemRewriteDriverFactoryTest() {
+    factory_.Init();
+  }
+
+  RewriteOptions::OptionSettingResult Parse(StringPiece option,
+                                            StringPiece arg) {
+    msg_.clear();
+    return factory_.ParseAndSetOption1(option, arg, true /* process_scope */,
+                                       &msg_, &handler_);
+  }
+
+  TestSystemRewriteDriverFactory factory_;
+  NullMessageHandler handler_;
+  GoogleString msg_;
+};
+
+TEST_F(SystemRewriteDriverFactoryTest, Associativity) {
+  EXPECT_EQ(RewriteOptions::kOptionOk, Parse(kAssociativity, "8"));
+  EXPECT_EQ(8, factory_.caches()->shm_cache_associativity());
+
+  const int kMax = SharedMemCache<64>::kMaxAssociativity;
+  EXPECT_EQ(RewriteOptions::kOptionOk,
+            Parse(kAssociativity, IntegerToString(kMax)));
+  EXPECT_EQ(kMax, factory_.caches()->shm_cache_associativity());
+}
+
+TEST_F(SystemRewriteDriverFactoryTest, AssociativityOutOfRange) {
+  EXPECT_EQ(RewriteOptions::kOptionOk, Parse(kAssociativity, "8"));
+
+  // None of these may reach the caches, which would CHECK-fail on them.
+  const char* kBad[] = { "0", "-1", "17", "four" };
+  for (int i = 0, n = arraysize(kBad); i < n; ++i) {
+    EXPECT_EQ(RewriteOptions::kOptionValueInvalid,
+              Parse(kAssociativity, kBad[i])) << kBad[i];
+    EXPECT_EQ("must be between 1 and 16", msg_) << kBad[i];
+    EXPECT_EQ(8, factory_.caches()->shm_cache_associativity()) << kBad[i];
+  }
+}
+
+TEST_F(SystemRewriteDriverFactoryTest, WorkStealingIsOffByDefault) {
+  EXPECT_FALSE(factory_.rewrite_thread_work_stealing());
+  EXPECT_FALSE(factory_.PoolStealsWork(RewriteDriverFactory::kRewriteWorkers));
+  EXPECT_FALSE(factory_.PoolStealsWork(
+      RewriteDriverFactory::kLowPriorityRewriteWorkers));
+}
+
+TEST_F(SystemRewriteDriverFactoryTest, WorkStealingOption) {
+  EXPECT_EQ(RewriteOptions::kOptionOk, Parse(kWorkStealing, "on"));
+  EXPECT_TRUE(factory_.rewrite_thread_work_stealing());
+  EXPECT_TRUE(factory_.PoolStealsWork(RewriteDriverFactory::kRewriteWorkers));
+  EXPECT_TRUE(factory_.PoolStealsWork(
+      RewriteDriverFactory::kLowPriorityRewriteWorkers));
+
+  // The single HTML thread has nobody to steal from.
+  EXPECT_FALSE(factory_.PoolStealsWork(RewriteDriverFactory::kHtmlWorkers));
+
+  EXPECT_EQ(RewriteOptions::kOptionOk, Parse(kWorkStealing, "off"));
+  EXPECT_FALSE(factory_.PoolStealsWork(RewriteDriverFactory::kRewriteWorkers));
+  EXPECT_EQ(RewriteOptions::kOptionValueInvalid, Parse(kWorkStealing, "x"));
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -81,6 +81,22 @@ void SystemRewriteOptions::AddProperties() {
                     RewriteOptions::kMemcachedServers,
                     "Comma-separated list of servers e.g. "
                         "host1:port1,host2:port2", false);
+  AddSystemProperty(10000, &SystemRewriteOptions::memcached_hedge_delay_us_,
+                    "amhd", RewriteOptions::kMemcachedHedgeDelayUs,
+                    "With MemcachedReplicas, how long in microseconds to "
+                        "wait for a server before also asking a replica for "
+                        "the value, or 0 to only ask once the server fails",
+                    true);
+  AddSystemProperty(1, &SystemRewriteOptions::memcached_replicas_, "amr",
+                    RewriteOptions::kMemcachedReplicas,
+                    "Number of memcached servers to store each value on, so "
+                        "reads can go to another server if one times out",
+                    true);
+  AddSystemProperty(0, &SystemRewriteOptions::memcached_target_latency_us_,
+                    "amtl", RewriteOptions::kMemcachedTargetLatencyUs,
+                    "If positive, the memcached lookup latency in "
+                        "microseconds to aim for, by shrinking batches of "
+                        "lookups when lookups take longer", true);
   AddSystemProperty(1, &SystemRewriteOptions::memcached_threads_, "amt",
                     RewriteOptions::kMemcachedThreads,
                     "Number of background threads to use to run "
@@ -117,6 +133,19 @@ void SystemRewriteOptions::AddProperties() {
                     &SystemRewriteOptions::statistics_logging_max_file_size_kb_,
                     "aslfs", RewriteOptions::kStatisticsLoggingMaxFileSizeKb,
                     "Max size for statistics logging file.", false);
+  AddSystemProperty(false, &SystemRewriteOptions::profile_filters_, "apf",
+                    RewriteOptions::kProfileFilters,
+                    "Whether to record the time each filter takes, for the "
+                        "filter_profile admin page.", true);
+  AddSystemProperty(0, &SystemRewriteOptions::request_timeline_sample_rate_,
+                    "artsr", RewriteOptions::kRequestTimelineSampleRate,
+                    "Record a timeline of cache lookups, fetches and rewrites "
+                        "for one in this many requests; 0 disables.", true);
+  AddSystemProperty(1000,
+                    &SystemRewriteOptions::request_timeline_slow_threshold_ms_,
+                    "artst", RewriteOptions::kRequestTimelineSlowThresholdMs,
+                    "Sampled requests taking at least this many milliseconds "
+                        "are listed on the slow_requests admin page.", true);
   AddSystemProperty(true, &SystemRewriteOptions::use_shared_mem_locking_,
                     "ausml", RewriteOptions::kUseSharedMemLocking,
                     "Use shared memory for internal named lock service", true);
@@ -136,6 +165,20 @@ void SystemRewriteOptions::AddProperties() {
                     "afcl", RewriteOptions::kFileCacheCleanInodeLimit,
                     "Set the target number of inodes for the file cache; 0 "
                         "means no limit", true);
+  AddSystemProperty(false, &SystemRewriteOptions::file_cache_index_, "afci",
+                    RewriteOptions::kFileCacheIndex,
+                    "Keep an index of the file cache's files, so that cleaning "
+                        "doesn't have to walk the whole cache directory", true);
+  AddSystemProperty(0, &SystemRewriteOptions::file_cache_io_threads_, "afcio",
+                    RewriteOptions::kFileCacheIoThreads,
+                    "Number of background threads to use for file cache reads "
+                        "and writes on behalf of the HTTP cache; 0 means they "
+                        "block the requesting thread", true);
+  AddSystemProperty(
+      0, &SystemRewriteOptions::file_cache_max_evictions_per_clean_, "afcme",
+      RewriteOptions::kFileCacheMaxEvictionsPerClean,
+      "With FileCacheIndex, the most files a single clean will evict before "
+          "rescheduling itself; 0 means no limit", true);
   AddSystemProperty(0, &SystemRewriteOptions::lru_cache_byte_limit_, "alcb",
                     RewriteOptions::kLruCacheByteLimit,
                     "Set the maximum byte size entry to store in the "
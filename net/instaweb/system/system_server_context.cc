@@ -38,6 +38,8 @@
 #include "net/instaweb/util/public/statistics.h"
 #include "net/instaweb/util/public/thread_system.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/filter_profiler.h"
+#include "pagespeed/kernel/base/request_timeline.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/timer.h"
 
@@ -53,6 +55,29 @@ const char kCacheFlushCount[] = "cache_flush_count";
 const char kCacheFlushTimestampMs[] = "cache_flush_timestamp_ms";
 const char kStatistics404Count[] = "statistics_404_count";
 
+// Filters whose resource rewrites ProfileFilters also records in statistics
+// histograms, so they're aggregated over all the server processes.
+const char* const kProfiledRewriteFilterIds[] = {
+  RewriteOptions::kCacheExtenderId,
+  RewriteOptions::kCssCombinerId,
+  RewriteOptions::kCssFilterId,
+  RewriteOptions::kCssImportFlattenerId,
+  RewriteOptions::kCssInlineId,
+  RewriteOptions::kGoogleFontCssInlineId,
+  RewriteOptions::kImageCombineId,
+  RewriteOptions::kImageCompressionId,
+  RewriteOptions::kInPlaceRewriteId,
+  RewriteOptions::kJavascriptCombinerId,
+  RewriteOptions::kJavascriptInlineId,
+  RewriteOptions::kJavascriptMinId,
+  RewriteOptions::kJavascriptMinSourceMapId,
+  RewriteOptions::kLocalStorageCacheId,
+  RewriteOptions::kPrioritizeCriticalCssId,
+};
+
+// Number of sampled request timelines kept for the slow_requests page.
+const int kMaxRequestTimelines = 64;
+
 }  // namespace
 
 SystemServerContext::SystemServerContext(
@@ -150,7 +175,8 @@ void SystemServerContext::CheckLegacyGlobalCacheFlushFile() {
             (timestamp_ms !=
              cache_flush_timestamp_ms_->SetReturningPreviousValue(
                  timestamp_ms))) {
-          int count = cache_flush_count_->Add(1);
+          cache_flush_count_->Add(1);
+          int count = cache_flush_count_->Get();
           message_handler()->Message(kWarning, "Cache Flush %d", count);
         }
       }
@@ -227,6 +253,9 @@ void SystemServerContext::InitStats(Statistics* statistics) {
   // than anything we have reasonably seen, to make sure we don't cut off actual
   // samples.
   html_rewrite_time_us_histogram->SetMaxValue(2 * Timer::kSecondUs);
+  for (int i = 0, n = arraysize(kProfiledRewriteFilterIds); i < n; ++i) {
+    FilterProfiler::InitRewriteStats(kProfiledRewriteFilterIds[i], statistics);
+  }
   UrlAsyncFetcherStats::InitStats(kLocalFetcherStatsPrefix, statistics);
 }
 
@@ -275,6 +304,24 @@ void SystemServerContext::ChildInit(SystemRewriteDriverFactory* factory) {
       set_default_system_fetcher(stats_fetcher_.get());
     }
 
+    if (global_system_rewrite_options()->profile_filters()) {
+      filter_profiler_.reset(
+          new FilterProfiler(factory->thread_system(), factory->timer()));
+      filter_profiler_->set_statistics(statistics());
+      set_filter_profiler(filter_profiler_.get());
+    }
+
+    int sample_rate =
+        global_system_rewrite_options()->request_timeline_sample_rate();
+    if (sample_rate > 0) {
+      request_timeline_store_.reset(new RequestTimelineStore(
+          factory->thread_system(), factory->timer(), sample_rate,
+          global_system_rewrite_options()->request_timeline_slow_threshold_ms()
+              * Timer::kMsUs,
+          kMaxRequestTimelines));
+      set_request_timeline_store(request_timeline_store_.get());
+    }
+
     // To allow Flush to come in while multiple threads might be
     // referencing the signature, we must be able to mutate the
     // timestamp and signature atomically.  RewriteOptions supports
@@ -283,6 +330,12 @@ void SystemServerContext::ChildInit(SystemRewriteDriverFactory* factory) {
         thread_system()->NewRWLock());
     factory->InitServerContext(this);
 
+    // The metadata cache is shared between processes, so slow request traces
+    // put there can be served by whichever one gets the request for them.
+    if (request_timeline_store_.get() != NULL) {
+      request_timeline_store_->set_shared_cache(metadata_cache());
+    }
+
     html_rewrite_time_us_histogram_ = statistics()->GetHistogram(
         kHtmlRewriteTimeUsHistogram);
     html_rewrite_time_us_histogram_->SetMaxValue(2 * Timer::kSecondUs);
@@ -161,6 +161,7 @@
         'rewriter/image_endian_test.cc',
         'rewriter/image_oom_test.cc',
         'rewriter/image_rewrite_filter_test.cc',
+        'rewriter/image_rewrite_queue_test.cc',
         'rewriter/image_test.cc',
         'rewriter/image_test_base.cc',
         'rewriter/image_url_encoder_test.cc',
@@ -240,6 +241,7 @@
         '<(DEPTH)/pagespeed/kernel/base/countdown_timer_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/escaping_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/fast_wildcard_group_test.cc',
+        '<(DEPTH)/pagespeed/kernel/base/filter_profiler_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/function_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/hasher_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/hostname_util_test.cc',
@@ -253,6 +255,7 @@
         '<(DEPTH)/pagespeed/kernel/base/null_statistics_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/pool_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/ref_counted_ptr_test.cc',
+        '<(DEPTH)/pagespeed/kernel/base/request_timeline_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/sha1_signature_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/shared_string_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/source_map_test.cc',
@@ -272,14 +275,17 @@
         '<(DEPTH)/pagespeed/kernel/cache/cache_batcher_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/cache_stats_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/compressed_cache_test.cc',
+        '<(DEPTH)/pagespeed/kernel/cache/consistent_hash_ring_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/delay_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/fallback_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/file_cache_test.cc',
+        '<(DEPTH)/pagespeed/kernel/cache/file_cache_index_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/key_value_codec_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/lru_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/mock_time_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/purge_context_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/purge_set_test.cc',
+        '<(DEPTH)/pagespeed/kernel/cache/sharded_lru_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/threadsafe_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/write_through_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/html/canonical_attributes_test.cc',
@@ -287,6 +293,7 @@
         '<(DEPTH)/pagespeed/kernel/html/doctype_test.cc',
         '<(DEPTH)/pagespeed/kernel/html/elide_attributes_filter_test.cc',
         '<(DEPTH)/pagespeed/kernel/html/html_attribute_quote_removal_test.cc',
+        '<(DEPTH)/pagespeed/kernel/html/html_event_list_test.cc',
         '<(DEPTH)/pagespeed/kernel/html/html_keywords_test.cc',
         '<(DEPTH)/pagespeed/kernel/html/html_name_test.cc',
         '<(DEPTH)/pagespeed/kernel/html/html_parse_test.cc',
@@ -403,6 +410,7 @@
         'system/loopback_route_fetcher_test.cc',
         'system/serf_url_async_fetcher_test.cc',
         'system/system_caches_test.cc',
+        'system/system_rewrite_driver_factory_test.cc',
         'system/system_request_context_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/mem_debug.cc',
       ],
@@ -459,6 +467,7 @@
         '<(DEPTH)/pagespeed/kernel.gyp:pthread_system',
         '<(DEPTH)/pagespeed/kernel.gyp:pagespeed_base_core',
         '<(DEPTH)/pagespeed/kernel.gyp:pagespeed_http',
+        '<(DEPTH)/pagespeed/kernel.gyp:pagespeed_sharedmem',
         '<(DEPTH)/pagespeed/kernel.gyp:proto_util',
         '<(DEPTH)/third_party/css_parser/css_parser.gyp:css_parser',
         '<(DEPTH)/third_party/re2/re2.gyp:re2_bench_util',
@@ -478,7 +487,11 @@
         '<(DEPTH)/pagespeed/kernel/cache/compressed_cache_speed_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/lru_cache_speed_test.cc',
         '<(DEPTH)/pagespeed/kernel/html/html_parse_speed_test.cc',
+        '<(DEPTH)/pagespeed/kernel/sharedmem/shared_mem_cache_speed_test.cc',
+        '<(DEPTH)/pagespeed/kernel/sharedmem/shared_mem_statistics_speed_test.cc',
+        '<(DEPTH)/pagespeed/kernel/thread/scheduler_speed_test.cc',
         '<(DEPTH)/pagespeed/kernel/util/deque_speed_test.cc',
+        '<(DEPTH)/pagespeed/kernel/util/simple_stats_speed_test.cc',
         '<(DEPTH)/pagespeed/kernel/util/url_escaper_speed_test.cc',
       ],
     },
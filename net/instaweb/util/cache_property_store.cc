@@ -20,6 +20,7 @@
 
 #include <algorithm>
 #include <utility>
+#include <vector>
 
 #include "base/logging.h"
 #include "net/instaweb/http/public/log_record.h"
@@ -261,6 +262,50 @@ void CachePropertyStore::Put(const GoogleString& url,
   }
 }
 
+void CachePropertyStore::MultiPut(const PutRequestVector& requests) {
+  // Group the writes by the backend under each cohort's CacheStats, so that
+  // cohorts sharing a backend are written in one round trip.
+  typedef std::map<CacheInterface*, std::vector<CacheStats*> > BackendCachesMap;
+  typedef std::map<CacheInterface*, CacheInterface::MultiPutRequest*>
+      BackendRequestMap;
+  BackendCachesMap backend_caches;
+  BackendRequestMap backend_requests;
+  for (int i = 0, n = requests.size(); i < n; ++i) {
+    const PutRequest& request = requests[i];
+    CohortCacheMap::iterator cohort_itr =
+        cohort_cache_map_.find(request.cohort->name());
+    CHECK(cohort_itr != cohort_cache_map_.end());
+    CacheStats* cache = cohort_itr->second;
+    CacheInterface* backend = cache->Backend();
+    CacheInterface::MultiPutRequest*& backend_request =
+        backend_requests[backend];
+    if (backend_request == NULL) {
+      backend_request = new CacheInterface::MultiPutRequest;
+    }
+    GoogleString value;
+    StringOutputStream sstream(&value);
+    request.values->SerializeToZeroCopyStream(&sstream);
+    SharedString shared_value;
+    shared_value.SwapWithString(&value);
+    backend_request->push_back(CacheInterface::KeyValue(
+        CacheKey(request.url, request.options_signature_hash,
+                 request.cache_key_suffix, request.cohort),
+        shared_value));
+    backend_caches[backend].push_back(cache);
+  }
+  for (BackendRequestMap::iterator p = backend_requests.begin(),
+           e = backend_requests.end(); p != e; ++p) {
+    std::vector<CacheStats*>& caches = backend_caches[p->first];
+    CacheInterface::MultiPutRequest* request = p->second;
+    if (request->size() == 1) {
+      caches[0]->Put((*request)[0].key, &(*request)[0].value);
+      delete request;
+    } else {
+      CacheStats::MultiPutThrough(caches, request);
+    }
+  }
+}
+
 void CachePropertyStore::AddCohort(const GoogleString& cohort) {
   AddCohortWithCache(cohort, default_cache_);
 }
@@ -269,11 +314,11 @@ void CachePropertyStore::AddCohortWithCache(
     const GoogleString& cohort, CacheInterface* cache) {
   std::pair<CohortCacheMap::iterator, bool> insertions =
       cohort_cache_map_.insert(
-        make_pair(cohort, static_cast<CacheInterface*>(NULL)));
+        make_pair(cohort, static_cast<CacheStats*>(NULL)));
   CHECK(insertions.second) << cohort << " is added twice.";
   // Create a new CacheStats for every cohort so that we can track cache
   // statistics independently for every cohort.
-  CacheInterface* cache_stats = new CacheStats(
+  CacheStats* cache_stats = new CacheStats(
         PropertyCache::GetStatsPrefix(cohort), cache, timer_, stats_);
   insertions.first->second = cache_stats;
 }
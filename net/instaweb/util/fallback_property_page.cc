@@ -18,6 +18,8 @@
 
 #include "net/instaweb/util/public/fallback_property_page.h"
 
+#include <vector>
+
 #include "base/logging.h"
 #include "net/instaweb/util/public/google_url.h"
 
@@ -75,10 +77,10 @@ void FallbackPropertyPage::UpdateValue(
 
 void FallbackPropertyPage::WriteCohort(
     const PropertyCache::Cohort* cohort) {
-  actual_property_page_->WriteCohort(cohort);
-  if (property_page_with_fallback_values_ != NULL) {
-    property_page_with_fallback_values_->WriteCohort(cohort);
-  }
+  std::vector<PropertyPage*> pages;
+  pages.push_back(actual_property_page_.get());
+  pages.push_back(property_page_with_fallback_values_.get());
+  PropertyPage::WriteCohortForPages(cohort, pages);
 }
 
 CacheInterface::KeyState FallbackPropertyPage::GetCacheState(
@@ -31,6 +31,9 @@
 #include "net/instaweb/util/public/property_store.h"
 #include "net/instaweb/util/public/simple_stats.h"
 #include "net/instaweb/util/public/thread_system.h"
+#include "pagespeed/kernel/base/cache_interface.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/string_util.h"
 #include "testing/base/public/gunit.h"
 
 namespace net_instaweb {
@@ -45,15 +48,51 @@ const char kValue2[] = "value2";
 const char kOptionsSignatureHash[] = "hash";
 const char kCacheKeySuffix[] = "CacheKeySuffix";
 
+// Passes everything through to another cache, counting the requests that
+// write to it, each of which would be a round trip to a remote cache.
+class WriteCountingCache : public CacheInterface {
+ public:
+  explicit WriteCountingCache(CacheInterface* cache)
+      : cache_(cache), num_writes_(0) {}
+  virtual ~WriteCountingCache() {}
+
+  virtual void Get(const GoogleString& key, Callback* callback) {
+    cache_->Get(key, callback);
+  }
+  virtual void Put(const GoogleString& key, SharedString* value) {
+    ++num_writes_;
+    cache_->Put(key, value);
+  }
+  virtual void MultiPut(MultiPutRequest* request) {
+    ++num_writes_;
+    cache_->MultiPut(request);
+  }
+  virtual void Delete(const GoogleString& key) { cache_->Delete(key); }
+  virtual GoogleString Name() const { return cache_->Name(); }
+  virtual bool IsBlocking() const { return cache_->IsBlocking(); }
+  virtual bool IsHealthy() const { return cache_->IsHealthy(); }
+  virtual void ShutDown() { cache_->ShutDown(); }
+
+  int num_writes() const { return num_writes_; }
+
+ private:
+  CacheInterface* cache_;
+  int num_writes_;
+
+  DISALLOW_COPY_AND_ASSIGN(WriteCountingCache);
+};
+
 class FallbackPropertyPageTest : public testing::Test {
  protected:
   FallbackPropertyPageTest()
       : lru_cache_(kMaxCacheSize),
+        write_counting_cache_(&lru_cache_),
         thread_system_(Platform::CreateThreadSystem()),
         timer_(thread_system_->NewMutex(), MockTimer::kApr_5_2010_ms),
         stats_(thread_system_.get()),
         cache_property_store_(
-            "test/", &lru_cache_, &timer_, &stats_, thread_system_.get()),
+            "test/", &write_counting_cache_, &timer_, &stats_,
+            thread_system_.get()),
         property_cache_(&cache_property_store_,
                         &timer_,
                         &stats_,
@@ -120,6 +159,7 @@ class FallbackPropertyPageTest : public testing::Test {
 
   scoped_ptr<FallbackPropertyPage> fallback_page_;
   LRUCache lru_cache_;
+  WriteCountingCache write_counting_cache_;
   scoped_ptr<ThreadSystem> thread_system_;
   MockTimer timer_;
   SimpleStats stats_;
@@ -219,6 +259,22 @@ TEST_F(FallbackPropertyPageTest, TestWriteCohortIfFallbackPageIsSet) {
   CheckValueIsPresent(kValue1);
 }
 
+TEST_F(FallbackPropertyPageTest, TestWriteCohortWritesBothPagesTogether) {
+  SetupFallbackPage();
+  fallback_page_->UpdateValue(cohort_, kPropertyName1, kValue1);
+  fallback_page_->WriteCohort(cohort_);
+
+  // Both pages went to the cache in a single request, but are still counted
+  // as separate inserts into the cohort.
+  EXPECT_EQ(1, write_counting_cache_.num_writes());
+  EXPECT_EQ(2, lru_cache_.num_inserts());
+  EXPECT_EQ(2, stats_.GetVariable(StrCat(
+      PropertyCache::GetStatsPrefix(kCohortName1), "_inserts"))->Get());
+
+  SetupFallbackPage();
+  CheckValueIsPresent(kValue1);
+}
+
 TEST_F(FallbackPropertyPageTest, TestGetFallbackPageUrl) {
   GoogleString fallback_path("http://www.abc.com/b/");
   GoogleString device_type_suffix("0");
@@ -20,6 +20,7 @@
 
 #include <algorithm>
 #include <utility>
+#include <vector>
 
 #include "base/logging.h"
 #include "net/instaweb/http/public/log_record.h"
@@ -399,6 +400,47 @@ void PropertyPage::WriteCohort(const PropertyCache::Cohort* cohort) {
   }
 }
 
+void PropertyPage::WriteCohortForPages(
+    const PropertyCache::Cohort* cohort,
+    const std::vector<PropertyPage*>& pages) {
+  if (cohort == NULL) {
+    // TODO(pulkitg): Change LOG(WARNING) to LOG(DFATAL).
+    LOG(WARNING) << "Cohort is NULL in PropertyPage::WriteCohortForPages()";
+    return;
+  }
+  PropertyCache* property_cache = NULL;
+  std::vector<PropertyCacheValues*> values;
+  PropertyStore::PutRequestVector requests;
+  for (int i = 0, n = pages.size(); i < n; ++i) {
+    PropertyPage* page = pages[i];
+    if (page == NULL) {
+      continue;
+    }
+    if (property_cache == NULL) {
+      property_cache = page->property_cache_;
+    } else if (page->property_cache_ != property_cache) {
+      // Can't share a batch with pages of another PropertyCache.
+      page->WriteCohort(cohort);
+      continue;
+    }
+    if (!property_cache->enabled()) {
+      continue;
+    }
+    scoped_ptr<PropertyCacheValues> page_values(new PropertyCacheValues);
+    if (page->EncodePropertyCacheValues(cohort, page_values.get()) ||
+        page->HasPropertyValueDeleted(cohort)) {
+      requests.push_back(PropertyStore::PutRequest(
+          page->url_, page->options_signature_hash_, page->cache_key_suffix_,
+          cohort, page_values.get()));
+      values.push_back(page_values.release());
+    }
+  }
+  if (!requests.empty()) {
+    property_cache->property_store()->MultiPut(requests);
+  }
+  STLDeleteElements(&values);
+}
+
 CacheInterface::KeyState PropertyPage::GetCacheState(
     const PropertyCache::Cohort* cohort) {
   ScopedMutex lock(mutex_.get());
@@ -39,6 +39,14 @@ PropertyStore::PropertyStore()
 PropertyStore::~PropertyStore() {
 }
 
+void PropertyStore::MultiPut(const PutRequestVector& requests) {
+  for (int i = 0, n = requests.size(); i < n; ++i) {
+    const PutRequest& request = requests[i];
+    Put(request.url, request.options_signature_hash, request.cache_key_suffix,
+        request.cohort, request.values, NULL);
+  }
+}
+
 void PropertyStoreGetCallback::InitStats(Statistics* statistics) {
   fast_finish_lookup_latency_ms_ =
       statistics->AddHistogram("PropertyStoreLatencyAfterFastFinishCalledMs");
@@ -37,6 +37,7 @@ namespace net_instaweb {
 
 class AbstractPropertyStoreGetCallback;
 class CacheInterface;
+class CacheStats;
 class PropertyCacheValues;
 class Statistics;
 class ThreadSystem;
@@ -76,6 +77,10 @@ class CachePropertyStore : public PropertyStore {
                    const PropertyCacheValues* values,
                    BoolCallback* done);
 
+  // Writes the batch with one MultiPut per cache backend, which is usually
+  // shared by all the cohorts.
+  virtual void MultiPut(const PutRequestVector& requests);
+
   // Establishes a Cohort backed by the CacheInteface passed to the constructor.
   void AddCohort(const GoogleString& cohort);
   // Establishes a Cohort to be backed by the specified CacheInterface.
@@ -104,7 +109,8 @@ class CachePropertyStore : public PropertyStore {
 
  private:
   GoogleString cache_key_prefix_;
-  typedef std::map<GoogleString, CacheInterface*> CohortCacheMap;
+  // Every cohort gets its own CacheStats wrapping its backend.
+  typedef std::map<GoogleString, CacheStats*> CohortCacheMap;
   CohortCacheMap cohort_cache_map_;
   CacheInterface* default_cache_;
   Timer* timer_;
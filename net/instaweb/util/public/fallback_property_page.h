@@ -61,7 +61,7 @@ class FallbackPropertyPage : public AbstractPropertyPage {
       const StringPiece& value);
 
   // Updates a Cohort of properties into the cache. It will also update for
-  // fallback property cache.
+  // fallback property cache, in the same batch of cache writes.
   virtual void WriteCohort(const PropertyCache::Cohort* cohort);
 
   // Gets the cache state for the actual property page.
@@ -364,6 +364,12 @@ class PropertyPage : public AbstractPropertyPage {
   // should be called periodically to update stability metrics.
   virtual void WriteCohort(const PropertyCache::Cohort* cohort);
 
+  // Like calling WriteCohort on each of pages, but hands all the writes to
+  // the PropertyStore together, so that ones going to the same cache backend
+  // take a single round trip.  NULL entries in pages are skipped.
+  static void WriteCohortForPages(const PropertyCache::Cohort* cohort,
+                                  const std::vector<PropertyPage*>& pages);
+
   // This function returns the cache state for a given cohort.
   //
   // It is a programming error to call GetCacheState on a PropertyPage
@@ -21,6 +21,8 @@
 #ifndef NET_INSTAWEB_UTIL_PUBLIC_PROPERTY_STORE_H_
 #define NET_INSTAWEB_UTIL_PUBLIC_PROPERTY_STORE_H_
 
+#include <vector>
+
 #include "net/instaweb/util/public/abstract_property_store_get_callback.h"
 #include "net/instaweb/util/public/property_cache.h"
 #include "net/instaweb/util/public/string.h"
@@ -41,6 +43,27 @@ class Timer;
 class PropertyStore {
  public:
   typedef Callback1<bool> BoolCallback;
+
+  // One cohort write of a MultiPut.  Does not own the cohort or values.
+  struct PutRequest {
+    PutRequest(const GoogleString& url_in,
+               const GoogleString& options_signature_hash_in,
+               const GoogleString& cache_key_suffix_in,
+               const PropertyCache::Cohort* cohort_in,
+               const PropertyCacheValues* values_in)
+        : url(url_in),
+          options_signature_hash(options_signature_hash_in),
+          cache_key_suffix(cache_key_suffix_in),
+          cohort(cohort_in),
+          values(values_in) {}
+    GoogleString url;
+    GoogleString options_signature_hash;
+    GoogleString cache_key_suffix;
+    const PropertyCache::Cohort* cohort;
+    const PropertyCacheValues* values;
+  };
+  typedef std::vector<PutRequest> PutRequestVector;
+
   PropertyStore();
   virtual ~PropertyStore();
 
@@ -74,6 +97,11 @@ class PropertyStore {
       const PropertyCacheValues* values,
       BoolCallback* done) = 0;
 
+  // Writes several cohorts, possibly of different pages, together.  The
+  // default implementation calls Put for each; stores whose backend can take
+  // them in one round trip should override it.
+  virtual void MultiPut(const PutRequestVector& requests);
+
   // PropertyStore::Get can be cancelled if enable_get_cancellation is true
   // i.e. input done callback will be called as soon as FastFinishLookup() is
   // called on the AbstractPropertyStoreGetCallback callback.
@@ -62,6 +62,9 @@ class TwoLevelPropertyStore : public PropertyStore {
       const PropertyCacheValues* values,
       BoolCallback* done);
 
+  // Writes the batch to both the storage systems.
+  virtual void MultiPut(const PutRequestVector& requests);
+
   virtual GoogleString Name() const;
 
  private:
@@ -385,6 +385,11 @@ void TwoLevelPropertyStore::Put(
   }
 }
 
+void TwoLevelPropertyStore::MultiPut(const PutRequestVector& requests) {
+  primary_property_store_->MultiPut(requests);
+  secondary_property_store_->MultiPut(requests);
+}
+
 GoogleString TwoLevelPropertyStore::Name() const {
   return StrCat(
       "1:", primary_property_store_->Name(),
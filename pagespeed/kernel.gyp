@@ -42,6 +42,7 @@
         'kernel/base/debug.cc',
         'kernel/base/file_message_handler.cc',
         'kernel/base/file_system.cc',
+        'kernel/base/filter_profiler.cc',
         'kernel/base/google_message_handler.cc',
         'kernel/base/message_handler.cc',
         'kernel/base/null_message_handler.cc',
@@ -101,6 +102,7 @@
         'kernel/base/null_rw_lock.cc',
         'kernel/base/null_statistics.cc',
         'kernel/base/posix_timer.cc',
+        'kernel/base/request_timeline.cc',
         'kernel/base/request_trace.cc',
         'kernel/base/rolling_hash.cc',
         'kernel/base/sha1_signature.cc',
@@ -192,13 +194,16 @@
         'kernel/cache/cache_batcher.cc',
         'kernel/cache/cache_stats.cc',
         'kernel/cache/compressed_cache.cc',
+        'kernel/cache/consistent_hash_ring.cc',
         'kernel/cache/delegating_cache_callback.cc',
         'kernel/cache/fallback_cache.cc',
         'kernel/cache/file_cache.cc',
+        'kernel/cache/file_cache_index.cc',
         'kernel/cache/key_value_codec.cc',
         'kernel/cache/lru_cache.cc',
         'kernel/cache/purge_context.cc',
         'kernel/cache/purge_set.cc',
+        'kernel/cache/sharded_lru_cache.cc',
         'kernel/cache/threadsafe_cache.cc',
         'kernel/cache/write_through_cache.cc',
        ],
@@ -236,6 +241,7 @@
         'kernel/html/html_attribute_quote_removal.cc',
         'kernel/html/html_element.cc',
         'kernel/html/html_event.cc',
+        'kernel/html/html_event_list.cc',
         'kernel/html/html_filter.cc',
         'kernel/html/html_keywords.cc',
         'kernel/html/html_lexer.cc',
@@ -395,6 +401,7 @@
       'target_name': 'pagespeed_image_processing',
       'type': '<(library)',
       'dependencies': [
+        ':pagespeed_base',
         '<(DEPTH)/base/base.gyp:base',
         '<(DEPTH)/build/libwebp.gyp:libwebp_enc',
         '<(DEPTH)/build/libwebp.gyp:libwebp_enc_mux',
@@ -497,6 +504,7 @@
       'target_name': 'pagespeed_thread',
       'type': '<(library)',
       'sources': [
+        'kernel/thread/named_lock_wait_queue.cc',
         'kernel/thread/queued_alarm.cc',
         'kernel/thread/queued_worker.cc',
         'kernel/thread/queued_worker_pool.cc',
@@ -18,6 +18,9 @@
 
 #include "pagespeed/kernel/base/abstract_shared_mem.h"
 
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/string.h"
+
 namespace net_instaweb {
 
 AbstractSharedMemSegment::~AbstractSharedMemSegment() {
@@ -26,4 +29,14 @@ AbstractSharedMemSegment::~AbstractSharedMemSegment() {
 AbstractSharedMem::~AbstractSharedMem() {
 }
 
+AbstractSharedMemSegment* AbstractSharedMem::CreateFileBackedSegment(
+    const GoogleString& name, const GoogleString& file_path, size_t size,
+    MessageHandler* handler, bool* reused) {
+  *reused = false;
+  handler->Message(kError, "Unable to create SHM segment %s backed by %s: "
+                   "not supported by this shared memory implementation.",
+                   name.c_str(), file_path.c_str());
+  return NULL;
+}
+
 }  // namespace net_instaweb
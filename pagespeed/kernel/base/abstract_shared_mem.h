@@ -100,6 +100,22 @@ class AbstractSharedMem {
   virtual AbstractSharedMemSegment* CreateSegment(
       const GoogleString& name, size_t size, MessageHandler* handler) = 0;
 
+  // Like CreateSegment, but the segment's memory is a shared mapping of the
+  // file at file_path, so its contents outlive the server and can be picked
+  // up again on restart. If the file already exists with exactly the given
+  // size, its contents are kept and *reused is set to true. Otherwise, the
+  // file is created or resized, the memory zeroed, and *reused set to false.
+  // Either way, other processes/threads use AttachToSegment as usual.
+  //
+  // The contents of a reused file are whatever the previous user left there,
+  // and mutexes in it must be initialized again.
+  //
+  // Returns NULL on failure. The default implementation always fails, as
+  // not all implementations are able to map files.
+  virtual AbstractSharedMemSegment* CreateFileBackedSegment(
+      const GoogleString& name, const GoogleString& file_path, size_t size,
+      MessageHandler* handler, bool* reused);
+
   // Attaches to an existing segment, which must have been created already.
   // May return NULL on failure
   virtual AbstractSharedMemSegment* AttachToSegment(
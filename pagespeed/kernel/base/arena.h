@@ -37,7 +37,7 @@ class Arena {
   // this much room for our work area, as it keeps things simple.
   static const size_t kAlign = 8;
 
-  Arena() {
+  Arena() : num_objects_allocated_(0), num_chunks_allocated_(0) {
     InitEmpty();
   }
 
@@ -67,6 +67,7 @@ class Arena {
     last_link_ = our_last_link_field;
 
     next_alloc_ += size;
+    ++num_objects_allocated_;
 
     char* out = base + kAlign;
     // Warning: the following line is very type-sensitive and can't
@@ -78,6 +79,17 @@ class Arena {
   // Cleans up all the objects in the arena. You must call this explicitly.
   void DestroyObjects();
 
+  bool empty() const { return chunks_.empty(); }
+
+  // Returns whether object was allocated in this arena.  This takes time
+  // linear in the number of chunks.
+  bool Contains(const void* object) const;
+
+  // The number of objects, and of chunks from the heap, allocated over the
+  // arena's lifetime, including those since destroyed.  For benchmarks.
+  int64 num_objects_allocated() const { return num_objects_allocated_; }
+  int64 num_chunks_allocated() const { return num_chunks_allocated_; }
+
   // Rounds block size up to 8; we always align to it, even on 32-bit.
   static size_t ExpandToAlign(size_t in) {
     return (in + kAlign - 1) & ~(kAlign - 1);
@@ -128,12 +140,16 @@ class Arena {
   char* scratch_;
 
   std::vector<Chunk*> chunks_;
+
+  int64 num_objects_allocated_;
+  int64 num_chunks_allocated_;
 };
 
 template<typename T>
 void Arena<T>::AddChunk() {
   Chunk* chunk = new Chunk();
   chunks_.push_back(chunk);
+  ++num_chunks_allocated_;
   next_alloc_ = chunk->buf;
   chunk_end_ = next_alloc_ + Chunk::kSize;
   last_link_ = &scratch_;
@@ -154,6 +170,18 @@ void Arena<T>::DestroyObjects() {
   InitEmpty();
 }
 
+template<typename T>
+bool Arena<T>::Contains(const void* object) const {
+  const char* p = static_cast<const char*>(object);
+  for (int i = 0, n = chunks_.size(); i < n; ++i) {
+    const char* buf = chunks_[i]->buf;
+    if ((p >= buf) && (p < buf + Chunk::kSize)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 template<typename T>
 void Arena<T>::InitEmpty() {
   // The way this is initialized ensures that the next call to allocate
@@ -175,6 +175,37 @@ TEST_F(ArenaTest, TestReuse) {
   TestCombo(20000, 10000);
 }
 
+TEST_F(ArenaTest, TestContains) {
+  Arena<Base> other;
+  EXPECT_TRUE(arena_.empty());
+  Base* a = new (&arena_) KidA(this);
+  Base* b = new (&other) KidB(this);
+  EXPECT_FALSE(arena_.empty());
+  EXPECT_TRUE(arena_.Contains(a));
+  EXPECT_FALSE(arena_.Contains(b));
+  EXPECT_TRUE(other.Contains(b));
+  EXPECT_FALSE(other.Contains(a));
+  arena_.DestroyObjects();
+  other.DestroyObjects();
+  EXPECT_TRUE(arena_.empty());
+}
+
+TEST_F(ArenaTest, TestAllocationCounts) {
+  EXPECT_EQ(0, arena_.num_objects_allocated());
+  EXPECT_EQ(0, arena_.num_chunks_allocated());
+  TestCombo(10000, 0);
+  EXPECT_EQ(10000, arena_.num_objects_allocated());
+  int64 chunks = arena_.num_chunks_allocated();
+  EXPECT_LT(1, chunks);
+  EXPECT_GT(10000, chunks);
+
+  // The counts cover the arena's lifetime, not just what it holds now.
+  ClearStats();
+  TestCombo(10000, 0);
+  EXPECT_EQ(20000, arena_.num_objects_allocated());
+  EXPECT_EQ(2 * chunks, arena_.num_chunks_allocated());
+}
+
 // Tests for alignment helper.
 TEST_F(ArenaTest, TestAlign) {
   // A few that work regardless of arch, to sanity-check
@@ -66,6 +66,22 @@ void CacheInterface::MultiGet(MultiGetRequest* request) {
   delete request;
 }
 
+void CacheInterface::MultiPut(MultiPutRequest* request) {
+  for (int i = 0, n = request->size(); i < n; ++i) {
+    KeyValue* key_value = &(*request)[i];
+    Put(key_value->key, &key_value->value);
+  }
+  delete request;
+}
+
+void CacheInterface::MultiPutWithKeyInValue(MultiPutRequest* request) {
+  for (int i = 0, n = request->size(); i < n; ++i) {
+    KeyValue* key_value = &(*request)[i];
+    PutWithKeyInValue(key_value->key, &key_value->value);
+  }
+  delete request;
+}
+
 void CacheInterface::ReportMultiGetNotFound(MultiGetRequest* request) {
   for (int i = 0, n = request->size(); i < n; ++i) {
     KeyCallback& key_callback = (*request)[i];
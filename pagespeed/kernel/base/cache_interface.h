@@ -123,6 +123,16 @@ class CacheInterface {
   };
   typedef std::vector<KeyCallback> MultiGetRequest;
 
+  // Vector of structures used to initiate a MultiPut.  Copying a
+  // SharedString just bumps its reference count.
+  struct KeyValue {
+    KeyValue(const GoogleString& k, const SharedString& v)
+        : key(k), value(v) {}
+    GoogleString key;
+    SharedString value;
+  };
+  typedef std::vector<KeyValue> MultiPutRequest;
+
   static const char* KeyStateName(KeyState state);
 
   CacheInterface();
@@ -151,6 +161,14 @@ class CacheInterface {
   virtual void Put(const GoogleString& key, SharedString* value) = 0;
   virtual void Delete(const GoogleString& key) = 0;
 
+  // Puts multiple values, letting implementations for which a round-trip
+  // to a server dominates the cost of a Put (e.g. memcached) send them all
+  // at once.  Default implementation simply loops over the request and
+  // calls Put.
+  //
+  // Ownership of the request is transferred to this function.
+  virtual void MultiPut(MultiPutRequest* request);
+
   // Convenience method to do a Put from a GoogleString* value.  The
   // bytes will be swapped out of the value and into a temp
   // SharedString.
@@ -213,6 +231,11 @@ class CacheInterface {
     CHECK(false);
   }
 
+  // MultiPut counterpart of PutWithKeyInValue, where each value already
+  // has its key encoded into it.  Default implementation loops over the
+  // request and calls PutWithKeyInValue.  Takes ownership of the request.
+  virtual void MultiPutWithKeyInValue(MultiPutRequest* request);
+
  protected:
   // Invokes callback->ValidateCandidate() and callback->Done() as appropriate.
   void ValidateAndReportResult(const GoogleString& key, KeyState state,
@@ -0,0 +1,293 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pagespeed/kernel/base/filter_profiler.h"
+
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <utility>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/escaping.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/base/writer.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const char kRewriteHistogramPrefix[] = "filter_profile_rewrite_";
+
+// Upper bound of the rewrite histograms, which is well past the time of any
+// rewrite we've seen, so as not to cut off samples.
+const int64 kMaxHistogramUs = 2 * Timer::kSecondUs;
+
+bool MoreCpu(const FilterProfiler::Profile& a,
+             const FilterProfiler::Profile& b) {
+  if (a.cpu_us.total != b.cpu_us.total) {
+    return a.cpu_us.total > b.cpu_us.total;
+  }
+  if (a.wall_us.total != b.wall_us.total) {
+    return a.wall_us.total > b.wall_us.total;
+  }
+  if (a.kind != b.kind) {
+    return a.kind < b.kind;
+  }
+  return a.id < b.id;
+}
+
+GoogleString MeasureJson(const FilterProfiler::Measure& measure) {
+  if (measure.count == 0) {
+    return "null";
+  }
+  return StrCat(
+      "{\"count\": ", Integer64ToString(measure.count),
+      ", \"total\": ", Integer64ToString(measure.total),
+      ", \"max\": ", Integer64ToString(measure.max),
+      ", \"median\": ", Integer64ToString(measure.Percentile(50)),
+      StrCat(", \"p99\": ", Integer64ToString(measure.Percentile(99)), "}"));
+}
+
+}  // namespace
+
+const char* FilterProfiler::KindName(Kind kind) {
+  switch (kind) {
+    case kHtmlFilter:
+      return "html";
+    case kRewrite:
+      return "rewrite";
+    case kNumKinds:
+      break;
+  }
+  LOG(DFATAL) << "Unknown filter kind " << kind;
+  return "";
+}
+
+FilterProfiler::Measure::Measure() : count(0), total(0), max(0) {
+  std::fill(buckets, buckets + kNumBuckets, 0);
+}
+
+int64 FilterProfiler::Measure::Percentile(double percent) const {
+  if (count == 0) {
+    return 0;
+  }
+  int64 rank = static_cast<int64>(std::ceil(count * percent / 100.0));
+  rank = std::max(static_cast<int64>(1), std::min(rank, count));
+  int64 seen = 0;
+  for (int i = 0; i < kNumBuckets - 1; ++i) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      int64 top = (i == 0) ? 0 : (static_cast<int64>(1) << i) - 1;
+      return std::min(top, max);
+    }
+  }
+  return max;
+}
+
+FilterProfiler::Profile::Profile(Kind filter_kind, StringPiece filter_id)
+    : kind(filter_kind),
+      bytes(0) {
+  filter_id.CopyToString(&id);
+}
+
+FilterProfiler::Entry::Entry(Kind kind, StringPiece filter_id)
+    : profile(kind, filter_id),
+      wall_us_histogram(NULL),
+      cpu_us_histogram(NULL) {
+}
+
+FilterProfiler::Scope::Scope(FilterProfiler* profiler, Kind kind,
+                             StringPiece filter_id, int64 bytes)
+    : profiler_(profiler),
+      kind_(kind),
+      filter_id_(filter_id),
+      bytes_(bytes),
+      start_wall_us_(0),
+      start_cpu_us_(0) {
+  if (profiler_ != NULL) {
+    start_wall_us_ = profiler_->timer()->NowUs();
+    start_cpu_us_ = ThreadCpuUs();
+  }
+}
+
+FilterProfiler::Scope::~Scope() {
+  if (profiler_ != NULL) {
+    int64 cpu_us = kCpuUnavailable;
+    if (start_cpu_us_ != kCpuUnavailable) {
+      int64 end_cpu_us = ThreadCpuUs();
+      if (end_cpu_us != kCpuUnavailable) {
+        cpu_us = end_cpu_us - start_cpu_us_;
+      }
+    }
+    int64 wall_us = profiler_->timer()->NowUs() - start_wall_us_;
+    profiler_->Record(kind_, filter_id_, wall_us, cpu_us, bytes_);
+  }
+}
+
+FilterProfiler::FilterProfiler(ThreadSystem* thread_system, Timer* timer)
+    : timer_(timer),
+      statistics_(NULL),
+      mutex_(thread_system->NewMutex()) {
+}
+
+FilterProfiler::~FilterProfiler() {
+  Clear();
+}
+
+void FilterProfiler::InitRewriteStats(StringPiece filter_id,
+                                      Statistics* statistics) {
+  statistics->AddHistogram(RewriteWallUsHistogram(filter_id))->SetMaxValue(
+      kMaxHistogramUs);
+  statistics->AddHistogram(RewriteCpuUsHistogram(filter_id))->SetMaxValue(
+      kMaxHistogramUs);
+}
+
+GoogleString FilterProfiler::RewriteWallUsHistogram(StringPiece filter_id) {
+  return StrCat(kRewriteHistogramPrefix, filter_id, "_wall_us");
+}
+
+GoogleString FilterProfiler::RewriteCpuUsHistogram(StringPiece filter_id) {
+  return StrCat(kRewriteHistogramPrefix, filter_id, "_cpu_us");
+}
+
+Histogram* FilterProfiler::FindHistogram(const GoogleString& name) {
+  Histogram* histogram = statistics_->FindHistogram(name);
+  if (histogram != NULL) {
+    // Shared memory histograms can only be given their range once they're
+    // attached, which InitRewriteStats is too early for.  This is a no-op if
+    // the range is already set.
+    histogram->SetMaxValue(kMaxHistogramUs);
+  }
+  return histogram;
+}
+
+void FilterProfiler::AddSample(int64 value, Measure* measure) {
+  value = std::max(static_cast<int64>(0), value);  // Guard against skew.
+  int bucket = 0;
+  for (int64 v = value; (v != 0) && (bucket < kNumBuckets - 1); v >>= 1) {
+    ++bucket;
+  }
+  ++measure->count;
+  measure->total += value;
+  measure->max = std::max(measure->max, value);
+  ++measure->buckets[bucket];
+}
+
+void FilterProfiler::Record(Kind kind, StringPiece filter_id, int64 wall_us,
+                            int64 cpu_us, int64 bytes) {
+  DCHECK_LT(kind, kNumKinds);
+  Histogram* wall_us_histogram;
+  Histogram* cpu_us_histogram;
+  {
+    ScopedMutex lock(mutex_.get());
+    ProfileMap* profiles = &profiles_[kind];
+    ProfileMap::iterator p = profiles->find(filter_id);
+    Entry* entry;
+    if (p == profiles->end()) {
+      entry = new Entry(kind, filter_id);
+      if ((statistics_ != NULL) && (kind == kRewrite)) {
+        entry->wall_us_histogram =
+            FindHistogram(RewriteWallUsHistogram(filter_id));
+        entry->cpu_us_histogram =
+            FindHistogram(RewriteCpuUsHistogram(filter_id));
+      }
+      (*profiles)[entry->profile.id] = entry;
+    } else {
+      entry = p->second;
+    }
+    Profile* profile = &entry->profile;
+    profile->bytes += bytes;
+    AddSample(wall_us, &profile->wall_us);
+    if (cpu_us != kCpuUnavailable) {
+      AddSample(cpu_us, &profile->cpu_us);
+    }
+    wall_us_histogram = entry->wall_us_histogram;
+    cpu_us_histogram = entry->cpu_us_histogram;
+  }
+
+  // The histograms have locks of their own, which may be shared with other
+  // processes, so don't hold ours while adding to them.
+  if (wall_us_histogram != NULL) {
+    wall_us_histogram->Add(wall_us);
+  }
+  if ((cpu_us_histogram != NULL) && (cpu_us != kCpuUnavailable)) {
+    cpu_us_histogram->Add(cpu_us);
+  }
+}
+
+void FilterProfiler::Snapshot(ProfileVector* profiles) {
+  profiles->clear();
+  {
+    ScopedMutex lock(mutex_.get());
+    for (int kind = 0; kind < kNumKinds; ++kind) {
+      for (ProfileMap::const_iterator p = profiles_[kind].begin(),
+               e = profiles_[kind].end(); p != e; ++p) {
+        profiles->push_back(p->second->profile);
+      }
+    }
+  }
+  std::sort(profiles->begin(), profiles->end(), MoreCpu);
+}
+
+void FilterProfiler::DumpJson(Writer* writer, MessageHandler* handler) {
+  // Snapshot first, so we don't hold the lock while writing.
+  ProfileVector profiles;
+  Snapshot(&profiles);
+  writer->Write("{\"filters\": [", handler);
+  for (int i = 0, n = profiles.size(); i < n; ++i) {
+    const Profile& profile = profiles[i];
+    GoogleString escaped_id;
+    EscapeToJsonStringLiteral(profile.id, true /* add_quotes */, &escaped_id);
+    GoogleString entry = StrCat(
+        (i == 0) ? "{" : ", {",
+        "\"kind\": \"", KindName(profile.kind),
+        "\", \"id\": ", escaped_id,
+        ", \"bytes\": ", Integer64ToString(profile.bytes));
+    StrAppend(&entry,
+              ", \"wall_us\": ", MeasureJson(profile.wall_us),
+              ", \"cpu_us\": ", MeasureJson(profile.cpu_us), "}");
+    writer->Write(entry, handler);
+  }
+  writer->Write("]}", handler);
+}
+
+void FilterProfiler::Clear() {
+  ScopedMutex lock(mutex_.get());
+  for (int kind = 0; kind < kNumKinds; ++kind) {
+    STLDeleteValues(&profiles_[kind]);
+  }
+}
+
+int64 FilterProfiler::ThreadCpuUs() {
+  // RUSAGE_THREAD is supported on Linux since 2.6.26; see getrusage(2).
+#ifdef RUSAGE_THREAD
+  struct rusage usage;
+  if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+    return ((usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+            Timer::kSecondUs) +
+        usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+  }
+#endif
+  return kCpuUnavailable;
+}
+
+}  // namespace net_instaweb
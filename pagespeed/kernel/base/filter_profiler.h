@@ -0,0 +1,189 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_BASE_FILTER_PROFILER_H_
+#define PAGESPEED_KERNEL_BASE_FILTER_PROFILER_H_
+
+#include <map>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+class AbstractMutex;
+class Histogram;
+class MessageHandler;
+class Statistics;
+class ThreadSystem;
+class Timer;
+class Writer;
+
+// Accumulates the wall-clock time, CPU time and input bytes spent in each
+// filter, so we can tell which filters cost the most.  HTML filters are keyed
+// by name and resource rewrites by filter id, separately, so that the two
+// can't be confused.  Unlike Statistics, filters need not be declared up
+// front, so the profile is kept in-process rather than in shared memory.
+//
+// Each of the times is also kept in a histogram with one bucket per power of
+// two microseconds, from which approximate percentiles are computed.
+//
+// Resource rewrites by filters whose ids were declared with InitRewriteStats
+// are also recorded in Statistics histograms, which are shared between
+// server processes, so their costs can be seen for the whole server.
+//
+// This class is thread-safe.
+class FilterProfiler {
+ public:
+  // Bucket 0 counts samples of 0us; bucket i > 0 counts samples in
+  // [2^(i-1), 2^i) us, with the last bucket also taking anything longer.
+  static const int kNumBuckets = 32;
+
+  // Passed as the CPU time of a run when it could not be measured.
+  static const int64 kCpuUnavailable = -1;
+
+  // What a profile measures, and so how its filter is identified.
+  enum Kind {
+    kHtmlFilter,  // HtmlFilter::Name(), over a flush window.
+    kRewrite,     // RewriteFilter::id(), over a resource rewrite.
+    kNumKinds
+  };
+
+  // Returns "html" or "rewrite".
+  static const char* KindName(Kind kind);
+
+  // Totals for one kind of cost, over all the runs of a filter.
+  struct Measure {
+    Measure();
+
+    // Returns an upper bound on the given percentile (0 to 100) of the
+    // samples: the top of the bucket it falls in, or max if that's lower.
+    // Returns 0 if there are no samples.
+    int64 Percentile(double percent) const;
+
+    int64 count;
+    int64 total;
+    int64 max;
+    int64 buckets[kNumBuckets];
+  };
+
+  // Everything recorded for one filter.  cpu_us has no samples if the
+  // platform can't measure per-thread CPU time.
+  struct Profile {
+    Profile(Kind filter_kind, StringPiece filter_id);
+
+    Kind kind;
+    GoogleString id;
+    int64 bytes;
+    Measure wall_us;
+    Measure cpu_us;
+  };
+  typedef std::vector<Profile> ProfileVector;
+
+  // Records the costs of running the filter from construction to
+  // destruction, if profiler is non-NULL.
+  class Scope {
+   public:
+    Scope(FilterProfiler* profiler, Kind kind, StringPiece filter_id,
+          int64 bytes);
+    ~Scope();
+
+   private:
+    FilterProfiler* profiler_;
+    Kind kind_;
+    StringPiece filter_id_;
+    int64 bytes_;
+    int64 start_wall_us_;
+    int64 start_cpu_us_;
+
+    DISALLOW_COPY_AND_ASSIGN(Scope);
+  };
+
+  FilterProfiler(ThreadSystem* thread_system, Timer* timer);
+  ~FilterProfiler();
+
+  // Declares the histograms for the wall and CPU time of resource rewrites
+  // by the filter with the given id.
+  static void InitRewriteStats(StringPiece filter_id, Statistics* statistics);
+
+  // Names of the histograms declared by InitRewriteStats.
+  static GoogleString RewriteWallUsHistogram(StringPiece filter_id);
+  static GoogleString RewriteCpuUsHistogram(StringPiece filter_id);
+
+  // Makes Record add resource rewrites to the histograms in statistics, for
+  // the filters that have them.  Must be called before anything is recorded.
+  void set_statistics(Statistics* statistics) { statistics_ = statistics; }
+
+  // Accounts for one run of the filter, which took wall_us and cpu_us
+  // microseconds and was given bytes of input.  cpu_us may be
+  // kCpuUnavailable, in which case only the wall time is recorded.
+  void Record(Kind kind, StringPiece filter_id, int64 wall_us, int64 cpu_us,
+              int64 bytes);
+
+  // Returns a copy of the profiles of all filters that have run, with the
+  // highest total CPU time first.
+  void Snapshot(ProfileVector* profiles);
+
+  // The JSON written looks like:
+  //   {"filters": [{"kind": "rewrite", "id": "ic", "bytes": 3000,
+  //                 "wall_us": {"count": 2, "total": 700, "max": 600,
+  //                             "median": 127, "p99": 600},
+  //                 "cpu_us": {...}}, ...]}
+  // with the filters in Snapshot order, and "cpu_us": null if no CPU time
+  // was measured.
+  void DumpJson(Writer* writer, MessageHandler* handler);
+
+  void Clear();
+
+  Timer* timer() const { return timer_; }
+
+  // Returns the CPU time consumed by the calling thread so far, or
+  // kCpuUnavailable where the platform can't report per-thread CPU time.
+  static int64 ThreadCpuUs();
+
+ private:
+  // A profile, and the statistics histograms it's also recorded in, which
+  // are NULL if there are none for the filter.
+  struct Entry {
+    Entry(Kind kind, StringPiece filter_id);
+
+    Profile profile;
+    Histogram* wall_us_histogram;
+    Histogram* cpu_us_histogram;
+  };
+
+  // Keyed by StringPieces pointing into the Profiles' ids, so lookups
+  // need not copy the filter id.
+  typedef std::map<StringPiece, Entry*> ProfileMap;
+
+  static void AddSample(int64 value, Measure* measure);
+
+  // Returns the named histogram of statistics_, with its range set, or NULL
+  // if there's no such histogram.
+  Histogram* FindHistogram(const GoogleString& name);
+
+  Timer* timer_;
+  Statistics* statistics_;
+  scoped_ptr<AbstractMutex> mutex_;
+  ProfileMap profiles_[kNumKinds];  // Guarded by mutex_.
+
+  DISALLOW_COPY_AND_ASSIGN(FilterProfiler);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_BASE_FILTER_PROFILER_H_
@@ -0,0 +1,243 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pagespeed/kernel/base/filter_profiler.h"
+
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/mock_timer.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/null_thread_system.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_writer.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+
+namespace net_instaweb {
+
+namespace {
+
+class FilterProfilerTest : public testing::Test {
+ protected:
+  FilterProfilerTest()
+      : timer_(new NullMutex, 0),
+        profiler_(&thread_system_, &timer_) {
+  }
+
+  NullThreadSystem thread_system_;
+  MockTimer timer_;
+  FilterProfiler profiler_;
+};
+
+TEST_F(FilterProfilerTest, RecordsPerFilterCostliestFirst) {
+  profiler_.Record(FilterProfiler::kRewrite, "a", 100, 50, 1000);
+  profiler_.Record(FilterProfiler::kRewrite, "b", 10, 1000, 5);
+  profiler_.Record(FilterProfiler::kRewrite, "a", 600, 300, 2000);
+
+  FilterProfiler::ProfileVector profiles;
+  profiler_.Snapshot(&profiles);
+  ASSERT_EQ(2, profiles.size());
+
+  EXPECT_EQ("b", profiles[0].id);
+  EXPECT_EQ(5, profiles[0].bytes);
+  EXPECT_EQ(1, profiles[0].cpu_us.count);
+  EXPECT_EQ(1000, profiles[0].cpu_us.total);
+
+  EXPECT_EQ("a", profiles[1].id);
+  EXPECT_EQ(3000, profiles[1].bytes);
+  EXPECT_EQ(2, profiles[1].wall_us.count);
+  EXPECT_EQ(700, profiles[1].wall_us.total);
+  EXPECT_EQ(600, profiles[1].wall_us.max);
+  EXPECT_EQ(2, profiles[1].cpu_us.count);
+  EXPECT_EQ(350, profiles[1].cpu_us.total);
+  EXPECT_EQ(300, profiles[1].cpu_us.max);
+}
+
+TEST_F(FilterProfilerTest, Percentiles) {
+  FilterProfiler::Measure measure;
+  EXPECT_EQ(0, measure.Percentile(50));
+
+  profiler_.Record(FilterProfiler::kRewrite, "a", 0, 0, 0);
+  profiler_.Record(FilterProfiler::kRewrite, "a", 100, 0, 0);
+  profiler_.Record(FilterProfiler::kRewrite, "a", 100, 0, 0);
+  profiler_.Record(FilterProfiler::kRewrite, "a", 600, 0, 0);
+  FilterProfiler::ProfileVector profiles;
+  profiler_.Snapshot(&profiles);
+  ASSERT_EQ(1, profiles.size());
+  const FilterProfiler::Measure& wall = profiles[0].wall_us;
+  EXPECT_EQ(0, wall.Percentile(0));
+  EXPECT_EQ(0, wall.Percentile(25));
+  EXPECT_EQ(127, wall.Percentile(50));  // 100 is in [64, 128).
+  EXPECT_EQ(127, wall.Percentile(75));
+  EXPECT_EQ(600, wall.Percentile(99));  // Capped by the max.
+  EXPECT_EQ(0, profiles[0].cpu_us.Percentile(99));
+}
+
+TEST_F(FilterProfilerTest, ExtremeSamples) {
+  const int64 kHuge = static_cast<int64>(1) << 50;
+  profiler_.Record(FilterProfiler::kRewrite, "a", kHuge, -5, 0);
+  FilterProfiler::ProfileVector profiles;
+  profiler_.Snapshot(&profiles);
+  ASSERT_EQ(1, profiles.size());
+  EXPECT_EQ(1, profiles[0].wall_us.buckets[FilterProfiler::kNumBuckets - 1]);
+  EXPECT_EQ(kHuge, profiles[0].wall_us.Percentile(50));
+  EXPECT_EQ(1, profiles[0].cpu_us.buckets[0]);  // Negative skew reads as 0.
+  EXPECT_EQ(0, profiles[0].cpu_us.total);
+}
+
+TEST_F(FilterProfilerTest, Scope) {
+  {
+    FilterProfiler::Scope scope(&profiler_, FilterProfiler::kHtmlFilter, "a",
+                                42);
+    timer_.AdvanceUs(250);
+  }
+  {
+    FilterProfiler::Scope scope(NULL, FilterProfiler::kHtmlFilter, "b", 42);
+  }
+  FilterProfiler::ProfileVector profiles;
+  profiler_.Snapshot(&profiles);
+  ASSERT_EQ(1, profiles.size());
+  EXPECT_EQ(FilterProfiler::kHtmlFilter, profiles[0].kind);
+  EXPECT_EQ("a", profiles[0].id);
+  EXPECT_EQ(42, profiles[0].bytes);
+  EXPECT_EQ(250, profiles[0].wall_us.total);
+  if (FilterProfiler::ThreadCpuUs() == FilterProfiler::kCpuUnavailable) {
+    EXPECT_EQ(0, profiles[0].cpu_us.count);
+  } else {
+    EXPECT_EQ(1, profiles[0].cpu_us.count);
+    EXPECT_LE(0, profiles[0].cpu_us.total);
+  }
+}
+
+TEST_F(FilterProfilerTest, ThreadCpuUsAdvances) {
+  int64 start_us = FilterProfiler::ThreadCpuUs();
+  if (start_us == FilterProfiler::kCpuUnavailable) {
+    return;  // Nothing to measure on this platform.
+  }
+  int64 now_us = start_us;
+  volatile int spin = 0;
+  while (now_us == start_us) {
+    ++spin;
+    now_us = FilterProfiler::ThreadCpuUs();
+  }
+  EXPECT_LT(start_us, now_us);
+}
+
+TEST_F(FilterProfilerTest, CpuUnavailable) {
+  profiler_.Record(FilterProfiler::kRewrite, "a", 100,
+                   FilterProfiler::kCpuUnavailable, 10);
+  FilterProfiler::ProfileVector profiles;
+  profiler_.Snapshot(&profiles);
+  ASSERT_EQ(1, profiles.size());
+  EXPECT_EQ(1, profiles[0].wall_us.count);
+  EXPECT_EQ(100, profiles[0].wall_us.total);
+  EXPECT_EQ(0, profiles[0].cpu_us.count);
+
+  GoogleString json;
+  StringWriter writer(&json);
+  NullMessageHandler handler;
+  profiler_.DumpJson(&writer, &handler);
+  EXPECT_EQ(
+      "{\"filters\": ["
+      "{\"kind\": \"rewrite\", \"id\": \"a\", \"bytes\": 10, "
+      "\"wall_us\": {\"count\": 1, \"total\": 100, \"max\": 100, "
+      "\"median\": 100, \"p99\": 100}, "
+      "\"cpu_us\": null}]}",
+      json);
+}
+
+TEST_F(FilterProfilerTest, KindsAreSeparate) {
+  // An HTML filter may have the same name as a rewriter's id.
+  profiler_.Record(FilterProfiler::kHtmlFilter, "ic", 10, 10, 100);
+  profiler_.Record(FilterProfiler::kRewrite, "ic", 20, 20, 5);
+  FilterProfiler::ProfileVector profiles;
+  profiler_.Snapshot(&profiles);
+  ASSERT_EQ(2, profiles.size());
+  EXPECT_EQ(FilterProfiler::kRewrite, profiles[0].kind);
+  EXPECT_EQ("ic", profiles[0].id);
+  EXPECT_EQ(5, profiles[0].bytes);
+  EXPECT_EQ(FilterProfiler::kHtmlFilter, profiles[1].kind);
+  EXPECT_EQ("ic", profiles[1].id);
+  EXPECT_EQ(100, profiles[1].bytes);
+}
+
+TEST_F(FilterProfilerTest, DumpJson) {
+  GoogleString json;
+  StringWriter writer(&json);
+  NullMessageHandler handler;
+  profiler_.DumpJson(&writer, &handler);
+  EXPECT_EQ("{\"filters\": []}", json);
+
+  profiler_.Record(FilterProfiler::kRewrite, "ic", 100, 10, 1000);
+  profiler_.Record(FilterProfiler::kRewrite, "ic", 600, 20, 2000);
+  profiler_.Record(FilterProfiler::kRewrite, "say \"hi\"", 1, 1, 1);
+  json.clear();
+  profiler_.DumpJson(&writer, &handler);
+  EXPECT_EQ(
+      "{\"filters\": ["
+      "{\"kind\": \"rewrite\", \"id\": \"ic\", \"bytes\": 3000, "
+      "\"wall_us\": {\"count\": 2, \"total\": 700, \"max\": 600, "
+      "\"median\": 127, \"p99\": 600}, "
+      "\"cpu_us\": {\"count\": 2, \"total\": 30, \"max\": 20, "
+      "\"median\": 15, \"p99\": 20}}, "
+      "{\"kind\": \"rewrite\", \"id\": \"say \\u0022hi\\u0022\", "
+      "\"bytes\": 1, "
+      "\"wall_us\": {\"count\": 1, \"total\": 1, \"max\": 1, "
+      "\"median\": 1, \"p99\": 1}, "
+      "\"cpu_us\": {\"count\": 1, \"total\": 1, \"max\": 1, "
+      "\"median\": 1, \"p99\": 1}}]}",
+      json);
+}
+
+TEST_F(FilterProfilerTest, Clear) {
+  profiler_.Record(FilterProfiler::kRewrite, "a", 1, 1, 1);
+  profiler_.Clear();
+  FilterProfiler::ProfileVector profiles;
+  profiler_.Snapshot(&profiles);
+  EXPECT_TRUE(profiles.empty());
+  profiler_.Record(FilterProfiler::kRewrite, "a", 1, 1, 1);
+  profiler_.Snapshot(&profiles);
+  ASSERT_EQ(1, profiles.size());
+  EXPECT_EQ(1, profiles[0].wall_us.count);
+}
+
+TEST_F(FilterProfilerTest, RewriteHistograms) {
+  SimpleStats stats(&thread_system_);
+  FilterProfiler::InitRewriteStats("ic", &stats);
+  profiler_.set_statistics(&stats);
+  Histogram* wall_us =
+      stats.GetHistogram(FilterProfiler::RewriteWallUsHistogram("ic"));
+  Histogram* cpu_us =
+      stats.GetHistogram(FilterProfiler::RewriteCpuUsHistogram("ic"));
+
+  profiler_.Record(FilterProfiler::kRewrite, "ic", 300, 200, 10);
+  profiler_.Record(FilterProfiler::kRewrite, "ic", 100,
+                   FilterProfiler::kCpuUnavailable, 10);
+  EXPECT_EQ(2, wall_us->Count());
+  EXPECT_EQ(300, wall_us->Maximum());
+  EXPECT_EQ(1, cpu_us->Count());
+  EXPECT_EQ(200, cpu_us->Maximum());
+
+  // HTML filters and undeclared rewrites are only profiled in-process.
+  profiler_.Record(FilterProfiler::kHtmlFilter, "ic", 1, 1, 1);
+  profiler_.Record(FilterProfiler::kRewrite, "jm", 1, 1, 1);
+  EXPECT_EQ(2, wall_us->Count());
+  FilterProfiler::ProfileVector profiles;
+  profiler_.Snapshot(&profiles);
+  EXPECT_EQ(3, profiles.size());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
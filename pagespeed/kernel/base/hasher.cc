@@ -45,6 +45,13 @@ GoogleString Hasher::Hash(const StringPiece& content) const {
   return out;
 }
 
+void Hasher::RawHashInto(const StringPiece& content, char* out,
+                         int out_size) const {
+  GoogleString raw_hash = RawHash(content);
+  CHECK_LE(out_size, static_cast<int>(raw_hash.size()));
+  raw_hash.copy(out, out_size);
+}
+
 int Hasher::HashSizeInChars() const {
   // For char hashes, we return the hash after Base64 encoding, which expands by
   // 4/3. We round down, this should not matter unless someone really wants that
@@ -56,6 +56,13 @@ class Hasher {
   // This operation is thread-safe.
   virtual GoogleString RawHash(const StringPiece& content) const = 0;
 
+  // Writes the first out_size bytes of RawHash(content) to out, which
+  // out_size must not be more than RawHashSizeInBytes().  The default goes
+  // through RawHash; subclasses that can produce the hash in place override
+  // this so that callers needing only a few bytes don't allocate.
+  virtual void RawHashInto(const StringPiece& content, char* out,
+                           int out_size) const;
+
   // The number of bytes RawHash will produce.
   virtual int RawHashSizeInBytes() const = 0;
 
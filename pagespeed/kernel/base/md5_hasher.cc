@@ -17,6 +17,9 @@
 
 #include "pagespeed/kernel/base/md5_hasher.h"
 
+#include <cstring>
+
+#include "base/logging.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "base/md5.h"
@@ -48,6 +51,14 @@ GoogleString MD5Hasher::RawHash(const StringPiece& content) const {
   return raw_hash;
 }
 
+void MD5Hasher::RawHashInto(const StringPiece& content, char* out,
+                            int out_size) const {
+  CHECK_LE(out_size, kMD5NumBytes);
+  MD5Digest digest;
+  MD5Sum(content.data(), content.size(), &digest);
+  std::memcpy(out, digest.a, out_size);
+}
+
 int MD5Hasher::RawHashSizeInBytes() const {
   return kMD5NumBytes;
 }
@@ -34,6 +34,8 @@ class MD5Hasher : public Hasher {
   virtual ~MD5Hasher();
 
   virtual GoogleString RawHash(const StringPiece& content) const;
+  virtual void RawHashInto(const StringPiece& content, char* out,
+                           int out_size) const;
   virtual int RawHashSizeInBytes() const;
 
  private:
@@ -48,6 +48,16 @@ TEST_F(MD5HasherTest, HashesDiffer) {
             hasher.Hash(GoogleString(5001, 'z')));
 }
 
+TEST_F(MD5HasherTest, RawHashIntoMatchesRawHash) {
+  MD5Hasher hasher;
+  GoogleString raw_hash = hasher.RawHash("foobar");
+  char buffer[16];
+  for (int size = 0; size <= hasher.RawHashSizeInBytes(); ++size) {
+    hasher.RawHashInto("foobar", buffer, size);
+    EXPECT_EQ(raw_hash.substr(0, size), GoogleString(buffer, size));
+  }
+}
+
 }  // namespace
 
 }  // namespace net_instaweb
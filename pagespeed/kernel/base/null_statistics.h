@@ -37,6 +37,7 @@ class NullStatisticsVariable {
   void Set(int64 value) { }
   int64 Get() const { return 0; }
   int64 AddHelper(int delta) const { return 0; }
+  void IncBy(int64 delta) const { }
   StringPiece GetName() const { return StringPiece(NULL); }
 
  private:
@@ -0,0 +1,322 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pagespeed/kernel/base/request_timeline.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/cache_interface.h"
+#include "pagespeed/kernel/base/escaping.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/string_writer.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/base/writer.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const char kSharedCacheKeyPrefix[] = "pagespeed_request_timeline/";
+
+GoogleString JsonString(StringPiece str) {
+  GoogleString escaped;
+  EscapeToJsonStringLiteral(str, true /* add_quotes */, &escaped);
+  return escaped;
+}
+
+bool Slower(const RequestTimelinePtr& a, const RequestTimelinePtr& b) {
+  return a->DurationUs() > b->DurationUs();
+}
+
+}  // namespace
+
+const int RequestTimeline::kMaxEvents;
+
+RequestTimeline::Span::Span(RequestTimeline* timeline, StringPiece category,
+                            StringPiece name)
+    : timeline_(timeline),
+      category_(category),
+      name_(name),
+      start_us_(0) {
+  if (timeline_ != NULL) {
+    start_us_ = timeline_->timer()->NowUs();
+  }
+}
+
+RequestTimeline::Span::~Span() {
+  if (timeline_ != NULL) {
+    timeline_->AddSpan(category_, name_, detail_, start_us_,
+                       timeline_->timer()->NowUs());
+  }
+}
+
+RequestTimeline::RequestTimeline(StringPiece label, int64 id,
+                                 ThreadSystem* thread_system, Timer* timer)
+    : label_(label.data(), label.size()),
+      id_(id),
+      thread_system_(thread_system),
+      timer_(timer),
+      start_us_(timer->NowUs()),
+      mutex_(thread_system->NewMutex()),
+      store_(NULL),
+      end_us_(-1),
+      num_dropped_events_(0) {
+}
+
+RequestTimeline::~RequestTimeline() {
+  STLDeleteElements(&threads_);
+}
+
+void RequestTimeline::AddSpan(StringPiece category, StringPiece name,
+                              StringPiece detail, int64 start_us,
+                              int64 end_us) {
+  AddEvent('X', category, name, detail, start_us, end_us);
+}
+
+void RequestTimeline::AddInstant(StringPiece category, StringPiece name,
+                                 StringPiece detail) {
+  int64 now_us = timer_->NowUs();
+  AddEvent('i', category, name, detail, now_us, now_us);
+}
+
+void RequestTimeline::AddEvent(char phase, StringPiece category,
+                               StringPiece name, StringPiece detail,
+                               int64 start_us, int64 end_us) {
+  ScopedMutex lock(mutex_.get());
+  if (static_cast<int>(events_.size()) >= kMaxEvents) {
+    ++num_dropped_events_;
+    return;
+  }
+  events_.push_back(Event());
+  Event& event = events_.back();
+  category.CopyToString(&event.category);
+  name.CopyToString(&event.name);
+  detail.CopyToString(&event.detail);
+  event.phase = phase;
+  event.start_us = start_us;
+  event.duration_us = std::max(static_cast<int64>(0), end_us - start_us);
+  event.thread_index = CurrentThreadIndex();
+}
+
+int RequestTimeline::CurrentThreadIndex() {
+  // Requests touch only a handful of threads, so a linear scan is fine.
+  for (int i = 0, n = threads_.size(); i < n; ++i) {
+    if (threads_[i]->IsCurrentThread()) {
+      return i;
+    }
+  }
+  threads_.push_back(thread_system_->GetThreadId());
+  return threads_.size() - 1;
+}
+
+void RequestTimeline::Finish() {
+  ScopedMutex lock(mutex_.get());
+  if (end_us_ < 0) {
+    end_us_ = timer_->NowUs();
+    // The store detaches its timelines before it goes away, which it can't
+    // do while we hold mutex_, so store_ stays valid until we're done.
+    if (store_ != NULL) {
+      store_->TimelineFinished(*this);
+    }
+  }
+}
+
+void RequestTimeline::Detach() {
+  ScopedMutex lock(mutex_.get());
+  store_ = NULL;
+}
+
+bool RequestTimeline::finished() const {
+  ScopedMutex lock(mutex_.get());
+  return end_us_ >= 0;
+}
+
+int64 RequestTimeline::DurationUs() const {
+  ScopedMutex lock(mutex_.get());
+  int64 end_us = (end_us_ >= 0) ? end_us_ : timer_->NowUs();
+  return end_us - start_us_;
+}
+
+int64 RequestTimeline::FinishedDurationUs() const {
+  ScopedMutex lock(mutex_.get());
+  return (end_us_ >= 0) ? (end_us_ - start_us_) : -1;
+}
+
+int RequestTimeline::num_events() const {
+  ScopedMutex lock(mutex_.get());
+  return events_.size();
+}
+
+int RequestTimeline::num_dropped_events() const {
+  ScopedMutex lock(mutex_.get());
+  return num_dropped_events_;
+}
+
+void RequestTimeline::DumpChromeTraceJson(Writer* writer,
+                                          MessageHandler* handler) const {
+  ScopedMutex lock(mutex_.get());
+  DumpChromeTraceJsonLockHeld(writer, handler);
+}
+
+void RequestTimeline::DumpChromeTraceJsonLockHeld(
+    Writer* writer, MessageHandler* handler) const {
+  // The process_name metadata event labels the whole trace with the request.
+  writer->Write(StrCat(
+      "{\"traceEvents\": [{\"name\": \"process_name\", \"ph\": \"M\", "
+      "\"pid\": 1, \"tid\": 0, \"args\": {\"name\": ", JsonString(label_),
+      "}}"), handler);
+  for (int i = 0, n = events_.size(); i < n; ++i) {
+    const Event& event = events_[i];
+    GoogleString json = StrCat(
+        ",\n{\"name\": ", JsonString(event.name),
+        ", \"cat\": ", JsonString(event.category),
+        ", \"ph\": \"", StringPiece(&event.phase, 1),
+        "\", \"ts\": ", Integer64ToString(event.start_us - start_us_));
+    if (event.phase == 'X') {
+      StrAppend(&json, ", \"dur\": ", Integer64ToString(event.duration_us));
+    } else {
+      StrAppend(&json, ", \"s\": \"t\"");  // Instant scoped to the thread.
+    }
+    StrAppend(&json, ", \"pid\": 1, \"tid\": ",
+              IntegerToString(event.thread_index));
+    if (!event.detail.empty()) {
+      StrAppend(&json, ", \"args\": {\"detail\": ", JsonString(event.detail),
+                "}");
+    }
+    json.push_back('}');
+    writer->Write(json, handler);
+  }
+  writer->Write(StrCat(
+      "],\n\"otherData\": {\"label\": ", JsonString(label_),
+      ", \"duration_us\": ", Integer64ToString(
+          ((end_us_ >= 0) ? end_us_ : timer_->NowUs()) - start_us_),
+      ", \"dropped_events\": ", IntegerToString(num_dropped_events_), "}}"),
+                handler);
+}
+
+RequestTimelineStore::RequestTimelineStore(ThreadSystem* thread_system,
+                                           Timer* timer, int sample_rate,
+                                           int64 slow_threshold_us,
+                                           int max_timelines)
+    : thread_system_(thread_system),
+      timer_(timer),
+      sample_rate_(sample_rate),
+      slow_threshold_us_(slow_threshold_us),
+      max_timelines_(max_timelines),
+      shared_cache_(NULL),
+      mutex_(thread_system->NewMutex()),
+      num_requests_(0),
+      next_sequence_(1) {
+  DCHECK_LT(0, sample_rate_);
+  DCHECK_LT(0, max_timelines_);
+}
+
+RequestTimelineStore::~RequestTimelineStore() {
+  ScopedMutex lock(mutex_.get());
+  for (TimelineDeque::iterator p = timelines_.begin(), e = timelines_.end();
+       p != e; ++p) {
+    (*p)->Detach();
+  }
+}
+
+RequestTimelinePtr RequestTimelineStore::MaybeStartTimeline(
+    StringPiece label) {
+  RequestTimelinePtr timeline;
+  ScopedMutex lock(mutex_.get());
+  if ((num_requests_++ % sample_rate_) == 0) {
+    MakeRoom();
+    // The process id is read for each timeline rather than once, since the
+    // store may be made before the server forks its children.
+    int64 id = (CurrentProcessId() << 32) | (next_sequence_++ & 0xffffffffLL);
+    timeline.reset(new RequestTimeline(label, id, thread_system_, timer_));
+    timeline->store_ = this;  // Nobody else can see it yet.
+    timelines_.push_back(timeline);
+  }
+  return timeline;
+}
+
+void RequestTimelineStore::MakeRoom() {
+  while (static_cast<int>(timelines_.size()) >= max_timelines_) {
+    // Drop the oldest timeline that finished fast, which is usually at or
+    // near the front, or failing that the oldest of all.
+    TimelineDeque::iterator victim = timelines_.begin();
+    for (TimelineDeque::iterator p = timelines_.begin(), e = timelines_.end();
+         p != e; ++p) {
+      int64 duration_us = (*p)->FinishedDurationUs();
+      if ((duration_us >= 0) && (duration_us < slow_threshold_us_)) {
+        victim = p;
+        break;
+      }
+    }
+    (*victim)->Detach();
+    timelines_.erase(victim);
+  }
+}
+
+void RequestTimelineStore::TimelineFinished(const RequestTimeline& timeline) {
+  if ((shared_cache_ == NULL) ||
+      (timeline.end_us_ - timeline.start_us_ < slow_threshold_us_)) {
+    return;
+  }
+  GoogleString json;
+  StringWriter writer(&json);
+  NullMessageHandler handler;
+  timeline.DumpChromeTraceJsonLockHeld(&writer, &handler);
+  SharedString value(json);
+  shared_cache_->Put(SharedCacheKey(timeline.id()), &value);
+}
+
+void RequestTimelineStore::GetSlowTimelines(TimelineVector* timelines) {
+  timelines->clear();
+  {
+    ScopedMutex lock(mutex_.get());
+    for (TimelineDeque::iterator p = timelines_.begin(), e = timelines_.end();
+         p != e; ++p) {
+      if ((*p)->FinishedDurationUs() >= slow_threshold_us_) {
+        timelines->push_back(*p);
+      }
+    }
+  }
+  std::stable_sort(timelines->begin(), timelines->end(), Slower);
+}
+
+GoogleString RequestTimelineStore::SharedCacheKey(int64 timeline_id) {
+  return StrCat(kSharedCacheKeyPrefix, Integer64ToString(timeline_id));
+}
+
+int64 RequestTimelineStore::CurrentProcessId() {
+  return static_cast<int64>(getpid());
+}
+
+RequestTimelinePtr RequestTimelineStore::Find(int64 id) {
+  if (ProcessIdOf(id) != CurrentProcessId()) {
+    return RequestTimelinePtr();
+  }
+  ScopedMutex lock(mutex_.get());
+  for (TimelineDeque::iterator p = timelines_.begin(), e = timelines_.end();
+       p != e; ++p) {
+    if ((*p)->id() == id) {
+      return *p;
+    }
+  }
+  return RequestTimelinePtr();
+}
+
+}  // namespace net_instaweb
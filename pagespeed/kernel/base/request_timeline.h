@@ -0,0 +1,238 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_BASE_REQUEST_TIMELINE_H_
+#define PAGESPEED_KERNEL_BASE_REQUEST_TIMELINE_H_
+
+#include <deque>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/ref_counted_ptr.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+
+namespace net_instaweb {
+
+class AbstractMutex;
+class CacheInterface;
+class MessageHandler;
+class RequestTimelineStore;
+class Timer;
+class Writer;
+
+// Records a timeline of what happened while serving one request: spans for
+// cache lookups, fetches, lock waits and rewrites, and instants for things
+// like flushes.  The timeline can be written out in the Chrome trace-event
+// format, so it can be loaded into chrome://tracing, with one row per thread
+// that recorded events.
+//
+// Timelines are only made for a sample of requests (see
+// RequestTimelineStore), so code recording into them must check for NULL.
+// The number of events kept is capped, so a pathological request can't use
+// unbounded memory; events past the cap are counted but dropped.
+//
+// This class is thread-safe.
+class RequestTimeline : public RefCounted<RequestTimeline> {
+ public:
+  static const int kMaxEvents = 1000;
+
+  // Records a span from construction to destruction, if timeline is
+  // non-NULL.  category and name must outlive the Span.
+  class Span {
+   public:
+    Span(RequestTimeline* timeline, StringPiece category, StringPiece name);
+    ~Span();
+
+    void set_detail(StringPiece detail) { detail.CopyToString(&detail_); }
+
+   private:
+    RequestTimeline* timeline_;
+    StringPiece category_;
+    StringPiece name_;
+    GoogleString detail_;
+    int64 start_us_;
+
+    DISALLOW_COPY_AND_ASSIGN(Span);
+  };
+
+  // label describes the request, typically its URL, and id identifies the
+  // timeline in its RequestTimelineStore.
+  RequestTimeline(StringPiece label, int64 id, ThreadSystem* thread_system,
+                  Timer* timer);
+
+  // Records something that took from start_us to end_us, as measured by
+  // timer(), on the calling thread.  detail may be empty.
+  void AddSpan(StringPiece category, StringPiece name, StringPiece detail,
+               int64 start_us, int64 end_us);
+
+  // Records something that happened just now on the calling thread.
+  void AddInstant(StringPiece category, StringPiece name, StringPiece detail);
+
+  // Marks the request as done; DurationUs stops growing after the first call.
+  void Finish();
+  bool finished() const;
+
+  // Time from construction until Finish, or until now if it's not finished.
+  int64 DurationUs() const;
+
+  // Time from construction until Finish, or -1 if it's not finished.
+  int64 FinishedDurationUs() const;
+
+  int num_events() const;
+  int num_dropped_events() const;
+
+  // Writes {"traceEvents": [...]}, with timestamps relative to the start of
+  // the request.
+  void DumpChromeTraceJson(Writer* writer, MessageHandler* handler) const;
+
+  const GoogleString& label() const { return label_; }
+  int64 id() const { return id_; }
+  int64 start_us() const { return start_us_; }
+  Timer* timer() const { return timer_; }
+
+ private:
+  REFCOUNT_FRIEND_DECLARATION(RequestTimeline);
+  friend class RequestTimelineStore;
+
+  struct Event {
+    GoogleString category;
+    GoogleString name;
+    GoogleString detail;
+    char phase;  // 'X' for a span, 'i' for an instant.
+    int64 start_us;
+    int64 duration_us;
+    int thread_index;
+  };
+
+  ~RequestTimeline();
+
+  void AddEvent(char phase, StringPiece category, StringPiece name,
+                StringPiece detail, int64 start_us, int64 end_us);
+
+  void DumpChromeTraceJsonLockHeld(Writer* writer,
+                                   MessageHandler* handler) const;
+
+  // Called by the store when it lets go of this timeline, so that Finish
+  // doesn't report back to it.
+  void Detach();
+
+  // Returns a small number identifying the calling thread within this
+  // timeline.  Must be called with mutex_ held.
+  int CurrentThreadIndex();
+
+  const GoogleString label_;
+  const int64 id_;
+  ThreadSystem* thread_system_;
+  Timer* timer_;
+  const int64 start_us_;
+  scoped_ptr<AbstractMutex> mutex_;
+
+  // The following are guarded by mutex_.
+  RequestTimelineStore* store_;  // Told about Finish; NULL once detached.
+  int64 end_us_;  // -1 until Finish.
+  std::vector<Event> events_;
+  int num_dropped_events_;
+  std::vector<ThreadSystem::ThreadId*> threads_;  // Owned.
+
+  DISALLOW_COPY_AND_ASSIGN(RequestTimeline);
+};
+
+typedef RefCountedPtr<RequestTimeline> RequestTimelinePtr;
+
+// Decides which requests get a RequestTimeline, and keeps the recent ones
+// around so the slow ones can be looked at from the admin site.  Timelines of
+// requests that finished faster than the slow threshold are discarded first
+// when making room.
+//
+// Each server process has its own store.  Timeline ids carry the id of the
+// process that recorded them in their upper 32 bits, so they are unique
+// across processes, and a lookup that lands in the wrong process can tell
+// which one owns the timeline.  Given a shared cache, the store also writes
+// each slow timeline's trace there as it finishes, so that any process can
+// serve it.
+//
+// This class is thread-safe.
+class RequestTimelineStore {
+ public:
+  typedef std::vector<RequestTimelinePtr> TimelineVector;
+
+  // One in sample_rate requests is given a timeline; sample_rate must be
+  // positive.  Requests taking at least slow_threshold_us are reported by
+  // GetSlowTimelines, and at most max_timelines timelines are kept.
+  RequestTimelineStore(ThreadSystem* thread_system, Timer* timer,
+                       int sample_rate, int64 slow_threshold_us,
+                       int max_timelines);
+  ~RequestTimelineStore();
+
+  // Returns a new timeline if this request is sampled, and NULL otherwise.
+  RequestTimelinePtr MaybeStartTimeline(StringPiece label);
+
+  // Returns the finished timelines that were slow, slowest first.
+  void GetSlowTimelines(TimelineVector* timelines);
+
+  // Returns the timeline with the given id, or NULL if it was discarded or
+  // was recorded by another process.
+  RequestTimelinePtr Find(int64 id);
+
+  // Sets a cache, which should be one that every server process can read, to
+  // put the Chrome trace JSON of finished slow timelines in, under
+  // SharedCacheKey(id).  Must be called before any timelines are started;
+  // the cache must outlive the store.
+  void set_shared_cache(CacheInterface* cache) { shared_cache_ = cache; }
+  CacheInterface* shared_cache() const { return shared_cache_; }
+
+  static GoogleString SharedCacheKey(int64 timeline_id);
+
+  // The id of the process that recorded the timeline with the given id.
+  static int64 ProcessIdOf(int64 timeline_id) { return timeline_id >> 32; }
+
+  // The id of the calling process, as used in timeline ids.
+  static int64 CurrentProcessId();
+
+  int64 slow_threshold_us() const { return slow_threshold_us_; }
+
+ private:
+  friend class RequestTimeline;
+  typedef std::deque<RequestTimelinePtr> TimelineDeque;
+
+  // Drops timelines until there are fewer than max_timelines_, preferring
+  // to drop the oldest finished, fast ones.  Must be called with mutex_
+  // held.
+  void MakeRoom();
+
+  // Called by timeline as it finishes, with its mutex held.
+  void TimelineFinished(const RequestTimeline& timeline);
+
+  ThreadSystem* thread_system_;
+  Timer* timer_;
+  const int sample_rate_;
+  const int64 slow_threshold_us_;
+  const int max_timelines_;
+  CacheInterface* shared_cache_;
+  scoped_ptr<AbstractMutex> mutex_;
+
+  // The following are guarded by mutex_.
+  int64 num_requests_;
+  int64 next_sequence_;  // Per process; combined with its id to make ids.
+  TimelineDeque timelines_;  // Oldest first.
+
+  DISALLOW_COPY_AND_ASSIGN(RequestTimelineStore);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_BASE_REQUEST_TIMELINE_H_
@@ -0,0 +1,230 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pagespeed/kernel/base/request_timeline.h"
+
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/mock_timer.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/null_thread_system.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_writer.h"
+#include "pagespeed/kernel/cache/lru_cache.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const int64 kSlowUs = 1000;
+
+class RequestTimelineTest : public testing::Test {
+ protected:
+  RequestTimelineTest()
+      : timer_(new NullMutex, 1000000),
+        store_(&thread_system_, &timer_, 2, kSlowUs, 3) {
+  }
+
+  GoogleString Dump(RequestTimeline* timeline) {
+    GoogleString json;
+    StringWriter writer(&json);
+    timeline->DumpChromeTraceJson(&writer, &handler_);
+    return json;
+  }
+
+  // Starts sampled timelines, skipping over the requests that aren't.
+  RequestTimelinePtr StartSampled(StringPiece label) {
+    RequestTimelinePtr timeline = store_.MaybeStartTimeline(label);
+    if (timeline.get() == NULL) {
+      timeline = store_.MaybeStartTimeline(label);
+    }
+    return timeline;
+  }
+
+  NullThreadSystem thread_system_;
+  MockTimer timer_;
+  NullMessageHandler handler_;
+  RequestTimelineStore store_;
+};
+
+TEST_F(RequestTimelineTest, SpansAndInstants) {
+  RequestTimelinePtr timeline(
+      new RequestTimeline("http://a.com/", 7, &thread_system_, &timer_));
+  timer_.AdvanceUs(10);
+  {
+    RequestTimeline::Span span(timeline.get(), "cache", "http_cache_l1");
+    span.set_detail("miss");
+    timer_.AdvanceUs(5);
+  }
+  {
+    RequestTimeline::Span span(NULL, "cache", "ignored");
+  }
+  timeline->AddInstant("html", "flush", "");
+  timer_.AdvanceUs(5);
+  timeline->Finish();
+  timer_.AdvanceUs(100);
+  timeline->Finish();
+
+  EXPECT_TRUE(timeline->finished());
+  EXPECT_EQ(20, timeline->DurationUs());
+  EXPECT_EQ(2, timeline->num_events());
+  EXPECT_EQ(
+      "{\"traceEvents\": [{\"name\": \"process_name\", \"ph\": \"M\", "
+      "\"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"http://a.com/\"}},\n"
+      "{\"name\": \"http_cache_l1\", \"cat\": \"cache\", \"ph\": \"X\", "
+      "\"ts\": 10, \"dur\": 5, \"pid\": 1, \"tid\": 0, "
+      "\"args\": {\"detail\": \"miss\"}},\n"
+      "{\"name\": \"flush\", \"cat\": \"html\", \"ph\": \"i\", "
+      "\"ts\": 15, \"s\": \"t\", \"pid\": 1, \"tid\": 0}],\n"
+      "\"otherData\": {\"label\": \"http://a.com/\", \"duration_us\": 20, "
+      "\"dropped_events\": 0}}",
+      Dump(timeline.get()));
+}
+
+TEST_F(RequestTimelineTest, EscapesAndCapsEvents) {
+  RequestTimelinePtr timeline(
+      new RequestTimeline("say \"hi\"\n</script>", 1, &thread_system_,
+                          &timer_));
+  EXPECT_FALSE(timeline->finished());
+  timer_.AdvanceUs(3);
+  EXPECT_EQ(3, timeline->DurationUs());
+  for (int i = 0; i < RequestTimeline::kMaxEvents + 2; ++i) {
+    timeline->AddInstant("c", "n", "");
+  }
+  EXPECT_EQ(RequestTimeline::kMaxEvents, timeline->num_events());
+  EXPECT_EQ(2, timeline->num_dropped_events());
+  GoogleString json = Dump(timeline.get());
+  EXPECT_NE(GoogleString::npos,
+            json.find("\"name\": \"say \\u0022hi\\u0022\\u000a"
+                      "\\u003c/script\\u003e\""));
+  EXPECT_NE(GoogleString::npos, json.find("\"dropped_events\": 2}}"));
+}
+
+TEST_F(RequestTimelineTest, Sampling) {
+  RequestTimelinePtr first = store_.MaybeStartTimeline("a");
+  RequestTimelinePtr second = store_.MaybeStartTimeline("b");
+  RequestTimelinePtr third = store_.MaybeStartTimeline("c");
+  ASSERT_TRUE(first.get() != NULL);
+  EXPECT_TRUE(second.get() == NULL);
+  ASSERT_TRUE(third.get() != NULL);
+  EXPECT_EQ("a", first->label());
+  EXPECT_NE(first->id(), third->id());
+  EXPECT_EQ(first.get(), store_.Find(first->id()).get());
+  EXPECT_TRUE(store_.Find(12345).get() == NULL);
+}
+
+TEST_F(RequestTimelineTest, IdsNameTheRecordingProcess) {
+  RequestTimelinePtr timeline = StartSampled("a");
+  ASSERT_TRUE(timeline.get() != NULL);
+  int64 pid = RequestTimelineStore::CurrentProcessId();
+  EXPECT_EQ(pid, RequestTimelineStore::ProcessIdOf(timeline->id()));
+
+  // The same sequence number from another process isn't ours to find.
+  int64 sequence = timeline->id() & 0xffffffffLL;
+  int64 other_id = ((pid + 1) << 32) | sequence;
+  EXPECT_TRUE(store_.Find(other_id).get() == NULL);
+  EXPECT_EQ(timeline.get(), store_.Find(timeline->id()).get());
+}
+
+TEST_F(RequestTimelineTest, ReportsSlowestFirst) {
+  RequestTimelinePtr fast = StartSampled("fast");
+  RequestTimelinePtr slow = StartSampled("slow");
+  RequestTimelinePtr slower = StartSampled("slower");
+  fast->Finish();
+  timer_.AdvanceUs(kSlowUs);
+  slow->Finish();
+  timer_.AdvanceUs(kSlowUs);
+  slower->Finish();
+
+  RequestTimelineStore::TimelineVector timelines;
+  store_.GetSlowTimelines(&timelines);
+  ASSERT_EQ(2, timelines.size());
+  EXPECT_EQ("slower", timelines[0]->label());
+  EXPECT_EQ("slow", timelines[1]->label());
+}
+
+TEST_F(RequestTimelineTest, DropsFastTimelinesFirst) {
+  RequestTimelinePtr slow = StartSampled("slow");
+  RequestTimelinePtr fast = StartSampled("fast");
+  RequestTimelinePtr running = StartSampled("running");
+  fast->Finish();
+  timer_.AdvanceUs(kSlowUs);
+  slow->Finish();
+
+  // The store is full, so starting another timeline drops the fast one, even
+  // though the slow one is older.
+  RequestTimelinePtr next = StartSampled("next");
+  EXPECT_TRUE(store_.Find(fast->id()).get() == NULL);
+  EXPECT_TRUE(store_.Find(slow->id()).get() != NULL);
+  EXPECT_TRUE(store_.Find(running->id()).get() != NULL);
+
+  // With nothing fast left to drop, the oldest goes.
+  RequestTimelinePtr last = StartSampled("last");
+  EXPECT_TRUE(store_.Find(slow->id()).get() == NULL);
+  EXPECT_TRUE(store_.Find(running->id()).get() != NULL);
+  EXPECT_TRUE(store_.Find(next->id()).get() != NULL);
+  EXPECT_TRUE(store_.Find(last->id()).get() != NULL);
+}
+
+TEST_F(RequestTimelineTest, DropsOneFastTimelineAtATime) {
+  RequestTimelinePtr first = StartSampled("first");
+  RequestTimelinePtr second = StartSampled("second");
+  RequestTimelinePtr third = StartSampled("third");
+  first->Finish();
+  second->Finish();
+  third->Finish();
+
+  // Only the oldest fast timeline makes way; the others stay findable.
+  RequestTimelinePtr next = StartSampled("next");
+  EXPECT_TRUE(store_.Find(first->id()).get() == NULL);
+  EXPECT_TRUE(store_.Find(second->id()).get() != NULL);
+  EXPECT_TRUE(store_.Find(third->id()).get() != NULL);
+  EXPECT_TRUE(store_.Find(next->id()).get() != NULL);
+}
+
+TEST_F(RequestTimelineTest, SharesSlowTimelines) {
+  LRUCache cache(100000);
+  store_.set_shared_cache(&cache);
+  RequestTimelinePtr fast = StartSampled("fast");
+  RequestTimelinePtr slow = StartSampled("slow");
+  slow->AddInstant("c", "n", "");
+  fast->Finish();
+  timer_.AdvanceUs(kSlowUs);
+  slow->Finish();
+
+  EXPECT_EQ(static_cast<size_t>(1), cache.num_elements());
+  CacheInterface::SynchronousCallback callback;
+  cache.Get(RequestTimelineStore::SharedCacheKey(slow->id()), &callback);
+  ASSERT_TRUE(callback.called());
+  ASSERT_EQ(CacheInterface::kAvailable, callback.state());
+  EXPECT_EQ(Dump(slow.get()), callback.value()->Value());
+}
+
+TEST_F(RequestTimelineTest, OutlivesItsStore) {
+  LRUCache cache(100000);
+  RequestTimelinePtr timeline;
+  {
+    RequestTimelineStore store(&thread_system_, &timer_, 1, 0, 3);
+    store.set_shared_cache(&cache);
+    timeline = store.MaybeStartTimeline("a");
+  }
+  // The store is gone, so there's nobody to share the timeline with.
+  timeline->Finish();
+  EXPECT_TRUE(timeline->finished());
+  EXPECT_EQ(static_cast<size_t>(0), cache.num_elements());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
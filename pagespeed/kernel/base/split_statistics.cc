@@ -76,9 +76,9 @@ StringPiece SplitVariable::GetName() const {
   return rw_->GetName();
 }
 
-int64 SplitVariable::AddHelper(int delta) {
+void SplitVariable::AddHelper(int delta) {
   w_->Add(delta);
-  return rw_->Add(delta);
+  rw_->Add(delta);
 }
 
 SplitHistogram::SplitHistogram(
@@ -69,7 +69,7 @@ class SplitVariable : public Variable {
   virtual ~SplitVariable();
   virtual int64 Get() const;
   virtual StringPiece GetName() const;
-  virtual int64 AddHelper(int delta);
+  virtual void AddHelper(int delta);
   virtual void Clear();
 
  private:
@@ -0,0 +1,132 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_BASE_STAT_STRIPES_H_
+#define PAGESPEED_KERNEL_BASE_STAT_STRIPES_H_
+
+#include <sched.h>
+#include <unistd.h>
+
+#include <cstddef>
+
+#include "pagespeed/kernel/base/basictypes.h"
+
+namespace net_instaweb {
+
+// Helpers for statistics whose values are spread over several cache-line
+// sized stripes, so that threads updating a statistic at the same time
+// rarely touch the same line and never have to take a lock.  An update goes
+// to the stripe for the CPU doing it, with an atomic read-modify-write;
+// readers sum over all the stripes.  The atomic operations work directly on
+// memory, so they are good for statistics in shared memory segments as well
+// as for in-process ones.
+class StatStripes {
+ public:
+  // Number of stripes each value is spread over, and the number of bytes
+  // apart they should be.
+  static const int kNumStripes = 16;
+  static const size_t kStripeBytes = 64;
+
+  // Returns the stripe the current thread should update.  Using the CPU
+  // number means that threads running at the same time practically never
+  // share a stripe; where that's not available we spread by process instead.
+  static int CurrentStripe() {
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    if (cpu >= 0) {
+      return cpu % kNumStripes;
+    }
+#endif
+    return getpid() % kNumStripes;
+  }
+
+  // Rounds size up to a whole number of stripes.
+  static size_t RoundUp(size_t size) {
+    return (size + kStripeBytes - 1) / kStripeBytes * kStripeBytes;
+  }
+
+  static int64 AtomicAdd(volatile int64* ptr, int64 delta) {
+    return __sync_add_and_fetch(ptr, delta);
+  }
+
+  static int64 AtomicLoad(volatile int64* ptr) {
+#if defined(__LP64__) || defined(_LP64)
+    return *ptr;
+#else
+    // A plain 64-bit load may tear on 32-bit platforms.
+    return __sync_add_and_fetch(ptr, 0);
+#endif
+  }
+
+  static bool AtomicCompareAndSwap(volatile int64* ptr, int64 old_value,
+                                   int64 new_value) {
+    return __sync_bool_compare_and_swap(ptr, old_value, new_value);
+  }
+
+  static int64 AtomicExchange(volatile int64* ptr, int64 new_value) {
+    int64 old_value = AtomicLoad(ptr);
+    int64 seen;
+    while ((seen = __sync_val_compare_and_swap(ptr, old_value, new_value)) !=
+           old_value) {
+      old_value = seen;
+    }
+    return old_value;
+  }
+
+  // The following operate on a counter spread over num_stripes stripes,
+  // kStripeBytes apart, starting at 'stripes'; each stripe holds its share of
+  // the counter in its first int64.  num_stripes is at most kNumStripes, and
+  // a counter with just one stripe takes only an int64.
+
+  // Adds delta to the current stripe.  This touches only that stripe's cache
+  // line, which is what makes concurrent updates cheap, so hot paths should
+  // use this rather than anything that also reads the total.
+  static void CounterAdd(char* stripes, int num_stripes, int64 delta) {
+    int index = (num_stripes == 1) ? 0 : CurrentStripe() % num_stripes;
+    AtomicAdd(CounterStripe(stripes, index), delta);
+  }
+
+  // Returns the value of the counter, reading every stripe.
+  static int64 CounterSum(const char* stripes, int num_stripes) {
+    int64 sum = 0;
+    for (int i = 0; i < num_stripes; ++i) {
+      sum += AtomicLoad(CounterStripe(stripes, i));
+    }
+    return sum;
+  }
+
+  // Sets the counter to value and returns its previous value.  CounterAdds
+  // racing with this are not lost: they end up on top of value.  Calls to
+  // this must be serialized by the caller.
+  static int64 CounterExchange(char* stripes, int num_stripes, int64 value) {
+    int64 previous_value = 0;
+    for (int i = 0; i < num_stripes; ++i) {
+      previous_value += AtomicExchange(CounterStripe(stripes, i), 0);
+    }
+    AtomicAdd(CounterStripe(stripes, 0), value);
+    return previous_value;
+  }
+
+ private:
+  static volatile int64* CounterStripe(const char* stripes, int index) {
+    return reinterpret_cast<volatile int64*>(
+        const_cast<char*>(stripes) + index * kStripeBytes);
+  }
+
+  DISALLOW_IMPLICIT_CONSTRUCTORS(StatStripes);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_BASE_STAT_STRIPES_H_
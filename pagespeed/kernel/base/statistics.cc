@@ -196,6 +196,10 @@ UpDownCounter* Statistics::AddGlobalUpDownCounter(const StringPiece& name) {
   return AddUpDownCounter(name);
 }
 
+Variable* Statistics::AddStripedVariable(const StringPiece& name) {
+  return AddVariable(name);
+}
+
 namespace {
 
 const char kHistogramProlog[] =
@@ -49,18 +49,21 @@ class Variable {
   // implementation has some sensible way of doing so.
   virtual StringPiece GetName() const = 0;
 
-  // Adds 'delta' to the variable's value, returning the result.
+  // Adds 'delta' to the variable's value.  This does not return the new
+  // value, since counters are bumped far more often than they are read and
+  // some implementations have to do real work to compute it; call Get() if
+  // you need it.  UpDownCounter::Add does return the new value.
   // TODO(sligocki): s/int/int64/
-  int64 Add(int non_negative_delta) {
+  void Add(int non_negative_delta) {
     DCHECK_LE(0, non_negative_delta);
-    return AddHelper(non_negative_delta);
+    AddHelper(non_negative_delta);
   }
 
   virtual void Clear() = 0;
 
  protected:
   // This is virtual so that subclasses can add platform-specific atomicity.
-  virtual int64 AddHelper(int delta) = 0;
+  virtual void AddHelper(int delta) = 0;
 };
 
 // UpDownCounters are variables that can also be decreased (e.g. Add
@@ -370,6 +373,13 @@ class Statistics {
   // not be deleted by the caller.
   virtual Variable* AddVariable(const StringPiece& name) = 0;
 
+  // Like AddVariable, but for variables that are bumped so often, by so many
+  // threads at once, that implementations should trade some memory for cheaper
+  // concurrent updates, for example by spreading the value over several cache
+  // lines.  Use it only for the hottest counters.  Default implementation
+  // simply forwards to AddVariable.
+  virtual Variable* AddStripedVariable(const StringPiece& name);
+
   // Find a variable from a name, returning NULL if not found.
   virtual Variable* FindVariable(const StringPiece& name) const = 0;
 
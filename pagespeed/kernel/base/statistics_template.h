@@ -62,6 +62,17 @@ template<class Var, class UpDown, class Hist,
     return var;
   }
 
+  virtual Var* AddStripedVariable(const StringPiece& name) {
+    Var* var = FindVariable(name);
+    if (var == NULL) {
+      var = NewStripedVariable(name);
+      variables_.push_back(var);
+      variable_names_.push_back(name.as_string());
+      variable_map_[name.as_string()] = var;
+    }
+    return var;
+  }
+
   virtual UpDown* AddUpDownCounter(const StringPiece& name) {
     UpDown* var = FindUpDownCounter(name);
     if (var == NULL) {
@@ -246,6 +257,11 @@ template<class Var, class UpDown, class Hist,
   // Interface to subclass.
   virtual Var* NewVariable(StringPiece name) = 0;
 
+  // Default implementation just calls NewVariable
+  virtual Var* NewStripedVariable(StringPiece name) {
+    return NewVariable(name);
+  }
+
   // Interface to subclass.
   virtual UpDown* NewUpDownCounter(StringPiece name) = 0;
 
@@ -306,7 +322,8 @@ template<class Var, class UpDown, class Hist,
 //      Impl(StringPiece name, Statistics* stats);
 //      int64 Get();
 //      StringPiece GetName();
-//      int64 AddHelper(int delta);
+//      int64 AddHelper(int delta);  // Returns the new value.
+//      void IncBy(int64 delta);     // Need not compute the new value.
 //      void Clear();
 // See ../util/simple_stats.h, class SimpleStatsVariable, for an example
 // of an Impl class.
@@ -316,7 +333,7 @@ template<class Impl> class VarTemplate : public Variable {
   virtual ~VarTemplate() {}
   virtual int64 Get() const { return impl_.Get(); }
   virtual StringPiece GetName() const { return impl_.GetName(); }
-  virtual int64 AddHelper(int delta) { return impl_.AddHelper(delta); }
+  virtual void AddHelper(int delta) { impl_.IncBy(delta); }
   virtual void Clear() { impl_.Set(0); }
 
   Impl* impl() { return &impl_; }
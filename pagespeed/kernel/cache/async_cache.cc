@@ -142,6 +142,51 @@ void AsyncCache::CancelPut(GoogleString* key, SharedString* value) {
   outstanding_operations_.NoBarrierIncrement(-1);
 }
 
+void AsyncCache::MultiPut(MultiPutRequest* request) {
+  if (!IsHealthy()) {
+    delete request;
+    return;
+  }
+
+  // As in Put, any encoding of keys into values must be done now.
+  if (cache_->MustEncodeKeyInValueOnPut()) {
+    MultiPutRequest* encoded_request = new MultiPutRequest;
+    encoded_request->reserve(request->size());
+    for (int i = 0, n = request->size(); i < n; ++i) {
+      KeyValue* key_value = &(*request)[i];
+      SharedString encoded_value;
+      if (key_value_codec::Encode(key_value->key, &key_value->value,
+                                  &encoded_value)) {
+        encoded_request->push_back(KeyValue(key_value->key, encoded_value));
+      }
+    }
+    delete request;
+    request = encoded_request;
+  }
+
+  outstanding_operations_.NoBarrierIncrement(1);
+  sequence_->Add(MakeFunction(this, &AsyncCache::DoMultiPut,
+                              &AsyncCache::CancelMultiPut, request));
+}
+
+void AsyncCache::DoMultiPut(MultiPutRequest* request) {
+  if (IsHealthy()) {
+    if (cache_->MustEncodeKeyInValueOnPut()) {
+      cache_->MultiPutWithKeyInValue(request);
+    } else {
+      cache_->MultiPut(request);
+    }
+  } else {
+    delete request;
+  }
+  outstanding_operations_.NoBarrierIncrement(-1);
+}
+
+void AsyncCache::CancelMultiPut(MultiPutRequest* request) {
+  delete request;
+  outstanding_operations_.NoBarrierIncrement(-1);
+}
+
 void AsyncCache::Delete(const GoogleString& key) {
   if (IsHealthy()) {
     outstanding_operations_.NoBarrierIncrement(1);
@@ -67,6 +67,8 @@ class AsyncCache : public CacheInterface {
   virtual void Put(const GoogleString& key, SharedString* value);
   virtual void Delete(const GoogleString& key);
   virtual void MultiGet(MultiGetRequest* request);
+  // Sends the whole request to the underlying cache as a single operation.
+  virtual void MultiPut(MultiPutRequest* request);
   static GoogleString FormatName(StringPiece cache);
   virtual GoogleString Name() const { return FormatName(cache_->Name()); }
   virtual bool IsBlocking() const { return false; }
@@ -102,10 +104,12 @@ class AsyncCache : public CacheInterface {
   void DoMultiGet(MultiGetRequest* request);
   void CancelMultiGet(MultiGetRequest* request);
 
-  // Functions to execute Put/Delete in sequence_.  Canceling
-  // a Put/Delete just drops the request.
+  // Functions to execute Put/MultiPut/Delete in sequence_.  Canceling
+  // a Put/MultiPut/Delete just drops the request.
   void DoPut(GoogleString* key, SharedString* value);
   void CancelPut(GoogleString* key, SharedString* value);
+  void DoMultiPut(MultiPutRequest* request);
+  void CancelMultiPut(MultiPutRequest* request);
   void DoDelete(GoogleString* key);
   void CancelDelete(GoogleString* key);
 
@@ -290,6 +290,10 @@ TEST_F(AsyncCacheTest, MultiGet) {
   TestMultiGet();
 }
 
+TEST_F(AsyncCacheTest, MultiPut) {
+  TestMultiPut(3);
+}
+
 TEST_F(AsyncCacheTest, MultiGetDrop) {
   PopulateCache(3);
   Callback* n2 = InitiateDelayedGet("n2");
@@ -359,6 +363,17 @@ TEST_F(AsyncCacheTest, NoPutsOnSickServer) {
   CheckNotFound("n0");
 }
 
+TEST_F(AsyncCacheTest, NoMultiPutsOnSickServer) {
+  synced_lru_cache_->set_is_healthy(false);
+  CacheInterface::MultiPutRequest* request =
+      new CacheInterface::MultiPutRequest;
+  request->push_back(CacheInterface::KeyValue("n0", SharedString("v0")));
+  Cache()->MultiPut(request);
+  PostOpCleanup();
+  synced_lru_cache_->set_is_healthy(true);
+  CheckNotFound("n0");
+}
+
 TEST_F(AsyncCacheTest, NoGetsOnSickServer) {
   PopulateCache(3);
   CheckGet("n0", "v0");
@@ -18,37 +18,51 @@
 
 #include "pagespeed/kernel/cache/cache_batcher.h"
 
+#include <algorithm>
 
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/atomic_int32.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/shared_string.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/cache/cache_interface.h"
 #include "pagespeed/kernel/cache/delegating_cache_callback.h"
 
 namespace {
 
 const char kDroppedGets[] = "cache_batcher_dropped_gets";
+const char kCoalescedGets[] = "cache_batcher_coalesced_gets";
+const char kQueuedPuts[] = "cache_batcher_queued_puts";
+const char kBatchSizeHistogram[] = "cache_batcher_batch_size";
+const char kQueueWaitHistogram[] = "cache_batcher_queue_wait_us";
+
+const int kBatchSizeHistogramMaxValue = 500;
+const int kQueueWaitHistogramMaxValueUs = 1*1000*1000;
 
 }  // namespace
 
 namespace net_instaweb {
 
+const size_t CacheBatcher::kUnlimitedBatchSize;
+const size_t CacheBatcher::kAdaptiveBatchSizeIncrement;
+
 // Used to track the progress of a MultiGet, so that we can keep track
 // of how many lookups are outstanding, where a MultiGet counts as one
 // lookup independent of how many keys it has.
 class CacheBatcher::Group {
  public:
-  Group(CacheBatcher* batcher, int group_size)
+  Group(CacheBatcher* batcher, int group_size, int64 start_us)
       : batcher_(batcher),
-        outstanding_lookups_(group_size) {
+        outstanding_lookups_(group_size),
+        start_us_(start_us) {
   }
 
   void Done() {
     if (outstanding_lookups_.BarrierIncrement(-1) == 0) {
-      batcher_->GroupComplete();
+      batcher_->GroupComplete(start_us_);
       delete this;
     }
   }
@@ -56,40 +70,79 @@ class CacheBatcher::Group {
  private:
   CacheBatcher* batcher_;
   AtomicInt32 outstanding_lookups_;
+  int64 start_us_;
 
   DISALLOW_COPY_AND_ASSIGN(Group);
 };
 
 class CacheBatcher::BatcherCallback : public DelegatingCacheCallback {
  public:
-  BatcherCallback(CacheInterface::Callback* callback, Group* group)
+  BatcherCallback(CacheInterface::Callback* callback, Group* group,
+                  CacheBatcher* batcher, const GoogleString& key)
       : DelegatingCacheCallback(callback),
-        group_(group) {
+        group_(group),
+        batcher_(batcher),
+        key_(key),
+        candidate_state_(CacheInterface::kNotFound) {
   }
 
   virtual ~BatcherCallback() {}
 
+  // Remembers the candidate so it can be offered to any other callbacks
+  // waiting on this key, which validate it for themselves.
+  virtual bool ValidateCandidate(const GoogleString& key,
+                                 CacheInterface::KeyState state) {
+    candidate_state_ = state;
+    candidate_value_ = *value();
+    return DelegatingCacheCallback::ValidateCandidate(key, state);
+  }
+
   virtual void Done(CacheInterface::KeyState state) {
     Group* group = group_;
+    CacheBatcher* batcher = batcher_;
+    GoogleString key;
+    key.swap(key_);
+    CacheInterface::KeyState candidate_state = candidate_state_;
+    SharedString candidate_value(candidate_value_);
+    CallbackVector waiters;
+    batcher->TakeWaiters(key, &waiters);
     DelegatingCacheCallback::Done(state);  // deletes this.
+    batcher->ReportToWaiters(key, candidate_state, candidate_value, waiters);
     group->Done();
   }
 
  private:
   Group* group_;
+  CacheBatcher* batcher_;
+  GoogleString key_;
+  CacheInterface::KeyState candidate_state_;
+  SharedString candidate_value_;
 
   DISALLOW_COPY_AND_ASSIGN(BatcherCallback);
 };
 
 CacheBatcher::CacheBatcher(CacheInterface* cache, AbstractMutex* mutex,
-                           Statistics* statistics)
+                           Timer* timer, Statistics* statistics)
     : cache_(cache),
       mutex_(mutex),
+      timer_(timer),
       last_batch_size_(-1),
       pending_(0),
       max_parallel_lookups_(kDefaultMaxParallelLookups),
       max_queue_size_(kDefaultMaxQueueSize),
-      dropped_gets_(statistics->GetVariable(kDroppedGets)) {
+      max_batch_size_(kUnlimitedBatchSize),
+      adaptive_(false),
+      target_latency_us_(0),
+      adaptive_parallel_lookups_(0),
+      adaptive_batch_size_(0),
+      dropped_gets_(statistics->GetVariable(kDroppedGets)),
+      coalesced_gets_(statistics->GetVariable(kCoalescedGets)),
+      queued_puts_count_(statistics->GetVariable(kQueuedPuts)),
+      batch_size_histogram_(statistics->GetHistogram(kBatchSizeHistogram)),
+      queue_wait_us_histogram_(
+          statistics->GetHistogram(kQueueWaitHistogram)) {
+  batch_size_histogram_->SetMaxValue(kBatchSizeHistogramMaxValue);
+  queue_wait_us_histogram_->SetMaxValue(kQueueWaitHistogramMaxValueUs);
 }
 
 CacheBatcher::~CacheBatcher() {
@@ -108,63 +161,272 @@ GoogleString CacheBatcher::Name() const {
 
 void CacheBatcher::InitStats(Statistics* statistics) {
   statistics->AddVariable(kDroppedGets);
+  statistics->AddVariable(kCoalescedGets);
+  statistics->AddVariable(kQueuedPuts);
+  Histogram* batch_size_histogram =
+      statistics->AddHistogram(kBatchSizeHistogram);
+  batch_size_histogram->SetMaxValue(kBatchSizeHistogramMaxValue);
+  Histogram* queue_wait_us_histogram =
+      statistics->AddHistogram(kQueueWaitHistogram);
+  queue_wait_us_histogram->SetMaxValue(kQueueWaitHistogramMaxValueUs);
+}
+
+void CacheBatcher::EnableAdaptiveMode(int64 target_latency_us) {
+  ScopedMutex mutex(mutex_.get());
+  adaptive_ = true;
+  target_latency_us_ = target_latency_us;
+  adaptive_parallel_lookups_ = max_parallel_lookups_;
+  adaptive_batch_size_ = BatchSizeCeiling();
+}
+
+size_t CacheBatcher::BatchSizeCeiling() const {
+  // The queue can never hold more than max_queue_size_ keys, so that
+  // serves as the limit on an unlimited batch.
+  if ((max_batch_size_ == kUnlimitedBatchSize) ||
+      (max_batch_size_ > max_queue_size_)) {
+    return max_queue_size_;
+  }
+  return max_batch_size_;
+}
+
+int CacheBatcher::parallel_lookups_limit() {
+  ScopedMutex mutex(mutex_.get());
+  return adaptive_ ? adaptive_parallel_lookups_ : max_parallel_lookups_;
+}
+
+size_t CacheBatcher::batch_size_limit() {
+  ScopedMutex mutex(mutex_.get());
+  return adaptive_ ? adaptive_batch_size_ : BatchSizeCeiling();
 }
 
 bool CacheBatcher::CanIssueGet() const {
-  return (pending_ < max_parallel_lookups_);
+  int limit = adaptive_ ? adaptive_parallel_lookups_ : max_parallel_lookups_;
+  return (pending_ < limit);
 }
 
 void CacheBatcher::Get(const GoogleString& key, Callback* callback) {
   bool immediate = false;
   bool drop_get = false;
+  bool coalesced = false;
+  bool queued_put = false;
+  int64 now_us = timer_->NowUs();
   {
     ScopedMutex mutex(mutex_.get());
 
-    if (CanIssueGet()) {
+    InFlightMap::iterator iter = in_flight_.find(key);
+    PutMap::iterator put_iter = queued_puts_.find(key);
+    if (put_iter != queued_puts_.end()) {
+      *callback->value() = put_iter->second;
+      queued_put = true;
+    } else if (iter != in_flight_.end()) {
+      iter->second.push_back(callback);
+      coalesced = true;
+    } else if (CanIssueGet()) {
       immediate = true;
       ++pending_;
+      in_flight_[key];
     } else if (queue_.size() >= max_queue_size_) {
       drop_get = true;
     } else {
       queue_.push_back(KeyCallback(key, callback));
+      queue_start_us_.push_back(now_us);
+      in_flight_[key];
     }
   }
-  if (immediate) {
-    Group* group = new Group(this, 1);
-    callback = new BatcherCallback(callback, group);
+  if (queued_put) {
+    ValidateAndReportResult(key, CacheInterface::kAvailable, callback);
+  } else if (immediate) {
+    batch_size_histogram_->Add(1);
+    Group* group = new Group(this, 1, now_us);
+    callback = new BatcherCallback(callback, group, this, key);
     cache_->Get(key, callback);
   } else if (drop_get) {
     ValidateAndReportResult(key, CacheInterface::kNotFound, callback);
     dropped_gets_->Add(1);
+  } else if (coalesced) {
+    coalesced_gets_->Add(1);
   }
 }
 
-void CacheBatcher::GroupComplete() {
-  MultiGetRequest* request = NULL;
+CacheInterface::MultiGetRequest* CacheBatcher::TakeBatch(int64 now_us) {
+  size_t batch_size = std::min(
+      queue_.size(), adaptive_ ? adaptive_batch_size_ : BatchSizeCeiling());
+  MultiGetRequest* request = new MultiGetRequest;
+  if (batch_size == queue_.size()) {
+    request->swap(queue_);
+  } else {
+    request->assign(queue_.begin(), queue_.begin() + batch_size);
+    queue_.erase(queue_.begin(), queue_.begin() + batch_size);
+  }
+  for (size_t i = 0; i < batch_size; ++i) {
+    queue_wait_us_histogram_->Add(now_us - queue_start_us_[i]);
+  }
+  queue_start_us_.erase(queue_start_us_.begin(),
+                        queue_start_us_.begin() + batch_size);
+  last_batch_size_ = batch_size;
+  return request;
+}
+
+void CacheBatcher::IssueBatch(MultiGetRequest* request, int64 now_us) {
+  batch_size_histogram_->Add(request->size());
+  Group* group = new Group(this, request->size(), now_us);
+  for (int i = 0, n = request->size(); i < n; ++i) {
+    KeyCallback* key_callback = &(*request)[i];
+    key_callback->callback = new BatcherCallback(
+        key_callback->callback, group, this, key_callback->key);
+  }
+  cache_->MultiGet(request);
+}
+
+void CacheBatcher::AdaptLimits(int64 latency_us) {
+  if (latency_us <= target_latency_us_) {
+    adaptive_parallel_lookups_ =
+        std::min(adaptive_parallel_lookups_ + 1, max_parallel_lookups_);
+    adaptive_batch_size_ = std::min(
+        adaptive_batch_size_ + kAdaptiveBatchSizeIncrement,
+        BatchSizeCeiling());
+  } else {
+    adaptive_parallel_lookups_ = std::max(adaptive_parallel_lookups_ / 2, 1);
+    adaptive_batch_size_ =
+        std::max(adaptive_batch_size_ / 2, static_cast<size_t>(1));
+  }
+}
 
+CacheInterface::MultiPutRequest* CacheBatcher::TakeQueuedPuts() {
+  if (queued_puts_.empty()) {
+    return NULL;
+  }
+  MultiPutRequest* request = new MultiPutRequest;
+  request->reserve(queued_puts_.size());
+  for (PutMap::iterator iter = queued_puts_.begin();
+       iter != queued_puts_.end(); ++iter) {
+    request->push_back(KeyValue(iter->first, iter->second));
+    ++sending_puts_[iter->first];
+  }
+  queued_puts_.clear();
+  return request;
+}
+
+void CacheBatcher::SendQueuedPuts(MultiPutRequest* request) {
+  StringVector keys;
+  keys.reserve(request->size());
+  for (int i = 0, n = request->size(); i < n; ++i) {
+    keys.push_back((*request)[i].key);
+  }
+  cache_->MultiPut(request);
+
+  // The Puts are now ahead of anything else we send the cache, so Deletes
+  // that were held back for them can go.
+  StringVector deletes;
   {
     ScopedMutex mutex(mutex_.get());
-    if (queue_.empty()) {
-      --pending_;
-      return;
+    for (int i = 0, n = keys.size(); i < n; ++i) {
+      KeyCountMap::iterator iter = sending_puts_.find(keys[i]);
+      if (--iter->second == 0) {
+        sending_puts_.erase(iter);
+        if (deletes_after_puts_.erase(keys[i]) != 0) {
+          deletes.push_back(keys[i]);
+        }
+      }
     }
-    request = new MultiGetRequest;
-    last_batch_size_ = queue_.size();
-    request->swap(queue_);
   }
-  Group* group = new Group(this, request->size());
-  for (int i = 0, n = request->size(); i < n; ++i) {
-    (*request)[i].callback = new BatcherCallback((*request)[i].callback,
-                                                 group);
+  for (int i = 0, n = deletes.size(); i < n; ++i) {
+    cache_->Delete(deletes[i]);
+  }
+}
+
+void CacheBatcher::GroupComplete(int64 start_us) {
+  std::vector<MultiGetRequest*> requests;
+  MultiPutRequest* put_request;
+  int64 now_us = timer_->NowUs();
+
+  {
+    ScopedMutex mutex(mutex_.get());
+    --pending_;
+    if (adaptive_) {
+      AdaptLimits(now_us - start_us);
+    }
+    put_request = TakeQueuedPuts();
+    while (!queue_.empty() && CanIssueGet()) {
+      ++pending_;
+      requests.push_back(TakeBatch(now_us));
+    }
+  }
+  if (put_request != NULL) {
+    SendQueuedPuts(put_request);
+  }
+  for (int i = 0, n = requests.size(); i < n; ++i) {
+    IssueBatch(requests[i], now_us);
+  }
+}
+
+void CacheBatcher::TakeWaiters(const GoogleString& key,
+                               CallbackVector* waiters) {
+  ScopedMutex mutex(mutex_.get());
+  InFlightMap::iterator iter = in_flight_.find(key);
+  if (iter != in_flight_.end()) {
+    waiters->swap(iter->second);
+    in_flight_.erase(iter);
+  }
+}
+
+void CacheBatcher::ReportToWaiters(const GoogleString& key, KeyState state,
+                                   const SharedString& value,
+                                   const CallbackVector& waiters) {
+  for (int i = 0, n = waiters.size(); i < n; ++i) {
+    *waiters[i]->value() = value;
+    ValidateAndReportResult(key, state, waiters[i]);
   }
-  cache_->MultiGet(request);
 }
 
 void CacheBatcher::Put(const GoogleString& key, SharedString* value) {
-  cache_->Put(key, value);
+  MultiPutRequest* request = new MultiPutRequest;
+  request->push_back(KeyValue(key, *value));
+  MultiPut(request);
+}
+
+void CacheBatcher::MultiPut(MultiPutRequest* request) {
+  MultiPutRequest* full_queue = NULL;
+  {
+    ScopedMutex mutex(mutex_.get());
+    if (!CanIssueGet()) {
+      for (int i = 0, n = request->size(); i < n; ++i) {
+        const KeyValue& key_value = (*request)[i];
+        queued_puts_[key_value.key] = key_value.value;
+      }
+      queued_puts_count_->Add(request->size());
+      delete request;
+      request = NULL;
+      if (queued_puts_.size() >= max_queue_size_) {
+        full_queue = TakeQueuedPuts();
+      }
+    }
+  }
+  if (request != NULL) {
+    // Nothing is outstanding, so there is nothing to wait behind.
+    if (request->size() == 1) {
+      KeyValue& key_value = (*request)[0];
+      cache_->Put(key_value.key, &key_value.value);
+      delete request;
+    } else {
+      cache_->MultiPut(request);
+    }
+  } else if (full_queue != NULL) {
+    SendQueuedPuts(full_queue);
+  }
 }
 
 void CacheBatcher::Delete(const GoogleString& key) {
+  {
+    ScopedMutex mutex(mutex_.get());
+    queued_puts_.erase(key);
+    if (sending_puts_.find(key) != sending_puts_.end()) {
+      // A batch with a Put of key has been taken off the queue, but may not
+      // have reached the cache yet, so deleting now could be undone by it.
+      deletes_after_puts_.insert(key);
+      return;
+    }
+  }
   cache_->Delete(key);
 }
 
@@ -175,17 +437,31 @@ int CacheBatcher::Pending() {
 
 void CacheBatcher::ShutDown() {
   MultiGetRequest* request = NULL;
+  MultiPutRequest* put_request = NULL;
   {
     ScopedMutex mutex(mutex_.get());
+    put_request = TakeQueuedPuts();
     if (!queue_.empty()) {
       request = new MultiGetRequest;
       request->swap(queue_);
+      queue_start_us_.clear();
     }
   }
 
   if (request != NULL) {
+    for (int i = 0, n = request->size(); i < n; ++i) {
+      const GoogleString& key = (*request)[i].key;
+      CallbackVector waiters;
+      TakeWaiters(key, &waiters);
+      ReportToWaiters(key, kNotFound, SharedString(), waiters);
+    }
     ReportMultiGetNotFound(request);
   }
+
+  // Send the queued Puts ahead of the shutdown, rather than losing them.
+  if (put_request != NULL) {
+    SendQueuedPuts(put_request);
+  }
   cache_->ShutDown();
 }
 
@@ -20,9 +20,12 @@
 #define PAGESPEED_KERNEL_CACHE_CACHE_BATCHER_H_
 
 #include <cstddef>
+#include <map>
+#include <vector>
 
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/shared_string.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/cache/cache_interface.h"
@@ -30,8 +33,9 @@
 namespace net_instaweb {
 
 class AbstractMutex;
-class SharedString;
+class Histogram;
 class Statistics;
+class Timer;
 class Variable;
 
 // Batches up cache lookups to exploit implementations that have MultiGet
@@ -44,6 +48,24 @@ class Variable;
 // There is also a maximum queue size.  If Gets stream in faster than they
 // are completed and the queue overflows, then we respond with a fast kNotFound.
 //
+// A Get for a key that is already queued or being looked up does not start
+// another lookup.  Instead its callback is given the result of the lookup
+// in progress.
+//
+// Puts are batched the same way: while lookups are outstanding, Puts are
+// queued and then sent as a single MultiPut when a lookup completes, so
+// writes share the round-trips the lookups are already waiting for.  A Get
+// for a key with a queued Put is answered from the queue, and a full put
+// queue is sent immediately rather than dropped.
+//
+// In adaptive mode, the number of parallel lookups and the number of keys
+// per MultiGet are tuned, AIMD-style, from the latency of each lookup.
+// Each lookup that completes within the target latency allows one more
+// parallel lookup and kAdaptiveBatchSizeIncrement more keys per MultiGet.
+// Each slower one halves both.  The limits never exceed the configured
+// max_parallel_lookups and max_batch_size, so adaptive mode only backs off
+// from those when the cache is slow.
+//
 // Note that this class is designed for use with an asynchronous cache
 // implementation.  To use this with a blocking cache implementation, please
 // wrap the blocking cache in an AsyncCache.
@@ -68,8 +90,16 @@ class CacheBatcher : public CacheInterface {
   // requests, calling the callback immediately with kNotFound.
   static const size_t kDefaultMaxQueueSize = 1000;
 
-  // Does not take ownership of the cache. Takes ownership of the mutex.
-  CacheBatcher(CacheInterface* cache, AbstractMutex* mutex,
+  // By default, all the queued lookups are sent in a single MultiGet.
+  static const size_t kUnlimitedBatchSize = 0;
+
+  // In adaptive mode, each lookup faster than the target raises the
+  // MultiGet size limit by this much.
+  static const size_t kAdaptiveBatchSizeIncrement = 16;
+
+  // Does not take ownership of the cache or the timer. Takes ownership of
+  // the mutex.
+  CacheBatcher(CacheInterface* cache, AbstractMutex* mutex, Timer* timer,
                Statistics* statistics);
   virtual ~CacheBatcher();
 
@@ -80,6 +110,13 @@ class CacheBatcher : public CacheInterface {
 
   virtual void Get(const GoogleString& key, Callback* callback);
   virtual void Put(const GoogleString& key, SharedString* value);
+  virtual void MultiPut(MultiPutRequest* request);
+
+  // Drops any queued Put of key, then deletes it right away, or, if a batch
+  // of queued Puts with the key is on its way to the cache, right after that
+  // batch is sent.  Either way a Put made before the Delete can't undo it.
+  // Deletes are not batched: they come only from invalidations, such as a
+  // changed input resource, which are rare next to Gets and Puts.
   virtual void Delete(const GoogleString& key);
   virtual GoogleString Name() const;
   static GoogleString FormatName(StringPiece cache, int parallelism, int max);
@@ -92,6 +129,21 @@ class CacheBatcher : public CacheInterface {
   void set_max_queue_size(size_t n) { max_queue_size_ = n; }
   void set_max_parallel_lookups(size_t n) { max_parallel_lookups_ = n; }
 
+  // Limits the number of keys sent in each MultiGet; any remaining queued
+  // keys wait for the next free lookup.  kUnlimitedBatchSize, the default,
+  // sends the whole queue.
+  void set_max_batch_size(size_t n) { max_batch_size_ = n; }
+
+  // Turns on adaptive mode, tuning the lookup limits to keep lookups within
+  // target_latency_us.  This should be called at setup time, after setting
+  // max_parallel_lookups and max_batch_size, which become the upper bounds.
+  void EnableAdaptiveMode(int64 target_latency_us);
+
+  // The limits currently in force, which only differ from
+  // max_parallel_lookups and max_batch_size in adaptive mode.
+  int parallel_lookups_limit();
+  size_t batch_size_limit();
+
   int Pending();  // This is used to help synchronize tests.
 
   virtual bool IsHealthy() const { return cache_->IsHealthy(); }
@@ -101,17 +153,77 @@ class CacheBatcher : public CacheInterface {
   class Group;
   class BatcherCallback;
 
-  void GroupComplete();
+  typedef std::vector<Callback*> CallbackVector;
+
+  // Maps each key being queued or looked up to the callbacks for later
+  // Gets of the same key, which share its result.
+  typedef std::map<GoogleString, CallbackVector> InFlightMap;
+
+  // Queued Puts by key; a later Put of the same key replaces the value.
+  typedef std::map<GoogleString, SharedString> PutMap;
+
+  // The number of batches of queued Puts with each key that have been taken
+  // off the queue but not yet handed to the cache.
+  typedef std::map<GoogleString, int> KeyCountMap;
+
+  void GroupComplete(int64 start_us);
   bool CanIssueGet() const;  // must be called with mutex_ held.
 
+  // Takes the next MultiGet's worth of keys off the queue.  Must be called
+  // with mutex_ held.
+  MultiGetRequest* TakeBatch(int64 now_us);
+
+  // Sends a MultiGet of keys taken from the queue.
+  void IssueBatch(MultiGetRequest* request, int64 now_us);
+
+  // Adjusts the adaptive limits after a lookup took latency_us.  Must be
+  // called with mutex_ held.
+  void AdaptLimits(int64 latency_us);
+
+  // Takes all the queued Puts, returning NULL if there are none, and marks
+  // their keys as being sent.  Must be called with mutex_ held.
+  MultiPutRequest* TakeQueuedPuts();
+
+  // Sends Puts taken by TakeQueuedPuts to the cache, followed by any Deletes
+  // of their keys that came in meanwhile.
+  void SendQueuedPuts(MultiPutRequest* request);
+
+  // Removes key from the in-flight map, returning the callbacks waiting on
+  // it in *waiters.
+  void TakeWaiters(const GoogleString& key, CallbackVector* waiters);
+
+  // Reports the lookup result for key to callbacks that were waiting on it.
+  void ReportToWaiters(const GoogleString& key, KeyState state,
+                       const SharedString& value,
+                       const CallbackVector& waiters);
+
+  size_t BatchSizeCeiling() const;
+
   CacheInterface* cache_;
   scoped_ptr<AbstractMutex> mutex_;
+  Timer* timer_;
   MultiGetRequest queue_;
+  std::vector<int64> queue_start_us_;  // When each queue_ entry was queued.
+  InFlightMap in_flight_;
+  PutMap queued_puts_;
+  KeyCountMap sending_puts_;
+  StringSet deletes_after_puts_;  // Keys to delete once sent; in sending_puts_.
   int last_batch_size_;
   int pending_;
   int max_parallel_lookups_;
   size_t max_queue_size_;  // size_t so it can be compared to queue_.size().
+  size_t max_batch_size_;
+
+  bool adaptive_;
+  int64 target_latency_us_;
+  int adaptive_parallel_lookups_;
+  size_t adaptive_batch_size_;
+
   Variable* dropped_gets_;
+  Variable* coalesced_gets_;
+  Variable* queued_puts_count_;
+  Histogram* batch_size_histogram_;
+  Histogram* queue_wait_us_histogram_;
 
   DISALLOW_COPY_AND_ASSIGN(CacheBatcher);
 };
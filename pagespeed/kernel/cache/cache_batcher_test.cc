@@ -23,6 +23,7 @@
 #include <cstddef>
 
 #include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/mock_timer.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/thread_system.h"
@@ -44,6 +45,50 @@ const int kMaxWorkers = 2;
 
 namespace net_instaweb {
 
+// Forwards everything to another cache, but first Deletes a chosen key
+// through the batcher when a MultiPut arrives, like a Delete that comes in
+// just after the batcher takes its queued Puts and before they are sent.
+class DeleteDuringMultiPutCache : public CacheInterface {
+ public:
+  explicit DeleteDuringMultiPutCache(CacheInterface* cache)
+      : cache_(cache), batcher_(NULL) {}
+  virtual ~DeleteDuringMultiPutCache() {}
+
+  void DeleteDuringNextMultiPut(CacheBatcher* batcher,
+                                const GoogleString& key) {
+    batcher_ = batcher;
+    key_ = key;
+  }
+
+  virtual void Get(const GoogleString& key, Callback* callback) {
+    cache_->Get(key, callback);
+  }
+  virtual void MultiGet(MultiGetRequest* request) { cache_->MultiGet(request); }
+  virtual void Put(const GoogleString& key, SharedString* value) {
+    cache_->Put(key, value);
+  }
+  virtual void Delete(const GoogleString& key) { cache_->Delete(key); }
+  virtual void MultiPut(MultiPutRequest* request) {
+    if (batcher_ != NULL) {
+      CacheBatcher* batcher = batcher_;
+      batcher_ = NULL;
+      batcher->Delete(key_);
+    }
+    cache_->MultiPut(request);
+  }
+  virtual GoogleString Name() const { return cache_->Name(); }
+  virtual bool IsBlocking() const { return cache_->IsBlocking(); }
+  virtual bool IsHealthy() const { return cache_->IsHealthy(); }
+  virtual void ShutDown() { cache_->ShutDown(); }
+
+ private:
+  CacheInterface* cache_;
+  CacheBatcher* batcher_;
+  GoogleString key_;
+
+  DISALLOW_COPY_AND_ASSIGN(DeleteDuringMultiPutCache);
+};
+
 class CacheBatcherTest : public CacheTestBase {
  protected:
   CacheBatcherTest() : expected_pending_(0) {
@@ -52,6 +97,8 @@ class CacheBatcherTest : public CacheTestBase {
     CacheBatcher::InitStats(statistics_.get());
     lru_cache_.reset(new LRUCache(kMaxSize));
     timer_.reset(thread_system_->NewTimer());
+    mock_timer_.reset(new MockTimer(thread_system_->NewMutex(),
+                                    MockTimer::kApr_5_2010_ms));
     pool_.reset(
         new QueuedWorkerPool(kMaxWorkers, "cache", thread_system_.get()));
     threadsafe_cache_.reset(new ThreadsafeCache(
@@ -61,6 +108,7 @@ class CacheBatcherTest : public CacheTestBase {
                                       thread_system_.get()));
     batcher_.reset(new CacheBatcher(delay_cache_.get(),
                                     thread_system_->NewMutex(),
+                                    mock_timer_.get(),
                                     statistics_.get()));
     set_mutex(thread_system_->NewMutex());
   }
@@ -116,6 +164,7 @@ class CacheBatcherTest : public CacheTestBase {
   scoped_ptr<ThreadSystem> thread_system_;
   scoped_ptr<ThreadsafeCache> threadsafe_cache_;
   scoped_ptr<Timer> timer_;
+  scoped_ptr<MockTimer> mock_timer_;  // Used by the batcher.
   scoped_ptr<QueuedWorkerPool> pool_;
   scoped_ptr<AsyncCache> async_cache_;
   scoped_ptr<DelayCache> delay_cache_;
@@ -254,4 +303,210 @@ TEST_F(CacheBatcherTest, ExceedMaxQueueAndDrop) {
   CheckGet("n4", "v4");
 }
 
+TEST_F(CacheBatcherTest, CoalesceDuplicateGets) {
+  batcher_->set_max_parallel_lookups(1);
+
+  PopulateCache(2);
+
+  // The second lookup of "n0" shares the first one's result.
+  DelayKey("n0");
+  Callback* n0 = InitiateGet("n0");
+  Callback* n0_again = InitiateGet("n0");
+
+  // So do duplicate lookups of a queued key.
+  Callback* n1 = InitiateGet("n1");
+  Callback* n1_again = InitiateGet("n1");
+  Callback* not_found = InitiateGet("not found");
+  Callback* not_found_again = InitiateGet("not found");
+  EXPECT_EQ(6, outstanding_fetches());
+  EXPECT_EQ(3, statistics_->GetVariable("cache_batcher_coalesced_gets")->Get());
+
+  ReleaseKey("n0");
+  WaitAndCheck(n0, "v0");
+  WaitAndCheck(n0_again, "v0");
+  WaitAndCheck(n1, "v1");
+  WaitAndCheck(n1_again, "v1");
+  WaitAndCheckNotFound(not_found);
+  WaitAndCheckNotFound(not_found_again);
+  EXPECT_EQ(0, outstanding_fetches());
+  EXPECT_EQ(2, batcher_->last_batch_size());
+  EXPECT_EQ(2, lru_cache_->num_hits());
+}
+
+TEST_F(CacheBatcherTest, CoalescedGetsValidateSeparately) {
+  PopulateCache(1);
+
+  DelayKey("n0");
+  Callback* n0 = InitiateGet("n0");
+  Callback* n0_invalid = InitiateGet("n0");
+  n0_invalid->set_invalid_value("v0");
+  ReleaseKey("n0");
+  WaitAndCheck(n0, "v0");
+  WaitAndCheckNotFound(n0_invalid);
+}
+
+TEST_F(CacheBatcherTest, Histograms) {
+  batcher_->set_max_parallel_lookups(1);
+
+  PopulateCache(3);
+
+  DelayKey("n0");
+  Callback* n0 = InitiateGet("n0");
+  Callback* n1 = InitiateGet("n1");
+  Callback* n2 = InitiateGet("n2");
+  ReleaseKey("n0");
+  WaitAndCheck(n0, "v0");
+  WaitAndCheck(n1, "v1");
+  WaitAndCheck(n2, "v2");
+
+  // One single-key lookup, then one batch of 2, whose keys both waited
+  // in the queue.
+  EXPECT_EQ(2, statistics_->GetHistogram("cache_batcher_batch_size")->Count());
+  EXPECT_EQ(2, statistics_->GetHistogram(
+      "cache_batcher_queue_wait_us")->Count());
+}
+
+TEST_F(CacheBatcherTest, LimitBatchSize) {
+  batcher_->set_max_parallel_lookups(1);
+  batcher_->set_max_batch_size(2);
+
+  PopulateCache(4);
+
+  DelayKey("n0");
+  Callback* n0 = InitiateGet("n0");
+  Callback* n1 = InitiateGet("n1");
+  Callback* n2 = InitiateGet("n2");
+  Callback* n3 = InitiateGet("n3");
+  ReleaseKey("n0");
+  WaitAndCheck(n0, "v0");
+  WaitAndCheck(n1, "v1");
+  WaitAndCheck(n2, "v2");
+  WaitAndCheck(n3, "v3");
+
+  // n1 and n2 went in one batch, then n3 by itself.
+  EXPECT_EQ(1, batcher_->last_batch_size());
+  EXPECT_EQ(3, statistics_->GetHistogram("cache_batcher_batch_size")->Count());
+}
+
+TEST_F(CacheBatcherTest, QueuePutsBehindLookup) {
+  batcher_->set_max_parallel_lookups(1);
+
+  PopulateCache(1);
+
+  // While "n0" is being looked up, Puts wait for it and then go out
+  // together, with the last Put of a key winning.
+  DelayKey("n0");
+  Callback* n0 = InitiateGet("n0");
+  CheckPut("n1", "v1");
+  CheckPut("n2", "old");
+  CheckPut("n2", "v2");
+  CheckPut("n3", "v3");
+  CheckDelete("n3");
+  EXPECT_EQ(4, statistics_->GetVariable("cache_batcher_queued_puts")->Get());
+  EXPECT_EQ(1, lru_cache_->num_elements());
+
+  // A Get of a queued key sees the queued value.
+  CheckGet("n2", "v2");
+  EXPECT_EQ(1, lru_cache_->num_elements());
+
+  ReleaseKey("n0");
+  WaitAndCheck(n0, "v0");
+  while (lru_cache_->num_elements() != 3) {
+    timer_->SleepMs(1);
+  }
+  EXPECT_EQ(3, lru_cache_->num_inserts());
+  CheckGet("n1", "v1");
+  CheckGet("n2", "v2");
+  CheckNotFound("n3");
+
+  // With nothing outstanding, Puts go straight through.
+  CheckPut("n4", "v4");
+  EXPECT_EQ(4, statistics_->GetVariable("cache_batcher_queued_puts")->Get());
+}
+
+TEST_F(CacheBatcherTest, DeleteIsNotOvertakenBySentPuts) {
+  DeleteDuringMultiPutCache delete_cache(delay_cache_.get());
+  batcher_.reset(new CacheBatcher(&delete_cache,
+                                  thread_system_->NewMutex(),
+                                  mock_timer_.get(),
+                                  statistics_.get()));
+  batcher_->set_max_parallel_lookups(1);
+
+  PopulateCache(1);
+
+  DelayKey("n0");
+  Callback* n0 = InitiateGet("n0");
+  CheckPut("n1", "v1");
+  CheckPut("n2", "v2");
+
+  // The Delete of "n1" lands while the queued Puts are on their way to the
+  // cache, so it must be sent after them rather than be undone by them.
+  delete_cache.DeleteDuringNextMultiPut(batcher_.get(), "n1");
+  ReleaseKey("n0");
+  WaitAndCheck(n0, "v0");
+  while (lru_cache_->num_inserts() != 3) {
+    timer_->SleepMs(1);
+  }
+  CheckNotFound("n1");
+  CheckGet("n2", "v2");
+  EXPECT_EQ(2, lru_cache_->num_elements());
+}
+
+TEST_F(CacheBatcherTest, FullPutQueueIsSent) {
+  batcher_->set_max_parallel_lookups(1);
+  batcher_->set_max_queue_size(2);
+
+  PopulateCache(1);
+
+  DelayKey("n0");
+  Callback* n0 = InitiateGet("n0");
+  CheckPut("n1", "v1");
+  EXPECT_EQ(1, lru_cache_->num_elements());
+  CheckPut("n2", "v2");
+  while (lru_cache_->num_elements() != 3) {
+    timer_->SleepMs(1);
+  }
+  ReleaseKey("n0");
+  WaitAndCheck(n0, "v0");
+}
+
+TEST_F(CacheBatcherTest, Adaptive) {
+  const int64 kTargetLatencyUs = 1000;
+  batcher_->set_max_parallel_lookups(4);
+  batcher_->set_max_batch_size(100);
+  batcher_->EnableAdaptiveMode(kTargetLatencyUs);
+  EXPECT_EQ(4, batcher_->parallel_lookups_limit());
+  EXPECT_EQ(100, batcher_->batch_size_limit());
+
+  PopulateCache(1);
+
+  // A slow lookup halves the limits.
+  DelayKey("n0");
+  Callback* n0 = InitiateGet("n0");
+  mock_timer_->AdvanceUs(2 * kTargetLatencyUs);
+  ReleaseKey("n0");
+  WaitAndCheck(n0, "v0");
+  EXPECT_EQ(2, batcher_->parallel_lookups_limit());
+  EXPECT_EQ(50, batcher_->batch_size_limit());
+
+  DelayKey("n0");
+  n0 = InitiateGet("n0");
+  mock_timer_->AdvanceUs(2 * kTargetLatencyUs);
+  ReleaseKey("n0");
+  WaitAndCheck(n0, "v0");
+  EXPECT_EQ(1, batcher_->parallel_lookups_limit());
+  EXPECT_EQ(25, batcher_->batch_size_limit());
+
+  // Fast lookups raise them again, additively, up to the maximums.
+  CheckGet("n0", "v0");
+  EXPECT_EQ(2, batcher_->parallel_lookups_limit());
+  EXPECT_EQ(25 + CacheBatcher::kAdaptiveBatchSizeIncrement,
+            batcher_->batch_size_limit());
+  for (int i = 0; i < 10; ++i) {
+    CheckGet("n0", "v0");
+  }
+  EXPECT_EQ(4, batcher_->parallel_lookups_limit());
+  EXPECT_EQ(100, batcher_->batch_size_limit());
+}
+
 }  // namespace net_instaweb
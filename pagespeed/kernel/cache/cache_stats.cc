@@ -18,6 +18,9 @@
 
 #include "pagespeed/kernel/cache/cache_stats.h"
 
+#include <vector>
+
+#include "base/logging.h"
 #include "pagespeed/kernel/base/shared_string.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/string.h"
@@ -97,9 +100,9 @@ void CacheStats::InitStats(StringPiece prefix, Statistics* statistics) {
       statistics->AddHistogram(StrCat(prefix, kLookupSizeHistogram));
   lookup_size_bytes_histogram->SetMaxValue(kSizeHistogramMaxValue);
   statistics->AddVariable(StrCat(prefix, kDeletes));
-  statistics->AddVariable(StrCat(prefix, kHits));
+  statistics->AddStripedVariable(StrCat(prefix, kHits));
   statistics->AddVariable(StrCat(prefix, kInserts));
-  statistics->AddVariable(StrCat(prefix, kMisses));
+  statistics->AddStripedVariable(StrCat(prefix, kMisses));
 }
 
 class CacheStats::StatsCallback : public DelegatingCacheCallback {
@@ -170,6 +173,64 @@ void CacheStats::Put(const GoogleString& key, SharedString* value) {
   }
 }
 
+void CacheStats::MultiPut(MultiPutRequest* request) {
+  if (shutdown_.value()) {
+    delete request;
+  } else {
+    int64 start_time_us = timer_->NowUs();
+    int n = request->size();
+    inserts_->Add(n);
+    for (int i = 0; i < n; ++i) {
+      insert_size_bytes_histogram_->Add((*request)[i].value.size());
+    }
+    cache_->MultiPut(request);
+
+    // Every key waited for the whole batch, so record its latency once per
+    // key, as if they had been separate Puts.
+    int64 latency_us = timer_->NowUs() - start_time_us;
+    for (int i = 0; i < n; ++i) {
+      insert_latency_us_histogram_->Add(latency_us);
+    }
+  }
+}
+
+void CacheStats::MultiPutThrough(const std::vector<CacheStats*>& caches,
+                                 MultiPutRequest* request) {
+  DCHECK_EQ(caches.size(), request->size());
+  if (caches.empty()) {
+    delete request;
+    return;
+  }
+  CacheInterface* cache = caches[0]->cache_;
+  int64 start_time_us = caches[0]->timer_->NowUs();
+
+  // Puts for caches that have been shut down are dropped, as in Put.
+  MultiPutRequest* sent_request = new MultiPutRequest;
+  std::vector<CacheStats*> sent_caches;
+  for (int i = 0, n = caches.size(); i < n; ++i) {
+    CacheStats* stats = caches[i];
+    DCHECK_EQ(cache, stats->cache_);
+    if (!stats->shutdown_.value()) {
+      KeyValue& key_value = (*request)[i];
+      stats->inserts_->Add(1);
+      stats->insert_size_bytes_histogram_->Add(key_value.value.size());
+      sent_request->push_back(key_value);
+      sent_caches.push_back(stats);
+    }
+  }
+  delete request;
+  if (sent_request->empty()) {
+    delete sent_request;
+    return;
+  }
+  cache->MultiPut(sent_request);
+
+  int64 latency_us = caches[0]->timer_->NowUs() - start_time_us;
+  for (int i = 0, n = sent_caches.size(); i < n; ++i) {
+    sent_caches[i]->insert_latency_us_histogram_->Add(latency_us);
+  }
+}
+
 void CacheStats::Delete(const GoogleString& key) {
   if (!shutdown_.value()) {
     deletes_->Add(1);
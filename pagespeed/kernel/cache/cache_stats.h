@@ -19,6 +19,8 @@
 #ifndef PAGESPEED_KERNEL_CACHE_CACHE_STATS_H_
 #define PAGESPEED_KERNEL_CACHE_CACHE_STATS_H_
 
+#include <vector>
+
 #include "pagespeed/kernel/base/atomic_bool.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/string.h"
@@ -52,6 +54,7 @@ class CacheStats : public CacheInterface {
   virtual void Get(const GoogleString& key, Callback* callback);
   virtual void MultiGet(MultiGetRequest* request);
   virtual void Put(const GoogleString& key, SharedString* value);
+  virtual void MultiPut(MultiPutRequest* request);
   virtual void Delete(const GoogleString& key);
   virtual CacheInterface* Backend() { return cache_; }
   virtual bool IsBlocking() const { return cache_->IsBlocking(); }
@@ -70,6 +73,15 @@ class CacheStats : public CacheInterface {
   }
   static GoogleString FormatName(StringPiece prefix, StringPiece cache);
 
+  // Sends the Puts in request to the backend wrapped by all of caches as one
+  // MultiPut, counting (*request)[i] as an insert into caches[i].  This lets
+  // CacheStats that share a backend, such as those of the property cache
+  // cohorts, keep separate statistics without giving up batched writes.
+  //
+  // Ownership of the request is transferred to this function.
+  static void MultiPutThrough(const std::vector<CacheStats*>& caches,
+                              MultiPutRequest* request);
+
  private:
   class StatsCallback;
   friend class StatsCallback;
@@ -88,17 +88,27 @@ TEST_F(CacheStatsTest, BasicOperation) {
   cache_stats_->Delete("key");
   EXPECT_EQ(1, stats_.GetVariable("test_deletes")->Get());
 
-  // TODO(jmarantz): we do not currently have a functional histogram
-  // implementation in SimpleStats, so we cannot conveniently test it.
-  // It is feasible we could mock it.  Note that this makes the
-  // instantiation of MockTimer and DelayCache in this test file sort
-  // of pointless, but are left here for convenience on follow-up.
-  //
-  // It should be possible to use SharedMemHistogram, we just need an
-  // in-process version of SharedMemSystem.
-  //
-  // Histogram* latency = stats_.GetHistogram("test_hit_latency_us");
-  // EXPECT_EQ(1, latency->Count());
+  // The MockTimer never moves, so the latencies are all 0.
+  Histogram* latency = stats_.GetHistogram("test_hit_latency_us");
+  EXPECT_EQ(1, latency->Count());
+  EXPECT_EQ(0, latency->Maximum());
+  EXPECT_EQ(2, stats_.GetHistogram("test_get_count")->Count());
+  EXPECT_EQ(3, stats_.GetHistogram("test_insert_size_bytes")->Average());
+  EXPECT_EQ(3, stats_.GetHistogram("test_lookup_size_bytes")->Average());
+}
+
+TEST_F(CacheStatsTest, MultiPut) {
+  CacheInterface::MultiPutRequest* request =
+      new CacheInterface::MultiPutRequest;
+  request->push_back(CacheInterface::KeyValue("key1", SharedString("val1")));
+  request->push_back(CacheInterface::KeyValue("key2", SharedString("val2")));
+  cache_stats_->MultiPut(request);
+  EXPECT_EQ(2, stats_.GetVariable("test_inserts")->Get());
+  EXPECT_EQ(2, stats_.GetHistogram("test_insert_latency_us")->Count());
+  CacheTestBase::Callback callback;
+  cache_stats_->Get("key2", &callback);
+  EXPECT_EQ(CacheInterface::kAvailable, callback.state());
+  EXPECT_EQ(GoogleString("val2"), callback.value()->Value());
 }
 
 TEST_F(CacheStatsTest, Backend) {
@@ -212,6 +212,23 @@ class CacheTestBase : public testing::Test {
     WaitAndCheck(n1, "v1");
   }
 
+  // Writes keys in pattern n0 n1 n2... with values v0 v1 v2... using
+  // a single MultiPut, and checks they can all be read back.
+  void TestMultiPut(int num) {
+    CacheInterface::MultiPutRequest* request =
+        new CacheInterface::MultiPutRequest;
+    for (int i = 0; i < num; ++i) {
+      request->push_back(CacheInterface::KeyValue(
+          StringPrintf("n%d", i), SharedString(StringPrintf("v%d", i))));
+    }
+    Cache()->MultiPut(request);
+    PostOpCleanup();
+    for (int i = 0; i < num; ++i) {
+      CheckGet(StringPrintf("n%d", i), StringPrintf("v%d", i));
+    }
+    CheckNotFound(StringPrintf("n%d", num).c_str());
+  }
+
   // Populates the cache with keys in pattern n0 n1 n2 n3...
   // and values in pattern v0 v1 v2 v3...
   void PopulateCache(int num) {
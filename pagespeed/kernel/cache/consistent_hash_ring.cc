@@ -0,0 +1,97 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pagespeed/kernel/cache/consistent_hash_ring.h"
+
+#include <algorithm>
+
+#include "pagespeed/kernel/base/md5_hasher.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// Each MD5 digest yields four 32-bit points.
+const int kPointsPerDigest = 4;
+
+}  // namespace
+
+const int ConsistentHashRing::kPointsPerServer;
+
+ConsistentHashRing::ConsistentHashRing(const StringVector& server_names)
+    : num_servers_(server_names.size()) {
+  MD5Hasher hasher;
+  points_.reserve(num_servers_ * kPointsPerServer);
+  for (int server = 0; server < num_servers_; ++server) {
+    for (int i = 0; i < kPointsPerServer / kPointsPerDigest; ++i) {
+      GoogleString digest = hasher.RawHash(
+          StrCat(server_names[server], "-", IntegerToString(i)));
+      const unsigned char* bytes =
+          reinterpret_cast<const unsigned char*>(digest.data());
+      for (int j = 0; j < kPointsPerDigest; ++j) {
+        const unsigned char* b = bytes + 4 * j;
+        uint32 hash = (static_cast<uint32>(b[3]) << 24) |
+            (static_cast<uint32>(b[2]) << 16) |
+            (static_cast<uint32>(b[1]) << 8) |
+            static_cast<uint32>(b[0]);
+        points_.push_back(Point(hash, server));
+      }
+    }
+  }
+  // Ties are broken by server index so the ring doesn't depend on the
+  // sort's handling of equal elements.
+  std::sort(points_.begin(), points_.end());
+}
+
+ConsistentHashRing::~ConsistentHashRing() {
+}
+
+int ConsistentHashRing::FirstPointIndex(uint32 hash) const {
+  PointVector::const_iterator iter = std::lower_bound(
+      points_.begin(), points_.end(), Point(hash, 0));
+  if (iter == points_.end()) {
+    return 0;  // Wrap around.
+  }
+  return iter - points_.begin();
+}
+
+int ConsistentHashRing::ServerForHash(uint32 hash) const {
+  if (points_.empty()) {
+    return -1;
+  }
+  return points_[FirstPointIndex(hash)].second;
+}
+
+void ConsistentHashRing::ServersForHash(uint32 hash, int max_servers,
+                                        std::vector<int>* servers) const {
+  servers->clear();
+  if (points_.empty()) {
+    return;
+  }
+  max_servers = std::min(max_servers, num_servers_);
+  servers->reserve(max_servers);
+  for (int i = FirstPointIndex(hash), n = 0;
+       n < num_points() && static_cast<int>(servers->size()) < max_servers;
+       ++n, i = NextPointIndex(i)) {
+    int server = ServerAtPoint(i);
+    if (std::find(servers->begin(), servers->end(), server) ==
+        servers->end()) {
+      servers->push_back(server);
+    }
+  }
+}
+
+}  // namespace net_instaweb
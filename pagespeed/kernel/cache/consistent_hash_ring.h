@@ -0,0 +1,86 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_CACHE_CONSISTENT_HASH_RING_H_
+#define PAGESPEED_KERNEL_CACHE_CONSISTENT_HASH_RING_H_
+
+#include <utility>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+// Maps 32-bit key hashes onto a set of servers so that adding or removing
+// a server only moves about 1/N of the keys, rather than reshuffling
+// nearly all of them as hash-modulo-N does.
+//
+// Each server is placed at kPointsPerServer pseudo-random points on a
+// ring of 32-bit hashes, computed from the MD5 of its name the way
+// libketama does.  A key belongs to the server owning the first point at
+// or after the key's hash, wrapping around.  Callers choose the key hash;
+// AprMemCache uses crc32 rather than ketama's MD5, so its key placement
+// does not match other ketama clients even with the same server names.
+class ConsistentHashRing {
+ public:
+  static const int kPointsPerServer = 160;
+
+  // server_names identifies the servers, e.g. "host:port".  The index of
+  // a name in the vector is the index returned for that server.
+  explicit ConsistentHashRing(const StringVector& server_names);
+  ~ConsistentHashRing();
+
+  int num_servers() const { return num_servers_; }
+
+  // Returns the index of the server that owns hash, or -1 if there are
+  // no servers.
+  int ServerForHash(uint32 hash) const;
+
+  // Fills *servers with up to max_servers distinct server indices in the
+  // order they are met walking the ring from hash.  The first is
+  // ServerForHash(hash); each later one is the server that would take
+  // over the key if all the ones before it were removed, which makes
+  // them the natural places to put replicas.
+  void ServersForHash(uint32 hash, int max_servers,
+                      std::vector<int>* servers) const;
+
+  // For callers that walk the ring themselves, e.g. to skip servers as
+  // they go: the walk for hash starts at point FirstPointIndex(hash) and
+  // continues with NextPointIndex until it has visited num_points().
+  // Servers own many points, so a walk meets each one many times.  These
+  // must not be called on a ring with no servers.
+  int num_points() const { return points_.size(); }
+  int FirstPointIndex(uint32 hash) const;
+  int NextPointIndex(int point_index) const {
+    return (point_index + 1 == num_points()) ? 0 : point_index + 1;
+  }
+  int ServerAtPoint(int point_index) const {
+    return points_[point_index].second;
+  }
+
+ private:
+  typedef std::pair<uint32, int> Point;  // (hash, server index)
+  typedef std::vector<Point> PointVector;
+
+  int num_servers_;
+  PointVector points_;  // Sorted by hash.
+
+  DISALLOW_COPY_AND_ASSIGN(ConsistentHashRing);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_CACHE_CONSISTENT_HASH_RING_H_
@@ -0,0 +1,142 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Unit-test the consistent hash ring.
+#include "pagespeed/kernel/cache/consistent_hash_ring.h"
+
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const int kNumKeys = 20000;
+
+class ConsistentHashRingTest : public testing::Test {
+ protected:
+  // Returns names host0:11211, host1:11211, ...
+  static StringVector ServerNames(int num_servers) {
+    StringVector names;
+    for (int i = 0; i < num_servers; ++i) {
+      names.push_back(StrCat("host", IntegerToString(i), ":11211"));
+    }
+    return names;
+  }
+
+  // Spreads key hashes over the whole 32-bit range.
+  static uint32 KeyHash(int key) {
+    return static_cast<uint32>(key) * 2654435761U;
+  }
+};
+
+TEST_F(ConsistentHashRingTest, Empty) {
+  ConsistentHashRing ring((StringVector()));
+  EXPECT_EQ(0, ring.num_servers());
+  EXPECT_EQ(-1, ring.ServerForHash(42));
+  std::vector<int> servers;
+  ring.ServersForHash(42, 2, &servers);
+  EXPECT_TRUE(servers.empty());
+}
+
+TEST_F(ConsistentHashRingTest, OneServer) {
+  ConsistentHashRing ring(ServerNames(1));
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(0, ring.ServerForHash(KeyHash(i)));
+  }
+  EXPECT_EQ(0, ring.ServerForHash(0));
+  EXPECT_EQ(0, ring.ServerForHash(kuint32max));
+}
+
+TEST_F(ConsistentHashRingTest, Balanced) {
+  const int kNumServers = 4;
+  ConsistentHashRing ring(ServerNames(kNumServers));
+  std::vector<int> counts(kNumServers, 0);
+  for (int i = 0; i < kNumKeys; ++i) {
+    ++counts[ring.ServerForHash(KeyHash(i))];
+  }
+  for (int i = 0; i < kNumServers; ++i) {
+    EXPECT_LT(kNumKeys * 15 / 100, counts[i]) << i;
+    EXPECT_GT(kNumKeys * 35 / 100, counts[i]) << i;
+  }
+}
+
+TEST_F(ConsistentHashRingTest, AddingServerMovesFewKeys) {
+  ConsistentHashRing ring4(ServerNames(4));
+  ConsistentHashRing ring5(ServerNames(5));
+  int moved = 0;
+  for (int i = 0; i < kNumKeys; ++i) {
+    int before = ring4.ServerForHash(KeyHash(i));
+    int after = ring5.ServerForHash(KeyHash(i));
+    if (before != after) {
+      // Keys only ever move to the new server.
+      EXPECT_EQ(4, after);
+      ++moved;
+    }
+  }
+  // Ideally 1/5 of the keys move; with hash-modulo-N it would be 4/5.
+  EXPECT_LT(kNumKeys * 10 / 100, moved);
+  EXPECT_GT(kNumKeys * 30 / 100, moved);
+}
+
+TEST_F(ConsistentHashRingTest, RemovingServerOnlyMovesItsKeys) {
+  StringVector names = ServerNames(5);
+  ConsistentHashRing ring(names);
+  StringVector fewer_names(names);
+  fewer_names.erase(fewer_names.begin() + 2);
+  ConsistentHashRing smaller_ring(fewer_names);
+  for (int i = 0; i < kNumKeys; ++i) {
+    uint32 hash = KeyHash(i);
+    const GoogleString& before = names[ring.ServerForHash(hash)];
+    const GoogleString& after = fewer_names[smaller_ring.ServerForHash(hash)];
+    if (before != names[2]) {
+      EXPECT_EQ(before, after) << i;
+    }
+  }
+}
+
+TEST_F(ConsistentHashRingTest, ServersForHash) {
+  StringVector names = ServerNames(5);
+  ConsistentHashRing ring(names);
+  for (int i = 0; i < 1000; ++i) {
+    uint32 hash = KeyHash(i);
+    std::vector<int> servers;
+    ring.ServersForHash(hash, 3, &servers);
+    ASSERT_EQ(3, servers.size());
+    EXPECT_EQ(ring.ServerForHash(hash), servers[0]);
+    EXPECT_NE(servers[0], servers[1]);
+    EXPECT_NE(servers[0], servers[2]);
+    EXPECT_NE(servers[1], servers[2]);
+
+    // The second server is where the key goes when the first is removed.
+    StringVector fewer_names(names);
+    fewer_names.erase(fewer_names.begin() + servers[0]);
+    ConsistentHashRing smaller_ring(fewer_names);
+    EXPECT_EQ(names[servers[1]],
+              fewer_names[smaller_ring.ServerForHash(hash)]);
+  }
+
+  // Asking for more servers than there are returns each once.
+  std::vector<int> servers;
+  ring.ServersForHash(KeyHash(7), 10, &servers);
+  EXPECT_EQ(5, servers.size());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
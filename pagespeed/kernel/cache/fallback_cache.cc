@@ -136,14 +136,18 @@ void FallbackCache::MultiGet(MultiGetRequest* request) {
   small_object_cache_->MultiGet(request);
 }
 
-void FallbackCache::Put(const GoogleString& key, SharedString* value) {
-  int store_size = value->size();
+bool FallbackCache::IsLargeObject(const GoogleString& key,
+                                  const SharedString& value) const {
+  int store_size = value.size();
   if (account_for_key_size_) {
     store_size += static_cast<int>(key.size());
   }
   store_size += 1;  // For kInSmallObjectCache marker.
+  return store_size > threshold_bytes_;
+}
 
-  if (store_size > threshold_bytes_) {
+void FallbackCache::Put(const GoogleString& key, SharedString* value) {
+  if (IsLargeObject(key, *value)) {
     SharedString forwarding_value;
     forwarding_value.Assign(&kInLargeObjectCache, 1);
     small_object_cache_->Put(key, &forwarding_value);
@@ -155,6 +159,27 @@ void FallbackCache::Put(const GoogleString& key, SharedString* value) {
   }
 }
 
+void FallbackCache::MultiPut(MultiPutRequest* request) {
+  // All the markers and small objects go to small_object_cache_ in one
+  // MultiPut; large objects are put individually.
+  MultiPutRequest* small_request = new MultiPutRequest;
+  small_request->reserve(request->size());
+  for (int i = 0, n = request->size(); i < n; ++i) {
+    KeyValue* key_value = &(*request)[i];
+    if (IsLargeObject(key_value->key, key_value->value)) {
+      SharedString forwarding_value;
+      forwarding_value.Assign(&kInLargeObjectCache, 1);
+      small_request->push_back(KeyValue(key_value->key, forwarding_value));
+      large_object_cache_->Put(key_value->key, &key_value->value);
+    } else {
+      small_request->push_back(*key_value);
+      small_request->back().value.Append(&kInSmallObjectCache, 1);
+    }
+  }
+  delete request;
+  small_object_cache_->MultiPut(small_request);
+}
+
 void FallbackCache::Delete(const GoogleString& key) {
   small_object_cache_->Delete(key);
   large_object_cache_->Delete(key);
@@ -53,6 +53,7 @@ class FallbackCache : public CacheInterface {
   virtual void Put(const GoogleString& key, SharedString* value);
   virtual void Delete(const GoogleString& key);
   virtual void MultiGet(MultiGetRequest* request);
+  virtual void MultiPut(MultiPutRequest* request);
   virtual bool IsBlocking() const {
     // We can fulfill our guarantee only if both caches block.
     return (small_object_cache_->IsBlocking() &&
@@ -79,6 +80,9 @@ class FallbackCache : public CacheInterface {
   void set_account_for_key_size(bool x) { account_for_key_size_ = x; }
 
  private:
+  // Whether value is too big to store in small_object_cache_.
+  bool IsLargeObject(const GoogleString& key, const SharedString& value) const;
+
   void DecodeValueMatchingKeyAndCallCallback(
       const GoogleString& key, const char* data, size_t data_len,
       Callback* callback);
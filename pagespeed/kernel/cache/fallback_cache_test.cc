@@ -193,6 +193,25 @@ TEST_F(FallbackCacheTest, LargeValueMultiGet) {
   WaitAndCheck(large2, kLargeValue2);
 }
 
+TEST_F(FallbackCacheTest, MultiPut) {
+  TestMultiPut(3);
+  EXPECT_EQ(0, large_cache_.size_bytes()) << "fallback not used.";
+}
+
+TEST_F(FallbackCacheTest, LargeValueMultiPut) {
+  const GoogleString kLargeValue(kLargeWriteSize, 'a');
+  CacheInterface::MultiPutRequest* request =
+      new CacheInterface::MultiPutRequest;
+  request->push_back(CacheInterface::KeyValue("small", SharedString("value")));
+  request->push_back(CacheInterface::KeyValue(kLargeKey1,
+                                              SharedString(kLargeValue)));
+  Cache()->MultiPut(request);
+  EXPECT_EQ(kLargeWriteSize + STATIC_STRLEN(kLargeKey1),
+            large_cache_.size_bytes());
+  CheckGet("small", "value");
+  CheckGet(kLargeKey1, kLargeValue);
+}
+
 TEST_F(FallbackCacheTest, MultiLargeSharingSmall) {
   // Make another connection to the same small_cache_, but with a different
   // large_ cache.
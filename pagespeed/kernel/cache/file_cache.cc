@@ -22,6 +22,8 @@
 #include <vector>
 
 #include "base/logging.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/atomic_bool.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/file_system.h"
 #include "pagespeed/kernel/base/function.h"
@@ -32,16 +34,26 @@
 #include "pagespeed/kernel/base/shared_string.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_hash.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/cache/cache_interface.h"
+#include "pagespeed/kernel/cache/file_cache_index.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
 #include "pagespeed/kernel/thread/slow_worker.h"
 #include "pagespeed/kernel/util/url_to_filename_encoder.h"
 
 namespace net_instaweb {
 
-namespace {  // For structs used only in Clean().
+namespace {
+
+const int kLatencyHistogramMaxValueUs = 1000 * 1000;
 
+// How soon to clean again when a clean from the index stopped at
+// max_evictions_per_clean while the cache was still over its targets.
+const int64 kIncrementalCleanDelayMs = 10 * Timer::kSecondMs;
+
+// Used only in Clean().
 struct CompareByAtime {
  public:
   // Sort by ascending atime.
@@ -70,18 +82,48 @@ class FileCache::CacheCleanFunction : public Function {
   DISALLOW_COPY_AND_ASSIGN(CacheCleanFunction);
 };
 
+// Runs the file operations of a FileCache in the calling thread.
+class FileCache::BlockingCache : public CacheInterface {
+ public:
+  explicit BlockingCache(FileCache* cache) : cache_(cache) {}
+  virtual ~BlockingCache() {}
+
+  virtual void Get(const GoogleString& key, Callback* callback) {
+    cache_->GetNow(key, callback);
+  }
+  virtual void Put(const GoogleString& key, SharedString* value) {
+    cache_->PutNow(key, value);
+  }
+  virtual void Delete(const GoogleString& key) { cache_->DeleteNow(key); }
+  virtual CacheInterface* Backend() { return cache_; }
+  virtual GoogleString Name() const { return cache_->Name(); }
+  virtual bool IsBlocking() const { return true; }
+  virtual bool IsHealthy() const { return true; }
+  virtual void ShutDown() {}
+
+ private:
+  FileCache* cache_;
+  DISALLOW_COPY_AND_ASSIGN(BlockingCache);
+};
+
 const char FileCache::kBytesFreedInCleanup[] =
     "file_cache_bytes_freed_in_cleanup";
 const char FileCache::kCleanups[] = "file_cache_cleanups";
 const char FileCache::kDiskChecks[] = "file_cache_disk_checks";
 const char FileCache::kEvictions[] = "file_cache_evictions";
 const char FileCache::kWriteErrors[] = "file_cache_write_errors";
+const char FileCache::kGetLatencyHistogram[] = "file_cache_get_latency_us";
+const char FileCache::kPutLatencyHistogram[] = "file_cache_put_latency_us";
+const char FileCache::kDeleteLatencyHistogram[] =
+    "file_cache_delete_latency_us";
 
 // Filenames for the next scheduled clean time and the lockfile.  In
 // order to prevent these from colliding with actual cachefiles, they
 // contain characters that our filename encoder would escape.
 const char FileCache::kCleanTimeName[] = "!clean!time!";
 const char FileCache::kCleanLockName[] = "!clean!lock!";
+const char FileCache::kCleanIndexName[] = "!clean!index!";
+const char FileCache::kReservedFilePrefix[] = "!reserved!";
 
 // TODO(abliss): remove policy from constructor; provide defaults here
 // and setters below.
@@ -98,16 +140,28 @@ FileCache::FileCache(const GoogleString& path, FileSystem* file_system,
       path_length_limit_(file_system_->MaxPathLength(path)),
       clean_time_path_(path),
       clean_lock_path_(path),
+      clean_index_path_(path),
+      reserved_path_prefix_(path),
+      more_to_clean_(false),
       disk_checks_(stats->GetVariable(kDiskChecks)),
       cleanups_(stats->GetVariable(kCleanups)),
       evictions_(stats->GetVariable(kEvictions)),
       bytes_freed_in_cleanup_(stats->GetVariable(kBytesFreedInCleanup)),
-      write_errors_(stats->GetVariable(kWriteErrors)) {
+      write_errors_(stats->GetVariable(kWriteErrors)),
+      get_latency_us_histogram_(stats->GetHistogram(kGetLatencyHistogram)),
+      put_latency_us_histogram_(stats->GetHistogram(kPutLatencyHistogram)),
+      delete_latency_us_histogram_(
+          stats->GetHistogram(kDeleteLatencyHistogram)) {
   next_clean_ms_ = policy->timer->NowMs() + policy->clean_interval_ms / 2;
   EnsureEndsInSlash(&clean_time_path_);
   StrAppend(&clean_time_path_, kCleanTimeName);
   EnsureEndsInSlash(&clean_lock_path_);
   StrAppend(&clean_lock_path_, kCleanLockName);
+  EnsureEndsInSlash(&clean_index_path_);
+  StrAppend(&clean_index_path_, kCleanIndexName);
+  EnsureEndsInSlash(&reserved_path_prefix_);
+  StrAppend(&reserved_path_prefix_, kReservedFilePrefix);
+  blocking_cache_.reset(new BlockingCache(this));
 }
 
 FileCache::~FileCache() {
@@ -119,9 +173,128 @@ void FileCache::InitStats(Statistics* statistics) {
   statistics->AddVariable(kDiskChecks);
   statistics->AddVariable(kEvictions);
   statistics->AddVariable(kWriteErrors);
+  statistics->AddHistogram(kGetLatencyHistogram)->SetMaxValue(
+      kLatencyHistogramMaxValueUs);
+  statistics->AddHistogram(kPutLatencyHistogram)->SetMaxValue(
+      kLatencyHistogramMaxValueUs);
+  statistics->AddHistogram(kDeleteLatencyHistogram)->SetMaxValue(
+      kLatencyHistogramMaxValueUs);
+}
+
+void FileCache::SetIoPool(QueuedWorkerPool* pool, int num_sequences) {
+  io_sequences_.clear();
+  for (int i = 0; i < num_sequences; ++i) {
+    QueuedWorkerPool::Sequence* sequence = pool->NewSequence();
+    if (sequence == NULL) {
+      break;  // The pool is shutting down.
+    }
+    sequence->set_max_queue_size(kMaxQueueSize);
+    io_sequences_.push_back(sequence);
+  }
+}
+
+void FileCache::EnableIndex(AbstractMutex* mutex) {
+  DCHECK(index_.get() == NULL);
+  index_.reset(new FileCacheIndex(clean_index_path_, file_system_, mutex,
+                                  message_handler_));
+}
+
+StringPiece FileCache::IndexName(const GoogleString& filename) const {
+  StringPiece name(filename);
+  // All our files are under path_, which may or may not end in a slash.
+  name.remove_prefix(std::min(name.size(), path_.size()));
+  if (name.starts_with("/")) {
+    name.remove_prefix(1);
+  }
+  return name;
+}
+
+bool FileCache::IsCleanFile(const GoogleString& filename) const {
+  return (clean_time_path_ == filename || clean_lock_path_ == filename ||
+          StringPiece(filename).starts_with(clean_index_path_) ||
+          IsReservedFile(filename));
+}
+
+bool FileCache::IsReservedFile(const GoogleString& filename) const {
+  return StringPiece(filename).starts_with(reserved_path_prefix_);
+}
+
+int FileCache::SequenceIndex(const GoogleString& key) const {
+  return HashString<CasePreserve, size_t>(key.data(), key.size()) %
+      io_sequences_.size();
 }
 
 void FileCache::Get(const GoogleString& key, Callback* callback) {
+  if (io_sequences_.empty()) {
+    GetNow(key, callback);
+  } else if (stopped_.value()) {
+    ValidateAndReportResult(key, kNotFound, callback);
+  } else {
+    io_sequences_[SequenceIndex(key)]->Add(
+        MakeFunction(this, &FileCache::GetInSequence, &FileCache::CancelGet,
+                     new GoogleString(key), callback));
+  }
+}
+
+void FileCache::MultiGet(MultiGetRequest* request) {
+  if (io_sequences_.empty()) {
+    CacheInterface::MultiGet(request);
+    return;
+  }
+  if (stopped_.value()) {
+    ReportMultiGetNotFound(request);
+    return;
+  }
+
+  // Give each sequence the part of the request for the keys it handles, so
+  // they are all read in parallel.
+  std::vector<MultiGetRequest*> parts(io_sequences_.size(), NULL);
+  for (int i = 0, n = request->size(); i < n; ++i) {
+    KeyCallback& key_callback = (*request)[i];
+    MultiGetRequest*& part = parts[SequenceIndex(key_callback.key)];
+    if (part == NULL) {
+      part = new MultiGetRequest;
+    }
+    part->push_back(key_callback);
+  }
+  delete request;
+  for (int i = 0, n = parts.size(); i < n; ++i) {
+    if (parts[i] != NULL) {
+      io_sequences_[i]->Add(
+          MakeFunction(this, &FileCache::MultiGetInSequence,
+                       &FileCache::CancelMultiGet, parts[i]));
+    }
+  }
+}
+
+void FileCache::GetInSequence(GoogleString* key, Callback* callback) {
+  if (stopped_.value()) {
+    CancelGet(key, callback);
+  } else {
+    GetNow(*key, callback);
+    delete key;
+  }
+}
+
+void FileCache::CancelGet(GoogleString* key, Callback* callback) {
+  ValidateAndReportResult(*key, kNotFound, callback);
+  delete key;
+}
+
+void FileCache::MultiGetInSequence(MultiGetRequest* request) {
+  if (stopped_.value()) {
+    CancelMultiGet(request);
+  } else {
+    CacheInterface::MultiGet(request);
+  }
+}
+
+void FileCache::CancelMultiGet(MultiGetRequest* request) {
+  ReportMultiGetNotFound(request);
+}
+
+void FileCache::GetNow(const GoogleString& key, Callback* callback) {
+  int64 start_us = cache_policy_->timer->NowUs();
   GoogleString filename;
   bool ret = EncodeFilename(key, &filename);
   if (ret) {
@@ -133,27 +306,97 @@ void FileCache::Get(const GoogleString& key, Callback* callback) {
     GoogleString buf;
     ret = file_system_->ReadFile(filename.c_str(), &buf, &null_handler);
     callback->value()->SwapWithString(&buf);
+    if (ret && index_.get() != NULL) {
+      index_->RecordAccess(IndexName(filename),
+                           cache_policy_->timer->NowMs() / Timer::kSecondMs);
+    }
   }
+  get_latency_us_histogram_->Add(cache_policy_->timer->NowUs() - start_us);
   ValidateAndReportResult(key, ret ? kAvailable : kNotFound, callback);
 }
 
 void FileCache::Put(const GoogleString& key, SharedString* value) {
+  if (io_sequences_.empty()) {
+    PutNow(key, value);
+  } else if (!stopped_.value()) {
+    io_sequences_[SequenceIndex(key)]->Add(
+        MakeFunction(this, &FileCache::PutInSequence, &FileCache::CancelPut,
+                     new GoogleString(key), new SharedString(*value)));
+  }
+}
+
+void FileCache::PutInSequence(GoogleString* key, SharedString* value) {
+  if (!stopped_.value()) {
+    PutNow(*key, value);
+  }
+  delete key;
+  delete value;
+}
+
+void FileCache::CancelPut(GoogleString* key, SharedString* value) {
+  delete key;
+  delete value;
+}
+
+void FileCache::PutNow(const GoogleString& key, SharedString* value) {
+  int64 start_us = cache_policy_->timer->NowUs();
   GoogleString filename;
-  if (EncodeFilename(key, &filename) &&
-      !file_system_->WriteFileAtomic(filename, value->Value(),
-                                     message_handler_)) {
-    write_errors_->Add(1);
+  if (EncodeFilename(key, &filename)) {
+    if (!file_system_->WriteFileAtomic(filename, value->Value(),
+                                       message_handler_)) {
+      write_errors_->Add(1);
+    } else if (index_.get() != NULL) {
+      index_->RecordPut(IndexName(filename), value->size(),
+                        cache_policy_->timer->NowMs() / Timer::kSecondMs);
+    }
   }
+  put_latency_us_histogram_->Add(cache_policy_->timer->NowUs() - start_us);
   CleanIfNeeded();
 }
 
 void FileCache::Delete(const GoogleString& key) {
+  if (io_sequences_.empty()) {
+    DeleteNow(key);
+  } else if (!stopped_.value()) {
+    io_sequences_[SequenceIndex(key)]->Add(
+        MakeFunction(this, &FileCache::DeleteInSequence,
+                     &FileCache::CancelDelete, new GoogleString(key)));
+  }
+}
+
+void FileCache::DeleteInSequence(GoogleString* key) {
+  if (!stopped_.value()) {
+    DeleteNow(*key);
+  }
+  delete key;
+}
+
+void FileCache::CancelDelete(GoogleString* key) {
+  delete key;
+}
+
+void FileCache::DeleteNow(const GoogleString& key) {
   GoogleString filename;
   if (!EncodeFilename(key, &filename)) {
     return;
   }
+  int64 start_us = cache_policy_->timer->NowUs();
   NullMessageHandler null_handler;  // Do not emit messages on delete failures.
-  file_system_->RemoveFile(filename.c_str(), &null_handler);
+  if (file_system_->RemoveFile(filename.c_str(), &null_handler) &&
+      index_.get() != NULL) {
+    index_->RecordDelete(IndexName(filename));
+  }
+  delete_latency_us_histogram_->Add(cache_policy_->timer->NowUs() - start_us);
+}
+
+void FileCache::ShutDown() {
+  stopped_.set_value(true);
+  for (int i = 0, n = io_sequences_.size(); i < n; ++i) {
+    io_sequences_[i]->CancelPendingFunctions();
+  }
+  if (index_.get() != NULL) {
+    index_->Flush();
+  }
 }
 
 bool FileCache::EncodeFilename(const GoogleString& key,
@@ -183,6 +426,15 @@ const int64 kEmptyDirCleanAgeSec = 60;
 }  // namespace
 
 bool FileCache::Clean(int64 target_size_bytes, int64 target_inode_count) {
+  more_to_clean_ = false;
+  if (index_.get() != NULL) {
+    bool everything_ok;
+    if (CleanWithIndex(target_size_bytes, target_inode_count,
+                       &everything_ok)) {
+      return everything_ok;
+    }
+  }
+
   // TODO(jud): this function can delete .lock and .outputlock files, is this
   // problematic?
   message_handler_->Message(kInfo,
@@ -202,6 +454,13 @@ bool FileCache::Clean(int64 target_size_bytes, int64 target_inode_count) {
   // target_inode_count of 0 indicates no inode limit.
   int64 cache_size = dir_info.size_bytes;
   int64 cache_inode_count = dir_info.inode_count;
+  for (int i = 0, n = dir_info.files.size(); i < n; ++i) {
+    const FileSystem::FileInfo& file = dir_info.files[i];
+    if (IsReservedFile(file.name)) {
+      cache_size -= file.size_bytes;
+      --cache_inode_count;
+    }
+  }
   if (cache_size < target_size_bytes &&
       (target_inode_count == 0 ||
        cache_inode_count < target_inode_count)) {
@@ -210,6 +469,9 @@ bool FileCache::Clean(int64 target_size_bytes, int64 target_inode_count) {
                               "no cleanup needed.",
                               Integer64ToString(cache_size).c_str(),
                               Integer64ToString(cache_inode_count).c_str());
+    if (index_.get() != NULL) {
+      RebuildIndex(dir_info.files.begin(), dir_info.files.end());
+    }
     return true;
   }
 
@@ -263,8 +525,7 @@ bool FileCache::Clean(int64 target_size_bytes, int64 target_inode_count) {
     // newest files (and very small) so they would normally not be deleted
     // anyway. But on some systems (e.g. mounted noatime?) they were getting
     // deleted.
-    if (clean_time_path_.compare(file.name) == 0 ||
-        clean_lock_path_.compare(file.name) == 0) {
+    if (IsCleanFile(file.name)) {
       continue;
     }
     cache_size -= file.size_bytes;
@@ -275,6 +536,9 @@ bool FileCache::Clean(int64 target_size_bytes, int64 target_inode_count) {
                                               message_handler_);
     evictions_->Add(1);
   }
+  if (index_.get() != NULL) {
+    RebuildIndex(file_itr, dir_info.files.end());
+  }
 
   int64 bytes_freed = orig_cache_size - cache_size;
   message_handler_->Message(kInfo,
@@ -284,6 +548,95 @@ bool FileCache::Clean(int64 target_size_bytes, int64 target_inode_count) {
   return everything_ok;
 }
 
+bool FileCache::CleanWithIndex(int64 target_size_bytes,
+                               int64 target_inode_count,
+                               bool* everything_ok) {
+  int64 cache_size, cache_file_count;
+  if (!index_->StartClean(&cache_size, &cache_file_count)) {
+    message_handler_->Message(kInfo,
+                              "No file cache index in %s; walking the cache.",
+                              clean_index_path_.c_str());
+    return false;
+  }
+
+  message_handler_->Message(kInfo,
+                            "Checking indexed cache size against target %s "
+                            "and file count against target %s",
+                            Integer64ToString(target_size_bytes).c_str(),
+                            Integer64ToString(target_inode_count).c_str());
+  disk_checks_->Add(1);
+  *everything_ok = true;
+
+  if (cache_size < target_size_bytes &&
+      (target_inode_count == 0 || cache_file_count < target_inode_count)) {
+    message_handler_->Message(kInfo,
+                              "File cache size is %s and contains %s files; "
+                              "no cleanup needed.",
+                              Integer64ToString(cache_size).c_str(),
+                              Integer64ToString(cache_file_count).c_str());
+    index_->FinishClean();  // Folds the journal into the snapshot.
+    return true;
+  }
+
+  message_handler_->Message(kInfo,
+                            "File cache size is %s and contains %s files; "
+                            "beginning cleanup.",
+                            Integer64ToString(cache_size).c_str(),
+                            Integer64ToString(cache_file_count).c_str());
+  cleanups_->Add(1);
+  int64 orig_cache_size = cache_size;
+  target_size_bytes = (target_size_bytes * 3) / 4;
+  target_inode_count = (target_inode_count * 3) / 4;
+
+  GoogleString prefix = path_;
+  EnsureEndsInSlash(&prefix);
+  const int64 max_evictions = cache_policy_->max_evictions_per_clean;
+  int64 num_evictions = 0;
+  NullMessageHandler null_handler;
+  GoogleString victim;
+  int64 victim_size;
+  while (cache_size > target_size_bytes ||
+         (target_inode_count != 0 && cache_file_count > target_inode_count)) {
+    if (max_evictions != 0 && num_evictions == max_evictions) {
+      more_to_clean_ = true;
+      break;
+    }
+    if (!index_->PopOldest(&victim, &victim_size)) {
+      break;
+    }
+    cache_size -= victim_size;
+    --cache_file_count;
+    // The index may be behind the directory, so a file that's already gone
+    // is not an error.
+    file_system_->RemoveFile(StrCat(prefix, victim).c_str(), &null_handler);
+    ++num_evictions;
+  }
+  evictions_->Add(num_evictions);
+  index_->FinishClean();
+
+  int64 bytes_freed = orig_cache_size - cache_size;
+  message_handler_->Message(kInfo,
+                            "File cache cleanup complete; freed %s bytes%s",
+                            Integer64ToString(bytes_freed).c_str(),
+                            more_to_clean_ ? ", more to clean" : "");
+  bytes_freed_in_cleanup_->Add(bytes_freed);
+  return true;
+}
+
+void FileCache::RebuildIndex(
+    std::vector<FileSystem::FileInfo>::const_iterator begin,
+    std::vector<FileSystem::FileInfo>::const_iterator end) {
+  FileCacheIndex::EntryVector entries;
+  entries.reserve(end - begin);
+  for (; begin != end; ++begin) {
+    if (!IsCleanFile(begin->name)) {
+      entries.push_back(FileCacheIndex::Entry(
+          IndexName(begin->name), begin->size_bytes, begin->atime_sec));
+    }
+  }
+  index_->Rebuild(&entries);
+}
+
 bool FileCache::CleanWithLocking(int64 next_clean_time_ms) {
   bool to_return = false;
 
@@ -301,6 +654,19 @@ bool FileCache::CleanWithLocking(int64 next_clean_time_ms) {
     // Now actually clean.
     to_return = Clean(cache_policy_->target_size_bytes,
                       cache_policy_->target_inode_count);
+    if (more_to_clean_) {
+      // Come back soon for the rest, rather than evicting everything at once.
+      int64 soon_ms = cache_policy_->timer->NowMs() +
+          std::min(kIncrementalCleanDelayMs, cache_policy_->clean_interval_ms);
+      if (soon_ms < next_clean_ms_) {
+        next_clean_ms_ = soon_ms;
+        if (!file_system_->WriteFileAtomic(clean_time_path_,
+                                           Integer64ToString(soon_ms),
+                                           message_handler_)) {
+          write_errors_->Add(1);
+        }
+      }
+    }
     file_system_->Unlock(clean_lock_path_, message_handler_);
   }
   return to_return;
@@ -19,15 +19,23 @@
 #ifndef PAGESPEED_KERNEL_CACHE_FILE_CACHE_H_
 #define PAGESPEED_KERNEL_CACHE_FILE_CACHE_H_
 
+#include <vector>
+
+#include "pagespeed/kernel/base/atomic_bool.h"
 #include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/file_system.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/cache/cache_interface.h"
+#include "pagespeed/kernel/cache/file_cache_index.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
 
 namespace net_instaweb {
 
-class FileSystem;
+class AbstractMutex;
 class Hasher;
+class Histogram;
 class MessageHandler;
 class SharedString;
 class SlowWorker;
@@ -43,12 +51,17 @@ class FileCache : public CacheInterface {
                 int64 target_size_bytes, int64 target_inode_count)
         : timer(timer), hasher(hasher), clean_interval_ms(clean_interval_ms),
           target_size_bytes(target_size_bytes),
-          target_inode_count(target_inode_count) {}
+          target_inode_count(target_inode_count),
+          max_evictions_per_clean(0) {}
     const Timer* timer;
     const Hasher* hasher;
     int64 clean_interval_ms;
     int64 target_size_bytes;
     int64 target_inode_count;
+    // With an index (see EnableIndex), the most files a single clean will
+    // evict; if that's not enough to get under the targets, another clean
+    // is scheduled shortly after. 0 means no limit.
+    int64 max_evictions_per_clean;
    private:
     DISALLOW_COPY_AND_ASSIGN(CachePolicy);
   };
@@ -58,9 +71,54 @@ class FileCache : public CacheInterface {
             MessageHandler* handler);
   virtual ~FileCache();
 
+  // The maximum number of operations each I/O sequence will queue up while
+  // the disk is slow; see QueuedWorkerPool::Sequence::set_max_queue_size.
+  static const int64 kMaxQueueSize = 2000;
+
+  // Files directly in the cache directory whose names start with this belong
+  // to someone else sharing the directory, such as the image of a persisted
+  // shared memory cache.  They are neither counted against the cache's size
+  // targets nor cleaned.  Like the cleaning files, the prefix contains
+  // characters that our filename encoder would escape.
+  static const char kReservedFilePrefix[];
+
   static void InitStats(Statistics* statistics);
 
+  // Makes the cache non-blocking: Get, MultiGet, Put and Delete queue their
+  // file operations on num_sequences sequences from pool and return right
+  // away, so up to num_sequences files are read or written in parallel.
+  // Operations on the same key always go to the same sequence, so they are
+  // performed in order, and a MultiGet is split up between the sequences
+  // its keys map to.
+  //
+  // This must be called before the cache is used. Does not take ownership
+  // of the pool, which should be shut down before the cache is destroyed.
+  // Calling it again replaces the sequences from the previous pool, which
+  // may then be deleted.
+  void SetIoPool(QueuedWorkerPool* pool, int num_sequences);
+
+  // A view of this cache that always does its file operations in the calling
+  // thread, even after SetIoPool, for users that need a blocking cache, such
+  // as the property cache. It shares the directory, index and cleaning with
+  // the cache itself, and, like a cache without an I/O pool, keeps working
+  // after ShutDown. Its operations are not ordered with those still queued
+  // on the pool. Owned by the cache.
+  CacheInterface* blocking_cache() { return blocking_cache_.get(); }
+
+  // Keeps an index of the files in the cache, with their sizes and access
+  // times, so that cleans can pick their victims from it instead of walking
+  // the whole cache directory. The directory is only walked when there's no
+  // index yet (or it was removed), to build one. Note that in cleans done
+  // from the index, target_inode_count is compared against the number of
+  // files, leaving out directories, and that files not written through a
+  // FileCache are not seen. See FileCacheIndex for details.
+  //
+  // This must be called before the cache is used. Takes ownership of mutex.
+  void EnableIndex(AbstractMutex* mutex);
+  bool index_enabled() const { return index_.get() != NULL; }
+
   virtual void Get(const GoogleString& key, Callback* callback);
+  virtual void MultiGet(MultiGetRequest* request);
   virtual void Put(const GoogleString& key, SharedString* value);
   virtual void Delete(const GoogleString& key);
   void set_worker(SlowWorker* worker) { worker_ = worker; }
@@ -69,9 +127,16 @@ class FileCache : public CacheInterface {
   static GoogleString FormatName() { return "FileCache"; }
   virtual GoogleString Name() const { return FormatName(); }
 
-  virtual bool IsBlocking() const { return true; }
-  virtual bool IsHealthy() const { return true; }
-  virtual void ShutDown() {}  // TODO(jmarantz): implement.
+  virtual bool IsBlocking() const { return io_sequences_.empty(); }
+  // Without an I/O pool the cache keeps working after ShutDown, as before.
+  virtual bool IsHealthy() const {
+    return io_sequences_.empty() || !stopped_.value();
+  }
+
+  // With an I/O pool, cancels any queued operations: Gets are reported as
+  // kNotFound, and Puts and Deletes are dropped.  Also writes out what the
+  // index has buffered.
+  virtual void ShutDown();
 
   const CachePolicy* cache_policy() const { return cache_policy_.get(); }
   CachePolicy* mutable_cache_policy() { return cache_policy_.get(); }
@@ -87,11 +152,48 @@ class FileCache : public CacheInterface {
   static const char kEvictions[];
   static const char kWriteErrors[];
 
+  // Histograms of the time taken by each file operation, in microseconds.
+  // With SetIoPool, this does not include time spent queued.
+  static const char kGetLatencyHistogram[];
+  static const char kPutLatencyHistogram[];
+  static const char kDeleteLatencyHistogram[];
+
  private:
+  class BlockingCache;
   class CacheCleanFunction;
+  friend class BlockingCache;
   friend class FileCacheTest;
   friend class CacheCleanFunction;
 
+  // The actual file operations, run either directly by Get, Put, and
+  // Delete, or in a sequence, where the ...InSequence methods run them.
+  void GetNow(const GoogleString& key, Callback* callback);
+  void PutNow(const GoogleString& key, SharedString* value);
+  void DeleteNow(const GoogleString& key);
+
+  // Functions run in io_sequences_, which take ownership of their
+  // arguments. Canceled Gets report kNotFound.
+  void GetInSequence(GoogleString* key, Callback* callback);
+  void CancelGet(GoogleString* key, Callback* callback);
+  void MultiGetInSequence(MultiGetRequest* request);
+  void CancelMultiGet(MultiGetRequest* request);
+  void PutInSequence(GoogleString* key, SharedString* value);
+  void CancelPut(GoogleString* key, SharedString* value);
+  void DeleteInSequence(GoogleString* key);
+  void CancelDelete(GoogleString* key);
+
+  // Index into io_sequences_ for key.
+  int SequenceIndex(const GoogleString& key) const;
+
+  // The name index_ uses for filename, which is relative to path_.
+  StringPiece IndexName(const GoogleString& filename) const;
+
+  // Whether filename is one of the files used to coordinate cleaning,
+  // including those of the index, or is reserved (see kReservedFilePrefix);
+  // such files are never evicted.
+  bool IsCleanFile(const GoogleString& filename) const;
+  bool IsReservedFile(const GoogleString& filename) const;
+
   // Attempts to clean the cache. Returns false if we failed and the cache still
   // needs to be cleaned. Returns true if everything's fine. This may take a
   // while. It's OK for others to write and read from the cache while this is
@@ -99,6 +201,17 @@ class FileCache : public CacheInterface {
   // target_inode_count of 0 means no inode limit is applied.
   bool Clean(int64 target_size_bytes, int64 target_inode_count);
 
+  // Cleans the cache using the sizes and access times in index_ rather than
+  // by walking the cache directory, setting *everything_ok to what Clean
+  // should return. Returns false if there's no index yet, in which case the
+  // directory needs to be walked instead.
+  bool CleanWithIndex(int64 target_size_bytes, int64 target_inode_count,
+                      bool* everything_ok);
+
+  // Replaces index_ with the files in [begin, end).
+  void RebuildIndex(std::vector<FileSystem::FileInfo>::const_iterator begin,
+                    std::vector<FileSystem::FileInfo>::const_iterator end);
+
   // Clean the cache, taking care of interprocess locking, as well as
   // timestamp update. Returns true if the cache was actually cleaned.
   bool CleanWithLocking(int64 next_clean_time_ms);
@@ -125,18 +238,37 @@ class FileCache : public CacheInterface {
   // The full paths to our cleanup timestamp and lock files.
   GoogleString clean_time_path_;
   GoogleString clean_lock_path_;
+  GoogleString clean_index_path_;
+  GoogleString reserved_path_prefix_;
   bool last_conditional_clean_result_;
 
+  // NULL unless EnableIndex was called.
+  scoped_ptr<FileCacheIndex> index_;
+  // Set when a clean from the index hit max_evictions_per_clean before
+  // getting under the targets.
+  bool more_to_clean_;
+
   Variable* disk_checks_;
   Variable* cleanups_;
   Variable* evictions_;
   Variable* bytes_freed_in_cleanup_;
   Variable* write_errors_;
+  Histogram* get_latency_us_histogram_;
+  Histogram* put_latency_us_histogram_;
+  Histogram* delete_latency_us_histogram_;
+
+  // Empty unless SetIoPool was called. Owned by the pool.
+  std::vector<QueuedWorkerPool::Sequence*> io_sequences_;
+  AtomicBool stopped_;
+  scoped_ptr<CacheInterface> blocking_cache_;
 
   // The filename where we keep the next scheduled cleanup time in seconds.
   static const char kCleanTimeName[];
   // The name of the global mutex protecting reads and writes to that file.
   static const char kCleanLockName[];
+  // The name of the index of the files in the cache, and the prefix of the
+  // names of its other files; see EnableIndex.
+  static const char kCleanIndexName[];
 
   DISALLOW_COPY_AND_ASSIGN(FileCache);
 };
@@ -0,0 +1,490 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pagespeed/kernel/cache/file_cache_index.h"
+
+#include <algorithm>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/file_system.h"
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_hash.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// Splits the first space-separated field off *rest and parses it as an
+// int64.
+bool ConsumeInt64(StringPiece* rest, int64* value) {
+  stringpiece_ssize_type space = rest->find(' ');
+  if (space == StringPiece::npos) {
+    return false;
+  }
+  GoogleString field;
+  rest->substr(0, space).CopyToString(&field);
+  rest->remove_prefix(space + 1);
+  return StringToInt64(field, value);
+}
+
+// Splits the first line off *rest, returning false if there's no complete
+// line left.
+bool ConsumeLine(StringPiece* rest, StringPiece* line) {
+  stringpiece_ssize_type newline = rest->find('\n');
+  if (newline == StringPiece::npos) {
+    return false;
+  }
+  *line = rest->substr(0, newline);
+  rest->remove_prefix(newline + 1);
+  return true;
+}
+
+struct CompareEntriesByAtime {
+  bool operator()(const FileCacheIndex::Entry& one,
+                  const FileCacheIndex::Entry& two) const {
+    return one.atime_sec < two.atime_sec;
+  }
+};
+
+template<class MapIterator>
+struct CompareMapEntriesByAtime {
+  bool operator()(MapIterator one, MapIterator two) const {
+    return one->second.atime_sec < two->second.atime_sec;
+  }
+};
+
+}  // namespace
+
+const size_t FileCacheIndex::kFlushThresholdBytes;
+const int FileCacheIndex::kSnapshotIoBytes;
+const int64 FileCacheIndex::kAccessResolutionSec;
+const int64 FileCacheIndex::kUnknownSize;
+const int FileCacheIndex::kRecentAccessSlots;
+const char FileCacheIndex::kJournalSuffix[] = "journal";
+const char FileCacheIndex::kCleaningSuffix[] = "cleaning";
+
+FileCacheIndex::FileCacheIndex(const GoogleString& index_path,
+                               FileSystem* file_system, AbstractMutex* mutex,
+                               MessageHandler* handler)
+    : index_path_(index_path),
+      journal_path_(StrCat(index_path, kJournalSuffix)),
+      cleaning_path_(StrCat(index_path, kCleaningSuffix)),
+      file_system_(file_system),
+      handler_(handler),
+      mutex_(mutex),
+      recent_accesses_(kRecentAccessSlots),
+      snapshot_reader_(file_system, handler),
+      journal_sorted_(false),
+      journal_pos_(0),
+      num_malformed_(0) {
+}
+
+FileCacheIndex::~FileCacheIndex() {
+  Flush();
+}
+
+void FileCacheIndex::RecordPut(StringPiece name, int64 size_bytes,
+                               int64 time_sec) {
+  ScopedMutex lock(mutex_.get());
+  NoteAccessLockHeld(name, time_sec);
+  AddRecordLockHeld(StrCat("P ", Integer64ToString(size_bytes), " ",
+                           Integer64ToString(time_sec), " ", name));
+}
+
+void FileCacheIndex::RecordAccess(StringPiece name, int64 time_sec) {
+  ScopedMutex lock(mutex_.get());
+  if (NoteAccessLockHeld(name, time_sec)) {
+    AddRecordLockHeld(StrCat("A ", Integer64ToString(time_sec), " ", name));
+  }
+}
+
+void FileCacheIndex::RecordDelete(StringPiece name) {
+  ScopedMutex lock(mutex_.get());
+  AddRecordLockHeld(StrCat("D ", name));
+}
+
+bool FileCacheIndex::NoteAccessLockHeld(StringPiece name, int64 time_sec) {
+  // Names that collide just get logged more often.
+  uint64 hash = HashString<CasePreserve, uint64>(name.data(), name.size());
+  RecentAccess& recent = recent_accesses_[hash % kRecentAccessSlots];
+  if (recent.hash == hash &&
+      time_sec - recent.time_sec < kAccessResolutionSec) {
+    return false;
+  }
+  recent.hash = hash;
+  recent.time_sec = time_sec;
+  return true;
+}
+
+void FileCacheIndex::AddRecordLockHeld(const GoogleString& record) {
+  DCHECK_EQ(GoogleString::npos, record.find('\n'));
+  StrAppend(&buffer_, record, "\n");
+  if (buffer_.size() >= kFlushThresholdBytes) {
+    FlushLockHeld();
+  }
+}
+
+bool FileCacheIndex::Flush() {
+  ScopedMutex lock(mutex_.get());
+  return FlushLockHeld();
+}
+
+bool FileCacheIndex::FlushLockHeld() {
+  if (buffer_.empty()) {
+    return true;
+  }
+  FileSystem::OutputFile* file =
+      file_system_->OpenOutputFileForAppend(journal_path_.c_str(), handler_);
+  if (file == NULL) {
+    // Drop the records rather than let them pile up; the files they
+    // describe will look older than they are, or go unseen.
+    buffer_.clear();
+    return false;
+  }
+  bool ok = file->Write(buffer_, handler_);
+  ok &= file_system_->Close(file, handler_);
+  buffer_.clear();
+  return ok;
+}
+
+bool FileCacheIndex::StartClean(int64* total_bytes, int64* num_files) {
+  Flush();
+  journal_.clear();
+  journal_by_atime_.clear();
+  journal_sorted_ = false;
+  journal_pos_ = 0;
+  num_malformed_ = 0;
+  *total_bytes = 0;
+  *num_files = 0;
+
+  // A clean that died partway leaves the journal it was working on behind,
+  // so replay that before the current journal, which we move aside so
+  // records made from now on go to a new one.
+  NullMessageHandler null_handler;  // Missing files are not errors.
+  GoogleString journal;
+  file_system_->ReadFile(cleaning_path_.c_str(), &journal, &null_handler);
+  ParseJournal(journal);
+  if (file_system_->RenameFile(journal_path_.c_str(), cleaning_path_.c_str(),
+                               &null_handler)) {
+    journal.clear();
+    file_system_->ReadFile(cleaning_path_.c_str(), &journal, &null_handler);
+    ParseJournal(journal);
+  }
+
+  // One pass over the snapshot to total it up, and then another, through
+  // snapshot_reader_, to pop files off it and copy the rest.
+  snapshot_reader_.Close();
+  bool have_snapshot = snapshot_reader_.Open(index_path_);
+  LineReader reader(file_system_, handler_);
+  if (have_snapshot && reader.Open(index_path_)) {
+    StringPiece name;
+    int64 size_bytes, atime_sec;
+    while (NextSnapshotLine(&reader, &name, &size_bytes, &atime_sec)) {
+      if (journal_.empty()) {
+        *total_bytes += size_bytes;
+        ++*num_files;
+        continue;
+      }
+      name.CopyToString(&key_);
+      JournalMap::iterator iter = journal_.find(key_);
+      if (iter == journal_.end()) {
+        *total_bytes += size_bytes;
+        ++*num_files;
+      } else if (iter->second.size_bytes == kUnknownSize) {
+        // Just read since the snapshot; it's counted with the journal below.
+        iter->second.size_bytes = size_bytes;
+      }
+    }
+  }
+  for (JournalMap::iterator iter = journal_.begin(), end = journal_.end();
+       iter != end; ++iter) {
+    if (!iter->second.deleted && iter->second.size_bytes != kUnknownSize) {
+      *total_bytes += iter->second.size_bytes;
+      ++*num_files;
+    }
+  }
+
+  if (num_malformed_ != 0) {
+    handler_->Message(kWarning, "Skipped %s malformed records in %s",
+                      Integer64ToString(num_malformed_).c_str(),
+                      index_path_.c_str());
+  }
+  return have_snapshot;
+}
+
+void FileCacheIndex::ParseJournal(StringPiece contents) {
+  StringPiece line;
+  while (ConsumeLine(&contents, &line)) {
+    if (line.size() < 3 || line[1] != ' ') {
+      ++num_malformed_;
+      continue;
+    }
+    char type = line[0];
+    StringPiece rest = line.substr(2);
+    int64 size_bytes, time_sec;
+    bool ok = true;
+    switch (type) {
+      case 'P':
+        ok = ConsumeInt64(&rest, &size_bytes) &&
+            ConsumeInt64(&rest, &time_sec) && !rest.empty();
+        if (ok) {
+          JournalEntry& entry = journal_[rest.as_string()];
+          entry.size_bytes = size_bytes;
+          entry.atime_sec = time_sec;
+          entry.deleted = false;
+        }
+        break;
+      case 'A':
+        ok = ConsumeInt64(&rest, &time_sec) && !rest.empty();
+        if (ok) {
+          // If this is all we hear of the file, its size comes from the
+          // snapshot; if it's not there either, it's dropped.
+          journal_[rest.as_string()].atime_sec = time_sec;
+        }
+        break;
+      case 'D':
+        journal_[rest.as_string()].deleted = true;
+        break;
+      default:
+        ok = false;
+        break;
+    }
+    if (!ok) {
+      ++num_malformed_;
+    }
+  }
+  if (!contents.empty()) {
+    // A record cut short by a crash, or a concurrent append.
+    ++num_malformed_;
+  }
+}
+
+bool FileCacheIndex::NextSnapshotLine(LineReader* reader,
+                                      StringPiece* name, int64* size_bytes,
+                                      int64* atime_sec) {
+  StringPiece line;
+  while (reader->NextLine(&line)) {
+    if (ConsumeInt64(&line, size_bytes) && ConsumeInt64(&line, atime_sec) &&
+        !line.empty()) {
+      *name = line;
+      return true;
+    }
+    ++num_malformed_;
+  }
+  return false;
+}
+
+bool FileCacheIndex::InJournal(StringPiece name) {
+  if (journal_.empty()) {
+    return false;
+  }
+  name.CopyToString(&key_);
+  return journal_.find(key_) != journal_.end();
+}
+
+void FileCacheIndex::SortJournal() {
+  if (journal_sorted_) {
+    return;
+  }
+  for (JournalMap::iterator iter = journal_.begin(), end = journal_.end();
+       iter != end; ++iter) {
+    if (!iter->second.deleted && iter->second.size_bytes != kUnknownSize) {
+      journal_by_atime_.push_back(iter);
+    }
+  }
+  std::stable_sort(journal_by_atime_.begin(), journal_by_atime_.end(),
+                   CompareMapEntriesByAtime<JournalMap::iterator>());
+  journal_sorted_ = true;
+}
+
+bool FileCacheIndex::PopOldest(GoogleString* name, int64* size_bytes) {
+  // Files in the snapshot that the journal doesn't mention were used before
+  // any that it does.
+  StringPiece snapshot_name;
+  int64 atime_sec;
+  while (NextSnapshotLine(&snapshot_reader_, &snapshot_name, size_bytes,
+                          &atime_sec)) {
+    if (!InJournal(snapshot_name)) {
+      snapshot_name.CopyToString(name);
+      return true;
+    }
+  }
+  SortJournal();
+  if (journal_pos_ == journal_by_atime_.size()) {
+    return false;
+  }
+  JournalMap::iterator victim = journal_by_atime_[journal_pos_++];
+  *name = victim->first;
+  *size_bytes = victim->second.size_bytes;
+  return true;
+}
+
+bool FileCacheIndex::FinishClean() {
+  SnapshotWriter writer(index_path_, file_system_, handler_);
+  StringPiece name;
+  int64 size_bytes, atime_sec;
+  while (NextSnapshotLine(&snapshot_reader_, &name, &size_bytes,
+                          &atime_sec)) {
+    if (!InJournal(name)) {
+      writer.AddLine(name, size_bytes, atime_sec);
+    }
+  }
+  SortJournal();
+  for (size_t n = journal_by_atime_.size(); journal_pos_ < n;
+       ++journal_pos_) {
+    JournalMap::iterator iter = journal_by_atime_[journal_pos_];
+    writer.AddLine(iter->first, iter->second.size_bytes,
+                   iter->second.atime_sec);
+  }
+  return WriteSnapshot(&writer);
+}
+
+bool FileCacheIndex::Rebuild(EntryVector* files) {
+  std::stable_sort(files->begin(), files->end(), CompareEntriesByAtime());
+  SnapshotWriter writer(index_path_, file_system_, handler_);
+  for (int i = 0, n = files->size(); i < n; ++i) {
+    const Entry& entry = (*files)[i];
+    writer.AddLine(entry.name, entry.size_bytes, entry.atime_sec);
+  }
+  return WriteSnapshot(&writer);
+}
+
+bool FileCacheIndex::WriteSnapshot(SnapshotWriter* writer) {
+  // The new snapshot may replace the one being read.
+  snapshot_reader_.Close();
+  bool ok = writer->Commit();
+  if (ok) {
+    NullMessageHandler null_handler;  // There may be no journal.
+    file_system_->RemoveFile(cleaning_path_.c_str(), &null_handler);
+  }
+  journal_.clear();
+  journal_by_atime_.clear();
+  journal_sorted_ = false;
+  journal_pos_ = 0;
+  return ok;
+}
+
+FileCacheIndex::LineReader::LineReader(FileSystem* file_system,
+                                      MessageHandler* handler)
+    : file_system_(file_system),
+      handler_(handler),
+      file_(NULL),
+      pos_(0) {
+}
+
+FileCacheIndex::LineReader::~LineReader() {
+  Close();
+}
+
+bool FileCacheIndex::LineReader::Open(const GoogleString& path) {
+  Close();
+  NullMessageHandler null_handler;  // A missing file is not an error.
+  file_ = file_system_->OpenInputFile(path.c_str(), &null_handler);
+  return file_ != NULL;
+}
+
+void FileCacheIndex::LineReader::Close() {
+  if (file_ != NULL) {
+    file_system_->Close(file_, handler_);
+    file_ = NULL;
+  }
+  buffer_.clear();
+  pos_ = 0;
+}
+
+bool FileCacheIndex::LineReader::NextLine(StringPiece* line) {
+  for (;;) {
+    size_t newline = buffer_.find('\n', pos_);
+    if (newline != GoogleString::npos) {
+      *line = StringPiece(buffer_.data() + pos_, newline - pos_);
+      pos_ = newline + 1;
+      return true;
+    }
+    if (file_ == NULL) {
+      // Anything left is a line cut short, e.g. by a crash.
+      return false;
+    }
+    buffer_.erase(0, pos_);
+    pos_ = 0;
+    size_t old_size = buffer_.size();
+    buffer_.resize(old_size + kSnapshotIoBytes);
+    int got = file_->Read(&buffer_[old_size], kSnapshotIoBytes, handler_);
+    buffer_.resize(old_size + std::max(got, 0));
+    if (got <= 0) {
+      file_system_->Close(file_, handler_);
+      file_ = NULL;
+    }
+  }
+}
+
+FileCacheIndex::SnapshotWriter::SnapshotWriter(const GoogleString& path,
+                                               FileSystem* file_system,
+                                               MessageHandler* handler)
+    : path_(path),
+      file_system_(file_system),
+      handler_(handler),
+      file_(file_system->OpenTempFile(StrCat(path, ".temp"), handler)),
+      ok_(file_ != NULL) {
+}
+
+FileCacheIndex::SnapshotWriter::~SnapshotWriter() {
+  if (file_ != NULL) {
+    // Not committed; drop what was written.
+    GoogleString temp_path(file_->filename());
+    file_system_->Close(file_, handler_);
+    NullMessageHandler null_handler;
+    file_system_->RemoveFile(temp_path.c_str(), &null_handler);
+  }
+}
+
+void FileCacheIndex::SnapshotWriter::AddLine(StringPiece name,
+                                             int64 size_bytes,
+                                             int64 atime_sec) {
+  StrAppend(&buffer_, Integer64ToString(size_bytes), " ",
+            Integer64ToString(atime_sec), " ", name, "\n");
+  if (buffer_.size() >= static_cast<size_t>(kSnapshotIoBytes)) {
+    FlushBuffer();
+  }
+}
+
+bool FileCacheIndex::SnapshotWriter::FlushBuffer() {
+  if (ok_ && !buffer_.empty()) {
+    ok_ = file_->Write(buffer_, handler_);
+  }
+  buffer_.clear();
+  return ok_;
+}
+
+bool FileCacheIndex::SnapshotWriter::Commit() {
+  if (file_ == NULL) {
+    return false;
+  }
+  FlushBuffer();
+  GoogleString temp_path(file_->filename());
+  ok_ &= file_system_->Close(file_, handler_);
+  file_ = NULL;
+  ok_ = ok_ && file_system_->RenameFile(temp_path.c_str(), path_.c_str(),
+                                         handler_);
+  if (!ok_) {
+    NullMessageHandler null_handler;
+    file_system_->RemoveFile(temp_path.c_str(), &null_handler);
+  }
+  return ok_;
+}
+
+}  // namespace net_instaweb
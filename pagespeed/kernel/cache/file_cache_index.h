@@ -0,0 +1,252 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_CACHE_FILE_CACHE_INDEX_H_
+#define PAGESPEED_KERNEL_CACHE_FILE_CACHE_INDEX_H_
+
+#include <map>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/file_system.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+
+namespace net_instaweb {
+
+class AbstractMutex;
+class MessageHandler;
+
+// Keeps track of the files in a FileCache, with their sizes and last access
+// times, so that cleaning can find its victims and the cache's total size
+// without walking the entire directory tree.
+//
+// The index is kept in two files. The snapshot, at index_path, lists the
+// files known at the end of the last clean, least recently used first:
+//   <size_bytes> <atime_sec> <name>
+// The journal, at index_path plus kJournalSuffix, logs what happened since:
+//   P <size_bytes> <time_sec> <name>   --- name was written
+//   A <time_sec> <name>                --- name was read
+//   D <name>                           --- name was removed
+// Later records override earlier ones for the same name. Records are
+// buffered in memory and appended in batches, so several processes can
+// share an index; each batch is a single append, so batches don't
+// interleave. A process logs a read of a file at most once every
+// kAccessResolutionSec, so hot files don't flood the journal.
+//
+// Each clean moves the journal aside, so that new records start a fresh
+// one, and folds it into a new snapshot. So the snapshot stays one line per
+// file, and the journal holds at most one clean interval's worth of
+// records. Only the journal is held in a map while cleaning. The snapshot,
+// already in eviction order, is read and written kSnapshotIoBytes at a time,
+// so a clean's memory doesn't grow with the number of files in the cache.
+//
+// The index is a hint rather than an authority: records still buffered
+// when a process dies are lost, and files FileCache didn't write are never
+// seen. Removing the snapshot makes the next clean walk the cache directory
+// and rebuild the index from it.
+class FileCacheIndex {
+ public:
+  struct Entry {
+    Entry() : size_bytes(0), atime_sec(0) {}
+    Entry(StringPiece name_in, int64 size, int64 atime)
+        : name(name_in.data(), name_in.size()), size_bytes(size),
+          atime_sec(atime) {}
+
+    GoogleString name;
+    int64 size_bytes;
+    int64 atime_sec;
+  };
+  typedef std::vector<Entry> EntryVector;
+
+  // Buffered records are appended to the journal once they take this many
+  // bytes.
+  static const size_t kFlushThresholdBytes = 4096;
+
+  // How much of the snapshot is read or written at once.
+  static const int kSnapshotIoBytes = 64 * 1024;
+
+  // How stale a file's access time in the index is allowed to get.
+  static const int64 kAccessResolutionSec = 600;
+
+  // Appended to index_path to name the journal, and the journal while a
+  // clean is folding it into the snapshot.
+  static const char kJournalSuffix[];
+  static const char kCleaningSuffix[];
+
+  // Takes ownership of mutex, which protects the buffer of records.
+  FileCacheIndex(const GoogleString& index_path, FileSystem* file_system,
+                 AbstractMutex* mutex, MessageHandler* handler);
+
+  // Flushes any buffered records.
+  ~FileCacheIndex();
+
+  // Names may be anything without a newline; FileCache uses paths relative
+  // to the cache directory.
+  void RecordPut(StringPiece name, int64 size_bytes, int64 time_sec);
+  void RecordAccess(StringPiece name, int64 time_sec);
+  void RecordDelete(StringPiece name);
+
+  // Appends all buffered records to the journal. Returns whether successful.
+  bool Flush();
+
+  // The methods below are for the cache cleaner, of which there must be only
+  // one at a time (FileCache ensures that with a file lock). They don't
+  // interfere with the Record methods above.
+
+  // Starts a clean: moves the journal aside and reads it along with the
+  // snapshot, setting *total_bytes and *num_files for the files they
+  // describe. Malformed records and lines (e.g. a last one cut short by a
+  // crash) are skipped. Returns false if there is no snapshot, in which
+  // case the caller should walk the cache and call Rebuild.
+  bool StartClean(int64* total_bytes, int64* num_files);
+
+  // Takes the least recently used remaining file out of the index. Returns
+  // false if there are none left.
+  bool PopOldest(GoogleString* name, int64* size_bytes);
+
+  // Ends a clean, writing a snapshot of the files that weren't popped.
+  bool FinishClean();
+
+  // Ends a clean, writing a snapshot of files, e.g. from a directory walk.
+  // Sorts *files.
+  bool Rebuild(EntryVector* files);
+
+  const GoogleString& index_path() const { return index_path_; }
+
+ private:
+  // What the journal says about a file. A size of kUnknownSize means there
+  // are only reads of it.
+  struct JournalEntry {
+    JournalEntry() : size_bytes(kUnknownSize), atime_sec(0), deleted(false) {}
+
+    int64 size_bytes;
+    int64 atime_sec;
+    bool deleted;
+  };
+  typedef std::map<GoogleString, JournalEntry> JournalMap;
+  static const int64 kUnknownSize = -1;
+
+  // The last logged read of a file whose name hashes to the slot.
+  struct RecentAccess {
+    RecentAccess() : hash(0), time_sec(0) {}
+
+    uint64 hash;
+    int64 time_sec;
+  };
+  static const int kRecentAccessSlots = 4096;
+
+  // Appends a record to buffer_, flushing it if it's grown large.
+  void AddRecordLockHeld(const GoogleString& record)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  bool FlushLockHeld() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Notes a read or write of name at time_sec, returning whether a read
+  // should be logged.
+  bool NoteAccessLockHeld(StringPiece name, int64 time_sec)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Reads a file a line at a time, holding at most a line plus
+  // kSnapshotIoBytes of it in memory.
+  class LineReader {
+   public:
+    LineReader(FileSystem* file_system, MessageHandler* handler);
+    ~LineReader();
+
+    // Returns false if path can't be opened.
+    bool Open(const GoogleString& path);
+    void Close();
+
+    // Sets *line to the next complete line, without its newline. It's valid
+    // until the next call. Returns false at the end of the file.
+    bool NextLine(StringPiece* line);
+
+   private:
+    FileSystem* file_system_;
+    MessageHandler* handler_;
+    FileSystem::InputFile* file_;
+    GoogleString buffer_;
+    size_t pos_;  // Where the unread part of buffer_ starts.
+
+    DISALLOW_COPY_AND_ASSIGN(LineReader);
+  };
+
+  // Writes a new snapshot to a temporary file, kSnapshotIoBytes at a time,
+  // and renames it into place.
+  class SnapshotWriter {
+   public:
+    SnapshotWriter(const GoogleString& path, FileSystem* file_system,
+                   MessageHandler* handler);
+    ~SnapshotWriter();
+
+    void AddLine(StringPiece name, int64 size_bytes, int64 atime_sec);
+
+    // Returns whether the whole snapshot was written and moved into place.
+    bool Commit();
+
+   private:
+    bool FlushBuffer();
+
+    const GoogleString path_;
+    FileSystem* file_system_;
+    MessageHandler* handler_;
+    FileSystem::OutputFile* file_;
+    GoogleString buffer_;
+    bool ok_;
+
+    DISALLOW_COPY_AND_ASSIGN(SnapshotWriter);
+  };
+
+  // Replays the records in contents into journal_.
+  void ParseJournal(StringPiece contents);
+
+  // Reads the next well-formed line of the snapshot from reader.
+  bool NextSnapshotLine(LineReader* reader, StringPiece* name,
+                        int64* size_bytes, int64* atime_sec);
+
+  // Whether a snapshot line for name is superseded by the journal.
+  bool InJournal(StringPiece name);
+
+  // Fills journal_by_atime_ with the live files in journal_.
+  void SortJournal();
+
+  // Commits writer's snapshot and forgets the journal StartClean read.
+  bool WriteSnapshot(SnapshotWriter* writer);
+
+  const GoogleString index_path_;
+  const GoogleString journal_path_;
+  const GoogleString cleaning_path_;
+  FileSystem* file_system_;
+  MessageHandler* handler_;
+  scoped_ptr<AbstractMutex> mutex_;
+  GoogleString buffer_ GUARDED_BY(mutex_);
+  std::vector<RecentAccess> recent_accesses_ GUARDED_BY(mutex_);
+
+  // State of the clean in progress.
+  LineReader snapshot_reader_;  // Open on the part of the snapshot not popped.
+  JournalMap journal_;
+  std::vector<JournalMap::iterator> journal_by_atime_;
+  bool journal_sorted_;
+  size_t journal_pos_;  // The next entry to pop from journal_by_atime_.
+  int64 num_malformed_;
+  GoogleString key_;  // Scratch space for looking names up in journal_.
+
+  DISALLOW_COPY_AND_ASSIGN(FileCacheIndex);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_CACHE_FILE_CACHE_INDEX_H_
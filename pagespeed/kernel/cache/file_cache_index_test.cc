@@ -0,0 +1,288 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Unit-test the file cache index.
+#include "pagespeed/kernel/cache/file_cache_index.h"
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/google_message_handler.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/mem_file_system.h"
+#include "pagespeed/kernel/base/mock_timer.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/util/platform.h"
+
+namespace net_instaweb {
+
+namespace {
+
+class FileCacheIndexTest : public testing::Test {
+ protected:
+  FileCacheIndexTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        timer_(new NullMutex, 0),
+        file_system_(thread_system_.get(), &timer_),
+        index_path_(StrCat(GTestTempDir(), "/!clean!index!")) {
+    index_.reset(NewIndex());
+  }
+
+  FileCacheIndex* NewIndex() {
+    return new FileCacheIndex(index_path_, &file_system_, new NullMutex,
+                              &handler_);
+  }
+
+  // Starts a clean, checking that there's a snapshot and what it holds.
+  void StartClean(int64 expected_bytes, int64 expected_files) {
+    int64 total_bytes, num_files;
+    ASSERT_TRUE(index_->StartClean(&total_bytes, &num_files));
+    EXPECT_EQ(expected_bytes, total_bytes);
+    EXPECT_EQ(expected_files, num_files);
+  }
+
+  // Pops all the files left in the clean, and returns them with their sizes.
+  GoogleString PopAll() {
+    GoogleString result, name;
+    int64 size_bytes;
+    while (index_->PopOldest(&name, &size_bytes)) {
+      StrAppend(&result, name, ":", Integer64ToString(size_bytes), " ");
+    }
+    return result;
+  }
+
+  // Starts the index off with an empty snapshot.
+  void RebuildEmpty() {
+    FileCacheIndex::EntryVector files;
+    ASSERT_TRUE(index_->Rebuild(&files));
+  }
+
+  GoogleString ReadFile(const GoogleString& path) {
+    GoogleString contents;
+    NullMessageHandler null_handler;
+    file_system_.ReadFile(path.c_str(), &contents, &null_handler);
+    return contents;
+  }
+
+  GoogleString ReadSnapshot() { return ReadFile(index_path_); }
+  GoogleString ReadJournal() {
+    return ReadFile(StrCat(index_path_, FileCacheIndex::kJournalSuffix));
+  }
+
+  scoped_ptr<ThreadSystem> thread_system_;
+  MockTimer timer_;
+  MemFileSystem file_system_;
+  GoogleMessageHandler handler_;
+  const GoogleString index_path_;
+  scoped_ptr<FileCacheIndex> index_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(FileCacheIndexTest);
+};
+
+TEST_F(FileCacheIndexTest, NoSnapshot) {
+  int64 total_bytes, num_files;
+  index_->RecordPut("a", 10, 100);
+  EXPECT_FALSE(index_->StartClean(&total_bytes, &num_files));
+  RebuildEmpty();
+
+  // Rebuild replaces whatever was in the journal at StartClean.
+  StartClean(0, 0);
+  EXPECT_EQ("", PopAll());
+}
+
+TEST_F(FileCacheIndexTest, Records) {
+  RebuildEmpty();
+  index_->RecordPut("a", 10, 100);
+  index_->RecordPut("b/c d", 20, 101);
+  index_->RecordPut("e", 30, 102);
+  index_->RecordAccess("unknown", 104);
+  index_->RecordDelete("e");
+  index_->RecordPut("b/c d", 25, 105);
+
+  StartClean(35, 2);
+  EXPECT_EQ("a:10 b/c d:25 ", PopAll());
+}
+
+TEST_F(FileCacheIndexTest, AccessesAreRateLimited) {
+  RebuildEmpty();
+  index_->RecordPut("a", 10, 100);
+  index_->RecordAccess("a", 101);
+  index_->RecordAccess("b", 101);
+  index_->RecordAccess("b", 102);
+  EXPECT_TRUE(index_->Flush());
+  EXPECT_EQ("P 10 100 a\nA 101 b\n", ReadJournal());
+
+  const int64 later_sec = 100 + FileCacheIndex::kAccessResolutionSec;
+  index_->RecordAccess("a", later_sec);
+  EXPECT_TRUE(index_->Flush());
+  EXPECT_EQ(StrCat("P 10 100 a\nA 101 b\nA ", Integer64ToString(later_sec),
+                   " a\n"),
+            ReadJournal());
+}
+
+TEST_F(FileCacheIndexTest, BuffersUntilFlush) {
+  index_->RecordPut("a", 10, 100);
+  EXPECT_EQ("", ReadJournal());
+  EXPECT_TRUE(index_->Flush());
+  EXPECT_EQ("P 10 100 a\n", ReadJournal());
+
+  // A large enough batch of records is flushed on its own.
+  GoogleString long_name(FileCacheIndex::kFlushThresholdBytes, 'x');
+  index_->RecordPut(long_name, 1, 1);
+  EXPECT_LT(FileCacheIndex::kFlushThresholdBytes, ReadJournal().size());
+}
+
+TEST_F(FileCacheIndexTest, SharedByTwoWriters) {
+  RebuildEmpty();
+  scoped_ptr<FileCacheIndex> other(NewIndex());
+  index_->RecordPut("a", 10, 100);
+  other->RecordPut("b", 20, 101);
+  EXPECT_TRUE(other->Flush());
+  index_->RecordDelete("b");
+
+  StartClean(10, 1);
+  EXPECT_EQ("a:10 ", PopAll());
+}
+
+// The snapshot is kept least recently used first, and the journal is folded
+// into it on each clean.
+TEST_F(FileCacheIndexTest, FoldsJournalIntoSnapshot) {
+  FileCacheIndex::EntryVector files;
+  files.push_back(FileCacheIndex::Entry("c", 3, 30));
+  files.push_back(FileCacheIndex::Entry("a", 1, 10));
+  files.push_back(FileCacheIndex::Entry("b", 2, 20));
+  ASSERT_TRUE(index_->Rebuild(&files));
+  EXPECT_EQ("1 10 a\n2 20 b\n3 30 c\n", ReadSnapshot());
+
+  index_->RecordAccess("a", 40);
+  index_->RecordDelete("b");
+  index_->RecordPut("d", 4, 35);
+  StartClean(1 + 3 + 4, 3);
+  EXPECT_EQ("", ReadJournal());
+
+  // Records made during the clean go to a new journal, for the next one.
+  index_->RecordPut("e", 5, 50);
+  EXPECT_TRUE(index_->FinishClean());
+  EXPECT_EQ("3 30 c\n4 35 d\n1 40 a\n", ReadSnapshot());
+  EXPECT_TRUE(index_->Flush());
+  EXPECT_EQ("P 5 50 e\n", ReadJournal());
+
+  StartClean(1 + 3 + 4 + 5, 4);
+  EXPECT_EQ("c:3 d:4 a:1 e:5 ", PopAll());
+}
+
+// Files popped during a clean are left out of the new snapshot.
+TEST_F(FileCacheIndexTest, PoppedFilesAreDropped) {
+  RebuildEmpty();
+  index_->RecordPut("a", 1, 10);
+  index_->RecordPut("b", 2, 20);
+  StartClean(3, 2);
+  GoogleString name;
+  int64 size_bytes;
+  ASSERT_TRUE(index_->PopOldest(&name, &size_bytes));
+  EXPECT_EQ("a", name);
+  EXPECT_TRUE(index_->FinishClean());
+  EXPECT_EQ("2 20 b\n", ReadSnapshot());
+}
+
+// Snapshots bigger than kSnapshotIoBytes are read and written in pieces,
+// with lines straddling the pieces.
+TEST_F(FileCacheIndexTest, LargeSnapshot) {
+  const int kNumFiles = 4 * FileCacheIndex::kSnapshotIoBytes / 50;
+  FileCacheIndex::EntryVector files;
+  int64 total_bytes = 0;
+  for (int i = 0; i < kNumFiles; ++i) {
+    files.push_back(FileCacheIndex::Entry(
+        StrCat("dir/", IntegerToString(i), "/", GoogleString(30, 'x')), i,
+        1000 + i));
+    total_bytes += i;
+  }
+  ASSERT_TRUE(index_->Rebuild(&files));
+  GoogleString snapshot = ReadSnapshot();
+  EXPECT_LT(3 * FileCacheIndex::kSnapshotIoBytes, snapshot.size());
+
+  index_->RecordDelete(files[1].name);
+  StartClean(total_bytes - 1, kNumFiles - 1);
+  GoogleString name;
+  int64 size_bytes;
+  ASSERT_TRUE(index_->PopOldest(&name, &size_bytes));
+  EXPECT_EQ(files[0].name, name);
+  EXPECT_EQ(0, size_bytes);
+  ASSERT_TRUE(index_->PopOldest(&name, &size_bytes));
+  EXPECT_EQ(files[2].name, name);
+  EXPECT_TRUE(index_->FinishClean());
+
+  // The first three files are gone from the snapshot, the rest are as they
+  // were.
+  size_t pos = 0;
+  for (int i = 0; i < 3; ++i) {
+    pos = snapshot.find('\n', pos) + 1;
+  }
+  EXPECT_EQ(snapshot.substr(pos), ReadSnapshot());
+  StartClean(total_bytes - 3, kNumFiles - 3);
+  ASSERT_TRUE(index_->PopOldest(&name, &size_bytes));
+  EXPECT_EQ(files[3].name, name);
+}
+
+// A clean that died partway leaves its journal behind for the next one.
+TEST_F(FileCacheIndexTest, ReplaysJournalOfDeadClean) {
+  RebuildEmpty();
+  ASSERT_TRUE(file_system_.WriteFile(
+      StrCat(index_path_, FileCacheIndex::kCleaningSuffix).c_str(),
+      "P 1 10 a\n", &handler_));
+  index_->RecordPut("b", 2, 20);
+  StartClean(3, 2);
+  EXPECT_TRUE(index_->FinishClean());
+  EXPECT_EQ("1 10 a\n2 20 b\n", ReadSnapshot());
+  EXPECT_EQ("", ReadFile(StrCat(index_path_,
+                                FileCacheIndex::kCleaningSuffix)));
+}
+
+TEST_F(FileCacheIndexTest, FlushOnDestruction) {
+  RebuildEmpty();
+  index_->RecordPut("a", 10, 100);
+  index_.reset(NewIndex());
+  StartClean(10, 1);
+}
+
+TEST_F(FileCacheIndexTest, SkipsMalformedRecords) {
+  ASSERT_TRUE(file_system_.WriteFile(
+      index_path_.c_str(),
+      "1 10 a\n"
+      "two 20 b\n"
+      "3 30\n"
+      "4 40 c\n",
+      &handler_));
+  ASSERT_TRUE(file_system_.WriteFile(
+      StrCat(index_path_, FileCacheIndex::kJournalSuffix).c_str(),
+      "P 10 100 d\n"
+      "P ten 100 e\n"
+      "P 10 100\n"
+      "\n"
+      "X 1 f\n"
+      "A 5\n"
+      "P 20 200 g\n"
+      "P 30 300 trunc",  // Cut short by a crash.
+      &handler_));
+  StartClean(1 + 4 + 10 + 20, 4);
+  EXPECT_EQ("a:1 c:4 d:10 g:20 ", PopAll());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -20,6 +20,7 @@
 #include "pagespeed/kernel/cache/file_cache.h"
 
 #include <unistd.h>
+#include <vector>
 
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/file_system.h"
@@ -35,7 +36,10 @@
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/cache/cache_test_base.h"
+#include "pagespeed/kernel/cache/file_cache_index.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
 #include "pagespeed/kernel/thread/slow_worker.h"
+#include "pagespeed/kernel/thread/worker_test_base.h"
 #include "pagespeed/kernel/util/platform.h"
 #include "pagespeed/kernel/util/simple_stats.h"
 
@@ -43,6 +47,25 @@ namespace net_instaweb {
 
 class FileCacheTest : public CacheTestBase {
  protected:
+  // Callback which waits for Done, for use with an asynchronous FileCache.
+  class AsyncCallback : public CacheTestBase::Callback {
+   public:
+    explicit AsyncCallback(FileCacheTest* test)
+        : Callback(test),
+          sync_point_(test->thread_system_.get()) {
+    }
+
+    virtual void Done(CacheInterface::KeyState state) {
+      Callback::Done(state);
+      sync_point_.Notify();
+    }
+
+    virtual void Wait() { sync_point_.Wait(); }
+
+   private:
+    WorkerTestBase::SyncPoint sync_point_;
+  };
+
   FileCacheTest()
       : thread_system_(Platform::CreateThreadSystem()),
         worker_("cleaner", thread_system_.get()),
@@ -70,6 +93,38 @@ class FileCacheTest : public CacheTestBase {
     file_system_.set_advance_time_on_update(true, &mock_timer_);
   }
 
+  ~FileCacheTest() {
+    if (pool_.get() != NULL) {
+      pool_->ShutDown();  // quiesce before destructing cache.
+    }
+  }
+
+  // Makes cache_ asynchronous, with reads and writes done in parallel by
+  // several threads.
+  void UseIoPool() {
+    set_mutex(thread_system_->NewMutex());
+    pool_.reset(new QueuedWorkerPool(kIoThreads, "file_cache_io",
+                                     thread_system_.get()));
+    cache_->SetIoPool(pool_.get(), kIoThreads);
+    EXPECT_FALSE(cache_->IsBlocking());
+
+    // Each file operation advances the mock time by a second, so keep the
+    // cleaner (which would have a field day with kTargetSize) from
+    // running in the background.
+    cache_->next_clean_ms_ = kint64max;
+  }
+
+  virtual Callback* NewCallback() {
+    if (pool_.get() != NULL) {
+      return new AsyncCallback(this);
+    }
+    return CacheTestBase::NewCallback();
+  }
+
+  double HistogramCount(const char* name) {
+    return stats_.GetHistogram(name)->Count();
+  }
+
   void CheckCleanTimestamp(int64 min_time_ms) {
     GoogleString buffer;
     file_system_.ReadFile(cache_->clean_time_path_.c_str(), &buffer,
@@ -92,6 +147,17 @@ class FileCacheTest : public CacheTestBase {
     return cache_->Clean(size, inode_count);
   }
 
+  // Gives cache_ an index. The first clean after this walks the cache
+  // directory, building the index.
+  void UseIndex() {
+    cache_->EnableIndex(thread_system_->NewMutex());
+    EXPECT_TRUE(cache_->index_enabled());
+  }
+
+  const GoogleString& index_path() const { return cache_->clean_index_path_; }
+  bool more_to_clean() const { return cache_->more_to_clean_; }
+  int64 next_clean_ms() const { return cache_->next_clean_ms_; }
+
   bool CheckClean() {
     cache_->CleanIfNeeded();
     while (worker_.IsBusy()) {
@@ -111,7 +177,9 @@ class FileCacheTest : public CacheTestBase {
   const int64 kTargetInodeLimit;
   SimpleStats stats_;
   scoped_ptr<FileCache> cache_;
+  scoped_ptr<QueuedWorkerPool> pool_;
   GoogleMessageHandler message_handler_;
+  static const int kIoThreads = 4;
 
   Variable* disk_checks_;
   Variable* cleanups_;
@@ -135,6 +203,98 @@ TEST_F(FileCacheTest, PutGetDelete) {
   CheckNotFound("Name");
 }
 
+TEST_F(FileCacheTest, LatencyHistograms) {
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  CheckNotFound("Another Name");
+  cache_->Delete("Name");
+  EXPECT_EQ(2, HistogramCount(FileCache::kGetLatencyHistogram));
+  EXPECT_EQ(1, HistogramCount(FileCache::kPutLatencyHistogram));
+  EXPECT_EQ(1, HistogramCount(FileCache::kDeleteLatencyHistogram));
+}
+
+TEST_F(FileCacheTest, AsyncPutGetDelete) {
+  UseIoPool();
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  CheckNotFound("Another Name");
+
+  CheckPut("Name", "NewValue");
+  CheckGet("Name", "NewValue");
+
+  // Operations on a key stay in order, so the Get sees the Delete.
+  cache_->Delete("Name");
+  CheckNotFound("Name");
+}
+
+TEST_F(FileCacheTest, AsyncMultiGet) {
+  UseIoPool();
+  TestMultiGet();
+
+  // Enough keys that every sequence gets a share of the request.
+  const int kKeys = 4 * kIoThreads;
+  PopulateCache(kKeys);
+  CacheInterface::MultiGetRequest* request =
+      new CacheInterface::MultiGetRequest;
+  std::vector<Callback*> callbacks;
+  for (int i = 0; i < kKeys; ++i) {
+    callbacks.push_back(AddCallback());
+    request->push_back(CacheInterface::KeyCallback(
+        StringPrintf("n%d", i), callbacks.back()));
+  }
+  cache_->MultiGet(request);
+  for (int i = 0; i < kKeys; ++i) {
+    WaitAndCheck(callbacks[i], StringPrintf("v%d", i));
+  }
+}
+
+TEST_F(FileCacheTest, AsyncShutDown) {
+  UseIoPool();
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  cache_->ShutDown();
+  EXPECT_FALSE(cache_->IsHealthy());
+  CheckNotFound("Name");
+
+  CacheInterface::MultiGetRequest* request =
+      new CacheInterface::MultiGetRequest;
+  Callback* callback = AddCallback();
+  request->push_back(CacheInterface::KeyCallback("Name", callback));
+  cache_->MultiGet(request);
+  WaitAndCheckNotFound(callback);
+}
+
+TEST_F(FileCacheTest, BlockingShutDown) {
+  CheckPut("Name", "Value");
+  cache_->ShutDown();
+  EXPECT_TRUE(cache_->IsHealthy());
+  CheckGet("Name", "Value");
+}
+
+TEST_F(FileCacheTest, BlockingViewOfAsyncCache) {
+  UseIoPool();
+  CacheInterface* blocking = cache_->blocking_cache();
+  EXPECT_TRUE(blocking->IsBlocking());
+  EXPECT_EQ(cache_.get(), blocking->Backend());
+
+  // Writes through either are seen by the other, and the view's Get is done
+  // by the time it returns.
+  CheckPut(blocking, "Name", "Value");
+  Callback* callback = InitiateGet(blocking, "Name");
+  EXPECT_TRUE(callback->called());
+  WaitAndCheck(callback, "Value");
+  // The view is not ordered with queued operations, so wait for the Put to
+  // land before reading it back.
+  CheckPut("Name", "NewValue");
+  CheckGet("Name", "NewValue");
+  CheckGet(blocking, "Name", "NewValue");
+
+  // The view keeps working once the pool is shut down.
+  cache_->ShutDown();
+  CheckNotFound("Name");
+  CheckGet(blocking, "Name", "NewValue");
+}
+
 // Throw a bunch of files into the cache and verify that they are
 // evicted sensibly.
 TEST_F(FileCacheTest, Clean) {
@@ -251,6 +411,29 @@ TEST_F(FileCacheTest, Clean) {
   EXPECT_EQ(6, dir_info.inode_count);
 }
 
+// Files with the reserved prefix, such as a persisted shared memory cache
+// kept in the cache directory, neither count towards the targets nor get
+// cleaned.
+TEST_F(FileCacheTest, ReservedFilesAreNotCleaned) {
+  CheckPut("a", "aa");
+  CheckPut("b", "bbbb");
+  GoogleString reserved =
+      StrCat(GTestTempDir(), "/", FileCache::kReservedFilePrefix, "image");
+  ASSERT_TRUE(file_system_.WriteFile(reserved.c_str(), GoogleString(100, 'x'),
+                                     &message_handler_));
+
+  EXPECT_TRUE(Clean(10, 3));
+  EXPECT_EQ(1, disk_checks_->Get());
+  EXPECT_EQ(0, cleanups_->Get());
+
+  EXPECT_TRUE(Clean(5, 0));  // Cleans down to 3 bytes.
+  EXPECT_EQ(1, cleanups_->Get());
+  EXPECT_EQ(2, evictions_->Get());
+  EXPECT_EQ(2 + 4, bytes_freed_in_cleanup_->Get());
+  EXPECT_TRUE(
+      file_system_.Exists(reserved.c_str(), &message_handler_).is_true());
+}
+
 // Test the auto-cleaning behavior
 TEST_F(FileCacheTest, CheckClean) {
   CheckPut("Name1", "Value");
@@ -280,4 +463,116 @@ TEST_F(FileCacheTest, CheckClean) {
   CheckCleanTimestamp(time_ms);
 }
 
+// Cleans from the index evict the least recently used files, and only walk
+// the directory, finding files the index doesn't know about, when the index
+// is gone.
+TEST_F(FileCacheTest, CleanWithIndex) {
+  UseIndex();
+  CheckPut("a", "aa");
+  CheckPut("b", "bbbb");
+  CheckPut("c", "cccccccc");
+  CheckPut("d", "dd");
+
+  // The first clean walks the directory; everything fits.
+  EXPECT_TRUE(Clean(100, 0));
+  EXPECT_EQ(1, disk_checks_->Get());
+  EXPECT_EQ(0, cleanups_->Get());
+
+  // A file the cache didn't write itself isn't in the index.
+  GoogleString stray = StrCat(GTestTempDir(), "/stray");
+  ASSERT_TRUE(file_system_.WriteFile(stray.c_str(), "stray stray",
+                                     &message_handler_));
+
+  // Make "a" and "c" recently used; "b" and "d" should be evicted first.
+  mock_timer_.SleepMs(2 * FileCacheIndex::kAccessResolutionSec *
+                      Timer::kSecondMs);
+  CheckGet("a", "aa");
+  CheckGet("c", "cccccccc");
+
+  stats_.Clear();
+  EXPECT_TRUE(Clean(14, 0));  // Cleans down to 10 bytes.
+  EXPECT_EQ(1, disk_checks_->Get());
+  EXPECT_EQ(1, cleanups_->Get());
+  EXPECT_EQ(2, evictions_->Get());
+  EXPECT_EQ(2 + 4, bytes_freed_in_cleanup_->Get());
+  EXPECT_FALSE(more_to_clean());
+  CheckGet("a", "aa");
+  CheckNotFound("b");
+  CheckGet("c", "cccccccc");
+  CheckNotFound("d");
+  EXPECT_TRUE(file_system_.Exists(stray.c_str(), &message_handler_).is_true());
+
+  // Later cleans keep using the index.
+  stats_.Clear();
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_TRUE(Clean(14, 0));
+  }
+  EXPECT_EQ(0, cleanups_->Get());
+  EXPECT_TRUE(file_system_.Exists(stray.c_str(), &message_handler_).is_true());
+
+  // Once the index is removed, a walk finds the stray file, the oldest of
+  // the lot.
+  ASSERT_TRUE(file_system_.RemoveFile(index_path().c_str(),
+                                      &message_handler_));
+  EXPECT_TRUE(Clean(14, 0));
+  EXPECT_EQ(1, cleanups_->Get());
+  EXPECT_TRUE(file_system_.Exists(stray.c_str(), &message_handler_).is_false());
+  CheckGet("a", "aa");
+  CheckGet("c", "cccccccc");
+}
+
+// The index counts files, not directories, against the inode target.
+TEST_F(FileCacheTest, CleanWithIndexByFileCount) {
+  UseIndex();
+  EXPECT_TRUE(Clean(100, 0));  // Build the (empty) index.
+  CheckPut("a/1", "1");
+  CheckPut("a/2", "2");
+  CheckPut("b/3", "3");
+  CheckPut("b/4", "4");
+
+  stats_.Clear();
+  EXPECT_TRUE(Clean(100, 4));  // Cleans down to 3 files.
+  EXPECT_EQ(1, evictions_->Get());
+  CheckNotFound("a/1");
+  CheckGet("a/2", "2");
+}
+
+// With max_evictions_per_clean, a clean from the index stops early, and the
+// next one is scheduled soon after.
+TEST_F(FileCacheTest, CleanWithIndexIncrementally) {
+  UseIndex();
+  cache_->mutable_cache_policy()->max_evictions_per_clean = 2;
+  EXPECT_TRUE(Clean(100, 0));  // Build the (empty) index.
+  CheckPut("a", "aaaa");
+  CheckPut("b", "bbbb");
+  CheckPut("c", "cccc");
+  CheckPut("d", "dddd");
+  CheckPut("e", "eeee");
+
+  stats_.Clear();
+  EXPECT_TRUE(Clean(8, 0));  // Wants to clean down to 6 bytes.
+  EXPECT_EQ(2, evictions_->Get());
+  EXPECT_TRUE(more_to_clean());
+  CheckNotFound("a");
+  CheckNotFound("b");
+
+  EXPECT_TRUE(Clean(8, 0));
+  EXPECT_EQ(4, evictions_->Get());
+  EXPECT_FALSE(more_to_clean());
+  CheckNotFound("c");
+  CheckNotFound("d");
+  CheckGet("e", "eeee");
+
+  // When cleaning stops early, the cleaner comes back well before the
+  // regular interval is up.
+  cache_->mutable_cache_policy()->target_size_bytes = 4;
+  CheckPut("f", "ffff");
+  CheckPut("g", "gggg");
+  CheckPut("h", "hhhh");
+  mock_timer_.SleepMs(kCleanIntervalMs + 1);
+  EXPECT_TRUE(CheckClean());
+  EXPECT_TRUE(more_to_clean());
+  EXPECT_GT(mock_timer_.NowMs() + kCleanIntervalMs / 2, next_clean_ms());
+}
+
 }  // namespace net_instaweb
@@ -0,0 +1,239 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pagespeed/kernel/cache/sharded_lru_cache.h"
+
+#include <cstddef>
+#include <cstring>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+#include "pagespeed/kernel/cache/delegating_cache_callback.h"
+#include "pagespeed/kernel/cache/lru_cache.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// Releases the shard's mutex before running the caller's Done, so that
+// callbacks are free to issue further operations on the cache.
+class ShardCallback : public DelegatingCacheCallback {
+ public:
+  ShardCallback(AbstractMutex* mutex, CacheInterface::Callback* callback)
+      EXCLUSIVE_LOCK_FUNCTION(mutex)
+      : DelegatingCacheCallback(callback), mutex_(mutex) {
+    mutex_->Lock();
+  }
+
+  virtual ~ShardCallback() {
+  }
+
+  virtual void Done(CacheInterface::KeyState state) UNLOCK_FUNCTION(mutex_) {
+    mutex_->Unlock();
+    DelegatingCacheCallback::Done(state);
+  }
+
+ private:
+  AbstractMutex* mutex_;
+
+  DISALLOW_COPY_AND_ASSIGN(ShardCallback);
+};
+
+// Picks a shard for a key.  The key is hashed again inside the shard's
+// LRUCache with HashString, so this has two jobs: it must be cheap, as it
+// is pure overhead on top of that, and it must not be correlated with
+// HashString's low bits, which index the shard's map -- otherwise each
+// shard's map would see its keys clustered on a fraction of its buckets.
+// So consume the key a word at a time rather than a byte at a time, and
+// return the high bits of a multiplicative scramble.
+uint64 ShardHash(const char* data, size_t size) {
+  const uint64 kMultiplier = 0x9e3779b97f4a7c15ULL;
+  uint64 hash = size;
+  const char* end = data + size;
+  for (; data + sizeof(uint64) <= end; data += sizeof(uint64)) {
+    uint64 word;
+    memcpy(&word, data, sizeof(word));
+    hash = (hash ^ word) * kMultiplier;
+    hash ^= hash >> 29;
+  }
+  for (; data != end; ++data) {
+    hash = (hash ^ static_cast<unsigned char>(*data)) * kMultiplier;
+  }
+  return (hash * kMultiplier) >> 32;
+}
+
+}  // namespace
+
+class ShardedLRUCache::Shard {
+ public:
+  Shard(size_t max_size, AbstractMutex* mutex)
+      : lru_cache_(max_size),
+        mutex_(mutex) {
+  }
+
+  void Get(const GoogleString& key, Callback* callback) {
+    lru_cache_.Get(key, new ShardCallback(mutex_.get(), callback));
+  }
+
+  void Put(const GoogleString& key, SharedString* value)
+      LOCKS_EXCLUDED(mutex_) {
+    ScopedMutex lock(mutex_.get());
+    lru_cache_.Put(key, value);
+  }
+
+  void Delete(const GoogleString& key) LOCKS_EXCLUDED(mutex_) {
+    ScopedMutex lock(mutex_.get());
+    lru_cache_.Delete(key);
+  }
+
+  size_t Sum(size_t (LRUCache::*accessor)() const) const
+      LOCKS_EXCLUDED(mutex_) {
+    ScopedMutex lock(mutex_.get());
+    return (lru_cache_.*accessor)();
+  }
+
+  bool IsHealthy() const LOCKS_EXCLUDED(mutex_) {
+    ScopedMutex lock(mutex_.get());
+    return lru_cache_.IsHealthy();
+  }
+
+  void set_is_healthy(bool x) LOCKS_EXCLUDED(mutex_) {
+    ScopedMutex lock(mutex_.get());
+    lru_cache_.set_is_healthy(x);
+  }
+
+  void SanityCheck() LOCKS_EXCLUDED(mutex_) {
+    ScopedMutex lock(mutex_.get());
+    lru_cache_.SanityCheck();
+  }
+
+  void Clear() LOCKS_EXCLUDED(mutex_) {
+    ScopedMutex lock(mutex_.get());
+    lru_cache_.Clear();
+  }
+
+  void ClearStats() LOCKS_EXCLUDED(mutex_) {
+    ScopedMutex lock(mutex_.get());
+    lru_cache_.ClearStats();
+  }
+
+ private:
+  LRUCache lru_cache_ GUARDED_BY(mutex_);
+  scoped_ptr<AbstractMutex> mutex_;
+
+  DISALLOW_COPY_AND_ASSIGN(Shard);
+};
+
+ShardedLRUCache::ShardedLRUCache(int num_shards, size_t max_size,
+                                 ThreadSystem* thread_system) {
+  CHECK_LT(0, num_shards);
+  size_t shard_size = max_size / num_shards;
+  size_t remainder = max_size % num_shards;
+  shards_.reserve(num_shards);
+  for (int i = 0; i < num_shards; ++i) {
+    // Hand the bytes that don't divide evenly to the first few shards, so
+    // that max_bytes_in_cache() adds up to exactly max_size.
+    size_t size = shard_size + ((static_cast<size_t>(i) < remainder) ? 1 : 0);
+    shards_.push_back(new Shard(size, thread_system->NewMutex()));
+  }
+}
+
+ShardedLRUCache::~ShardedLRUCache() {
+  STLDeleteElements(&shards_);
+}
+
+GoogleString ShardedLRUCache::FormatName(int num_shards) {
+  return StrCat("ShardedLRUCache(shards=", IntegerToString(num_shards), ")");
+}
+
+ShardedLRUCache::Shard* ShardedLRUCache::ShardForKey(
+    const GoogleString& key) const {
+  return shards_[ShardHash(key.data(), key.size()) % shards_.size()];
+}
+
+void ShardedLRUCache::Get(const GoogleString& key, Callback* callback) {
+  ShardForKey(key)->Get(key, callback);
+}
+
+void ShardedLRUCache::Put(const GoogleString& key, SharedString* new_value) {
+  ShardForKey(key)->Put(key, new_value);
+}
+
+void ShardedLRUCache::Delete(const GoogleString& key) {
+  ShardForKey(key)->Delete(key);
+}
+
+#define SUM_OVER_SHARDS(accessor)                                       \
+  size_t ShardedLRUCache::accessor() const {                            \
+    size_t sum = 0;                                                     \
+    for (int i = 0, n = shards_.size(); i < n; ++i) {                   \
+      sum += shards_[i]->Sum(&LRUCache::accessor);                      \
+    }                                                                   \
+    return sum;                                                         \
+  }
+
+SUM_OVER_SHARDS(size_bytes)
+SUM_OVER_SHARDS(max_bytes_in_cache)
+SUM_OVER_SHARDS(num_elements)
+SUM_OVER_SHARDS(num_evictions)
+SUM_OVER_SHARDS(num_hits)
+SUM_OVER_SHARDS(num_misses)
+SUM_OVER_SHARDS(num_inserts)
+SUM_OVER_SHARDS(num_identical_reinserts)
+SUM_OVER_SHARDS(num_deletes)
+
+#undef SUM_OVER_SHARDS
+
+void ShardedLRUCache::SanityCheck() {
+  for (int i = 0, n = shards_.size(); i < n; ++i) {
+    shards_[i]->SanityCheck();
+  }
+}
+
+void ShardedLRUCache::Clear() {
+  for (int i = 0, n = shards_.size(); i < n; ++i) {
+    shards_[i]->Clear();
+  }
+}
+
+void ShardedLRUCache::ClearStats() {
+  for (int i = 0, n = shards_.size(); i < n; ++i) {
+    shards_[i]->ClearStats();
+  }
+}
+
+bool ShardedLRUCache::IsHealthy() const {
+  // All shards share a health state, so checking one is enough.
+  return shards_[0]->IsHealthy();
+}
+
+void ShardedLRUCache::ShutDown() {
+  set_is_healthy(false);
+}
+
+void ShardedLRUCache::set_is_healthy(bool x) {
+  for (int i = 0, n = shards_.size(); i < n; ++i) {
+    shards_[i]->set_is_healthy(x);
+  }
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,112 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_CACHE_SHARDED_LRU_CACHE_H_
+#define PAGESPEED_KERNEL_CACHE_SHARDED_LRU_CACHE_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+
+namespace net_instaweb {
+
+class SharedString;
+class ThreadSystem;
+
+// Thread-safe in-memory LRU cache made up of a fixed number of
+// independently locked LRUCache shards.  Each key is hashed to one shard,
+// so operations on keys in different shards never contend for the same
+// mutex.  This is intended as a drop-in replacement for
+// ThreadsafeCache(LRUCache) when many threads share one in-process cache.
+//
+// The capacity is divided evenly between the shards, and LRU order is
+// maintained per shard rather than globally.  So an entry larger than
+// max_size / num_shards can never be stored, and an eviction may remove an
+// entry that is not the least recently used one in the whole cache.
+//
+// As with ThreadsafeCache, a shard's lock is held while the callback's
+// validator runs, but is released before Done is called.
+//
+// Gets take the shard's lock too, since a hit moves the entry to the front
+// of the shard's LRU list.  Approximating LRU with CLOCK-style reference
+// bits would spare Gets that write, but not the lock: LRUCache's map can't
+// be read while another thread changes it, and there's no concurrent map in
+// this code base to replace it with.  Gets on different shards already
+// proceed in parallel.
+class ShardedLRUCache : public CacheInterface {
+ public:
+  // A reasonable default for num_shards; a power of two comfortably above
+  // the number of cores on a typical server.
+  static const int kDefaultNumShards = 16;
+
+  // Creates a cache holding at most max_size bytes of keys and values
+  // spread across num_shards shards.  Does not take ownership of
+  // thread_system, which is used only to create a mutex per shard.
+  ShardedLRUCache(int num_shards, size_t max_size, ThreadSystem* thread_system);
+  virtual ~ShardedLRUCache();
+
+  virtual void Get(const GoogleString& key, Callback* callback);
+  virtual void Put(const GoogleString& key, SharedString* new_value);
+  virtual void Delete(const GoogleString& key);
+
+  int num_shards() const { return shards_.size(); }
+
+  // The following accessors sum their value over all shards, locking each
+  // shard in turn.  Since the shards are not all locked at once, the result
+  // is not an atomic snapshot when the cache is in use from other threads.
+  size_t size_bytes() const;
+  size_t max_bytes_in_cache() const;
+  size_t num_elements() const;
+  size_t num_evictions() const;
+  size_t num_hits() const;
+  size_t num_misses() const;
+  size_t num_inserts() const;
+  size_t num_identical_reinserts() const;
+  size_t num_deletes() const;
+
+  // Sanity check the data structures of every shard.
+  void SanityCheck();
+
+  // Clear the entire cache.  Used primarily for testing.  As with
+  // LRUCache::Clear, this does not clear the stats.
+  void Clear();
+
+  // Clear the stats -- note that this will not clear the content.
+  void ClearStats();
+
+  static GoogleString FormatName(int num_shards);
+  virtual GoogleString Name() const { return FormatName(num_shards()); }
+  virtual bool IsBlocking() const { return true; }
+  virtual bool IsHealthy() const;
+  virtual void ShutDown();
+
+  void set_is_healthy(bool x);
+
+ private:
+  class Shard;
+
+  Shard* ShardForKey(const GoogleString& key) const;
+
+  std::vector<Shard*> shards_;
+
+  DISALLOW_COPY_AND_ASSIGN(ShardedLRUCache);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_CACHE_SHARDED_LRU_CACHE_H_
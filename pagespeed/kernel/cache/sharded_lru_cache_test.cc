@@ -0,0 +1,185 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Unit-test the sharded lru cache.
+
+#include "pagespeed/kernel/cache/sharded_lru_cache.h"
+
+#include <cstddef>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/cache/cache_spammer.h"
+#include "pagespeed/kernel/cache/cache_test_base.h"
+#include "pagespeed/kernel/util/platform.h"
+
+namespace {
+
+const int kNumShards = 4;
+
+// Large enough that each shard could hold every key the tests insert, so
+// the tests that don't expect evictions are independent of how keys hash.
+const size_t kMaxSize = 1000;
+
+const int kNumThreads = 4;
+const int kNumIters = 10000;
+const int kNumInserts = 10;
+
+}  // namespace
+
+namespace net_instaweb {
+
+class ShardedLRUCacheTest : public CacheTestBase {
+ protected:
+  ShardedLRUCacheTest()
+      : thread_runtime_(Platform::CreateThreadSystem()),
+        cache_(new ShardedLRUCache(kNumShards, kMaxSize,
+                                   thread_runtime_.get())) {
+  }
+
+  virtual CacheInterface* Cache() { return cache_.get(); }
+  virtual void PostOpCleanup() { cache_->SanityCheck(); }
+
+  void ResetCache(int num_shards, size_t max_size) {
+    cache_.reset(new ShardedLRUCache(num_shards, max_size,
+                                     thread_runtime_.get()));
+  }
+
+  void SpamHelper(bool expecting_evictions, bool do_deletes,
+                  const char* value_pattern) {
+    CacheSpammer::RunTests(kNumThreads, kNumIters, kNumInserts,
+                           expecting_evictions, do_deletes, value_pattern,
+                           cache_.get(), thread_runtime_.get());
+    cache_->SanityCheck();
+  }
+
+  scoped_ptr<ThreadSystem> thread_runtime_;
+  scoped_ptr<ShardedLRUCache> cache_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ShardedLRUCacheTest);
+};
+
+TEST_F(ShardedLRUCacheTest, PutGetDelete) {
+  EXPECT_EQ(static_cast<size_t>(0), cache_->size_bytes());
+  EXPECT_EQ(static_cast<size_t>(0), cache_->num_elements());
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  EXPECT_EQ(static_cast<size_t>(9), cache_->size_bytes());  // "Name" + "Value"
+  EXPECT_EQ(static_cast<size_t>(1), cache_->num_elements());
+  CheckNotFound("Another Name");
+
+  CheckPut("Name", "NewValue");
+  CheckGet("Name", "NewValue");
+  EXPECT_EQ(static_cast<size_t>(12),
+            cache_->size_bytes());  // "Name" + "NewValue"
+  EXPECT_EQ(static_cast<size_t>(1), cache_->num_elements());
+
+  CheckDelete("Name");
+  CheckNotFound("Name");
+  EXPECT_EQ(static_cast<size_t>(0), cache_->size_bytes());
+  EXPECT_EQ(static_cast<size_t>(0), cache_->num_elements());
+}
+
+TEST_F(ShardedLRUCacheTest, CapacityIsSplitAcrossShards) {
+  ResetCache(3, 100);
+  EXPECT_EQ(3, cache_->num_shards());
+  EXPECT_EQ(static_cast<size_t>(100), cache_->max_bytes_in_cache());
+
+  // A single entry larger than one shard's share can't be stored.
+  CheckPut("big", GoogleString(40, 'x'));
+  CheckNotFound("big");
+}
+
+TEST_F(ShardedLRUCacheTest, StatsSumOverShards) {
+  for (int i = 0; i < 20; ++i) {
+    CheckPut(StrCat("name", IntegerToString(i)), "value");
+  }
+  EXPECT_EQ(static_cast<size_t>(20), cache_->num_elements());
+  EXPECT_EQ(static_cast<size_t>(20), cache_->num_inserts());
+  for (int i = 0; i < 20; ++i) {
+    CheckGet(StrCat("name", IntegerToString(i)), "value");
+  }
+  CheckNotFound("absent");
+  EXPECT_EQ(static_cast<size_t>(20), cache_->num_hits());
+  EXPECT_EQ(static_cast<size_t>(1), cache_->num_misses());
+
+  cache_->ClearStats();
+  EXPECT_EQ(static_cast<size_t>(0), cache_->num_hits());
+  EXPECT_EQ(static_cast<size_t>(20), cache_->num_elements());
+  cache_->Clear();
+  EXPECT_EQ(static_cast<size_t>(0), cache_->num_elements());
+  EXPECT_EQ(static_cast<size_t>(0), cache_->size_bytes());
+}
+
+TEST_F(ShardedLRUCacheTest, Evictions) {
+  // 10 bytes per entry into a 100 byte cache split four ways: each shard
+  // holds at most two entries, so 20 entries must evict.
+  ResetCache(kNumShards, 100);
+  for (int i = 0; i < 20; ++i) {
+    CheckPut(StrCat("name", IntegerToString(i % 10), "x"),
+             StrCat("val", IntegerToString(i)));
+  }
+  EXPECT_LT(static_cast<size_t>(0), cache_->num_evictions());
+  EXPECT_GE(static_cast<size_t>(100), cache_->size_bytes());
+}
+
+TEST_F(ShardedLRUCacheTest, BasicInvalid) {
+  // Check that we honor callback veto on validity.
+  CheckPut("nameA", "valueA");
+  CheckPut("nameB", "valueB");
+  CheckGet("nameA", "valueA");
+  CheckGet("nameB", "valueB");
+  set_invalid_value("valueA");
+  CheckNotFound("nameA");
+  CheckGet("nameB", "valueB");
+}
+
+TEST_F(ShardedLRUCacheTest, MultiGet) {
+  TestMultiGet();
+}
+
+TEST_F(ShardedLRUCacheTest, ShutDown) {
+  CheckPut("Name", "Value");
+  EXPECT_TRUE(cache_->IsHealthy());
+  cache_->ShutDown();
+  EXPECT_FALSE(cache_->IsHealthy());
+  CheckNotFound("Name");
+  CheckPut("Name2", "Value2");
+  CheckNotFound("Name2");
+}
+
+TEST_F(ShardedLRUCacheTest, SpamCacheNoEvictionsOrDeletions) {
+  SpamHelper(false, false, "valu%d");
+}
+
+TEST_F(ShardedLRUCacheTest, SpamCacheWithEvictions) {
+  ResetCache(kNumShards, 100);
+  SpamHelper(true, false, "value%d");
+}
+
+TEST_F(ShardedLRUCacheTest, SpamCacheWithDeletions) {
+  SpamHelper(false, true, "valu%d");
+}
+
+TEST_F(ShardedLRUCacheTest, SpamCacheWithDeletionsAndEvictions) {
+  ResetCache(kNumShards, 100);
+  SpamHelper(true, true, "value%d");
+}
+
+}  // namespace net_instaweb
@@ -49,6 +49,7 @@ class CollapseWhitespaceFilter : public EmptyHtmlFilter {
   virtual void EndElement(HtmlElement* element);
   virtual void Characters(HtmlCharactersNode* characters);
   virtual const char* Name() const { return "CollapseWhitespace"; }
+  virtual bool IsStreamingSafe() const { return true; }
 
  private:
   HtmlParse* html_parse_;
@@ -19,6 +19,7 @@
 #ifndef PAGESPEED_KERNEL_HTML_HTML_ELEMENT_H_
 #define PAGESPEED_KERNEL_HTML_HTML_ELEMENT_H_
 
+#include "pagespeed/kernel/base/arena.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/inline_slist.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
@@ -342,7 +343,8 @@ class HtmlElement : public HtmlNode {
 
  protected:
   virtual void SynthesizeEvents(const HtmlEventListIterator& iter,
-                                HtmlEventList* queue);
+                                HtmlEventList* queue,
+                                Arena<HtmlEvent>* arena);
 
   virtual HtmlEventListIterator begin() const { return data_->begin_; }
   virtual HtmlEventListIterator end() const { return data_->end_; }
@@ -19,20 +19,36 @@
 #ifndef PAGESPEED_KERNEL_HTML_HTML_EVENT_H_
 #define PAGESPEED_KERNEL_HTML_HTML_EVENT_H_
 
+#include <cstddef>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/arena.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/html/html_element.h"
+#include "pagespeed/kernel/html/html_event_list.h"
 #include "pagespeed/kernel/html/html_filter.h"
 #include "pagespeed/kernel/html/html_node.h"
 
 namespace net_instaweb {
 
-class HtmlEvent {
+// Events are allocated in HtmlParse's event arena and are freed all at once
+// when it is recycled, so they must not be deleted directly.
+class HtmlEvent : public HtmlEventLink {
  public:
   explicit HtmlEvent(int line_number) : line_number_(line_number) {
   }
   virtual ~HtmlEvent();
+
+  void* operator new(size_t size, Arena<HtmlEvent>* arena) {
+    return arena->Allocate(size);
+  }
+
+  void operator delete(void* ptr, Arena<HtmlEvent>* arena) {
+    LOG(FATAL) << "HtmlEvent must not be deleted directly.";
+  }
+
   virtual void Run(HtmlFilter* filter) = 0;
   virtual GoogleString ToString() const = 0;
 
@@ -51,12 +67,22 @@ class HtmlEvent {
 
   int line_number() const { return line_number_; }
 
+ protected:
+  // Version that affects visibility of the destructor.
+  void operator delete(void* ptr) {
+    LOG(FATAL) << "HtmlEvent must not be deleted directly.";
+  }
+
  private:
   int line_number_;
 
   DISALLOW_COPY_AND_ASSIGN(HtmlEvent);
 };
 
+inline HtmlEvent* HtmlEventListIterator::operator*() const {
+  return static_cast<HtmlEvent*>(link_);
+}
+
 class HtmlStartDocumentEvent: public HtmlEvent {
  public:
   explicit HtmlStartDocumentEvent(int line_number) : HtmlEvent(line_number) {}
@@ -0,0 +1,92 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pagespeed/kernel/html/html_event_list.h"
+
+#include "base/logging.h"
+#include "pagespeed/kernel/html/html_event.h"
+
+namespace net_instaweb {
+
+HtmlEventList::HtmlEventList() : size_(0) {
+  sentinel_.prev_ = &sentinel_;
+  sentinel_.next_ = &sentinel_;
+}
+
+HtmlEventList::~HtmlEventList() {
+}
+
+HtmlEventList::iterator HtmlEventList::insert(const iterator& pos,
+                                              HtmlEvent* event) {
+  HtmlEventLink* link = event;
+  HtmlEventLink* next = pos.link_;
+  DCHECK(link->prev_ == NULL && link->next_ == NULL)
+      << "Event is already on a list";
+  link->prev_ = next->prev_;
+  link->next_ = next;
+  next->prev_->next_ = link;
+  next->prev_ = link;
+  ++size_;
+  return iterator(link);
+}
+
+HtmlEventList::iterator HtmlEventList::erase(const iterator& pos) {
+  HtmlEventLink* link = pos.link_;
+  DCHECK(link != &sentinel_) << "Erasing end()";
+  HtmlEventLink* next = link->next_;
+  link->prev_->next_ = next;
+  next->prev_ = link->prev_;
+  link->prev_ = NULL;
+  link->next_ = NULL;
+  --size_;
+  return iterator(next);
+}
+
+void HtmlEventList::splice(const iterator& pos, HtmlEventList& other,
+                           const iterator& first, const iterator& last) {
+  if (first == last) {
+    return;
+  }
+  if (&other != this) {
+    size_t count = 0;
+    for (iterator p = first; p != last; ++p) {
+      ++count;
+    }
+    other.size_ -= count;
+    size_ += count;
+  }
+
+  // Unlink [head, tail] from its list...
+  HtmlEventLink* head = first.link_;
+  HtmlEventLink* tail = last.link_->prev_;
+  head->prev_->next_ = last.link_;
+  last.link_->prev_ = head->prev_;
+
+  // ...and link it in before pos.
+  HtmlEventLink* next = pos.link_;
+  head->prev_ = next->prev_;
+  tail->next_ = next;
+  next->prev_->next_ = head;
+  next->prev_ = tail;
+}
+
+void HtmlEventList::clear() {
+  // The events themselves are freed with their arena, so there's no need to
+  // clear their links.
+  sentinel_.prev_ = &sentinel_;
+  sentinel_.next_ = &sentinel_;
+  size_ = 0;
+}
+
+}  // namespace net_instaweb
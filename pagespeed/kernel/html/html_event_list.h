@@ -0,0 +1,155 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_HTML_HTML_EVENT_LIST_H_
+#define PAGESPEED_KERNEL_HTML_HTML_EVENT_LIST_H_
+
+#include <cstddef>
+#include <iterator>
+
+#include "pagespeed/kernel/base/basictypes.h"
+
+namespace net_instaweb {
+
+class HtmlEvent;
+class HtmlEventList;
+
+// The prev/next links by which an HtmlEvent is threaded onto an
+// HtmlEventList.  HtmlEvent inherits from this, so putting an event on a
+// list, or moving it between lists, never allocates.  An event can be on at
+// most one list at a time.
+class HtmlEventLink {
+ protected:
+  HtmlEventLink() : prev_(NULL), next_(NULL) {}
+
+ private:
+  friend class HtmlEventList;
+  friend class HtmlEventListIterator;
+
+  HtmlEventLink* prev_;
+  HtmlEventLink* next_;
+
+  DISALLOW_COPY_AND_ASSIGN(HtmlEventLink);
+};
+
+// Bidirectional iterator over an HtmlEventList.  Like a std::list iterator,
+// it stays valid while its event is spliced to another position or list,
+// and end() is specific to the list it came from.
+class HtmlEventListIterator {
+ public:
+  typedef std::bidirectional_iterator_tag iterator_category;
+  typedef HtmlEvent* value_type;
+  typedef ptrdiff_t difference_type;
+  typedef HtmlEvent** pointer;
+  typedef HtmlEvent* reference;
+
+  HtmlEventListIterator() : link_(NULL) {}
+
+  // Defined in html_event.h, where HtmlEvent is complete.
+  inline HtmlEvent* operator*() const;
+
+  HtmlEventListIterator& operator++() {
+    link_ = link_->next_;
+    return *this;
+  }
+  HtmlEventListIterator operator++(int) {
+    HtmlEventListIterator prev = *this;
+    link_ = link_->next_;
+    return prev;
+  }
+  HtmlEventListIterator& operator--() {
+    link_ = link_->prev_;
+    return *this;
+  }
+  HtmlEventListIterator operator--(int) {
+    HtmlEventListIterator next = *this;
+    link_ = link_->prev_;
+    return next;
+  }
+
+  bool operator==(const HtmlEventListIterator& that) const {
+    return link_ == that.link_;
+  }
+  bool operator!=(const HtmlEventListIterator& that) const {
+    return link_ != that.link_;
+  }
+
+ private:
+  friend class HtmlEventList;
+
+  explicit HtmlEventListIterator(HtmlEventLink* link) : link_(link) {}
+
+  HtmlEventLink* link_;
+
+  // Copying is allowed.
+};
+
+// A doubly linked list of HtmlEvents threaded through the events
+// themselves, providing the subset of the std::list<HtmlEvent*> interface
+// HtmlParse uses.  The list does not own its events: they are allocated in,
+// and freed with, HtmlParse's event arena.
+class HtmlEventList {
+ public:
+  typedef HtmlEventListIterator iterator;
+
+  HtmlEventList();
+  ~HtmlEventList();
+
+  // Iterators give mutable access to the events even from a const list, as
+  // with a list of pointers.
+  iterator begin() const { return iterator(sentinel()->next_); }
+  iterator end() const { return iterator(sentinel()); }
+
+  bool empty() const { return sentinel_.next_ == &sentinel_; }
+  size_t size() const { return size_; }
+
+  void push_back(HtmlEvent* event) { insert(end(), event); }
+  void push_front(HtmlEvent* event) { insert(begin(), event); }
+
+  // Links event in before pos, returning an iterator to it.
+  iterator insert(const iterator& pos, HtmlEvent* event);
+
+  // Unlinks the event at pos, returning an iterator to the event after it.
+  iterator erase(const iterator& pos);
+
+  // Moves the events in [first, last) from other, which may be this list,
+  // to just before pos.  Iterators to the moved events remain valid.
+  void splice(const iterator& pos, HtmlEventList& other,  // NOLINT
+              const iterator& first, const iterator& last);
+
+  // Unlinks all events.
+  void clear();
+
+ private:
+  class Sentinel : public HtmlEventLink {
+   public:
+    Sentinel() {}
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(Sentinel);
+  };
+
+  HtmlEventLink* sentinel() const {
+    return const_cast<Sentinel*>(&sentinel_);
+  }
+
+  Sentinel sentinel_;
+  size_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(HtmlEventList);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_HTML_HTML_EVENT_LIST_H_
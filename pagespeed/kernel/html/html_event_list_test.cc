@@ -0,0 +1,157 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Unit-test the intrusive event list.
+
+#include "pagespeed/kernel/html/html_event_list.h"
+
+#include "pagespeed/kernel/base/arena.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/html/html_event.h"
+
+namespace net_instaweb {
+
+namespace {
+
+class HtmlEventListTest : public testing::Test {
+ protected:
+  virtual void TearDown() {
+    arena_.DestroyObjects();
+  }
+
+  // Makes an event that can be identified by its line number.
+  HtmlEvent* NewEvent(int id) {
+    return new (&arena_) HtmlStartDocumentEvent(id);
+  }
+
+  // Returns the ids of the events in list, walking both forwards and
+  // backwards, e.g. "1 2 3/3 2 1".
+  static GoogleString Ids(const HtmlEventList& list) {
+    GoogleString forward, backward;
+    for (HtmlEventList::iterator p = list.begin(); p != list.end(); ++p) {
+      StrAppend(&forward, forward.empty() ? "" : " ",
+                IntegerToString((*p)->line_number()));
+    }
+    HtmlEventList::iterator p = list.end();
+    while (p != list.begin()) {
+      --p;
+      StrAppend(&backward, backward.empty() ? "" : " ",
+                IntegerToString((*p)->line_number()));
+    }
+    return StrCat(forward, "/", backward);
+  }
+
+  Arena<HtmlEvent> arena_;
+};
+
+TEST_F(HtmlEventListTest, Empty) {
+  HtmlEventList list;
+  EXPECT_TRUE(list.empty());
+  EXPECT_EQ(0, list.size());
+  EXPECT_TRUE(list.begin() == list.end());
+  EXPECT_EQ("/", Ids(list));
+}
+
+TEST_F(HtmlEventListTest, InsertAndErase) {
+  HtmlEventList list;
+  list.push_back(NewEvent(2));
+  list.push_front(NewEvent(1));
+  list.push_back(NewEvent(4));
+  HtmlEventList::iterator four = list.end();
+  --four;
+  HtmlEventList::iterator three = list.insert(four, NewEvent(3));
+  EXPECT_EQ(3, (*three)->line_number());
+  EXPECT_EQ(4, list.size());
+  EXPECT_EQ("1 2 3 4/4 3 2 1", Ids(list));
+
+  HtmlEvent* event = *three;
+  HtmlEventList::iterator next = list.erase(three);
+  EXPECT_TRUE(next == four);
+  EXPECT_EQ(3, list.size());
+  EXPECT_EQ("1 2 4/4 2 1", Ids(list));
+
+  // An erased event can be put back on a list.
+  list.insert(list.begin(), event);
+  EXPECT_EQ("3 1 2 4/4 2 1 3", Ids(list));
+
+  list.clear();
+  EXPECT_TRUE(list.empty());
+  EXPECT_EQ(0, list.size());
+  EXPECT_EQ("/", Ids(list));
+}
+
+TEST_F(HtmlEventListTest, SpliceBetweenLists) {
+  HtmlEventList a, b;
+  for (int i = 1; i <= 5; ++i) {
+    a.push_back(NewEvent(i));
+  }
+  b.push_back(NewEvent(10));
+  HtmlEventList::iterator first = a.begin();
+  ++first;
+  HtmlEventList::iterator last = first;
+  ++last;
+  ++last;
+  ++last;  // [2, 5)
+
+  // Iterators into the moved range stay valid.
+  HtmlEventList::iterator two = first;
+  b.splice(b.begin(), a, first, last);
+  EXPECT_EQ("1 5/5 1", Ids(a));
+  EXPECT_EQ("2 3 4 10/10 4 3 2", Ids(b));
+  EXPECT_EQ(2, a.size());
+  EXPECT_EQ(4, b.size());
+  EXPECT_TRUE(two == b.begin());
+
+  // Splicing everything back to the end.
+  a.splice(a.end(), b, b.begin(), b.end());
+  EXPECT_TRUE(b.empty());
+  EXPECT_EQ(0, b.size());
+  EXPECT_EQ(6, a.size());
+  EXPECT_EQ("1 5 2 3 4 10/10 4 3 2 5 1", Ids(a));
+
+  // An empty range is a no-op.
+  a.splice(a.begin(), b, b.begin(), b.end());
+  EXPECT_EQ(6, a.size());
+  EXPECT_EQ("1 5 2 3 4 10/10 4 3 2 5 1", Ids(a));
+}
+
+TEST_F(HtmlEventListTest, SpliceWithinList) {
+  HtmlEventList list;
+  for (int i = 1; i <= 5; ++i) {
+    list.push_back(NewEvent(i));
+  }
+  HtmlEventList::iterator four = list.end();
+  --four;
+  --four;
+  HtmlEventList::iterator two = list.begin();
+  ++two;
+
+  // Move [4, 5] to the front.
+  list.splice(list.begin(), list, four, list.end());
+  EXPECT_EQ("4 5 1 2 3/3 2 1 5 4", Ids(list));
+  EXPECT_EQ(5, list.size());
+
+  // Move [2] to the end.
+  HtmlEventList::iterator three = two;
+  ++three;
+  list.splice(list.end(), list, two, three);
+  EXPECT_EQ("4 5 1 3 2/2 3 1 5 4", Ids(list));
+  EXPECT_EQ(5, list.size());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -90,6 +90,19 @@ class HtmlFilter {
   // pre-render filters to inherit off it.
   virtual void RenderDone();
 
+  // Returns true if this filter can be fused with adjacent streaming-safe
+  // filters, so that HtmlParse makes a single pass over the flush window,
+  // running each event through all of them in turn, rather than one pass
+  // per filter.  A filter that returns true promises that:
+  //   - it mutates a node only in place, and only from the event that
+  //     introduces it (StartElement for an element), never after;
+  //   - it does not insert, delete, move, replace, defer or restore nodes;
+  //   - it does not look ahead of the current event, nor depend on what a
+  //     later filter does to the current flush window.
+  // HtmlParse reports a violation of the structural rules as a DFATAL.
+  // Default implementation returns false.
+  virtual bool IsStreamingSafe() const { return false; }
+
   // Invoked by rewrite driver where all filters should determine whether
   // they are enabled for this request. The re-writer my optionally set
   // disabled_reason to explain why it disabled itself, which will appear
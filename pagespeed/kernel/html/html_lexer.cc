@@ -23,6 +23,12 @@
 #include <cstdarg>
 #include <cstddef>  // for size_t
 #include <cstdio>
+#include <cstring>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define PAGESPEED_HTML_LEXER_SSE2 1
+#endif
 
 #include "base/logging.h"
 #include "pagespeed/kernel/base/message_handler.h"
@@ -145,6 +151,51 @@ bool IsInSet(const HtmlName::Keyword* keywords, int num,
 #define IS_IN_SET(keywords, keyword) \
     IsInSet(keywords, arraysize(keywords), keyword)
 
+// How far back EvalScriptTag looks into literal_: it acts on the byte after
+// "</script", "<script", "<!-" or "--".
+const size_t kScriptLookbehind = STATIC_STRLEN("</script");
+
+// Returns a pointer to the first occurrence of c in [begin, end), or end.
+// memchr is vectorized by the C library.
+inline const char* FindByte(const char* begin, const char* end, char c) {
+  const void* found = memchr(begin, c, end - begin);
+  return (found == NULL) ? end : static_cast<const char*>(found);
+}
+
+// Returns a pointer to the first occurrence of a or b in [begin, end), or
+// end.
+inline const char* FindEitherByte(const char* begin, const char* end,
+                                  char a, char b) {
+#ifdef PAGESPEED_HTML_LEXER_SSE2
+  const __m128i va = _mm_set1_epi8(a);
+  const __m128i vb = _mm_set1_epi8(b);
+  for (; end - begin >= 16; begin += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, va),
+                                              _mm_cmpeq_epi8(chunk, vb)));
+    if (mask != 0) {
+      return begin + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; begin < end; ++begin) {
+    if ((*begin == a) || (*begin == b)) {
+      break;
+    }
+  }
+  return begin;
+}
+
+// Returns the number of newlines in [begin, end).
+inline int CountNewlines(const char* begin, const char* end) {
+  int count = 0;
+  while ((begin = FindByte(begin, end, '\n')) != end) {
+    ++count;
+    ++begin;
+  }
+  return count;
+}
+
 }  // namespace
 
 // TODO(jmarantz): support multi-byte encodings
@@ -637,8 +688,10 @@ void HtmlLexer::EvalScriptTag(char c) {
 // Emits raw uninterpreted characters.
 void HtmlLexer::EmitLiteral() {
   if (!literal_.empty()) {
-    html_parse_->AddEvent(new HtmlCharactersEvent(
-        html_parse_->NewCharactersNode(Parent(), literal_), tag_start_line_));
+    html_parse_->AddEvent(
+        new (html_parse_->event_arena()) HtmlCharactersEvent(
+            html_parse_->NewCharactersNode(Parent(), literal_),
+            tag_start_line_));
     literal_.clear();
   }
   state_ = START;
@@ -654,10 +707,12 @@ void HtmlLexer::EmitComment() {
       (token_.find("[endif]") != GoogleString::npos)) {
     HtmlIEDirectiveNode* node =
         html_parse_->NewIEDirectiveNode(Parent(), token_);
-    html_parse_->AddEvent(new HtmlIEDirectiveEvent(node, tag_start_line_));
+    html_parse_->AddEvent(new (html_parse_->event_arena())
+                          HtmlIEDirectiveEvent(node, tag_start_line_));
   } else {
     HtmlCommentNode* node = html_parse_->NewCommentNode(Parent(), token_);
-    html_parse_->AddEvent(new HtmlCommentEvent(node, tag_start_line_));
+    html_parse_->AddEvent(new (html_parse_->event_arena())
+                          HtmlCommentEvent(node, tag_start_line_));
   }
   token_.clear();
   state_ = START;
@@ -665,7 +720,7 @@ void HtmlLexer::EmitComment() {
 
 void HtmlLexer::EmitCdata() {
   literal_.clear();
-  html_parse_->AddEvent(new HtmlCdataEvent(
+  html_parse_->AddEvent(new (html_parse_->event_arena()) HtmlCdataEvent(
       html_parse_->NewCdataNode(Parent(), token_), tag_start_line_));
   token_.clear();
   state_ = START;
@@ -1013,7 +1068,7 @@ void HtmlLexer::EmitTagClose(HtmlElement::Style style) {
 
 void HtmlLexer::EmitDirective() {
   literal_.clear();
-  html_parse_->AddEvent(new HtmlDirectiveEvent(
+  html_parse_->AddEvent(new (html_parse_->event_arena()) HtmlDirectiveEvent(
       html_parse_->NewDirectiveNode(Parent(), token_), line_));
   // Update the doctype; note that if this is not a doctype directive, Parse()
   // will return false and not alter doctype_.
@@ -1035,6 +1090,14 @@ void HtmlLexer::Parse(const char* text, int size) {
       // Return without doing anything if skip_parsing_ is true.
       return;
     }
+
+    // Text, comment bodies, attribute values and the like are mostly long
+    // runs of bytes that don't change our state, so skip over those in bulk
+    // and only step through the state machine for the bytes that matter.
+    i += ConsumeInertBytes(text + i, size - i);
+    if (i == size) {
+      break;
+    }
     char c = text[i];
     if (c == '\n') {
       ++line_;
@@ -1084,6 +1147,58 @@ void HtmlLexer::Parse(const char* text, int size) {
   }
 }
 
+int HtmlLexer::ConsumeInertBytes(const char* text, int size) {
+  const char* end = text + size;
+  const char* stop = text;
+  GoogleString* token = NULL;  // Other than literal_, which always gets it.
+  switch (state_) {
+    case START:
+      stop = FindByte(text, end, '<');
+      break;
+    case COMMENT_BODY:
+      stop = FindByte(text, end, '-');
+      token = &token_;
+      break;
+    case CDATA_BODY:
+      stop = FindByte(text, end, ']');
+      token = &token_;
+      break;
+    case TAG_ATTR_VALDQ:
+      stop = FindByte(text, end, '"');
+      token = &attr_value_;
+      break;
+    case TAG_ATTR_VALSQ:
+      stop = FindByte(text, end, '\'');
+      token = &attr_value_;
+      break;
+    case LITERAL_TAG:
+      stop = FindByte(text, end, '>');
+      break;
+    case SCRIPT_TAG: {
+      // Everything EvalScriptTag does is keyed off a '<' or '-' at most
+      // kScriptLookbehind bytes back, so we can skip up to the next of those
+      // provided there isn't one at the end of literal_ already.
+      size_t tail = (literal_.size() > kScriptLookbehind) ?
+          literal_.size() - kScriptLookbehind : 0;
+      if (literal_.find_first_of("<-", tail) == GoogleString::npos) {
+        stop = FindEitherByte(text, end, '<', '-');
+      }
+      break;
+    }
+    default:
+      break;
+  }
+  int consumed = stop - text;
+  if (consumed != 0) {
+    literal_.append(text, consumed);
+    if (token != NULL) {
+      token->append(text, consumed);
+    }
+    line_ += CountNewlines(text, stop);
+  }
+  return consumed;
+}
+
 // The HTML-input sloppiness in these three methods is applied independent
 // of whether we think the document is XHTML, either via doctype or
 // mime-type.  The internet is full of lies.  See Issue 252:
@@ -129,6 +129,12 @@ class HtmlLexer {
   inline void EvalDirective(char c);
   inline void EvalBogusComment(char c);
 
+  // Consumes the longest prefix of [text, text + size) that the current state
+  // would merely accumulate, one byte at a time, into literal_ and possibly
+  // token_ or attr_value_, and appends it to them in bulk.  Returns the
+  // number of bytes consumed, which is 0 in states that do more per byte.
+  int ConsumeInertBytes(const char* text, int size);
+
   // Makes an element based on token_, which will be parsed as the tag
   // name.
   void MakeElement();
@@ -20,7 +20,6 @@
 #define PAGESPEED_KERNEL_HTML_HTML_NODE_H_
 
 #include <cstddef>
-#include <list>
 
 #include "base/logging.h"
 #include "pagespeed/kernel/base/arena.h"
@@ -28,15 +27,13 @@
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/html/html_event_list.h"
 
 namespace net_instaweb {
 
 class HtmlElement;
 class HtmlEvent;
 
-typedef std::list<HtmlEvent*> HtmlEventList;
-typedef HtmlEventList::iterator HtmlEventListIterator;
-
 // Base class for HtmlElement and HtmlLeafNode.  Generally represents all
 // lexical tokens in HTML, except that for subclass HtmlElement, which
 // represents both the opening & closing token.
@@ -73,9 +70,11 @@ class HtmlNode {
   // Create new event object(s) representing this node, and insert them into
   // the queue just before the given iterator; also, update this node object as
   // necessary so that begin() and end() will return iterators pointing to
-  // the new event(s).  The line number for each event should probably be -1.
+  // the new event(s).  The events are allocated in arena.  The line number
+  // for each event should probably be -1.
   virtual void SynthesizeEvents(const HtmlEventListIterator& iter,
-                                HtmlEventList* queue) = 0;
+                                HtmlEventList* queue,
+                                Arena<HtmlEvent>* arena) = 0;
 
   // Return an iterator pointing to the first event associated with this node.
   virtual HtmlEventListIterator begin() const = 0;
@@ -151,7 +150,8 @@ class HtmlCdataNode : public HtmlLeafNode {
 
  protected:
   virtual void SynthesizeEvents(const HtmlEventListIterator& iter,
-                                HtmlEventList* queue);
+                                HtmlEventList* queue,
+                                Arena<HtmlEvent>* arena);
 
  private:
   HtmlCdataNode(HtmlElement* parent,
@@ -177,7 +177,8 @@ class HtmlCharactersNode : public HtmlLeafNode {
 
  protected:
   virtual void SynthesizeEvents(const HtmlEventListIterator& iter,
-                                HtmlEventList* queue);
+                                HtmlEventList* queue,
+                                Arena<HtmlEvent>* arena);
 
  private:
   HtmlCharactersNode(HtmlElement* parent,
@@ -197,7 +198,8 @@ class HtmlCommentNode : public HtmlLeafNode {
 
  protected:
   virtual void SynthesizeEvents(const HtmlEventListIterator& iter,
-                                HtmlEventList* queue);
+                                HtmlEventList* queue,
+                                Arena<HtmlEvent>* arena);
 
  private:
   HtmlCommentNode(HtmlElement* parent,
@@ -217,7 +219,8 @@ class HtmlIEDirectiveNode : public HtmlLeafNode {
 
  protected:
   virtual void SynthesizeEvents(const HtmlEventListIterator& iter,
-                                HtmlEventList* queue);
+                                HtmlEventList* queue,
+                                Arena<HtmlEvent>* arena);
 
  private:
   HtmlIEDirectiveNode(HtmlElement* parent,
@@ -237,7 +240,8 @@ class HtmlDirectiveNode : public HtmlLeafNode {
 
  protected:
   virtual void SynthesizeEvents(const HtmlEventListIterator& iter,
-                                HtmlEventList* queue);
+                                HtmlEventList* queue,
+                                Arena<HtmlEvent>* arena);
 
  private:
   HtmlDirectiveNode(HtmlElement* parent,
@@ -24,8 +24,10 @@
 #include "base/logging.h"
 #include "pagespeed/kernel/base/arena.h"
 #include "pagespeed/kernel/base/atom.h"
+#include "pagespeed/kernel/base/filter_profiler.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/print_message_handler.h"
+#include "pagespeed/kernel/base/request_timeline.h"
 #include "pagespeed/kernel/base/stl_util.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
@@ -47,6 +49,9 @@ HtmlParse::HtmlParse(MessageHandler* message_handler)
     : lexer_(NULL),  // Can't initialize here, since "this" should not be used
                      // in the initializer list (it generates an error in
                      // Visual Studio builds).
+      events_(new Arena<HtmlEvent>),
+      num_deleted_arena_events_(0),
+      num_deleted_arena_chunks_(0),
       current_(queue_.end()),
       message_handler_(message_handler),
       line_number_(1),
@@ -58,8 +63,14 @@ HtmlParse::HtmlParse(MessageHandler* message_handler)
       url_valid_(false),
       log_rewrite_timing_(false),
       running_filters_(false),
+      fuse_streaming_filters_(true),
+      running_fused_filters_(false),
       parse_start_time_us_(0),
+      delayed_start_literal_(NULL),
       timer_(NULL),
+      filter_profiler_(NULL),
+      request_timeline_(NULL),
+      flush_window_bytes_(0),
       current_filter_(NULL),
       dynamically_disabled_filter_list_(NULL) {
   lexer_ = new HtmlLexer(this);
@@ -68,7 +79,7 @@ HtmlParse::HtmlParse(MessageHandler* message_handler)
 
 HtmlParse::~HtmlParse() {
   delete lexer_;
-  STLDeleteElements(&queue_);
+  queue_.clear();
   STLDeleteElements(&event_listeners_);
   ClearElements();
 }
@@ -188,7 +199,7 @@ HtmlElement* HtmlParse::NewElement(HtmlElement* parent, const HtmlName& name) {
 
 void HtmlParse::AddElement(HtmlElement* element, int line_number) {
   HtmlStartElementEvent* event =
-      new HtmlStartElementEvent(element, line_number);
+      new (event_arena()) HtmlStartElementEvent(element, line_number);
   AddEvent(event);
   element->set_begin(Last());
   element->set_begin_line_number(line_number);
@@ -196,7 +207,7 @@ void HtmlParse::AddElement(HtmlElement* element, int line_number) {
 
 bool HtmlParse::StartParseId(const StringPiece& url, const StringPiece& id,
                              const ContentType& content_type) {
-  delayed_start_literal_.reset();
+  delayed_start_literal_ = NULL;
   determine_enabled_filters_called_ = false;
 
   // Paranoid debug-checking and unconditional clearing of state variables.
@@ -231,7 +242,7 @@ bool HtmlParse::StartParseId(const StringPiece& url, const StringPiece& id,
       parse_start_time_us_ = timer_->NowUs();
       InfoHere("HtmlParse::StartParse");
     }
-    AddEvent(new HtmlStartDocumentEvent(line_number_));
+    AddEvent(new (event_arena()) HtmlStartDocumentEvent(line_number_));
     lexer_->StartParse(id, content_type);
   }
   return url_valid_;
@@ -260,9 +271,9 @@ void HtmlParse::BeginFinishParse() {
   DCHECK(url_valid_) << "Invalid to call FinishParse on invalid input";
   if (url_valid_) {
     lexer_->FinishParse();
-    DCHECK(delayed_start_literal_.get() == NULL);
-    delayed_start_literal_.reset();
-    AddEvent(new HtmlEndDocumentEvent(line_number_));
+    DCHECK(delayed_start_literal_ == NULL);
+    delayed_start_literal_ = NULL;
+    AddEvent(new (event_arena()) HtmlEndDocumentEvent(line_number_));
   }
 }
 
@@ -281,6 +292,7 @@ void HtmlParse::ParseTextInternal(const char* text, int size) {
   DCHECK(url_valid_) << "Invalid to call ParseText with invalid url";
   if (url_valid_) {
     DetermineEnabledFilters();
+    flush_window_bytes_ += size;
     lexer_->Parse(text, size);
   }
 }
@@ -340,12 +352,87 @@ void HtmlParse::ApplyFilter(HtmlFilter* filter) {
   }
 
   ShowProgress(StrCat("ApplyFilter:", filter->Name()).c_str());
+  {
+    FilterProfiler::Scope profile(filter_profiler_,
+                                  FilterProfiler::kHtmlFilter, filter->Name(),
+                                  flush_window_bytes_);
+    RequestTimeline::Span span(request_timeline_, "filter", filter->Name());
+    for (current_ = queue_.begin(); current_ != queue_.end(); NextEvent()) {
+      HtmlEvent* event = *current_;
+      line_number_ = event->line_number();
+      event->Run(filter);
+    }
+    filter->Flush();
+  }
+
+  if (need_sanity_check_) {
+    SanityCheck();
+    need_sanity_check_ = false;
+  }
+  current_filter_ = NULL;
+}
+
+void HtmlParse::ApplyFilters(const FilterList& list) {
+  FilterVector fused;
+  for (FilterList::const_iterator i = list.begin(); i != list.end(); ++i) {
+    HtmlFilter* filter = *i;
+    if (!filter->is_enabled()) {
+      continue;
+    }
+    if (fuse_streaming_filters_ && (filter_profiler_ == NULL) &&
+        filter->IsStreamingSafe()) {
+      fused.push_back(filter);
+    } else {
+      // filter ends the current run of streaming-safe filters, if any.
+      ApplyFusedFilters(&fused);
+      ApplyFilter(filter);
+    }
+  }
+  ApplyFusedFilters(&fused);
+}
+
+void HtmlParse::ApplyFusedFilters(FilterVector* filters) {
+  if (filters->size() <= 1) {
+    if (!filters->empty()) {
+      ApplyFilter(filters->front());
+      filters->clear();
+    }
+    return;
+  }
+  DCHECK(current_filter_ == NULL);
+
+  // Streaming-safe filters never defer nodes, so none of them can have an
+  // open deferred node to splice in, as ApplyFilter does.
+  for (int i = 0, n = filters->size(); i < n; ++i) {
+    DCHECK(open_deferred_nodes_.find((*filters)[i]) ==
+           open_deferred_nodes_.end());
+  }
+  if (coalesce_characters_ && need_coalesce_characters_) {
+    CoalesceAdjacentCharactersNodes();
+    DelayLiteralTag();
+    need_coalesce_characters_ = false;
+  }
+
+  ShowProgress("ApplyFusedFilters");
+  RequestTimeline::Span span(request_timeline_, "filter", "fused filters");
+  running_fused_filters_ = true;
   for (current_ = queue_.begin(); current_ != queue_.end(); NextEvent()) {
     HtmlEvent* event = *current_;
     line_number_ = event->line_number();
-    event->Run(filter);
+    for (int i = 0, n = filters->size(); i < n; ++i) {
+      current_filter_ = (*filters)[i];
+      event->Run(current_filter_);
+      if (skip_increment_) {
+        break;  // A misbehaving filter removed the event; see CheckNotFused.
+      }
+    }
+  }
+  for (int i = 0, n = filters->size(); i < n; ++i) {
+    current_filter_ = (*filters)[i];
+    current_filter_->Flush();
   }
-  filter->Flush();
+  running_fused_filters_ = false;
+  filters->clear();
 
   if (need_sanity_check_) {
     SanityCheck();
@@ -354,6 +441,13 @@ void HtmlParse::ApplyFilter(HtmlFilter* filter) {
   current_filter_ = NULL;
 }
 
+void HtmlParse::CheckNotFused(const char* operation) {
+  if (running_fused_filters_) {
+    LOG(DFATAL) << current_filter_->Name() << " is IsStreamingSafe() but "
+                << "called " << operation;
+  }
+}
+
 void HtmlParse::NextEvent() {
   if (skip_increment_) {
     skip_increment_ = false;
@@ -370,8 +464,8 @@ void HtmlParse::CoalesceAdjacentCharactersNodes() {
     HtmlCharactersNode* node = event->GetCharactersNode();
     if ((node != NULL) && (prev != NULL)) {
       prev->Append(node->contents());
+      // The event itself is freed along with the rest of the flush window.
       current_ = queue_.erase(current_);  // returns element after erased
-      delete event;
       node->MarkAsDead(queue_.end());
       need_sanity_check_ = true;
     } else {
@@ -394,7 +488,7 @@ void HtmlParse::DelayLiteralTag() {
     // tag.  We are not going to process this within the current
     // flush window, but instead wait till the EndElement arrives
     // from the lexer.
-    delayed_start_literal_.reset(event);
+    delayed_start_literal_ = event;
     queue_.erase(current_);
   }
   current_ = queue_.end();
@@ -499,13 +593,14 @@ void HtmlParse::Flush() {
   if (url_valid_) {
     ShowProgress("Flush");
 
-    for (FilterList::iterator i = filters_.begin(); i != filters_.end(); ++i) {
-      HtmlFilter* filter = *i;
-      if (filter->is_enabled()) {
-        ApplyFilter(filter);
-      }
+    RequestTimeline::Span span(request_timeline_, "html", "flush");
+    if (request_timeline_ != NULL) {
+      span.set_detail(StrCat(Integer64ToString(flush_window_bytes_),
+                             " bytes"));
     }
+    ApplyFilters(filters_);
     ClearEvents();
+    flush_window_bytes_ = 0;
   }
 }
 
@@ -533,13 +628,88 @@ void HtmlParse::ClearEvents() {
         }
       }
     }
-    delete event;
   }
   queue_.clear();
+  if (!EventsOutliveFlushWindow()) {
+    FreeEventArenas();
+  } else {
+    // Keep this window's events until the ones carried over are gone, but
+    // don't let that pin the events of every later window too.
+    if (!events_->empty()) {
+      retired_event_arenas_.push_back(events_.release());
+      events_.reset(new Arena<HtmlEvent>);
+    }
+    FreeUnreferencedEventArenas();
+  }
   need_sanity_check_ = false;
   need_coalesce_characters_ = false;
 }
 
+bool HtmlParse::EventsOutliveFlushWindow() const {
+  // A held-back literal tag and the events of deferred nodes are carried
+  // into later flush windows, so the arena must survive until they are gone.
+  // At the latest that's at EndFinishParse.
+  return (delayed_start_literal_ != NULL) || !deferred_nodes_.empty();
+}
+
+void HtmlParse::FreeUnreferencedEventArenas() {
+  std::vector<bool> referenced(retired_event_arenas_.size(), false);
+  std::vector<const HtmlEvent*> carried_over;
+  if (delayed_start_literal_ != NULL) {
+    carried_over.push_back(delayed_start_literal_);
+  }
+  for (NodeToEventListMap::iterator p = deferred_nodes_.begin(),
+           e = deferred_nodes_.end(); p != e; ++p) {
+    HtmlEventList* events = p->second;
+    for (HtmlEventListIterator q = events->begin(); q != events->end(); ++q) {
+      carried_over.push_back(*q);
+    }
+  }
+  for (int i = 0, n = carried_over.size(); i < n; ++i) {
+    for (int j = 0, m = retired_event_arenas_.size(); j < m; ++j) {
+      if (retired_event_arenas_[j]->Contains(carried_over[i])) {
+        referenced[j] = true;
+        break;
+      }
+    }
+  }
+  int num_kept = 0;
+  for (int j = 0, m = retired_event_arenas_.size(); j < m; ++j) {
+    Arena<HtmlEvent>* arena = retired_event_arenas_[j];
+    if (referenced[j]) {
+      retired_event_arenas_[num_kept++] = arena;
+    } else {
+      DeleteEventArena(arena);
+    }
+  }
+  retired_event_arenas_.resize(num_kept);
+}
+
+void HtmlParse::FreeEventArenas() {
+  events_->DestroyObjects();
+  for (int j = 0, m = retired_event_arenas_.size(); j < m; ++j) {
+    DeleteEventArena(retired_event_arenas_[j]);
+  }
+  retired_event_arenas_.clear();
+}
+
+void HtmlParse::DeleteEventArena(Arena<HtmlEvent>* arena) {
+  arena->DestroyObjects();
+  num_deleted_arena_events_ += arena->num_objects_allocated();
+  num_deleted_arena_chunks_ += arena->num_chunks_allocated();
+  delete arena;
+}
+
+void HtmlParse::GetEventAllocationCounts(int64* num_events,
+                                         int64* num_chunks) const {
+  *num_events = num_deleted_arena_events_ + events_->num_objects_allocated();
+  *num_chunks = num_deleted_arena_chunks_ + events_->num_chunks_allocated();
+  for (int j = 0, m = retired_event_arenas_.size(); j < m; ++j) {
+    *num_events += retired_event_arenas_[j]->num_objects_allocated();
+    *num_chunks += retired_event_arenas_[j]->num_chunks_allocated();
+  }
+}
+
 size_t HtmlParse::GetEventQueueSize() {
   return queue_.size();
 }
@@ -609,9 +779,10 @@ void HtmlParse::InsertNodeBeforeCurrent(HtmlNode* new_node) {
 
 void HtmlParse::InsertNodeBeforeEvent(const HtmlEventListIterator& event,
                                       HtmlNode* new_node) {
+  CheckNotFused("InsertNodeBeforeEvent");
   need_sanity_check_ = true;
   need_coalesce_characters_ = true;
-  new_node->SynthesizeEvents(event, &queue_);
+  new_node->SynthesizeEvents(event, &queue_, event_arena());
 }
 
 void HtmlParse::InsertNodeAfterEvent(const HtmlEventListIterator& event,
@@ -722,6 +893,7 @@ bool HtmlParse::MoveCurrentBefore(HtmlNode* element) {
 // Additionally, there are common sense constraints like, current_node and
 // move_to must be within the event window, etc.
 bool HtmlParse::MoveCurrentBeforeEvent(const HtmlEventListIterator& move_to) {
+  CheckNotFused("MoveCurrentBeforeEvent");
   bool ret = false;
   if (move_to != queue_.end() && current_ != queue_.end()) {
     HtmlNode* move_to_node = (*move_to)->GetNode();
@@ -787,6 +959,7 @@ bool HtmlParse::IsDescendantOf(const HtmlNode* possible_child,
 }
 
 bool HtmlParse::DeleteNode(HtmlNode* node) {
+  CheckNotFused("DeleteNode");
   bool deleted = false;
   if (IsRewritable(node)) {
     bool done = false;
@@ -815,8 +988,6 @@ bool HtmlParse::DeleteNode(HtmlNode* node) {
         message_handler_->Check(nested_node->live(), "!nested_node->live()");
         nested_node->MarkAsDead(queue_.end());
       }
-
-      delete event;
     }
 
     // Our iteration should have covered the passed-in element as well.
@@ -841,6 +1012,7 @@ bool HtmlParse::DeleteNode(HtmlNode* node) {
 }
 
 bool HtmlParse::DeleteSavingChildren(HtmlElement* element) {
+  CheckNotFused("DeleteSavingChildren");
   bool deleted = false;
   if (IsRewritable(element)) {
     HtmlElement* new_parent = element->parent();
@@ -946,6 +1118,8 @@ bool HtmlParse::IsInEventWindow(const HtmlEventListIterator& iter) const {
 
 void HtmlParse::ClearElements() {
   ClearDeferredNodes();
+  delayed_start_literal_ = NULL;
+  FreeEventArenas();
   nodes_.DestroyObjects();
   DCHECK(!running_filters_);
 }
@@ -1072,7 +1246,7 @@ void HtmlParse::FatalErrorHere(const char* msg, ...) {
 
 void HtmlParse::CloseElement(
     HtmlElement* element, HtmlElement::Style style, int line_number) {
-  if (delayed_start_literal_.get() != NULL) {
+  if (delayed_start_literal_ != NULL) {
     HtmlElement* element = delayed_start_literal_->GetElementIfStartEvent();
     DCHECK(element != NULL);
     bool insert_at_begin = true;
@@ -1093,8 +1267,8 @@ void HtmlParse::CloseElement(
       if (node != NULL) {
         if (p != queue_.begin()) {
           --p;
-          element->set_begin(
-              queue_.insert(p, delayed_start_literal_.release()));
+          element->set_begin(queue_.insert(p, delayed_start_literal_));
+          delayed_start_literal_ = NULL;
           insert_at_begin = false;
         }
       } else {
@@ -1111,14 +1285,15 @@ void HtmlParse::CloseElement(
       }
     }
     if (insert_at_begin) {
-      queue_.push_front(delayed_start_literal_.release());
+      queue_.push_front(delayed_start_literal_);
+      delayed_start_literal_ = NULL;
       element->set_begin(queue_.begin());
     }
-    DCHECK(delayed_start_literal_.get() == NULL);
+    DCHECK(delayed_start_literal_ == NULL);
   }
 
   HtmlEndElementEvent* end_event =
-      new HtmlEndElementEvent(element, line_number);
+      new (event_arena()) HtmlEndElementEvent(element, line_number);
   if (element->style() != HtmlElement::INVISIBLE) {
     element->set_style(style);
   }
@@ -1210,13 +1385,14 @@ bool HtmlParse::InsertComment(StringPiece unescaped) {
     if (parent != NULL && IsLiteralTag(parent->keyword())) {
       return false;
     }
-    AddEvent(
-        new HtmlCommentEvent(NewCommentNode(lexer_->Parent(), escaped), 0));
+    AddEvent(new (event_arena()) HtmlCommentEvent(
+        NewCommentNode(lexer_->Parent(), escaped), 0));
   }
   return true;
 }
 
 void HtmlParse::DeferCurrentNode() {
+  CheckNotFused("DeferCurrentNode");
   CHECK(current_ != queue_.end());
   HtmlNode* node = (*current_)->GetNode();
 
@@ -1268,6 +1444,7 @@ void HtmlParse::DeferCurrentNode() {
 }
 
 void HtmlParse::RestoreDeferredNode(HtmlNode* deferred_node) {
+  CheckNotFused("RestoreDeferredNode");
   // There are two cases:
   //  1. The removed node is complete now.
   //  2. The removed node is incomplete (error).
@@ -1323,7 +1500,6 @@ void HtmlParse::ClearDeferredNodes() {
       message_handler_->Message(
           kWarning, "Removed node %s never replaced", node->ToString().c_str());
     }
-    STLDeleteElements(events);
     delete events;
   }
   deferred_nodes_.clear();
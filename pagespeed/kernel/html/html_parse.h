@@ -35,6 +35,7 @@
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/symbol_table.h"
 #include "pagespeed/kernel/html/html_element.h"
+#include "pagespeed/kernel/html/html_event_list.h"
 #include "pagespeed/kernel/html/html_name.h"
 #include "pagespeed/kernel/html/html_node.h"
 #include "pagespeed/kernel/http/content_type.h"
@@ -43,10 +44,12 @@
 namespace net_instaweb {
 
 class DocType;
+class FilterProfiler;
 class HtmlEvent;
 class HtmlFilter;
 class HtmlLexer;
 class MessageHandler;
+class RequestTimeline;
 class Timer;
 
 typedef std::set <const HtmlEvent*> ConstHtmlEventSet;
@@ -70,8 +73,10 @@ typedef std::set <const HtmlEvent*> ConstHtmlEventSet;
 //     cdata
 //     comment
 //
-// The parser retains the sequence of events as a data structure:
-// list<HtmlEvent>.  HtmlEvents are sent to filters (HtmlFilter), as follows:
+// The parser retains the sequence of events as a data structure: an
+// HtmlEventList, threaded through events allocated in an arena that is
+// recycled between flush-windows.  HtmlEvents are sent to filters
+// (HtmlFilter), as follows:
 //   foreach filter in filter-chain
 //     foreach event in flush-window
 //       apply filter to event
@@ -427,12 +432,33 @@ class HtmlParse {
   // Run a filter on the current queue of parse nodes.
   void ApplyFilter(HtmlFilter* filter);
 
+  // If true (the default), each run of consecutive enabled filters that are
+  // IsStreamingSafe() is applied in a single pass over the flush window,
+  // rather than in one pass per filter.  See HtmlFilter::IsStreamingSafe.
+  void set_fuse_streaming_filters(bool x) { fuse_streaming_filters_ = x; }
+  bool fuse_streaming_filters() const { return fuse_streaming_filters_; }
+
   // Provide timer to helping to report timing of each filter.  You must also
   // set_log_rewrite_timing(true) to turn on this reporting.
   void set_timer(Timer* timer) { timer_ = timer; }
   Timer* timer() const { return timer_; }
   void set_log_rewrite_timing(bool x) { log_rewrite_timing_ = x; }
 
+  // If non-NULL, the time each filter spends on each flush window is
+  // recorded in profiler, keyed by the filter's Name().  Streaming-safe
+  // filters are not fused while profiling, so each is measured on its own.
+  void set_filter_profiler(FilterProfiler* profiler) {
+    filter_profiler_ = profiler;
+  }
+  FilterProfiler* filter_profiler() const { return filter_profiler_; }
+
+  // If non-NULL, each flush and each filter run within it is recorded as a
+  // span in timeline.  Fused filters are recorded as a single span.
+  void set_request_timeline(RequestTimeline* timeline) {
+    request_timeline_ = timeline;
+  }
+  RequestTimeline* request_timeline() const { return request_timeline_; }
+
   // Adds a filter to be called during parsing as new events are added.
   // Takes ownership of the HtmlFilter passed in.
   void add_event_listener(HtmlFilter* listener);
@@ -534,6 +560,10 @@ class HtmlParse {
 
   void CheckFilterEnabled(HtmlFilter* filter);
 
+  // Runs the enabled filters in list over the current queue of parse nodes,
+  // in order, fusing streaming-safe ones if fuse_streaming_filters().
+  void ApplyFilters(const FilterList& list);
+
   // Call DetermineEnabled() on each filter. Should be called after
   // the property cache lookup has finished since some filters depend on
   // pcache results in their DetermineEnabled implementation. If a subclass has
@@ -544,6 +574,12 @@ class HtmlParse {
 
  private:
   void ApplyFilterHelper(HtmlFilter* filter);
+  // Runs filters, which must all be streaming-safe, over the current queue
+  // of parse nodes in a single pass, and then clears the vector.
+  void ApplyFusedFilters(FilterVector* filters);
+  // Reports a DFATAL if a fused filter attempts operation, which would
+  // restructure the event queue.
+  void CheckNotFused(const char* operation);
   HtmlEventListIterator Last();  // Last element in queue
   bool IsInEventWindow(const HtmlEventListIterator& iter) const;
   void InsertNodeBeforeEvent(const HtmlEventListIterator& event,
@@ -562,12 +598,26 @@ class HtmlParse {
                   HtmlElement* new_parent);
   void CoalesceAdjacentCharactersNodes();
   void ClearEvents();
+  bool EventsOutliveFlushWindow() const;
+
+  // Frees the retired event arenas that no longer hold any events carried
+  // over from earlier flush windows.
+  void FreeUnreferencedEventArenas();
+  void FreeEventArenas();
+  void DeleteEventArena(Arena<HtmlEvent>* arena);
+
+  // Totals over the parser's lifetime of the events allocated, and of the
+  // heap chunks the event arenas took to hold them.  For HtmlTestingPeer.
+  void GetEventAllocationCounts(int64* num_events, int64* num_chunks) const;
   void EmitQueue(MessageHandler* handler);
   inline void NextEvent();
   void ClearDeferredNodes();
   inline bool IsRewritableIgnoringDeferral(const HtmlNode* node) const;
   inline bool IsRewritableIgnoringEnd(const HtmlNode* node) const;
 
+  // Events must be allocated here, with new (event_arena()).
+  Arena<HtmlEvent>* event_arena() { return events_.get(); }
+
   // Visible for testing only, via HtmlTestingPeer
   friend class HtmlTestingPeer;
   void AddEvent(HtmlEvent* event);
@@ -589,6 +639,14 @@ class HtmlParse {
   FilterList filters_;
   HtmlLexer* lexer_;
   Arena<HtmlNode> nodes_;
+  // Events are destroyed all at once at the end of a flush window.  If some
+  // outlive it (see EventsOutliveFlushWindow), the window's arena is retired
+  // instead, and freed at the end of the first window after which none of
+  // its events are still carried over, or at EndFinishParse.
+  scoped_ptr<Arena<HtmlEvent> > events_;
+  std::vector<Arena<HtmlEvent>*> retired_event_arenas_;
+  int64 num_deleted_arena_events_;  // Counts from arenas no longer around.
+  int64 num_deleted_arena_chunks_;
   HtmlEventList queue_;
   HtmlEventListIterator current_;
   // Have we deleted current? Then we shouldn't do certain manipulations to it.
@@ -605,9 +663,14 @@ class HtmlParse {
   bool url_valid_;
   bool log_rewrite_timing_;  // Should we time the speed of parsing?
   bool running_filters_;
+  bool fuse_streaming_filters_;
+  bool running_fused_filters_;  // In ApplyFusedFilters.
   int64 parse_start_time_us_;
-  scoped_ptr<HtmlEvent> delayed_start_literal_;
+  HtmlEvent* delayed_start_literal_;  // Allocated in an event arena.
   Timer* timer_;
+  FilterProfiler* filter_profiler_;
+  RequestTimeline* request_timeline_;
+  int64 flush_window_bytes_;        // Bytes parsed since the last Flush.
   HtmlFilter* current_filter_;      // Filter currently running in ApplyFilter
 
   // When deferring a node that spans a flush window, we present upstream
@@ -19,20 +19,29 @@
 // Unit-test the html reader/writer to ensure that a few tricky
 // constructs come through without corruption.
 
+#include <algorithm>
 #include <vector>
 
 #include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/filter_profiler.h"
 #include "pagespeed/kernel/base/gtest.h"
 #include "pagespeed/kernel/base/gmock.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/mock_message_handler.h"
+#include "pagespeed/kernel/base/mock_timer.h"
+#include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/null_thread_system.h"
+#include "pagespeed/kernel/base/request_timeline.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/string_writer.h"
+#include "pagespeed/kernel/html/collapse_whitespace_filter.h"
 #include "pagespeed/kernel/html/disable_test_filter.h"
+#include "pagespeed/kernel/html/elide_attributes_filter.h"
 #include "pagespeed/kernel/html/empty_html_filter.h"
 #include "pagespeed/kernel/html/explicit_close_tag.h"
+#include "pagespeed/kernel/html/html_attribute_quote_removal.h"
 #include "pagespeed/kernel/html/html_element.h"
 #include "pagespeed/kernel/html/html_event.h"
 #include "pagespeed/kernel/html/html_filter.h"
@@ -1084,6 +1093,48 @@ TEST_F(HtmlAnnotationTest, FlushDoesNotBreakStyleTag) {
                annotation());
 }
 
+// The lexer skips over runs of bytes that can't change its state in bulk, so
+// make sure that where those runs are cut by chunk boundaries doesn't matter.
+TEST_F(HtmlAnnotationTest, ChunkBoundariesDoNotChangeParse) {
+  static const char kHtml[] =
+      "<div class=\"a b\" title='x y'>Some text &amp; more\n"
+      "<!-- a comment -- with - dashes --->"
+      "<![CDATA[ some ]] cdata ]]>"
+      "<style>p { color: red; }</style>"
+      "<script>a = '<!--<script>'; b = 1 - 2; </script>--> c = 3;"
+      "d = '</scriptx>';</script>\n"
+      "<textarea>a <b> c</textarea>"
+      "</div>";
+  const int kSize = STATIC_STRLEN(kHtml);
+  SetupWriter();
+  html_parse_.StartParse("http://test.com/chunks.html");
+  html_parse_.ParseText(kHtml);
+  html_parse_.FinishParse();
+  GoogleString expected = annotation();
+  EXPECT_STREQ(
+      "+div:class=\"a b\",title='x y' 'Some text &amp; more\n'"
+      " +style 'p { color: red; }' -style(e)"
+      " +script 'a = '<!--<script>'; b = 1 - 2; </script>--> c = 3;"
+      "d = '</scriptx>';' -script(e) '\n'"
+      " +textarea 'a <b> c' -textarea(e) -div(e)",
+      expected);
+
+  EXPECT_STREQ(kHtml, output_buffer_);
+
+  for (int chunk_size = 1; chunk_size < kSize; ++chunk_size) {
+    ResetAnnotation();
+    output_buffer_.clear();
+    html_parse_.StartParse("http://test.com/chunks.html");
+    for (int i = 0; i < kSize; i += chunk_size) {
+      html_parse_.ParseText(StringPiece(kHtml + i,
+                                        std::min(chunk_size, kSize - i)));
+    }
+    html_parse_.FinishParse();
+    EXPECT_EQ(expected, annotation()) << "chunk_size=" << chunk_size;
+    EXPECT_STREQ(kHtml, output_buffer_) << "chunk_size=" << chunk_size;
+  }
+}
+
 TEST_F(HtmlAnnotationTest, UnclosedScriptOnly) {
   SetupWriter();
   annotation_.set_annotate_flush(true);
@@ -1414,8 +1465,7 @@ class EventListManipulationTest : public HtmlParseTest {
     static const char kUrl[] = "http://html.parse.test/event_list_test.html";
     ASSERT_TRUE(html_parse_.StartParse(kUrl));
     node1_ = html_parse_.NewCharactersNode(NULL, "1");
-    HtmlTestingPeer::AddEvent(&html_parse_,
-                              new HtmlCharactersEvent(node1_, -1));
+    AddCharactersEvent(node1_);
     node2_ = html_parse_.NewCharactersNode(NULL, "2");
     node3_ = html_parse_.NewCharactersNode(NULL, "3");
     // Note: the last 2 are not added in SetUp.
@@ -1426,6 +1476,13 @@ class EventListManipulationTest : public HtmlParseTest {
     HtmlParseTest::TearDown();
   }
 
+  void AddCharactersEvent(HtmlCharactersNode* node) {
+    HtmlTestingPeer::AddEvent(
+        &html_parse_,
+        new (HtmlTestingPeer::event_arena(&html_parse_))
+        HtmlCharactersEvent(node, -1));
+  }
+
   void CheckExpected(const GoogleString& expected) {
     SetupWriter();
     html_parse()->ApplyFilter(html_writer_filter_.get());
@@ -1488,8 +1545,8 @@ TEST_F(EventListManipulationTest, TestDeleteOnly) {
 
 TEST_F(EventListManipulationTest, TestDeleteFirst) {
   HtmlTestingPeer::set_coalesce_characters(&html_parse_, false);
-  HtmlTestingPeer::AddEvent(&html_parse_, new HtmlCharactersEvent(node2_, -1));
-  HtmlTestingPeer::AddEvent(&html_parse_, new HtmlCharactersEvent(node3_, -1));
+  AddCharactersEvent(node2_);
+  AddCharactersEvent(node3_);
   html_parse_.DeleteNode(node1_);
   CheckExpected("23");
   html_parse_.DeleteNode(node2_);
@@ -1500,8 +1557,8 @@ TEST_F(EventListManipulationTest, TestDeleteFirst) {
 
 TEST_F(EventListManipulationTest, TestDeleteLast) {
   HtmlTestingPeer::set_coalesce_characters(&html_parse_, false);
-  HtmlTestingPeer::AddEvent(&html_parse_, new HtmlCharactersEvent(node2_, -1));
-  HtmlTestingPeer::AddEvent(&html_parse_, new HtmlCharactersEvent(node3_, -1));
+  AddCharactersEvent(node2_);
+  AddCharactersEvent(node3_);
   html_parse_.DeleteNode(node3_);
   CheckExpected("12");
   html_parse_.DeleteNode(node2_);
@@ -1512,8 +1569,8 @@ TEST_F(EventListManipulationTest, TestDeleteLast) {
 
 TEST_F(EventListManipulationTest, TestDeleteMiddle) {
   HtmlTestingPeer::set_coalesce_characters(&html_parse_, false);
-  HtmlTestingPeer::AddEvent(&html_parse_, new HtmlCharactersEvent(node2_, -1));
-  HtmlTestingPeer::AddEvent(&html_parse_, new HtmlCharactersEvent(node3_, -1));
+  AddCharactersEvent(node2_);
+  AddCharactersEvent(node3_);
   html_parse_.DeleteNode(node2_);
   CheckExpected("13");
 }
@@ -1524,8 +1581,8 @@ TEST_F(EventListManipulationTest, TestDeleteMiddle) {
 // parent-pointer check.
 TEST_F(EventListManipulationTest, TestAddParentToSequence) {
   HtmlTestingPeer::set_coalesce_characters(&html_parse_, false);
-  HtmlTestingPeer::AddEvent(&html_parse_, new HtmlCharactersEvent(node2_, -1));
-  HtmlTestingPeer::AddEvent(&html_parse_, new HtmlCharactersEvent(node3_, -1));
+  AddCharactersEvent(node2_);
+  AddCharactersEvent(node3_);
   HtmlElement* div = html_parse_.NewElement(NULL, HtmlName::kDiv);
   EXPECT_TRUE(html_parse_.AddParentToSequence(node1_, node3_, div));
   CheckExpected("<div>123</div>");
@@ -1572,17 +1629,17 @@ TEST_F(EventListManipulationTest, TestAppendChild) {
 
 TEST_F(EventListManipulationTest, TestAddParentToSequenceDifferentParents) {
   HtmlTestingPeer::set_coalesce_characters(&html_parse_, false);
-  HtmlTestingPeer::AddEvent(&html_parse_, new HtmlCharactersEvent(node2_, -1));
+  AddCharactersEvent(node2_);
   HtmlElement* div = html_parse_.NewElement(NULL, HtmlName::kDiv);
   EXPECT_TRUE(html_parse_.AddParentToSequence(node1_, node2_, div));
   CheckExpected("<div>12</div>");
-  HtmlTestingPeer::AddEvent(&html_parse_, new HtmlCharactersEvent(node3_, -1));
+  AddCharactersEvent(node3_);
   CheckExpected("<div>12</div>3");
   EXPECT_FALSE(html_parse_.AddParentToSequence(node2_, node3_, div));
 }
 
 TEST_F(EventListManipulationTest, TestDeleteGroup) {
-  HtmlTestingPeer::AddEvent(&html_parse_, new HtmlCharactersEvent(node2_, -1));
+  AddCharactersEvent(node2_);
   HtmlElement* div = html_parse_.NewElement(NULL, HtmlName::kDiv);
   EXPECT_TRUE(html_parse_.AddParentToSequence(node1_, node2_, div));
   CheckExpected("<div>12</div>");
@@ -1594,11 +1651,11 @@ TEST_F(EventListManipulationTest, TestMoveElementIntoParent1) {
   HtmlElement* head = html_parse_.NewElement(NULL, HtmlName::kHead);
   EXPECT_TRUE(html_parse_.AddParentToSequence(node1_, node1_, head));
   CheckExpected("<head>1</head>");
-  HtmlTestingPeer::AddEvent(&html_parse_, new HtmlCharactersEvent(node2_, -1));
+  AddCharactersEvent(node2_);
   HtmlElement* div = html_parse_.NewElement(NULL, HtmlName::kDiv);
   EXPECT_TRUE(html_parse_.AddParentToSequence(node2_, node2_, div));
   CheckExpected("<head>1</head><div>2</div>");
-  HtmlTestingPeer::AddEvent(&html_parse_, new HtmlCharactersEvent(node3_, -1));
+  AddCharactersEvent(node3_);
   CheckExpected("<head>1</head><div>2</div>3");
   HtmlTestingPeer::SetCurrent(&html_parse_, div);
   EXPECT_TRUE(html_parse_.MoveCurrentInto(head));
@@ -1610,8 +1667,8 @@ TEST_F(EventListManipulationTest, TestMoveElementIntoParent2) {
   HtmlElement* head = html_parse_.NewElement(NULL, HtmlName::kHead);
   EXPECT_TRUE(html_parse_.AddParentToSequence(node1_, node1_, head));
   CheckExpected("<head>1</head>");
-  HtmlTestingPeer::AddEvent(&html_parse_, new HtmlCharactersEvent(node2_, -1));
-  HtmlTestingPeer::AddEvent(&html_parse_, new HtmlCharactersEvent(node3_, -1));
+  AddCharactersEvent(node2_);
+  AddCharactersEvent(node3_);
   CheckExpected("<head>1</head>23");
   HtmlElement* div = html_parse_.NewElement(NULL, HtmlName::kDiv);
   EXPECT_TRUE(html_parse_.AddParentToSequence(node3_, node3_, div));
@@ -1637,10 +1694,10 @@ TEST_F(EventListManipulationTest, TestDeleteSavingChildrenEnd) {
 TEST_F(EventListManipulationTest, TestMoveCurrentBefore) {
   // Setup events.
   HtmlTestingPeer::set_coalesce_characters(&html_parse_, false);
-  HtmlTestingPeer::AddEvent(&html_parse_, new HtmlCharactersEvent(node2_, -1));
+  AddCharactersEvent(node2_);
   HtmlElement* div = html_parse_.NewElement(NULL, HtmlName::kDiv);
   EXPECT_TRUE(html_parse_.AddParentToSequence(node1_, node2_, div));
-  HtmlTestingPeer::AddEvent(&html_parse_, new HtmlCharactersEvent(node3_, -1));
+  AddCharactersEvent(node3_);
   CheckExpected("<div>12</div>3");
   HtmlTestingPeer::SetCurrent(&html_parse_, node3_);
 
@@ -1668,7 +1725,7 @@ TEST_F(EventListManipulationTest, TestMoveCurrentBefore) {
 
 TEST_F(EventListManipulationTest, TestCoalesceOnAdd) {
   CheckExpected("1");
-  HtmlTestingPeer::AddEvent(&html_parse_, new HtmlCharactersEvent(node2_, -1));
+  AddCharactersEvent(node2_);
   CheckExpected("12");
 
   // this will coalesce node1 and node2 togethers.  So there is only
@@ -1682,11 +1739,11 @@ TEST_F(EventListManipulationTest, TestCoalesceOnDelete) {
   CheckExpected("1");
   HtmlElement* div = html_parse_.NewElement(NULL, HtmlName::kDiv);
   html_parse_.AddElement(div, -1);
-  HtmlTestingPeer::AddEvent(&html_parse_, new HtmlCharactersEvent(node2_, -1));
+  AddCharactersEvent(node2_);
   HtmlTestingPeer testing_peer;
   testing_peer.SetNodeParent(node2_, div);
   html_parse_.CloseElement(div, HtmlElement::EXPLICIT_CLOSE, -1);
-  HtmlTestingPeer::AddEvent(&html_parse_, new HtmlCharactersEvent(node3_, -1));
+  AddCharactersEvent(node3_);
   CheckExpected("1<div>2</div>3");
 
   // Removing the div, leaving the children intact...
@@ -1704,7 +1761,7 @@ TEST_F(EventListManipulationTest, TestHasChildren) {
   HtmlElement* div = html_parse_.NewElement(NULL, HtmlName::kDiv);
   html_parse_.AddElement(div, -1);
   EXPECT_FALSE(html_parse_.HasChildrenInFlushWindow(div));
-  HtmlTestingPeer::AddEvent(&html_parse_, new HtmlCharactersEvent(node2_, -1));
+  AddCharactersEvent(node2_);
   HtmlTestingPeer testing_peer;
   testing_peer.SetNodeParent(node2_, div);
 
@@ -2741,6 +2798,27 @@ TEST_F(HtmlRestoreTest, MoveAAfterNestedB) {
        "<div id=a>1<span>2</span>3</div>7</div>"));
 }
 
+TEST_F(HtmlRestoreTest, FreeEventsOfEachFlushWindow) {
+  // Only the flush window holding the deferred node keeps its events while
+  // the node is deferred; the windows after it are freed as usual.
+  restore_nodes_filter_.MoveOnStart("a", "b");
+  SetupWriter();
+  html_parse_.StartParse("http://test.com/free_events");
+  html_parse_.ParseText("<div id=a>1</div>");
+  html_parse_.Flush();
+  EXPECT_EQ(1, HtmlTestingPeer::num_retired_event_arenas(&html_parse_));
+  for (int i = 0; i < 3; ++i) {
+    html_parse_.ParseText("<span>2</span>");
+    html_parse_.Flush();
+    EXPECT_EQ(1, HtmlTestingPeer::num_retired_event_arenas(&html_parse_));
+  }
+  html_parse_.ParseText("<div id=b>3</div>");
+  html_parse_.Flush();
+  EXPECT_EQ(0, HtmlTestingPeer::num_retired_event_arenas(&html_parse_));
+  html_parse_.FinishParse();
+  EXPECT_STREQ("<span>2</span><span>2</span><span>2</span>"
+               "<div id=b>3</div><div id=a>1</div>", output_buffer_);
+}
 
 TEST_F(HtmlRestoreTest, MoveABAfterC) {
   restore_nodes_filter_.MoveOnStart("a", "c");
@@ -3023,4 +3101,189 @@ TEST_F(HtmlRestoreTest, CoalesceCharsAcrossFlush) {
   }
 }
 
+// Logs the events it sees to a log shared with other filters, and optionally
+// claims to be streaming-safe.
+class EventLoggingFilter : public EmptyHtmlFilter {
+ public:
+  EventLoggingFilter(const char* name, bool streaming_safe, GoogleString* log)
+      : name_(name), streaming_safe_(streaming_safe), log_(log) {}
+
+  virtual void StartElement(HtmlElement* element) {
+    Log(StrCat("<", element->name_str()));
+  }
+  virtual void EndElement(HtmlElement* element) {
+    Log(StrCat("/", element->name_str()));
+  }
+  virtual void Characters(HtmlCharactersNode* characters) {
+    Log(StrCat("'", characters->contents()));
+  }
+  virtual void Flush() { Log("F"); }
+  virtual bool IsStreamingSafe() const { return streaming_safe_; }
+  virtual const char* Name() const { return name_; }
+
+ private:
+  void Log(StringPiece event) {
+    StrAppend(log_, log_->empty() ? "" : " ", name_, event);
+  }
+
+  const char* name_;
+  bool streaming_safe_;
+  GoogleString* log_;
+
+  DISALLOW_COPY_AND_ASSIGN(EventLoggingFilter);
+};
+
+// Deletes comments, though it claims to be streaming-safe.
+class BadStreamingFilter : public EmptyHtmlFilter {
+ public:
+  explicit BadStreamingFilter(HtmlParse* html_parse)
+      : html_parse_(html_parse) {}
+
+  virtual void Comment(HtmlCommentNode* comment) {
+    html_parse_->DeleteNode(comment);
+  }
+  virtual bool IsStreamingSafe() const { return true; }
+  virtual const char* Name() const { return "BadStreaming"; }
+
+ private:
+  HtmlParse* html_parse_;
+
+  DISALLOW_COPY_AND_ASSIGN(BadStreamingFilter);
+};
+
+class HtmlFusedFilterTest : public HtmlParseTest {
+ protected:
+  HtmlFusedFilterTest()
+      : a_("A", true, &log_),
+        b_("B", true, &log_),
+        unsafe_("U", false, &log_) {
+  }
+
+  void ParseLogged(StringPiece html) {
+    log_.clear();
+    html_parse_.StartParse("http://test.com/fused.html");
+    html_parse_.ParseText(html);
+    html_parse_.FinishParse();
+  }
+
+  GoogleString log_;
+  EventLoggingFilter a_;
+  EventLoggingFilter b_;
+  EventLoggingFilter unsafe_;
+};
+
+TEST_F(HtmlFusedFilterTest, StreamingSafeFiltersRunInOnePass) {
+  html_parse_.AddFilter(&a_);
+  html_parse_.AddFilter(&b_);
+  ParseLogged("<p>x</p>");
+  EXPECT_EQ("A<p B<p A'x B'x A/p B/p AF BF", log_);
+
+  html_parse_.set_fuse_streaming_filters(false);
+  ParseLogged("<p>x</p>");
+  EXPECT_EQ("A<p A'x A/p AF B<p B'x B/p BF", log_);
+}
+
+TEST_F(HtmlFusedFilterTest, UnsafeFilterSplitsRun) {
+  html_parse_.AddFilter(&a_);
+  html_parse_.AddFilter(&unsafe_);
+  html_parse_.AddFilter(&b_);
+  ParseLogged("<p>x</p>");
+  EXPECT_EQ("A<p A'x A/p AF U<p U'x U/p UF B<p B'x B/p BF", log_);
+}
+
+TEST_F(HtmlFusedFilterTest, DisabledFilterDoesNotSplitRun) {
+  DisableTestFilter disabled("D", false, "");
+  html_parse_.AddFilter(&a_);
+  html_parse_.AddFilter(&disabled);
+  html_parse_.AddFilter(&b_);
+  ParseLogged("<p>x</p>");
+  EXPECT_EQ("A<p B<p A'x B'x A/p B/p AF BF", log_);
+}
+
+TEST_F(HtmlFusedFilterTest, FusedOutputMatchesUnfused) {
+  CollapseWhitespaceFilter collapse_whitespace(&html_parse_);
+  ElideAttributesFilter elide_attributes(&html_parse_);
+  HtmlAttributeQuoteRemoval quote_removal(&html_parse_);
+  html_parse_.AddFilter(&elide_attributes);
+  html_parse_.AddFilter(&quote_removal);
+  html_parse_.AddFilter(&collapse_whitespace);
+  SetupWriter();
+
+  const char kInput[] =
+      "<form method=\"get\">\n  <input type=\"text\" checked=\"checked\">"
+      "  a    b  </form>\n\n<pre>  x  </pre><script> var a  =  1; </script>";
+  const char kExpected[] =
+      "<form>\n<input type=text checked>"
+      " a b </form>\n<pre>  x  </pre><script> var a  =  1; </script>";
+  for (int i = 0, n = STATIC_STRLEN(kInput); i < n; ++i) {
+    html_parse_.set_fuse_streaming_filters(true);
+    ParseWithFlush(kInput, i);
+    EXPECT_EQ(kExpected, output_buffer_) << "fused, flush at " << i;
+    html_parse_.set_fuse_streaming_filters(false);
+    ParseWithFlush(kInput, i);
+    EXPECT_EQ(kExpected, output_buffer_) << "unfused, flush at " << i;
+  }
+}
+
+TEST_F(HtmlFusedFilterTest, ProfiledFiltersRunSeparately) {
+  NullThreadSystem thread_system;
+  MockTimer timer(new NullMutex, 0);
+  FilterProfiler profiler(&thread_system, &timer);
+  html_parse_.set_filter_profiler(&profiler);
+  html_parse_.AddFilter(&a_);
+  html_parse_.AddFilter(&b_);
+  html_parse_.StartParse("http://test.com/profiled.html");
+  html_parse_.ParseText("<p>x</p>");
+  html_parse_.Flush();
+  html_parse_.ParseText("<p>yz</p>");
+  html_parse_.FinishParse();
+  EXPECT_EQ("A<p A'x A/p AF B<p B'x B/p BF "
+            "A<p A'yz A/p AF B<p B'yz B/p BF", log_);
+
+  FilterProfiler::ProfileVector profiles;
+  profiler.Snapshot(&profiles);
+  ASSERT_EQ(2, profiles.size());
+  EXPECT_EQ("A", profiles[0].id);
+  EXPECT_EQ("B", profiles[1].id);
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_EQ(FilterProfiler::kHtmlFilter, profiles[i].kind);
+    EXPECT_EQ(2, profiles[i].wall_us.count);
+    EXPECT_EQ(2, profiles[i].cpu_us.count);
+    EXPECT_EQ(STATIC_STRLEN("<p>x</p><p>yz</p>"), profiles[i].bytes);
+  }
+}
+
+TEST_F(HtmlFusedFilterTest, TimelineRecordsFlushesAndFilters) {
+  NullThreadSystem thread_system;
+  MockTimer timer(new NullMutex, 0);
+  RequestTimelinePtr timeline(
+      new RequestTimeline("timeline", 1, &thread_system, &timer));
+  html_parse_.set_request_timeline(timeline.get());
+  html_parse_.AddFilter(&a_);
+  html_parse_.AddFilter(&b_);
+  html_parse_.StartParse("http://test.com/timeline.html");
+  html_parse_.ParseText("<p>x</p>");
+  html_parse_.Flush();
+  html_parse_.ParseText("<p>yz</p>");
+  html_parse_.FinishParse();
+  html_parse_.set_request_timeline(NULL);
+
+  // Each of the two flushes has a span for the fused filters and one for
+  // the flush itself.
+  EXPECT_EQ(4, timeline->num_events());
+  GoogleString json;
+  StringWriter writer(&json);
+  timeline->DumpChromeTraceJson(&writer, &message_handler_);
+  EXPECT_NE(GoogleString::npos, json.find("\"fused filters\""));
+  EXPECT_NE(GoogleString::npos, json.find("\"detail\": \"8 bytes\""));
+  EXPECT_NE(GoogleString::npos, json.find("\"detail\": \"9 bytes\""));
+}
+
+TEST_F(HtmlFusedFilterTest, FusedFilterMayNotRestructure) {
+  BadStreamingFilter bad(&html_parse_);
+  html_parse_.AddFilter(&bad);
+  html_parse_.AddFilter(&a_);
+  EXPECT_DEBUG_DEATH(ParseLogged("<!--x-->"), "BadStreaming");
+}
+
 }  // namespace net_instaweb
@@ -21,6 +21,7 @@
 
 #include <cstddef>
 
+#include "pagespeed/kernel/base/arena.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/html/html_node.h"
 #include "pagespeed/kernel/html/html_parse.h"
@@ -40,6 +41,9 @@ class HtmlTestingPeer {
   static void AddEvent(HtmlParse* parser, HtmlEvent* event) {
     parser->AddEvent(event);
   }
+  static Arena<HtmlEvent>* event_arena(HtmlParse* parser) {
+    return parser->event_arena();
+  }
   static void SetCurrent(HtmlParse* parser, HtmlNode* node) {
     parser->SetCurrent(node);
   }
@@ -49,6 +53,22 @@ class HtmlTestingPeer {
   static size_t symbol_table_size(HtmlParse* parser) {
     return parser->symbol_table_size();
   }
+  static int num_retired_event_arenas(HtmlParse* parser) {
+    return parser->retired_event_arenas_.size();
+  }
+
+  // Lifetime totals of the events and nodes the parser allocated, and of the
+  // heap chunks its arenas took to hold them.
+  static void GetEventAllocationCounts(HtmlParse* parser, int64* num_events,
+                                       int64* num_chunks) {
+    parser->GetEventAllocationCounts(num_events, num_chunks);
+  }
+  static int64 num_nodes_allocated(HtmlParse* parser) {
+    return parser->nodes_.num_objects_allocated();
+  }
+  static int64 num_node_chunks_allocated(HtmlParse* parser) {
+    return parser->nodes_.num_chunks_allocated();
+  }
 
  private:
   DISALLOW_COPY_AND_ASSIGN(HtmlTestingPeer);
@@ -60,6 +60,7 @@ class HtmlWriterFilter : public HtmlFilter {
   void set_case_fold(bool case_fold) { case_fold_ = case_fold; }
 
   virtual const char* Name() const { return "HtmlWriter"; }
+  virtual bool IsStreamingSafe() const { return true; }
 
  protected:
   // Clear various variables for rewriting a new html file.
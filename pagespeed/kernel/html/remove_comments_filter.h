@@ -69,6 +69,8 @@ class RemoveCommentsFilter : public EmptyHtmlFilter {
 
   virtual void Comment(HtmlCommentNode* comment);
   virtual const char* Name() const { return "RemoveComments"; }
+  // Not IsStreamingSafe: deleting a comment coalesces the text around it,
+  // which changes what later filters see.
 
  private:
   HtmlParse* html_parse_;
@@ -19,6 +19,12 @@
 #include "pagespeed/kernel/image/image_resizer.h"
 
 #include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define PAGESPEED_IMAGE_RESIZER_SSE2 1
+#endif
 
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/string.h"
@@ -195,10 +201,95 @@ void ComputeResizedSizeRatio(int input_width,
   *height = static_cast<int>(resized_height);
 }
 
+#ifdef PAGESPEED_IMAGE_RESIZER_SSE2
+// The SSE2 kernels below do the same float operations, in the same order, as
+// the scalar code they stand in for, just on several values at once, so their
+// results are bit-exact.  In particular they multiply and add separately
+// rather than using fused multiply-adds.
+
+// Returns the 4 bytes at data as floats.
+inline __m128 LoadFourAsFloats(const uint8_t* data) {
+  int32 bytes;
+  memcpy(&bytes, data, sizeof(bytes));
+  const __m128i zero = _mm_setzero_si128();
+  __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+  return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+}
+
+inline __m128 LoadFourAsFloats(const float* data) {
+  return _mm_loadu_ps(data);
+}
+
+// Returns the 3 bytes at data as floats, with 0 in the last lane.
+inline __m128 LoadThreeAsFloats(const uint8_t* data) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i bytes = _mm_cvtsi32_si128(data[0] | (data[1] << 8) |
+                                    (data[2] << 16));
+  __m128i words = _mm_unpacklo_epi8(bytes, zero);
+  return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+}
+
+// Gathering gray pixels into lanes costs more than summing them one output
+// at a time once the runs of middle pixels get longer than this.
+const int kMaxGrayLaneRun = 1;
+
+// Returns in_data[index] for each of the 4 table entries, as floats, where
+// index is first_index_ + offset, or 0 where that's not before last_index_.
+inline __m128 GatherMiddleGray(const ResizeTableEntry* entries, int offset,
+                               const uint8_t* in_data) {
+  float values[4];
+  for (int i = 0; i < 4; ++i) {
+    int index = entries[i].first_index_ + offset;
+    values[i] = (index < entries[i].last_index_) ? in_data[index] : 0;
+  }
+  return _mm_loadu_ps(values);
+}
+#endif  // PAGESPEED_IMAGE_RESIZER_SSE2
+
 void ResizeRowAreaGray(const ResizeTableEntry* table, int pixels_per_row,
                        const uint8_t* in_data, float* out_data) {
-  int out_idx = 0;
-  for (int x = 0; x < pixels_per_row; ++x) {
+  int x = 0;
+#ifdef PAGESPEED_IMAGE_RESIZER_SSE2
+  // Compute 4 output pixels at once, one per lane.  Lanes with shorter runs
+  // of middle pixels add zeros, which leaves their sums unchanged.  Besides
+  // using SIMD, this breaks the dependency chain between the additions.
+  for (; x + 4 <= pixels_per_row; x += 4) {
+    const ResizeTableEntry* entries = table + x;
+    int max_run = 0;
+    for (int i = 0; i < 4; ++i) {
+      int run = entries[i].last_index_ - entries[i].first_index_ - 1;
+      if (run > max_run) {
+        max_run = run;
+      }
+    }
+    if (max_run > kMaxGrayLaneRun) {
+      // Runs are about the same length all along a row, so leave the rest
+      // of it to the scalar loop.
+      break;
+    }
+    __m128 first = _mm_setr_ps(in_data[entries[0].first_index_],
+                               in_data[entries[1].first_index_],
+                               in_data[entries[2].first_index_],
+                               in_data[entries[3].first_index_]);
+    __m128 acc = _mm_mul_ps(first, _mm_setr_ps(entries[0].first_weight_,
+                                               entries[1].first_weight_,
+                                               entries[2].first_weight_,
+                                               entries[3].first_weight_));
+    for (int offset = 1; offset <= max_run; ++offset) {
+      acc = _mm_add_ps(acc, GatherMiddleGray(entries, offset, in_data));
+    }
+    __m128 last = _mm_setr_ps(in_data[entries[0].last_index_],
+                              in_data[entries[1].last_index_],
+                              in_data[entries[2].last_index_],
+                              in_data[entries[3].last_index_]);
+    acc = _mm_add_ps(acc, _mm_mul_ps(last, _mm_setr_ps(
+        entries[0].last_weight_, entries[1].last_weight_,
+        entries[2].last_weight_, entries[3].last_weight_)));
+    _mm_storeu_ps(out_data + x, acc);
+  }
+#endif
+  int out_idx = x;
+  for (; x < pixels_per_row; ++x) {
     const ResizeTableEntry& table_entry = table[x];
     int in_idx = table_entry.first_index_;
     float weight = table_entry.first_weight_;
@@ -223,8 +314,27 @@ void ResizeRowAreaGray(const ResizeTableEntry* table, int pixels_per_row,
 
 void ResizeRowAreaRGB(const ResizeTableEntry* table, int pixels_per_row,
                       const uint8_t* in_data, float* out_data) {
-  int out_idx = 0;
-  for (int x = 0; x < pixels_per_row; ++x) {
+  int x = 0;
+#ifdef PAGESPEED_IMAGE_RESIZER_SSE2
+  // Each pixel goes in one vector, with its 4th lane unused.  Storing that
+  // lane spills into the next output pixel, which is written afterwards, so
+  // the last pixel is left to the scalar loop.
+  for (; x + 1 < pixels_per_row; ++x) {
+    const ResizeTableEntry& table_entry = table[x];
+    int in_idx = table_entry.first_index_;
+    __m128 acc = _mm_mul_ps(LoadThreeAsFloats(in_data + in_idx),
+                            _mm_set1_ps(table_entry.first_weight_));
+    for (in_idx += 3; in_idx < table_entry.last_index_; in_idx += 3) {
+      acc = _mm_add_ps(acc, LoadThreeAsFloats(in_data + in_idx));
+    }
+    in_idx = table_entry.last_index_;
+    acc = _mm_add_ps(acc, _mm_mul_ps(LoadThreeAsFloats(in_data + in_idx),
+                                     _mm_set1_ps(table_entry.last_weight_)));
+    _mm_storeu_ps(out_data + 3 * x, acc);
+  }
+#endif
+  int out_idx = 3 * x;
+  for (; x < pixels_per_row; ++x) {
     const ResizeTableEntry& table_entry = table[x];
     int in_idx = table_entry.first_index_;
     float weight = table_entry.first_weight_;
@@ -258,8 +368,25 @@ void ResizeRowAreaRGB(const ResizeTableEntry* table, int pixels_per_row,
 
 void ResizeRowAreaRGBA(const ResizeTableEntry* table, int pixels_per_row,
                        const uint8_t* in_data, float* out_data) {
-  int out_idx = 0;
-  for (int x = 0; x < pixels_per_row; ++x) {
+  int x = 0;
+#ifdef PAGESPEED_IMAGE_RESIZER_SSE2
+  // Each pixel fits exactly in one vector.
+  for (; x < pixels_per_row; ++x) {
+    const ResizeTableEntry& table_entry = table[x];
+    int in_idx = table_entry.first_index_;
+    __m128 acc = _mm_mul_ps(LoadFourAsFloats(in_data + in_idx),
+                            _mm_set1_ps(table_entry.first_weight_));
+    for (in_idx += 4; in_idx < table_entry.last_index_; in_idx += 4) {
+      acc = _mm_add_ps(acc, LoadFourAsFloats(in_data + in_idx));
+    }
+    in_idx = table_entry.last_index_;
+    acc = _mm_add_ps(acc, _mm_mul_ps(LoadFourAsFloats(in_data + in_idx),
+                                     _mm_set1_ps(table_entry.last_weight_)));
+    _mm_storeu_ps(out_data + 4 * x, acc);
+  }
+#endif
+  int out_idx = 4 * x;
+  for (; x < pixels_per_row; ++x) {
     const ResizeTableEntry& table_entry = table[x];
     int in_idx = table_entry.first_index_;
     float weight = table_entry.first_weight_;
@@ -488,6 +615,13 @@ template<class BufferType>
 void ResizeColArea<BufferType>::AppendFirstRow(
     const BufferType* in_data, float weight) {
   int index = 0;
+#ifdef PAGESPEED_IMAGE_RESIZER_SSE2
+  const __m128 weights = _mm_set1_ps(weight);
+  for (; index < elements_per_row_4_; index += 4) {
+    _mm_storeu_ps(buffer_.get() + index,
+                  _mm_mul_ps(weights, LoadFourAsFloats(in_data + index)));
+  }
+#endif
   for (; index < elements_per_row_4_; index += 4) {
     buffer_[index]   = weight * in_data[index];
     buffer_[index+1] = weight * in_data[index+1];
@@ -503,6 +637,13 @@ template<class BufferType>
 void ResizeColArea<BufferType>::AppendMiddleRow(
     const BufferType* in_data) {
   int index = 0;
+#ifdef PAGESPEED_IMAGE_RESIZER_SSE2
+  for (; index < elements_per_row_4_; index += 4) {
+    float* buffer = buffer_.get() + index;
+    _mm_storeu_ps(buffer, _mm_add_ps(_mm_loadu_ps(buffer),
+                                     LoadFourAsFloats(in_data + index)));
+  }
+#endif
   for (; index < elements_per_row_4_; index += 4) {
     buffer_[index]   += in_data[index];
     buffer_[index+1] += in_data[index+1];
@@ -518,6 +659,15 @@ template<class BufferType>
 void ResizeColArea<BufferType>::AppendLastRow(
     const BufferType* in_data, float weight) {
   int index = 0;
+#ifdef PAGESPEED_IMAGE_RESIZER_SSE2
+  const __m128 weights = _mm_set1_ps(weight);
+  for (; index < elements_per_row_4_; index += 4) {
+    float* buffer = buffer_.get() + index;
+    _mm_storeu_ps(buffer, _mm_add_ps(
+        _mm_loadu_ps(buffer),
+        _mm_mul_ps(weights, LoadFourAsFloats(in_data + index))));
+  }
+#endif
   for (; index < elements_per_row_4_; index += 4) {
     buffer_[index]   += weight * in_data[index];
     buffer_[index+1] += weight * in_data[index+1];
@@ -536,6 +686,21 @@ void ResizeColArea<BufferType>::ComputeOutput(const float* in_data,
   // Make local copies of the data in order to speed up computation.
   const float half_grid_area = half_grid_area_;
   const float inv_grid_area = inv_grid_area_;
+#ifdef PAGESPEED_IMAGE_RESIZER_SSE2
+  // The values are in [0, 256), where truncating to int and then packing
+  // with saturation matches static_cast<uint8_t>.
+  const __m128 half_grid_areas = _mm_set1_ps(half_grid_area);
+  const __m128 inv_grid_areas = _mm_set1_ps(inv_grid_area);
+  for (; index < elements_per_row_4_; index += 4) {
+    __m128 values = _mm_mul_ps(
+        _mm_add_ps(_mm_loadu_ps(in_data + index), half_grid_areas),
+        inv_grid_areas);
+    __m128i ints = _mm_cvttps_epi32(values);
+    __m128i words = _mm_packs_epi32(ints, ints);
+    int32 bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+    memcpy(out_data + index, &bytes, sizeof(bytes));
+  }
+#endif
   for (; index < elements_per_row_4_; index+=4) {
     out_data[index] = static_cast<uint8_t>((
         in_data[index] + half_grid_area) * inv_grid_area);
@@ -23,6 +23,7 @@
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/image/image_resizer.h"
+#include "pagespeed/kernel/image/image_util.h"
 #include "pagespeed/kernel/image/jpeg_optimizer.h"
 #include "pagespeed/kernel/image/png_optimizer.h"
 #include "pagespeed/kernel/image/read_image.h"
@@ -49,6 +50,7 @@ using pagespeed::image_compression::PngScanlineReaderRaw;
 using pagespeed::image_compression::ReadTestFile;
 using pagespeed::image_compression::ScanlineResizer;
 using pagespeed::image_compression::ScanlineWriterInterface;
+using pagespeed::image_compression::GetBytesPerPixel;
 using pagespeed::image_compression::WebpConfiguration;
 using pagespeed::image_compression::kMessagePatternPixelFormat;
 using pagespeed::image_compression::kMessagePatternStats;
@@ -343,4 +345,56 @@ TEST_F(ScanlineResizerTest, ResizeFractionalRatio) {
   EXPECT_EQ(new_height, num_rows);
 }
 
+// Shrinking by exactly 2 should average each 2-by-2 block of input pixels.
+// The vectorized and scalar code paths are both checked this way, against a
+// straightforward reference rather than gold files, on an image wide enough
+// for the vector loops to do most of the work.
+TEST_F(ScanlineResizerTest, HalveAveragesBlocks) {
+  const char* kImages[] = { kValidImages[0], kValidImages[1],
+                            kValidImages[2], kImagePagespeed };
+  for (size_t index_image = 0; index_image < arraysize(kImages);
+       ++index_image) {
+    const char* file_name = kImages[index_image];
+    const char* dir = (index_image < kValidImageCount) ?
+        kPngSuiteTestDir : kPngTestDir;
+    ASSERT_TRUE(ReadTestFile(dir, file_name, "png", &input_image_));
+
+    // Decode the whole input to compute the expected output from.
+    PngScanlineReaderRaw full_reader(&message_handler_);
+    ASSERT_TRUE(full_reader.Initialize(input_image_.data(),
+                                       input_image_.length()));
+    const size_t bytes_per_pixel =
+        GetBytesPerPixel(full_reader.GetPixelFormat());
+    const size_t input_width = full_reader.GetImageWidth();
+    const size_t bytes_per_row = input_width * bytes_per_pixel;
+    GoogleString input_pixels;
+    while (full_reader.HasMoreScanLines()) {
+      void* row = NULL;
+      ASSERT_TRUE(full_reader.ReadNextScanline(&row));
+      input_pixels.append(static_cast<const char*>(row), bytes_per_row);
+    }
+
+    ASSERT_TRUE(reader_.Initialize(input_image_.data(),
+                                   input_image_.length()));
+    ASSERT_TRUE(resizer_.Initialize(&reader_, input_width / 2,
+                                    kPreserveAspectRatio));
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(input_pixels.data());
+    for (size_t y = 0; resizer_.HasMoreScanLines(); ++y) {
+      ASSERT_TRUE(resizer_.ReadNextScanline(&scanline_));
+      const uint8_t* out = static_cast<const uint8_t*>(scanline_);
+      const uint8_t* top = in + 2 * y * bytes_per_row;
+      const uint8_t* bottom = top + bytes_per_row;
+      for (size_t i = 0; i < resizer_.GetBytesPerScanline(); ++i) {
+        size_t x = i / bytes_per_pixel;
+        size_t j = 2 * x * bytes_per_pixel + i % bytes_per_pixel;
+        int expected = (top[j] + top[j + bytes_per_pixel] + bottom[j] +
+                        bottom[j + bytes_per_pixel] + 2) / 4;
+        // The resizer works in floating point, so allow off-by-one.
+        ASSERT_NEAR(expected, out[i], 1)
+            << file_name << " at row " << y << ", byte " << i;
+      }
+    }
+  }
+}
+
 }  // namespace
@@ -240,6 +240,43 @@ ScanlineStatus JpegScanlineReader::InitializeWithStatus(const void* image_data,
   return ScanlineStatus(SCANLINE_STATUS_SUCCESS);
 }
 
+bool JpegScanlineReader::ScaleDownTo(size_t min_width, size_t min_height) {
+  if (!was_initialized_ || (row_ > 0) || (min_width == 0) ||
+      (min_height == 0)) {
+    return false;
+  }
+
+  // libjpeg rounds the scaled dimensions up, and scales by at most 8.
+  jpeg_decompress_struct* jpeg_decompress = &(jpeg_env_->jpeg_decompress_);
+  const size_t image_width = jpeg_decompress->image_width;
+  const size_t image_height = jpeg_decompress->image_height;
+  unsigned int scale_denom = 1;
+  while ((scale_denom < 8) &&
+         ((image_width + 2 * scale_denom - 1) / (2 * scale_denom) >=
+          min_width) &&
+         ((image_height + 2 * scale_denom - 1) / (2 * scale_denom) >=
+          min_height)) {
+    scale_denom *= 2;
+  }
+  if (scale_denom == 1) {
+    return false;
+  }
+
+  if (setjmp(jpeg_env_->jmp_buf_env_)) {
+    Reset();
+    PS_LOG_INFO(message_handler_, "libjpeg failed to scale the image.");
+    return false;
+  }
+  jpeg_decompress->scale_num = 1;
+  jpeg_decompress->scale_denom = scale_denom;
+  jpeg_calc_output_dimensions(jpeg_decompress);
+
+  width_ = jpeg_decompress->output_width;
+  height_ = jpeg_decompress->output_height;
+  bytes_per_row_ = width_ * jpeg_decompress->out_color_components;
+  return true;
+}
+
 ScanlineStatus JpegScanlineReader::ReadNextScanlineWithStatus(
     void** out_scanline_bytes) {
   if (!was_initialized_ || !HasMoreScanLines()) {
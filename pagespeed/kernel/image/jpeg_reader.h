@@ -97,6 +97,17 @@ class JpegScanlineReader : public ScanlineReaderInterface {
   virtual size_t GetImageWidth() {  return width_; }
   virtual bool IsProgressive() { return is_progressive_; }
 
+  // Asks libjpeg to scale the image down by 2, 4 or 8 while decoding it, in
+  // the DCT domain, which is much cheaper than decoding it at full size and
+  // shrinking the pixels afterwards.  The largest factor which keeps the
+  // image at least min_width x min_height is used, and the dimensions
+  // reported by the reader change accordingly.  Must be called after
+  // Initialize() and before the first ReadNextScanline().  Returns true if
+  // the image will be scaled.  If libjpeg fails while setting up the scaling,
+  // the reader is reset, as on other errors, and has to be initialized again
+  // before it can be read.
+  bool ScaleDownTo(size_t min_width, size_t min_height);
+
  private:
   JpegEnv* jpeg_env_;  // State of libjpeg
   unsigned char* row_pointer_[1];  // Pointer for a row buffer
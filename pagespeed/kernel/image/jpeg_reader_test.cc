@@ -20,6 +20,7 @@
 #include "pagespeed/kernel/base/mock_message_handler.h"
 #include "pagespeed/kernel/base/null_mutex.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/image/image_resizer.h"
 #include "pagespeed/kernel/image/jpeg_reader.h"
 #include "pagespeed/kernel/image/read_image.h"
 #include "pagespeed/kernel/image/test_utils.h"
@@ -40,6 +41,7 @@ using pagespeed::image_compression::kMessagePatternLibJpegFailure;
 using pagespeed::image_compression::ReadImage;
 using pagespeed::image_compression::ReadTestFile;
 using pagespeed::image_compression::ReadTestFileWithExt;
+using pagespeed::image_compression::ScanlineResizer;
 
 const char* kValidJpegImages[] = {
   "test411",        // RGB color space with 4:1:1 chroma sub-sampling.
@@ -139,4 +141,92 @@ TEST(JpegReaderTest, PartialRead) {
   ASSERT_TRUE(reader4.ReadNextScanline(&scanline));
 }
 
+// Verify that the reader picks the largest scale which keeps the image big
+// enough, and rounds the scaled dimensions up.
+TEST(JpegReaderTest, ScaleDown) {
+  MockMessageHandler message_handler(new NullMutex);
+  for (size_t i = 0; i < kValidJpegImageCount; ++i) {
+    GoogleString image;
+    ReadTestFile(kJpegTestDir, kValidJpegImages[i], "jpg", &image);
+    JpegScanlineReader reader(&message_handler);
+    ASSERT_TRUE(reader.Initialize(image.c_str(), image.length()));
+    const size_t bytes_per_pixel =
+        reader.GetBytesPerScanline() / reader.GetImageWidth();
+
+    // The images are 130x97, so scaling by 8 would make them too narrow.
+    ASSERT_TRUE(reader.ScaleDownTo(30, 20));
+    EXPECT_EQ(33, reader.GetImageWidth());
+    EXPECT_EQ(25, reader.GetImageHeight());
+    EXPECT_EQ(33 * bytes_per_pixel, reader.GetBytesPerScanline());
+    int num_rows = 0;
+    void* scanline = NULL;
+    while (reader.HasMoreScanLines()) {
+      ASSERT_TRUE(reader.ReadNextScanline(&scanline));
+      ++num_rows;
+    }
+    EXPECT_EQ(25, num_rows);
+  }
+}
+
+// Verify that decoding scaled down in the DCT domain gives about the same
+// pixels as decoding at full size and resizing.
+TEST(JpegReaderTest, ScaleDownMatchesResizer) {
+  MockMessageHandler message_handler(new NullMutex);
+  GoogleString image;
+  ReadTestFile(kJpegTestDir, "progressive", "jpg", &image);
+
+  JpegScanlineReader scaled_reader(&message_handler);
+  ASSERT_TRUE(scaled_reader.Initialize(image.c_str(), image.length()));
+  ASSERT_TRUE(scaled_reader.ScaleDownTo(50, 50));
+  EXPECT_EQ(50, scaled_reader.GetImageWidth());
+  EXPECT_EQ(50, scaled_reader.GetImageHeight());
+
+  JpegScanlineReader full_reader(&message_handler);
+  ASSERT_TRUE(full_reader.Initialize(image.c_str(), image.length()));
+  ScanlineResizer resizer(&message_handler);
+  ASSERT_TRUE(resizer.Initialize(&full_reader, 50, 50));
+  ASSERT_EQ(resizer.GetBytesPerScanline(),
+            scaled_reader.GetBytesPerScanline());
+
+  int total_diff = 0;
+  int num_bytes = 0;
+  while (scaled_reader.HasMoreScanLines()) {
+    void* scaled_row = NULL;
+    void* resized_row = NULL;
+    ASSERT_TRUE(scaled_reader.ReadNextScanline(&scaled_row));
+    ASSERT_TRUE(resizer.ReadNextScanline(&resized_row));
+    const uint8* scaled = static_cast<const uint8*>(scaled_row);
+    const uint8* resized = static_cast<const uint8*>(resized_row);
+    for (size_t i = 0; i < scaled_reader.GetBytesPerScanline(); ++i) {
+      total_diff += abs(static_cast<int>(scaled[i]) - resized[i]);
+      ++num_bytes;
+    }
+  }
+  EXPECT_FALSE(resizer.HasMoreScanLines());
+  EXPECT_GT(num_bytes, total_diff);  // Off by less than 1 on average.
+}
+
+// Verify that the reader doesn't scale when it can't.
+TEST(JpegReaderTest, ScaleDownNotPossible) {
+  MockMessageHandler message_handler(new NullMutex);
+  GoogleString image;
+  ReadTestFile(kJpegTestDir, kValidJpegImages[0], "jpg", &image);
+  JpegScanlineReader reader(&message_handler);
+
+  // Not initialized.
+  EXPECT_FALSE(reader.ScaleDownTo(30, 20));
+
+  // Halving would make the image too small.
+  ASSERT_TRUE(reader.Initialize(image.c_str(), image.length()));
+  EXPECT_FALSE(reader.ScaleDownTo(70, 20));
+  EXPECT_EQ(130, reader.GetImageWidth());
+  EXPECT_EQ(97, reader.GetImageHeight());
+
+  // Decoding has started.
+  void* scanline = NULL;
+  ASSERT_TRUE(reader.ReadNextScanline(&scanline));
+  EXPECT_FALSE(reader.ScaleDownTo(30, 20));
+  EXPECT_EQ(130, reader.GetImageWidth());
+}
+
 }  // namespace
@@ -18,10 +18,16 @@
 
 #include "pagespeed/kernel/image/png_optimizer.h"
 
+#include <vector>
+
 #include "base/logging.h"
+#include "pagespeed/kernel/base/atomic_int32.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/stl_util.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/image/scanline_utils.h"
 
 #ifdef __native_client__
@@ -44,6 +50,7 @@ extern "C" {
 #include "third_party/optipng/src/opngreduc/opngreduc.h"
 }
 
+using net_instaweb::AtomicInt32;
 using net_instaweb::MessageHandler;
 using pagespeed::image_compression::PngCompressParams;
 
@@ -61,6 +68,31 @@ const PngCompressParams kPngCompressionParams[] = {
 
 const size_t kParamCount = arraysize(kPngCompressionParams);
 
+// When predicting the best parameters, we compress kSampleBands bands of
+// kSampleBandRows consecutive rows, spread evenly over the image.  The bands
+// must be tall enough for the row filters and the compressor's window to
+// behave as they do on the whole image.
+const int kSampleBands = 4;
+const int kSampleBandRows = 16;
+
+// Aborts the current libpng invocation, returning to its setjmp.
+void PngLongJmp(png_structp png_ptr) {
+#if PNG_LIBPNG_VER >= 10400
+  #ifndef __native_client__
+    png_longjmp(png_ptr, 1);
+  #else
+    // On native client, invoking png_longjmp as above causes a
+    // crash. Invoking longjmp directly, however, works fine.  For the
+    // time being we use this workaround for native client builds. See
+    // http://code.google.com/p/page-speed/issues/detail?id=644 for
+    // more information.
+    longjmp(png_ptr->longjmp_buffer, 1);
+  #endif
+#else
+  longjmp(png_ptr->jmpbuf, 1);
+#endif
+}
+
 void ReadPngFromStream(png_structp read_ptr,
                        png_bytep data,
                        png_size_t length) {
@@ -76,20 +108,7 @@ void ReadPngFromStream(png_structp read_ptr,
     PS_DLOG_INFO(input->message_handler(), "Unexpected EOF.");
 
     // We weren't able to satisfy the read, so abort.
-#if PNG_LIBPNG_VER >= 10400
-  #ifndef __native_client__
-    png_longjmp(read_ptr, 1);
-  #else
-    // On native client, invoking png_longjmp as above causes a
-    // crash. Invoking longjmp directly, however, works fine.  For the
-    // time being we use this workaround for native client builds. See
-    // http://code.google.com/p/page-speed/issues/detail?id=644 for
-    // more information.
-    longjmp(read_ptr->longjmp_buffer, 1);
-  #endif
-#else
-    longjmp(read_ptr->jmpbuf, 1);
-#endif
+    PngLongJmp(read_ptr);
   }
 }
 
@@ -101,27 +120,51 @@ void WritePngToString(png_structp write_ptr,
   buffer.append(reinterpret_cast<char*>(data), length);
 }
 
+// Destination of a PNG written by a compression trial.
+struct TrialOutput {
+  TrialOutput(const AtomicInt32* best, GoogleString* out)
+      : best_size(best), buffer(out) {}
+
+  const AtomicInt32* best_size;  // Smallest finished trial; 0 if none yet.
+  GoogleString* buffer;
+};
+
+void WritePngTrialToString(png_structp write_ptr,
+                           png_bytep data,
+                           png_size_t length) {
+  TrialOutput* output =
+      reinterpret_cast<TrialOutput*>(png_get_io_ptr(write_ptr));
+  output->buffer->append(reinterpret_cast<char*>(data), length);
+  if (output->best_size != NULL) {
+    // Output can only grow, so a trial that is already larger than a
+    // finished one can't win, and we stop spending CPU on it.  This isn't
+    // an error, so we skip png_error and its logging.
+    size_t best_size = output->best_size->value();
+    if ((best_size != 0) && (output->buffer->size() > best_size)) {
+      PngLongJmp(write_ptr);
+    }
+  }
+}
+
+// Lowers *best_size to size, unless it's already smaller.
+void UpdateBestSize(int32 size, AtomicInt32* best_size) {
+  int32 best = best_size->value();
+  while ((best == 0) || (size < best)) {
+    int32 seen = best_size->CompareAndSwap(best, size);
+    if (seen == best) {
+      break;
+    }
+    best = seen;
+  }
+}
+
 void PngErrorFn(png_structp png_ptr, png_const_charp msg) {
   PS_DLOG_INFO(static_cast<MessageHandler*>(png_get_error_ptr(png_ptr)), \
                "libpng error: %s", msg);
 
   // Invoking the error function indicates a terminal failure, which
   // means we must longjmp to abort the libpng invocation.
-#if PNG_LIBPNG_VER >= 10400
-  #ifndef __native_client__
-    png_longjmp(png_ptr, 1);
-  #else
-    // On native client, invoking png_longjmp as above causes a
-    // crash. Invoking longjmp directly, however, works fine.  For the
-    // time being we use this workaround for native client builds. See
-    // http://code.google.com/p/page-speed/issues/detail?id=644 for
-    // more information.
-    longjmp(png_ptr->longjmp_buffer, 1);
-  #endif
-
-#else
-  longjmp(png_ptr->jmpbuf, 1);
-#endif
+  PngLongJmp(png_ptr);
 }
 
 void PngWarningFn(png_structp png_ptr, png_const_charp msg) {
@@ -232,10 +275,71 @@ PngReaderInterface::PngReaderInterface() {
 PngReaderInterface::~PngReaderInterface() {
 }
 
+// Compresses a copy of a write struct with one set of parameters.
+class PngOptimizer::CompressionTrial {
+ public:
+  CompressionTrial(PngOptimizer* optimizer, const PngCompressParams& params,
+                   AtomicInt32* best_size)
+      : optimizer_(optimizer),
+        params_(params),
+        best_size_(best_size),
+        write_(ScopedPngStruct::WRITE, optimizer->message_handler_),
+        copied_(false),
+        success_(false) {
+  }
+
+  // Copies from, sharing its rows.  This touches from's error handling
+  // state, so it must be done on the thread that owns from.
+  void CopyFrom(const ScopedPngStruct& from) {
+    copied_ = CopyPngStructs(from, &write_);
+  }
+
+  void Run() {
+    if (copied_) {
+      success_ = optimizer_->CreateOptimizedPngWithParams(
+          &write_, params_, best_size_, &output_);
+      if (success_) {
+        UpdateBestSize(static_cast<int32>(output_.size()), best_size_);
+      }
+    }
+  }
+
+  bool success() const { return success_; }
+  GoogleString* output() { return &output_; }
+
+ private:
+  PngOptimizer* optimizer_;
+  const PngCompressParams params_;
+  AtomicInt32* best_size_;
+  ScopedPngStruct write_;
+  GoogleString output_;
+  bool copied_;
+  bool success_;
+
+  DISALLOW_COPY_AND_ASSIGN(CompressionTrial);
+};
+
+class PngOptimizer::CompressionTrialThread : public ThreadSystem::Thread {
+ public:
+  CompressionTrialThread(ThreadSystem* thread_system, CompressionTrial* trial)
+      : Thread(thread_system, "png_trial", ThreadSystem::kJoinable),
+        trial_(trial) {
+  }
+
+  virtual void Run() { trial_->Run(); }
+
+ private:
+  CompressionTrial* trial_;
+
+  DISALLOW_COPY_AND_ASSIGN(CompressionTrialThread);
+};
+
 PngOptimizer::PngOptimizer(MessageHandler* handler)
     : read_(ScopedPngStruct::READ, handler),
       write_(ScopedPngStruct::WRITE, handler),
       best_compression_(false),
+      predict_best_params_(false),
+      thread_system_(NULL),
       message_handler_(handler) {
 }
 
@@ -288,33 +392,135 @@ bool PngOptimizer::CreateOptimizedPng(const PngReaderInterface& reader,
                                            out);
   } else {
     PngCompressParams params(PNG_FILTER_NONE, Z_DEFAULT_STRATEGY, false);
-    return CreateOptimizedPngWithParams(&write_, params, out);
+    return CreateOptimizedPngWithParams(&write_, params, NULL, out);
   }
 }
 
 bool PngOptimizer::CreateBestOptimizedPngForParams(
     const PngCompressParams* param_list, size_t param_list_size,
     GoogleString* out) {
-  bool success = false;
+  size_t predicted_index;
+  if (predict_best_params_ &&
+      PredictBestParams(param_list, param_list_size, &predicted_index)) {
+    param_list += predicted_index;
+    param_list_size = 1;
+  }
+
+  // libpng doesn't allow for reuse of the write structs, so each trial
+  // compresses its own copy of write_.
+  AtomicInt32 best_size(0);
+  std::vector<CompressionTrial*> trials;
   for (size_t idx = 0; idx < param_list_size; ++idx) {
-    ScopedPngStruct write(ScopedPngStruct::WRITE, message_handler_);
-    GoogleString temp_output;
-    // libpng doesn't allow for reuse of the write structs, so we must copy on
-    // each iteration of the loop.
-    CopyPngStructs(write_, &write);
-    if (CreateOptimizedPngWithParams(&write, param_list[idx], &temp_output)) {
-      // If this gives better compression update the output.
-      if (out->empty() || out->size() > temp_output.size()) {
-        out->swap(temp_output);
+    trials.push_back(new CompressionTrial(this, param_list[idx], &best_size));
+    trials.back()->CopyFrom(write_);
+  }
+
+  if ((thread_system_ == NULL) || (trials.size() < 2)) {
+    for (size_t idx = 0; idx < trials.size(); ++idx) {
+      trials[idx]->Run();
+    }
+  } else {
+    // Run the first trial on this thread, and the others alongside it.
+    std::vector<CompressionTrialThread*> threads;
+    for (size_t idx = 1; idx < trials.size(); ++idx) {
+      CompressionTrialThread* thread =
+          new CompressionTrialThread(thread_system_, trials[idx]);
+      if (thread->Start()) {
+        threads.push_back(thread);
+      } else {
+        delete thread;
+        trials[idx]->Run();
       }
-      success |= true;
     }
+    trials[0]->Run();
+    for (size_t idx = 0; idx < threads.size(); ++idx) {
+      threads[idx]->Join();
+    }
+    STLDeleteElements(&threads);
   }
+
+  // Keep the smallest output, preferring earlier parameters on ties, so the
+  // result doesn't depend on the order in which the trials finished.
+  bool success = false;
+  for (size_t idx = 0; idx < trials.size(); ++idx) {
+    CompressionTrial* trial = trials[idx];
+    if (trial->success() &&
+        (!success || (out->size() > trial->output()->size()))) {
+      out->swap(*trial->output());
+      success = true;
+    }
+  }
+  STLDeleteElements(&trials);
   return success;
 }
 
+bool PngOptimizer::PredictBestParams(const PngCompressParams* param_list,
+                                     size_t param_list_size,
+                                     size_t* best_index) {
+  if (param_list_size < 2) {
+    return false;
+  }
+  png_structp png_ptr = write_.png_ptr();
+  png_infop info_ptr = write_.info_ptr();
+  png_uint_32 width, height;
+  int bit_depth, color_type, interlace_type, compression_type, filter_type;
+  if (setjmp(png_jmpbuf(png_ptr))) {
+    return false;
+  }
+  png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth, &color_type,
+               &interlace_type, &compression_type, &filter_type);
+  const png_uint_32 sample_height = kSampleBands * kSampleBandRows;
+  if (height < 2 * sample_height) {
+    // Compressing the whole image isn't much more work than the sample.
+    return false;
+  }
+
+  png_bytepp rows = png_get_rows(png_ptr, info_ptr);
+  if (rows == NULL) {
+    return false;
+  }
+  std::vector<png_bytep> sample_rows;
+  sample_rows.reserve(sample_height);
+  png_uint_32 band_spacing = height / kSampleBands;
+  for (int band = 0; band < kSampleBands; ++band) {
+    png_bytepp band_rows = rows + band * band_spacing;
+    sample_rows.insert(sample_rows.end(), band_rows,
+                       band_rows + kSampleBandRows);
+  }
+
+  // The sample is a short image made of the bands, which the trials copy.
+  ScopedPngStruct sample(ScopedPngStruct::WRITE, message_handler_);
+  if (!CopyPngStructs(write_, &sample)) {
+    return false;
+  }
+  if (setjmp(png_jmpbuf(sample.png_ptr()))) {
+    return false;
+  }
+  png_set_IHDR(sample.png_ptr(), sample.info_ptr(), width, sample_height,
+               bit_depth, color_type, interlace_type, compression_type,
+               filter_type);
+  png_set_rows(sample.png_ptr(), sample.info_ptr(), &sample_rows[0]);
+
+  AtomicInt32 best_size(0);
+  bool found = false;
+  for (size_t idx = 0; idx < param_list_size; ++idx) {
+    ScopedPngStruct trial(ScopedPngStruct::WRITE, message_handler_);
+    GoogleString output;
+    if (CopyPngStructs(sample, &trial) &&
+        CreateOptimizedPngWithParams(&trial, param_list[idx], &best_size,
+                                     &output) &&
+        (!found || (static_cast<size_t>(best_size.value()) > output.size()))) {
+      best_size.set_value(output.size());
+      *best_index = idx;
+      found = true;
+    }
+  }
+  return found;
+}
+
 bool PngOptimizer::CreateOptimizedPngWithParams(ScopedPngStruct* write,
     const PngCompressParams& params,
+    const AtomicInt32* best_size,
     GoogleString *out) {
   int compression_level =
       best_compression_ ? Z_BEST_COMPRESSION : Z_DEFAULT_COMPRESSION;
@@ -323,7 +529,7 @@ bool PngOptimizer::CreateOptimizedPngWithParams(ScopedPngStruct* write,
   png_set_compression_strategy(write->png_ptr(), params.compression_strategy);
   png_set_filter(write->png_ptr(), PNG_FILTER_TYPE_BASE, params.filter_level);
   png_set_compression_window_bits(write->png_ptr(), 15);
-  if (!WritePng(write, out)) {
+  if (!WritePng(write, best_size, out)) {
     return false;
   }
   return true;
@@ -346,6 +552,29 @@ bool PngOptimizer::OptimizePngBestCompression(const PngReaderInterface& reader,
   return o.CreateOptimizedPng(reader, in, out, handler);
 }
 
+bool PngOptimizer::OptimizePngBestCompressionInParallel(
+    const PngReaderInterface& reader,
+    const GoogleString& in,
+    GoogleString* out,
+    ThreadSystem* thread_system,
+    MessageHandler* handler) {
+  PngOptimizer o(handler);
+  o.EnableBestCompression();
+  o.EnableParallelTrials(thread_system);
+  return o.CreateOptimizedPng(reader, in, out, handler);
+}
+
+bool PngOptimizer::OptimizePngPredictingBestCompression(
+    const PngReaderInterface& reader,
+    const GoogleString& in,
+    GoogleString* out,
+    MessageHandler* handler) {
+  PngOptimizer o(handler);
+  o.EnableBestCompression();
+  o.EnablePredictedTrial();
+  return o.CreateOptimizedPng(reader, in, out, handler);
+}
+
 PngReader::PngReader(MessageHandler* handler)
   : message_handler_(handler) {
 }
@@ -473,11 +702,15 @@ bool PngReader::GetAttributes(const GoogleString& body,
   return true;
 }
 
-bool PngOptimizer::WritePng(ScopedPngStruct* write, GoogleString* buffer) {
+bool PngOptimizer::WritePng(ScopedPngStruct* write,
+                            const AtomicInt32* best_size,
+                            GoogleString* buffer) {
+  TrialOutput output(best_size, buffer);
   if (setjmp(png_jmpbuf(write->png_ptr()))) {
     return false;
   }
-  png_set_write_fn(write->png_ptr(), buffer, &WritePngToString, &PngFlush);
+  png_set_write_fn(write->png_ptr(), &output, &WritePngTrialToString,
+                   &PngFlush);
   png_write_png(
       write->png_ptr(), write->info_ptr(), PNG_TRANSFORM_IDENTITY, NULL);
 
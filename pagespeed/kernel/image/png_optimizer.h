@@ -41,7 +41,9 @@ extern "C" {
 #include "pagespeed/kernel/image/scanline_status.h"
 
 namespace net_instaweb {
+class AtomicInt32;
 class MessageHandler;
+class ThreadSystem;
 }
 
 namespace pagespeed {
@@ -49,6 +51,7 @@ namespace pagespeed {
 namespace image_compression {
 
 using net_instaweb::MessageHandler;
+using net_instaweb::ThreadSystem;
 
 class ScanlineStreamInput;
 
@@ -235,9 +238,36 @@ class PngOptimizer {
                                          GoogleString* out,
                                          MessageHandler* handler);
 
+  // Produces the same output as OptimizePngBestCompression, but runs the
+  // compression trials concurrently, each on its own thread from
+  // thread_system.  This lowers the latency of a single image at the same
+  // total CPU cost, so it's best used when there are idle cores.  The trials
+  // report errors to handler from their own threads, so handler must be
+  // thread-safe; a MockMessageHandler, for example, needs a real mutex.
+  static bool OptimizePngBestCompressionInParallel(
+      const PngReaderInterface& reader,
+      const GoogleString& in,
+      GoogleString* out,
+      ThreadSystem* thread_system,
+      MessageHandler* handler);
+
+  // Like OptimizePngBestCompression, but first compresses a sample of the
+  // image's rows with each set of trial parameters, and then compresses the
+  // whole image just once, with the parameters that did best on the sample.
+  // This costs little more than one trial, but the output is sometimes a bit
+  // larger than OptimizePngBestCompression's.
+  static bool OptimizePngPredictingBestCompression(
+      const PngReaderInterface& reader,
+      const GoogleString& in,
+      GoogleString* out,
+      MessageHandler* handler);
+
   static bool CopyPngStructs(const ScopedPngStruct& from, ScopedPngStruct* to);
 
  private:
+  class CompressionTrial;
+  class CompressionTrialThread;
+
   explicit PngOptimizer(MessageHandler* handler);
   ~PngOptimizer();
 
@@ -253,17 +283,40 @@ class PngOptimizer {
   // smaller files.
   void EnableBestCompression() { best_compression_ = true; }
 
-  bool WritePng(ScopedPngStruct* write, GoogleString* buffer);
+  // Runs the best compression trials on threads from thread_system.
+  void EnableParallelTrials(ThreadSystem* thread_system) {
+    thread_system_ = thread_system;
+  }
+
+  // Picks the best compression parameters from a sample of the rows.
+  void EnablePredictedTrial() { predict_best_params_ = true; }
+
+  // Writes the image to buffer.  If best_size is non-NULL and non-zero, the
+  // write is abandoned, returning false, once the output gets larger than
+  // best_size.
+  bool WritePng(ScopedPngStruct* write,
+                const net_instaweb::AtomicInt32* best_size,
+                GoogleString* buffer);
   bool CopyReadToWrite();
   bool CreateBestOptimizedPngForParams(const PngCompressParams* param_list,
                                        size_t param_list_size,
                                        GoogleString* out);
   bool CreateOptimizedPngWithParams(ScopedPngStruct* write,
                                     const PngCompressParams& params,
+                                    const net_instaweb::AtomicInt32* best_size,
                                     GoogleString* out);
+
+  // Compresses a few bands of write_'s rows with each of the parameters, and
+  // sets *best_index to the one giving the smallest output.  Returns false if
+  // the image is too small for sampling to be worthwhile, or on error.
+  bool PredictBestParams(const PngCompressParams* param_list,
+                         size_t param_list_size, size_t* best_index);
+
   ScopedPngStruct read_;
   ScopedPngStruct write_;
   bool best_compression_;
+  bool predict_best_params_;
+  ThreadSystem* thread_system_;  // NULL to run trials serially.
   MessageHandler* message_handler_;
 
   DISALLOW_COPY_AND_ASSIGN(PngOptimizer);
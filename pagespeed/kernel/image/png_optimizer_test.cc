@@ -24,12 +24,15 @@
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/mock_message_handler.h"
 #include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/image/gif_reader.h"
 #include "pagespeed/kernel/image/png_optimizer.h"
 #include "pagespeed/kernel/image/read_image.h"
 #include "pagespeed/kernel/image/scanline_utils.h"
 #include "pagespeed/kernel/image/test_utils.h"
+#include "pagespeed/kernel/util/platform.h"
 
 extern "C" {
 #ifdef USE_SYSTEM_LIBPNG
@@ -43,6 +46,8 @@ namespace {
 
 using net_instaweb::MockMessageHandler;
 using net_instaweb::NullMutex;
+using net_instaweb::Platform;
+using net_instaweb::ThreadSystem;
 using pagespeed::image_compression::kGifTestDir;
 using pagespeed::image_compression::kPngSuiteTestDir;
 using pagespeed::image_compression::kPngSuiteGifTestDir;
@@ -511,6 +516,17 @@ void AssertMatch(const GoogleString& in,
   EXPECT_EQ(info.compressed_size_best, out.size()) << info.filename;
   AssertPngEq(ref, out, info.filename, in_rgba);
 
+  // Running the trials in parallel must not change the output.  The trials
+  // may log from several threads at once, so their handler needs a real
+  // mutex.
+  scoped_ptr<ThreadSystem> thread_system(Platform::CreateThreadSystem());
+  MockMessageHandler parallel_handler(thread_system->NewMutex());
+  GoogleString parallel_out;
+  ASSERT_TRUE(PngOptimizer::OptimizePngBestCompressionInParallel(
+      *reader, in, &parallel_out, thread_system.get(), &parallel_handler))
+      << info.filename;
+  EXPECT_EQ(out, parallel_out) << info.filename;
+
   ASSERT_TRUE(png_reader.GetAttributes(
       out, &width, &height, &bit_depth, &color_type)) << info.filename;
   EXPECT_EQ(info.compressed_bit_depth, bit_depth) << info.filename;
@@ -707,6 +723,31 @@ TEST_F(PngOptimizerTest, LargerPng) {
   EXPECT_EQ(0, color_type);
 }
 
+TEST_F(PngOptimizerTest, PredictingBestCompression) {
+  // The image is tall enough that the parameters are picked from a sample of
+  // its rows, so we get one of the outputs the full trials would choose from.
+  reader_.reset(new PngReader(&message_handler_));
+  GoogleString in, best, predicted;
+  ReadTestFile(kPngTestDir, "this_is_a_test", "png", &in);
+  ASSERT_TRUE(PngOptimizer::OptimizePngBestCompression(*reader_, in, &best,
+      &message_handler_));
+  ASSERT_TRUE(PngOptimizer::OptimizePngPredictingBestCompression(
+      *reader_, in, &predicted, &message_handler_));
+  EXPECT_LE(best.size(), predicted.size());
+  EXPECT_GT(in.size(), predicted.size());
+  AssertPngEq(in, predicted, "this_is_a_test", GoogleString());
+
+  // Images too short to sample go through all the trials.
+  for (size_t i = 0; i < kValidImageCount; i++) {
+    ReadTestFile(kPngSuiteTestDir, kValidImages[i].filename, "png", &in);
+    ASSERT_TRUE(PngOptimizer::OptimizePngPredictingBestCompression(
+        *reader_, in, &predicted, &message_handler_))
+        << kValidImages[i].filename;
+    EXPECT_EQ(kValidImages[i].compressed_size_best, predicted.size())
+        << kValidImages[i].filename;
+  }
+}
+
 TEST_F(PngOptimizerTest, InvalidPngs) {
   reader_.reset(new PngReader(&message_handler_));
   for (size_t i = 0; i < kInvalidFileCount; i++) {
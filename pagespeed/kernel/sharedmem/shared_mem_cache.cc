@@ -30,16 +30,23 @@
 // partitioned between them.
 //
 // When we access an entry, we first select a sector number based off its key,
-// and then within the sector we choose kAssociativity (4) possible
+// and then within the sector we choose associativity (by default 4) possible
 // directory entries storing it, and the appropriate directory entry then
 // points to some number of blocks containing the object's payload.
 //
+// The sectors are followed by an ImageHeader (see shared_mem_cache_data.h)
+// recording the cache's geometry and format version. It's mostly of interest
+// to file-backed caches (see InitializeFromFile), which check it to decide
+// whether the contents left in the file by a previous run can be reused.
+//
 // In each sector we store:
 //
 // 1) Freelist --- block number of a free block, or -1 (kInvalidBlock) if there
 //    are none. Further free blocks are linked via the block successor list.
 //
-// 2) LRU front/rear links into the cache directory.
+// 2) LRU front/rear links into the cache directory, and the number of
+//    lookups the frequency sketch (7, below) has counted since it was last
+//    halved.
 //
 // 3) Various statistics (see struct SectorStats in shared_mem_cache_data.h
 //    for the list)
@@ -62,19 +69,33 @@
 //    (But note that the size of the hash portion is dependent on the Hasher;
 //     and the struct is padded to be 8-aligned).
 //
+// 7) The frequency sketch: kSketchRows rows of byte-sized counters, each
+//    row as wide as the directory, but at least 64 counters.
+//
 // Padding to align to block size.
 //
-// 7) The data blocks. These contain the actual payload.
+// 8) The data blocks. These contain the actual payload.
 //
 // ----------------------------------------------------------------------------
 // Cache directory usage
 // ----------------------------------------------------------------------------
 //
-// Presently we operate in a 4-way skew associative fashion:
+// By default we operate in a 4-way skew associative fashion:
 // each key determines 4 (very rarely identical) positions in the directory
-// that may be used to store it. We check both for lookup/overwrite, and use
-// timestamps to determine replacement candidates. (Experiments have shown that
-// 2-way produced way too many extra conflicts).
+// that may be used to store it. We check all of them for lookup/overwrite,
+// and use timestamps to determine replacement candidates. (Experiments have
+// shown that 2-way produced way too many extra conflicts). Large caches may
+// want 8 or 16 ways; see set_associativity(). The first 4 positions are
+// always the same for a given key, further ones are chosen by double
+// hashing.
+//
+// With kEvictLeastFrequentlyUsed, replacement prefers the candidate with the
+// fewest hits (hit_count), falling back to timestamps for ties. It also
+// applies TinyLFU admission: every lookup in a sector, hit or miss, is
+// counted in the sector's count-min sketch, which is halved periodically so
+// old counts fade. A Put of a new key that would replace a live entry is
+// dropped if the sketch says the key was looked up less often than that
+// entry, so one-off keys can't push out popular ones.
 //
 // ----------------------------------------------------------------------------
 // Cache entry format
@@ -101,6 +122,10 @@
 // ::Put() fail, but the filter would proceeds anyway as it has no way of
 // knowing?
 //
+// hit_count counts Gets that found the entry. It saturates at
+// kMaxHitCount, and is halved for all the entries remaining in an
+// associativity set whenever one of its entries is evicted.
+//
 // creating and open_count are used to lock the particular entry for
 // reading or writing while the main sector lock is released.
 //
@@ -113,6 +138,24 @@
 // True       0           Writer working.
 //
 // For now, writers wait in sleep loop, while readers simply fail/miss.
+// Since a PinnedValue keeps open_count raised for as long as its holder
+// likes, a Put waits at most kMaxPutWaitUs for the readers of the entry it
+// wants before giving up and dropping the write. A Delete can't just give
+// up, as that would leave the stale value readable, so after waiting
+// kMaxDeleteWaitUs it clears the entry's hash and unlinks it from the LRU,
+// which makes the key a miss from then on while leaving the blocks alone.
+// Such an entry has an all-0 hash, open_count > 0, and blocks; it is freed
+// by whichever reader brings open_count back to 0. A Delete that finds a Put
+// waiting for an entry's readers clears the hash the same way, without
+// waiting itself; the Put then drops its write, whether or not the readers
+// left in time, and frees the entry or leaves it to its last reader.
+//
+// Readers of values that fit in a single block can skip the open_count
+// dance and copy the value while still holding the sector lock, since that
+// is no more expensive than taking the lock a second time to drop the
+// count; Get does that. Larger values are pinned and copied out without the
+// lock. GetPinned, which tests use, always pins, leaving the count raised
+// until its PinnedValue is released.
 //
 // TODO(morlovich): Evaluate using chaining and one more layer of indirection
 // instead, as it should hopefully produce much better utilization and avoid
@@ -120,6 +163,7 @@
 
 #include "pagespeed/kernel/sharedmem/shared_mem_cache.h"
 
+#include <algorithm>
 #include <cstddef>                     // for size_t
 #include <cstring>
 #include <map>
@@ -150,14 +194,53 @@ using SharedMemCacheData::BlockNum;
 using SharedMemCacheData::BlockVector;
 using SharedMemCacheData::CacheEntry;
 using SharedMemCacheData::EntryNum;
+using SharedMemCacheData::ImageHeader;
 using SharedMemCacheData::Sector;
 using SharedMemCacheData::SectorStats;
 using SharedMemCacheData::kInvalidBlock;
 using SharedMemCacheData::kInvalidEntry;
 using SharedMemCacheData::kHashSize;
+using SharedMemCacheData::kSketchRows;
 
 namespace {
 
+const uint32 kMaxHitCount = 255;
+
+// How long a writer sleeps between checks for readers to leave an entry,
+// and how long a Put will keep at it before dropping the write.
+const int64 kWriterSpinUs = 50;
+const int64 kMaxPutWaitUs = 100 * Timer::kMsUs;
+
+// How long a Delete waits for readers before leaving the entry for the last
+// of them to free; see the top of the file.
+const int64 kMaxDeleteWaitUs = Timer::kMsUs;
+
+// Identifies cache images; see ImageHeader. kImageVersion must be bumped
+// whenever the sector or entry formats change.
+const uint64 kImageMagic = 0x65686361636d6873ULL;  // "shmcache"
+const uint32 kImageVersion = 4;
+
+// FNV-1a over the header, excluding the checksum itself.
+uint64 ImageHeaderChecksum(const ImageHeader& header) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&header);
+  uint64 hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < offsetof(ImageHeader, checksum); ++i) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// FNV-1a, continuing from hash, for CacheEntry::checksum.
+const uint32 kEntryChecksumBasis = 0x811c9dc5U;
+
+uint32 ExtendEntryChecksum(uint32 hash, const char* data, size_t size) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 0x01000193U;
+  }
+  return hash;
+}
+
 bool IsAllNil(const StringPiece& raw_hash) {
   bool all_nil = true;
   for (size_t c = 0; c < raw_hash.length(); ++c) {
@@ -202,9 +285,19 @@ SharedMemCache<kBlockSize>::SharedMemCache(
       num_sectors_(sectors),
       entries_per_sector_(entries_per_sector),
       blocks_per_sector_(blocks_per_sector),
+      associativity_(kDefaultAssociativity),
+      eviction_policy_(kEvictLeastRecentlyUsed),
+      file_backed_(false),
       handler_(handler) {
 }
 
+template<size_t kBlockSize>
+void SharedMemCache<kBlockSize>::set_associativity(int associativity) {
+  CHECK_LE(1, associativity);
+  CHECK_LE(associativity, kMaxAssociativity);
+  associativity_ = associativity;
+}
+
 template<size_t kBlockSize>
 GoogleString SharedMemCache<kBlockSize>::FormatName() {
   return StringPrintf("SharedMemCache<%d>", static_cast<int>(kBlockSize));
@@ -216,16 +309,34 @@ SharedMemCache<kBlockSize>::~SharedMemCache() {
 }
 
 template<size_t kBlockSize>
-bool SharedMemCache<kBlockSize>::InitCache(bool parent) {
+bool SharedMemCache<kBlockSize>::InitCache(bool parent,
+                                           const GoogleString& file_path) {
   size_t sector_size =
       Sector<kBlockSize>::RequiredSize(shm_runtime_, entries_per_sector_,
                                        blocks_per_sector_);
-  size_t size = num_sectors_ * sector_size;
+  size_t sectors_size = num_sectors_ * sector_size;
+  size_t size = sectors_size + sizeof(ImageHeader);
 
-  if (parent) {
-    segment_.reset(shm_runtime_->CreateSegment(filename_, size, handler_));
-  } else {
+  bool reused = false;
+  file_backed_ = false;
+  if (!parent) {
     segment_.reset(shm_runtime_->AttachToSegment(filename_, size, handler_));
+  } else {
+    if (!file_path.empty()) {
+      segment_.reset(shm_runtime_->CreateFileBackedSegment(
+          filename_, file_path, size, handler_, &reused));
+      if (segment_.get() == NULL) {
+        handler_->Message(
+            kWarning, "SharedMemCache: can't keep %s in %s, its contents "
+            "will not persist across restarts", filename_.c_str(),
+            file_path.c_str());
+      } else {
+        file_backed_ = true;
+      }
+    }
+    if (segment_.get() == NULL) {
+      segment_.reset(shm_runtime_->CreateSegment(filename_, size, handler_));
+    }
   }
 
   if (segment_.get() == NULL) {
@@ -236,17 +347,44 @@ bool SharedMemCache<kBlockSize>::InitCache(bool parent) {
     return false;
   }
 
+  char* base = const_cast<char*>(segment_->Base());
+  ImageHeader* image_header =
+      reinterpret_cast<ImageHeader*>(base + sectors_size);
+  ImageHeader expected_header;
+  FillImageHeader(&expected_header);
+  if (reused &&
+      std::memcmp(image_header, &expected_header, sizeof(ImageHeader)) != 0) {
+    ImageHeader stored_header = *image_header;
+    bool intact = (stored_header.magic == kImageMagic) &&
+                  (ImageHeaderChecksum(stored_header) ==
+                   stored_header.checksum);
+    handler_->Message(
+        kWarning, "SharedMemCache: %s %s, starting with an empty cache",
+        file_path.c_str(),
+        intact ? "was written with different settings or version"
+               : "does not hold a valid cache image");
+    reused = false;
+    std::memset(base, 0, size);
+  }
+
   STLDeleteElements(&sectors_);
   sectors_.clear();
+  int64 restored_entries = 0;
   for (int s = 0; s < num_sectors_; ++s) {
     scoped_ptr<Sector<kBlockSize> > sec(
         new Sector<kBlockSize>(segment_.get(), s * sector_size,
                                entries_per_sector_, blocks_per_sector_));
     bool ok;
-    if (parent) {
-      ok = sec->Initialize(handler_);
-    } else {
+    if (!parent) {
       ok = sec->Attach(handler_);
+    } else if (reused) {
+      int restored = RecoverSector(sec.get(), s * sector_size, sector_size);
+      ok = (restored >= 0);
+      if (ok) {
+        restored_entries += restored;
+      }
+    } else {
+      ok = sec->Initialize(handler_);
     }
 
     if (!ok) {
@@ -259,23 +397,111 @@ bool SharedMemCache<kBlockSize>::InitCache(bool parent) {
   }
 
   if (parent) {
+    // Only mark the image valid once the sectors are all set up.
+    *image_header = expected_header;
     handler_->Message(
       kInfo, "SharedMemCache: %s, sectors = %d, entries/sector = %d, "
       " %d-byte blocks/sector = %d, total footprint: %s", filename_.c_str(),
       num_sectors_, entries_per_sector_, static_cast<int>(kBlockSize),
       blocks_per_sector_, FormatSize(size).c_str());
+    if (reused) {
+      handler_->Message(
+          kInfo, "SharedMemCache: %s, restored %s entries from %s",
+          filename_.c_str(), Integer64ToString(restored_entries).c_str(),
+          file_path.c_str());
+    }
   }
   return true;
 }
 
+template<size_t kBlockSize>
+void SharedMemCache<kBlockSize>::FillImageHeader(ImageHeader* header) {
+  std::memset(header, 0, sizeof(*header));
+  header->magic = kImageMagic;
+  header->version = kImageVersion;
+  header->block_size = kBlockSize;
+  header->num_sectors = num_sectors_;
+  header->entries_per_sector = entries_per_sector_;
+  header->blocks_per_sector = blocks_per_sector_;
+  header->associativity = associativity_;
+  header->raw_hash_size = hasher_->RawHashSizeInBytes();
+  header->mutex_size = shm_runtime_->SharedMutexSize();
+  header->entry_size = sizeof(CacheEntry);
+  header->checksum = ImageHeaderChecksum(*header);
+}
+
+template<size_t kBlockSize>
+int SharedMemCache<kBlockSize>::RecoverSector(Sector<kBlockSize>* sector,
+                                              size_t sector_offset,
+                                              size_t sector_size) {
+  if (!sector->Recover(handler_)) {
+    handler_->Message(
+        kWarning, "SharedMemCache: %s, discarding damaged sector at %s",
+        filename_.c_str(), FormatSize(sector_offset).c_str());
+    std::memset(const_cast<char*>(segment_->Base()) + sector_offset, 0,
+                sector_size);
+    return sector->Initialize(handler_) ? 0 : -1;
+  }
+
+  // Entries that were in the middle of being written may have incomplete
+  // payloads, so drop them. The image may also have been copied from a live
+  // cache (see PthreadSharedMem::CreateFileBackedSegment), catching an entry
+  // and its blocks at different moments, so drop entries whose payload
+  // doesn't match their checksum too.
+  int mismatched = 0;
+  sector->mutex()->Lock();
+  for (EntryNum e = 0; e < entries_per_sector_; ++e) {
+    CacheEntry* entry = sector->EntryAt(e);
+    if (IsAllNil(StringPiece(entry->hash_bytes, kHashSize))) {
+      continue;
+    }
+    BlockVector blocks;
+    sector->BlockListForEntry(entry, &blocks);
+    bool drop = entry->creating;
+    if (!drop) {
+      uint32 checksum = ExtendEntryChecksum(kEntryChecksumBasis,
+                                            entry->hash_bytes, kHashSize);
+      for (size_t b = 0; b < blocks.size(); ++b) {
+        checksum = ExtendEntryChecksum(
+            checksum, sector->BlockBytes(blocks[b]),
+            sector->BytesInPortion(entry->byte_size, b, blocks.size()));
+      }
+      if (checksum != entry->checksum) {
+        drop = true;
+        ++mismatched;
+      }
+    }
+    if (drop) {
+      sector->ReturnBlocksToFreeList(blocks);
+      entry->creating = false;
+      MarkEntryFree(sector, e);
+    }
+  }
+  int restored = static_cast<int>(sector->sector_stats()->used_entries);
+  sector->mutex()->Unlock();
+  if (mismatched > 0) {
+    handler_->Message(
+        kWarning, "SharedMemCache: %s, dropped %d entries with bad checksums "
+        "from sector at %s", filename_.c_str(), mismatched,
+        FormatSize(sector_offset).c_str());
+  }
+  return restored;
+}
+
 template<size_t kBlockSize>
 bool SharedMemCache<kBlockSize>::Initialize() {
-  return InitCache(true);
+  return InitCache(true, "");
+}
+
+template<size_t kBlockSize>
+bool SharedMemCache<kBlockSize>::InitializeFromFile(
+    const GoogleString& file_path) {
+  return InitCache(true, file_path);
 }
 
 template<size_t kBlockSize>
 bool SharedMemCache<kBlockSize>::Attach() {
-  return InitCache(false);
+  return InitCache(false, "");
 }
 
 template<size_t kBlockSize>
@@ -294,8 +520,9 @@ void SharedMemCache<kBlockSize>::ComputeDimensions(
     int* blocks_per_sector_out,
     int64* size_cap_out) {
   int64 size = size_kb * 1024;
-  const int kEntrySize = sizeof(CacheEntry);
-  // Footprint of an entry is kEntrySize bytes. Block is kBlockSize + 4
+  const int kEntrySize = sizeof(CacheEntry) + kSketchRows;
+  // Footprint of an entry is kEntrySize bytes, including its share of the
+  // frequency sketch. Block is kBlockSize + 4
   // bytes for successor list. We ignore sector headers for the math since
   // negligible. So:
   //
@@ -382,7 +609,8 @@ void SharedMemCache<kBlockSize>::RestoreSnapshot(
     }
 
     SharedString value(entry.value());
-    PutRawHash(entry.raw_key(), entry.last_use_timestamp_ms(), &value);
+    PutRawHash(entry.raw_key().data(), entry.last_use_timestamp_ms(),
+               &value);
   }
 }
 
@@ -406,13 +634,14 @@ template<size_t kBlockSize>
 void SharedMemCache<kBlockSize>::Put(const GoogleString& key,
                                      SharedString* value) {
   int64 now_ms = timer_->NowMs();
-  GoogleString raw_hash = ToRawHash(key);
+  char raw_hash[kHashSize];
+  ToRawHash(key, raw_hash);
   PutRawHash(raw_hash, now_ms, value);
 }
 
 template<size_t kBlockSize>
 void SharedMemCache<kBlockSize>::PutRawHash(
-    const GoogleString& raw_hash,
+    const char* raw_hash,
     int64 last_use_timestamp_ms,
     SharedString* value) {
   // See also ::ComputeDimensions
@@ -440,14 +669,17 @@ void SharedMemCache<kBlockSize>::PutRawHash(
   // but not if there is another writer, in which case we just give up.
   // It is important, however, that we always exit if the key matches,
   // so we don't end up creating a second copy!
-  for (int p = 0; p < kAssociativity; ++p) {
+  for (int p = 0; p < pos.num_keys; ++p) {
     EntryNum cand_key = pos.keys[p];
     CacheEntry* cand = sector->EntryAt(cand_key);
     if (KeyMatch(cand, raw_hash)) {
       if (!cand->creating) {
         ++stats->num_put_update;
-        EnsureReadyForWriting(sector, cand);
-        PutIntoEntry(sector, cand_key, last_use_timestamp_ms, value);
+        if (EnsureReadyForWriting(sector, cand_key, kMaxPutWaitUs)) {
+          PutIntoEntry(sector, cand_key, last_use_timestamp_ms, value);
+        } else {
+          sector->mutex()->Unlock();
+        }
       } else {
         ++stats->num_put_concurrent_create;
         sector->mutex()->Unlock();
@@ -461,12 +693,11 @@ void SharedMemCache<kBlockSize>::PutRawHash(
   // readers, as it's unclear that they are any less important than us.
   EntryNum best_key = kInvalidEntry;
   CacheEntry* best = NULL;
-  for (int p = 0; p < kAssociativity; ++p) {
+  for (int p = 0; p < pos.num_keys; ++p) {
     EntryNum cand_key = pos.keys[p];
     CacheEntry* cand = sector->EntryAt(cand_key);
     if (Writeable(cand)) {
-      if ((best_key == kInvalidEntry) ||
-          (cand->last_use_timestamp_ms < best->last_use_timestamp_ms)) {
+      if ((best_key == kInvalidEntry) || BetterVictim(cand, best)) {
         best = cand;
         best_key = cand_key;
       }
@@ -482,12 +713,37 @@ void SharedMemCache<kBlockSize>::PutRawHash(
 
   if (best->byte_size != 0 ||
       !IsAllNil(StringPiece(best->hash_bytes, kHashSize))) {
+    if ((eviction_policy_ == kEvictLeastFrequentlyUsed) &&
+        (sector->EstimateAccesses(raw_hash) <
+         sector->EstimateAccesses(best->hash_bytes))) {
+      // TinyLFU admission: keep the entry, as it's more popular.
+      ++stats->num_put_rejected;
+      sector->mutex()->Unlock();
+      return;
+    }
     ++stats->num_put_replace;
+    if (stats->used_entries < entries_per_sector_) {
+      ++stats->num_put_conflict;
+    }
+
+    if (eviction_policy_ == kEvictLeastFrequentlyUsed) {
+      // Age the survivors, so that hits long past count for less.
+      for (int p = 0; p < pos.num_keys; ++p) {
+        CacheEntry* cand = sector->EntryAt(pos.keys[p]);
+        if (cand != best) {
+          cand->hit_count /= 2;
+        }
+      }
+    }
   }
 
   // Wait for readers before touching the key.
-  EnsureReadyForWriting(sector, best);
-  std::memcpy(best->hash_bytes, raw_hash.data(), kHashSize);
+  if (!EnsureReadyForWriting(sector, best_key, kMaxPutWaitUs)) {
+    sector->mutex()->Unlock();
+    return;
+  }
+  std::memcpy(best->hash_bytes, raw_hash, kHashSize);
+  best->hit_count = 0;
   PutIntoEntry(sector, best_key, last_use_timestamp_ms, value);
 }
 
@@ -553,9 +809,13 @@ void SharedMemCache<kBlockSize>::PutIntoEntry(
     size_t bytes = sector->BytesInPortion(entry->byte_size, b, want_blocks);
     std::memcpy(sector->BlockBytes(blocks[b]), data + b * kBlockSize, bytes);
   }
+  uint32 checksum = ExtendEntryChecksum(
+      ExtendEntryChecksum(kEntryChecksumBasis, entry->hash_bytes, kHashSize),
+      data, value->size());
 
   // We're done, clear creating bit.
   sector->mutex()->Lock();
+  entry->checksum = checksum;
   entry->creating = false;
   sector->mutex()->Unlock();
 }
@@ -563,82 +823,198 @@ void SharedMemCache<kBlockSize>::PutIntoEntry(
 template<size_t kBlockSize>
 void SharedMemCache<kBlockSize>::Get(const GoogleString& key,
                                      Callback* callback) {
-  GoogleString raw_hash = ToRawHash(key);
+  char raw_hash[kHashSize];
+  ToRawHash(key, raw_hash);
+  int64 now_ms = timer_->NowMs();
+  SharedString* out = callback->value();
+  PinnedValue value;
+  if (!LookUp(raw_hash, now_ms, out, &value)) {
+    ValidateAndReportResult(key, kNotFound, callback);
+    return;
+  }
+
+  if (value.pinned()) {
+    // Collect the contents.
+    out->DetachAndClear();
+    out->Extend(value.size());
+    int pos = 0;
+    for (int i = 0; i < value.num_pieces(); ++i) {
+      StringPiece piece = value.piece(i);
+      out->WriteAt(pos, piece.data(), piece.size());
+      pos += piece.size();
+    }
+
+    // Now reduce the reference count. This takes the sector lock again, as
+    // open_count is only ever touched under it.
+    value.Release();
+  }
+  ValidateAndReportResult(key, kAvailable, callback);
+}
+
+template<size_t kBlockSize>
+bool SharedMemCache<kBlockSize>::GetPinned(const GoogleString& key,
+                                           PinnedValue* value) {
+  value->Release();
+  char raw_hash[kHashSize];
+  ToRawHash(key, raw_hash);
+  return LookUp(raw_hash, timer_->NowMs(), NULL, value);
+}
+
+template<size_t kBlockSize>
+bool SharedMemCache<kBlockSize>::LookUp(const char* raw_hash,
+                                        int64 last_use_timestamp_ms,
+                                        SharedString* small_value,
+                                        PinnedValue* value) {
+  DCHECK(!value->pinned());
   Position pos;
   ExtractPosition(raw_hash, &pos);
   Sector<kBlockSize>* sector = sectors_[pos.sector];
   sector->mutex()->Lock();
   SectorStats* stats = sector->sector_stats();
   ++stats->num_get;
+  if (eviction_policy_ == kEvictLeastFrequentlyUsed) {
+    sector->RecordAccess(raw_hash);
+  }
 
-  for (int p = 0; p < kAssociativity; ++p) {
+  for (int p = 0; p < pos.num_keys; ++p) {
     EntryNum cand_key = pos.keys[p];
     CacheEntry* cand = sector->EntryAt(cand_key);
     if (KeyMatch(cand, raw_hash)) {
       ++stats->num_get_hit;
-      GetFromEntry(key, sector, cand_key, callback);
-      return;
+      if (cand->creating) {
+        // For now, consider concurrent creation a miss.
+        break;
+      }
+      TouchEntryForHit(sector, last_use_timestamp_ms, cand_key);
+      if ((small_value != NULL) &&
+          (static_cast<size_t>(cand->byte_size) <= kBlockSize)) {
+        // At most one block, so copy it out right away rather than opening
+        // the entry and having to re-take the lock to close it again.
+        small_value->DetachAndClear();
+        if (cand->byte_size != 0) {
+          small_value->Append(sector->BlockBytes(cand->first_block),
+                              cand->byte_size);
+        }
+        sector->mutex()->Unlock();
+      } else {
+        // Drops the lock as the entry is now opened for reading.
+        PinEntry(sector, cand_key, value);
+      }
+      return true;
     }
   }
 
   sector->mutex()->Unlock();
-  ValidateAndReportResult(key, kNotFound, callback);
+  return false;
 }
 
 template<size_t kBlockSize>
-void SharedMemCache<kBlockSize>::GetFromEntry(
-    const GoogleString& key,
-    Sector<kBlockSize>* sector,
-    EntryNum entry_num,
-    Callback* callback) {
+void SharedMemCache<kBlockSize>::PinEntry(Sector<kBlockSize>* sector,
+                                          EntryNum entry_num,
+                                          PinnedValue* value) {
   CacheEntry* entry = sector->EntryAt(entry_num);
-  if (entry->creating) {
-    // For now, consider concurrent creation a miss.
-    sector->mutex()->Unlock();
-    ValidateAndReportResult(key, kNotFound, callback);
-    return;
-  }
+  DCHECK(!entry->creating);
   ++entry->open_count;
 
-  TouchEntry(sector, timer_->NowMs(), entry_num);
+  value->cache_ = this;
+  value->sector_ = sector;
+  value->entry_num_ = entry_num;
+  value->size_ = entry->byte_size;
+  for (BlockNum block = entry->first_block; block != kInvalidBlock;
+       block = sector->GetBlockSuccessor(block)) {
+    value->AddBlock(sector->BlockBytes(block));
+  }
+  sector->mutex()->Unlock();
+}
 
-  BlockVector blocks;
-  sector->BlockListForEntry(entry, &blocks);
+template<size_t kBlockSize>
+SharedMemCache<kBlockSize>::PinnedValue::PinnedValue()
+    : cache_(NULL),
+      sector_(NULL),
+      entry_num_(kInvalidEntry),
+      size_(0),
+      num_pieces_(0) {
+}
 
-  // Drop the lock as the entry is now opened for reading.
-  sector->mutex()->Unlock();
+template<size_t kBlockSize>
+SharedMemCache<kBlockSize>::PinnedValue::~PinnedValue() {
+  Release();
+}
 
-  // Collect the contents.
-  SharedString* out = callback->value();
-  out->DetachAndClear();
-  out->Extend(entry->byte_size);
+template<size_t kBlockSize>
+StringPiece SharedMemCache<kBlockSize>::PinnedValue::piece(int i) const {
+  DCHECK_LE(0, i);
+  DCHECK_LT(i, num_pieces_);
+  const char* block = (i < kInlineBlocks) ? inline_blocks_[i]
+                                          : extra_blocks_[i - kInlineBlocks];
+  return StringPiece(block, Sector<kBlockSize>::BytesInPortion(
+      size_, i, num_pieces_));
+}
 
-  size_t total_blocks = blocks.size();
-  int pos = 0;
-  for (size_t b = 0; b < total_blocks; ++b) {
-    int bytes = sector->BytesInPortion(entry->byte_size, b, total_blocks);
-    out->WriteAt(pos, sector->BlockBytes(blocks[b]), bytes);
-    pos += bytes;
+template<size_t kBlockSize>
+void SharedMemCache<kBlockSize>::PinnedValue::AppendTo(
+    GoogleString* out) const {
+  out->reserve(out->size() + size_);
+  for (int i = 0; i < num_pieces_; ++i) {
+    piece(i).AppendToString(out);
   }
+}
 
-  // Now reduce the reference count.
-  // TODO(morlovich): atomic ops?
+template<size_t kBlockSize>
+void SharedMemCache<kBlockSize>::PinnedValue::Release() {
+  if (sector_ == NULL) {
+    return;
+  }
+  cache_->UnpinEntry(sector_, entry_num_);
+
+  cache_ = NULL;
+  sector_ = NULL;
+  entry_num_ = kInvalidEntry;
+  size_ = 0;
+  num_pieces_ = 0;
+  extra_blocks_.clear();
+}
+
+template<size_t kBlockSize>
+void SharedMemCache<kBlockSize>::UnpinEntry(Sector<kBlockSize>* sector,
+                                            EntryNum entry_num) {
   sector->mutex()->Lock();
+  CacheEntry* entry = sector->EntryAt(entry_num);
+  DCHECK_LT(0u, entry->open_count);
   --entry->open_count;
+  if ((entry->open_count == 0) && !entry->creating &&
+      IsAllNil(StringPiece(entry->hash_bytes, kHashSize))) {
+    // A Delete removed the entry while we had it pinned, and left it to us.
+    // (If a Put is waiting on it instead, EnsureReadyForWriting frees it.)
+    BlockVector blocks;
+    sector->BlockListForEntry(entry, &blocks);
+    sector->ReturnBlocksToFreeList(blocks);
+    MarkEntryFree(sector, entry_num);
+  }
   sector->mutex()->Unlock();
-  ValidateAndReportResult(key, kAvailable, callback);
+}
+
+template<size_t kBlockSize>
+void SharedMemCache<kBlockSize>::PinnedValue::AddBlock(const char* block) {
+  if (num_pieces_ < kInlineBlocks) {
+    inline_blocks_[num_pieces_] = block;
+  } else {
+    extra_blocks_.push_back(block);
+  }
+  ++num_pieces_;
 }
 
 template<size_t kBlockSize>
 void SharedMemCache<kBlockSize>::Delete(const GoogleString& key) {
-  GoogleString raw_hash = ToRawHash(key);
+  char raw_hash[kHashSize];
+  ToRawHash(key, raw_hash);
   Position pos;
   ExtractPosition(raw_hash, &pos);
 
   Sector<kBlockSize>* sector = sectors_[pos.sector];
   sector->mutex()->Lock();
 
-  for (int p = 0; p < kAssociativity; ++p) {
+  for (int p = 0; p < pos.num_keys; ++p) {
     EntryNum cand_key = pos.keys[p];
     if (KeyMatch(sector->EntryAt(cand_key), raw_hash)) {
       DeleteEntry(sector, cand_key);
@@ -653,7 +1029,29 @@ template<size_t kBlockSize>
 void SharedMemCache<kBlockSize>::DeleteEntry(Sector<kBlockSize>* sector,
                                              EntryNum entry_num) {
   CacheEntry* entry = sector->EntryAt(entry_num);
-  EnsureReadyForWriting(sector, entry);
+  if (entry->creating) {
+    if (entry->open_count > 0) {
+      // A Put is waiting for the entry's readers, and may yet give up and
+      // leave the old value in place. Clearing the hash makes the key a miss
+      // either way; EnsureReadyForWriting notices it and frees the entry, or
+      // hands it to its last reader.
+      std::memset(entry->hash_bytes, 0, kHashSize);
+    }
+    // Otherwise another writer is filling in the entry's blocks without the
+    // lock, so they must not be freed under it. Its Put of the key is as
+    // good as ordered after this Delete.
+    sector->mutex()->Unlock();
+    return;
+  }
+  if (!EnsureReadyForWriting(sector, entry_num, kMaxDeleteWaitUs)) {
+    // Someone has the value pinned. Make the key a miss right away, and take
+    // the entry off the LRU so nothing evicts, snapshots or reuses it; the
+    // last reader frees it in UnpinEntry.
+    std::memset(entry->hash_bytes, 0, kHashSize);
+    sector->UnlinkEntryFromLRU(entry_num);
+    sector->mutex()->Unlock();
+    return;
+  }
   BlockVector blocks;
   sector->BlockListForEntry(entry, &blocks);
   sector->ReturnBlocksToFreeList(blocks);
@@ -731,6 +1129,8 @@ void SharedMemCache<kBlockSize>::MarkEntryFree(Sector<kBlockSize>* sector,
   entry->last_use_timestamp_ms = 0;
   entry->byte_size = 0;
   entry->first_block = kInvalidBlock;
+  entry->hit_count = 0;
+  entry->checksum = 0;
 }
 
 template<size_t kBlockSize>
@@ -743,6 +1143,27 @@ void SharedMemCache<kBlockSize>::TouchEntry(Sector<kBlockSize>* sector,
   entry->last_use_timestamp_ms = last_use_timestamp_ms;
 }
 
+template<size_t kBlockSize>
+void SharedMemCache<kBlockSize>::TouchEntryForHit(
+    Sector<kBlockSize>* sector, int64 last_use_timestamp_ms,
+    EntryNum entry_num) {
+  TouchEntry(sector, last_use_timestamp_ms, entry_num);
+  CacheEntry* entry = sector->EntryAt(entry_num);
+  if (entry->hit_count < kMaxHitCount) {
+    ++entry->hit_count;
+  }
+}
+
+template<size_t kBlockSize>
+bool SharedMemCache<kBlockSize>::BetterVictim(const CacheEntry* a,
+                                              const CacheEntry* b) const {
+  if ((eviction_policy_ == kEvictLeastFrequentlyUsed) &&
+      (a->hit_count != b->hit_count)) {
+    return a->hit_count < b->hit_count;
+  }
+  return a->last_use_timestamp_ms < b->last_use_timestamp_ms;
+}
+
 template<size_t kBlockSize>
 bool SharedMemCache<kBlockSize>::Writeable(const CacheEntry* entry) {
   return (entry->open_count == 0) && !entry->creating;
@@ -750,63 +1171,87 @@ bool SharedMemCache<kBlockSize>::Writeable(const CacheEntry* entry) {
 
 template<size_t kBlockSize>
 bool SharedMemCache<kBlockSize>::KeyMatch(CacheEntry* entry,
-                                          const GoogleString& raw_hash) {
-  DCHECK_EQ(kHashSize, raw_hash.size());
-  return 0 == std::memcmp(entry->hash_bytes, raw_hash.data(), kHashSize);
+                                          const char* raw_hash) {
+  return 0 == std::memcmp(entry->hash_bytes, raw_hash, kHashSize);
 }
 
 template<size_t kBlockSize>
-GoogleString SharedMemCache<kBlockSize>::ToRawHash(const GoogleString& key) {
-  GoogleString raw_hash = hasher_->RawHash(key);
-  DCHECK(raw_hash.size() >= kHashSize);
-  if (raw_hash.size() > kHashSize) {
-    raw_hash.resize(kHashSize);
-  }
+void SharedMemCache<kBlockSize>::ToRawHash(const GoogleString& key,
+                                           char* raw_hash) {
+  DCHECK_GE(static_cast<size_t>(hasher_->RawHashSizeInBytes()), kHashSize);
+  hasher_->RawHashInto(key, raw_hash, kHashSize);
 
   // Avoid all 0x00, that's special
-  if (IsAllNil(raw_hash)) {
+  if (IsAllNil(StringPiece(raw_hash, kHashSize))) {
     raw_hash[0] = ' ';
   }
-  return raw_hash;
 }
 
 template<size_t kBlockSize>
 void SharedMemCache<kBlockSize>::ExtractPosition(
-    const GoogleString& raw_hash,
+    const char* raw_hash,
     SharedMemCache<kBlockSize>::Position* out_pos) {
   // We need at least 13 bytes of hash in code below, as we split it as follows:
   // keys[0] from hash[0..3]
   // keys[1] from hash[4..7]
   // keys[2] from hash[8..11]
   // sector number (hash[12])
-  DCHECK_GE(raw_hash.length(), 13u);
-
-  // Should also be consistent with out config
-  DCHECK_EQ(raw_hash.length(), kHashSize);
+  COMPILE_ASSERT(kHashSize == 16, hash_is_four_words);
 
-  // This implementation only supports associativity 4, so it will need to be
-  // readjusted if we decide to use an another setting.
-  COMPILE_ASSERT(kAssociativity == 4, need_different_code_for_other_assoc);
+  // The code below always fills in at least 4 positions.
+  COMPILE_ASSERT(kMaxAssociativity >= 4, need_room_for_4_positions);
 
   // Get the sector # from the [12]th byte, being careful not to sign-extend;
   // we have to watch out for negatives for %
   int raw_sector = static_cast<int>(static_cast<unsigned char>(raw_hash[12]));
   out_pos->sector = (raw_sector % sectors_.size());
 
-  const uint32* keys = reinterpret_cast<const uint32*>(raw_hash.data());
-  out_pos->keys[0] = static_cast<EntryNum>(keys[0] % entries_per_sector_);
-  out_pos->keys[1] = static_cast<EntryNum>(keys[1] % entries_per_sector_);
-  out_pos->keys[2] = static_cast<EntryNum>(keys[2] % entries_per_sector_);
+  EntryNum cands[kMaxAssociativity];
+  // raw_hash is usually a char array on the caller's stack, so may not be
+  // aligned for reading words directly.
+  uint32 keys[4];
+  std::memcpy(keys, raw_hash, sizeof(keys));
+  cands[0] = static_cast<EntryNum>(keys[0] % entries_per_sector_);
+  cands[1] = static_cast<EntryNum>(keys[1] % entries_per_sector_);
+  cands[2] = static_cast<EntryNum>(keys[2] % entries_per_sector_);
 
   // For entry 3, we potentially already used lower bits of key[3] word for
   // sector, so instead use higher-bits from keys[0] as lower ones.
   uint32 key3 = (keys[0] >> 16) | (keys[1] << 16);
-  out_pos->keys[3] = static_cast<EntryNum>(key3 % entries_per_sector_);
+  cands[3] = static_cast<EntryNum>(key3 % entries_per_sector_);
+
+  // Any further positions are picked by double hashing with the two 64-bit
+  // halves of the hash. Making the step odd keeps it from sharing a factor
+  // of 2 with a power-of-2 number of entries.
+  if (associativity_ > 4) {
+    uint64 base = keys[0] | (static_cast<uint64>(keys[1]) << 32);
+    uint64 step = keys[2] | (static_cast<uint64>(keys[3]) << 32) | 1;
+    for (int p = 4; p < associativity_; ++p) {
+      cands[p] = static_cast<EntryNum>(
+          (base + p * step) % static_cast<uint64>(entries_per_sector_));
+    }
+  }
+
+  // The candidates above can repeat, e.g. when the step shares a factor with
+  // entries_per_sector_. Probe past repeats so that every entry of the set
+  // is distinct; Put would otherwise age or count one entry twice.
+  int num_keys = 0;
+  for (int p = 0; p < associativity_ && num_keys < entries_per_sector_; ++p) {
+    EntryNum cand = cands[p];
+    while (std::find(out_pos->keys, out_pos->keys + num_keys, cand) !=
+           out_pos->keys + num_keys) {
+      cand = (cand + 1) % entries_per_sector_;
+    }
+    out_pos->keys[num_keys] = cand;
+    ++num_keys;
+  }
+  out_pos->num_keys = num_keys;
 }
 
 template<size_t kBlockSize>
-void SharedMemCache<kBlockSize>::EnsureReadyForWriting(
-    Sector<kBlockSize>* sector, CacheEntry* entry) {
+bool SharedMemCache<kBlockSize>::EnsureReadyForWriting(
+    Sector<kBlockSize>* sector, EntryNum entry_num, int64 max_wait_us) {
+  CacheEntry* entry = sector->EntryAt(entry_num);
   // It is possible that as we are starting to write, some other processes
   // are still in the middle of copying in read data for this entry, so we have
   // to make sure they finish up first.
@@ -818,12 +1263,43 @@ void SharedMemCache<kBlockSize>::EnsureReadyForWriting(
   entry->creating = true;
 
   // Now just wait for previous readers to leave.
+  int64 waited_us = 0;
+  bool timed_out = false;
   while (entry->open_count > 0) {
+    if ((max_wait_us >= 0) && (waited_us >= max_wait_us)) {
+      // Someone is holding on to the value; let them have it.
+      timed_out = true;
+      ++sector->sector_stats()->num_put_wait_timeouts;
+      break;
+    }
     ++sector->sector_stats()->num_put_spins;
     sector->mutex()->Unlock();
-    timer_->SleepUs(50);
+    timer_->SleepUs(kWriterSpinUs);
+    waited_us += kWriterSpinUs;
     sector->mutex()->Lock();
   }
+
+  // A Delete that came while we waited cleared the hash (see DeleteEntry).
+  // It must stick, so our write is dropped and the entry goes away: now if
+  // the readers are gone, or else by the hand of the last of them, with the
+  // entry off the LRU in the meantime, just as if the Delete had timed out.
+  if ((waited_us > 0) && IsAllNil(StringPiece(entry->hash_bytes, kHashSize))) {
+    entry->creating = false;
+    if (entry->open_count == 0) {
+      BlockVector blocks;
+      sector->BlockListForEntry(entry, &blocks);
+      sector->ReturnBlocksToFreeList(blocks);
+      MarkEntryFree(sector, entry_num);
+    } else {
+      sector->UnlinkEntryFromLRU(entry_num);
+    }
+    return false;
+  }
+  if (timed_out) {
+    entry->creating = false;
+    return false;
+  }
+  return true;
 }
 
 template class SharedMemCache<64>;  // metadata ("rname") cache
@@ -26,6 +26,7 @@
 #include "pagespeed/kernel/base/cache_interface.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_annotations.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_cache_data.h"
 
@@ -36,6 +37,7 @@ class AbstractSharedMemSegment;
 class Hasher;
 class MessageHandler;
 class SharedMemCacheDump;
+class SharedMemCacheTestBase;
 class SharedString;
 class Timer;
 
@@ -43,8 +45,24 @@ class Timer;
 template<size_t kBlockSize>
 class SharedMemCache : public CacheInterface {
  public:
-  static const int kAssociativity = 4;  // Note: changing this requires changing
-                                        // code of ExtractPosition as well.
+  // Bounds for set_associativity().
+  static const int kDefaultAssociativity = 4;
+  static const int kMaxAssociativity = 16;
+
+  // How Put picks which entry of a key's associativity set to overwrite
+  // when the key isn't already present.
+  enum EvictionPolicy {
+    // Overwrite the entry that was used least recently.
+    kEvictLeastRecentlyUsed,
+
+    // Overwrite the entry with the fewest recent hits, breaking ties by
+    // recency. Every eviction halves the hit counts of the entries left in
+    // the set, so formerly popular entries do age out. On top of that, a
+    // new key is only admitted in place of a live entry if a per-sector
+    // count-min sketch of lookups (TinyLFU) says it's been looked up at
+    // least as often lately; otherwise the Put is dropped.
+    kEvictLeastFrequentlyUsed
+  };
 
   // Initializes the cache's settings, but does not actually touch the shared
   // memory --- you must call Initialize or Attach (and handle them potentially
@@ -64,6 +82,23 @@ class SharedMemCache : public CacheInterface {
   // in the root process, before forking.
   bool Initialize();
 
+  // Like Initialize, but keeps the cache in the file at file_path rather than
+  // in anonymous shared memory, so its contents survive server restarts
+  // without any serialization. If the file holds a cache image written with
+  // the same settings (including associativity and the hasher's size), the
+  // entries in it are checked and reused; otherwise, the file is reset to an
+  // empty cache.
+  //
+  // The file must not be used by any other cache. If it can't be used (e.g.
+  // the shared memory implementation can't map files, or another server has
+  // it locked), this logs a warning and falls back to plain shared memory;
+  // see file_backed().
+  bool InitializeFromFile(const GoogleString& file_path);
+
+  // Whether the parent's Initialize call ended up with a file-backed cache.
+  // Only meaningful in the parent process.
+  bool file_backed() const { return file_backed_; }
+
   // Connects to already initialized state from a child process. It must be
   // called once for every cache in every child process (that is, post-fork).
   // Returns whether successful.
@@ -88,6 +123,19 @@ class SharedMemCache : public CacheInterface {
                                 int* blocks_per_sector_out,
                                 int64* size_cap_out);
 
+  // Sets how many directory entries a key may be stored in; must be between
+  // 1 and kMaxAssociativity. Higher associativity lowers the number of
+  // entries evicted by conflicts while others sit unused, at the cost of
+  // more entries to scan per operation. Must be called before Initialize or
+  // Attach, with the same value in every process.
+  void set_associativity(int associativity);
+  int associativity() const { return associativity_; }
+
+  // Sets the policy Put uses to choose entries to overwrite. The default is
+  // kEvictLeastRecentlyUsed. This must also agree between processes.
+  void set_eviction_policy(EvictionPolicy policy) { eviction_policy_ = policy; }
+  EvictionPolicy eviction_policy() const { return eviction_policy_; }
+
   // Returns the largest size of an object this cache can store.
   size_t MaxValueSize() const {
     return (blocks_per_sector_ * kBlockSize) / 8;
@@ -113,7 +161,10 @@ class SharedMemCache : public CacheInterface {
   static void DemarshalSnapshot(const GoogleString& marshaled,
                                 SharedMemCacheDump* out);
 
+  // Values larger than a block are pinned, and copied into the callback's
+  // value without holding the sector lock; see PinnedValue.
   virtual void Get(const GoogleString& key, Callback* callback);
+
   virtual void Put(const GoogleString& key, SharedString* value);
   virtual void Delete(const GoogleString& key);
   static GoogleString FormatName();
@@ -129,24 +180,109 @@ class SharedMemCache : public CacheInterface {
   void SanityCheck();
 
  private:
+  friend class SharedMemCacheTestBase;
+
+  // A read-only view of a cached value, left in place in the shared memory
+  // blocks that hold it, which Get uses to copy large values out without
+  // holding the sector lock. The value is split into pieces at block
+  // boundaries.
+  //
+  // While a PinnedValue holds an entry, that entry will not be evicted, and
+  // Put and Delete of its key will wait for it to be released, so callers
+  // should consume the value and Release() promptly. A Put gives up after
+  // waiting 100ms. A Delete waits 1ms, then removes the key anyway and leaves
+  // the entry's blocks to be freed by the last PinnedValue to let go of them.
+  // A PinnedValue must be released before the cache it came from is
+  // destroyed. It can be reused for several lookups, one at a time.
+  class PinnedValue {
+   public:
+    PinnedValue();
+    ~PinnedValue();
+
+    bool pinned() const { return sector_ != NULL; }
+
+    // Total size of the value, in bytes.
+    size_t size() const { return size_; }
+
+    int num_pieces() const { return num_pieces_; }
+    StringPiece piece(int i) const;
+
+    // Appends a copy of the entire value to *out.
+    void AppendTo(GoogleString* out) const;
+
+    // Unpins the entry, if any. Called automatically on destruction.
+    void Release();
+
+   private:
+    friend class SharedMemCache<kBlockSize>;
+
+    // Values of up to this many blocks have their block pointers stored
+    // inline, so pinning them doesn't touch the heap.
+    static const int kInlineBlocks = 4;
+
+    void AddBlock(const char* block);
+
+    SharedMemCache<kBlockSize>* cache_;
+    SharedMemCacheData::Sector<kBlockSize>* sector_;
+    SharedMemCacheData::EntryNum entry_num_;
+    size_t size_;
+    int num_pieces_;
+    const char* inline_blocks_[kInlineBlocks];
+    std::vector<const char*> extra_blocks_;
+
+    DISALLOW_COPY_AND_ASSIGN(PinnedValue);
+  };
+
+  // Looks up key like Get, but pins the entry in *value instead of copying
+  // it, whatever its size. Any entry *value previously held is released
+  // first. Tests use this to hold entries pinned the way Get does.
+  bool GetPinned(const GoogleString& key, PinnedValue* value);
+
   // Describes potential placements of a key
   struct Position {
     int sector;
-    SharedMemCacheData::EntryNum keys[kAssociativity];
+    int num_keys;  // distinct entries in keys; associativity_ unless tiny.
+    SharedMemCacheData::EntryNum keys[kMaxAssociativity];
   };
 
-  bool InitCache(bool parent);
+  // file_path may be empty to use anonymous shared memory. Only meaningful
+  // for parent.
+  bool InitCache(bool parent, const GoogleString& file_path);
+
+  // Fills in the image header describing this cache's layout.
+  void FillImageHeader(SharedMemCacheData::ImageHeader* header);
+
+  // Recovers a sector from a reused cache image, returning the number of
+  // entries kept. If the sector is damaged, it's cleared instead.
+  // Returns -1 if the sector couldn't be set up at all.
+  int RecoverSector(SharedMemCacheData::Sector<kBlockSize>* sector,
+                    size_t sector_offset, size_t sector_size);
 
-  void PutRawHash(const GoogleString& raw_hash, int64 last_use_timestamp_ms,
+  // raw_hash points to kHashSize bytes, as do all the raw hashes below.
+  void PutRawHash(const char* raw_hash, int64 last_use_timestamp_ms,
                   SharedString* value);
 
-  // Finish a get, with the entry matching and sector lock held.
-  // Releases lock when done.
-  void GetFromEntry(const GoogleString& key,
-                    SharedMemCacheData::Sector<kBlockSize>* sector,
-                    SharedMemCacheData::EntryNum entry_num, Callback* callback)
+  // Looks up raw_hash, returning whether it was found. On a hit, a value
+  // that fits in one block is copied to *small_value while the sector lock
+  // is held, unless small_value is NULL; any other value is pinned in
+  // *value, which must not be holding an entry.
+  bool LookUp(const char* raw_hash, int64 last_use_timestamp_ms,
+              SharedString* small_value, PinnedValue* value);
+
+  // Opens the entry for reading and points *value at its blocks. The entry
+  // must not be in the process of being written. Lock is expected to be
+  // held at entry, and will be released when done.
+  void PinEntry(SharedMemCacheData::Sector<kBlockSize>* sector,
+                SharedMemCacheData::EntryNum entry_num, PinnedValue* value)
+      EXCLUSIVE_LOCKS_REQUIRED(sector->mutex())
       UNLOCK_FUNCTION(sector->mutex());
 
+  // Undoes PinEntry, freeing the entry if a Delete removed it meanwhile.
+  // Takes and releases the sector lock.
+  void UnpinEntry(SharedMemCacheData::Sector<kBlockSize>* sector,
+                  SharedMemCacheData::EntryNum entry_num)
+      LOCKS_EXCLUDED(sector->mutex());
+
   // Finish a put into the given entry. Lock is expected to be held at entry,
   // will be released when done. The hash in the entry must also be already
   // correct at time of entry.
@@ -156,8 +292,10 @@ class SharedMemCache : public CacheInterface {
       EXCLUSIVE_LOCKS_REQUIRED(sector->mutex())
       UNLOCK_FUNCTION(sector->mutex());
 
-  // Finish a delete, with the entry matching and sector lock held.
-  // Releases lock when done.
+  // Finish a delete, with the entry matching and sector lock held. If the
+  // entry is still pinned after a short wait, it is removed from the
+  // directory and LRU right away but its blocks are left for UnpinEntry to
+  // free. Releases lock when done.
   void DeleteEntry(SharedMemCacheData::Sector<kBlockSize>* sector,
                    SharedMemCacheData::EntryNum entry_num)
       UNLOCK_FUNCTION(sector->mutex());
@@ -182,22 +320,38 @@ class SharedMemCache : public CacheInterface {
                   int64 last_use_timestamp_ms,
                   SharedMemCacheData::EntryNum entry_num);
 
+  // Like TouchEntry, but also counts a hit on the entry.
+  void TouchEntryForHit(SharedMemCacheData::Sector<kBlockSize>* sector,
+                        int64 last_use_timestamp_ms,
+                        SharedMemCacheData::EntryNum entry_num);
+
+  // Returns true if, under the eviction policy, entry a should be
+  // overwritten in preference to entry b.
+  bool BetterVictim(const SharedMemCacheData::CacheEntry* a,
+                    const SharedMemCacheData::CacheEntry* b) const;
+
   // Returns true if the entry can be written (in particular meaning it's not
   // opened by someone else)
   bool Writeable(const SharedMemCacheData::CacheEntry* entry);
 
-  bool KeyMatch(SharedMemCacheData::CacheEntry* entry,
-                const GoogleString& raw_hash);
+  bool KeyMatch(SharedMemCacheData::CacheEntry* entry, const char* raw_hash);
 
-  GoogleString ToRawHash(const GoogleString& key);
+  // Writes the kHashSize byte hash of key to raw_hash; this is done for
+  // every operation, so it doesn't allocate.
+  void ToRawHash(const GoogleString& key, char* raw_hash);
 
   // Given a hash, tells what sector and what entries in it to check.
-  void ExtractPosition(const GoogleString& raw_hash, Position* out_pos);
+  void ExtractPosition(const char* raw_hash, Position* out_pos);
 
   // Makes sure we have exclusive write access to the entry, with no concurrent
-  // readers. Must be called with sector lock held.
-  void EnsureReadyForWriting(SharedMemCacheData::Sector<kBlockSize>* sector,
-                             SharedMemCacheData::CacheEntry* entry)
+  // readers. Must be called with sector lock held, which is still held on
+  // return. If readers are still around after max_wait_us (negative to wait
+  // indefinitely), gives up, leaves the entry as it was and returns false.
+  // Also returns false if the entry was deleted while we waited, in which
+  // case it is freed (or left for its last reader to free).
+  bool EnsureReadyForWriting(SharedMemCacheData::Sector<kBlockSize>* sector,
+                             SharedMemCacheData::EntryNum entry_num,
+                             int64 max_wait_us)
       EXCLUSIVE_LOCKS_REQUIRED(sector->mutex());
 
   AbstractSharedMem* shm_runtime_;
@@ -207,6 +361,9 @@ class SharedMemCache : public CacheInterface {
   int num_sectors_;
   int entries_per_sector_;
   int blocks_per_sector_;
+  int associativity_;
+  EvictionPolicy eviction_policy_;
+  bool file_backed_;
   MessageHandler* handler_;
 
   scoped_ptr<AbstractSharedMemSegment> segment_;
@@ -21,6 +21,10 @@
 
 #include "pagespeed/kernel/sharedmem/shared_mem_cache_data.h"
 
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
 #include "base/logging.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/abstract_shared_mem.h"
@@ -41,6 +45,20 @@ double percent(int64 portion, int64 total) {
   return static_cast<double>(portion) / static_cast<double>(total) * 100.0;
 }
 
+// The frequency sketch has a row of counters for each of kSketchRows hash
+// functions, each row as wide as the directory, but no narrower than
+// kMinSketchWidth, so that tiny sectors still tell keys apart.
+const size_t kMinSketchWidth = 64;
+const unsigned char kMaxSketchCount = 15;
+
+// TinyLFU's sample size: the sketch is halved after this many lookups per
+// directory entry.
+const uint32 kSketchSampleFactor = 10;
+
+size_t SketchWidth(size_t cache_entries) {
+  return std::max(cache_entries, kMinSketchWidth);
+}
+
 }  // namespace
 
 template<size_t kBlockSize>
@@ -49,20 +67,23 @@ struct Sector<kBlockSize>::MemLayout {
     // Check out alignment assumptions -- everything must be of a size
     // that's multiple of 8. The exact sizes don't matter too much, but
     // we check it anyway to avoid surprises.
-    CHECK_EQ(96u, sizeof(SectorHeader));
-    CHECK_EQ(48u, sizeof(CacheEntry));
+    CHECK_EQ(120u, sizeof(SectorHeader));
+    CHECK_EQ(56u, sizeof(CacheEntry));
 
     header_bytes = AlignTo(8, sizeof(SectorHeader) + mutex_size);
     block_successor_list_bytes =
         AlignTo(8, sizeof(BlockNum) * data_blocks);
-    size_t directory_size = sizeof(CacheEntry) * cache_entries;
+    directory_bytes = sizeof(CacheEntry) * cache_entries;
+    sketch_bytes = AlignTo(8, kSketchRows * SketchWidth(cache_entries));
     metadata_bytes =
-        AlignTo(kBlockSize,
-                header_bytes + directory_size + block_successor_list_bytes);
+        AlignTo(kBlockSize, header_bytes + block_successor_list_bytes +
+                                directory_bytes + sketch_bytes);
   }
 
   size_t header_bytes;  // also offset to the block successor list.
   size_t block_successor_list_bytes;
+  size_t directory_bytes;
+  size_t sketch_bytes;
   size_t metadata_bytes;  // e.g. offset to the blocks.
 };
 
@@ -72,6 +93,7 @@ Sector<kBlockSize>::Sector(AbstractSharedMemSegment* segment,
                            size_t data_blocks)
     : cache_entries_(cache_entries),
       data_blocks_(data_blocks),
+      sketch_width_(SketchWidth(cache_entries)),
       segment_(segment),
       sector_offset_(sector_offset) {
   MemLayout layout(segment->SharedMutexSize(), cache_entries, data_blocks);
@@ -80,6 +102,8 @@ Sector<kBlockSize>::Sector(AbstractSharedMemSegment* segment,
   block_successors_ = reinterpret_cast<BlockNum*>(base + layout.header_bytes);
   directory_base_ =
       base + layout.header_bytes + layout.block_successor_list_bytes;
+  sketch_ = reinterpret_cast<unsigned char*>(directory_base_) +
+            layout.directory_bytes;
   blocks_base_ = base + layout.metadata_bytes;
 }
 
@@ -126,6 +150,128 @@ bool Sector<kBlockSize>::Initialize(MessageHandler* handler)
   ReturnBlocksToFreeList(all_blocks);
   sector_header_->stats.used_blocks = 0;
 
+  std::memset(sketch_, 0, kSketchRows * sketch_width_);
+  sector_header_->sketch_additions = 0;
+
+  return true;
+}
+
+template<size_t kBlockSize>
+bool Sector<kBlockSize>::Recover(MessageHandler* handler)
+    NO_THREAD_SAFETY_ANALYSIS {
+  // Any process that held the mutex is gone, so we can just make a new one.
+  if (!segment_->InitializeSharedMutex(sector_offset_ + sizeof(SectorHeader),
+                                       handler)) {
+    return false;
+  }
+
+  if (!Attach(handler)) {
+    return false;
+  }
+
+  // Check that every block is on exactly one of the entries' chains or the
+  // freelist, and that the entries' sizes agree with their chains.
+  std::vector<bool> block_seen(data_blocks_, false);
+  size_t used_blocks = 0;
+  for (size_t c = 0; c < cache_entries_; ++c) {
+    CacheEntry* entry = EntryAt(c);
+    entry->open_count = 0;
+    size_t length;
+    if (entry->byte_size < 0 ||
+        !ClaimBlockChain(entry->first_block, &block_seen, &length) ||
+        length != DataBlocksForSize(entry->byte_size)) {
+      return false;
+    }
+    used_blocks += length;
+  }
+
+  size_t free_blocks;
+  if (!ClaimBlockChain(sector_header_->free_list_front, &block_seen,
+                       &free_blocks) ||
+      (used_blocks + free_blocks != data_blocks_)) {
+    return false;
+  }
+
+  // Walk the LRU, checking that it's well-linked.
+  std::vector<bool> in_lru(cache_entries_, false);
+  size_t used_entries = 0;
+  EntryNum prev = kInvalidEntry;
+  for (EntryNum e = sector_header_->lru_list_front; e != kInvalidEntry;
+       e = EntryAt(e)->lru_next) {
+    if (e < 0 || e >= static_cast<EntryNum>(cache_entries_) || in_lru[e] ||
+        EntryAt(e)->lru_prev != prev) {
+      return false;
+    }
+    in_lru[e] = true;
+    prev = e;
+    ++used_entries;
+  }
+  if (sector_header_->lru_list_rear != prev) {
+    return false;
+  }
+
+  // Entries outside the LRU must be free ones, with all-0 keys and no links.
+  // A Delete that finds an entry open clears its key and leaves its blocks
+  // to the last reader (see SharedMemCache::DeleteEntry), so a free entry
+  // may still hold blocks if that reader went away with the previous server
+  // generation; free them now. If a Put was waiting for those readers, the
+  // entry is also still on the LRU, marked as creating.
+  for (size_t c = 0; c < cache_entries_; ++c) {
+    CacheEntry* entry = EntryAt(c);
+    bool free = true;
+    for (size_t i = 0; i < kHashSize; ++i) {
+      if (entry->hash_bytes[i] != '\0') {
+        free = false;
+        break;
+      }
+    }
+    if (!free) {
+      if (!in_lru[c]) {
+        return false;
+      }
+      continue;
+    }
+    if (in_lru[c]) {
+      if (!entry->creating) {
+        return false;
+      }
+      UnlinkEntryFromLRU(c);
+      --used_entries;
+    } else if (entry->lru_prev != kInvalidEntry ||
+               entry->lru_next != kInvalidEntry) {
+      return false;
+    }
+    if (entry->first_block != kInvalidBlock) {
+      BlockVector blocks;
+      BlockListForEntry(entry, &blocks);
+      ReturnBlocksToFreeList(blocks);
+      used_blocks -= blocks.size();
+    }
+    entry->creating = false;
+    entry->last_use_timestamp_ms = 0;
+    entry->byte_size = 0;
+    entry->first_block = kInvalidBlock;
+    entry->hit_count = 0;
+    entry->checksum = 0;
+  }
+
+  sector_header_->stats.used_entries = used_entries;
+  sector_header_->stats.used_blocks = used_blocks;
+  return true;
+}
+
+template<size_t kBlockSize>
+bool Sector<kBlockSize>::ClaimBlockChain(BlockNum first,
+                                         std::vector<bool>* seen,
+                                         size_t* length) {
+  *length = 0;
+  for (BlockNum b = first; b != kInvalidBlock; b = block_successors_[b]) {
+    if (b < 0 || b >= static_cast<BlockNum>(data_blocks_) || (*seen)[b]) {
+      return false;
+    }
+    (*seen)[b] = true;
+    ++*length;
+  }
   return true;
 }
 
@@ -214,6 +360,56 @@ void Sector<kBlockSize>::UnlinkEntryFromLRU(int entry_num) {
   entry->lru_next = kInvalidEntry;
 }
 
+template<size_t kBlockSize>
+void Sector<kBlockSize>::SketchSlots(const char* raw_hash,
+                                     size_t* slots) const {
+  for (int r = 0; r < kSketchRows; ++r) {
+    // Each row mixes half of the hash with its own seed through the
+    // MurmurHash3 finalizer, so that the rows are independent of each other
+    // and of the directory positions, which come from the same hash.
+    uint64 x;
+    std::memcpy(&x, raw_hash + (r % 2) * sizeof(x), sizeof(x));
+    x += (r + 1) * 0x9e3779b97f4a7c15ULL;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    slots[r] = r * sketch_width_ + x % sketch_width_;
+  }
+}
+
+template<size_t kBlockSize>
+void Sector<kBlockSize>::RecordAccess(const char* raw_hash) {
+  size_t slots[kSketchRows];
+  SketchSlots(raw_hash, slots);
+  for (int r = 0; r < kSketchRows; ++r) {
+    if (sketch_[slots[r]] < kMaxSketchCount) {
+      ++sketch_[slots[r]];
+    }
+  }
+
+  ++sector_header_->sketch_additions;
+  if (sector_header_->sketch_additions >=
+      kSketchSampleFactor * cache_entries_) {
+    for (size_t i = 0; i < kSketchRows * sketch_width_; ++i) {
+      sketch_[i] /= 2;
+    }
+    sector_header_->sketch_additions /= 2;
+  }
+}
+
+template<size_t kBlockSize>
+int Sector<kBlockSize>::EstimateAccesses(const char* raw_hash) {
+  size_t slots[kSketchRows];
+  SketchSlots(raw_hash, slots);
+  int estimate = kMaxSketchCount;
+  for (int r = 0; r < kSketchRows; ++r) {
+    estimate = std::min(estimate, static_cast<int>(sketch_[slots[r]]));
+  }
+  return estimate;
+}
+
 template<size_t kBlockSize>
 size_t Sector<kBlockSize>::BytesInPortion(size_t total_bytes, size_t b,
                                           size_t total) {
@@ -246,9 +442,12 @@ SectorStats::SectorStats()
     : num_put(0),
       num_put_update(0),
       num_put_replace(0),
+      num_put_conflict(0),
+      num_put_rejected(0),
       num_put_concurrent_create(0),
       num_put_concurrent_full_set(0),
       num_put_spins(0),
+      num_put_wait_timeouts(0),
       num_get(0),
       num_get_hit(0),
       used_entries(0),
@@ -259,9 +458,12 @@ void SectorStats::Add(const SectorStats& other) {
   num_put += other.num_put;
   num_put_update += other.num_put_update;
   num_put_replace += other.num_put_replace;
+  num_put_conflict += other.num_put_conflict;
+  num_put_rejected += other.num_put_rejected;
   num_put_concurrent_create += other.num_put_concurrent_create;
   num_put_concurrent_full_set += other.num_put_concurrent_full_set;
   num_put_spins += other.num_put_spins;
+  num_put_wait_timeouts += other.num_put_wait_timeouts;
   num_get += other.num_get;
   num_get_hit += other.num_get_hit;
   used_entries += other.used_entries;
@@ -277,6 +479,11 @@ GoogleString SectorStats::Dump(size_t total_entries,
                 Integer64ToString(num_put_update).c_str());
   StringAppendF(&out, "  replace/conflict miss: %s\n",
                 Integer64ToString(num_put_replace).c_str());
+  StringAppendF(&out, "    with unused entries left (conflict): %s (%.2f%%)\n",
+                Integer64ToString(num_put_conflict).c_str(),
+                percent(num_put_conflict, num_put));
+  StringAppendF(&out, "  new key not admitted (less frequent): %s\n",
+                Integer64ToString(num_put_rejected).c_str());
   StringAppendF(
       &out, "  simultaneous same-key insert: %s\n",
       Integer64ToString(num_put_concurrent_create).c_str());
@@ -286,6 +493,9 @@ GoogleString SectorStats::Dump(size_t total_entries,
   StringAppendF(
       &out, "  spinning sleeps performed by writers: %s\n",
       Integer64ToString(num_put_spins).c_str());
+  StringAppendF(
+      &out, "  dropped after waiting too long for readers: %s\n",
+      Integer64ToString(num_put_wait_timeouts).c_str());
 
   StringAppendF(&out, "Total get operations: %s\n",
                 Integer64ToString(num_get).c_str());
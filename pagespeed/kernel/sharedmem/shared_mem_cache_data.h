@@ -48,6 +48,10 @@ const BlockNum kInvalidBlock = -1;
 const EntryNum kInvalidEntry = -1;
 const size_t kHashSize = 16;
 
+// Number of rows in each sector's frequency sketch; see
+// Sector::RecordAccess.
+const int kSketchRows = 4;
+
 struct SectorStats {
   SectorStats();
 
@@ -61,9 +65,17 @@ struct SectorStats {
   int64 num_put;
   int64 num_put_update;  // update of the same key
   int64 num_put_replace;  // replacement of different key
+  // Replacements of a different key made while the sector had unused
+  // entries, so the old key was lost only because its associativity set
+  // was full. These are the evictions higher associativity would avoid.
+  int64 num_put_conflict;
+  // Puts of a new key that kEvictLeastFrequentlyUsed turned away, since the
+  // entry they would have replaced was looked up more often.
+  int64 num_put_rejected;
   int64 num_put_concurrent_create;
   int64 num_put_concurrent_full_set;
   int64 num_put_spins;  // # of times writers had to sleep behind readers
+  int64 num_put_wait_timeouts;  // # of puts dropped waiting on readers
   int64 num_get;    // # of calls to get
   int64 num_get_hit;
 
@@ -82,7 +94,9 @@ struct SectorHeader {
   BlockNum free_list_front;
   EntryNum lru_list_front;
   EntryNum lru_list_rear;
-  int32 padding;
+
+  // Lookups counted by the frequency sketch since it was last halved.
+  uint32 sketch_additions;
 
   SectorStats stats;
 
@@ -108,7 +122,36 @@ struct CacheEntry {
   // Number of readers currently accessing the data.
   uint32 open_count : 31;
 
-  uint32 padding;  // ensures we're 8-aligned.
+  // Number of hits on this entry, saturating, and halved when a neighbor
+  // in its associativity set is evicted. Used for kEvictLeastFrequentlyUsed.
+  uint32 hit_count;
+
+  // Checksum of hash_bytes and the payload, written along with the payload.
+  // Recovering a file-backed cache image drops entries whose blocks don't
+  // match it, e.g. because the image was copied while they were rewritten.
+  uint32 checksum;
+  int32 padding;
+};
+
+// Stored after the last sector, this identifies the layout of the cache
+// in a segment, so that a file-backed cache can tell whether a file left
+// behind by a previous run is something it can pick up.
+struct ImageHeader {
+  uint64 magic;
+  uint32 version;
+  uint32 block_size;
+  uint32 num_sectors;
+  uint32 entries_per_sector;
+  uint32 blocks_per_sector;
+  uint32 associativity;
+  uint32 raw_hash_size;
+  uint32 mutex_size;
+  uint32 entry_size;
+  uint32 padding;
+
+  // Checksum of all the fields above, so that a damaged header can be told
+  // apart from one written with different settings.
+  uint64 checksum;
 };
 
 // Helper for operating on a given sector's data structures; helping
@@ -145,6 +188,21 @@ class Sector {
   // mutexes. Returns true on success.
   bool Initialize(MessageHandler* handler);
 
+  // This can be called from the parent process instead of Initialize() when
+  // the sector's memory still holds the contents left by a previous run
+  // (which must not be in use any more). It re-creates the mutex, clears
+  // reader counts, and checks that the block chains, freelist and LRU are
+  // intact, with every block owned exactly once and exactly the entries with
+  // non-zero keys on the LRU. Entries that were deleted while open, and so
+  // still hold blocks under an all-0 key, are freed. Recomputes used_entries
+  // and used_blocks.
+  //
+  // Entries that were being written are left marked as creating for the
+  // caller to deal with. Returns false if the sector is damaged (or its
+  // mutex couldn't be created), in which case the caller should clear it
+  // and Initialize() it instead.
+  bool Recover(MessageHandler* handler);
+
   // Computes how much memory a sector will need for given number of entries.
   // Also makes sure it's padded to proper alignment.
   static size_t RequiredSize(AbstractSharedMem* shmem_runtime,
@@ -250,6 +308,19 @@ class Sector {
   int BlockListForEntry(CacheEntry* entry, BlockVector* out_blocks)
       EXCLUSIVE_LOCKS_REQUIRED(mutex());
 
+  // Frequency sketch ops.
+  // ------------------------------------------------------------
+
+  // Counts a lookup of the key with the given raw hash in the sector's
+  // count-min sketch. Counters saturate at 15, and once the sketch has
+  // counted 10 lookups per entry, all its counters are halved, so that it
+  // reflects recent popularity.
+  void RecordAccess(const char* raw_hash) EXCLUSIVE_LOCKS_REQUIRED(mutex());
+
+  // Estimates how many times the key was looked up recently. Collisions
+  // with other keys can make the estimate higher, never lower.
+  int EstimateAccesses(const char* raw_hash) EXCLUSIVE_LOCKS_REQUIRED(mutex());
+
   // Statistics stuff
   // ------------------------------------------------------------
 
@@ -263,6 +334,15 @@ class Sector {
   // Helper for doing sizing/memory layout computations.
   struct MemLayout;
 
+  // Marks the blocks on the chain starting at first in *seen, and sets
+  // *length to their number. Returns false if the chain leaves the sector
+  // or runs into a block that's already marked.
+  bool ClaimBlockChain(BlockNum first, std::vector<bool>* seen,
+                       size_t* length) EXCLUSIVE_LOCKS_REQUIRED(mutex());
+
+  // Sets slots[r] to the index of the sketch counter for raw_hash in row r.
+  void SketchSlots(const char* raw_hash, size_t* slots) const;
+
   // How many piece_size pieces suffice to fit total
   static size_t NeededPieces(size_t total, size_t piece_size) {
     return (total + piece_size - 1) / piece_size;
@@ -271,6 +351,7 @@ class Sector {
   // Configured geometry
   size_t cache_entries_;
   size_t data_blocks_;
+  size_t sketch_width_;  // counters per row of the frequency sketch
 
   // Pointers to where various things are, and our sizes
   AbstractSharedMemSegment* segment_;
@@ -278,6 +359,7 @@ class Sector {
   SectorHeader* sector_header_;
   BlockNum* block_successors_ PT_GUARDED_BY(mutex());
   char* directory_base_;
+  unsigned char* sketch_ PT_GUARDED_BY(mutex());
   char* blocks_base_;
   size_t sector_offset_;  // offset of the sector within the SHM segment
 
@@ -17,6 +17,7 @@
 #include "pagespeed/kernel/sharedmem/shared_mem_cache_data_test_base.h"
 
 #include <cstddef>                     // for size_t
+#include <cstring>
 #include <set>
 
 #include "pagespeed/kernel/base/abstract_mutex.h"
@@ -32,6 +33,8 @@ using SharedMemCacheData::BlockVector;
 using SharedMemCacheData::CacheEntry;
 using SharedMemCacheData::EntryNum;
 using SharedMemCacheData::Sector;
+using SharedMemCacheData::kHashSize;
+using SharedMemCacheData::kInvalidBlock;
 using SharedMemCacheData::kInvalidEntry;
 
 namespace {
@@ -293,6 +296,111 @@ void SharedMemCacheDataTestBase::TestBlockLists() NO_THREAD_SAFETY_ANALYSIS {
   ParentCleanup();
 }
 
+void SharedMemCacheDataTestBase::TestRecover() NO_THREAD_SAFETY_ANALYSIS {
+  AbstractSharedMemSegment* seg_raw_ptr = NULL;
+  Sector<kBlockSize>* sector_raw_ptr = NULL;
+  ASSERT_TRUE(ParentInit(&seg_raw_ptr, &sector_raw_ptr));
+  scoped_ptr<AbstractSharedMemSegment> seg(seg_raw_ptr);
+  scoped_ptr<Sector<kBlockSize> > sector(sector_raw_ptr);
+
+  // Entry 0 is a live entry, with 2 blocks and a reader.
+  BlockVector blocks;
+  ASSERT_EQ(2, sector->AllocBlocksFromFreeList(2, &blocks));
+  sector->LinkBlockSuccessors(blocks);
+  CacheEntry* live = sector->EntryAt(0);
+  live->hash_bytes[0] = 'a';
+  live->byte_size = 2 * kBlockSize;
+  live->first_block = blocks[0];
+  live->open_count = 1;
+  sector->InsertEntryIntoLRU(0);
+
+  // Entry 1 was deleted while pinned: its key is cleared and it's off the
+  // LRU, but it still has its 3 blocks, for its reader to free.
+  blocks.clear();
+  ASSERT_EQ(3, sector->AllocBlocksFromFreeList(3, &blocks));
+  sector->LinkBlockSuccessors(blocks);
+  CacheEntry* pinned = sector->EntryAt(1);
+  pinned->byte_size = 3 * kBlockSize;
+  pinned->first_block = blocks[0];
+  pinned->open_count = 1;
+
+  // Entry 2 was deleted while a Put waited for its reader: its key is
+  // cleared, but it's still on the LRU, with its block.
+  blocks.clear();
+  ASSERT_EQ(1, sector->AllocBlocksFromFreeList(1, &blocks));
+  sector->LinkBlockSuccessors(blocks);
+  CacheEntry* waited = sector->EntryAt(2);
+  waited->byte_size = 1;
+  waited->first_block = blocks[0];
+  waited->open_count = 1;
+  waited->creating = true;
+  sector->InsertEntryIntoLRU(2);
+
+  // Recovery keeps the live entry, and frees the other two.
+  ASSERT_TRUE(sector->Recover(&handler_));
+  EXPECT_EQ(1, sector->sector_stats()->used_entries);
+  EXPECT_EQ(2, sector->sector_stats()->used_blocks);
+  std::vector<EntryNum> lru;
+  ExtractAndSanityCheckLRU(sector.get(), &lru);
+  ASSERT_EQ(1u, lru.size());
+  EXPECT_EQ(0, lru[0]);
+  EXPECT_EQ(0u, live->open_count);
+  blocks.clear();
+  EXPECT_EQ(2, sector->BlockListForEntry(live, &blocks));
+
+  EXPECT_EQ(0u, pinned->open_count);
+  EXPECT_EQ(kInvalidBlock, pinned->first_block);
+  EXPECT_EQ(0, pinned->byte_size);
+  EXPECT_EQ(0u, waited->open_count);
+  EXPECT_FALSE(waited->creating);
+  EXPECT_EQ(kInvalidBlock, waited->first_block);
+
+  blocks.clear();
+  EXPECT_EQ(kBlocks - 2, sector->AllocBlocksFromFreeList(kBlocks, &blocks));
+  SanityCheckBlockVector(blocks, 0, kBlocks - 1);
+
+  ParentCleanup();
+}
+
+void SharedMemCacheDataTestBase::TestFrequencySketch()
+    NO_THREAD_SAFETY_ANALYSIS {
+  AbstractSharedMemSegment* seg_raw_ptr = NULL;
+  Sector<kBlockSize>* sector_raw_ptr = NULL;
+  ASSERT_TRUE(ParentInit(&seg_raw_ptr, &sector_raw_ptr));
+  scoped_ptr<AbstractSharedMemSegment> seg(seg_raw_ptr);
+  scoped_ptr<Sector<kBlockSize> > sector(sector_raw_ptr);
+
+  char hot[kHashSize];
+  char cold[kHashSize];
+  std::memset(hot, 'h', kHashSize);
+  std::memset(cold, 'c', kHashSize);
+  EXPECT_EQ(0, sector->EstimateAccesses(hot));
+
+  for (int i = 0; i < 5; ++i) {
+    sector->RecordAccess(hot);
+  }
+  EXPECT_EQ(5, sector->EstimateAccesses(hot));
+  EXPECT_EQ(0, sector->EstimateAccesses(cold));
+
+  // Counts saturate at 15.
+  for (int i = 0; i < 20; ++i) {
+    sector->RecordAccess(hot);
+  }
+  EXPECT_EQ(15, sector->EstimateAccesses(hot));
+
+  // After 10 lookups per entry, all counts are halved.
+  const int kSample = 10 * kEntries;
+  for (int i = 25; i < kSample - 1; ++i) {
+    sector->RecordAccess(cold);
+  }
+  EXPECT_EQ(15, sector->EstimateAccesses(hot));
+  sector->RecordAccess(cold);
+  EXPECT_EQ(7, sector->EstimateAccesses(hot));
+  EXPECT_EQ(7, sector->EstimateAccesses(cold));
+
+  ParentCleanup();
+}
+
 bool SharedMemCacheDataTestBase::ParentInit(AbstractSharedMemSegment** out_seg,
                                             Sector<kBlockSize>** out_sector) {
   size_t bytes =
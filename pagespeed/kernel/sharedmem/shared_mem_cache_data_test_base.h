@@ -42,6 +42,8 @@ class SharedMemCacheDataTestBase : public testing::Test {
   void TestFreeList();
   void TestLRU();
   void TestBlockLists();
+  void TestRecover();
+  void TestFrequencySketch();
 
  private:
   bool CreateChild(TestMethod method);
@@ -93,8 +95,17 @@ TYPED_TEST_P(SharedMemCacheDataTestTemplate, TestBlockLists) {
   SharedMemCacheDataTestBase::TestBlockLists();
 }
 
+TYPED_TEST_P(SharedMemCacheDataTestTemplate, TestRecover) {
+  SharedMemCacheDataTestBase::TestRecover();
+}
+
+TYPED_TEST_P(SharedMemCacheDataTestTemplate, TestFrequencySketch) {
+  SharedMemCacheDataTestBase::TestFrequencySketch();
+}
+
 REGISTER_TYPED_TEST_CASE_P(SharedMemCacheDataTestTemplate, TestFreeList,
-                           TestLRU, TestBlockLists);
+                           TestLRU, TestBlockLists, TestRecover,
+                           TestFrequencySketch);
 
 }  // namespace net_instaweb
 
@@ -16,8 +16,10 @@
 
 #include "pagespeed/kernel/sharedmem/shared_mem_cache_test_base.h"
 
+#include <sys/stat.h>
 #include <unistd.h>
 #include <cstddef>                     // for size_t
+#include <cstdio>
 #include <map>
 #include <utility>
 
@@ -25,6 +27,7 @@
 #include "pagespeed/kernel/base/shared_string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/cache/cache_interface.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_cache.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_cache_snapshot.pb.h"
@@ -36,6 +39,7 @@ namespace {
 
 const char kSegment[] = "cache";
 const char kAltSegment[] = "alt_cache";
+const char kOtherSegment[] = "other_cache";
 const int kSectors = 2;
 const int kSectorBlocks = 2000;
 const int kSectorEntries = 256;
@@ -242,7 +246,7 @@ void SharedMemCacheTestBase::TestReaderWriterChild() {
 }
 
 void SharedMemCacheTestBase::TestConflict() {
-  const int kAssociativity = SharedMemCache<kBlockSize>::kAssociativity;
+  const int kAssociativity = SharedMemCache<kBlockSize>::kDefaultAssociativity;
 
   // We create a cache with 1 sector, and kAssociativity entries, since it
   // makes it easy to get a conflict and replacement.
@@ -268,6 +272,118 @@ void SharedMemCacheTestBase::TestConflict() {
   small_cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
 }
 
+void SharedMemCacheTestBase::TestHighAssociativity() {
+  // With 16 ways into a 16-entry sector, repeated positions are probed past,
+  // so every key can go into every entry and all 16 keys must find unused
+  // ones.
+  const int kWays = SharedMemCache<kBlockSize>::kMaxAssociativity;
+  scoped_ptr<SharedMemCache<kBlockSize> > small_cache(
+      new SharedMemCache<kBlockSize>(shmem_runtime_.get(), kAltSegment, &timer_,
+                                     &hasher_, 1 /* sectors*/,
+                                     kWays /* entries / sector */,
+                                     kSectorBlocks, &handler_));
+  small_cache->set_associativity(kWays);
+  EXPECT_EQ(kWays, small_cache->associativity());
+  ASSERT_TRUE(small_cache->Initialize());
+
+  // Advance the time so live entries are never as old as unused ones.
+  for (int c = 0; c < kWays; ++c) {
+    timer_.AdvanceMs(1);
+    GoogleString key = IntegerToString(c);
+    CheckPut(small_cache.get(), key, key);
+  }
+  for (int c = 0; c < kWays; ++c) {
+    GoogleString key = IntegerToString(c);
+    CheckGet(small_cache.get(), key, key);
+  }
+  EXPECT_NE(GoogleString::npos,
+            small_cache->DumpStats().find("(conflict): 0 ("));
+  small_cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
+}
+
+void SharedMemCacheTestBase::TestEvictionPolicy() {
+  TestEvictionPolicyHelper(SharedMemCache<kBlockSize>::kEvictLeastRecentlyUsed,
+                           "frequent");
+  TestEvictionPolicyHelper(
+      SharedMemCache<kBlockSize>::kEvictLeastFrequentlyUsed, "recent");
+}
+
+void SharedMemCacheTestBase::TestEvictionPolicyHelper(
+    SharedMemCache<kBlockSize>::EvictionPolicy policy,
+    const char* expected_victim) {
+  // With 2 entries and more than 2 ways, every key may use either of them,
+  // and each is a candidate only once.
+  scoped_ptr<SharedMemCache<kBlockSize> > small_cache(
+      new SharedMemCache<kBlockSize>(shmem_runtime_.get(), kAltSegment, &timer_,
+                                     &hasher_, 1 /* sectors*/,
+                                     2 /* entries / sector */,
+                                     kSectorBlocks, &handler_));
+  small_cache->set_associativity(8);
+  small_cache->set_eviction_policy(policy);
+  EXPECT_EQ(policy, small_cache->eviction_policy());
+  ASSERT_TRUE(small_cache->Initialize());
+
+  timer_.AdvanceMs(1);
+  CheckPut(small_cache.get(), "frequent", "f");
+  timer_.AdvanceMs(1);
+  CheckPut(small_cache.get(), "recent", "r");
+
+  // "frequent" gets more hits, but "recent" gets the most recent one.
+  for (int i = 0; i < 3; ++i) {
+    timer_.AdvanceMs(1);
+    CheckGet(small_cache.get(), "frequent", "f");
+  }
+  timer_.AdvanceMs(1);
+  CheckGet(small_cache.get(), "recent", "r");
+
+  // "new" is looked up before it's put, as callers do, so that LFU's
+  // admission check sees it as popular as "recent".
+  timer_.AdvanceMs(1);
+  CheckNotFound(small_cache.get(), "new");
+  CheckPut(small_cache.get(), "new", "n");
+  CheckGet(small_cache.get(), "new", "n");
+  CheckNotFound(small_cache.get(), expected_victim);
+  small_cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
+}
+
+void SharedMemCacheTestBase::TestAdmission() {
+  // With LFU, a new key only replaces a live entry once it has been looked
+  // up at least as often as that entry.
+  scoped_ptr<SharedMemCache<kBlockSize> > small_cache(
+      new SharedMemCache<kBlockSize>(shmem_runtime_.get(), kAltSegment, &timer_,
+                                     &hasher_, 1 /* sectors*/,
+                                     2 /* entries / sector */,
+                                     kSectorBlocks, &handler_));
+  small_cache->set_associativity(8);
+  small_cache->set_eviction_policy(
+      SharedMemCache<kBlockSize>::kEvictLeastFrequentlyUsed);
+  ASSERT_TRUE(small_cache->Initialize());
+
+  timer_.AdvanceMs(1);
+  CheckPut(small_cache.get(), "a", "1");
+  timer_.AdvanceMs(1);
+  CheckPut(small_cache.get(), "b", "2");
+  for (int i = 0; i < 2; ++i) {
+    CheckGet(small_cache.get(), "a", "1");
+    CheckGet(small_cache.get(), "b", "2");
+  }
+
+  // Never looked up, so not admitted.
+  CheckPut(small_cache.get(), "cold", "3");
+  CheckNotFound(small_cache.get(), "cold");
+  CheckGet(small_cache.get(), "a", "1");
+  CheckGet(small_cache.get(), "b", "2");
+  EXPECT_NE(GoogleString::npos,
+            small_cache->DumpStats().find("(less frequent): 1\n"));
+
+  // Once it's been asked for as often as the others, it gets in.
+  CheckNotFound(small_cache.get(), "cold");
+  CheckNotFound(small_cache.get(), "cold");
+  CheckPut(small_cache.get(), "cold", "3");
+  CheckGet(small_cache.get(), "cold", "3");
+  small_cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
+}
+
 void SharedMemCacheTestBase::TestEvict() {
   // We create a cache with 1 sector as it makes it easier to reason
   // about how much room is left.
@@ -376,6 +492,260 @@ void SharedMemCacheTestBase::TestSnapshot() {
   }
 }
 
+void SharedMemCacheTestBase::TestPinned() {
+  typedef SharedMemCache<kBlockSize>::PinnedValue PinnedValue;
+  PinnedValue value;
+  EXPECT_FALSE(cache_->GetPinned("404", &value));
+  EXPECT_FALSE(value.pinned());
+
+  CheckPut("empty", "");
+  CheckPinned("empty", "");
+  CheckPut("200", "OK");
+  CheckPinned("200", "OK");
+  CheckPut("big", large_);
+  CheckPinned("big", large_);
+
+  // gigantic_ takes more blocks than a PinnedValue stores inline.
+  CheckPut("gigantic", gigantic_);
+  CheckPinned("gigantic", gigantic_);
+
+  // Pieces are split at block boundaries.
+  ASSERT_TRUE(cache_->GetPinned("big", &value));
+  ASSERT_EQ(3, value.num_pieces());
+  EXPECT_EQ(static_cast<size_t>(kBlockSize), value.piece(0).size());
+  EXPECT_EQ(static_cast<size_t>(kBlockSize), value.piece(1).size());
+  EXPECT_EQ(static_cast<size_t>(43), value.piece(2).size());
+
+  // A Put to a pinned key doesn't wait forever: after 100ms it gives up
+  // and leaves the old value in place.
+  int64 start_us = timer_.NowUs();
+  CheckPut("big", "not yet");
+  EXPECT_EQ(100 * Timer::kMsUs, timer_.NowUs() - start_us);
+  EXPECT_EQ(large_, value.piece(0).as_string() + value.piece(1).as_string() +
+                    value.piece(2).as_string());
+
+  // A pinned entry is still readable through the regular interface, and
+  // a PinnedValue can be reused, which releases the previous entry.
+  CheckGet("big", large_);
+  ASSERT_TRUE(cache_->GetPinned("200", &value));
+  EXPECT_EQ(static_cast<size_t>(2), value.size());
+  value.Release();
+  EXPECT_FALSE(value.pinned());
+
+  // Once released, entries can be rewritten and deleted again; this would
+  // spin forever if either pin above had leaked.
+  CheckPut("big", "small now");
+  CheckPinned("big", "small now");
+  CheckDelete("200");
+  EXPECT_FALSE(cache_->GetPinned("200", &value));
+
+  // A Delete of a pinned key waits only 1ms, after which the key is a miss
+  // while the pinned value stays readable; its blocks are freed (and
+  // checked for leaks by SanityCheck) once it's released.
+  CheckPut("big", large_);
+  ASSERT_TRUE(cache_->GetPinned("big", &value));
+  start_us = timer_.NowUs();
+  CheckDelete("big");
+  EXPECT_EQ(Timer::kMsUs, timer_.NowUs() - start_us);
+  CheckNotFound("big");
+  GoogleString contents;
+  value.AppendTo(&contents);
+  EXPECT_EQ(large_, contents);
+  CheckPut("big", "again");
+  CheckGet("big", "again");
+  value.Release();
+  SanityCheck();
+  CheckGet("big", "again");
+
+  // A Delete that comes while a Put waits for the pinned value's readers
+  // sticks, even though the Put then times out and leaves the entry alone.
+  ASSERT_TRUE(cache_->GetPinned("big", &value));
+  timer_.set_sleep_hook(
+      MakeFunction(this, &SharedMemCacheTestBase::CheckDelete, "big"));
+  CheckPut("big", "too late");
+  CheckNotFound("big");
+  contents.clear();
+  value.AppendTo(&contents);
+  EXPECT_EQ("again", contents);
+  value.Release();
+  SanityCheck();
+  CheckNotFound("big");
+}
+
+void SharedMemCacheTestBase::TestFileBacked() {
+  // The temp dir may not have been made yet.
+  mkdir(GTestTempDir().c_str(), 0755);
+  GoogleString path = StrCat(GTestTempDir(), "/shm_cache_image_",
+                             IntegerToString(getpid()));
+  unlink(path.c_str());
+
+  const int kAssociativity = SharedMemCache<kBlockSize>::kDefaultAssociativity;
+  scoped_ptr<SharedMemCache<kBlockSize> > file_cache(
+      MakeFileBackedCache(path, kAssociativity));
+  ASSERT_TRUE(file_cache.get() != NULL);
+  if (!file_cache->file_backed()) {
+    // Not all shared memory implementations can map files; they should still
+    // give us a working cache, though.
+    CheckPut(file_cache.get(), "a", "1");
+    CheckGet(file_cache.get(), "a", "1");
+    file_cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
+    return;
+  }
+  CheckPut(file_cache.get(), "a", "1");
+  CheckPut(file_cache.get(), "big", large_);
+  CheckPut(file_cache.get(), "gone", "2");
+  file_cache->Delete("gone");
+
+  // While the file is in use, another cache can't pick it up, and falls
+  // back to plain shared memory.
+  scoped_ptr<SharedMemCache<kBlockSize> > other_cache(
+      new SharedMemCache<kBlockSize>(shmem_runtime_.get(), kOtherSegment,
+                                     &timer_, &hasher_, 1 /* sectors*/,
+                                     kSectorEntries, kSectorBlocks, &handler_));
+  EXPECT_TRUE(other_cache->InitializeFromFile(path));
+  EXPECT_FALSE(other_cache->file_backed());
+  CheckNotFound(other_cache.get(), "a");
+  other_cache->GlobalCleanup(shmem_runtime_.get(), kOtherSegment, &handler_);
+
+  // Restart: the contents should all be there.
+  file_cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
+  file_cache.reset(MakeFileBackedCache(path, kAssociativity));
+  EXPECT_TRUE(file_cache->file_backed());
+  file_cache->SanityCheck();
+  CheckGet(file_cache.get(), "a", "1");
+  CheckGet(file_cache.get(), "big", large_);
+  CheckNotFound(file_cache.get(), "gone");
+  CheckPut(file_cache.get(), "b", "3");
+  CheckGet(file_cache.get(), "b", "3");
+
+  // Change a payload behind the cache's back, as a copy of the image made
+  // while a child of the old generation rewrote the entry might. The entry's
+  // checksum no longer matches, so only it is dropped.
+  const char kOldPayload[] = "payload before";
+  const char kNewPayload[] = "payload after!";
+  CheckPut(file_cache.get(), "torn", kOldPayload);
+  file_cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
+  FILE* file = fopen(path.c_str(), "r+b");
+  ASSERT_TRUE(file != NULL);
+  GoogleString image;
+  char buf[4096];
+  for (size_t got; (got = fread(buf, 1, sizeof(buf), file)) > 0; ) {
+    image.append(buf, got);
+  }
+  size_t payload_pos = image.find(kOldPayload);
+  ASSERT_NE(GoogleString::npos, payload_pos);
+  ASSERT_EQ(0, fseek(file, payload_pos, SEEK_SET));
+  EXPECT_EQ(1u, fwrite(kNewPayload, STATIC_STRLEN(kNewPayload), 1, file));
+  fclose(file);
+  file_cache.reset(MakeFileBackedCache(path, kAssociativity));
+  EXPECT_TRUE(file_cache->file_backed());
+  file_cache->SanityCheck();
+  CheckNotFound(file_cache.get(), "torn");
+  CheckGet(file_cache.get(), "b", "3");
+
+  // A cache that would place keys differently can't reuse the image.
+  file_cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
+  file_cache.reset(MakeFileBackedCache(path, 8));
+  EXPECT_TRUE(file_cache->file_backed());
+  CheckNotFound(file_cache.get(), "a");
+  CheckNotFound(file_cache.get(), "b");
+  CheckPut(file_cache.get(), "c", "4");
+  file_cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
+
+  // Damage the sector's freelist pointer. The sector should be discarded,
+  // but the cache still usable.
+  file = fopen(path.c_str(), "r+b");
+  ASSERT_TRUE(file != NULL);
+  int32 bad_block = kSectorBlocks + 1;
+  EXPECT_EQ(1u, fwrite(&bad_block, sizeof(bad_block), 1, file));
+  fclose(file);
+  file_cache.reset(MakeFileBackedCache(path, 8));
+  EXPECT_TRUE(file_cache->file_backed());
+  CheckNotFound(file_cache.get(), "c");
+  CheckPut(file_cache.get(), "c", "5");
+  CheckGet(file_cache.get(), "c", "5");
+  file_cache->SanityCheck();
+  file_cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
+  unlink(path.c_str());
+}
+
+void SharedMemCacheTestBase::TestFileBackedRestart() {
+  mkdir(GTestTempDir().c_str(), 0755);
+  GoogleString path = StrCat(GTestTempDir(), "/shm_cache_restart_",
+                             IntegerToString(getpid()));
+  unlink(path.c_str());
+
+  const int kAssociativity = SharedMemCache<kBlockSize>::kDefaultAssociativity;
+  scoped_ptr<SharedMemCache<kBlockSize> > file_cache(
+      MakeFileBackedCache(path, kAssociativity));
+  if (!file_cache->file_backed()) {
+    file_cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
+    return;
+  }
+  CheckPut(file_cache.get(), "a", "1");
+
+  ASSERT_EQ(0, pipe(to_parent_));
+  ASSERT_EQ(0, pipe(to_child_));
+  ASSERT_TRUE(CreateChild(&SharedMemCacheTestBase::TestFileBackedRestartChild));
+  char c;
+  ASSERT_EQ(1, read(to_parent_[0], &c, 1));  // Child attached.
+
+  // A graceful restart, with a child of the old generation still running:
+  // the new one still picks up the contents.
+  file_cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
+  file_cache.reset(MakeFileBackedCache(path, kAssociativity));
+  EXPECT_TRUE(file_cache->file_backed());
+  file_cache->SanityCheck();
+  CheckGet(file_cache.get(), "a", "1");
+  CheckPut(file_cache.get(), "b", "2");
+
+  ASSERT_EQ(1, write(to_child_[1], "g", 1));
+  test_env_->WaitForChildren();
+  for (int i = 0; i < 2; ++i) {
+    close(to_parent_[i]);
+    close(to_child_[i]);
+  }
+  file_cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
+  unlink(path.c_str());
+}
+
+void SharedMemCacheTestBase::TestFileBackedRestartChild() {
+  scoped_ptr<SharedMemCache<kBlockSize> > child_cache(
+      new SharedMemCache<kBlockSize>(shmem_runtime_.get(), kAltSegment, &timer_,
+                                     &hasher_, 1 /* sectors*/, kSectorEntries,
+                                     kSectorBlocks, &handler_));
+  // Stay around, attached, until the parent has restarted. (When the child
+  // is a thread, the mapping it attached to is gone by then.)
+  char c;
+  if (!child_cache->Attach() || (write(to_parent_[1], "a", 1) != 1) ||
+      (read(to_child_[0], &c, 1) != 1)) {
+    test_env_->ChildFailed();
+  }
+}
+
+SharedMemCache<SharedMemCacheTestBase::kBlockSize>*
+SharedMemCacheTestBase::MakeFileBackedCache(const GoogleString& path,
+                                            int associativity) {
+  SharedMemCache<kBlockSize>* cache =
+      new SharedMemCache<kBlockSize>(shmem_runtime_.get(), kAltSegment, &timer_,
+                                     &hasher_, 1 /* sectors*/, kSectorEntries,
+                                     kSectorBlocks, &handler_);
+  cache->set_associativity(associativity);
+  EXPECT_TRUE(cache->InitializeFromFile(path));
+  return cache;
+}
+
+void SharedMemCacheTestBase::CheckPinned(const GoogleString& key,
+                                         const GoogleString& expected) {
+  SharedMemCache<kBlockSize>::PinnedValue value;
+  ASSERT_TRUE(cache_->GetPinned(key, &value)) << key;
+  EXPECT_TRUE(value.pinned());
+  EXPECT_EQ(expected.size(), value.size());
+  GoogleString contents;
+  value.AppendTo(&contents);
+  EXPECT_EQ(expected, contents);
+}
+
 void SharedMemCacheTestBase::CheckDelete(const char* key) {
   cache_->Delete(key);
   SanityCheck();
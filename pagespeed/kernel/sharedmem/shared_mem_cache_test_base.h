@@ -19,6 +19,7 @@
 
 #include "pagespeed/kernel/base/abstract_shared_mem.h"
 #include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/gtest.h"
 #include "pagespeed/kernel/base/md5_hasher.h"
 #include "pagespeed/kernel/base/mock_message_handler.h"
@@ -51,8 +52,14 @@ class SharedMemCacheTestBase : public CacheTestBase {
   void TestReplacement();
   void TestReaderWriter();
   void TestConflict();
+  void TestHighAssociativity();
+  void TestEvictionPolicy();
+  void TestAdmission();
   void TestEvict();
   void TestSnapshot();
+  void TestPinned();
+  void TestFileBacked();
+  void TestFileBackedRestart();
 
   void ResetCache();
 
@@ -63,9 +70,42 @@ class SharedMemCacheTestBase : public CacheTestBase {
                        const SharedMemCacheDump& b,
                        const char* test_label);
 
+  // A MockTimer that runs a function the next time something sleeps on it,
+  // which lets a test act while a writer waits for an entry's readers.
+  class SleepHookTimer : public MockTimer {
+   public:
+    SleepHookTimer(AbstractMutex* mutex, int64 time_us)
+        : MockTimer(mutex, time_us), sleep_hook_(NULL) {}
+    virtual ~SleepHookTimer() { delete sleep_hook_; }
+
+    // Takes ownership of hook.
+    void set_sleep_hook(Function* hook) { sleep_hook_ = hook; }
+
+    virtual void SleepUs(int64 us) {
+      MockTimer::SleepUs(us);
+      Function* hook = sleep_hook_;
+      sleep_hook_ = NULL;
+      if (hook != NULL) {
+        hook->CallRun();
+      }
+    }
+
+   private:
+    Function* sleep_hook_;
+
+    DISALLOW_COPY_AND_ASSIGN(SleepHookTimer);
+  };
+
   SharedMemCache<kBlockSize>* MakeCache();
+  SharedMemCache<kBlockSize>* MakeFileBackedCache(const GoogleString& path,
+                                                  int associativity);
   void CheckDelete(const char* key);
+  void TestEvictionPolicyHelper(
+      SharedMemCache<kBlockSize>::EvictionPolicy policy,
+      const char* expected_victim);
+  void CheckPinned(const GoogleString& key, const GoogleString& expected);
   void TestReaderWriterChild();
+  void TestFileBackedRestartChild();
 
   scoped_ptr<SharedMemTestEnv> test_env_;
   scoped_ptr<AbstractSharedMem> shmem_runtime_;
@@ -73,13 +113,17 @@ class SharedMemCacheTestBase : public CacheTestBase {
   MD5Hasher hasher_;
   scoped_ptr<ThreadSystem> thread_system_;
   MockMessageHandler handler_;
-  MockTimer timer_;
+  SleepHookTimer timer_;
 
   GoogleString large_;
   GoogleString gigantic_;
 
   bool sanity_checks_enabled_;
 
+  // Pipes TestFileBackedRestart uses to step its child.
+  int to_parent_[2];
+  int to_child_[2];
+
   DISALLOW_COPY_AND_ASSIGN(SharedMemCacheTestBase);
 };
 
@@ -113,6 +157,18 @@ TYPED_TEST_P(SharedMemCacheTestTemplate, TestConflict) {
   SharedMemCacheTestBase::TestConflict();
 }
 
+TYPED_TEST_P(SharedMemCacheTestTemplate, TestHighAssociativity) {
+  SharedMemCacheTestBase::TestHighAssociativity();
+}
+
+TYPED_TEST_P(SharedMemCacheTestTemplate, TestEvictionPolicy) {
+  SharedMemCacheTestBase::TestEvictionPolicy();
+}
+
+TYPED_TEST_P(SharedMemCacheTestTemplate, TestAdmission) {
+  SharedMemCacheTestBase::TestAdmission();
+}
+
 TYPED_TEST_P(SharedMemCacheTestTemplate, TestEvict) {
   SharedMemCacheTestBase::TestEvict();
 }
@@ -121,9 +177,23 @@ TYPED_TEST_P(SharedMemCacheTestTemplate, TestSnapshot) {
   SharedMemCacheTestBase::TestSnapshot();
 }
 
+TYPED_TEST_P(SharedMemCacheTestTemplate, TestPinned) {
+  SharedMemCacheTestBase::TestPinned();
+}
+
+TYPED_TEST_P(SharedMemCacheTestTemplate, TestFileBacked) {
+  SharedMemCacheTestBase::TestFileBacked();
+}
+
+TYPED_TEST_P(SharedMemCacheTestTemplate, TestFileBackedRestart) {
+  SharedMemCacheTestBase::TestFileBackedRestart();
+}
+
 REGISTER_TYPED_TEST_CASE_P(SharedMemCacheTestTemplate, TestBasic, TestReinsert,
                            TestReplacement, TestReaderWriter, TestConflict,
-                           TestEvict, TestSnapshot);
+                           TestHighAssociativity, TestEvictionPolicy,
+                           TestAdmission, TestEvict, TestSnapshot, TestPinned,
+                           TestFileBacked, TestFileBackedRestart);
 
 }  // namespace net_instaweb
 
@@ -29,6 +29,7 @@
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/thread/named_lock_wait_queue.h"
 #include "pagespeed/kernel/thread/scheduler.h"
 #include "pagespeed/kernel/thread/scheduler_based_abstract_lock.h"
 
@@ -144,6 +145,7 @@ class SharedMemLock : public SchedulerBasedAbstractLock {
     }
 
     acquisition_time_ = Data::kNotAcquired;
+    manager_->wait_queue_->NotifyUnlocked(name_);
   }
 
   virtual GoogleString name() {
@@ -159,6 +161,10 @@ class SharedMemLock : public SchedulerBasedAbstractLock {
     return manager_->scheduler_;
   }
 
+  virtual NamedLockWaitQueue* wait_queue() const {
+    return manager_->wait_queue_.get();
+  }
+
  private:
   friend class SharedMemLockManager;
 
@@ -282,10 +288,15 @@ SharedMemLockManager::SharedMemLockManager(
       scheduler_(scheduler),
       hasher_(hasher),
       handler_(handler),
-      lock_size_(shm->SharedMutexSize()) {
+      lock_size_(shm->SharedMutexSize()),
+      wait_queue_(new NamedLockWaitQueue(scheduler)) {
   CHECK_GE(hasher_->RawHashSizeInBytes(), 9) << "Need >= 9 byte hashes";
 }
 
+void SharedMemLockManager::SetStatistics(Statistics* statistics) {
+  wait_queue_->SetStatistics(statistics);
+}
+
 SharedMemLockManager::~SharedMemLockManager() {
 }
 
@@ -33,7 +33,9 @@ class AbstractSharedMem;
 class AbstractSharedMemSegment;
 class Hasher;
 class MessageHandler;
+class NamedLockWaitQueue;
 class Scheduler;
+class Statistics;
 
 namespace SharedMemLockData {
 
@@ -42,9 +44,11 @@ struct Bucket;
 }  // namespace SharedMemLockData
 
 // A simple shared memory named locking manager, which uses scheduler alarms
-// (via SchedulerBasedAbstractLock) when it needs to block.
+// (via SchedulerBasedAbstractLock) when it needs to block.  Waiters in the
+// same process are woken directly when a lock is released; waiters in other
+// processes notice on their next poll.
 //
-// TODO(morlovich): Implement condvars?
+// TODO(morlovich): Implement cross-process condvars?
 class SharedMemLockManager : public NamedLockManager {
  public:
   // Note that you must call Initialize() in the root process, and Attach in
@@ -56,6 +60,11 @@ class SharedMemLockManager : public NamedLockManager {
       Hasher* hasher, MessageHandler* handler);
   virtual ~SharedMemLockManager();
 
+  // Records lock contention in statistics, on which
+  // NamedLockWaitQueue::InitStats must have been called.  Nothing is
+  // recorded unless this is called, at setup time, before any locks wait.
+  void SetStatistics(Statistics* statistics);
+
   // Sets up our shared state for use of all child processes. Returns
   // whether successful.
   bool Initialize();
@@ -90,6 +99,7 @@ class SharedMemLockManager : public NamedLockManager {
   Hasher* hasher_;
   MessageHandler* handler_;
   size_t lock_size_;
+  scoped_ptr<NamedLockWaitQueue> wait_queue_;
 
   DISALLOW_COPY_AND_ASSIGN(SharedMemLockManager);
 };
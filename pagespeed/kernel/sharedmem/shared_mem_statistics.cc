@@ -20,6 +20,7 @@
 #include <cmath>
 #include <cstddef>
 #include <limits>
+#include <vector>
 
 #include "base/logging.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
@@ -28,6 +29,7 @@
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/null_mutex.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/stat_stripes.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/util/statistics_logger.h"
@@ -51,12 +53,21 @@ const char kStatisticsObjName[] = "statistics";
 // statistics.
 const char kTimestampVariable[] = "timestamp_";
 
+// Rounds the mutex size up so the stripes following it are line-aligned.
+inline size_t PaddedMutexSize(size_t mutex_size) {
+  return StatStripes::RoundUp(mutex_size);
+}
+
 }  // namespace
 
-// Our shared memory storage format is an array of (mutex, int64).
+// Our shared memory storage format is an array of (mutex, int64), except
+// that striped variables are line-aligned (mutex, stripes), with the mutex
+// padded out to kStripeBytes so that the stripes are on their own cache lines.
 SharedMemVariable::SharedMemVariable(StringPiece name, Statistics* stats)
     : name_(name.as_string()),
-      value_ptr_(NULL) {
+      num_stripes_(1),
+      stripes_(NULL),
+      mutexed_scalar_(this) {
 }
 
 SharedMemStatistics::Var* SharedMemStatistics::NewVariable(StringPiece name) {
@@ -68,6 +79,15 @@ SharedMemStatistics::Var* SharedMemStatistics::NewVariable(StringPiece name) {
   return new Var(name, this);
 }
 
+SharedMemStatistics::Var* SharedMemStatistics::NewStripedVariable(
+    StringPiece name) {
+  Var* var = NewVariable(name);
+  if (var != NULL) {
+    var->impl()->SetStriped();
+  }
+  return var;
+}
+
 SharedMemStatistics::UpDown* SharedMemStatistics::NewUpDownCounter(
     StringPiece name) {
   if (frozen_) {
@@ -88,14 +108,52 @@ SharedMemStatistics::Hist* SharedMemStatistics::NewHistogram(
   return new Hist(name, this);
 }
 
-int64 SharedMemVariable::GetLockHeld() const {
-  return *value_ptr_;
+// A striped variable takes a line-padded mutex plus kNumStripes *
+// kStripeBytes (1KB) of shared memory, and any other a mutex and an int64.
+size_t SharedMemVariable::AllocationSize(
+    AbstractSharedMem* shm_runtime) const {
+  if (striped()) {
+    return PaddedMutexSize(shm_runtime->SharedMutexSize()) +
+        kNumStripes * kStripeBytes;
+  }
+  return shm_runtime->SharedMutexSize() + sizeof(int64);
+}
+
+int64 SharedMemVariable::Get() const {
+  if (mutex_.get() == NULL) {
+    return -1;
+  }
+  return StatStripes::CounterSum(stripes_, num_stripes_);
+}
+
+void SharedMemVariable::IncBy(int64 delta) {
+  if (mutex_.get() != NULL) {
+    StatStripes::CounterAdd(stripes_, num_stripes_, delta);
+  }
+}
+
+int64 SharedMemVariable::AddHelper(int delta) {
+  if (mutex_.get() == NULL) {
+    return -1;
+  }
+  StatStripes::CounterAdd(stripes_, num_stripes_, delta);
+  return Get();
+}
+
+void SharedMemVariable::Set(int64 new_value) {
+  SetReturningPreviousValue(new_value);
+}
+
+int64 SharedMemVariable::SetReturningPreviousValue(int64 new_value) {
+  if (mutex_.get() == NULL) {
+    return -1;
+  }
+  ScopedMutex hold_lock(mutex_.get());
+  return SetReturningPreviousValueLockHeld(new_value);
 }
 
 int64 SharedMemVariable::SetReturningPreviousValueLockHeld(int64 new_value) {
-  int64 previous_value = *value_ptr_;
-  *value_ptr_ = new_value;
-  return previous_value;
+  return StatStripes::CounterExchange(stripes_, num_stripes_, new_value);
 }
 
 void SharedMemVariable::AttachTo(
@@ -108,18 +166,15 @@ void SharedMemVariable::AttachTo(
         name_.c_str());
   }
 
-  value_ptr_ = reinterpret_cast<volatile int64*>(
-      segment->Base() + offset + segment->SharedMutexSize());
+  size_t mutex_size = segment->SharedMutexSize();
+  stripes_ = const_cast<char*>(segment->Base()) + offset +
+      (striped() ? PaddedMutexSize(mutex_size) : mutex_size);
 }
 
 void SharedMemVariable::Reset() {
   mutex_.reset();
 }
 
-AbstractMutex* SharedMemVariable::mutex() const {
-  return mutex_.get();
-}
-
 SharedMemHistogram::SharedMemHistogram(StringPiece name, Statistics* stats)
     : num_buckets_(kDefaultNumBuckets + kOutOfBoundsCatcherBuckets),
       buffer_(NULL) {
@@ -456,8 +511,8 @@ SharedMemStatistics::SharedMemStatistics(
       frozen_(false) {
   if (logging) {
     if (logging_file.size() > 0) {
-      SharedMemVariable* timestamp_impl =
-          AddVariable(kTimestampVariable)->impl();
+      MutexedScalar* timestamp_impl =
+          AddVariable(kTimestampVariable)->impl()->mutexed_scalar();
       console_logger_.reset(new StatisticsLogger(
           logging_interval_ms, max_logfile_size_kb, logging_file,
           timestamp_impl, message_handler, this, file_system, timer));
@@ -472,27 +527,44 @@ SharedMemStatistics::SharedMemStatistics(
 SharedMemStatistics::~SharedMemStatistics() {
 }
 
-bool SharedMemStatistics::InitMutexes(size_t per_var,
-                                      MessageHandler* message_handler) {
+size_t SharedMemStatistics::ComputeVariableOffsets(
+    std::vector<size_t>* offsets) {
   size_t pos = 0;
-  for (size_t i = 0; i < variables_size(); ++i, pos += per_var) {
+  for (size_t i = 0; i < variables_size() + up_down_size(); ++i) {
+    SharedMemVariable* var = (i < variables_size()) ?
+        variables(i)->impl() : up_downs(i - variables_size())->impl();
+    if (var->striped()) {
+      pos = StatStripes::RoundUp(pos);
+    }
+    offsets->push_back(pos);
+    pos += var->AllocationSize(shm_runtime_);
+  }
+  return pos;
+}
+
+bool SharedMemStatistics::InitMutexes(const std::vector<size_t>& var_offsets,
+                                      size_t histogram_offset,
+                                      MessageHandler* message_handler) {
+  for (size_t i = 0; i < variables_size(); ++i) {
     Variable* var = variables(i);
-    if (!segment_->InitializeSharedMutex(pos, message_handler)) {
+    if (!segment_->InitializeSharedMutex(var_offsets[i], message_handler)) {
       message_handler->Message(
           kError, "Unable to create mutex for statistics variable %s",
           var->GetName().as_string().c_str());
       return false;
     }
   }
-  for (size_t i = 0; i < up_down_size(); ++i, pos += per_var) {
+  for (size_t i = 0; i < up_down_size(); ++i) {
     UpDownCounter* var = up_downs(i);
-    if (!segment_->InitializeSharedMutex(pos, message_handler)) {
+    if (!segment_->InitializeSharedMutex(var_offsets[variables_size() + i],
+                                         message_handler)) {
       message_handler->Message(
           kError, "Unable to create mutex for statistics variable %s",
           var->GetName().as_string().c_str());
       return false;
     }
   }
+  size_t pos = histogram_offset;
   for (size_t i = 0; i < histograms_size();) {
     if (!segment_->InitializeSharedMutex(pos, message_handler)) {
       message_handler->Message(
@@ -512,8 +584,9 @@ bool SharedMemStatistics::Init(bool parent,
   frozen_ = true;
 
   // Compute size of shared memory
-  size_t per_var = shm_runtime_->SharedMutexSize() + sizeof(int64);
-  size_t total = (variables_size() + up_down_size()) * per_var;
+  std::vector<size_t> var_offsets;
+  size_t histogram_offset = ComputeVariableOffsets(&var_offsets);
+  size_t total = histogram_offset;
   for (size_t i = 0; i < histograms_size(); ++i) {
     SharedMemHistogram* hist = histograms(i);
     total += hist->AllocationSize(shm_runtime_);
@@ -527,7 +600,7 @@ bool SharedMemStatistics::Init(bool parent,
 
     // Init the locks
     if (ok) {
-      if (!InitMutexes(per_var, message_handler)) {
+      if (!InitMutexes(var_offsets, histogram_offset, message_handler)) {
         // We had a segment but could not make some mutex. In this case,
         // we can't predict what would happen if the child process tried
         // to touch messed up mutexes. Accordingly, we blow away the
@@ -550,23 +623,25 @@ bool SharedMemStatistics::Init(bool parent,
   }
 
   // Now make the variable objects actually point to the right things.
-  size_t pos = 0;
-  for (size_t i = 0; i < variables_size(); ++i, pos += per_var) {
+  for (size_t i = 0; i < variables_size(); ++i) {
     if (ok) {
-      variables(i)->impl()->AttachTo(segment_.get(), pos, message_handler);
+      variables(i)->impl()->AttachTo(segment_.get(), var_offsets[i],
+                                     message_handler);
     } else {
       variables(i)->impl()->Reset();
     }
   }
   // Now make the up_down_counter objects actually point to the right things.
-  for (size_t i = 0; i < up_down_size(); ++i, pos += per_var) {
+  for (size_t i = 0; i < up_down_size(); ++i) {
     if (ok) {
-      up_downs(i)->impl()->AttachTo(segment_.get(), pos, message_handler);
+      up_downs(i)->impl()->AttachTo(
+          segment_.get(), var_offsets[variables_size() + i], message_handler);
     } else {
       up_downs(i)->impl()->Reset();
     }
   }
   // Initialize Histogram buffers.
+  size_t pos = histogram_offset;
   for (size_t i = 0; i < histograms_size();) {
     SharedMemHistogram* hist = histograms(i);
     if (ok) {
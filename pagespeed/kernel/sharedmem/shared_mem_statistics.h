@@ -18,11 +18,13 @@
 #define PAGESPEED_KERNEL_SHAREDMEM_SHARED_MEM_STATISTICS_H_
 
 #include <cstddef>
+#include <vector>
 
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/abstract_shared_mem.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/stat_stripes.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/statistics_template.h"
 #include "pagespeed/kernel/base/string.h"
@@ -37,10 +39,19 @@ class Timer;
 
 // An implementation of Statistics using our shared memory infrastructure.
 // These statistics will be shared amongst all processes and threads
-// spawned by our host.  Note that we will be obtaining a per-variable mutex for
-// every read and write to these variables.  Since this may be expensive,
-// we may need each thread to keep a local cache and infrequently write
-// through to this Statistics object.  TODO(abliss): actually do this.
+// spawned by our host.
+//
+// Variables never block on Add, which is an atomic fetch-and-add.  A variable
+// is kept in an int64 next to its mutex, unless it was added with
+// AddStripedVariable, in which case it is striped over kNumStripes
+// cache-line-sized slots, and an update goes to the slot picked by the CPU
+// (or, where that can't be determined, the process) doing it, so that
+// concurrent updates do not fight over one line.  Reads sum up all the slots.
+// Striping costs shared memory, kNumStripes * kStripeBytes (1KB) plus a
+// line-padded mutex per variable, so it is meant only for the few hottest
+// counters.  The mutex is taken by Set and SetReturningPreviousValue and by
+// StatisticsLogger, all of which are rare compared to Add.  Histograms are
+// still mutex-protected.
 //
 // Because we must allocate shared memory segments and mutexes before any child
 // processes and threads are created, all AddVariable calls must be done in
@@ -53,23 +64,67 @@ class Timer;
 // warning message will be logged).  If the variable fails to initialize in the
 // process that happens to serve a statistics page, then the variable will show
 // up with value -1.
-class SharedMemVariable : public MutexedScalar {
+class SharedMemVariable : public UpDownCounter {
  public:
+  // Number of slots a striped variable's value is spread over, and the number
+  // of bytes each of them takes up (a cache line, so that updates to different
+  // slots do not contend).
+  static const int kNumStripes = StatStripes::kNumStripes;
+  static const size_t kStripeBytes = StatStripes::kStripeBytes;
+
   SharedMemVariable(StringPiece name, Statistics* stats);
   virtual ~SharedMemVariable() {}
   virtual StringPiece GetName() const { return name_; }
 
- protected:
-  virtual AbstractMutex* mutex() const;
-  virtual int64 GetLockHeld() const;
-  virtual int64 SetReturningPreviousValueLockHeld(int64 value);
+  // Get, IncBy and AddHelper do not take the mutex.  IncBy only touches the
+  // slot for the current CPU, if striped, and is what Variable::Add uses.
+  // AddHelper, for UpDownCounter::Add, also returns the sum of the slots right
+  // after the update, which means reading all of them; the sum may include
+  // concurrent updates from other threads and processes.  These are public so
+  // that VarTemplate and UpDownTemplate can forward to them.
+  virtual int64 Get() const;
+  void IncBy(int64 delta);
+  virtual int64 AddHelper(int delta);
+  virtual void Set(int64 value);
+  virtual int64 SetReturningPreviousValue(int64 value);
+
+  // The variable as StatisticsLogger wants it, to keep its timestamp in.
+  MutexedScalar* mutexed_scalar() { return &mutexed_scalar_; }
+
+  bool striped() const { return num_stripes_ > 1; }
+
+  // Returns the amount of shared memory this variable needs, including its
+  // mutex.  A striped variable must also start on a kStripeBytes boundary.
+  size_t AllocationSize(AbstractSharedMem* shm_runtime) const;
 
  private:
+  // Presents the variable through the MutexedScalar interface.
+  class MutexedView : public MutexedScalar {
+   public:
+    explicit MutexedView(SharedMemVariable* var) : var_(var) {}
+    virtual ~MutexedView() {}
+
+   protected:
+    virtual AbstractMutex* mutex() const { return var_->mutex_.get(); }
+    virtual int64 GetLockHeld() const { return var_->Get(); }
+    virtual int64 SetReturningPreviousValueLockHeld(int64 value) {
+      return var_->SetReturningPreviousValueLockHeld(value);
+    }
+
+   private:
+    SharedMemVariable* var_;
+
+    DISALLOW_COPY_AND_ASSIGN(MutexedView);
+  };
+
   friend class SharedMemStatistics;
   friend class SharedMemTimedVariable;
 
   explicit SharedMemVariable(const StringPiece& name);
 
+  // Spreads the value over kNumStripes slots.  Must be called before AttachTo.
+  void SetStriped() { num_stripes_ = kNumStripes; }
+
   void AttachTo(AbstractSharedMemSegment* segment_, size_t offset,
                 MessageHandler* message_handler);
 
@@ -77,14 +132,20 @@ class SharedMemVariable : public MutexedScalar {
   // share some state with parent.
   void Reset();
 
+  int64 SetReturningPreviousValueLockHeld(int64 value);
+
   // The name of this variable.
   const GoogleString name_;
 
-  // Lock protecting us. NULL if for some reason initialization failed.
+  // Serializes Set, and is what StatisticsLogger locks. NULL if for some
+  // reason initialization failed.
   scoped_ptr<AbstractMutex> mutex_;
 
-  // The data...
-  volatile int64* value_ptr_;
+  // The data: num_stripes_ slots, kStripeBytes apart.
+  int num_stripes_;
+  char* stripes_;
+
+  MutexedView mutexed_scalar_;
 
   DISALLOW_COPY_AND_ASSIGN(SharedMemVariable);
 };
@@ -222,13 +283,19 @@ class SharedMemStatistics : public ScalarStatisticsTemplate<
 
  protected:
   virtual Var* NewVariable(StringPiece name);
+  virtual Var* NewStripedVariable(StringPiece name);
   virtual UpDown* NewUpDownCounter(StringPiece name);
   virtual Hist* NewHistogram(StringPiece name);
 
  private:
-  // Create mutexes in the segment, with per_var bytes being used,
-  // counting the mutex, for each variable.
-  bool InitMutexes(size_t per_var, MessageHandler* message_handler);
+  // Fills in the offset in the segment of each variable and then each
+  // up/down counter, and returns the offset where the histograms start.
+  size_t ComputeVariableOffsets(std::vector<size_t>* offsets);
+
+  // Create mutexes in the segment, for variables and up/down counters at
+  // var_offsets, and histograms starting at histogram_offset.
+  bool InitMutexes(const std::vector<size_t>& var_offsets,
+                   size_t histogram_offset, MessageHandler* message_handler);
 
   friend class SharedMemStatisticsTestBase;
 
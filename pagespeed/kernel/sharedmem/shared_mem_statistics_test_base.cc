@@ -35,6 +35,8 @@ namespace {
 const char kPrefix[] = "/prefix/";
 const char kVar1[] = "v1";
 const char kVar2[] = "num_flushes";
+const char kPlainVar[] = "plain";
+const char kStripedVar[] = "striped";
 const char kHist1[] = "H1";
 const char kHist2[] = "Html Time us Histogram";
 
@@ -87,6 +89,12 @@ bool SharedMemStatisticsTestBase::AddVars(SharedMemStatistics* stats) {
   return ((v1 != NULL) && (v2 != NULL));
 }
 
+bool SharedMemStatisticsTestBase::AddStripedVars(SharedMemStatistics* stats) {
+  Variable* plain = stats->AddVariable(kPlainVar);
+  Variable* striped = stats->AddStripedVariable(kStripedVar);
+  return ((plain != NULL) && (striped != NULL) && AddVars(stats));
+}
+
 bool SharedMemStatisticsTestBase::AddHistograms(SharedMemStatistics* stats) {
   Histogram* hist1 = stats->AddHistogram(kHist1);
   Histogram* hist2 = stats->AddHistogram(kHist2);
@@ -271,6 +279,27 @@ void SharedMemStatisticsTestBase::TestSetReturningPrevious() {
   EXPECT_EQ(10, v1->Get());
 }
 
+void SharedMemStatisticsTestBase::TestSetAfterManyAdds() {
+  ParentInit();
+
+  // Adds from many children may land in different stripes of the variable;
+  // both Get and SetReturningPreviousValue must account for all of them.
+  UpDownCounter* v1 = stats_->GetUpDownCounter(kVar1);
+  UpDownCounter* v2 = stats_->GetUpDownCounter(kVar2);
+  v1->Add(5);
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_TRUE(CreateChild(&SharedMemStatisticsTestBase::TestAddChild));
+  }
+  test_env_->WaitForChildren();
+  EXPECT_EQ(5 + 10 * 1, v1->Get());
+  EXPECT_EQ(15, v1->SetReturningPreviousValue(-4));
+  EXPECT_EQ(-4, v1->Get());
+  EXPECT_EQ(3, v1->Add(7));
+  v2->Set(0);
+  EXPECT_EQ(0, v2->Get());
+  EXPECT_EQ(-1, v2->Add(-1));
+}
+
 void SharedMemStatisticsTestBase::TestAddChild() {
   scoped_ptr<SharedMemStatistics> stats(ChildInit());
   stats->Init(false, &handler_);
@@ -286,6 +315,50 @@ void SharedMemStatisticsTestBase::TestAddChild() {
   hist2->Add(4);
 }
 
+void SharedMemStatisticsTestBase::TestStripedVariable() {
+  // A striped variable among plain ones, which must keep out of each other's
+  // way in the segment.
+  EXPECT_TRUE(AddStripedVars(stats_.get()));
+  EXPECT_TRUE(AddHistograms(stats_.get()));
+  stats_->Init(true, &handler_);
+
+  EXPECT_FALSE(stats_->FindVariable(kPlainVar)->impl()->striped());
+  EXPECT_TRUE(stats_->FindVariable(kStripedVar)->impl()->striped());
+  Variable* plain = stats_->GetVariable(kPlainVar);
+  Variable* striped = stats_->GetVariable(kStripedVar);
+  UpDownCounter* v1 = stats_->GetUpDownCounter(kVar1);
+  v1->Set(3);
+  plain->Add(5);
+  striped->Add(7);
+
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_TRUE(CreateChild(
+        &SharedMemStatisticsTestBase::TestStripedVariableChild));
+  }
+  test_env_->WaitForChildren();
+  EXPECT_EQ(5 + 10 * 1, plain->Get());
+  EXPECT_EQ(7 + 10 * 2, striped->Get());
+  EXPECT_EQ(3, v1->Get());
+
+  striped->Clear();
+  EXPECT_EQ(0, striped->Get());
+  EXPECT_EQ(15, plain->Get());
+}
+
+void SharedMemStatisticsTestBase::TestStripedVariableChild() {
+  scoped_ptr<SharedMemStatistics> stats(new SharedMemStatistics(
+      kLogIntervalMs, kMaxLogfileSizeKb, kStatsLogFile, false /* no logging */,
+      kPrefix, shmem_runtime_.get(), &handler_, file_system_.get(),
+      timer_.get()));
+  if (!AddStripedVars(stats.get()) || !AddHistograms(stats.get())) {
+    test_env_->ChildFailed();
+    return;
+  }
+  stats->Init(false, &handler_);
+  stats->GetVariable(kPlainVar)->Add(1);
+  stats->GetVariable(kStripedVar)->Add(2);
+}
+
 // This function tests the Histogram options with multi-processes.
 void SharedMemStatisticsTestBase::TestHistogram() {
   ParentInit();
@@ -52,12 +52,14 @@ class SharedMemStatisticsTestBase : public testing::Test {
   void TestClear();
   void TestAdd();
   void TestSetReturningPrevious();
+  void TestSetAfterManyAdds();
   void TestHistogram();
   void TestHistogramRender();
   void TestHistogramNoExtraClear();
   void TestHistogramExtremeBuckets();
   void TestTimedVariableEmulation();
   void TestConsoleStatisticsLogger();
+  void TestStripedVariable();
 
   StatisticsLogger* console_logger() const {
     return stats_->console_logger_.get();
@@ -76,7 +78,11 @@ class SharedMemStatisticsTestBase : public testing::Test {
 
   // Adds 10x +1 to variable 1, and 10x +2 to variable 2.
   void TestAddChild();
+  // Adds 1 to the plain variable and 2 to the striped one.
+  void TestStripedVariableChild();
   bool AddVars(SharedMemStatistics* stats);
+  // Adds a plain and a striped variable ahead of the ones AddVars does.
+  bool AddStripedVars(SharedMemStatistics* stats);
   bool AddHistograms(SharedMemStatistics* stats);
   // Helper function for TestHistogramRender().
   // Check if string html contains the pattern.
@@ -122,6 +128,10 @@ TYPED_TEST_P(SharedMemStatisticsTestTemplate, TestSetReturningPrevious) {
   SharedMemStatisticsTestBase::TestSetReturningPrevious();
 }
 
+TYPED_TEST_P(SharedMemStatisticsTestTemplate, TestSetAfterManyAdds) {
+  SharedMemStatisticsTestBase::TestSetAfterManyAdds();
+}
+
 TYPED_TEST_P(SharedMemStatisticsTestTemplate, TestHistogram) {
   SharedMemStatisticsTestBase::TestHistogram();
 }
@@ -142,13 +152,19 @@ TYPED_TEST_P(SharedMemStatisticsTestTemplate, TestTimedVariableEmulation) {
   SharedMemStatisticsTestBase::TestTimedVariableEmulation();
 }
 
+TYPED_TEST_P(SharedMemStatisticsTestTemplate, TestStripedVariable) {
+  SharedMemStatisticsTestBase::TestStripedVariable();
+}
+
 REGISTER_TYPED_TEST_CASE_P(SharedMemStatisticsTestTemplate, TestCreate,
                            TestSet, TestClear, TestAdd,
                            TestSetReturningPrevious,
+                           TestSetAfterManyAdds,
                            TestHistogram, TestHistogramRender,
                            TestHistogramNoExtraClear,
                            TestHistogramExtremeBuckets,
-                           TestTimedVariableEmulation);
+                           TestTimedVariableEmulation,
+                           TestStripedVariable);
 
 }  // namespace net_instaweb
 
@@ -16,6 +16,8 @@
 
 #include "pagespeed/kernel/thread/mock_scheduler.h"
 
+#include <vector>
+
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/function.h"
@@ -74,6 +76,33 @@ class ChainedAlarm : public Function {
   DISALLOW_COPY_AND_ASSIGN(ChainedAlarm);
 };
 
+// Records when it was run, and checks that it was not run early.
+class TimeCheckAlarm : public Function {
+ public:
+  TimeCheckAlarm(Timer* timer, int64 wakeup_us, int64* last_run_us,
+                 int* count)
+      : timer_(timer),
+        wakeup_us_(wakeup_us),
+        last_run_us_(last_run_us),
+        count_(count) {}
+
+  virtual void Run() {
+    int64 now_us = timer_->NowUs();
+    EXPECT_EQ(wakeup_us_, now_us);
+    EXPECT_LE(*last_run_us_, now_us);
+    *last_run_us_ = now_us;
+    ++*count_;
+  }
+
+ private:
+  Timer* timer_;
+  int64 wakeup_us_;
+  int64* last_run_us_;
+  int* count_;
+
+  DISALLOW_COPY_AND_ASSIGN(TimeCheckAlarm);
+};
+
 }  // namespace
 
 class MockSchedulerTest : public testing::Test {
@@ -112,6 +141,10 @@ class MockSchedulerTest : public testing::Test {
     scheduler_->AdvanceTimeUs(interval_us);
   }
 
+  void AdvanceToUs(int64 time_us) {
+    scheduler_->AdvanceTimeUs(time_us - timer_.NowUs());
+  }
+
  protected:
   scoped_ptr<ThreadSystem> thread_system_;
   MockTimer timer_;
@@ -216,6 +249,149 @@ TEST_F(MockSchedulerTest, CancelledDueToMockSchedulerDestruction) {
 }
 #endif
 
+// The scheduler files alarms at different granularities depending on how
+// far off they are; make sure they still come out in order, and on time.
+TEST_F(MockSchedulerTest, OrderingAcrossHorizons) {
+  const int64 kHourUs = 60 * Timer::kMinuteUs;
+  AddTask(6 * kHourUs, 'g');  // Past the end of the coarsest level.
+  AddTask(3 * Timer::kMinuteUs, 'e');
+  AddTask(2 * Timer::kSecondUs, 'c');
+  AddTask(5 * Timer::kMsUs, 'a');
+  AddTask(2 * Timer::kSecondUs + 1, 'd');
+  AddTask(kHourUs, 'f');
+  AddTask(5 * Timer::kMsUs + 1, 'b');
+  AddTask(Timer::kYearMs * Timer::kMsUs, 'h');
+  AdvanceToUs(5 * Timer::kMsUs);
+  EXPECT_EQ("a", string_);
+  AdvanceToUs(2 * Timer::kSecondUs);
+  EXPECT_EQ("abc", string_);
+  AdvanceToUs(kHourUs - 1);
+  EXPECT_EQ("abcde", string_);
+  AdvanceToUs(kHourUs);
+  EXPECT_EQ("abcdef", string_);
+  AdvanceToUs(6 * kHourUs - 1);
+  EXPECT_EQ("abcdef", string_);
+  AdvanceToUs(6 * kHourUs);
+  EXPECT_EQ("abcdefg", string_);
+  AdvanceToUs(Timer::kYearMs * Timer::kMsUs);
+  EXPECT_EQ("abcdefgh", string_);
+}
+
+TEST_F(MockSchedulerTest, CancellationAcrossHorizons) {
+  const int64 kHourUs = 60 * Timer::kMinuteUs;
+  Scheduler::Alarm* alarms[] = {
+    AddTask(Timer::kMsUs, 'a'),
+    AddTask(Timer::kSecondUs, 'b'),
+    AddTask(Timer::kMinuteUs, 'c'),
+    AddTask(kHourUs, 'd'),
+    AddTask(10 * kHourUs, 'e'),
+  };
+  AddTask(Timer::kMsUs, 'A');
+  AddTask(Timer::kSecondUs, 'B');
+  AddTask(Timer::kMinuteUs, 'C');
+  AddTask(kHourUs, 'D');
+  AddTask(10 * kHourUs, 'E');
+  {
+    ScopedMutex lock(scheduler_->mutex());
+    for (int i = 0; i < arraysize(alarms); ++i) {
+      EXPECT_TRUE(scheduler_->CancelAlarm(alarms[i]));
+    }
+  }
+  AdvanceTimeUs(10 * kHourUs);
+  EXPECT_EQ("ABCDE", string_);
+}
+
+// Alarms added in the past, or right behind the time the scheduler has
+// looked ahead to, still run in order.
+TEST_F(MockSchedulerTest, AddBehindLookahead) {
+  AddTask(50 * Timer::kMsUs, 'c');
+  AdvanceTimeUs(10 * Timer::kMsUs);
+  AddTask(30 * Timer::kMsUs, 'b');
+  AddTask(5 * Timer::kMsUs, 'a');  // Already due.
+  AddTask(50 * Timer::kMsUs, 'd');
+  AdvanceTimeUs(Timer::kMsUs);
+  EXPECT_EQ("a", string_);
+  AdvanceTimeUs(39 * Timer::kMsUs);
+  EXPECT_EQ("abcd", string_);
+}
+
+// MockScheduler advances time to each alarm in turn, so every alarm should
+// run exactly at its wakeup time, however far apart they are.
+TEST_F(MockSchedulerTest, ManyAlarmsRunOnTime) {
+  const int kNumAlarms = 2000;
+  const int64 kCancelTimeUs = Timer::kSecondUs / 2;
+  int64 last_run_us = 0;
+  int count = 0;
+  uint32 seed = 1;
+  std::vector<Scheduler::Alarm*> to_cancel;
+  for (int i = 0; i < kNumAlarms; ++i) {
+    seed = seed * 1103515245 + 12345;
+    // Spread the wakeups over scales from microseconds to hours.
+    int64 wakeup_us = (seed >> 8) % (Timer::kSecondUs << (i % 16));
+    Scheduler::Alarm* alarm = scheduler_->AddAlarmAtUs(
+        wakeup_us,
+        new TimeCheckAlarm(&timer_, wakeup_us, &last_run_us, &count));
+    if ((i % 5 == 0) && (wakeup_us > kCancelTimeUs)) {
+      to_cancel.push_back(alarm);
+    }
+  }
+  AdvanceToUs(kCancelTimeUs);
+  EXPECT_LT(0, count);
+  int num_canceled = to_cancel.size();
+  EXPECT_LT(0, num_canceled);
+  {
+    ScopedMutex lock(scheduler_->mutex());
+    for (int i = 0; i < num_canceled; ++i) {
+      EXPECT_TRUE(scheduler_->CancelAlarm(to_cancel[i]));
+    }
+  }
+  // Step time along irregularly for a while, rather than straight to each
+  // alarm, and then run everything else.
+  while (timer_.NowUs() < 10 * Timer::kSecondUs) {
+    seed = seed * 1103515245 + 12345;
+    AdvanceTimeUs((seed >> 8) % (2 * Timer::kMsUs));
+  }
+  AdvanceToUs(Timer::kSecondUs << 16);
+  EXPECT_EQ(kNumAlarms, count + num_canceled);
+}
+
+// Cancels alarms a few seconds out in deadline order, as when requests with
+// the same timeout finish in the order they started, adding another alarm
+// after each, mostly after all the rest but sometimes before or among them.
+// Whatever is left should still run on time.
+TEST_F(MockSchedulerTest, CancelInDeadlineOrder) {
+  const int kNumAlarms = 200;
+  const int64 kStartUs = 5 * Timer::kSecondUs;
+  const int64 kSpacingUs = 10 * Timer::kMsUs;
+  int64 last_run_us = 0;
+  int count = 0;
+  std::vector<Scheduler::Alarm*> alarms(kNumAlarms);
+  for (int i = 0; i < kNumAlarms; ++i) {
+    int k = (i * 37) % kNumAlarms;  // Add them out of order.
+    int64 wakeup_us = kStartUs + k * kSpacingUs;
+    alarms[k] = scheduler_->AddAlarmAtUs(
+        wakeup_us,
+        new TimeCheckAlarm(&timer_, wakeup_us, &last_run_us, &count));
+  }
+  for (int i = 0; i < kNumAlarms; ++i) {
+    {
+      ScopedMutex lock(scheduler_->mutex());
+      EXPECT_TRUE(scheduler_->CancelAlarm(alarms[i]));
+    }
+    int64 wakeup_us = kStartUs + (kNumAlarms + i) * kSpacingUs;
+    if (i % 4 == 2) {
+      wakeup_us = kStartUs - (i + 1) * Timer::kMsUs;
+    } else if (i % 4 == 3) {
+      wakeup_us = kStartUs + ((i + kNumAlarms) / 2) * kSpacingUs + 1;
+    }
+    scheduler_->AddAlarmAtUs(
+        wakeup_us,
+        new TimeCheckAlarm(&timer_, wakeup_us, &last_run_us, &count));
+  }
+  AdvanceToUs(kStartUs + 2 * kNumAlarms * kSpacingUs);
+  EXPECT_EQ(kNumAlarms, count);
+}
+
 TEST_F(MockSchedulerTest, WakeupOnAdvancementOfSimulatedTime) {
   scheduler_->AddAlarmAtUs(Timer::kMsUs * kDelayMs, new TestAlarm());
   {
@@ -0,0 +1,141 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pagespeed/kernel/thread/named_lock_wait_queue.h"
+
+#include <algorithm>
+
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/thread/scheduler.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// Waits longer than this all land in the histogram's last bucket.
+const int64 kWaitHistogramMaxValueMs = 30 * Timer::kSecondMs;
+
+}  // namespace
+
+const char NamedLockWaitQueue::kNamedLockContentions[] =
+    "named_lock_contentions";
+const char NamedLockWaitQueue::kNamedLockWakeups[] = "named_lock_wakeups";
+const char NamedLockWaitQueue::kNamedLockTimeouts[] = "named_lock_timeouts";
+const char NamedLockWaitQueue::kNamedLockWaitMs[] = "named_lock_wait_ms";
+
+NamedLockWaitQueue::Waiter::~Waiter() {
+}
+
+NamedLockWaitQueue::NamedLockWaitQueue(Scheduler* scheduler)
+    : scheduler_(scheduler),
+      num_waiters_(0),
+      contentions_(NULL),
+      wakeups_(NULL),
+      timeouts_(NULL),
+      wait_ms_(NULL) {
+}
+
+NamedLockWaitQueue::~NamedLockWaitQueue() {
+}
+
+void NamedLockWaitQueue::InitStats(Statistics* statistics) {
+  statistics->AddVariable(kNamedLockContentions);
+  statistics->AddVariable(kNamedLockWakeups);
+  statistics->AddVariable(kNamedLockTimeouts);
+  Histogram* wait_ms = statistics->AddHistogram(kNamedLockWaitMs);
+  wait_ms->SetMaxValue(kWaitHistogramMaxValueMs);
+}
+
+void NamedLockWaitQueue::SetStatistics(Statistics* statistics) {
+  contentions_ = statistics->GetVariable(kNamedLockContentions);
+  wakeups_ = statistics->GetVariable(kNamedLockWakeups);
+  timeouts_ = statistics->GetVariable(kNamedLockTimeouts);
+  wait_ms_ = statistics->GetHistogram(kNamedLockWaitMs);
+}
+
+void NamedLockWaitQueue::AddWaiter(const GoogleString& lock_name,
+                                   Waiter* waiter) {
+  waiters_[lock_name].push_back(waiter);
+  num_waiters_.BarrierIncrement(1);
+}
+
+void NamedLockWaitQueue::RequeueWaiter(const GoogleString& lock_name,
+                                       Waiter* waiter) {
+  waiters_[lock_name].push_front(waiter);
+  num_waiters_.BarrierIncrement(1);
+}
+
+void NamedLockWaitQueue::RemoveWaiter(const GoogleString& lock_name,
+                                      Waiter* waiter) {
+  WaiterMap::iterator iter = waiters_.find(lock_name);
+  if (iter == waiters_.end()) {
+    return;
+  }
+  WaiterQueue& queue = iter->second;
+  WaiterQueue::iterator pos = std::find(queue.begin(), queue.end(), waiter);
+  if (pos != queue.end()) {
+    queue.erase(pos);
+    num_waiters_.BarrierIncrement(-1);
+  }
+  if (queue.empty()) {
+    waiters_.erase(iter);
+  }
+}
+
+void NamedLockWaitQueue::NotifyUnlocked(const GoogleString& lock_name) {
+  if (num_waiters_.value() == 0) {
+    return;
+  }
+  ScopedMutex lock(scheduler_->mutex());
+  WaiterMap::iterator iter = waiters_.find(lock_name);
+  if (iter == waiters_.end()) {
+    return;
+  }
+  WaiterQueue& queue = iter->second;
+  Waiter* waiter = queue.front();
+  queue.pop_front();
+  num_waiters_.BarrierIncrement(-1);
+  if (queue.empty()) {
+    waiters_.erase(iter);
+  }
+  if (wakeups_ != NULL) {
+    wakeups_->Add(1);
+  }
+  // Note: this may drop and re-take the scheduler mutex, so we must be done
+  // with iter by now.
+  waiter->WakeupMutexHeld();
+}
+
+void NamedLockWaitQueue::RecordContention() {
+  if (contentions_ != NULL) {
+    contentions_->Add(1);
+  }
+}
+
+void NamedLockWaitQueue::RecordAcquired(int64 wait_ms) {
+  if (wait_ms_ != NULL) {
+    wait_ms_->Add(wait_ms);
+  }
+}
+
+void NamedLockWaitQueue::RecordTimeout() {
+  if (timeouts_ != NULL) {
+    timeouts_->Add(1);
+  }
+}
+
+}  // namespace net_instaweb
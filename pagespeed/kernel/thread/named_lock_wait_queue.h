@@ -0,0 +1,126 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_THREAD_NAMED_LOCK_WAIT_QUEUE_H_
+#define PAGESPEED_KERNEL_THREAD_NAMED_LOCK_WAIT_QUEUE_H_
+
+#include <deque>
+#include <map>
+
+#include "pagespeed/kernel/base/atomic_int32.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/thread/scheduler.h"
+
+namespace net_instaweb {
+
+class Histogram;
+class Statistics;
+class Variable;
+
+// Per-lock-manager queues of the SchedulerBasedAbstractLock operations in
+// this process that are blocked waiting for a named lock.  When a lock is
+// unlocked, the lock manager calls NotifyUnlocked, which wakes the waiter
+// that has been queued on that name the longest so that it retries at once,
+// rather than whenever its next backoff poll happens to come around.
+//
+// Only unlocks performed in this process are seen, so waiters still poll
+// (at a bounded interval) to notice locks released by other processes and to
+// time out or steal.
+//
+// All queue state is guarded by the scheduler mutex, which the waiters also
+// need in order to manage their alarms.
+class NamedLockWaitQueue {
+ public:
+  // A blocked lock operation.
+  class Waiter {
+   public:
+    Waiter() { }
+    virtual ~Waiter();
+
+    // Called with the scheduler mutex held after the waiter has been removed
+    // from the queue because the lock it wants was unlocked.  The waiter
+    // should retry the lock promptly, and if that fails queue itself again
+    // with RequeueWaiter, so that it keeps its place.  May drop and re-take
+    // the scheduler mutex.
+    virtual void WakeupMutexHeld() = 0;
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(Waiter);
+  };
+
+  static const char kNamedLockContentions[];
+  static const char kNamedLockWakeups[];
+  static const char kNamedLockTimeouts[];
+  static const char kNamedLockWaitMs[];
+
+  explicit NamedLockWaitQueue(Scheduler* scheduler);
+  ~NamedLockWaitQueue();
+
+  static void InitStats(Statistics* statistics);
+
+  // Records statistics from now on.  This should be called at setup time,
+  // before any waiters are queued; until then nothing is recorded.
+  void SetStatistics(Statistics* statistics);
+
+  Scheduler* scheduler() const { return scheduler_; }
+
+  // Adds waiter to the back of the queue for lock_name.
+  void AddWaiter(const GoogleString& lock_name, Waiter* waiter)
+      EXCLUSIVE_LOCKS_REQUIRED(scheduler_->mutex());
+
+  // Puts a woken waiter that failed to get the lock back at the front of the
+  // queue for lock_name, ahead of the waiters that arrived after it.
+  void RequeueWaiter(const GoogleString& lock_name, Waiter* waiter)
+      EXCLUSIVE_LOCKS_REQUIRED(scheduler_->mutex());
+
+  // Removes waiter from the queue for lock_name, if it is there.
+  void RemoveWaiter(const GoogleString& lock_name, Waiter* waiter)
+      EXCLUSIVE_LOCKS_REQUIRED(scheduler_->mutex());
+
+  // Called by a lock after it releases lock_name; wakes the first waiter
+  // queued on that name, if any.  This doesn't touch the scheduler mutex
+  // unless some lock has waiters, so uncontended unlocks stay cheap.
+  void NotifyUnlocked(const GoogleString& lock_name)
+      LOCKS_EXCLUDED(scheduler_->mutex());
+
+  // Statistics hooks for lock operations that missed their fast path.
+  void RecordContention();
+  void RecordAcquired(int64 wait_ms);
+  void RecordTimeout();
+
+ private:
+  typedef std::deque<Waiter*> WaiterQueue;
+  typedef std::map<GoogleString, WaiterQueue> WaiterMap;
+
+  Scheduler* scheduler_;
+  WaiterMap waiters_ GUARDED_BY(scheduler_->mutex());
+
+  // The number of waiters in waiters_, which may be read without the
+  // scheduler mutex.  A waiter is counted before it tries the lock, so an
+  // Unlock that follows a failed try always sees it.
+  AtomicInt32 num_waiters_;
+
+  Variable* contentions_;
+  Variable* wakeups_;
+  Variable* timeouts_;
+  Histogram* wait_ms_;
+
+  DISALLOW_COPY_AND_ASSIGN(NamedLockWaitQueue);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_THREAD_NAMED_LOCK_WAIT_QUEUE_H_
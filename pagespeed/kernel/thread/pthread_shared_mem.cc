@@ -18,13 +18,22 @@
 
 #include <fcntl.h>
 #include <pthread.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <cerrno>
 #include <cstddef>
+#include <cstring>
 #include <map>
 #include <utility>
 
+#ifdef __linux__
+#include <linux/fs.h>  // For FICLONE.
+#endif
+
 #include "base/logging.h"
 #include "pagespeed/kernel/base/abstract_shared_mem.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
@@ -52,6 +61,112 @@ void CheckedClose(int fd, MessageHandler* message_handler) {
   }
 }
 
+// Takes an exclusive lock on all of fd's file without waiting. The lock
+// belongs to the open file description, so another open() of the file
+// conflicts with it even within this process. Forked children share the
+// description, which is why they drop their copies in AttachToSegment.
+bool LockFile(int fd) {
+#ifdef F_OFD_SETLK
+  struct flock lock;
+  std::memset(&lock, 0, sizeof(lock));
+  lock.l_type = F_WRLCK;
+  lock.l_whence = SEEK_SET;  // l_start = l_len = 0 covers the whole file.
+  return fcntl(fd, F_OFD_SETLK, &lock) == 0;
+#else
+  return flock(fd, LOCK_EX | LOCK_NB) == 0;
+#endif
+}
+
+// Copies bytes [pos, end) of from_fd to the same place in to_fd.
+bool CopyRange(int from_fd, int to_fd, off_t pos, off_t end) {
+#ifdef __NR_copy_file_range
+  // This copies inside the kernel, without a trip through our buffer, and
+  // some file systems don't even read the data. Where it's unsupported, or
+  // across file systems on older kernels, we fall back to reading and writing.
+  while (pos < end) {
+    int64 from_pos = pos;  // The kernel's loff_t.
+    int64 to_pos = pos;
+    ssize_t copied = syscall(__NR_copy_file_range, from_fd, &from_pos, to_fd,
+                             &to_pos, static_cast<size_t>(end - pos), 0);
+    if (copied < 0 && errno == EINTR) {
+      continue;
+    }
+    if (copied <= 0) {
+      break;
+    }
+    pos += copied;
+  }
+#endif
+  char buf[64 * 1024];
+  while (pos < end) {
+    size_t want = sizeof(buf);
+    if (end - pos < static_cast<off_t>(want)) {
+      want = static_cast<size_t>(end - pos);
+    }
+    ssize_t got = pread(from_fd, buf, want, pos);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      return false;
+    }
+    for (ssize_t done = 0; done < got; ) {
+      ssize_t put = pwrite(to_fd, buf + done, got - done, pos + done);
+      if (put < 0 && errno == EINTR) {
+        continue;
+      }
+      if (put <= 0) {
+        return false;
+      }
+      done += put;
+    }
+    pos += got;
+  }
+  return true;
+}
+
+// Copies the first size bytes of from_fd, which is exactly that long, into
+// the empty to_fd. This runs in the parent at startup before anything is
+// served, so it's done as cheaply as the file system allows. A reflink
+// shares the old blocks instead of copying them, which is nearly free.
+// Failing that, only the parts of the file that were ever written are
+// copied: the rest are holes that read as zeros, as does the unwritten
+// part of to_fd once it's extended.
+bool CopyFile(int from_fd, int to_fd, size_t size) {
+#ifdef FICLONE
+  if (ioctl(to_fd, FICLONE, from_fd) == 0) {
+    return true;
+  }
+#endif
+  const off_t end = static_cast<off_t>(size);
+  off_t pos = 0;
+  while (pos < end) {
+    off_t data_start = pos;
+    off_t data_end = end;
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    data_start = lseek(from_fd, pos, SEEK_DATA);
+    if (data_start < 0) {
+      if (errno == ENXIO) {
+        return true;  // Nothing but a hole from pos on.
+      }
+      // No hole support here, so copy everything.
+      data_start = pos;
+    } else {
+      data_end = lseek(from_fd, data_start, SEEK_HOLE);
+      if ((data_end < 0) || (data_end > end)) {
+        data_end = end;
+      }
+    }
+#endif
+    if ((data_start < data_end) &&
+        !CopyRange(from_fd, to_fd, data_start, data_end)) {
+      return false;
+    }
+    pos = data_end;
+  }
+  return true;
+}
+
 // Unlike PthreadMutex this doesn't own the lock, but rather refers to an
 // external one.
 class PthreadSharedMemMutex : public AbstractMutex {
@@ -145,6 +260,8 @@ size_t PthreadSharedMem::s_instance_count_ = 0;
 
 PthreadSharedMem::SegmentBaseMap* PthreadSharedMem::segment_bases_ = NULL;
 
+PthreadSharedMem::SegmentFileMap* PthreadSharedMem::segment_files_ = NULL;
+
 PthreadSharedMem::PthreadSharedMem() {
   instance_number_ = ++s_instance_count_;
 }
@@ -168,22 +285,87 @@ AbstractSharedMemSegment* PthreadSharedMem::CreateSegment(
     return NULL;
   }
 
-  // map it
-  char* base = reinterpret_cast<char*>(
-                   mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
-  int mmap_errno = errno;
+  return MapSegment(prefixed_name, fd, -1 /* lock_fd */, size, handler);
+}
+
+AbstractSharedMemSegment* PthreadSharedMem::CreateFileBackedSegment(
+    const GoogleString& name, const GoogleString& file_path, size_t size,
+    MessageHandler* handler, bool* reused) {
+  GoogleString prefixed_name = PrefixSegmentName(name);
+  *reused = false;
+  int fd = open(file_path.c_str(), O_RDWR | O_CREAT, 0600);
+  if (fd == -1) {
+    handler->Message(
+        kError, "Unable to create SHM segment %s, open of %s failed "
+        "with errno=%d.", prefixed_name.c_str(), file_path.c_str(), errno);
+    return NULL;
+  }
+
+  // Don't let the lock leak into anything our children exec.
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  if (!LockFile(fd)) {
+    handler->Message(
+        kWarning, "Unable to create SHM segment %s, %s is locked (errno=%d); "
+        "it may be in use by another server.", prefixed_name.c_str(),
+        file_path.c_str(), errno);
+    CheckedClose(fd, handler);
+    return NULL;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    handler->Message(
+        kError, "Unable to create SHM segment %s, fstat of %s failed "
+        "with errno=%d.", prefixed_name.c_str(), file_path.c_str(), errno);
+    CheckedClose(fd, handler);
+    return NULL;
+  }
+
+  // Children of a previous server generation may still have the file mapped
+  // and be writing to it, as they don't hold the lock. So the file is never
+  // changed in place: the new segment gets a fresh file, seeded with a copy
+  // of the old contents if they could be reused, which is then renamed over
+  // the old one. The old children keep the old file until they exit. They
+  // may write to it while we copy, so the copy can be torn; SharedMemCache
+  // checksums each entry to catch that.
+  GoogleString temp_path = StrCat(file_path, ".tmp");
+  int new_fd = open(temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  bool ok = (new_fd != -1);
+  if (ok) {
+    fcntl(new_fd, F_SETFD, FD_CLOEXEC);
+    ok = LockFile(new_fd);
+  }
+  if (ok && (static_cast<size_t>(file_stat.st_size) == size)) {
+    ok = CopyFile(fd, new_fd, size);
+    *reused = ok;
+  }
+  // Extending the file zero-fills it, just like memory from /dev/zero.
+  // A mapping holds on to the open file description it was made from, and
+  // with it the lock, so the mapping is made through a separate descriptor.
+  int map_fd = -1;
+  ok = ok && (ftruncate(new_fd, static_cast<off_t>(size)) == 0) &&
+       ((map_fd = open(temp_path.c_str(), O_RDWR)) != -1) &&
+       (rename(temp_path.c_str(), file_path.c_str()) == 0);
+  int saved_errno = errno;
   CheckedClose(fd, handler);
-  if (base == MAP_FAILED) {
+  if (!ok) {
     handler->Message(
-        kError, "Unable to create SHM segment %s, mmap failed with errno=%d.",
-        prefixed_name.c_str(), mmap_errno);
+        kError, "Unable to create SHM segment %s, preparing %s failed "
+        "with errno=%d.", prefixed_name.c_str(), temp_path.c_str(),
+        saved_errno);
+    if (map_fd != -1) {
+      CheckedClose(map_fd, handler);
+    }
+    if (new_fd != -1) {
+      CheckedClose(new_fd, handler);
+      unlink(temp_path.c_str());
+    }
+    *reused = false;
     return NULL;
   }
 
-  SegmentBaseMap* bases = AcquireSegmentBases();
-  (*bases)[prefixed_name] = std::make_pair(base, size);
-  UnlockSegmentBases();
-  return new PthreadSharedMemSegment(base, size, handler);
+  return MapSegment(prefixed_name, map_fd, new_fd, size, handler);
 }
 
 AbstractSharedMemSegment* PthreadSharedMem::AttachToSegment(
@@ -199,6 +381,16 @@ AbstractSharedMemSegment* PthreadSharedMem::AttachToSegment(
   }
   char* base = i->second.first;
   DCHECK_EQ(size, i->second.second);
+  if (segment_files_ != NULL) {
+    // In a child, drop the inherited descriptor of a file-backed segment:
+    // the mapping doesn't need it, and the lock on the file should only be
+    // held by the process that created the segment.
+    SegmentFileMap::iterator f = segment_files_->find(prefixed_name);
+    if ((f != segment_files_->end()) && (f->second.second != getpid())) {
+      CheckedClose(f->second.first, handler);
+      segment_files_->erase(f);
+    }
+  }
   UnlockSegmentBases();
   return new PthreadSharedMemSegment(base, size, handler);
 }
@@ -215,6 +407,19 @@ void PthreadSharedMem::DestroySegment(const GoogleString& name,
     // for things like apache2ctrl graceful (and similar nginx configuration).
     munmap(i->second.first, i->second.second);
     bases->erase(i);
+    if (segment_files_ != NULL) {
+      // Closing our descriptor releases the lock on the file, as children
+      // that attached have closed theirs already.
+      SegmentFileMap::iterator f = segment_files_->find(prefixed_name);
+      if (f != segment_files_->end()) {
+        CheckedClose(f->second.first, handler);
+        segment_files_->erase(f);
+      }
+      if (segment_files_->empty()) {
+        delete segment_files_;
+        segment_files_ = NULL;
+      }
+    }
     if (bases->empty()) {
       delete segment_bases_;
       segment_bases_ = NULL;
@@ -242,6 +447,35 @@ void PthreadSharedMem::UnlockSegmentBases() {
   lock.Unlock();
 }
 
+AbstractSharedMemSegment* PthreadSharedMem::MapSegment(
+    const GoogleString& prefixed_name, int fd, int lock_fd, size_t size,
+    MessageHandler* handler) {
+  char* base = reinterpret_cast<char*>(
+                   mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+  int mmap_errno = errno;
+  CheckedClose(fd, handler);
+  if (base == MAP_FAILED) {
+    if (lock_fd != -1) {
+      CheckedClose(lock_fd, handler);
+    }
+    handler->Message(
+        kError, "Unable to create SHM segment %s, mmap failed with errno=%d.",
+        prefixed_name.c_str(), mmap_errno);
+    return NULL;
+  }
+
+  SegmentBaseMap* bases = AcquireSegmentBases();
+  (*bases)[prefixed_name] = std::make_pair(base, size);
+  if (lock_fd != -1) {
+    if (segment_files_ == NULL) {
+      segment_files_ = new SegmentFileMap();
+    }
+    (*segment_files_)[prefixed_name] = std::make_pair(lock_fd, getpid());
+  }
+  UnlockSegmentBases();
+  return new PthreadSharedMemSegment(base, size, handler);
+}
+
 GoogleString PthreadSharedMem::PrefixSegmentName(const GoogleString& name) {
   GoogleString res;
   StrAppend(&res, "[", IntegerToString(instance_number_), "]", name);
@@ -257,6 +491,10 @@ void PthreadSharedMem::Terminate() {
     delete segment_bases_;
     segment_bases_ = NULL;
   }
+  if (segment_files_ != NULL) {
+    delete segment_files_;
+    segment_files_ = NULL;
+  }
   lock.Unlock();
 }
 
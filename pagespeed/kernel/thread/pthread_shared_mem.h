@@ -17,6 +17,7 @@
 #ifndef PAGESPEED_KERNEL_THREAD_PTHREAD_SHARED_MEM_H_
 #define PAGESPEED_KERNEL_THREAD_PTHREAD_SHARED_MEM_H_
 
+#include <sys/types.h>
 #include <cstddef>
 #include <map>
 #include <utility>
@@ -45,6 +46,24 @@ class PthreadSharedMem : public AbstractSharedMem {
   virtual AbstractSharedMemSegment* CreateSegment(
       const GoogleString& name, size_t size, MessageHandler* handler);
 
+  // Maps file_path with MAP_SHARED, so changes made to the segment end up in
+  // the file. Like with CreateSegment, this must be called before forking.
+  //
+  // The file is locked until DestroySegment, and this fails if the lock is
+  // held elsewhere, e.g. by another server using the same file. Only this
+  // process holds the lock: children drop their inherited descriptor when
+  // they AttachToSegment, and children that never attach hold it until they
+  // exit. So a graceful restart, which destroys and creates the segment again
+  // in the same root process, keeps the contents even while children of the
+  // previous generation finish their last requests. Since those may still
+  // write to the file, it's never modified in place: the new segment maps a
+  // copy, written next to it under a .tmp suffix and renamed over it. The
+  // copy isn't atomic with respect to those writes, so users of the segment
+  // must be prepared to find it torn; SharedMemCache checksums its entries.
+  virtual AbstractSharedMemSegment* CreateFileBackedSegment(
+      const GoogleString& name, const GoogleString& file_path, size_t size,
+      MessageHandler* handler, bool* reused);
+
   virtual AbstractSharedMemSegment* AttachToSegment(
       const GoogleString& name, size_t size, MessageHandler* handler);
 
@@ -56,12 +75,22 @@ class PthreadSharedMem : public AbstractSharedMem {
 
  private:
   typedef std::map<GoogleString, std::pair<char*, size_t> > SegmentBaseMap;
+  // fd and the pid of the process that opened it, by prefixed name.
+  typedef std::map<GoogleString, std::pair<int, pid_t> > SegmentFileMap;
 
   // Accessor for below. Note that the segment_bases_lock will be held at exit.
   static SegmentBaseMap* AcquireSegmentBases();
 
   static void UnlockSegmentBases();
 
+  // Maps size bytes of fd shared and read-write, and records the mapping
+  // under prefixed_name so that AttachToSegment can find it. Closes fd.
+  // Unless it's -1, lock_fd, the locked descriptor of a file-backed segment,
+  // is remembered in segment_files_ and closed by DestroySegment.
+  AbstractSharedMemSegment* MapSegment(const GoogleString& prefixed_name,
+                                       int fd, int lock_fd, size_t size,
+                                       MessageHandler* handler);
+
   // Prefixes the passed in segment name with the current instance number.
   GoogleString PrefixSegmentName(const GoogleString& name);
 
@@ -70,6 +99,11 @@ class PthreadSharedMem : public AbstractSharedMem {
   // initialized in a thread-unsafe manner, given the above assumptions.
   static SegmentBaseMap* segment_bases_;
 
+  // Descriptors of the (locked) files backing segments made by
+  // CreateFileBackedSegment, by prefixed name. Protected by the same lock as
+  // segment_bases_.
+  static SegmentFileMap* segment_files_;
+
   // Holds the number of times a PthreadSharedMem has been created.
   static size_t s_instance_count_;
   // Used to prefix segment names, so that when two runtimes are active at the
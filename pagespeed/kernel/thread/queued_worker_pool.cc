@@ -20,12 +20,15 @@
 
 #include <deque>
 #include <set>
+#include <utility>
 #include <vector>
 
 #include "base/logging.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/condvar.h"
 #include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/stl_util.h"
 #include "pagespeed/kernel/base/thread_annotations.h"
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/base/timer.h"
@@ -46,14 +49,130 @@ const size_t kUnboundedQueue = 0;
 
 }  // namespace
 
+// Runnable sequences waiting for a worker.  Sequences with a deadline are
+// kept in deadline order and run before untagged ones; the rest run oldest
+// first.  A sequence whose deadline has passed is demoted to the back of
+// the untagged ones, since whoever was waiting on it has given up.
+class QueuedWorkerPool::RunQueue {
+ public:
+  RunQueue() {}
+
+  bool empty() const { return urgent_.empty() && background_.empty(); }
+  size_t size() const { return urgent_.size() + background_.size(); }
+
+  void Push(Sequence* sequence, int64 deadline_ms) {
+    if (deadline_ms == kNoDeadline) {
+      background_.push_back(sequence);
+      return;
+    }
+    // Drivers mostly compute their deadlines with the same offset from
+    // now, so this nearly always inserts at the back.
+    UrgentQueue::iterator pos = urgent_.end();
+    while ((pos != urgent_.begin()) && ((pos - 1)->first > deadline_ms)) {
+      --pos;
+    }
+    urgent_.insert(pos, std::make_pair(deadline_ms, sequence));
+  }
+
+  // Returns the next sequence to run, or NULL if there is none.  Sets
+  // *promoted if it was one with a deadline that jumped ahead of older
+  // background work.
+  Sequence* Pop(Timer* timer, bool* promoted) {
+    DemoteStale(timer);
+    Sequence* sequence = NULL;
+    if (!urgent_.empty()) {
+      *promoted = !background_.empty();
+      sequence = urgent_.front().second;
+      urgent_.pop_front();
+    } else if (!background_.empty()) {
+      sequence = background_.front();
+      background_.pop_front();
+    }
+    return sequence;
+  }
+
+  // Removes and returns the sequence that is least worth running: one whose
+  // deadline has already passed, else the oldest background sequence, else
+  // the one with the earliest deadline.  Sets *stale in the first case.
+  // Must not be called when empty.
+  Sequence* Shed(Timer* timer, bool* stale) {
+    Sequence* sequence = NULL;
+    if (!urgent_.empty() && IsStale(timer, urgent_.front().first)) {
+      *stale = true;
+      sequence = urgent_.front().second;
+      urgent_.pop_front();
+    } else if (!background_.empty()) {
+      sequence = background_.front();
+      background_.pop_front();
+    } else {
+      sequence = urgent_.front().second;
+      urgent_.pop_front();
+    }
+    return sequence;
+  }
+
+ private:
+  typedef std::deque<std::pair<int64, Sequence*> > UrgentQueue;
+
+  static bool IsStale(Timer* timer, int64 deadline_ms) {
+    return (timer != NULL) && (deadline_ms < timer->NowMs());
+  }
+
+  void DemoteStale(Timer* timer) {
+    if (urgent_.empty() || (timer == NULL)) {
+      return;
+    }
+    int64 now_ms = timer->NowMs();
+    while (!urgent_.empty() && (urgent_.front().first < now_ms)) {
+      background_.push_back(urgent_.front().second);
+      urgent_.pop_front();
+    }
+  }
+
+  UrgentQueue urgent_;
+  std::deque<Sequence*> background_;
+
+  DISALLOW_COPY_AND_ASSIGN(RunQueue);
+};
+
+// A work-stealing worker's queue of runnable sequences.  Its owner and
+// thieves alike take the most urgent sequence first.
+class QueuedWorkerPool::WorkerQueue {
+ public:
+  WorkerQueue(int index, ThreadSystem* thread_system)
+      : index(index),
+        mutex(thread_system->NewMutex()),
+        worker(NULL),
+        steals(0),
+        idles(0) {
+  }
+
+  const int index;
+  scoped_ptr<AbstractMutex> mutex;
+  RunQueue sequences;     // Guarded by mutex.
+  QueuedWorker* worker;   // Guarded by the pool's mutex_.
+  int64 steals;           // Guarded by mutex.
+  int64 idles;            // Guarded by mutex.
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(WorkerQueue);
+};
+
 QueuedWorkerPool::QueuedWorkerPool(
     int max_workers, StringPiece thread_name_base, ThreadSystem* thread_system)
     : thread_system_(thread_system),
       mutex_(thread_system_->NewMutex()),
+      queued_sequences_(new RunQueue),
       max_workers_(max_workers),
       shutdown_(false),
       queue_size_(NULL),
-      load_shedding_threshold_(kNoLoadShedding) {
+      load_shedding_threshold_(kNoLoadShedding),
+      timer_(NULL),
+      deadline_promotions_(NULL),
+      stale_sheds_(NULL),
+      work_stealing_(false),
+      steal_count_(NULL),
+      idle_count_(NULL) {
   thread_name_base.CopyToString(&thread_name_base_);
 }
 
@@ -67,6 +186,7 @@ QueuedWorkerPool::~QueuedWorkerPool() {
     sequence->WaitForShutDown();
     delete sequence;
   }
+  STLDeleteElements(&worker_queues_);
 }
 
 void QueuedWorkerPool::ShutDown() {
@@ -169,19 +289,23 @@ QueuedWorkerPool::Sequence* QueuedWorkerPool::AssignWorkerToNextSequence(
   Sequence* sequence = NULL;
   ScopedMutex lock(mutex_.get());
   if (!shutdown_) {
-    if (queued_sequences_.empty()) {
+    if (queued_sequences_->empty()) {
       int erased = active_workers_.erase(worker);
       DCHECK_EQ(1, erased);
       available_workers_.push_back(worker);
     } else {
-      sequence = queued_sequences_.front();
-      queued_sequences_.pop_front();
+      sequence = PopSequence(queued_sequences_.get());
     }
   }
   return sequence;
 }
 
-void QueuedWorkerPool::QueueSequence(Sequence* sequence) {
+void QueuedWorkerPool::QueueSequence(Sequence* sequence, int64 deadline_ms) {
+  if (work_stealing_) {
+    QueueSequenceStealing(sequence, deadline_ms);
+    return;
+  }
+
   QueuedWorker* worker = NULL;
   Sequence* drop_sequence = NULL;
   {
@@ -198,15 +322,14 @@ void QueuedWorkerPool::QueueSequence(Sequence* sequence) {
         active_workers_.insert(worker);
       } else {
         // No workers available: must queue the sequence.
-        queued_sequences_.push_back(sequence);
+        queued_sequences_->Push(sequence, deadline_ms);
 
-        // If too many sequences are waiting, we will cancel the oldest
-        // waiting one.
+        // If too many sequences are waiting, we will cancel the one least
+        // worth running: a stale one, else the oldest.
         if ((load_shedding_threshold_ != kNoLoadShedding) &&
-            (queued_sequences_.size() >
+            (queued_sequences_->size() >
              static_cast<size_t>(load_shedding_threshold_))) {
-          drop_sequence = queued_sequences_.front();
-          queued_sequences_.pop_front();
+          drop_sequence = ShedSequence(queued_sequences_.get());
         }
       }
     } else {
@@ -230,6 +353,217 @@ void QueuedWorkerPool::QueueSequence(Sequence* sequence) {
   }
 }
 
+void QueuedWorkerPool::set_work_stealing(bool x) {
+  ScopedMutex lock(mutex_.get());
+  DCHECK(active_workers_.empty() && available_workers_.empty())
+      << "set_work_stealing must be called before starting any work";
+  work_stealing_ = x;
+  if (work_stealing_ && worker_queues_.empty()) {
+    for (size_t i = 0; i < max_workers_; ++i) {
+      worker_queues_.push_back(new WorkerQueue(i, thread_system_));
+    }
+  }
+}
+
+void QueuedWorkerPool::GetWorkerStats(std::vector<WorkerStats>* stats) {
+  stats->clear();
+  for (int i = 0, n = worker_queues_.size(); i < n; ++i) {
+    WorkerQueue* queue = worker_queues_[i];
+    ScopedMutex lock(queue->mutex.get());
+    WorkerStats worker_stats;
+    worker_stats.steals = queue->steals;
+    worker_stats.idles = queue->idles;
+    stats->push_back(worker_stats);
+  }
+}
+
+// Like Run, but once the sequence is exhausted the worker takes the next
+// one from its own queue, or steals one, and only takes the pool's mutex
+// when it finds no work.  sequence may be NULL if the worker was woken
+// to steal.
+void QueuedWorkerPool::RunStealing(Sequence* sequence, WorkerQueue* queue) {
+  if (sequence == NULL) {
+    sequence = NextSequenceStealing(queue);
+  }
+  while (sequence != NULL) {
+    while (Function* function = sequence->NextFunction()) {
+      function->CallRun();
+    }
+    sequence = NextSequenceStealing(queue);
+  }
+}
+
+QueuedWorkerPool::Sequence* QueuedWorkerPool::NextSequenceStealing(
+    WorkerQueue* queue) {
+  Sequence* sequence = TakeOrStealSequence(queue);
+  if (sequence != NULL) {
+    return sequence;
+  }
+
+  ScopedMutex lock(mutex_.get());
+  if (shutdown_) {
+    return NULL;
+  }
+
+  // Announce that we are going idle before looking at the queues one last
+  // time.  PushSequence reads num_idle_workers_ with the queue's mutex held,
+  // so a sequence pushed concurrently is either found here, or its pusher
+  // sees us idle and wakes us, which it must take mutex_ to do.
+  num_idle_workers_.BarrierIncrement(1);
+  sequence = TakeOrStealSequence(queue);
+  if (sequence != NULL) {
+    num_idle_workers_.BarrierIncrement(-1);
+    return sequence;
+  }
+  int erased = active_workers_.erase(queue->worker);
+  DCHECK_EQ(1, erased);
+  available_workers_.push_back(queue->worker);
+  {
+    ScopedMutex queue_lock(queue->mutex.get());
+    ++queue->idles;
+  }
+  if (idle_count_ != NULL) {
+    idle_count_->Add(1);
+  }
+  return NULL;
+}
+
+QueuedWorkerPool::Sequence* QueuedWorkerPool::TakeOrStealSequence(
+    WorkerQueue* queue) {
+  Sequence* sequence = NULL;
+  {
+    ScopedMutex lock(queue->mutex.get());
+    sequence = PopSequence(&queue->sequences);
+  }
+  if (sequence == NULL) {
+    // Look for work on the other queues, starting with the next one so that
+    // idle workers don't all converge on the same victim.
+    for (int i = 1, n = worker_queues_.size(); (i < n) && (sequence == NULL);
+         ++i) {
+      WorkerQueue* victim = worker_queues_[(queue->index + i) % n];
+      ScopedMutex lock(victim->mutex.get());
+      sequence = PopSequence(&victim->sequences);
+    }
+    if (sequence != NULL) {
+      {
+        ScopedMutex lock(queue->mutex.get());
+        ++queue->steals;
+      }
+      if (steal_count_ != NULL) {
+        steal_count_->Add(1);
+      }
+    }
+  }
+  if (sequence != NULL) {
+    num_queued_sequences_.NoBarrierIncrement(-1);
+  }
+  return sequence;
+}
+
+void QueuedWorkerPool::QueueSequenceStealing(Sequence* sequence,
+                                             int64 deadline_ms) {
+  QueuedWorker* worker = NULL;
+  WorkerQueue* worker_queue = NULL;
+  Sequence* drop_sequence = NULL;
+  if ((num_idle_workers_.value() > 0) ||
+      (num_started_workers_.value() < static_cast<int32>(max_workers_))) {
+    // There may be a worker free to take the sequence directly, as in
+    // QueueSequence.  If not, no worker can go idle until we release
+    // mutex_, and any that does will then find the sequence.
+    ScopedMutex lock(mutex_.get());
+    worker = ClaimWorkerMutexHeld(&worker_queue);
+    if (worker == NULL) {
+      PushSequence(sequence, deadline_ms, &drop_sequence);
+    }
+  } else if (PushSequence(sequence, deadline_ms, &drop_sequence)) {
+    // A worker went idle without seeing the sequence; wake it up to steal.
+    ScopedMutex lock(mutex_.get());
+    worker = ClaimWorkerMutexHeld(&worker_queue);
+    sequence = NULL;
+  }
+
+  if (drop_sequence != NULL) {
+    drop_sequence->Cancel();
+  }
+
+  // Run the worker without holding the Pool lock.
+  if (worker != NULL) {
+    worker->RunInWorkThread(
+        new MemberFunction2<QueuedWorkerPool, QueuedWorkerPool::Sequence*,
+                            WorkerQueue*>(
+            &QueuedWorkerPool::RunStealing, this, sequence, worker_queue));
+  }
+}
+
+QueuedWorker* QueuedWorkerPool::ClaimWorkerMutexHeld(WorkerQueue** queue) {
+  QueuedWorker* worker = NULL;
+  if (shutdown_) {
+    return NULL;
+  }
+  if (!available_workers_.empty()) {
+    worker = available_workers_.back();
+    available_workers_.pop_back();
+    num_idle_workers_.BarrierIncrement(-1);
+    for (int i = 0, n = worker_queues_.size(); i < n; ++i) {
+      if (worker_queues_[i]->worker == worker) {
+        *queue = worker_queues_[i];
+        break;
+      }
+    }
+  } else {
+    int index = num_started_workers_.value();
+    if (index >= static_cast<int>(max_workers_)) {
+      return NULL;
+    }
+    worker = new QueuedWorker(
+        StrCat(thread_name_base_, "-", IntegerToString(index)),
+        thread_system_);
+    worker->Start();
+    *queue = worker_queues_[index];
+    (*queue)->worker = worker;
+    num_started_workers_.BarrierIncrement(1);
+  }
+  active_workers_.insert(worker);
+  return worker;
+}
+
+bool QueuedWorkerPool::PushSequence(Sequence* sequence, int64 deadline_ms,
+                                    Sequence** drop_sequence) {
+  // Deal sequences out round-robin; idle workers will steal to even out any
+  // imbalance.
+  uint32 next = static_cast<uint32>(next_queue_.NoBarrierIncrement(1));
+  WorkerQueue* queue = worker_queues_[next % worker_queues_.size()];
+  ScopedMutex lock(queue->mutex.get());
+  queue->sequences.Push(sequence, deadline_ms);
+  int32 num_queued = num_queued_sequences_.BarrierIncrement(1);
+  if ((load_shedding_threshold_ != kNoLoadShedding) &&
+      (num_queued > load_shedding_threshold_)) {
+    // The central queue sheds from all the sequences in the pool; shedding
+    // from this queue is a close and much cheaper approximation.
+    *drop_sequence = ShedSequence(&queue->sequences);
+    num_queued_sequences_.NoBarrierIncrement(-1);
+  }
+  return num_idle_workers_.value() > 0;
+}
+
+QueuedWorkerPool::Sequence* QueuedWorkerPool::PopSequence(RunQueue* queue) {
+  bool promoted = false;
+  Sequence* sequence = queue->Pop(timer_, &promoted);
+  if (promoted && (deadline_promotions_ != NULL)) {
+    deadline_promotions_->Add(1);
+  }
+  return sequence;
+}
+
+QueuedWorkerPool::Sequence* QueuedWorkerPool::ShedSequence(RunQueue* queue) {
+  bool stale = false;
+  Sequence* sequence = queue->Shed(timer_, &stale);
+  if (stale && (stale_sheds_ != NULL)) {
+    stale_sheds_->Add(1);
+  }
+  return sequence;
+}
+
 bool QueuedWorkerPool::AreBusy(const SequenceSet& sequences)
     NO_THREAD_SAFETY_ANALYSIS {
   // This is the only operation that accesses multiple workers at once.
@@ -310,6 +644,7 @@ QueuedWorkerPool::Sequence::Sequence(ThreadSystem* thread_system,
 void QueuedWorkerPool::Sequence::Reset() {
   shutdown_ = false;
   active_ = false;
+  deadline_ms_ = kNoDeadline;
   DCHECK(work_queue_.empty());
 }
 
@@ -373,6 +708,7 @@ void QueuedWorkerPool::Sequence::Cancel() {
 void QueuedWorkerPool::Sequence::Add(Function* function) {
   bool queue_sequence = false;
   bool cancel = false;
+  int64 deadline_ms = kNoDeadline;
   {
     ScopedMutex lock(sequence_mutex_.get());
     if (shutdown_) {
@@ -395,13 +731,14 @@ void QueuedWorkerPool::Sequence::Add(Function* function) {
 
       work_queue_.push_back(function_to_add);
       queue_sequence = (!active_ && (work_queue_.size() == 1));
+      deadline_ms = deadline_ms_;
     }
   }
   if (cancel) {
     function->CallCancel();
   }
   if (queue_sequence) {
-    pool_->QueueSequence(this);
+    pool_->QueueSequence(this, deadline_ms);
   }
   UpdateWaveform(queue_size_, cancel ? 0 : 1);
 }
@@ -420,6 +757,11 @@ void QueuedWorkerPool::Sequence::CancelPendingFunctions() {
   }
 }
 
+void QueuedWorkerPool::Sequence::set_deadline_ms(int64 deadline_ms) {
+  ScopedMutex lock(sequence_mutex_.get());
+  deadline_ms_ = deadline_ms;
+}
+
 Function* QueuedWorkerPool::Sequence::NextFunction() {
   Function* function = NULL;
   QueuedWorkerPool* release_to_pool = NULL;
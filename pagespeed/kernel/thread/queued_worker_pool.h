@@ -21,6 +21,18 @@
 //
 // This differs from QueuedWorker, which always uses exactly one thread.
 // In this interface, any task can be assigned to any thread.
+//
+// By default, runnable sequences wait in a single queue guarded by the
+// pool's mutex.  With set_work_stealing(true), each worker instead has its
+// own queue of runnable sequences, and a worker that runs out of work steals
+// from the others, so busy workers hand off sequences without contending on
+// a central lock.  Either way a Sequence runs on at most one worker at a
+// time, so its functions still run in the order they were added.
+//
+// A Sequence may also carry a deadline, marking it as work that a request
+// is waiting on.  Runnable sequences with a deadline are started ahead of
+// untagged background work, and once the deadline passes they lose that
+// priority and are the first to be shed under load.
 
 #ifndef PAGESPEED_KERNEL_THREAD_QUEUED_WORKER_POOL_H_
 #define PAGESPEED_KERNEL_THREAD_QUEUED_WORKER_POOL_H_
@@ -30,6 +42,7 @@
 #include <set>
 #include <vector>
 
+#include "pagespeed/kernel/base/atomic_int32.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
@@ -42,6 +55,8 @@ namespace net_instaweb {
 
 class AbstractMutex;
 class QueuedWorker;
+class Timer;
+class Variable;
 class Waveform;
 
 // Maintains a predefined number of worker threads, and dispatches any
@@ -49,6 +64,7 @@ class Waveform;
 class QueuedWorkerPool {
  public:
   static const int kNoLoadShedding = -1;
+  static const int64 kNoDeadline = -1;
 
   QueuedWorkerPool(int max_workers, StringPiece thread_name_base,
                    ThreadSystem* thread_system);
@@ -108,6 +124,13 @@ class QueuedWorkerPool {
     // Calls Cancel on all pending functions in the queue.
     void CancelPendingFunctions() LOCKS_EXCLUDED(sequence_mutex_);
 
+    // Tags the sequence as doing work that is wanted by deadline_ms, in
+    // terms of the pool's timer (see QueuedWorkerPool::set_timer), or
+    // untags it if deadline_ms == kNoDeadline.  The tag is read when the
+    // sequence becomes runnable, so it should be set before adding the
+    // functions it is meant to expedite.
+    void set_deadline_ms(int64 deadline_ms) LOCKS_EXCLUDED(sequence_mutex_);
+
    private:
     // Construct using QueuedWorkerPool::NewSequence().
     Sequence(ThreadSystem* thread_system, QueuedWorkerPool* pool);
@@ -152,6 +175,7 @@ class QueuedWorkerPool {
     scoped_ptr<ThreadSystem::Condvar> termination_condvar_;
     Waveform* queue_size_;
     size_t max_queue_size_;
+    int64 deadline_ms_ GUARDED_BY(sequence_mutex_);
 
     DISALLOW_COPY_AND_ASSIGN(Sequence);
   };
@@ -200,10 +224,25 @@ class QueuedWorkerPool {
   //    queue.
   static bool AreBusy(const SequenceSet& sequences);
 
+  // Counts kept for each worker of a work-stealing pool.
+  struct WorkerStats {
+    int64 steals;  // Sequences taken from another worker's queue.
+    int64 idles;   // Times the worker went idle for lack of work.
+  };
+
+  // Enables per-worker queues with work stealing.  Must be called before
+  // starting any work.
+  void set_work_stealing(bool x);
+  bool work_stealing() const { return work_stealing_; }
+
+  // Fills stats with the counts for each worker slot of a work-stealing
+  // pool, whether or not its thread has been started yet.
+  void GetWorkerStats(std::vector<WorkerStats>* stats);
+
   // If x == kNoLoadShedding disables load-shedding.
   // Otherwise, if more than x sequences are queued waiting to run,
-  // sequences will start getting dropped and canceled, with oldest
-  // sequences canceled first.
+  // sequences will start getting dropped and canceled, with those whose
+  // deadline has passed canceled first, then the oldest.
   //
   // Precondition: x > 0 || x == kNoLoadShedding
   // x = kNoLoadShedding (the default) disables the limit.
@@ -216,13 +255,58 @@ class QueuedWorkerPool {
   // This must be called prior to creating sequences.
   void set_queue_size_stat(Waveform* x) { queue_size_ = x; }
 
+  // Sets up counters, summed across a work-stealing pool's workers, of
+  // steals and of workers going idle; see WorkerStats.  Either may be NULL.
+  //
+  // This must be called prior to creating sequences.
+  void set_steal_count_stat(Variable* x) { steal_count_ = x; }
+  void set_idle_count_stat(Variable* x) { idle_count_ = x; }
+
+  // Sets the timer against which sequence deadlines are checked.  Without
+  // one, sequences with deadlines are still run first, but never become
+  // stale.
+  void set_timer(Timer* x) { timer_ = x; }
+
+  // Sets up counters of sequences with deadlines that were started ahead of
+  // older background work, and of sequences shed because their deadline
+  // had already passed.  Either may be NULL.
+  //
+  // This must be called prior to creating sequences.
+  void set_deadline_promotion_stat(Variable* x) { deadline_promotions_ = x; }
+  void set_stale_shed_stat(Variable* x) { stale_sheds_ = x; }
+
  private:
   friend class Sequence;
+  class RunQueue;
+  class WorkerQueue;
+  typedef std::vector<WorkerQueue*> WorkerQueueVector;
+
   void Run(Sequence* sequence, QueuedWorker* worker);
-  void QueueSequence(Sequence* sequence);
+  void QueueSequence(Sequence* sequence, int64 deadline_ms);
   Sequence* AssignWorkerToNextSequence(QueuedWorker* worker);
   void SequenceNoLongerActive(Sequence* sequence);
 
+  // Work-stealing counterparts of the above.
+  void RunStealing(Sequence* sequence, WorkerQueue* queue);
+  void QueueSequenceStealing(Sequence* sequence, int64 deadline_ms);
+  Sequence* NextSequenceStealing(WorkerQueue* queue);
+  Sequence* TakeOrStealSequence(WorkerQueue* queue);
+  // Returns an idle worker, or starts a new one if we have not reached
+  // max_workers_, setting *queue to its queue.  Returns NULL if all the
+  // workers are busy.
+  QueuedWorker* ClaimWorkerMutexHeld(WorkerQueue** queue)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Puts sequence on the next worker queue in turn, setting *drop_sequence
+  // if that sheds load.  Returns true if a worker is idle and so must be
+  // woken to run it.
+  bool PushSequence(Sequence* sequence, int64 deadline_ms,
+                    Sequence** drop_sequence);
+
+  // Takes the next sequence to run from queue, or sheds one from it,
+  // counting the outcome in the deadline stats.
+  Sequence* PopSequence(RunQueue* queue);
+  Sequence* ShedSequence(RunQueue* queue);
+
   ThreadSystem* thread_system_;
   scoped_ptr<AbstractMutex> mutex_;
 
@@ -233,7 +317,7 @@ class QueuedWorkerPool {
   // queued_sequences_ and free_sequences_ are mutually exclusive, but
   // all_sequences contains all of them.
   std::vector<Sequence*> all_sequences_;
-  std::deque<Sequence*> queued_sequences_;
+  scoped_ptr<RunQueue> queued_sequences_;
   std::vector<Sequence*> free_sequences_;
 
   GoogleString thread_name_base_;
@@ -244,6 +328,24 @@ class QueuedWorkerPool {
   Waveform* queue_size_;
   int load_shedding_threshold_;
 
+  Timer* timer_;
+  Variable* deadline_promotions_;
+  Variable* stale_sheds_;
+
+  // Work-stealing state.  worker_queues_ has a slot for each of the
+  // max_workers_ workers, and is fixed once work starts.  The worker counts
+  // are only written with mutex_ held, but are read without it to decide
+  // whether a queued sequence needs to wake a worker.  The queued-sequence
+  // count, used for load shedding, is kept across all the queues.
+  bool work_stealing_;
+  WorkerQueueVector worker_queues_;
+  AtomicInt32 num_started_workers_;
+  AtomicInt32 num_idle_workers_;
+  AtomicInt32 num_queued_sequences_;
+  AtomicInt32 next_queue_;
+  Variable* steal_count_;
+  Variable* idle_count_;
+
   DISALLOW_COPY_AND_ASSIGN(QueuedWorkerPool);
 };
 
@@ -19,12 +19,19 @@
 
 #include "pagespeed/kernel/thread/queued_worker_pool.h"
 
+#include <vector>
+
 #include "base/logging.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/mock_timer.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/thread/worker_test_base.h"
+#include "pagespeed/kernel/util/simple_stats.h"
 
 namespace net_instaweb {
 namespace {
@@ -78,6 +85,24 @@ class Increment : public Function {
   DISALLOW_COPY_AND_ASSIGN(Increment);
 };
 
+// Appends its index to a sequence's log when run.
+class RecordOrder : public Function {
+ public:
+  RecordOrder(int index, std::vector<int>* order)
+      : index_(index),
+        order_(order) {
+  }
+
+ protected:
+  virtual void Run() { order_->push_back(index_); }
+
+ private:
+  int index_;
+  std::vector<int>* order_;
+
+  DISALLOW_COPY_AND_ASSIGN(RecordOrder);
+};
+
 // Tests that all the jobs queued in one sequence should run sequentially.
 TEST_F(QueuedWorkerPoolTest, BasicOperation) {
   const int kBound = 42;
@@ -328,6 +353,300 @@ TEST_F(QueuedWorkerPoolTest, CancelPending) {
   EXPECT_EQ(-300, count);
 }
 
+// Appends a label to a string when run, or the label prefixed with '~'
+// when canceled.  The sequences in these tests share one worker, so the
+// appends are serialized.
+class AppendFunction : public Function {
+ public:
+  AppendFunction(StringPiece label, GoogleString* out)
+      : label_(label.data(), label.size()), out_(out) {}
+
+ protected:
+  virtual void Run() { StrAppend(out_, label_); }
+  virtual void Cancel() { StrAppend(out_, "~", label_); }
+
+ private:
+  GoogleString label_;
+  GoogleString* out_;
+
+  DISALLOW_COPY_AND_ASSIGN(AppendFunction);
+};
+
+class QueuedWorkerPoolDeadlineTest : public QueuedWorkerPoolTest {
+ protected:
+  QueuedWorkerPoolDeadlineTest()
+      : timer_(thread_runtime_->NewMutex(), 0),
+        stats_(thread_runtime_.get()),
+        promotions_(stats_.AddVariable("deadline_promotions")),
+        stale_sheds_(stats_.AddVariable("stale_sheds")),
+        wedge_sync_(thread_runtime_.get()) {
+  }
+
+  // Replaces the pool with a single-worker one, so that the order in which
+  // queued sequences run is deterministic, and wedges that worker.
+  void SetUpWedgedPool(bool work_stealing) {
+    worker_.reset(new QueuedWorkerPool(1, "deadline_test",
+                                       thread_runtime_.get()));
+    worker_->set_work_stealing(work_stealing);
+    worker_->set_timer(&timer_);
+    worker_->set_deadline_promotion_stat(promotions_);
+    worker_->set_stale_shed_stat(stale_sheds_);
+    QueuedWorkerPool::Sequence* wedge = worker_->NewSequence();
+    wedge->Add(new WaitRunFunction(&wedge_sync_));
+  }
+
+  // Queues a sequence that appends label, tagged with deadline_ms.
+  QueuedWorkerPool::Sequence* QueueLabel(StringPiece label,
+                                         int64 deadline_ms) {
+    QueuedWorkerPool::Sequence* sequence = worker_->NewSequence();
+    sequence->set_deadline_ms(deadline_ms);
+    sequence->Add(new AppendFunction(label, &order_));
+    return sequence;
+  }
+
+  // Releases the wedged worker, and waits until an untagged sequence
+  // queued after all the others has run.
+  void RunQueued() {
+    QueuedWorkerPool::Sequence* last = worker_->NewSequence();
+    SyncPoint done(thread_runtime_.get());
+    last->Add(new NotifyRunFunction(&done));
+    wedge_sync_.Notify();
+    done.Wait();
+  }
+
+  void TestDeadlineOrder(bool work_stealing) {
+    SetUpWedgedPool(work_stealing);
+    QueueLabel("a", QueuedWorkerPool::kNoDeadline);
+    QueueLabel("b", 100);
+    QueueLabel("c", QueuedWorkerPool::kNoDeadline);
+    QueueLabel("d", 50);
+    RunQueued();
+    EXPECT_EQ("dbac", order_);
+    EXPECT_EQ(2, promotions_->Get());
+  }
+
+  MockTimer timer_;
+  SimpleStats stats_;
+  Variable* promotions_;
+  Variable* stale_sheds_;
+  SyncPoint wedge_sync_;
+  GoogleString order_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(QueuedWorkerPoolDeadlineTest);
+};
+
+// Sequences with deadlines run earliest deadline first, ahead of older
+// background sequences, which run in the order they were queued.
+TEST_F(QueuedWorkerPoolDeadlineTest, DeadlineSequencesRunFirst) {
+  TestDeadlineOrder(false);
+}
+
+TEST_F(QueuedWorkerPoolDeadlineTest, DeadlineSequencesRunFirstStealing) {
+  TestDeadlineOrder(true);
+}
+
+// Once its deadline passes, a sequence waits behind the background work.
+TEST_F(QueuedWorkerPoolDeadlineTest, StaleSequencesAreDemoted) {
+  SetUpWedgedPool(false);
+  QueuedWorkerPool::Sequence* a = QueueLabel("a", 10);
+  QueueLabel("b", QueuedWorkerPool::kNoDeadline);
+  timer_.SetTimeMs(20);
+  // a is demoted behind RunQueued's own sequence too.
+  RunQueued();
+  WaitUntilSequenceCompletes(a);
+  EXPECT_EQ("ba", order_);
+  EXPECT_EQ(0, promotions_->Get());
+}
+
+// Under load, a stale sequence is shed before the oldest background one.
+TEST_F(QueuedWorkerPoolDeadlineTest, StaleSequencesAreShedFirst) {
+  SetUpWedgedPool(false);
+  worker_->SetLoadSheddingThreshold(4);
+  QueueLabel("a", QueuedWorkerPool::kNoDeadline);
+  QueueLabel("b", 10);
+  timer_.SetTimeMs(20);
+  QueueLabel("c", 100);
+  QueueLabel("d", QueuedWorkerPool::kNoDeadline);
+  QueueLabel("e", QueuedWorkerPool::kNoDeadline);  // Sheds b.
+  // The sequence RunQueued adds to wait for the others then sheds a, the
+  // oldest background sequence, as c is not stale.
+  RunQueued();
+  EXPECT_EQ("~b~acde", order_);
+  EXPECT_EQ(1, stale_sheds_->Get());
+}
+
+// Runs the same kind of work through a work-stealing pool.
+class QueuedWorkerPoolStealingTest : public QueuedWorkerPoolTest {
+ public:
+  QueuedWorkerPoolStealingTest() {
+    worker_.reset(new QueuedWorkerPool(4, "stealing_worker_pool_test",
+                                       thread_runtime_.get()));
+    worker_->set_work_stealing(true);
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(QueuedWorkerPoolStealingTest);
+};
+
+TEST_F(QueuedWorkerPoolStealingTest, BasicOperation) {
+  const int kBound = 42;
+  int count = 0;
+  SyncPoint sync(thread_runtime_.get());
+
+  QueuedWorkerPool::Sequence* sequence = worker_->NewSequence();
+  for (int i = 0; i < kBound; ++i) {
+    sequence->Add(new Increment(i + 1, &count));
+  }
+
+  sequence->Add(new NotifyRunFunction(&sync));
+  sync.Wait();
+  EXPECT_EQ(kBound, count);
+  worker_->FreeSequence(sequence);
+}
+
+TEST_F(QueuedWorkerPoolStealingTest, SlowAndFastSequences) {
+  const int kBound = 42;
+  int count = 0;
+  SyncPoint sync(thread_runtime_.get());
+  SyncPoint wait(thread_runtime_.get());
+
+  QueuedWorkerPool::Sequence* slow_sequence = worker_->NewSequence();
+  slow_sequence->Add(new WaitRunFunction(&wait));
+  slow_sequence->Add(new NotifyRunFunction(&sync));
+
+  QueuedWorkerPool::Sequence* fast_sequence = worker_->NewSequence();
+  for (int i = 0; i < kBound; ++i) {
+    fast_sequence->Add(new Increment(i + 1, &count));
+  }
+  fast_sequence->Add(new NotifyRunFunction(&wait));
+
+  sync.Wait();
+  EXPECT_EQ(kBound, count);
+  worker_->FreeSequence(fast_sequence);
+  worker_->FreeSequence(slow_sequence);
+}
+
+TEST_F(QueuedWorkerPoolStealingTest, RestartSequenceFromFunction) {
+  SyncPoint sync(thread_runtime_.get());
+  QueuedWorkerPool::Sequence* sequence = worker_->NewSequence();
+  sequence->Add(new MakeNewSequence(&sync, worker_.get(), sequence));
+  sync.Wait();
+}
+
+TEST_F(QueuedWorkerPoolStealingTest, AddAfterShutDown) {
+  QueuedWorkerPool::Sequence* sequence = worker_->NewSequence();
+  worker_->ShutDown();
+  LogOpsFunction f;
+  sequence->Add(&f);
+  worker_.reset(NULL);
+  EXPECT_TRUE(f.cancel_called());
+  EXPECT_FALSE(f.run_called());
+}
+
+// Queues many sequences while one worker is wedged.  Sequences are dealt
+// round-robin, so some land on the wedged worker's queue and can only run if
+// the other workers steal them.  Each sequence must still run its functions
+// in the order they were added.
+TEST_F(QueuedWorkerPoolStealingTest, ManySequencesKeepOrder) {
+  const int kNumSequences = 64;
+  const int kNumFunctions = 50;
+  std::vector<QueuedWorkerPool::Sequence*> sequences;
+  std::vector<std::vector<int> > orders(kNumSequences);
+
+  // The first sequence gets a worker of its own, which stays wedged until
+  // every other sequence has completed.
+  SyncPoint wedge_sync(thread_runtime_.get());
+  QueuedWorkerPool::Sequence* wedge = worker_->NewSequence();
+  wedge->Add(new WaitRunFunction(&wedge_sync));
+
+  for (int i = 0; i < kNumSequences; ++i) {
+    sequences.push_back(worker_->NewSequence());
+  }
+  for (int j = 0; j < kNumFunctions; ++j) {
+    for (int i = 0; i < kNumSequences; ++i) {
+      sequences[i]->Add(new RecordOrder(j, &orders[i]));
+    }
+  }
+
+  std::vector<int> expected_order;
+  for (int j = 0; j < kNumFunctions; ++j) {
+    expected_order.push_back(j);
+  }
+  for (int i = 0; i < kNumSequences; ++i) {
+    WaitUntilSequenceCompletes(sequences[i]);
+    EXPECT_EQ(expected_order, orders[i]) << "sequence " << i;
+    worker_->FreeSequence(sequences[i]);
+  }
+
+  // The sequences queued behind the wedge were all stolen.
+  std::vector<QueuedWorkerPool::WorkerStats> stats;
+  worker_->GetWorkerStats(&stats);
+  ASSERT_EQ(4, stats.size());
+  int64 steals = 0;
+  for (int i = 0, n = stats.size(); i < n; ++i) {
+    steals += stats[i].steals;
+  }
+  EXPECT_LT(0, steals);
+
+  wedge_sync.Notify();
+  WaitUntilSequenceCompletes(wedge);
+  worker_->FreeSequence(wedge);
+}
+
+TEST_F(QueuedWorkerPoolStealingTest, LoadShedding) {
+  const int kThresh = 100;
+  worker_.reset(new QueuedWorkerPool(2, "stealing_worker_pool_test",
+                                     thread_runtime_.get()));
+  worker_->set_work_stealing(true);
+  worker_->SetLoadSheddingThreshold(kThresh);
+
+  // As in QueuedWorkerPoolTest.LoadShedding, wedge both workers and then
+  // queue 2*kThresh sequences behind them, plus one to notify us.  Load is
+  // shed from each worker's own queue, so it is only approximately oldest
+  // first, but exactly as many sequences are dropped.
+  SyncPoint wedge1_sync(thread_runtime_.get());
+  SyncPoint wedge2_sync(thread_runtime_.get());
+  QueuedWorkerPool::Sequence* wedge1 = worker_->NewSequence();
+  wedge1->Add(new WaitRunFunction(&wedge1_sync));
+  QueuedWorkerPool::Sequence* wedge2 = worker_->NewSequence();
+  wedge2->Add(new WaitRunFunction(&wedge2_sync));
+
+  std::vector<QueuedWorkerPool::Sequence*> log_ops;
+  std::vector<LogOpsFunction*> log_ops_functions;
+  for (int i = 0; i < 2 * kThresh; ++i) {
+    LogOpsFunction* fn = new LogOpsFunction;
+    QueuedWorkerPool::Sequence* log_op = worker_->NewSequence();
+    log_op->Add(fn);
+    log_ops.push_back(log_op);
+    log_ops_functions.push_back(fn);
+  }
+
+  SyncPoint done_sync(thread_runtime_.get());
+  QueuedWorkerPool::Sequence* done = worker_->NewSequence();
+  done->Add(new NotifyRunFunction(&done_sync));
+
+  wedge1_sync.Notify();
+  wedge2_sync.Notify();
+  done_sync.Wait();
+  worker_->ShutDown();
+
+  worker_->FreeSequence(wedge1);
+  worker_->FreeSequence(wedge2);
+  int num_canceled = 0;
+  for (int i = 0; i < 2 * kThresh; ++i) {
+    EXPECT_NE(log_ops_functions[i]->cancel_called(),
+              log_ops_functions[i]->run_called());
+    if (log_ops_functions[i]->cancel_called()) {
+      ++num_canceled;
+    }
+    delete log_ops_functions[i];
+    worker_->FreeSequence(log_ops[i]);
+  }
+  EXPECT_EQ(kThresh + 1, num_canceled);
+  worker_->FreeSequence(done);
+}
+
 }  // namespace
 
 }  // namespace net_instaweb
@@ -19,6 +19,7 @@
 
 #include <algorithm>
 #include <set>
+#include <vector>
 
 #include "base/logging.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
@@ -35,6 +36,32 @@ namespace {
 
 const int kIndexNotSet = 0;
 
+// Geometry of the alarm wheel.  Alarm times are bucketed into ticks of
+// 2^kTickShift us (about a millisecond), and each of kLevels levels has
+// kSlots slots, each slot spanning kSlots slots of the level below.  Level 0
+// thus covers the next 65ms at tick resolution, level 1 the next 4s, level 2
+// the next 4.5 minutes and level 3 the next 4.8 hours; alarms further out
+// wait in an overflow list.
+const int kTickShift = 10;
+const int kSlotBits = 6;
+const int kSlots = 1 << kSlotBits;
+const int kLevels = 4;
+const int kNumBuckets = kLevels * kSlots + 1;  // The extra one is overflow.
+const int kOverflowBucket = kLevels * kSlots;
+const int kNotQueued = -2;
+const int kReady = -1;
+const int kNoBucket = -1;
+
+inline int64 TickForUs(int64 time_us) {
+  return time_us >> kTickShift;
+}
+
+// Index of the lowest set bit of a non-zero bitmap.
+inline int LowestBit(uint64 bits) {
+  DCHECK_NE(0U, bits);
+  return __builtin_ctzll(bits);
+}
+
 }  // namespace
 
 // Basic Alarm type (forward declared in the .h file).  Note that Alarms are
@@ -74,14 +101,25 @@ class Scheduler::Alarm {
  protected:
   Alarm() : wakeup_time_us_(0),
             index_(kIndexNotSet),
+            bucket_(kNotQueued),
+            bucket_prev_(NULL),
+            bucket_next_(NULL),
             in_wait_dispatch_(false) { }
   virtual ~Alarm() { }
 
  private:
   friend class Scheduler;
+  friend class Scheduler::AlarmWheel;
   int64 wakeup_time_us_;
   uint32 index_;  // Set by scheduler to disambiguate equal wakeup times.
 
+  // Where the alarm is in the AlarmWheel: a bucket index, kReady, or
+  // kNotQueued.  Alarms in a bucket, or in the ready list, are linked through
+  // bucket_prev_ and bucket_next_.
+  int bucket_;
+  Alarm* bucket_prev_;
+  Alarm* bucket_next_;
+
   // This is used to mark a wait alarm that's being considered by ::Signal
   // as owned by it for purposes of cleanup, so any concurrent timeout will
   // know not to delete it.
@@ -198,12 +236,404 @@ bool Scheduler::CompareAlarms::operator()(const Alarm* a,
   return a->Compare(b) < 0;
 }
 
+// A hierarchical timing wheel holding the outstanding alarms, in the style
+// of Varghese & Lauck.  Each alarm is linked into the bucket for its tick,
+// at the finest level of the wheel that still distinguishes it from the
+// wheel's cursor, so adding or removing one never looks at any other.  As
+// the cursor advances, the buckets for each coarser slot it reaches are
+// redistributed among the finer levels, and the alarms in each level-0 slot
+// it passes are sorted, together, and appended to an ordered list of ready
+// alarms.  Finding the earliest alarm still in the wheel sorts the first
+// occupied bucket, which then stays sorted as its alarms are removed, so
+// that cancelling alarms in deadline order doesn't search it again each
+// time.
+//
+// Invariants: every alarm in the ready list is due at a tick before
+// cursor_, and every alarm in the wheel at cursor_ or later, so the head of
+// the ready list is the earliest alarm of all.  An alarm at level L > 0
+// shares all the digits of cursor_ above L, and has a larger digit at L;
+// one at level 0 shares all but the last digit, which is no smaller.
+class Scheduler::AlarmWheel {
+ public:
+  explicit AlarmWheel(Timer* timer)
+      : timer_(timer),
+        cursor_(0),
+        ready_head_(NULL),
+        ready_tail_(NULL),
+        num_in_wheel_(0),
+        wheel_earliest_(NULL),
+        sorted_bucket_(kNoBucket),
+        sorted_tail_(NULL) {
+    for (int i = 0; i < kNumBuckets; ++i) {
+      buckets_[i] = NULL;
+    }
+    for (int i = 0; i < kLevels; ++i) {
+      occupied_[i] = 0;
+    }
+  }
+
+  bool empty() const {
+    return (ready_head_ == NULL) && (num_in_wheel_ == 0);
+  }
+
+  void Insert(Alarm* alarm) {
+    DCHECK_EQ(kNotQueued, alarm->bucket_);
+    if (empty()) {
+      // Start the cursor at the current time rather than wherever it was
+      // left, so that alarms land in the levels that match how far off they
+      // are.  Starting it at the alarm instead would put every later alarm
+      // due before it into the ready set.
+      cursor_ = TickForUs(timer_->NowUs());
+    }
+    bool wheel_was_empty = (num_in_wheel_ == 0);
+    Place(alarm);
+    if (alarm->bucket_ != kReady) {
+      if (wheel_was_empty) {
+        wheel_earliest_ = alarm;
+      } else if ((wheel_earliest_ != NULL) &&
+                 (alarm->Compare(wheel_earliest_) < 0)) {
+        wheel_earliest_ = alarm;
+      }
+    }
+  }
+
+  // Removes alarm, returning false if it was not present.
+  bool Erase(Alarm* alarm) {
+    if (alarm->bucket_ == kNotQueued) {
+      return false;
+    }
+    if (alarm->bucket_ == kReady) {
+      UnlinkReady(alarm);
+    } else {
+      Unlink(alarm);
+      if (alarm == wheel_earliest_) {
+        wheel_earliest_ = NULL;
+      }
+    }
+    alarm->bucket_ = kNotQueued;
+    return true;
+  }
+
+  // Returns the earliest alarm, or NULL if there are none, having first
+  // moved every alarm due by now_us to the ready list.  The cursor is never
+  // run ahead of now_us to find an alarm that isn't due yet, since any alarm
+  // added behind the cursor has to be inserted into the ready list in order.
+  Alarm* Earliest(int64 now_us) {
+    AdvanceTo(TickForUs(now_us) + 1);
+    if (ready_head_ != NULL) {
+      return ready_head_;
+    }
+    return (num_in_wheel_ == 0) ? NULL : WheelEarliest();
+  }
+
+  // Returns true if some alarm is due no later than wakeup_time_us.  This
+  // usually needs only the cached earliest alarm, or the first occupied
+  // bucket's bounds, and sorts that bucket only if neither decides it.
+  bool HasAlarmNoLaterThan(int64 wakeup_time_us) {
+    if (ready_head_ != NULL) {
+      return ready_head_->wakeup_time_us_ <= wakeup_time_us;
+    }
+    if (num_in_wheel_ == 0) {
+      return false;
+    }
+    if (wheel_earliest_ == NULL) {
+      int bucket = FirstOccupiedBucket();
+      if (buckets_[bucket]->wakeup_time_us_ <= wakeup_time_us) {
+        return true;
+      }
+      if (TickForUs(wakeup_time_us) < BucketStartTick(bucket)) {
+        return false;
+      }
+    }
+    return WheelEarliest()->wakeup_time_us_ <= wakeup_time_us;
+  }
+
+ private:
+  // Puts alarm into the ready list, or the appropriate bucket for cursor_.
+  void Place(Alarm* alarm) {
+    int64 tick = TickForUs(alarm->wakeup_time_us_);
+    if (tick < cursor_) {
+      InsertReady(alarm);
+      return;
+    }
+    int bucket = kOverflowBucket;
+    for (int level = 0; level < kLevels; ++level) {
+      int shift = level * kSlotBits;
+      if ((tick >> (shift + kSlotBits)) == (cursor_ >> (shift + kSlotBits))) {
+        int slot = static_cast<int>((tick >> shift) & (kSlots - 1));
+        bucket = level * kSlots + slot;
+        occupied_[level] |= 1ULL << slot;
+        break;
+      }
+    }
+    alarm->bucket_ = bucket;
+    ++num_in_wheel_;
+    if (bucket == sorted_bucket_) {
+      // Keep the bucket sorted if alarm goes at either end, as when alarms
+      // are added in deadline order.
+      if (alarm->Compare(sorted_tail_) > 0) {
+        alarm->bucket_prev_ = sorted_tail_;
+        alarm->bucket_next_ = NULL;
+        sorted_tail_->bucket_next_ = alarm;
+        sorted_tail_ = alarm;
+        return;
+      }
+      if (alarm->Compare(buckets_[bucket]) > 0) {
+        sorted_bucket_ = kNoBucket;
+      }
+    }
+    alarm->bucket_prev_ = NULL;
+    alarm->bucket_next_ = buckets_[bucket];
+    if (buckets_[bucket] != NULL) {
+      buckets_[bucket]->bucket_prev_ = alarm;
+    }
+    buckets_[bucket] = alarm;
+  }
+
+  // Links alarm into the ready list after prev, or at the head if prev is
+  // NULL.
+  void LinkReadyAfter(Alarm* prev, Alarm* alarm) {
+    alarm->bucket_ = kReady;
+    alarm->bucket_prev_ = prev;
+    alarm->bucket_next_ = (prev == NULL) ? ready_head_ : prev->bucket_next_;
+    if (alarm->bucket_next_ != NULL) {
+      alarm->bucket_next_->bucket_prev_ = alarm;
+    } else {
+      ready_tail_ = alarm;
+    }
+    if (prev != NULL) {
+      prev->bucket_next_ = alarm;
+    } else {
+      ready_head_ = alarm;
+    }
+  }
+
+  // Inserts alarm into the ready list in order.  An alarm added behind the
+  // cursor is nearly always due about now, and so after most of the alarms
+  // already ready, so the search starts from the tail.
+  void InsertReady(Alarm* alarm) {
+    Alarm* prev = ready_tail_;
+    while ((prev != NULL) && (alarm->Compare(prev) < 0)) {
+      prev = prev->bucket_prev_;
+    }
+    LinkReadyAfter(prev, alarm);
+  }
+
+  void UnlinkReady(Alarm* alarm) {
+    if (alarm->bucket_prev_ != NULL) {
+      alarm->bucket_prev_->bucket_next_ = alarm->bucket_next_;
+    } else {
+      ready_head_ = alarm->bucket_next_;
+    }
+    if (alarm->bucket_next_ != NULL) {
+      alarm->bucket_next_->bucket_prev_ = alarm->bucket_prev_;
+    } else {
+      ready_tail_ = alarm->bucket_prev_;
+    }
+  }
+
+  void Unlink(Alarm* alarm) {
+    int bucket = alarm->bucket_;
+    if ((bucket == sorted_bucket_) && (alarm == sorted_tail_)) {
+      sorted_tail_ = alarm->bucket_prev_;
+    }
+    if (alarm->bucket_prev_ != NULL) {
+      alarm->bucket_prev_->bucket_next_ = alarm->bucket_next_;
+    } else {
+      buckets_[bucket] = alarm->bucket_next_;
+    }
+    if (alarm->bucket_next_ != NULL) {
+      alarm->bucket_next_->bucket_prev_ = alarm->bucket_prev_;
+    }
+    if (buckets_[bucket] == NULL) {
+      if (bucket == sorted_bucket_) {
+        sorted_bucket_ = kNoBucket;
+      }
+      if (bucket != kOverflowBucket) {
+        occupied_[bucket / kSlots] &= ~(1ULL << (bucket % kSlots));
+      }
+    }
+    --num_in_wheel_;
+  }
+
+  // Detaches and returns the list of alarms in bucket.
+  Alarm* TakeBucket(int bucket) {
+    Alarm* list = buckets_[bucket];
+    for (Alarm* alarm = list; alarm != NULL; alarm = alarm->bucket_next_) {
+      --num_in_wheel_;
+    }
+    buckets_[bucket] = NULL;
+    if (bucket == sorted_bucket_) {
+      sorted_bucket_ = kNoBucket;
+    }
+    if (bucket != kOverflowBucket) {
+      occupied_[bucket / kSlots] &= ~(1ULL << (bucket % kSlots));
+    }
+    return list;
+  }
+
+  void PlaceList(Alarm* list) {
+    while (list != NULL) {
+      Alarm* next = list->bucket_next_;
+      Place(list);
+      list = next;
+    }
+  }
+
+  // Returns the first tick at or after cursor_ at which something must
+  // happen: a level-0 slot falling due, or a coarser slot (or the overflow
+  // bucket) that must be redistributed.  Requires num_in_wheel_ != 0.
+  int64 NextEventTick() const {
+    for (int level = 0; level < kLevels; ++level) {
+      int shift = level * kSlotBits;
+      int digit = static_cast<int>((cursor_ >> shift) & (kSlots - 1));
+      uint64 pending = occupied_[level] & (~0ULL << digit);
+      if (pending != 0) {
+        int64 base = (cursor_ >> (shift + kSlotBits)) << (shift + kSlotBits);
+        return base | (static_cast<int64>(LowestBit(pending)) << shift);
+      }
+    }
+    int shift = kLevels * kSlotBits;
+    return ((cursor_ >> shift) + 1) << shift;
+  }
+
+  // Redistributes any coarser slots that begin at cursor_, coarsest first.
+  void Cascade() {
+    for (int level = kLevels; level > 0; --level) {
+      int shift = level * kSlotBits;
+      if ((cursor_ & ((1LL << shift) - 1)) == 0) {
+        int bucket = (level == kLevels) ? kOverflowBucket :
+            level * kSlots + static_cast<int>((cursor_ >> shift) &
+                                              (kSlots - 1));
+        PlaceList(TakeBucket(bucket));
+      }
+    }
+  }
+
+  // Moves the cursor forward to tick, moving every alarm due before it to
+  // the ready list.
+  void AdvanceTo(int64 tick) {
+    while ((num_in_wheel_ != 0) && (cursor_ < tick)) {
+      int64 next_tick = NextEventTick();
+      if (next_tick >= tick) {
+        break;
+      }
+      if (next_tick > cursor_) {
+        cursor_ = next_tick;
+        Cascade();
+      }
+      // Everything left in the slot for cursor_ is now due, and after
+      // everything already in the ready list, so we sort just the slot, if
+      // it isn't already, and append it.
+      int bucket = static_cast<int>(cursor_ & (kSlots - 1));
+      if (buckets_[bucket] != NULL) {
+        wheel_earliest_ = NULL;
+        bool sorted = (bucket == sorted_bucket_);
+        for (Alarm* alarm = TakeBucket(bucket); alarm != NULL;
+             alarm = alarm->bucket_next_) {
+          expiring_.push_back(alarm);
+        }
+        if (!sorted) {
+          std::sort(expiring_.begin(), expiring_.end(), CompareAlarms());
+        }
+        for (int i = 0, n = expiring_.size(); i < n; ++i) {
+          LinkReadyAfter(ready_tail_, expiring_[i]);
+        }
+        expiring_.clear();
+      }
+      ++cursor_;
+      Cascade();
+    }
+    if (cursor_ < tick) {
+      cursor_ = tick;
+      Cascade();
+    }
+  }
+
+  // Returns the bucket holding the earliest alarms in the wheel.  Requires
+  // num_in_wheel_ != 0.
+  int FirstOccupiedBucket() const {
+    for (int level = 0; level < kLevels; ++level) {
+      if (occupied_[level] != 0) {
+        // The cursor's own slot is empty at every level but 0, and at
+        // level 0 nothing is in a slot below it.
+        return level * kSlots + LowestBit(occupied_[level]);
+      }
+    }
+    return kOverflowBucket;
+  }
+
+  // Returns the first tick that an alarm in bucket could be due at.
+  int64 BucketStartTick(int bucket) const {
+    if (bucket == kOverflowBucket) {
+      int shift = kLevels * kSlotBits;
+      return ((cursor_ >> shift) + 1) << shift;
+    }
+    int shift = (bucket / kSlots) * kSlotBits;
+    int64 base = (cursor_ >> (shift + kSlotBits)) << (shift + kSlotBits);
+    return base | (static_cast<int64>(bucket % kSlots) << shift);
+  }
+
+  // Sorts the alarms in bucket into sorted_bucket_.
+  void SortBucket(int bucket) {
+    for (Alarm* alarm = buckets_[bucket]; alarm != NULL;
+         alarm = alarm->bucket_next_) {
+      expiring_.push_back(alarm);
+    }
+    std::sort(expiring_.begin(), expiring_.end(), CompareAlarms());
+    Alarm* prev = NULL;
+    for (int i = 0, n = expiring_.size(); i < n; ++i) {
+      Alarm* alarm = expiring_[i];
+      alarm->bucket_prev_ = prev;
+      alarm->bucket_next_ = NULL;
+      if (prev != NULL) {
+        prev->bucket_next_ = alarm;
+      } else {
+        buckets_[bucket] = alarm;
+      }
+      prev = alarm;
+    }
+    expiring_.clear();
+    sorted_bucket_ = bucket;
+    sorted_tail_ = prev;
+  }
+
+  // Returns the earliest alarm in the wheel, which if it's not already known
+  // is the first in the first occupied bucket, once that is sorted.
+  // Requires num_in_wheel_ != 0.
+  Alarm* WheelEarliest() {
+    if (wheel_earliest_ == NULL) {
+      int bucket = FirstOccupiedBucket();
+      if (bucket != sorted_bucket_) {
+        SortBucket(bucket);
+      }
+      wheel_earliest_ = buckets_[bucket];
+    }
+    return wheel_earliest_;
+  }
+
+  Timer* timer_;
+  int64 cursor_;              // The first tick not yet moved to ready.
+  Alarm* ready_head_;         // Alarms due before cursor_, in order.
+  Alarm* ready_tail_;
+  std::vector<Alarm*> expiring_;  // Scratch space for sorting buckets.
+  Alarm* buckets_[kNumBuckets];
+  uint64 occupied_[kLevels];  // Bitmaps of non-empty slots.
+  int num_in_wheel_;          // Number of alarms in buckets_.
+  Alarm* wheel_earliest_;     // Earliest alarm in buckets_, if known.
+  int sorted_bucket_;         // A bucket known to be in order, or kNoBucket.
+  Alarm* sorted_tail_;        // The last alarm in sorted_bucket_.
+
+  DISALLOW_COPY_AND_ASSIGN(AlarmWheel);
+};
+
 Scheduler::Scheduler(ThreadSystem* thread_system, Timer* timer)
     : thread_system_(thread_system),
       timer_(timer),
       mutex_(thread_system->NewMutex()),
       condvar_(mutex_->NewCondvar()),
       index_(kIndexNotSet),
+      outstanding_alarms_(new AlarmWheel(timer)),
       signal_count_(0),
       running_waiting_alarms_(false) {
 }
@@ -211,10 +641,9 @@ Scheduler::Scheduler(ThreadSystem* thread_system, Timer* timer)
 Scheduler::~Scheduler() {
 #if SCHEDULER_CANCEL_OUTSTANDING_ALARMS_ON_DESTRUCTION
   ScopedMutex lock(mutex_.get());
-  while (!outstanding_alarms_.empty()) {
-    AlarmSet::iterator p = outstanding_alarms_.begin();
-    Alarm* alarm = *p;
-    outstanding_alarms_.erase(p);
+  while (!outstanding_alarms_->empty()) {
+    Alarm* alarm = outstanding_alarms_->Earliest(timer_->NowUs());
+    outstanding_alarms_->Erase(alarm);
     alarm->CancelAlarm();
   }
 #endif
@@ -305,16 +734,11 @@ void Scheduler::AddAlarmMutexHeldUs(int64 wakeup_time_us, Alarm* alarm) {
   mutex_->DCheckLocked();
   alarm->wakeup_time_us_ = wakeup_time_us;
   alarm->index_ = ++index_;
-  // Someone may care about changes in wait time.  Broadcast if any occurred.
-  if (!outstanding_alarms_.empty()) {
-    Alarm* first_alarm = *outstanding_alarms_.begin();
-    if (wakeup_time_us < first_alarm->wakeup_time_us_) {
-      condvar_->Broadcast();
-    }
-  } else {
+  // Someone may care about changes in wait time.
+  if (!outstanding_alarms_->HasAlarmNoLaterThan(wakeup_time_us)) {
     condvar_->Broadcast();
   }
-  outstanding_alarms_.insert(alarm);
+  outstanding_alarms_->Insert(alarm);
 }
 
 Scheduler::Alarm* Scheduler::AddAlarmAtUs(int64 wakeup_time_us,
@@ -326,9 +750,16 @@ Scheduler::Alarm* Scheduler::AddAlarmAtUs(int64 wakeup_time_us,
   return result;
 }
 
+Scheduler::Alarm* Scheduler::AddAlarmAtUsMutexHeld(int64 wakeup_time_us,
+                                                   Function* callback) {
+  Alarm* result = new FunctionAlarm(callback, this);
+  AddAlarmMutexHeldUs(wakeup_time_us, result);
+  return result;
+}
+
 bool Scheduler::CancelAlarm(Alarm* alarm) {
   mutex_->DCheckLocked();
-  if (outstanding_alarms_.erase(alarm) != 0) {
+  if (outstanding_alarms_->Erase(alarm)) {
     // Note: the following call may drop and re-lock the scheduler mutex.
     alarm->CancelAlarm();
     return true;
@@ -338,20 +769,30 @@ bool Scheduler::CancelAlarm(Alarm* alarm) {
 }
 
 int64 Scheduler::RunAlarms(bool* ran_alarms) {
-  while (!outstanding_alarms_.empty()) {
+  // Rather than consult the timer for every alarm, we run all those due by
+  // the time we last read, and only read it again when we run out.
+  int64 now_us = timer_->NowUs();
+  bool now_is_fresh = true;
+  while (!outstanding_alarms_->empty()) {
     mutex_->DCheckLocked();
-    // We don't use the iterator to go through the set, because we're dropping
-    // the lock in mid-loop thus permitting new insertions and cancellations.
-    AlarmSet::iterator first_alarm_iterator = outstanding_alarms_.begin();
-    Alarm* first_alarm = *first_alarm_iterator;
-    int64 now_us = timer_->NowUs();
+    // We look up the first alarm afresh each time around, because we're
+    // dropping the lock in mid-loop thus permitting new insertions and
+    // cancellations.
+    Alarm* first_alarm = outstanding_alarms_->Earliest(now_us);
     if (now_us < first_alarm->wakeup_time_us_) {
-      // The next deadline lies in the future.
-      return first_alarm->wakeup_time_us_;
+      if (now_is_fresh) {
+        // The next deadline lies in the future.
+        return first_alarm->wakeup_time_us_;
+      }
+      // Time may have moved on while we were running alarms.
+      now_us = timer_->NowUs();
+      now_is_fresh = true;
+      continue;
     }
+    now_is_fresh = false;
     // first_alarm should be run.  It can't have been cancelled as we've held
     // the lock since we found it.
-    outstanding_alarms_.erase(first_alarm_iterator);  // Prevent cancellation.
+    outstanding_alarms_->Erase(first_alarm);  // Prevent cancellation.
     if (ran_alarms != NULL) {
       *ran_alarms = true;
     }
@@ -394,7 +835,7 @@ void Scheduler::ProcessAlarmsOrWaitUs(int64 timeout_us) {
 // For testing purposes, let a tester know when the scheduler has quiesced.
 bool Scheduler::NoPendingAlarms() {
   mutex_->DCheckLocked();
-  return (outstanding_alarms_.empty());
+  return outstanding_alarms_->empty();
 }
 
 SchedulerBlockingFunction::SchedulerBlockingFunction(Scheduler* scheduler)
@@ -44,6 +44,11 @@ namespace net_instaweb {
 //
 // This class is designed to be overridden, but only to re-implement its
 // internal notion of blocking to permit time to be mocked by MockScheduler.
+//
+// Outstanding alarms are kept in a hierarchical timing wheel, so that adding
+// and cancelling them is constant-time however many are outstanding, and
+// alarms falling due are sorted only once they reach the front of the queue.
+// They still run in order of wakeup time, and then of scheduling.
 class Scheduler {
  public:
   // A callback for a scheduler alarm, with an associated wakeup time (absolute
@@ -94,7 +99,7 @@ class Scheduler {
   // the usual condition variable signal semantics.
   void Signal() EXCLUSIVE_LOCKS_REQUIRED(mutex());
 
-  // Alarms.  The following two methods provide a mechanism for scheduling
+  // Alarms.  The following methods provide a mechanism for scheduling
   // alarm tasks, each run at a particular time.
 
   // Schedules an alarm for absolute time wakeup_time_us, using the passed-in
@@ -105,6 +110,13 @@ class Scheduler {
   // yet.  This is why the scheduler mutex must be held for CancelAlarm.
   Alarm* AddAlarmAtUs(int64 wakeup_time_us, Function* callback);
 
+  // Like AddAlarmAtUs, but for callers that already hold mutex(), typically
+  // because they need to record the returned Alarm atomically with respect
+  // to a later CancelAlarm.  Does not perform outstanding work, so the alarm
+  // runs on the next pass through the scheduler even if it is already due.
+  Alarm* AddAlarmAtUsMutexHeld(int64 wakeup_time_us, Function* callback)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex());
+
   // Cancels an alarm, calling the Cancel() method and deleting the alarm
   // object.  Scheduler mutex must be held before call to ensure that alarm is
   // not called back before cancellation occurs.  Doesn't perform outstanding
@@ -162,6 +174,7 @@ class Scheduler {
   bool running_waiting_alarms() const { return running_waiting_alarms_; }
 
  private:
+  class AlarmWheel;
   class CondVarTimeout;
   class CondVarCallbackTimeout;
   friend class SchedulerTest;
@@ -179,9 +192,9 @@ class Scheduler {
   // signal_count_ increasing) events occur.
   scoped_ptr<ThreadSystem::Condvar> condvar_;
   uint32 index_;  // Used to disambiguate alarms with equal deadlines
-  AlarmSet outstanding_alarms_;  // Priority queue of future alarms
-  // An alarm may be deleted iff it is successfully removed from
-  // outstanding_alarms_.
+  // Priority queue of future alarms.  An alarm may be deleted iff it is
+  // successfully removed from outstanding_alarms_.
+  scoped_ptr<AlarmWheel> outstanding_alarms_;
   int64 signal_count_;           // Number of times Signal has been called
   AlarmSet waiting_alarms_;      // Alarms waiting for signal_count to change
   bool running_waiting_alarms_;  // True if we're in process of invoking
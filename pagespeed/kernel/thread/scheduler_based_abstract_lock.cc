@@ -19,11 +19,13 @@
 #include "pagespeed/kernel/thread/scheduler_based_abstract_lock.h"
 
 #include "base/logging.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/debug.h"
 #include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/thread/named_lock_wait_queue.h"
 #include "pagespeed/kernel/thread/scheduler.h"
 
 namespace net_instaweb {
@@ -35,6 +37,9 @@ namespace {
 const int kBusySpinIterations = 100;
 const int64 kMaxSpinSleepMs = Timer::kMinuteMs;  // Never sleep for more than 1m
 const int64 kMinTriesPerSteal = 2;  // Try to lock twice / steal interval.
+// With a wait queue we are woken by unlocks in this process, and poll only
+// for unlocks in other processes; bound how stale we let that get.
+const int64 kMaxFallbackPollMs = 100;
 
 // We back off exponentially, with a constant of 1.5.  We add an extra ms to
 // this backoff to avoid problems with wait intervals of 0 or 1.  We bound the
@@ -69,93 +74,236 @@ int64 IntervalWithEnd(Timer* timer, int64 interval_ms,
 
 // This object actually contains the state needed for periodically polling the
 // provided lock using the try_lock method, and for eventually calling or
-// canceling the callback. While it may feel attractive to reuse this object,
-// it's not actually safe as it runs into races trying to check the
-// delete_after_callback_ bit.
-class TimedWaitPollState : public Function {
+// canceling the callback.  It deletes itself once it has done so.  Each poll
+// is scheduled with a fresh PollAlarm; while it may feel attractive to reuse
+// the alarm callback, it's not actually safe as it runs into races trying to
+// check the delete_after_callback_ bit.
+//
+// If the lock has a wait queue, we stay queued on it until we finish, and an
+// Unlock of our lock in this process cancels our pending poll and schedules
+// one right away.  Fields marked below are guarded by the scheduler mutex in
+// that case.
+class TimedWaitPollState : public NamedLockWaitQueue::Waiter {
  public:
   typedef bool (SchedulerBasedAbstractLock::*TryLockMethod)(int64 steal_ms);
 
   TimedWaitPollState(
-      Scheduler* scheduler, Function* callback,
+      Scheduler* scheduler, NamedLockWaitQueue* wait_queue, Function* callback,
       SchedulerBasedAbstractLock* lock, TryLockMethod try_lock,
-      int64 steal_ms, int64 end_time_ms,
+      int64 steal_ms, int64 start_time_ms, int64 end_time_ms,
       int64 max_interval_ms)
       : scheduler_(scheduler),
+        wait_queue_(wait_queue),
         callback_(callback),
         lock_(lock),
+        name_(lock->name()),
         try_lock_(try_lock),
         steal_ms_(steal_ms),
+        start_time_ms_(start_time_ms),
         end_time_ms_(end_time_ms),
         max_interval_ms_(max_interval_ms),
-        interval_ms_(0) {}
+        interval_ms_(0),
+        alarm_(NULL),
+        queued_(false),
+        woken_(false),
+        requeue_at_front_(false) {}
   virtual ~TimedWaitPollState() { }
 
-  // Note: doesn't actually clone interval_ms_.
-  TimedWaitPollState* Clone() {
-    return new TimedWaitPollState(scheduler_, callback_, lock_,
-                                  try_lock_, steal_ms_, end_time_ms_,
-                                  max_interval_ms_);
-  }
-
- protected:
-  virtual void Run() {
-    if ((lock_->*try_lock_)(steal_ms_)) {
-      callback_->CallRun();
-      return;
-    }
-    Timer* timer = scheduler_->timer();
-    int64 now_ms = timer->NowMs();
-    if (now_ms >= end_time_ms_) {
-      callback_->CallCancel();
-      return;
-    }
+  // Tries the lock.  Runs or cancels the callback and deletes this if we're
+  // done, and otherwise schedules the next try.
+  void Poll();
 
-    TimedWaitPollState* next_try = Clone();
-    next_try->interval_ms_ =
-        IntervalWithEnd(timer, interval_ms_, max_interval_ms_, end_time_ms_);
-    scheduler_->AddAlarmAtUs((now_ms + next_try->interval_ms_) * Timer::kMsUs,
-                             next_try);
-  }
+  virtual void WakeupMutexHeld();
 
  private:
+  class PollAlarm : public Function {
+   public:
+    explicit PollAlarm(TimedWaitPollState* state) : state_(state) { }
+    virtual ~PollAlarm() { }
+
+   protected:
+    virtual void Run() { state_->AlarmFired(); }
+
+   private:
+    TimedWaitPollState* state_;
+    DISALLOW_COPY_AND_ASSIGN(PollAlarm);
+  };
+
+  void AlarmFired();
+  void Finish(bool acquired, int64 now_ms);
+
+  // Adds us to wait_queue_.  Must be called with the scheduler mutex held.
+  void Enqueue();
+
   Scheduler* scheduler_;
+  NamedLockWaitQueue* wait_queue_;  // NULL if we just poll.
   Function* callback_;
   SchedulerBasedAbstractLock* lock_;
+  const GoogleString name_;
   TryLockMethod try_lock_;
   const int64 steal_ms_;
+  const int64 start_time_ms_;
   const int64 end_time_ms_;
   const int64 max_interval_ms_;
   int64 interval_ms_;
+
+  // Guarded by the scheduler mutex.
+  Scheduler::Alarm* alarm_;  // Our pending poll, if any.
+  bool queued_;              // Whether we're in wait_queue_.
+  bool woken_;               // Whether an Unlock came while we were polling.
+  bool requeue_at_front_;    // Whether we were dequeued by a wakeup.
+
+  DISALLOW_COPY_AND_ASSIGN(TimedWaitPollState);
 };
 
+void TimedWaitPollState::Poll() {
+  if (wait_queue_ != NULL) {
+    ScopedMutex lock(scheduler_->mutex());
+    if (!queued_) {
+      // Queue before trying, so that an Unlock that races with our try
+      // will wake us.
+      Enqueue();
+    }
+    woken_ = false;
+  }
+  Timer* timer = scheduler_->timer();
+  if ((lock_->*try_lock_)(steal_ms_)) {
+    Finish(true, timer->NowMs());
+    return;
+  }
+  int64 now_ms = timer->NowMs();
+  if (now_ms >= end_time_ms_) {
+    Finish(false, now_ms);
+    return;
+  }
+
+  interval_ms_ =
+      IntervalWithEnd(timer, interval_ms_, max_interval_ms_, end_time_ms_);
+  int64 wakeup_time_us = (now_ms + interval_ms_) * Timer::kMsUs;
+  if (wait_queue_ == NULL) {
+    scheduler_->AddAlarmAtUs(wakeup_time_us, new PollAlarm(this));
+    return;
+  }
+  ScopedMutex lock(scheduler_->mutex());
+  if (woken_) {
+    // The lock was released after we were queued, possibly after our try
+    // failed, so we'd never hear about it again.  Try again right away.
+    wakeup_time_us = now_ms * Timer::kMsUs;
+  }
+  if (!queued_) {
+    Enqueue();
+  }
+  alarm_ = scheduler_->AddAlarmAtUsMutexHeld(wakeup_time_us,
+                                             new PollAlarm(this));
+}
+
+void TimedWaitPollState::Enqueue() {
+  // A waiter that was woken but lost the race for the lock to a fresh
+  // TryLock goes back to the front, so it isn't starved by later arrivals.
+  if (requeue_at_front_) {
+    wait_queue_->RequeueWaiter(name_, this);
+  } else {
+    wait_queue_->AddWaiter(name_, this);
+  }
+  queued_ = true;
+  requeue_at_front_ = false;
+}
+
+void TimedWaitPollState::AlarmFired() {
+  if (wait_queue_ != NULL) {
+    ScopedMutex lock(scheduler_->mutex());
+    alarm_ = NULL;
+  }
+  Poll();
+}
+
+void TimedWaitPollState::WakeupMutexHeld() {
+  queued_ = false;
+  requeue_at_front_ = true;
+  Scheduler::Alarm* alarm = alarm_;
+  if (alarm == NULL) {
+    // We're in the middle of a try.
+    woken_ = true;
+    return;
+  }
+  alarm_ = NULL;
+  // If the cancel fails the alarm is already running, and will try the lock
+  // after we release the scheduler mutex.  Note that CancelAlarm may drop and
+  // re-take the mutex; nothing else can reach us meanwhile since we are
+  // neither queued nor scheduled.
+  if (scheduler_->CancelAlarm(alarm)) {
+    alarm_ = scheduler_->AddAlarmAtUsMutexHeld(scheduler_->timer()->NowUs(),
+                                               new PollAlarm(this));
+  }
+}
+
+void TimedWaitPollState::Finish(bool acquired, int64 now_ms) {
+  if (wait_queue_ != NULL) {
+    {
+      ScopedMutex lock(scheduler_->mutex());
+      if (queued_) {
+        wait_queue_->RemoveWaiter(name_, this);
+      }
+    }
+    if (acquired) {
+      wait_queue_->RecordAcquired(now_ms - start_time_ms_);
+    } else {
+      wait_queue_->RecordTimeout();
+    }
+  }
+  if (acquired) {
+    callback_->CallRun();
+  } else {
+    callback_->CallCancel();
+  }
+  delete this;
+}
+
 }  // namespace
 
 SchedulerBasedAbstractLock::~SchedulerBasedAbstractLock() { }
 
+NamedLockWaitQueue* SchedulerBasedAbstractLock::wait_queue() const {
+  return NULL;
+}
+
 void SchedulerBasedAbstractLock::PollAndCallback(
     TryLockMethod try_lock, int64 steal_ms, int64 wait_ms, Function* callback) {
   // Measure ending time from immediately after failure of the fast path.
-  int64 end_time_ms = scheduler()->timer()->NowMs() + wait_ms;
-  if (BusySpin(try_lock, steal_ms)) {
-    callback->CallRun();
-    return;
+  int64 start_time_ms = scheduler()->timer()->NowMs();
+  int64 end_time_ms = start_time_ms + wait_ms;
+  int64 max_interval_ms = (steal_ms + 1) / kMinTriesPerSteal;
+  NamedLockWaitQueue* queue = wait_queue();
+  if (queue == NULL) {
+    if (BusySpin(try_lock, steal_ms)) {
+      callback->CallRun();
+      return;
+    }
+  } else {
+    // Unlocks in this process will wake us, so there's no point burning CPU
+    // spinning, and we need only poll often enough to notice unlocks in
+    // other processes in good time.
+    queue->RecordContention();
+    if (max_interval_ms > kMaxFallbackPollMs) {
+      max_interval_ms = kMaxFallbackPollMs;
+    }
   }
   // Slow path.  Allocate a TimedWaitPollState object and cede control to it.
-  int64 max_interval_ms = (steal_ms + 1) / kMinTriesPerSteal;
   TimedWaitPollState* poller =
-      new TimedWaitPollState(scheduler(), callback, this,
-                             try_lock, steal_ms,
+      new TimedWaitPollState(scheduler(), queue, callback, this,
+                             try_lock, steal_ms, start_time_ms,
                              end_time_ms, max_interval_ms);
-  poller->CallRun();
+  poller->Poll();
 }
 
 // The basic structure of each locking operation is the same:
 // Quick check for a free lock using TryLock().
 // If that fails, call PollAndCallBack, which:
-//   * First busy spins attempting to obtain the lock
+//   * First busy spins attempting to obtain the lock, unless the lock has a
+//     wait queue
 //   * If that fails, schedules an alarm that attempts to take the lock,
-//     or failing that backs off and schedules another alarm.
+//     or failing that backs off and schedules another alarm.  With a wait
+//     queue, an Unlock in this process moves that alarm up to now.
 // We run callbacks as soon as possible.  We could instead defer them
 // to a scheduler sequence, but in practice we don't have an appropriate
 // sequence to hand when we we stand up the lock manager.  So it's up to
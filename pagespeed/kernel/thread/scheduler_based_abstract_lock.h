@@ -25,6 +25,7 @@
 namespace net_instaweb {
 
 class Function;
+class NamedLockWaitQueue;
 class Scheduler;
 
 // A SchedulerBasedAbstractLock implements a Lock by blocking using the
@@ -33,6 +34,11 @@ class Scheduler;
 // the time between the initial call to the lock routine attempt and the time
 // the lock is unlocked (ie we might wait for an extra amount of time equal to
 // half the time we were forced to wait).
+//
+// Subclasses can do better by providing a NamedLockWaitQueue and notifying
+// it from Unlock: blocked operations then skip the busy spin, are woken as
+// soon as the lock is released in this process, and poll at most every
+// 100ms to spot releases in other processes.
 class SchedulerBasedAbstractLock : public NamedLock {
  public:
   virtual ~SchedulerBasedAbstractLock();
@@ -46,6 +52,11 @@ class SchedulerBasedAbstractLock : public NamedLock {
  protected:
   virtual Scheduler* scheduler() const = 0;
 
+  // Returns the queue blocked operations on this lock wait on, or NULL (the
+  // default) to rely purely on polling.  A lock that returns a queue must
+  // call its NotifyUnlocked whenever it is unlocked.
+  virtual NamedLockWaitQueue* wait_queue() const;
+
  private:
   typedef bool (SchedulerBasedAbstractLock::*TryLockMethod)(int64 steal_ms);
   bool TryLockIgnoreSteal(int64 steal_ignored);
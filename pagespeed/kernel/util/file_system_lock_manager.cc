@@ -19,6 +19,7 @@
 
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/file_system.h"
+#include "pagespeed/kernel/thread/named_lock_wait_queue.h"
 #include "pagespeed/kernel/thread/scheduler.h"
 #include "pagespeed/kernel/thread/scheduler_based_abstract_lock.h"
 #include "pagespeed/kernel/base/string.h"
@@ -57,6 +58,9 @@ class FileSystemLock : public SchedulerBasedAbstractLock {
 
   virtual void Unlock() {
     held_ = !manager_->file_system()->Unlock(name_, manager_->handler());
+    if (!held_) {
+      manager_->wait_queue()->NotifyUnlocked(name_);
+    }
   }
 
   virtual GoogleString name() {
@@ -72,6 +76,10 @@ class FileSystemLock : public SchedulerBasedAbstractLock {
     return manager_->scheduler();
   }
 
+  virtual NamedLockWaitQueue* wait_queue() const {
+    return manager_->wait_queue();
+  }
+
  private:
   friend class FileSystemLockManager;
 
@@ -97,10 +105,15 @@ FileSystemLockManager::FileSystemLockManager(
     : file_system_(file_system),
       base_path_(base_path.as_string()),
       scheduler_(scheduler),
-      handler_(handler) {
+      handler_(handler),
+      wait_queue_(new NamedLockWaitQueue(scheduler)) {
   EnsureEndsInSlash(&base_path_);
 }
 
+void FileSystemLockManager::SetStatistics(Statistics* statistics) {
+  wait_queue_->SetStatistics(statistics);
+}
+
 FileSystemLockManager::~FileSystemLockManager() { }
 
 NamedLock* FileSystemLockManager::CreateNamedLock(const StringPiece& name) {
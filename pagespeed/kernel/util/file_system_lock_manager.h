@@ -20,6 +20,7 @@
 #define PAGESPEED_KERNEL_UTIL_FILE_SYSTEM_LOCK_MANAGER_H_
 
 #include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/named_lock_manager.h"
@@ -28,12 +29,16 @@ namespace net_instaweb {
 
 class FileSystem;
 class MessageHandler;
+class NamedLockWaitQueue;
 class Scheduler;
+class Statistics;
 
 // Use the locking routines in FileSystem to implement named locks.  Requires a
 // Scheduler as well because the FileSystem locks are non-blocking and we must
 // deal with blocking until they are available.  A MessageHandler is used to
-// report file system errors during lock creation and cleanup.
+// report file system errors during lock creation and cleanup.  Waiters in the
+// same process are woken directly when a lock is released; waiters in other
+// processes notice on their next poll.
 class FileSystemLockManager : public NamedLockManager {
  public:
   // Note: a FileSystemLockManager must outlive
@@ -47,6 +52,11 @@ class FileSystemLockManager : public NamedLockManager {
                         MessageHandler* handler);
   virtual ~FileSystemLockManager();
 
+  // Records lock contention in statistics, on which
+  // NamedLockWaitQueue::InitStats must have been called.  Nothing is
+  // recorded unless this is called, at setup time, before any locks wait.
+  void SetStatistics(Statistics* statistics);
+
   // Multiple lock objects with the same name will manage the same underlying
   // lock.  Lock names must be legal file names according to file_system.
   //
@@ -62,12 +72,14 @@ class FileSystemLockManager : public NamedLockManager {
   FileSystem* file_system() const { return file_system_; }
   Scheduler* scheduler() const { return scheduler_; }
   MessageHandler* handler() const { return handler_; }
+  NamedLockWaitQueue* wait_queue() const { return wait_queue_.get(); }
 
  private:
   FileSystem* file_system_;
   GoogleString base_path_;
   Scheduler* scheduler_;
   MessageHandler* handler_;
+  scoped_ptr<NamedLockWaitQueue> wait_queue_;
 
   DISALLOW_COPY_AND_ASSIGN(FileSystemLockManager);
 };
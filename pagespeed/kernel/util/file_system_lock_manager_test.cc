@@ -21,17 +21,22 @@
 #include "pagespeed/kernel/util/file_system_lock_manager.h"
 
 #include "base/logging.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/google_message_handler.h"
 #include "pagespeed/kernel/base/gtest.h"
 #include "pagespeed/kernel/base/mem_file_system.h"
 #include "pagespeed/kernel/base/mock_timer.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/thread/mock_scheduler.h"
+#include "pagespeed/kernel/thread/named_lock_wait_queue.h"
 #include "pagespeed/kernel/base/named_lock_manager.h"
 #include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
 
 namespace net_instaweb {
 
@@ -43,6 +48,23 @@ const char kLock2[] = "lock2";
 const int64 kTimeoutMs = 50000;
 const int64 kWaitMs = 10000;
 
+// Records how an asynchronous lock attempt turned out.
+class LockCallback : public Function {
+ public:
+  LockCallback(bool* acquired, bool* cancelled)
+      : acquired_(acquired), cancelled_(cancelled) { }
+
+ protected:
+  virtual void Run() { *acquired_ = true; }
+  virtual void Cancel() { *cancelled_ = true; }
+
+ private:
+  bool* acquired_;
+  bool* cancelled_;
+
+  DISALLOW_COPY_AND_ASSIGN(LockCallback);
+};
+
 class FileSystemLockManagerTest : public testing::Test {
  protected:
   FileSystemLockManagerTest()
@@ -268,6 +290,123 @@ TEST_F(FileSystemLockManagerTest, WaitStealOld) {
   EXPECT_GT(start_ms + kWaitMs, end_ms);
 }
 
+TEST_F(FileSystemLockManagerTest, UnlockWakesWaiter) {
+  SimpleStats stats(thread_system_.get());
+  NamedLockWaitQueue::InitStats(&stats);
+  FileSystemLockManager manager(&file_system_, GTestTempDir(), &scheduler_,
+                                &handler_);
+  manager.SetStatistics(&stats);
+  scoped_ptr<NamedLock> holder(manager.CreateNamedLock(kLock1));
+  scoped_ptr<NamedLock> waiter(manager.CreateNamedLock(kLock1));
+  EXPECT_TRUE(holder->TryLock());
+
+  bool acquired = false;
+  bool cancelled = false;
+  waiter->LockTimedWaitStealOld(kWaitMs, kTimeoutMs,
+                                new LockCallback(&acquired, &cancelled));
+  scheduler_.AdvanceTimeMs(kWaitMs / 2);
+  EXPECT_FALSE(acquired);
+  EXPECT_FALSE(cancelled);
+
+  // The waiter gets the lock as soon as it is released, rather than at its
+  // next poll.
+  int64 unlock_ms = timer()->NowMs();
+  holder->Unlock();
+  {
+    ScopedMutex lock(scheduler_.mutex());
+    scheduler_.ProcessAlarmsOrWaitUs(0);
+  }
+  EXPECT_TRUE(acquired);
+  EXPECT_FALSE(cancelled);
+  EXPECT_TRUE(waiter->Held());
+  EXPECT_EQ(unlock_ms, timer()->NowMs());
+
+  // Now the former holder waits in vain.
+  EXPECT_FALSE(holder->LockTimedWait(kWaitMs));
+
+  EXPECT_EQ(2, stats.GetVariable(
+      NamedLockWaitQueue::kNamedLockContentions)->Get());
+  EXPECT_EQ(1, stats.GetVariable(
+      NamedLockWaitQueue::kNamedLockWakeups)->Get());
+  EXPECT_EQ(1, stats.GetVariable(
+      NamedLockWaitQueue::kNamedLockTimeouts)->Get());
+  EXPECT_EQ(1, stats.GetHistogram(
+      NamedLockWaitQueue::kNamedLockWaitMs)->Count());
+}
+
+TEST_F(FileSystemLockManagerTest, WaitersWokenInOrder) {
+  scoped_ptr<NamedLock> holder(MakeLock(kLock1));
+  scoped_ptr<NamedLock> first(MakeLock(kLock1));
+  scoped_ptr<NamedLock> second(MakeLock(kLock1));
+  EXPECT_TRUE(holder->TryLock());
+
+  bool first_acquired = false;
+  bool second_acquired = false;
+  bool cancelled = false;
+  first->LockTimedWait(kWaitMs, new LockCallback(&first_acquired, &cancelled));
+  second->LockTimedWait(kWaitMs,
+                        new LockCallback(&second_acquired, &cancelled));
+  scheduler_.AdvanceTimeMs(kWaitMs / 2);
+
+  // Each unlock hands the lock on to the next waiter in line.
+  holder->Unlock();
+  {
+    ScopedMutex lock(scheduler_.mutex());
+    scheduler_.ProcessAlarmsOrWaitUs(0);
+  }
+  EXPECT_TRUE(first_acquired);
+  EXPECT_FALSE(second_acquired);
+  first->Unlock();
+  {
+    ScopedMutex lock(scheduler_.mutex());
+    scheduler_.ProcessAlarmsOrWaitUs(0);
+  }
+  EXPECT_TRUE(second_acquired);
+  EXPECT_FALSE(cancelled);
+}
+
+TEST_F(FileSystemLockManagerTest, WokenWaiterKeepsItsPlace) {
+  scoped_ptr<NamedLock> holder(MakeLock(kLock1));
+  scoped_ptr<NamedLock> first(MakeLock(kLock1));
+  scoped_ptr<NamedLock> second(MakeLock(kLock1));
+  scoped_ptr<NamedLock> thief(MakeLock(kLock1));
+  EXPECT_TRUE(holder->TryLock());
+
+  bool first_acquired = false;
+  bool second_acquired = false;
+  bool cancelled = false;
+  first->LockTimedWait(kWaitMs, new LockCallback(&first_acquired, &cancelled));
+  second->LockTimedWait(kWaitMs,
+                        new LockCallback(&second_acquired, &cancelled));
+  scheduler_.AdvanceTimeMs(kWaitMs / 2);
+
+  // The unlock wakes the first waiter, but a TryLock gets in ahead of it.
+  holder->Unlock();
+  EXPECT_TRUE(thief->TryLock());
+  {
+    ScopedMutex lock(scheduler_.mutex());
+    scheduler_.ProcessAlarmsOrWaitUs(0);
+  }
+  EXPECT_FALSE(first_acquired);
+  EXPECT_FALSE(second_acquired);
+
+  // The first waiter is still ahead of the second for the next unlock.
+  thief->Unlock();
+  {
+    ScopedMutex lock(scheduler_.mutex());
+    scheduler_.ProcessAlarmsOrWaitUs(0);
+  }
+  EXPECT_TRUE(first_acquired);
+  EXPECT_FALSE(second_acquired);
+  first->Unlock();
+  {
+    ScopedMutex lock(scheduler_.mutex());
+    scheduler_.ProcessAlarmsOrWaitUs(0);
+  }
+  EXPECT_TRUE(second_acquired);
+  EXPECT_FALSE(cancelled);
+}
+
 }  // namespace
 
 }  // namespace net_instaweb
@@ -18,12 +18,97 @@
 
 #include "pagespeed/kernel/util/simple_stats.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "base/logging.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/stat_stripes.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_system.h"
 
 namespace net_instaweb {
 
+namespace {
+
+// Histogram defaults, as for SharedMemHistogram.
+const int kDefaultNumBuckets = 500;
+const int kOutOfBoundsCatcherBuckets = 2;
+const double kMaxValue = 5000;
+
+// Layout of each histogram stripe, in int64 slots.  The sums and extremes
+// are doubles, stored bitwise.  There's no count: that's the sum of the
+// buckets, so Add doesn't need to update it separately.
+enum HistogramSlot {
+  kSumSlot,
+  kSumOfSquaresSlot,
+  kMinSlot,
+  kMaxSlot,
+  kFirstBucketSlot
+};
+
+// Returns the size of a histogram stripe with num_buckets buckets.
+size_t StripeBytes(int num_buckets) {
+  return StatStripes::RoundUp((kFirstBucketSlot + num_buckets) * sizeof(int64));
+}
+
+// Returns a pointer into storage, which must have StatStripes::kStripeBytes
+// of slack, aligned to a cache line.
+char* AlignToStripe(char* storage) {
+  const size_t kStripeBytes = StatStripes::kStripeBytes;
+  size_t misalignment = reinterpret_cast<size_t>(storage) % kStripeBytes;
+  return (misalignment == 0) ? storage :
+      storage + (kStripeBytes - misalignment);
+}
+
+int64 DoubleToBits(double value) {
+  int64 bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+double BitsToDouble(int64 bits) {
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+double LoadDouble(volatile int64* slot) {
+  return BitsToDouble(StatStripes::AtomicLoad(slot));
+}
+
+void StoreDouble(volatile int64* slot, double value) {
+  StatStripes::AtomicExchange(slot, DoubleToBits(value));
+}
+
+void AddDouble(volatile int64* slot, double delta) {
+  int64 old_bits;
+  do {
+    old_bits = StatStripes::AtomicLoad(slot);
+  } while (!StatStripes::AtomicCompareAndSwap(
+      slot, old_bits, DoubleToBits(BitsToDouble(old_bits) + delta)));
+}
+
+// Replaces the double in slot with value if value is smaller (or, for
+// !keep_min, larger).
+void UpdateExtreme(volatile int64* slot, double value, bool keep_min) {
+  for (;;) {
+    int64 old_bits = StatStripes::AtomicLoad(slot);
+    double old_value = BitsToDouble(old_bits);
+    if (keep_min ? !(value < old_value) : !(value > old_value)) {
+      return;
+    }
+    if (StatStripes::AtomicCompareAndSwap(slot, old_bits,
+                                          DoubleToBits(value))) {
+      return;
+    }
+  }
+}
+
+}  // namespace
+
 SimpleStats::SimpleStats(ThreadSystem* thread_system)
     : thread_system_(thread_system) {
 }
@@ -31,8 +116,8 @@ SimpleStats::SimpleStats(ThreadSystem* thread_system)
 SimpleStats::~SimpleStats() {
 }
 
-CountHistogram* SimpleStats::NewHistogram(StringPiece /*name*/) {
-  return new CountHistogram(thread_system_->NewMutex());
+SimpleStatsHistogram* SimpleStats::NewHistogram(StringPiece /*name*/) {
+  return new SimpleStatsHistogram(thread_system_->NewMutex());
 }
 
 SimpleStats::Var* SimpleStats::NewVariable(StringPiece name) {
@@ -48,19 +133,331 @@ SimpleStats::UpDown* SimpleStats::NewUpDownCounter(StringPiece name) {
 }
 
 SimpleStatsVariable::SimpleStatsVariable(StringPiece name, Statistics* stats)
-    : value_(0) {}
+    : storage_(new char[(StatStripes::kNumStripes + 1) *
+                        StatStripes::kStripeBytes]),
+      stripes_(AlignToStripe(storage_.get())),
+      mutexed_scalar_(this) {
+  memset(stripes_, 0, StatStripes::kNumStripes * StatStripes::kStripeBytes);
+}
 
 SimpleStatsVariable::~SimpleStatsVariable() {
 }
 
-int64 SimpleStatsVariable::GetLockHeld() const {
-  return value_;
+int64 SimpleStatsVariable::Get() const {
+  return StatStripes::CounterSum(stripes_, StatStripes::kNumStripes);
+}
+
+void SimpleStatsVariable::IncBy(int64 delta) {
+  StatStripes::CounterAdd(stripes_, StatStripes::kNumStripes, delta);
+}
+
+int64 SimpleStatsVariable::AddHelper(int delta) {
+  StatStripes::CounterAdd(stripes_, StatStripes::kNumStripes, delta);
+  return Get();
+}
+
+void SimpleStatsVariable::Set(int64 value) {
+  SetReturningPreviousValue(value);
+}
+
+int64 SimpleStatsVariable::SetReturningPreviousValue(int64 value) {
+  if (mutex_.get() == NULL) {
+    return -1;
+  }
+  ScopedMutex hold_lock(mutex_.get());
+  return SetReturningPreviousValueLockHeld(value);
 }
 
 int64 SimpleStatsVariable::SetReturningPreviousValueLockHeld(int64 value) {
-  int64 previous_value = value_;
-  value_ = value;
-  return previous_value;
+  return StatStripes::CounterExchange(stripes_, StatStripes::kNumStripes,
+                                      value);
+}
+
+SimpleStatsHistogram::SimpleStatsHistogram(AbstractMutex* mutex)
+    : mutex_(mutex),
+      enable_negative_(false),
+      min_value_(0),
+      max_value_(kMaxValue),
+      num_buckets_(kDefaultNumBuckets + kOutOfBoundsCatcherBuckets),
+      stripe_bytes_(StripeBytes(num_buckets_)) {
+  for (int i = 0; i < StatStripes::kNumStripes; ++i) {
+    storage_[i] = NULL;
+  }
+}
+
+SimpleStatsHistogram::~SimpleStatsHistogram() {
+  FreeStripes();
+}
+
+volatile int64* SimpleStatsHistogram::Stripe(int index) const {
+  char* storage = storage_[index];
+  return (storage == NULL) ? NULL :
+      reinterpret_cast<volatile int64*>(AlignToStripe(storage));
+}
+
+volatile int64* SimpleStatsHistogram::MutableStripe(int index) {
+  volatile int64* stripe = Stripe(index);
+  if (stripe != NULL) {
+    return stripe;
+  }
+  // Several threads may get here at once for the same CPU; the first to
+  // install its stripe wins, and the rest use that one.
+  char* storage = new char[stripe_bytes_ + StatStripes::kStripeBytes];
+  stripe = reinterpret_cast<volatile int64*>(AlignToStripe(storage));
+  StoreDouble(stripe + kSumSlot, 0);
+  StoreDouble(stripe + kSumOfSquaresSlot, 0);
+  StoreDouble(stripe + kMinSlot, std::numeric_limits<double>::infinity());
+  StoreDouble(stripe + kMaxSlot, -std::numeric_limits<double>::infinity());
+  for (int j = 0; j < num_buckets_; ++j) {
+    stripe[kFirstBucketSlot + j] = 0;
+  }
+  if (!__sync_bool_compare_and_swap(&storage_[index],
+                                    static_cast<char*>(NULL), storage)) {
+    delete [] storage;
+  }
+  return Stripe(index);
+}
+
+void SimpleStatsHistogram::FreeStripes() {
+  for (int i = 0; i < StatStripes::kNumStripes; ++i) {
+    delete [] storage_[i];
+    storage_[i] = NULL;
+  }
+}
+
+void SimpleStatsHistogram::Add(double value) {
+  int index = FindBucket(value);
+  if (index < 0 || index >= num_buckets_) {
+    LOG(ERROR) << "Invalid bucket index found for" << value;
+    return;
+  }
+  volatile int64* stripe = MutableStripe(StatStripes::CurrentStripe());
+  StatStripes::AtomicAdd(stripe + kFirstBucketSlot + index, 1);
+  AddDouble(stripe + kSumSlot, value);
+  AddDouble(stripe + kSumOfSquaresSlot, value * value);
+  UpdateExtreme(stripe + kMinSlot, value, true);
+  UpdateExtreme(stripe + kMaxSlot, value, false);
+}
+
+void SimpleStatsHistogram::Clear() {
+  for (int i = 0; i < StatStripes::kNumStripes; ++i) {
+    volatile int64* stripe = Stripe(i);
+    if (stripe == NULL) {
+      continue;
+    }
+    StoreDouble(stripe + kSumSlot, 0);
+    StoreDouble(stripe + kSumOfSquaresSlot, 0);
+    StoreDouble(stripe + kMinSlot, std::numeric_limits<double>::infinity());
+    StoreDouble(stripe + kMaxSlot, -std::numeric_limits<double>::infinity());
+    for (int j = 0; j < num_buckets_; ++j) {
+      StatStripes::AtomicExchange(stripe + kFirstBucketSlot + j, 0);
+    }
+  }
+}
+
+void SimpleStatsHistogram::EnableNegativeBuckets() {
+  DCHECK_EQ(0, min_value_) << "Cannot call EnableNegativeBuckets and"
+                              "SetMinValue on the same histogram.";
+  ScopedMutex hold_lock(mutex_.get());
+  DCHECK_EQ(0, CountInternal()) << "EnableNegativeBuckets must be called "
+      "before any values are recorded.";
+  if (!enable_negative_) {
+    enable_negative_ = true;
+    Clear();
+  }
+}
+
+void SimpleStatsHistogram::SetMinValue(double value) {
+  DCHECK_EQ(false, enable_negative_) << "Cannot call"
+      "EnableNegativeBuckets and SetMinValue on the same histogram.";
+  DCHECK_LT(value, max_value_) << "Lower-bound of a histogram "
+      "should be smaller than its upper-bound.";
+  ScopedMutex hold_lock(mutex_.get());
+  DCHECK_EQ(0, CountInternal()) << "SetMinValue must be called before any "
+      "values are recorded.";
+  if (min_value_ != value) {
+    min_value_ = value;
+    Clear();
+  }
+}
+
+void SimpleStatsHistogram::SetMaxValue(double value) {
+  DCHECK_LT(0, value) << "Upper-bound of a histogram should be larger than 0.";
+  DCHECK_LT(min_value_, value) << "Upper-bound of a histogram should "
+      "be larger than its lower-bound.";
+  ScopedMutex hold_lock(mutex_.get());
+  DCHECK_EQ(0, CountInternal()) << "SetMaxValue must be called before any "
+      "values are recorded.";
+  if (max_value_ != value) {
+    max_value_ = value;
+    Clear();
+  }
+}
+
+void SimpleStatsHistogram::SetSuggestedNumBuckets(int i) {
+  DCHECK_GT(i, 0) << "Number of buckets should be larger than 0";
+  ScopedMutex hold_lock(mutex_.get());
+  DCHECK_EQ(0, CountInternal()) << "SetSuggestedNumBuckets must be called "
+      "before any values are recorded.";
+  if (num_buckets_ != i + kOutOfBoundsCatcherBuckets) {
+    num_buckets_ = i + kOutOfBoundsCatcherBuckets;
+    stripe_bytes_ = StripeBytes(num_buckets_);
+    FreeStripes();
+  }
+}
+
+int SimpleStatsHistogram::FindBucket(double value) {
+  // The catcher buckets come first and last; in between, as in
+  // SharedMemHistogram::FindBucket, we add 1 to skip the leftmost.
+  double lower_bound = enable_negative_ ? -max_value_ : min_value_;
+  if (value < lower_bound) {
+    return 0;
+  } else if (value >= max_value_) {
+    return num_buckets_ - 1;
+  } else if (enable_negative_ && value > 0) {
+    // Measure from the bucket containing 0, as value - lower_bound may
+    // overflow.
+    int index_zero = FindBucket(0);
+    return index_zero + (value - BucketStart(index_zero)) / BucketWidth();
+  }
+  return 1 + (value - lower_bound) / BucketWidth();
+}
+
+double SimpleStatsHistogram::BucketWidth() {
+  double range = enable_negative_ ? max_value_ * 2 : max_value_ - min_value_;
+  double bucket_width = range / (num_buckets_ - kOutOfBoundsCatcherBuckets);
+  DCHECK_NE(0, bucket_width);
+  return bucket_width;
+}
+
+int64 SimpleStatsHistogram::SumSlot(int slot) const {
+  int64 sum = 0;
+  for (int i = 0; i < StatStripes::kNumStripes; ++i) {
+    volatile int64* stripe = Stripe(i);
+    if (stripe != NULL) {
+      sum += StatStripes::AtomicLoad(stripe + slot);
+    }
+  }
+  return sum;
+}
+
+double SimpleStatsHistogram::SumDoubleSlot(int slot) const {
+  double sum = 0;
+  for (int i = 0; i < StatStripes::kNumStripes; ++i) {
+    volatile int64* stripe = Stripe(i);
+    if (stripe != NULL) {
+      sum += LoadDouble(stripe + slot);
+    }
+  }
+  return sum;
+}
+
+double SimpleStatsHistogram::AverageInternal() {
+  double count = CountInternal();
+  if (count == 0) {
+    return 0.0;
+  }
+  return SumDoubleSlot(kSumSlot) / count;
+}
+
+// Return estimated value that is larger than perc% of all data, just as
+// SharedMemHistogram::PercentileInternal does.
+double SimpleStatsHistogram::PercentileInternal(const double perc) {
+  double total = CountInternal();
+  if (total == 0 || perc < 0) {
+    return 0.0;
+  }
+  // Floor of count_below is the number of values below the percentile.
+  // We are indeed looking for the next value in histogram.
+  double count_below = floor(total * perc / 100);
+  double count = 0;
+  int i;
+  double bucket_count = 0;
+  for (i = 0; i < num_buckets_; ++i) {
+    bucket_count = BucketCount(i);
+    if (count + bucket_count <= count_below) {
+      count += bucket_count;
+      if (count == count_below) {
+        // The first number in (i+1)th bucket is the number we want. Its
+        // estimated value is the lower-bound of (i+1)th bucket.
+        return BucketStart(i + 1);
+      }
+    } else {
+      break;
+    }
+  }
+  // The (count_below + 1 - count)th number in bucket i is the number we want,
+  // but we can only estimate where it lies within the bucket.
+  double fraction = (count_below + 1 - count) / bucket_count;
+  double bound = std::min(BucketWidth(), MaximumInternal() - BucketStart(i));
+  return BucketStart(i) + fraction * bound;
+}
+
+double SimpleStatsHistogram::StandardDeviationInternal() {
+  double count = CountInternal();
+  if (count == 0) {
+    return 0.0;
+  }
+  double sum = SumDoubleSlot(kSumSlot);
+  double sum_of_squares = SumDoubleSlot(kSumOfSquaresSlot);
+  const double v = (sum_of_squares * count - sum * sum) / (count * count);
+  if (v < sum_of_squares * std::numeric_limits<double>::epsilon()) {
+    return 0.0;
+  }
+  return std::sqrt(v);
+}
+
+double SimpleStatsHistogram::CountInternal() {
+  int64 count = 0;
+  for (int i = 0; i < num_buckets_; ++i) {
+    count += SumSlot(kFirstBucketSlot + i);
+  }
+  return count;
+}
+
+double SimpleStatsHistogram::MaximumInternal() {
+  double max = -std::numeric_limits<double>::infinity();
+  for (int i = 0; i < StatStripes::kNumStripes; ++i) {
+    volatile int64* stripe = Stripe(i);
+    if (stripe != NULL) {
+      max = std::max(max, LoadDouble(stripe + kMaxSlot));
+    }
+  }
+  // As in SharedMemHistogram, an empty histogram's extremes are 0.
+  return (max == -std::numeric_limits<double>::infinity()) ? 0.0 : max;
+}
+
+double SimpleStatsHistogram::MinimumInternal() {
+  double min = std::numeric_limits<double>::infinity();
+  for (int i = 0; i < StatStripes::kNumStripes; ++i) {
+    volatile int64* stripe = Stripe(i);
+    if (stripe != NULL) {
+      min = std::min(min, LoadDouble(stripe + kMinSlot));
+    }
+  }
+  return (min == std::numeric_limits<double>::infinity()) ? 0.0 : min;
+}
+
+double SimpleStatsHistogram::BucketStart(int index) {
+  DCHECK(index >= 0 && index <= num_buckets_) <<
+      "Queried index is out of boundary.";
+  if (index == num_buckets_) {
+    // The outermost buckets catch everything out of range.
+    return std::numeric_limits<double>::infinity();
+  }
+  if (index == 0) {
+    return -std::numeric_limits<double>::infinity();
+  }
+  index -= 1;  // Skip over the left out-of-bounds catcher bucket.
+  double lower_bound = enable_negative_ ? -max_value_ : min_value_;
+  return lower_bound + index * BucketWidth();
+}
+
+double SimpleStatsHistogram::BucketCount(int index) {
+  if (index < 0 || index >= num_buckets_) {
+    return -1.0;
+  }
+  return SumSlot(kFirstBucketSlot + index);
 }
 
 }  // namespace net_instaweb
@@ -19,9 +19,12 @@
 #ifndef PAGESPEED_KERNEL_UTIL_SIMPLE_STATS_H_
 #define PAGESPEED_KERNEL_UTIL_SIMPLE_STATS_H_
 
+#include <cstddef>
+
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/stat_stripes.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/statistics_template.h"
 #include "pagespeed/kernel/base/string.h"
@@ -32,28 +35,135 @@ namespace net_instaweb {
 class AbstractMutex;
 class ThreadSystem;
 
-// These variables are thread-safe.
-class SimpleStatsVariable : public MutexedScalar {
+// These variables are thread-safe, and never block on Add: as with
+// SharedMemVariable, the value is spread over StatStripes::kNumStripes
+// cache lines, Add does an atomic add on the one for the current CPU, and
+// Get sums them all.  The mutex is only taken by Set and
+// SetReturningPreviousValue, and by StatisticsLogger.
+class SimpleStatsVariable {
  public:
   SimpleStatsVariable(StringPiece name, Statistics* stats);
-  virtual ~SimpleStatsVariable();
-  virtual StringPiece GetName() const { return StringPiece(NULL); }
+  ~SimpleStatsVariable();
+  StringPiece GetName() const { return StringPiece(NULL); }
 
   void set_mutex(AbstractMutex* mutex) { mutex_.reset(mutex); }
 
- protected:
-  virtual AbstractMutex* mutex() const { return mutex_.get(); }
-  virtual int64 GetLockHeld() const;
-  virtual int64 SetReturningPreviousValueLockHeld(int64 value);
+  // Get, IncBy and AddHelper do not take the mutex.  IncBy, which is what
+  // Variable::Add uses, only touches the current CPU's stripe.  AddHelper
+  // also returns the sum of the stripes right after the update, for
+  // UpDownCounter::Add; it may include concurrent updates from other threads.
+  int64 Get() const;
+  void IncBy(int64 delta);
+  int64 AddHelper(int delta);
+  void Set(int64 value);
+  int64 SetReturningPreviousValue(int64 value);
+
+  // The variable as StatisticsLogger wants it, to keep its timestamp in.
+  MutexedScalar* mutexed_scalar() { return &mutexed_scalar_; }
 
  private:
-  int64 value_;
+  // Presents the variable through the MutexedScalar interface.
+  class MutexedView : public MutexedScalar {
+   public:
+    explicit MutexedView(SimpleStatsVariable* var) : var_(var) {}
+    virtual ~MutexedView() {}
+
+   protected:
+    virtual AbstractMutex* mutex() const { return var_->mutex_.get(); }
+    virtual int64 GetLockHeld() const { return var_->Get(); }
+    virtual int64 SetReturningPreviousValueLockHeld(int64 value) {
+      return var_->SetReturningPreviousValueLockHeld(value);
+    }
+
+   private:
+    SimpleStatsVariable* var_;
+
+    DISALLOW_COPY_AND_ASSIGN(MutexedView);
+  };
+
+  int64 SetReturningPreviousValueLockHeld(int64 value);
+
+  scoped_array<char> storage_;  // stripes_, plus slack to line-align them.
+  char* stripes_;
   scoped_ptr<AbstractMutex> mutex_;
+  MutexedView mutexed_scalar_;
   DISALLOW_COPY_AND_ASSIGN(SimpleStatsVariable);
 };
 
+// A histogram whose Add never blocks either.  Each stripe has its own count,
+// sum, extremes and buckets, updated with atomic operations; the queries,
+// which are rare, take the mutex and merge the stripes.  Buckets are laid out
+// as in SharedMemHistogram.  With the default 500 buckets a stripe takes
+// about 4KB, so stripes are only allocated when a thread running on their
+// CPU first adds a value: a histogram that's rarely used stays small.
+//
+// The Set* and EnableNegativeBuckets methods must be called before any
+// value is recorded, and before the histogram is shared between threads.
+// Clear is safe at any time, though an Add racing with it may be partly lost.
+class SimpleStatsHistogram : public Histogram {
+ public:
+  // Takes ownership of mutex.
+  explicit SimpleStatsHistogram(AbstractMutex* mutex);
+  virtual ~SimpleStatsHistogram();
+
+  virtual void Add(double value);
+  virtual void Clear();
+  virtual int NumBuckets() { return num_buckets_; }
+  virtual void EnableNegativeBuckets();
+  virtual void SetMinValue(double value);
+  virtual void SetMaxValue(double value);
+  virtual void SetSuggestedNumBuckets(int i);
+
+ protected:
+  virtual AbstractMutex* lock() { return mutex_.get(); }
+  virtual double AverageInternal();
+  virtual double PercentileInternal(const double perc);
+  virtual double StandardDeviationInternal();
+  virtual double CountInternal();
+  virtual double MaximumInternal();
+  virtual double MinimumInternal();
+  virtual double BucketStart(int index);
+  virtual double BucketCount(int index);
+
+ private:
+  // Returns the stripe for index, allocating it if need be.
+  volatile int64* MutableStripe(int index);
+
+  // Frees all the stripes, so that they're allocated afresh for the current
+  // num_buckets_.
+  void FreeStripes();
+
+  // Returns the index of the bucket for value, including the catcher buckets
+  // for out-of-range values.
+  int FindBucket(double value);
+  double BucketWidth();
+
+  // Returns the stripe for index, or NULL if it hasn't been allocated.
+  volatile int64* Stripe(int index) const;
+
+  // Sums the given int64 slot, or the double stored in it, over all stripes.
+  int64 SumSlot(int slot) const;
+  double SumDoubleSlot(int slot) const;
+
+  scoped_ptr<AbstractMutex> mutex_;
+  bool enable_negative_;
+  double min_value_;  // Bounds of the in-range buckets.
+  double max_value_;
+  int num_buckets_;   // Including the two catcher buckets.
+  size_t stripe_bytes_;
+
+  // The storage for each stripe, or NULL until it's first needed.  Each is
+  // allocated with StatStripes::kStripeBytes of slack, so that the stripe
+  // can be aligned to a cache line.
+  char* volatile storage_[StatStripes::kNumStripes];
+
+  DISALLOW_COPY_AND_ASSIGN(SimpleStatsHistogram);
+};
+
 // Simple name/value pair statistics implementation.
-class SimpleStats : public ScalarStatisticsTemplate<SimpleStatsVariable> {
+class SimpleStats
+    : public ScalarStatisticsTemplate<SimpleStatsVariable,
+                                      SimpleStatsHistogram> {
  public:
   // SimpleStats will not take ownership of thread_system.  The thread system is
   // used to instantiate mutexes to allow SimpleStatsVariable to be thread-safe.
@@ -63,7 +173,7 @@ class SimpleStats : public ScalarStatisticsTemplate<SimpleStatsVariable> {
   void SetThreadSystem(ThreadSystem* x);
   ThreadSystem* thread_system() const { return thread_system_; }
 
-  virtual CountHistogram* NewHistogram(StringPiece name);
+  virtual SimpleStatsHistogram* NewHistogram(StringPiece name);
   virtual Var* NewVariable(StringPiece name);
   virtual UpDown* NewUpDownCounter(StringPiece name);
 
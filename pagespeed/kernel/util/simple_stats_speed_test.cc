@@ -0,0 +1,171 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//
+// Measures the cost of recording into SimpleStats variables and histograms,
+// from one thread and from several at once.  The Threaded benchmarks report
+// time per iteration, where each iteration has every thread do
+// kAddsPerThread adds to a shared variable and histogram.
+//
+// As with shared_mem_statistics_speed_test, these numbers are from a
+// single-CPU machine, so they show the uncontended cost only, where taking an
+// uncontended mutex is cheap.  Note also that the old SimpleStats histogram
+// only counted its values.
+//
+// Benchmark                 Time(ns)    CPU(ns) Iterations
+// --------------------------------------------------------
+// With mutexes:
+// BM_VariableAdd              20         19  100000000
+// BM_VariableGet              17         16  100000000
+// BM_HistogramAdd             12         11  100000000
+// BM_ThreadedAdd/1        541296     525666       1000
+// BM_ThreadedAdd/2       1077655    1050739       1000
+// BM_ThreadedAdd/4       2168676    2119330        100
+// BM_ThreadedAdd/8       4608745    4188216        100
+//
+// Striped:
+// BM_VariableAdd              25         24   10000000
+// BM_VariableGet              12         12  100000000
+// BM_HistogramAdd             31         30   10000000
+// BM_ThreadedAdd/1        605626     581933       1000
+// BM_ThreadedAdd/2       1217665    1148174       1000
+// BM_ThreadedAdd/4       2455639    2425306        100
+// BM_ThreadedAdd/8       5100456    4966548        100
+
+#include <vector>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/benchmark.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+
+namespace {
+
+const int kAddsPerThread = 10000;
+
+class StatsHolder {
+ public:
+  StatsHolder()
+      : thread_system_(net_instaweb::Platform::CreateThreadSystem()),
+        stats_(thread_system_.get()) {
+    variable_ = stats_.AddVariable("counter");
+    histogram_ = stats_.AddHistogram("histogram");
+    histogram_->SetMaxValue(1000);
+  }
+
+  net_instaweb::ThreadSystem* thread_system() { return thread_system_.get(); }
+  net_instaweb::Variable* variable() { return variable_; }
+  net_instaweb::Histogram* histogram() { return histogram_; }
+
+ private:
+  scoped_ptr<net_instaweb::ThreadSystem> thread_system_;
+  net_instaweb::SimpleStats stats_;
+  net_instaweb::Variable* variable_;
+  net_instaweb::Histogram* histogram_;
+
+  DISALLOW_COPY_AND_ASSIGN(StatsHolder);
+};
+
+class AddThread : public net_instaweb::ThreadSystem::Thread {
+ public:
+  explicit AddThread(StatsHolder* holder)
+      : Thread(holder->thread_system(), "add",
+               net_instaweb::ThreadSystem::kJoinable),
+        holder_(holder) {
+  }
+
+  virtual void Run() {
+    net_instaweb::Variable* variable = holder_->variable();
+    net_instaweb::Histogram* histogram = holder_->histogram();
+    for (int i = 0; i < kAddsPerThread; ++i) {
+      variable->Add(1);
+      histogram->Add(i % 1000);
+    }
+  }
+
+ private:
+  StatsHolder* holder_;
+
+  DISALLOW_COPY_AND_ASSIGN(AddThread);
+};
+
+static void BM_VariableAdd(int iters) {
+  StopBenchmarkTiming();
+  StatsHolder holder;
+  net_instaweb::Variable* variable = holder.variable();
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    variable->Add(1);
+  }
+  CHECK_EQ(iters, variable->Get());
+}
+
+static void BM_VariableGet(int iters) {
+  StopBenchmarkTiming();
+  StatsHolder holder;
+  net_instaweb::Variable* variable = holder.variable();
+  StartBenchmarkTiming();
+  int64 sum = 0;
+  for (int i = 0; i < iters; ++i) {
+    sum += variable->Get();
+  }
+  CHECK_EQ(0, sum);
+}
+
+static void BM_HistogramAdd(int iters) {
+  StopBenchmarkTiming();
+  StatsHolder holder;
+  net_instaweb::Histogram* histogram = holder.histogram();
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    histogram->Add(i % 1000);
+  }
+  CHECK_EQ(iters, histogram->Count());
+}
+
+static void BM_ThreadedAdd(int iters, int num_threads) {
+  StopBenchmarkTiming();
+  StatsHolder holder;
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    std::vector<AddThread*> threads;
+    for (int t = 0; t < num_threads; ++t) {
+      threads.push_back(new AddThread(&holder));
+    }
+    for (int t = 0; t < num_threads; ++t) {
+      CHECK(threads[t]->Start());
+    }
+    for (int t = 0; t < num_threads; ++t) {
+      threads[t]->Join();
+    }
+    STLDeleteElements(&threads);
+  }
+  CHECK_EQ(static_cast<int64>(iters) * num_threads * kAddsPerThread,
+           holder.variable()->Get());
+  CHECK_EQ(static_cast<double>(iters) * num_threads * kAddsPerThread,
+           holder.histogram()->Count());
+}
+
+}  // namespace
+
+BENCHMARK(BM_VariableAdd);
+BENCHMARK(BM_VariableGet);
+BENCHMARK(BM_HistogramAdd);
+BENCHMARK_RANGE(BM_ThreadedAdd, 1, 8);
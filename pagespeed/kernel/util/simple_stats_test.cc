@@ -5,8 +5,12 @@
 
 #include "pagespeed/kernel/util/simple_stats.h"
 
+#include <vector>
+
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/thread.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/thread_system.h"
@@ -73,4 +77,143 @@ TEST_F(SimpleStatsTest, TestSetReturningPrevious) {
   EXPECT_EQ(10, var->Get());
 }
 
+TEST_F(SimpleStatsTest, TestHistogram) {
+  Histogram* hist = stats_.AddHistogram("hist");
+  EXPECT_EQ(hist, stats_.FindHistogram("hist"));
+  hist->SetMaxValue(200);
+  EXPECT_TRUE(hist->Empty());
+  for (int i = 0; i <= 14; ++i) {
+    hist->Add(i);
+  }
+  EXPECT_EQ(15, hist->Count());
+  EXPECT_EQ(0, hist->Minimum());
+  EXPECT_EQ(14, hist->Maximum());
+  EXPECT_EQ(7, hist->Average());
+  EXPECT_NEAR(4.32049, hist->StandardDeviation(), 0.1);
+  EXPECT_NEAR(7, hist->Median(), 1);
+  EXPECT_NEAR(3, hist->Percentile(20), 1);
+
+  hist->Clear();
+  EXPECT_TRUE(hist->Empty());
+  EXPECT_EQ(0, hist->Maximum());
+  EXPECT_EQ(0, hist->Average());
+}
+
+TEST_F(SimpleStatsTest, TestHistogramExtremeBuckets) {
+  Histogram* hist = stats_.AddHistogram("hist");
+  hist->SetMaxValue(100);
+  hist->Add(0);
+  hist->Add(100);  // Out of range, so in the last bucket.
+  EXPECT_EQ(0, hist->BucketCount(0));
+  EXPECT_EQ(1, hist->BucketCount(1));
+  EXPECT_EQ(1, hist->BucketCount(hist->NumBuckets() - 1));
+  EXPECT_EQ(100, hist->Maximum());
+
+  hist->Clear();
+  hist->EnableNegativeBuckets();
+  EXPECT_TRUE(hist->Empty());
+  hist->Add(-101);
+  hist->Add(-5);
+  hist->Add(0);
+  hist->Add(5);
+  hist->Add(101);
+  EXPECT_EQ(1, hist->BucketCount(0));
+  EXPECT_EQ(1, hist->BucketCount(hist->NumBuckets() - 1));
+  EXPECT_EQ(5, hist->Count());
+  EXPECT_EQ(-101, hist->Minimum());
+  EXPECT_EQ(101, hist->Maximum());
+  EXPECT_EQ(-hist->BucketStart(1), hist->BucketStart(hist->NumBuckets() - 1));
+}
+
+TEST_F(SimpleStatsTest, TestHistogramNumBuckets) {
+  Histogram* hist = stats_.AddHistogram("hist");
+  hist->SetSuggestedNumBuckets(10);
+  hist->SetMaxValue(100);
+  EXPECT_EQ(12, hist->NumBuckets());  // Including the catcher buckets.
+  for (int i = 0; i < 100; ++i) {
+    hist->Add(i);
+  }
+  for (int i = 1; i <= 10; ++i) {
+    EXPECT_EQ(10, hist->BucketCount(i));
+    EXPECT_EQ((i - 1) * 10, hist->BucketStart(i));
+  }
+}
+
+TEST_F(SimpleStatsTest, TestHistogramShapeFixedOnceRecording) {
+  Histogram* hist = stats_.AddHistogram("hist");
+  hist->Add(1);
+  EXPECT_DEBUG_DEATH(hist->SetMaxValue(100), "before any values");
+  EXPECT_DEBUG_DEATH(hist->SetSuggestedNumBuckets(10), "before any values");
+}
+
+namespace {
+
+// Adds to a variable, an up/down counter and a histogram many times.
+class AddThread : public ThreadSystem::Thread {
+ public:
+  AddThread(ThreadSystem* thread_system, int num_adds, Variable* var,
+            UpDownCounter* up_down, Histogram* hist)
+      : ThreadSystem::Thread(thread_system, "simple_stats_add",
+                             ThreadSystem::kJoinable),
+        num_adds_(num_adds),
+        var_(var),
+        up_down_(up_down),
+        hist_(hist) {}
+
+  virtual void Run() {
+    for (int i = 0; i < num_adds_; ++i) {
+      var_->Add(1);
+      up_down_->Add((i % 2 == 0) ? 3 : -1);
+      hist_->Add(i % 10);
+    }
+  }
+
+ private:
+  int num_adds_;
+  Variable* var_;
+  UpDownCounter* up_down_;
+  Histogram* hist_;
+
+  DISALLOW_COPY_AND_ASSIGN(AddThread);
+};
+
+}  // namespace
+
+TEST_F(SimpleStatsTest, ConcurrentAddsAreNotLost) {
+  const int kNumThreads = 8;
+  const int kNumAdds = 20000;
+  Variable* var = stats_.AddVariable("var");
+  UpDownCounter* up_down = stats_.AddUpDownCounter("up_down");
+  Histogram* hist = stats_.AddHistogram("hist");
+  hist->SetMaxValue(10);
+  std::vector<AddThread*> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.push_back(new AddThread(thread_system_.get(), kNumAdds, var,
+                                    up_down, hist));
+    ASSERT_TRUE(threads.back()->Start());
+  }
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads[i]->Join();
+  }
+  STLDeleteElements(&threads);
+  EXPECT_EQ(kNumThreads * kNumAdds, var->Get());
+  EXPECT_EQ(kNumThreads * kNumAdds, up_down->Get());
+  EXPECT_EQ(kNumThreads * kNumAdds, hist->Count());
+  EXPECT_EQ(4.5, hist->Average());
+  EXPECT_EQ(0, hist->Minimum());
+  EXPECT_EQ(9, hist->Maximum());
+  EXPECT_EQ(kNumThreads * kNumAdds / 10, hist->BucketCount(1));
+}
+
+TEST_F(SimpleStatsTest, TestSetAfterAdds) {
+  UpDownCounter* var = stats_.AddUpDownCounter("c0");
+  var->Add(5);
+  var->Add(-2);
+  EXPECT_EQ(3, var->SetReturningPreviousValue(7));
+  var->Add(1);
+  EXPECT_EQ(8, var->Get());
+  var->Clear();
+  EXPECT_EQ(0, var->Get());
+}
+
 }  // namespace net_instaweb
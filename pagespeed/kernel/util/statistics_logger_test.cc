@@ -66,8 +66,8 @@ class StatisticsLoggerTest : public ::testing::Test {
         // statistics. There are integration tests in
         // SharedMemStatisticsTestBase which test those interactions.
         logger_(kLoggingIntervalMs, kMaxLogfileSizeKb, kStatsLogFile,
-                stats_.AddVariable(kTimestampVarName)->impl(), &handler_,
-                &stats_, &file_system_, &timer_) {
+                stats_.AddVariable(kTimestampVarName)->impl()->mutexed_scalar(),
+                &handler_, &stats_, &file_system_, &timer_) {
     logger_.InitStatsForTest();
     // Another non-logged statistics.
     stats_.AddVariable(kUnloggedVariable);
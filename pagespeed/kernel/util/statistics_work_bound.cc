@@ -28,23 +28,31 @@ StatisticsWorkBound::StatisticsWorkBound(UpDownCounter* counter, int bound)
 StatisticsWorkBound::~StatisticsWorkBound() { }
 
 bool StatisticsWorkBound::TryToWork() {
+  return TryToWorkUnits(1);
+}
+
+void StatisticsWorkBound::WorkComplete() {
+  WorkCompleteUnits(1);
+}
+
+bool StatisticsWorkBound::TryToWorkUnits(int units) {
   bool ok = true;
   if (counter_ != NULL) {
     // We conservatively increment, then test, and decrement on failure.  This
     // guarantees that two incrementors don't both get through when we're within
     // 1 of the bound, at the cost of occasionally rejecting them both.
-    counter_->Add(1);
-    ok = (counter_->Get() <= bound_);
+    int64 total = counter_->Add(units);
+    ok = (total <= bound_) || (total == units);
     if (!ok) {
-      counter_->Add(-1);
+      counter_->Add(-units);
     }
   }
   return ok;
 }
 
-void StatisticsWorkBound::WorkComplete() {
+void StatisticsWorkBound::WorkCompleteUnits(int units) {
   if (counter_ != NULL) {
-    counter_->Add(-1);
+    counter_->Add(-units);
   }
 }
 
@@ -39,6 +39,13 @@ class StatisticsWorkBound : public WorkBound {
 
   virtual bool TryToWork();
   virtual void WorkComplete();
+
+  // As above, for work which counts as 'units' against the bound rather than
+  // as 1, such as a number of bytes.  Work bigger than the whole bound gets
+  // through when nothing else is going on, as it otherwise never would.
+  bool TryToWorkUnits(int units);
+  void WorkCompleteUnits(int units);
+
  private:
   UpDownCounter* counter_;
   int bound_;
@@ -125,6 +125,28 @@ TEST_F(StatisticsWorkBoundTest, TestDistinctVar) {
   EXPECT_TRUE(bound1->TryToWork());
 }
 
+// Test work of varying size against a bound of 10.
+TEST_F(StatisticsWorkBoundTest, TestUnits) {
+  scoped_ptr<StatisticsWorkBound> bound1(MakeBound(var1_, 10));
+  scoped_ptr<StatisticsWorkBound> bound2(MakeBound(var1_, 10));
+  EXPECT_TRUE(bound1->TryToWorkUnits(6));
+  EXPECT_FALSE(bound2->TryToWorkUnits(5));
+  EXPECT_TRUE(bound2->TryToWorkUnits(4));
+  EXPECT_FALSE(bound1->TryToWork());
+  bound1->WorkCompleteUnits(6);
+  EXPECT_TRUE(bound1->TryToWork());
+  bound1->WorkComplete();
+  bound2->WorkCompleteUnits(4);
+  EXPECT_EQ(0, var1_->Get());
+
+  // Work bigger than the bound only gets through on its own.
+  EXPECT_TRUE(bound1->TryToWorkUnits(20));
+  EXPECT_FALSE(bound2->TryToWork());
+  bound1->WorkCompleteUnits(20);
+  EXPECT_TRUE(bound2->TryToWork());
+  EXPECT_FALSE(bound1->TryToWorkUnits(20));
+}
+
 }  // namespace
 
 }  // namespace net_instaweb
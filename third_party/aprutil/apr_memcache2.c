@@ -118,6 +118,28 @@ struct cache_server_query_t {
     apr_int32_t query_vec_count;
 };
 
+/** Server and pipelined commands for a multiple set */
+struct cache_server_multset_t {
+    apr_memcache2_server_t* ms;
+    apr_memcache2_conn_t* conn;
+    apr_status_t rv;
+    apr_size_t* value_indices;
+    apr_size_t value_count;
+    apr_size_t sent_count;
+    apr_size_t replied_count;
+    struct iovec* query_vec;
+    apr_int32_t query_vec_count;
+};
+
+/* Number of iovecs making up each pipelined set command. */
+#define MULT_SET_IOVECS_PER_VALUE 5
+
+/* Most sets sent to a server before reading back their replies.  Keeping
+ * the unread replies this short means they always fit in the socket
+ * buffers, so the server can't stall writing them while we stall writing
+ * more sets to it. */
+#define MULT_SET_WINDOW 64
+
 /* Default I/O timeout in microseconds. */
 #define MULT_GET_TIMEOUT 50000
 
@@ -174,6 +196,48 @@ apr_memcache2_find_server_hash(apr_memcache2_t *mc, const apr_uint32_t hash)
     }
 }
 
+/*
+ * Returns whether ms is live, first trying to revive it if it has been
+ * dead for a while.  *curtime caches the current time across calls, and
+ * should start out as 0.
+ */
+static int server_live_or_revived(apr_memcache2_t *mc,
+                                  apr_memcache2_server_t *ms,
+                                  apr_time_t *curtime)
+{
+    int live = 0;
+
+    if (ms->status == APR_MC_SERVER_LIVE) {
+        return 1;
+    }
+
+    if (*curtime == 0) {
+        *curtime = apr_time_now();
+    }
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(ms->lock);
+#endif
+    /* Try the the dead server, every 5 seconds, keeping the lock. */
+    if (*curtime - ms->btime >  apr_time_from_sec(5)) {
+        if (mc_version_ping_lock_held(ms) == APR_SUCCESS) {
+            ms->btime = *curtime;
+            make_server_live(mc, ms);
+            live = 1;
+        }
+    }
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(ms->lock);
+#endif
+    return live;
+}
+
+APU_DECLARE(int) apr_memcache2_server_is_live(apr_memcache2_t *mc,
+                                              apr_memcache2_server_t *ms)
+{
+    apr_time_t curtime = 0;
+    return server_live_or_revived(mc, ms, &curtime);
+}
+
 APU_DECLARE(apr_memcache2_server_t *)
 apr_memcache2_find_server_hash_default(void *baton, apr_memcache2_t *mc,
                                       const apr_uint32_t hash)
@@ -189,31 +253,9 @@ apr_memcache2_find_server_hash_default(void *baton, apr_memcache2_t *mc,
 
     do {
         ms = mc->live_servers[h % mc->ntotal];
-        if(ms->status == APR_MC_SERVER_LIVE) {
+        if (server_live_or_revived(mc, ms, &curtime)) {
             break;
         }
-        else {
-            if (curtime == 0) {
-                curtime = apr_time_now();
-            }
-#if APR_HAS_THREADS
-            apr_thread_mutex_lock(ms->lock);
-#endif
-            /* Try the the dead server, every 5 seconds, keeping the lock. */
-            if (curtime - ms->btime >  apr_time_from_sec(5)) {
-                if (mc_version_ping_lock_held(ms) == APR_SUCCESS) {
-                    ms->btime = curtime;
-                    make_server_live(mc, ms);
-#if APR_HAS_THREADS
-                    apr_thread_mutex_unlock(ms->lock);
-#endif
-                    break;
-                }
-            }
-#if APR_HAS_THREADS
-            apr_thread_mutex_unlock(ms->lock);
-#endif
-        }
         h++;
         i++;
     } while(i < mc->ntotal);
@@ -717,17 +759,16 @@ static apr_status_t sendv_and_get_server_line_with_timeout(
     return rv;
 }
 
-static apr_status_t storage_cmd_write(apr_memcache2_t *mc,
-                                      const char *cmd,
-                                      const apr_size_t cmd_size,
-                                      const char *key,
-                                      char *data,
-                                      const apr_size_t data_size,
-                                      apr_uint32_t timeout,
-                                      apr_uint16_t flags)
+static apr_status_t storage_cmd_write_server(apr_memcache2_t *mc,
+                                             apr_memcache2_server_t *ms,
+                                             const char *cmd,
+                                             const apr_size_t cmd_size,
+                                             const char *key,
+                                             char *data,
+                                             const apr_size_t data_size,
+                                             apr_uint32_t timeout,
+                                             apr_uint16_t flags)
 {
-    apr_uint32_t hash;
-    apr_memcache2_server_t *ms;
     apr_memcache2_conn_t *conn;
     apr_status_t rv;
     struct iovec vec[5];
@@ -735,13 +776,6 @@ static apr_status_t storage_cmd_write(apr_memcache2_t *mc,
 
     apr_size_t key_size = strlen(key);
 
-    hash = apr_memcache2_hash(mc, key, key_size);
-
-    ms = apr_memcache2_find_server_hash(mc, hash);
-
-    if (ms == NULL)
-        return APR_NOTFOUND;
-
     rv = ms_find_conn(ms, &conn);
 
     if (rv != APR_SUCCESS) {
@@ -790,6 +824,29 @@ static apr_status_t storage_cmd_write(apr_memcache2_t *mc,
     return rv;
 }
 
+static apr_status_t storage_cmd_write(apr_memcache2_t *mc,
+                                      const char *cmd,
+                                      const apr_size_t cmd_size,
+                                      const char *key,
+                                      char *data,
+                                      const apr_size_t data_size,
+                                      apr_uint32_t timeout,
+                                      apr_uint16_t flags)
+{
+    apr_uint32_t hash;
+    apr_memcache2_server_t *ms;
+
+    hash = apr_memcache2_hash(mc, key, strlen(key));
+
+    ms = apr_memcache2_find_server_hash(mc, hash);
+
+    if (ms == NULL)
+        return APR_NOTFOUND;
+
+    return storage_cmd_write_server(mc, ms, cmd, cmd_size, key,
+                                    data, data_size, timeout, flags);
+}
+
 APU_DECLARE(apr_status_t)
 apr_memcache2_set(apr_memcache2_t *mc,
                  const char *key,
@@ -805,6 +862,22 @@ apr_memcache2_set(apr_memcache2_t *mc,
                            timeout, flags);
 }
 
+APU_DECLARE(apr_status_t)
+apr_memcache2_set_server(apr_memcache2_t *mc,
+                         apr_memcache2_server_t *ms,
+                         const char *key,
+                         char *data,
+                         const apr_size_t data_size,
+                         apr_uint32_t timeout,
+                         apr_uint16_t flags)
+{
+    return storage_cmd_write_server(mc, ms,
+                                    MC_SET, MC_SET_LEN,
+                                    key,
+                                    data, data_size,
+                                    timeout, flags);
+}
+
 APU_DECLARE(apr_status_t)
 apr_memcache2_add(apr_memcache2_t *mc,
                  const char *key,
@@ -836,6 +909,237 @@ apr_memcache2_replace(apr_memcache2_t *mc,
 
 }
 
+/*
+ * Sets the status of the values sent to a server whose connection failed.
+ */
+static void mset_conn_failed(struct cache_server_multset_t *server_set,
+                             apr_memcache2_value_t *values,
+                             apr_size_t first,
+                             apr_status_t rv)
+{
+    apr_size_t j;
+
+    server_set->conn = NULL;
+    server_set->rv = rv;
+    for (j = first; j < server_set->value_count; j++) {
+        values[server_set->value_indices[j]].status = rv;
+    }
+}
+
+APU_DECLARE(apr_status_t)
+apr_memcache2_multset(apr_memcache2_t *mc,
+                     apr_pool_t *temp_pool,
+                     apr_memcache2_value_t *values,
+                     apr_memcache2_server_t **servers,
+                     apr_size_t nvalues,
+                     apr_uint32_t timeout)
+{
+    apr_status_t rv;
+    apr_memcache2_server_t* ms;
+    apr_memcache2_conn_t* conn;
+    apr_uint32_t hash;
+    apr_size_t written;
+    apr_size_t i, j, end;
+    apr_size_t nservers = 0;
+    apr_int32_t k, end_vec;
+    int more;
+    struct cache_server_multset_t* server_sets;
+    struct cache_server_multset_t* server_set;
+    apr_size_t* value_server;
+
+    if (nvalues == 0) {
+        return APR_SUCCESS;
+    }
+
+    /* There are at most as many servers as values. */
+    server_sets = apr_pcalloc(temp_pool,
+                              nvalues * sizeof(struct cache_server_multset_t));
+    value_server = apr_palloc(temp_pool, nvalues * sizeof(apr_size_t));
+
+    /* find the server, and a connection to it, for every value */
+    for (i = 0; i < nvalues; i++) {
+        value_server[i] = nvalues;  /* no server */
+        if (servers != NULL) {
+            ms = servers[i];
+        }
+        else {
+            hash = apr_memcache2_hash(mc, values[i].key,
+                                      strlen(values[i].key));
+            ms = apr_memcache2_find_server_hash(mc, hash);
+        }
+        if (ms == NULL) {
+            values[i].status = APR_NOTFOUND;
+            continue;
+        }
+
+        for (j = 0; j < nservers && server_sets[j].ms != ms; j++) {
+        }
+        if (j == nservers) {
+            server_sets[j].ms = ms;
+            server_sets[j].rv = ms_find_conn(ms, &server_sets[j].conn);
+            if (server_sets[j].rv != APR_SUCCESS) {
+                apr_memcache2_disable_server(mc, ms);
+                server_sets[j].conn = NULL;
+            }
+            nservers++;
+        }
+        if (server_sets[j].conn == NULL) {
+            values[i].status = server_sets[j].rv;
+            continue;
+        }
+        value_server[i] = j;
+        server_sets[j].value_count++;
+    }
+
+    /* build each server's pipeline of
+     * set <key> <flags> <exptime> <bytes>\r\n<data>\r\n
+     * commands, keeping track of which value each reply will be for */
+    for (j = 0; j < nservers; j++) {
+        server_set = &server_sets[j];
+        server_set->value_indices =
+            apr_palloc(temp_pool, server_set->value_count * sizeof(apr_size_t));
+        server_set->query_vec =
+            apr_palloc(temp_pool, (server_set->value_count *
+                                   MULT_SET_IOVECS_PER_VALUE *
+                                   sizeof(struct iovec)));
+        server_set->value_count = 0;
+        server_set->query_vec_count = 0;
+    }
+    for (i = 0; i < nvalues; i++) {
+        if (value_server[i] == nvalues) {
+            continue;
+        }
+        server_set = &server_sets[value_server[i]];
+        server_set->value_indices[server_set->value_count++] = i;
+        values[i].status = APR_EGENERAL;  /* until we hear back */
+
+        k = server_set->query_vec_count;
+        server_set->query_vec[k].iov_base = (char*) MC_SET;
+        server_set->query_vec[k].iov_len  = MC_SET_LEN;
+        k++;
+
+        server_set->query_vec[k].iov_base = (void*) values[i].key;
+        server_set->query_vec[k].iov_len  = strlen(values[i].key);
+        k++;
+
+        server_set->query_vec[k].iov_base =
+            apr_psprintf(temp_pool, " %u %u %" APR_SIZE_T_FMT " " MC_EOL,
+                         values[i].flags, timeout, values[i].len);
+        server_set->query_vec[k].iov_len =
+            strlen(server_set->query_vec[k].iov_base);
+        k++;
+
+        server_set->query_vec[k].iov_base = values[i].data;
+        server_set->query_vec[k].iov_len  = values[i].len;
+        k++;
+
+        server_set->query_vec[k].iov_base = (char*) MC_EOL;
+        server_set->query_vec[k].iov_len  = MC_EOL_LEN;
+        k++;
+
+        server_set->query_vec_count = k;
+    }
+
+    /* Send a window of each pipeline to every server, then read back the
+     * replies to those windows, until all the sets are done.  Every server
+     * gets its window before any replies are read, so they work on them in
+     * parallel. */
+    do {
+        more = 0;
+        for (j = 0; j < nservers; j++) {
+            server_set = &server_sets[j];
+            conn = server_set->conn;
+            if (conn == NULL ||
+                server_set->sent_count == server_set->value_count) {
+                continue;
+            }
+
+            end = server_set->sent_count + MULT_SET_WINDOW;
+            if (end > server_set->value_count) {
+                end = server_set->value_count;
+            }
+            end_vec = end * MULT_SET_IOVECS_PER_VALUE;
+            for (k = server_set->sent_count * MULT_SET_IOVECS_PER_VALUE,
+                     rv = APR_SUCCESS;
+                 k < end_vec && rv == APR_SUCCESS;
+                 k += APR_MAX_IOVEC_SIZE) {
+                rv = apr_socket_sendv(
+                    conn->sock, &(server_set->query_vec[k]),
+                    end_vec - k > APR_MAX_IOVEC_SIZE ?
+                        APR_MAX_IOVEC_SIZE : end_vec - k,
+                    &written);
+            }
+
+            if (rv != APR_SUCCESS) {
+                disable_server_and_connection(server_set->ms, LOCK_NOT_HELD,
+                                              conn);
+                mset_conn_failed(server_set, values,
+                                 server_set->replied_count, rv);
+                continue;
+            }
+            server_set->sent_count = end;
+        }
+
+        for (j = 0; j < nservers; j++) {
+            server_set = &server_sets[j];
+            ms = server_set->ms;
+            conn = server_set->conn;
+            if (conn == NULL ||
+                server_set->replied_count == server_set->sent_count) {
+                continue;
+            }
+
+            rv = poll_server_releasing_connection_on_failure(ms, LOCK_NOT_HELD,
+                                                             conn);
+            if (rv != APR_SUCCESS) {
+                mset_conn_failed(server_set, values,
+                                 server_set->replied_count, rv);
+                continue;
+            }
+
+            for (i = server_set->replied_count; i < server_set->sent_count;
+                 i++) {
+                rv = get_server_line(conn);
+                if (rv != APR_SUCCESS) {
+                    disable_server_and_connection(ms, LOCK_NOT_HELD, conn);
+                    mset_conn_failed(server_set, values, i, rv);
+                    break;
+                }
+
+                if (strcmp(conn->buffer, MS_STORED MC_EOL) == 0) {
+                    rv = APR_SUCCESS;
+                }
+                else if (strcmp(conn->buffer, MS_NOT_STORED MC_EOL) == 0) {
+                    rv = APR_EEXIST;
+                }
+                else {
+                    rv = APR_EGENERAL;
+                }
+                values[server_set->value_indices[i]].status = rv;
+            }
+            if (server_set->conn == NULL) {
+                continue;
+            }
+            server_set->replied_count = server_set->sent_count;
+
+            if (server_set->sent_count < server_set->value_count) {
+                more = 1;
+            }
+            else {
+                ms_release_conn(ms, conn);
+                server_set->conn = NULL;
+            }
+        }
+    } while (more);
+
+    for (i = 0; i < nvalues; i++) {
+        if (values[i].status != APR_SUCCESS) {
+            return values[i].status;
+        }
+    }
+    return APR_SUCCESS;
+}
+
 /*
  * Parses a decimal size from size_str, returning the value in *size.
  * Returns 1 if parsing was successful, 0 if parsing failed.
@@ -860,38 +1164,63 @@ apr_memcache2_getp(apr_memcache2_t *mc,
                   apr_size_t *new_length,
                   apr_uint16_t *flags_)
 {
-    apr_status_t rv;
     apr_memcache2_server_t *ms;
-    apr_memcache2_conn_t *conn;
     apr_uint32_t hash;
-    apr_size_t klen = strlen(key);
-    struct iovec vec[3];
 
-    hash = apr_memcache2_hash(mc, key, klen);
+    hash = apr_memcache2_hash(mc, key, strlen(key));
     ms = apr_memcache2_find_server_hash(mc, hash);
     if (ms == NULL)
         return APR_NOTFOUND;
 
-    rv = ms_find_conn(ms, &conn);
+    return apr_memcache2_getp_server(mc, ms, p, key, baton, new_length,
+                                     flags_);
+}
 
-    if (rv != APR_SUCCESS) {
-        apr_memcache2_disable_server(mc, ms);
-        return rv;
-    }
+/*
+ * Sends a get for key on conn.  On failure the connection is invalidated
+ * and the server marked dead.
+ */
+static apr_status_t send_get(apr_memcache2_server_t *ms,
+                             apr_memcache2_conn_t *conn,
+                             const char *key)
+{
+    apr_size_t written;
+    struct iovec vec[3];
+    apr_status_t rv;
 
     /* get <key>[ <key>[...]]\r\n */
     vec[0].iov_base = (char*) MC_GET;
     vec[0].iov_len  = MC_GET_LEN;
 
     vec[1].iov_base = (void*)key;
-    vec[1].iov_len  = klen;
+    vec[1].iov_len  = strlen(key);
 
     vec[2].iov_base = (char*) MC_EOL;
     vec[2].iov_len  = MC_EOL_LEN;
 
-    rv = sendv_and_get_server_line_with_timeout(ms, conn, vec, 3,
-                                                LOCK_NOT_HELD);
+    rv = apr_socket_sendv(conn->sock, vec, 3, &written);
+    if (rv != APR_SUCCESS) {
+        disable_server_and_connection(ms, LOCK_NOT_HELD, conn);
+    }
+    return rv;
+}
+
+/*
+ * Reads the reply to a get sent with send_get, once conn is readable, and
+ * releases the connection (or, on failure, invalidates it and marks the
+ * server dead).
+ */
+static apr_status_t read_get_reply(apr_memcache2_t *mc,
+                                   apr_memcache2_server_t *ms,
+                                   apr_memcache2_conn_t *conn,
+                                   apr_pool_t *p,
+                                   char **baton,
+                                   apr_size_t *new_length,
+                                   apr_uint16_t *flags_)
+{
+    apr_status_t rv = get_server_line(conn);
     if (rv != APR_SUCCESS) {
+        disable_server_and_connection(ms, LOCK_NOT_HELD, conn);
         return rv;
     }
 
@@ -973,23 +1302,190 @@ apr_memcache2_getp(apr_memcache2_t *mc,
     return rv;
 }
 
+/*
+ * Waits for the reply to a get sent with send_get, for up to the client's
+ * timeout, and reads it.
+ */
+static apr_status_t wait_for_get_reply(apr_memcache2_t *mc,
+                                       apr_memcache2_server_t *ms,
+                                       apr_memcache2_conn_t *conn,
+                                       apr_pool_t *p,
+                                       char **baton,
+                                       apr_size_t *new_length,
+                                       apr_uint16_t *flags_)
+{
+    apr_status_t rv = poll_server_releasing_connection_on_failure(
+        ms, LOCK_NOT_HELD, conn);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    return read_get_reply(mc, ms, conn, p, baton, new_length, flags_);
+}
+
+APU_DECLARE(apr_status_t)
+apr_memcache2_getp_server(apr_memcache2_t *mc,
+                          apr_memcache2_server_t *ms,
+                          apr_pool_t *p,
+                          const char *key,
+                          char **baton,
+                          apr_size_t *new_length,
+                          apr_uint16_t *flags_)
+{
+    apr_status_t rv;
+    apr_memcache2_conn_t *conn;
+
+    rv = ms_find_conn(ms, &conn);
+
+    if (rv != APR_SUCCESS) {
+        apr_memcache2_disable_server(mc, ms);
+        return rv;
+    }
+
+    rv = send_get(ms, conn, key);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    return wait_for_get_reply(mc, ms, conn, p, baton, new_length, flags_);
+}
+
+APU_DECLARE(apr_status_t)
+apr_memcache2_getp_hedged(apr_memcache2_t *mc,
+                          apr_memcache2_server_t *ms,
+                          apr_memcache2_server_t *backup,
+                          apr_interval_time_t hedge_delay,
+                          apr_pool_t *p,
+                          const char *key,
+                          char **baton,
+                          apr_size_t *new_length,
+                          apr_uint16_t *flags_,
+                          int *hedged)
+{
+    apr_status_t rv;
+    apr_memcache2_conn_t *conn;
+    apr_memcache2_conn_t *backup_conn;
+    apr_memcache2_conn_t *first_conn;
+    apr_memcache2_conn_t *second_conn;
+    apr_memcache2_server_t *first_ms;
+    apr_memcache2_server_t *second_ms;
+    apr_pollset_t *pollset;
+    apr_pollfd_t pollfds[2];
+    apr_int32_t queries_recvd;
+    const apr_pollfd_t *activefds;
+    int i;
+
+    *hedged = FALSE;
+    rv = ms_find_conn(ms, &conn);
+    if (rv != APR_SUCCESS) {
+        apr_memcache2_disable_server(mc, ms);
+        return apr_memcache2_getp_server(mc, backup, p, key, baton,
+                                         new_length, flags_);
+    }
+    rv = send_get(ms, conn, key);
+    if (rv != APR_SUCCESS) {
+        return apr_memcache2_getp_server(mc, backup, p, key, baton,
+                                         new_length, flags_);
+    }
+
+    /* Most replies come well within hedge_delay, and then this is no
+     * different from apr_memcache2_getp_server. */
+    rv = apr_pollset_poll(conn->pollset, hedge_delay, &queries_recvd,
+                          &activefds);
+    if (rv == APR_SUCCESS) {
+        return read_get_reply(mc, ms, conn, p, baton, new_length, flags_);
+    }
+    if (!APR_STATUS_IS_TIMEUP(rv)) {
+        disable_server_and_connection(ms, LOCK_NOT_HELD, conn);
+        return apr_memcache2_getp_server(mc, backup, p, key, baton,
+                                         new_length, flags_);
+    }
+
+    /* ms is slow: ask backup as well, and take whichever answers first.  If
+     * backup can't be asked, all we can do is keep waiting for ms. */
+    *hedged = TRUE;
+    rv = ms_find_conn(backup, &backup_conn);
+    if (rv != APR_SUCCESS) {
+        apr_memcache2_disable_server(mc, backup);
+        return wait_for_get_reply(mc, ms, conn, p, baton, new_length, flags_);
+    }
+    rv = send_get(backup, backup_conn, key);
+    if (rv != APR_SUCCESS) {
+        return wait_for_get_reply(mc, ms, conn, p, baton, new_length, flags_);
+    }
+    rv = apr_pollset_create(&pollset, 2, p, 0);
+    if (rv != APR_SUCCESS) {
+        ms_bad_conn(backup, backup_conn);
+        return wait_for_get_reply(mc, ms, conn, p, baton, new_length, flags_);
+    }
+    for (i = 0; i < 2; ++i) {
+        pollfds[i].desc_type = APR_POLL_SOCKET;
+        pollfds[i].reqevents = APR_POLLIN;
+        pollfds[i].p = p;
+        pollfds[i].desc.s = (i == 0) ? conn->sock : backup_conn->sock;
+        pollfds[i].client_data = (i == 0) ? conn : backup_conn;
+        apr_pollset_add(pollset, &pollfds[i]);
+    }
+    rv = apr_pollset_poll(pollset, mc->timeout_microseconds, &queries_recvd,
+                          &activefds);
+    if (rv != APR_SUCCESS) {
+        apr_pollset_destroy(pollset);
+        disable_server_and_connection(ms, LOCK_NOT_HELD, conn);
+        disable_server_and_connection(backup, LOCK_NOT_HELD, backup_conn);
+        return rv;
+    }
+    first_conn = activefds[0].client_data;
+    apr_pollset_destroy(pollset);
+    if (first_conn == conn) {
+        first_ms = ms;
+        second_ms = backup;
+        second_conn = backup_conn;
+    } else {
+        first_ms = backup;
+        second_ms = ms;
+        second_conn = conn;
+    }
+
+    rv = read_get_reply(mc, first_ms, first_conn, p, baton, new_length,
+                        flags_);
+    if ((rv == APR_SUCCESS) || (rv == APR_NOTFOUND)) {
+        /* The other reply, if it ever comes, would be taken for the reply to
+         * the next command on its connection, so drop that connection.  Its
+         * server isn't marked dead, though: it was only slower. */
+        ms_bad_conn(second_ms, second_conn);
+        return rv;
+    }
+    /* The first reply was bad, but the other server may yet answer. */
+    return wait_for_get_reply(mc, second_ms, second_conn, p, baton,
+                              new_length, flags_);
+}
+
 APU_DECLARE(apr_status_t)
 apr_memcache2_delete(apr_memcache2_t *mc,
                     const char *key,
                     apr_uint32_t timeout)
 {
-    apr_status_t rv;
     apr_memcache2_server_t *ms;
-    apr_memcache2_conn_t *conn;
     apr_uint32_t hash;
-    struct iovec vec[3];
-    apr_size_t klen = strlen(key);
 
-    hash = apr_memcache2_hash(mc, key, klen);
+    hash = apr_memcache2_hash(mc, key, strlen(key));
     ms = apr_memcache2_find_server_hash(mc, hash);
     if (ms == NULL)
         return APR_NOTFOUND;
 
+    return apr_memcache2_delete_server(mc, ms, key, timeout);
+}
+
+APU_DECLARE(apr_status_t)
+apr_memcache2_delete_server(apr_memcache2_t *mc,
+                            apr_memcache2_server_t *ms,
+                            const char *key,
+                            apr_uint32_t timeout)
+{
+    apr_status_t rv;
+    apr_memcache2_conn_t *conn;
+    struct iovec vec[3];
+    apr_size_t klen = strlen(key);
+
     rv = ms_find_conn(ms, &conn);
 
     if (rv != APR_SUCCESS) {
@@ -162,6 +162,17 @@ APU_DECLARE(apr_memcache2_server_t *) apr_memcache2_find_server_hash_default(voi
                                                                            apr_memcache2_t *mc,
                                                                            const apr_uint32_t hash);
 
+/**
+ * Checks whether a server is live, first trying to revive it if it has
+ * been marked dead for long enough, as server selection does.  This lets a
+ * custom server_func skip dead servers.
+ * @param mc The memcache client object to use
+ * @param ms Server to check
+ * @return non-zero if the server is live
+ */
+APU_DECLARE(int) apr_memcache2_server_is_live(apr_memcache2_t *mc,
+                                              apr_memcache2_server_t *ms);
+
 /**
  * Adds a server to a client object
  * @param mc The memcache client object to use
@@ -252,6 +263,57 @@ APU_DECLARE(apr_status_t) apr_memcache2_getp(apr_memcache2_t *mc,
                                             apr_size_t *len,
                                             apr_uint16_t *flags);
 
+/**
+ * Gets a value from a specific server, rather than the one the key hashes
+ * to, e.g. to read a replica
+ * @param mc client to use
+ * @param ms server to read from
+ * @param p Pool to use
+ * @param key null terminated string containing the key
+ * @param baton location of the allocated value
+ * @param len   length of data at baton
+ * @param flags any flags set by the client for this key
+ * @return
+ */
+APU_DECLARE(apr_status_t) apr_memcache2_getp_server(apr_memcache2_t *mc,
+                                                   apr_memcache2_server_t *ms,
+                                                   apr_pool_t *p,
+                                                   const char* key,
+                                                   char **baton,
+                                                   apr_size_t *len,
+                                                   apr_uint16_t *flags);
+
+/**
+ * Gets a value from server ms, but if ms has not answered after
+ * hedge_delay, also asks backup, which should hold a replica of the value,
+ * and returns whichever reply comes first.  The connection the other reply
+ * would come in on is closed, but its server is not marked dead unless it
+ * fails or times out.  If ms can't be asked at all, this reads from backup.
+ * @param mc client to use
+ * @param ms server to read from
+ * @param backup server to also read from if ms is slow
+ * @param hedge_delay how long to wait for ms before asking backup, in
+ *        microseconds
+ * @param p Pool to use
+ * @param key null terminated string containing the key
+ * @param baton location of the allocated value
+ * @param len   length of data at baton
+ * @param flags any flags set by the client for this key
+ * @param hedged set to whether backup was asked because ms was slow
+ * @return
+ */
+APU_DECLARE(apr_status_t) apr_memcache2_getp_hedged(
+    apr_memcache2_t *mc,
+    apr_memcache2_server_t *ms,
+    apr_memcache2_server_t *backup,
+    apr_interval_time_t hedge_delay,
+    apr_pool_t *p,
+    const char* key,
+    char **baton,
+    apr_size_t *len,
+    apr_uint16_t *flags,
+    int *hedged);
+
 
 /**
  * Add a key to a hash for a multiget query
@@ -296,6 +358,25 @@ APU_DECLARE(apr_status_t) apr_memcache2_set(apr_memcache2_t *mc,
                                            apr_uint32_t timeout,
                                            apr_uint16_t flags);
 
+/**
+ * Sets a value by key on a specific server, rather than the one the key
+ * hashes to, e.g. to write a replica
+ * @param mc client to use
+ * @param ms server to store the value on
+ * @param key   null terminated string containing the key
+ * @param baton data to store on the server
+ * @param data_size   length of data at baton
+ * @param timeout time in seconds for the data to live on the server
+ * @param flags any flags set by the client for this key
+ */
+APU_DECLARE(apr_status_t) apr_memcache2_set_server(apr_memcache2_t *mc,
+                                                  apr_memcache2_server_t *ms,
+                                                  const char *key,
+                                                  char *baton,
+                                                  const apr_size_t data_size,
+                                                  apr_uint32_t timeout,
+                                                  apr_uint16_t flags);
+
 /**
  * Adds value by key on the server
  * @param mc client to use
@@ -331,6 +412,31 @@ APU_DECLARE(apr_status_t) apr_memcache2_replace(apr_memcache2_t *mc,
                                                const apr_size_t data_size,
                                                apr_uint32_t timeout,
                                                apr_uint16_t flags);
+/**
+ * Sets multiple values on the servers, pipelining all the sets for each
+ * server so that the whole batch costs a single round trip.
+ * @param mc client to use
+ * @param temp_pool Pool used for temporary allocations.
+ * @param values array of nvalues values to store, each with its key,
+ *        data, len and flags set.  The status of each is set to the result
+ *        of its set: APR_SUCCESS, APR_EEXIST if the server did not store
+ *        it, or the error that kept it from being stored.
+ * @param servers if non-NULL, array of nvalues servers naming the server
+ *        to store each value on, which lets a value be stored on more than
+ *        one server.  If NULL, each value's server is found from the hash
+ *        of its key.
+ * @param nvalues number of values
+ * @param timeout time in seconds for the data to live on the server
+ * @return APR_SUCCESS if all the values were stored, otherwise the status
+ *         of the first value that was not.
+ */
+APU_DECLARE(apr_status_t) apr_memcache2_multset(apr_memcache2_t *mc,
+                                               apr_pool_t *temp_pool,
+                                               apr_memcache2_value_t *values,
+                                               apr_memcache2_server_t **servers,
+                                               apr_size_t nvalues,
+                                               apr_uint32_t timeout);
+
 /**
  * Deletes a key from a server
  * @param mc client to use
@@ -341,6 +447,19 @@ APU_DECLARE(apr_status_t) apr_memcache2_delete(apr_memcache2_t *mc,
                                               const char *key,
                                               apr_uint32_t timeout);
 
+/**
+ * Deletes a key from a specific server, rather than the one the key hashes
+ * to, e.g. to delete a replica
+ * @param mc client to use
+ * @param ms server to delete the key from
+ * @param key   null terminated string containing the key
+ * @param timeout time for the delete to stop other clients from adding
+ */
+APU_DECLARE(apr_status_t) apr_memcache2_delete_server(apr_memcache2_t *mc,
+                                                     apr_memcache2_server_t *ms,
+                                                     const char *key,
+                                                     apr_uint32_t timeout);
+
 /**
  * Increments a value
  * @param mc client to use